@@ -69,24 +69,59 @@ namespace
         { (uint32_t)PTGBuffer::SamplePattern::Halton, "Halton" },
         { (uint32_t)PTGBuffer::SamplePattern::Stratified, "Stratified" },
     };
+
+    // Scripting options.
+    const char kRecursionDepth[] = "recursionDepth";
+    const char kSpecRoughCutoff[] = "specRoughCutoff";
+    const char kEmissiveCutoff[] = "emissiveCutoff";
+    const char kSamplePattern[] = "samplePattern";
+    const char kSampleCount[] = "sampleCount";
 }
 
 PTGBuffer::SharedPtr PTGBuffer::create(RenderContext* pRenderContext, const Dictionary& dict)
 {
-    SharedPtr pPass = SharedPtr(new PTGBuffer);
+    SharedPtr pPass = SharedPtr(new PTGBuffer(dict));
     return pPass;
 }
 
-PTGBuffer::PTGBuffer()
+PTGBuffer::PTGBuffer(const Dictionary& dict)
     : RenderPass(kInfo)
 {
+    parseDictionary(dict);
     mpSampleGenerator = SampleGenerator::create(SAMPLE_GENERATOR_UNIFORM);
     FALCOR_ASSERT(mpSampleGenerator);
 }
 
+void PTGBuffer::parseDictionary(const Dictionary& dict)
+{
+    bool updatePattern = false;
+    for (const auto& [key, value] : dict)
+    {
+        if (key == kRecursionDepth) mRecursionDepth = value;
+        else if (key == kSpecRoughCutoff) mSpecRoughCutoff = value;
+        else if (key == kEmissiveCutoff) mEmissiveCutoff = value;
+        else if (key == kSamplePattern) { mSamplePattern = static_cast<SamplePattern>(static_cast<uint32_t>(value)); updatePattern = true; }
+        else if (key == kSampleCount) { mSampleCount = value; updatePattern = true; }
+        else logWarning("Unknown field '" + key + "' in a PTGBuffer dictionary");
+    }
+
+    //The jitter pattern is otherwise only created from the UI
+    if (updatePattern) {
+        updateSamplePattern();
+        mJitterGenChanged = true;
+    }
+}
+
 Dictionary PTGBuffer::getScriptingDictionary()
 {
-    return Dictionary();
+    Dictionary dict;
+    dict[kRecursionDepth] = mRecursionDepth;
+    dict[kSpecRoughCutoff] = mSpecRoughCutoff;
+    dict[kEmissiveCutoff] = mEmissiveCutoff;
+    dict[kSamplePattern] = static_cast<uint32_t>(mSamplePattern);
+    dict[kSampleCount] = mSampleCount;
+
+    return dict;
 }
 
 RenderPassReflection PTGBuffer::reflect(const CompileData& compileData)
@@ -64,7 +64,11 @@ public:
     virtual bool onKeyEvent(const KeyboardEvent& keyEvent) override { return false; }
 
 private:
-    PTGBuffer();
+    PTGBuffer(const Dictionary& dict);
+
+    /** Parses the dictonary when creating the render pass
+    */
+    void parseDictionary(const Dictionary& dict);
 
     /** Prepares Program Variables and binds the sample generator
     */
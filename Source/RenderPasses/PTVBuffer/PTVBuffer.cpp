@@ -87,6 +87,9 @@ namespace
     const char kSampleCount[] = "sampleCount";
     const char kUseAlphaTest[] = "useAlphaTest";
     const char kAdjustShadingNormals[] = "adjustShadingNormals";
+    const char kRecursionDepth[] = "recursionDepth";
+    const char kSpecRoughCutoff[] = "specRoughCutoff";
+    const char kEmissiveCutoff[] = "emissiveCutoff";
 }
 
 PTVBuffer::SharedPtr PTVBuffer::create(RenderContext* pRenderContext, const Dictionary& dict)
@@ -113,6 +116,9 @@ void PTVBuffer::parseDictionary(const Dictionary& dict)
         else if (key == kSampleCount) mSampleCount = value;
         else if (key == kUseAlphaTest) mUseAlphaTest = value;
         else if (key == kAdjustShadingNormals) mAdjustShadingNormals = value;
+        else if (key == kRecursionDepth) mRecursionDepth = value;
+        else if (key == kSpecRoughCutoff) mSpecRoughCutoff = value;
+        else if (key == kEmissiveCutoff) mEmissiveCutoff = value;
         // TODO: Check for unparsed fields, including those parsed in derived classes.
     }
 }
@@ -126,6 +132,9 @@ Dictionary PTVBuffer::getScriptingDictionary()
     dict[kSampleCount] = mSampleCount;
     dict[kUseAlphaTest] = mUseAlphaTest;
     dict[kAdjustShadingNormals] = mAdjustShadingNormals;
+    dict[kRecursionDepth] = mRecursionDepth;
+    dict[kSpecRoughCutoff] = mSpecRoughCutoff;
+    dict[kEmissiveCutoff] = mEmissiveCutoff;
 
     return dict;
 }
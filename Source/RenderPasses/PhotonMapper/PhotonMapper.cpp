@@ -26,7 +26,9 @@
  # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  **************************************************************************/
 #include "PhotonMapper.h"
+#include "../PhotonMapperCommon/PhotonPacking.h"
 #include <RenderGraph/RenderPassHelpers.h>
+#include <cstring>
 
 //for random seed generation
 #include <random>
@@ -53,13 +55,14 @@ namespace
     const char kShaderGeneratePhoton[] = "RenderPasses/PhotonMapper/PhotonMapperGenerate.rt.slang";
     const char kShaderCollectPhoton[] = "RenderPasses/PhotonMapper/PhotonMapperCollect.rt.slang";
     const char kShaderCollectStochasticPhoton[] = "RenderPasses/PhotonMapper/PhotonMapperStochasticCollect.rt.slang";
-    const char kShaderPhotonCulling[] = "RenderPasses/PhotonMapper/PhotonCulling.cs.slang";
+    const char kShaderPhotonCulling[] = "RenderPasses/PhotonMapperCommon/PhotonCulling.cs.slang";
     const char kShaderDebugShowPhotonAS[] = "RenderPasses/PhotonMapper/showPhotonAccelerationStructure.rt.slang";
+    const char kShaderCollectPhotonBVH[] = "RenderPasses/PhotonMapper/PhotonMapperCollectBVH.cs.slang";
     // Ray tracing settings that affect the traversal stack size.
    // These should be set as small as possible.
    //TODO: set them later to the right vals
     const uint32_t kMaxPayloadSizeBytes = 80u;
-    const uint32_t kMaxPayloadSizeBytesCollect = 48u;
+    const uint32_t kMaxPayloadSizeBytesCollect = 52u;
     const uint32_t kMaxAttributeSizeBytes = 8u;
     const uint32_t kMaxRecursionDepth = 2u;
 
@@ -79,7 +82,13 @@ namespace
     const Gui::DropdownList kInfoTexDropdownList{
         //{(uint)PhotonMapper::TextureFormat::_8Bit , "8Bits"},
         {(uint)PhotonMapper::TextureFormat::_16Bit , "16Bits"},
-        {(uint)PhotonMapper::TextureFormat::_32Bit , "32Bits"}
+        {(uint)PhotonMapper::TextureFormat::_32Bit , "32Bits"},
+        {(uint)PhotonMapper::TextureFormat::Compact , "Compact (16B)"}
+    };
+
+    const Gui::DropdownList kPhotonStorageList{
+        {(uint)PhotonStorage::Texture2D , "2D Textures"},
+        {(uint)PhotonStorage::LinearBuffer , "Linear Buffers"}
     };
 
     const Gui::DropdownList kStochasticCollectList{
@@ -87,28 +96,242 @@ namespace
         {19 , "19"},{23 , "23"},{27 , "27"}
     };
 
+    const Gui::DropdownList kPhotonBVHBuildModeList{
+        {(uint)PhotonSphereBVH::BuildMode::LBVH , "LBVH"},
+        {(uint)PhotonSphereBVH::BuildMode::BinnedSAH , "Binned SAH"}
+    };
+
     const Gui::DropdownList kLightTexModeList{
         {PhotonMapper::LightTexMode::power , "Power"},
         {PhotonMapper::LightTexMode::area , "Area"}
     };
+
+    const Gui::DropdownList kHashFunctionList{
+        {(uint)SpatialHashFunction::Wang , "Wang"},
+        {(uint)SpatialHashFunction::Morton , "Morton"},
+        {(uint)SpatialHashFunction::Pcg , "PCG"}
+    };
+
+    // Scripting options.
+    const char kNumPhotons[] = "numPhotons";
+    const char kGlobalBufferSize[] = "globalBufferSize";
+    const char kCausticBufferSize[] = "causticBufferSize";
+    const char kPhotonBufferOverestimate[] = "photonBufferOverestimate";
+    const char kAutoBufferSize[] = "autoBufferSize";
+    const char kPhotonGenerations[] = "photonGenerations";
+    const char kUseSPPM[] = "useSPPM";
+    const char kSPPMAlphaGlobal[] = "sppmAlphaGlobal";
+    const char kSPPMAlphaCaustic[] = "sppmAlphaCaustic";
+    const char kPerPixelSPPM[] = "perPixelSPPM";
+    const char kCausticRadiusStart[] = "causticRadiusStart";
+    const char kGlobalRadiusStart[] = "globalRadiusStart";
+    const char kRejectionProbability[] = "rejectionProbability";
+    const char kMaxBounces[] = "maxBounces";
+    const char kEmissiveScalar[] = "emissiveScalar";
+    const char kSpecRoughCutoff[] = "specRoughCutoff";
+    const char kUseAlphaTest[] = "useAlphaTest";
+    const char kAdjustShadingNormals[] = "adjustShadingNormals";
+    const char kUseFaceNormalRejection[] = "useFaceNormalRejection";
+    const char kInfoTexFormat[] = "infoTexFormat";
+    const char kPhotonStorage[] = "photonStorage";
+    const char kEnablePhotonCulling[] = "enablePhotonCulling";
+    const char kCullingHashBufferBits[] = "cullingHashBufferBits";
+    const char kCullingHashFunction[] = "cullingHashFunction";
+    const char kCullingNumHashes[] = "cullingNumHashes";
+    const char kUseProjectionMatrixCulling[] = "useProjectionMatrixCulling";
+    const char kCullingProjectionTestOver[] = "cullingProjectionTestOver";
+    const char kEnableStochasticCollect[] = "enableStochasticCollect";
+    const char kStochasticIterations[] = "stochasticIterations";
+    const char kStochasticMaxPhotons[] = "stochasticMaxPhotons";
+    const char kFastBuildAS[] = "fastBuildAS";
+    const char kValidatePhotonAS[] = "validatePhotonAS";
+    const char kCpuPhotonGather[] = "cpuPhotonGather";
+    const char kPhotonBVHBuildMode[] = "photonBVHBuildMode";
+    const char kLightSampleMode[] = "lightSampleMode";
+    const char kAsyncLightTableRebuild[] = "asyncLightTableRebuild";
+    const char kAdaptiveEmission[] = "adaptiveEmission";
+    const char kAdaptiveEmissionInterval[] = "adaptiveEmissionInterval";
+    const char kAdaptiveEmissionMinShare[] = "adaptiveEmissionMinShare";
+    const char kDisableGlobalCollection[] = "disableGlobalCollection";
+    const char kDisableCausticCollection[] = "disableCausticCollection";
+    const char kAlwaysResetIterations[] = "alwaysResetIterations";
+    const char kUseTimer[] = "useTimer";
+    const char kTimerDurationSec[] = "timerDurationSec";
+    const char kTimerMaxIterations[] = "timerMaxIterations";
+    const char kTimerRecordTimes[] = "timerRecordTimes";
+    const char kTimesOutputFile[] = "timesOutputFile";
+    const char kConvergenceEnabled[] = "convergenceEnabled";
+    const char kConvergenceReference[] = "convergenceReference";
+    const char kConvergenceIntervalIterations[] = "convergenceIntervalIterations";
+    const char kConvergenceIntervalMs[] = "convergenceIntervalMs";
+    const char kConvergenceSsim[] = "convergenceSsim";
+    const char kConvergenceOutputFile[] = "convergenceOutputFile";
+
+    bool isCompactFormat(uint format)
+    {
+        return format == static_cast<uint>(PhotonMapper::TextureFormat::Compact);
+    }
+
+    bool isLinearStorage(uint storage)
+    {
+        return storage == static_cast<uint>(PhotonStorage::LinearBuffer);
+    }
+
+    //Positions are in the AABBs. 8 bit infos are stored as halfs
+    PhotonStreamLayout createPhotonStreamLayout(uint capacity, uint format)
+    {
+        PhotonStreamFormat::Infos infos = PhotonStreamFormat::Infos::Half;
+        if (isCompactFormat(format)) infos = PhotonStreamFormat::Infos::Compact;
+        else if (format == static_cast<uint>(PhotonMapper::TextureFormat::_32Bit)) infos = PhotonStreamFormat::Infos::Full;
+        return PhotonStreamFormat::createMapLayout(capacity, infos, false);
+    }
 }
 
 PhotonMapper::SharedPtr PhotonMapper::create(RenderContext* pRenderContext, const Dictionary& dict)
 {
-    SharedPtr pPass = SharedPtr(new PhotonMapper);
+    SharedPtr pPass = SharedPtr(new PhotonMapper(dict));
     return pPass;
 }
 
-PhotonMapper::PhotonMapper():
+PhotonMapper::PhotonMapper(const Dictionary& dict):
     RenderPass(kInfo)
 {
+    parseDictionary(dict);
+
+    PhotonBufferSizePolicy::Options sizeOptions;
+    sizeOptions.minCapacity = kInfoTexHeight;
+    mCausticSizePolicy.setOptions(sizeOptions);
+    mGlobalSizePolicy.setOptions(sizeOptions);
+    updateSizePolicyGranularity();
+
     mpSampleGenerator = SampleGenerator::create(SAMPLE_GENERATOR_UNIFORM);
     FALCOR_ASSERT(mpSampleGenerator);
 }
 
+void PhotonMapper::parseDictionary(const Dictionary& dict)
+{
+    for (const auto& [key, value] : dict)
+    {
+        if (key == kNumPhotons) { mNumPhotons = value; mNumPhotonsUI = mNumPhotons; }
+        else if (key == kGlobalBufferSize) mGlobalBufferSizeUI = value;
+        else if (key == kCausticBufferSize) mCausticBufferSizeUI = value;
+        else if (key == kPhotonBufferOverestimate) mPhotonBufferOverestimate = value;
+        else if (key == kAutoBufferSize) mAutoBufferSize = value;
+        else if (key == kPhotonGenerations) mPhotonGenerations = value;
+        else if (key == kUseSPPM) mUseStatisticProgressivePM = value;
+        else if (key == kSPPMAlphaGlobal) mSPPMAlphaGlobal = value;
+        else if (key == kSPPMAlphaCaustic) mSPPMAlphaCaustic = value;
+        else if (key == kPerPixelSPPM) mPerPixelSPPM = value;
+        else if (key == kCausticRadiusStart) mCausticRadiusStart = value;
+        else if (key == kGlobalRadiusStart) mGlobalRadiusStart = value;
+        else if (key == kRejectionProbability) mRejectionProbability = value;
+        else if (key == kMaxBounces) mMaxBounces = value;
+        else if (key == kEmissiveScalar) mIntensityScalar = value;
+        else if (key == kSpecRoughCutoff) mSpecRoughCutoff = value;
+        else if (key == kUseAlphaTest) mUseAlphaTest = value;
+        else if (key == kAdjustShadingNormals) mAdjustShadingNormals = value;
+        else if (key == kUseFaceNormalRejection) mUseFaceNormalToReject = value;
+        else if (key == kInfoTexFormat) mInfoTexFormat = value;
+        else if (key == kPhotonStorage) mPhotonStorage = value;
+        else if (key == kEnablePhotonCulling) mEnablePhotonCulling = value;
+        else if (key == kCullingHashBufferBits) mCullingHashBufferSizeBytes = value;
+        else if (key == kCullingHashFunction) mCullingHashFunction = value;
+        else if (key == kCullingNumHashes) mCullingNumHashes = value;
+        else if (key == kUseProjectionMatrixCulling) mUseProjectionMatrixCulling = value;
+        else if (key == kCullingProjectionTestOver) mPCullingrojectionTestOver = value;
+        else if (key == kEnableStochasticCollect) mEnableStochasticCollect = value;
+        else if (key == kStochasticIterations) mStochasticIterations = value;
+        else if (key == kStochasticMaxPhotons) { mMaxNumberPhotonsSC = value; mMaxNumberPhotonsSCUI = mMaxNumberPhotonsSC; }
+        else if (key == kFastBuildAS) { mAccelerationStructureFastBuild = value; mAccelerationStructureFastBuildUI = mAccelerationStructureFastBuild; }
+        else if (key == kValidatePhotonAS) mValidatePhotonAS = value;
+        else if (key == kCpuPhotonGather) mCpuPhotonGather = value;
+        else if (key == kPhotonBVHBuildMode) mPhotonBVHBuildMode = value;
+        else if (key == kLightSampleMode) mLightTexMode = static_cast<LightTexMode>(static_cast<uint32_t>(value));
+        else if (key == kAsyncLightTableRebuild) mAsyncLightTexRebuild = value;
+        else if (key == kAdaptiveEmission) mAdaptiveEmission = value;
+        else if (key == kAdaptiveEmissionInterval) mAdaptiveEmissionInterval = value;
+        else if (key == kAdaptiveEmissionMinShare) {
+            AdaptiveLightSampling::Options options = mLightAdaptation.getOptions();
+            options.minShare = value;
+            mLightAdaptation.setOptions(options);
+        }
+        else if (key == kDisableGlobalCollection) mDisableGlobalCollection = value;
+        else if (key == kDisableCausticCollection) mDisableCausticCollection = value;
+        else if (key == kAlwaysResetIterations) mAlwaysResetIterations = value;
+        else if (key == kUseTimer) { mUseTimer = value; mResetTimer = true; }
+        else if (key == kTimerDurationSec) mTimerDurationSec = value;
+        else if (key == kTimerMaxIterations) mTimerMaxIterations = value;
+        else if (key == kTimerRecordTimes) mTimerRecordTimes = value;
+        else if (key == kTimesOutputFile) mTimesOutputFilePath = static_cast<std::string>(value);
+        else if (key == kConvergenceEnabled) mConvergence.getOptions().enabled = value;
+        else if (key == kConvergenceReference) mConvergence.getOptions().referencePath = static_cast<std::string>(value);
+        else if (key == kConvergenceIntervalIterations) mConvergence.getOptions().intervalIterations = value;
+        else if (key == kConvergenceIntervalMs) mConvergence.getOptions().intervalMs = value;
+        else if (key == kConvergenceSsim) mConvergence.getOptions().computeSsim = value;
+        else if (key == kConvergenceOutputFile) mConvergence.getOptions().outputPath = static_cast<std::string>(value);
+        else logWarning("Unknown field '" + key + "' in a PhotonMapper dictionary");
+    }
+}
+
 Dictionary PhotonMapper::getScriptingDictionary()
 {
-    return Dictionary();
+    Dictionary dict;
+    dict[kNumPhotons] = mNumPhotons;
+    dict[kGlobalBufferSize] = mGlobalBufferSizeUI;
+    dict[kCausticBufferSize] = mCausticBufferSizeUI;
+    dict[kPhotonBufferOverestimate] = mPhotonBufferOverestimate;
+    dict[kAutoBufferSize] = mAutoBufferSize;
+    dict[kPhotonGenerations] = mPhotonGenerations;
+    dict[kUseSPPM] = mUseStatisticProgressivePM;
+    dict[kSPPMAlphaGlobal] = mSPPMAlphaGlobal;
+    dict[kSPPMAlphaCaustic] = mSPPMAlphaCaustic;
+    dict[kPerPixelSPPM] = mPerPixelSPPM;
+    dict[kCausticRadiusStart] = mCausticRadiusStart;
+    dict[kGlobalRadiusStart] = mGlobalRadiusStart;
+    dict[kRejectionProbability] = mRejectionProbability;
+    dict[kMaxBounces] = mMaxBounces;
+    dict[kEmissiveScalar] = mIntensityScalar;
+    dict[kSpecRoughCutoff] = mSpecRoughCutoff;
+    dict[kUseAlphaTest] = mUseAlphaTest;
+    dict[kAdjustShadingNormals] = mAdjustShadingNormals;
+    dict[kUseFaceNormalRejection] = mUseFaceNormalToReject;
+    dict[kInfoTexFormat] = mInfoTexFormat;
+    dict[kPhotonStorage] = mPhotonStorage;
+    dict[kEnablePhotonCulling] = mEnablePhotonCulling;
+    dict[kCullingHashBufferBits] = mCullingHashBufferSizeBytes;
+    dict[kCullingHashFunction] = mCullingHashFunction;
+    dict[kCullingNumHashes] = mCullingNumHashes;
+    dict[kUseProjectionMatrixCulling] = mUseProjectionMatrixCulling;
+    dict[kCullingProjectionTestOver] = mPCullingrojectionTestOver;
+    dict[kEnableStochasticCollect] = mEnableStochasticCollect;
+    dict[kStochasticIterations] = mStochasticIterations;
+    dict[kStochasticMaxPhotons] = mMaxNumberPhotonsSCUI;
+    dict[kFastBuildAS] = mAccelerationStructureFastBuildUI;
+    dict[kValidatePhotonAS] = mValidatePhotonAS;
+    dict[kCpuPhotonGather] = mCpuPhotonGather;
+    dict[kPhotonBVHBuildMode] = mPhotonBVHBuildMode;
+    dict[kLightSampleMode] = static_cast<uint32_t>(mLightTexMode);
+    dict[kAsyncLightTableRebuild] = mAsyncLightTexRebuild;
+    dict[kAdaptiveEmission] = mAdaptiveEmission;
+    dict[kAdaptiveEmissionInterval] = mAdaptiveEmissionInterval;
+    dict[kAdaptiveEmissionMinShare] = mLightAdaptation.getOptions().minShare;
+    dict[kDisableGlobalCollection] = mDisableGlobalCollection;
+    dict[kDisableCausticCollection] = mDisableCausticCollection;
+    dict[kAlwaysResetIterations] = mAlwaysResetIterations;
+    dict[kUseTimer] = mUseTimer;
+    dict[kTimerDurationSec] = mTimerDurationSec;
+    dict[kTimerMaxIterations] = mTimerMaxIterations;
+    dict[kTimerRecordTimes] = mTimerRecordTimes;
+    if (!mTimesOutputFilePath.empty()) dict[kTimesOutputFile] = mTimesOutputFilePath;
+    const auto& convergence = mConvergence.getOptions();
+    dict[kConvergenceEnabled] = convergence.enabled;
+    if (!convergence.referencePath.empty()) dict[kConvergenceReference] = convergence.referencePath;
+    dict[kConvergenceIntervalIterations] = convergence.intervalIterations;
+    dict[kConvergenceIntervalMs] = convergence.intervalMs;
+    dict[kConvergenceSsim] = convergence.computeSsim;
+    if (!convergence.outputPath.empty()) dict[kConvergenceOutputFile] = convergence.outputPath;
+
+    return dict;
 }
 
 RenderPassReflection PhotonMapper::reflect(const CompileData& compileData)
@@ -160,8 +383,8 @@ void PhotonMapper::execute(RenderContext* pRenderContext, const RenderData& rend
     checkTimer();
     if (mUseTimer && mTimerStopRenderer) return;
 
-    //Copy Photon Counter for UI
-    copyPhotonCounter(pRenderContext);
+    //Get the newest photon counter that is ready on the CPU
+    updatePhotonCounter();
 
     if (mNumPhotonsChanged) {
         changeNumPhotons();
@@ -174,10 +397,17 @@ void PhotonMapper::execute(RenderContext* pRenderContext, const RenderData& rend
         mRebuildAS = true;
     }
 
+    //Restarts the iterations if the screen size changed
+    if (mPerPixelSPPM) {
+        prepareProgressiveBuffers(renderData.getDefaultTextureDims());
+    }
+
     //reset radius
     if (mFrameCount == 0) {
         mCausticRadius = mCausticRadiusStart;
         mGlobalRadius = mGlobalRadiusStart;
+        mConvergence.restart();
+        mPhotonRing.reset();
     }
 
     if (is_set(mpScene->getUpdates(), Scene::UpdateFlags::GeometryChanged))
@@ -191,6 +421,13 @@ void PhotonMapper::execute(RenderContext* pRenderContext, const RenderData& rend
         mpScene->getLightCollection(pRenderContext);
     }
 
+    //The buffers are recreated with the sizes rounded to the new granularity
+    if (mPhotonStorageChanged) {
+        updateSizePolicyGranularity();
+        mResizePhotonBuffers = true;
+        mPhotonStorageChanged = false;
+    }
+
     if (mResizePhotonBuffers) {
         //Fits the buffer with the user defined offset percentage
         if (mFitBuffersToPhotonShot) {
@@ -201,14 +438,16 @@ void PhotonMapper::execute(RenderContext* pRenderContext, const RenderData& rend
             }
             mFitBuffersToPhotonShot = false;
         }
-        //put in new size with info tex2D height in mind
-        uint causticWidth = static_cast<uint>(std::ceil(mCausticBufferSizeUI / static_cast<float>(kInfoTexHeight)));
-        mCausticBuffers.maxSize = causticWidth * kInfoTexHeight;
-        uint globalWidth = static_cast<uint>(std::ceil(mGlobalBufferSizeUI / static_cast<float>(kInfoTexHeight)));
-        mGlobalBuffers.maxSize = globalWidth * kInfoTexHeight;
+        //put in new size with the storage granularity (info tex2D height) in mind
+        const uint granularity = getPhotonBufferGranularity();
+        uint causticWidth = static_cast<uint>(std::ceil(mCausticBufferSizeUI / static_cast<float>(granularity)));
+        mCausticBuffers.maxSize = std::max(causticWidth, 1u) * granularity;
+        uint globalWidth = static_cast<uint>(std::ceil(mGlobalBufferSizeUI / static_cast<float>(granularity)));
+        mGlobalBuffers.maxSize = std::max(globalWidth, 1u) * granularity;
 
         //refresh UI to new variable
         mCausticBufferSizeUI = mCausticBuffers.maxSize; mGlobalBufferSizeUI = mGlobalBuffers.maxSize;
+        mCausticSizePolicy.setCapacity(mCausticBuffers.maxSize); mGlobalSizePolicy.setCapacity(mGlobalBuffers.maxSize);
         mResizePhotonBuffers = false;
         mPhotonBuffersReady = false;
         mRebuildAS = true;
@@ -229,13 +468,20 @@ void PhotonMapper::execute(RenderContext* pRenderContext, const RenderData& rend
     }
 
     if (mRebuildLightTex) {
-        mLightSampleTex.reset();
+        //Keep the old table until the worker thread is done
+        if (mAsyncLightTexRebuild && mLightAliasTable)
+            mLightTableBuilder.buildAsync(LightSampleTableBuilder::createInput(pRenderContext, mpScene, mNumPhotons, mMaxDispatchY, (LightSampleTableBuilder::Mode)mLightTexMode));
+        else
+            mLightAliasTable.reset();
         mRebuildLightTex = false;
     }
 
-    //Create light sample tex if empty
-    if (!mLightSampleTex) {
-        createLightSampleTexture(pRenderContext);
+    //Create light table if empty
+    if (!mLightAliasTable) {
+        createLightSampleTable(pRenderContext);
+    }
+    else if (mLightTableBuilder.isReady()) {
+        uploadLightSampleTable(mLightTableBuilder.takeResult());
     }
 
     if (mRebuildCullingBuffer) {
@@ -253,6 +499,12 @@ void PhotonMapper::execute(RenderContext* pRenderContext, const RenderData& rend
     if (mRebuildAS)
         createAccelerationStructure(pRenderContext);
 
+    //Release the emission counters if adaptive emission is deactivated
+    if (mAdaptiveEmission)
+        updateAdaptiveEmission(pRenderContext);
+    else if (mLightEmissionCounter)
+        mLightEmissionCounter.reset();
+
     if (mEnablePhotonCulling)
         photonCullingPass(pRenderContext, renderData);
 
@@ -260,32 +512,45 @@ void PhotonMapper::execute(RenderContext* pRenderContext, const RenderData& rend
     // Generate Ray Pass
     //
 
+    mPhotonRing.beginGeneration();
     generatePhotons(pRenderContext, renderData);
+    copyPhotonCounter(pRenderContext);
 
 
     //Barrier for the AABB buffers (they need to be ready)
     pRenderContext->uavBarrier(mGlobalBuffers.aabb.get());
     pRenderContext->uavBarrier(mCausticBuffers.aabb.get());
 
-    //Take photon count from last iteration as a basis for this iteration. For first iteration take max buffer size
-    mPhotonAccelSizeLastIt = {static_cast<uint>(mPhotonCount[0] * mPhotonBufferOverestimate), static_cast<uint>(mPhotonCount[1] * mPhotonBufferOverestimate)};
-    if (mFrameCount == 0) { mPhotonAccelSizeLastIt[0] = mCausticBuffers.maxSize; mPhotonAccelSizeLastIt[1] = mGlobalBuffers.maxSize; }
+    //Take the newest read back photon count as a basis for this iteration. It is a few frames old, so take the max buffer size
+    //until a count from after the last reset is available
+    if (mPhotonCounterReadback.hasValue())
+        mPhotonAccelSizeLastIt = {static_cast<uint>(mPhotonCount[0] * mPhotonBufferOverestimate), static_cast<uint>(mPhotonCount[1] * mPhotonBufferOverestimate)};
+    else
+        mPhotonAccelSizeLastIt = { mCausticBuffers.maxSize, mGlobalBuffers.maxSize };
 
     buildBottomLevelAS(pRenderContext, mPhotonAccelSizeLastIt);
     buildTopLevelAS(pRenderContext);
 
-    if (mUsePhotonASDebugPass) {
+    if (mUsePhotonASDebugPass && !useCpuPhotonGather()) {
         //Use debug pass and skip the rest of the program
         photonASDebugPass(pRenderContext, renderData);
         return;
     }
     
     //Gather the photons with short rays
-    collectPhotons(pRenderContext, renderData);
+    if (useCpuPhotonGather())
+        collectPhotonsBVH(pRenderContext, renderData);
+    else
+        collectPhotons(pRenderContext, renderData);
 
     mFrameCount++;
 
-    if (mUseStatisticProgressivePM) {
+    //Compare with the reference if a measurement is due. The radii are the ones used for this iteration
+    mConvergence.update(pRenderContext, renderData[kOutputChannels[0].name]->asTexture(), mFrameCount, mGlobalRadius, mCausticRadius);
+
+    //With per pixel SPPM the AABBs keep the start radius, it bounds the radius of every pixel.
+    //One step per frame also with several ring generations, every frame traces a single generation (see PhotonGenerationRing)
+    if (mUseStatisticProgressivePM && !mPerPixelSPPM) {
         float itF = static_cast<float>(mFrameCount);
         mGlobalRadius *= sqrt((itF + mSPPMAlphaGlobal) / (itF + 1.0f));
         mCausticRadius *= sqrt((itF + mSPPMAlphaCaustic) / (itF + 1.0f));
@@ -301,18 +566,34 @@ void PhotonMapper::execute(RenderContext* pRenderContext, const RenderData& rend
 
 void PhotonMapper::generatePhotons(RenderContext* pRenderContext, const RenderData& renderData)
 {
+    FALCOR_PROFILE("generate photons");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Generate);
 
     //Reset counter Buffers
     pRenderContext->copyBufferRegion(mPhotonCounterBuffer.counter.get(), 0, mPhotonCounterBuffer.reset.get(), 0, sizeof(uint64_t));
     pRenderContext->resourceBarrier(mPhotonCounterBuffer.counter.get(), Resource::State::ShaderResource);
 
-    //Clear the photon Buffers
-    pRenderContext->clearUAV(mGlobalBuffers.aabb.get()->getUAV().get(), uint4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mGlobalBuffers.infoFlux.get(), float4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mGlobalBuffers.infoDir.get(), float4(0, 0, 0, 0));
-    pRenderContext->clearUAV(mCausticBuffers.aabb.get()->getUAV().get(), uint4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mCausticBuffers.infoFlux.get(), float4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mCausticBuffers.infoDir.get(), float4(0, 0, 0, 0));
+    //Clear the photon Buffers. Linear streams are not cleared, only photons with an AABB of this iteration are read.
+    //With more than one generation only the AABBs of the current ring slot are cleared, the info of the other slots is still read
+    const uint slot = mPhotonRing.getCurrentSlot();
+    for (PhotonBuffers* buffers : { &mGlobalBuffers, &mCausticBuffers }) {
+        if (mPhotonRing.getGenerationCount() > 1) {
+            const uint64_t slotBytes = uint64_t(buffers->maxSize) * PhotonAccelerationStructure::kAABBStride;
+            pRenderContext->copyBufferRegion(buffers->aabb.get(), slot * slotBytes, mAabbClearBuffer.get(), 0, slotBytes);
+            continue;
+        }
+        pRenderContext->clearUAV(buffers->aabb.get()->getUAV().get(), uint4(0, 0, 0, 0));
+        if (buffers->streams) {
+            continue;
+        }
+        else if (buffers->packed) {
+            pRenderContext->clearUAV(buffers->packed->getUAV().get(), uint4(0, 0, 0, 0));
+        }
+        else {
+            pRenderContext->clearTexture(buffers->infoFlux.get(), float4(0, 0, 0, 0));
+            pRenderContext->clearTexture(buffers->infoDir.get(), float4(0, 0, 0, 0));
+        }
+    }
     
 
     auto lights = mpScene->getLights();
@@ -321,17 +602,21 @@ void PhotonMapper::generatePhotons(RenderContext* pRenderContext, const RenderDa
     // Specialize the Generate program.
     // These defines should not modify the program vars. Do not trigger program vars re-creation.
     mTracerGenerate.pProgram->addDefine("USE_ANALYTIC_LIGHTS", mpScene->useAnalyticLights() ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("ADAPTIVE_EMISSION", mAdaptiveEmission ? "1" : "0");
     mTracerGenerate.pProgram->addDefine("USE_EMISSIVE_LIGHTS", mpScene->useEmissiveLights() ? "1" : "0");
     mTracerGenerate.pProgram->addDefine("USE_ENV_LIGHT", mpScene->useEnvLight() ? "1" : "0");
     mTracerGenerate.pProgram->addDefine("USE_ENV_BACKGROUND", mpScene->useEnvBackground() ? "1" : "0");
-    mTracerGenerate.pProgram->addDefine("MAX_PHOTON_INDEX_GLOBAL", std::to_string(mGlobalBuffers.maxSize));
-    mTracerGenerate.pProgram->addDefine("MAX_PHOTON_INDEX_CAUSTIC", std::to_string(mCausticBuffers.maxSize));
+    mTracerGenerate.pProgram->addDefine("MAX_PHOTON_INDEX_GLOBAL", std::to_string(mGlobalBuffers.maxSize - 1));
+    mTracerGenerate.pProgram->addDefine("MAX_PHOTON_INDEX_CAUSTIC", std::to_string(mCausticBuffers.maxSize - 1));
     mTracerGenerate.pProgram->addDefine("INFO_TEXTURE_HEIGHT", std::to_string(kInfoTexHeight));
     mTracerGenerate.pProgram->addDefine("RAY_TMAX", std::to_string(1000.f));    //TODO: Set as variable
     mTracerGenerate.pProgram->addDefine("RAY_TMIN_CULLING", std::to_string(kCollectTMin));
     mTracerGenerate.pProgram->addDefine("RAY_TMAX_CULLING", std::to_string(kCollectTMax));
     mTracerGenerate.pProgram->addDefine("CULLING_USE_PROJECTION", std::to_string(mUseProjectionMatrixCulling));
+    mTracerGenerate.pProgram->addDefine("SPATIAL_HASH_FUNCTION", std::to_string(mCullingHashFunction));
     mTracerGenerate.pProgram->addDefine("PHOTON_FACE_NORMAL", mUseFaceNormalToReject ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("PHOTON_COMPACT", isCompactFormat(mInfoTexFormat) ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("PHOTON_STORAGE_LINEAR", isLinearStorage(mPhotonStorage) ? "1" : "0");
 
     // Prepare program vars. This may trigger shader compilation.
     // The program should have all necessary defines set at this point.
@@ -346,10 +631,13 @@ void PhotonMapper::generatePhotons(RenderContext* pRenderContext, const RenderDa
     //PerFrame Constant Buffer
     std::string nameBuf = "PerFrame";
     var[nameBuf]["gFrameCount"] = mFrameCount;
+    var[nameBuf]["gLightAliasTableSize"] = mLightAliasTableSize;
     var[nameBuf]["gCausticRadius"] = mCausticRadius;
     var[nameBuf]["gGlobalRadius"] = mGlobalRadius;
     var[nameBuf]["gHashScaleFactor"] = 1.0f / (mGlobalRadius * 2);  //Radius needs to be double to ensure that all photons from the camera cell are in it
-    
+    var[nameBuf]["gPhotonLayout"][0].setBlob(mCausticBuffers.layout);
+    var[nameBuf]["gPhotonLayout"][1].setBlob(mGlobalBuffers.layout);
+    var[nameBuf]["gRingOffset"] = uint2(slot * mCausticBuffers.maxSize, slot * mGlobalBuffers.maxSize);
 
     //Upload constant buffer only if options changed
     if (mResetConstantBuffers) {
@@ -360,13 +648,12 @@ void PhotonMapper::generatePhotons(RenderContext* pRenderContext, const RenderDa
         var[nameBuf]["gEmissiveScale"] = mIntensityScalar;
 
         var[nameBuf]["gSpecRoughCutoff"] = mSpecRoughCutoff;
-        var[nameBuf]["gAnalyticInvPdf"] = mAnalyticInvPdf;
         var[nameBuf]["gAdjustShadingNormals"] = mAdjustShadingNormals;
         var[nameBuf]["gUseAlphaTest"] = mUseAlphaTest;
 
         var[nameBuf]["gEnablePhotonCulling"] = mEnablePhotonCulling;
-        var[nameBuf]["gCullingHashSize"] = 1 << mCullingHashBufferSizeBytes;
-        var[nameBuf]["gCullingYExtent"] = mCullingYExtent;
+        var[nameBuf]["gCullingBitMask"] = CullingBloomFilter::getBitMask(mCullingHashBufferSizeBytes);
+        var[nameBuf]["gCullingNumHashes"] = mCullingNumHashes;
         var[nameBuf]["gCullingProjTest"] = mPCullingrojectionTestOver;
     }
 
@@ -379,21 +666,26 @@ void PhotonMapper::generatePhotons(RenderContext* pRenderContext, const RenderDa
         var["gPhotonAABB"][i] = i == 0 ? mCausticBuffers.aabb : mGlobalBuffers.aabb;
         var["gPhotonFlux"][i] = i == 0 ? mCausticBuffers.infoFlux : mGlobalBuffers.infoFlux;
         var["gPhotonDir"][i] = i == 0 ? mCausticBuffers.infoDir : mGlobalBuffers.infoDir;
+        var["gPhotonPacked"][i] = i == 0 ? mCausticBuffers.packed : mGlobalBuffers.packed;
+        var["gPhotonStreams"][i] = i == 0 ? mCausticBuffers.streams : mGlobalBuffers.streams;
     }
     
     var["gRndSeedBuffer"] = mRandNumSeedBuffer;
 
     var["gPhotonCounter"] = mPhotonCounterBuffer.counter;
 
-    //Bind light sample tex
-    var["gLightSample"] = mLightSampleTex;
-    var["gNumPhotonsPerEmissive"] = mPhotonsPerTriangle;
+    //Bind light table
+    var["gLightAliasTable"] = mLightAliasTable;
 
     //Set optinal culling variables
     if (mEnablePhotonCulling) {
         var["gCullingHashBuffer"] = mCullingBuffer;
     }
 
+    if (mAdaptiveEmission) {
+        var["gLightEmissionCounter"] = mLightEmissionCounter;
+    }
+
     // Get dimensions of ray dispatch.
     const uint2 targetDim = uint2(mPGDispatchX, mMaxDispatchY);
     FALCOR_ASSERT(targetDim.x > 0 && targetDim.y > 0);
@@ -416,6 +708,7 @@ void PhotonMapper::collectPhotons(RenderContext* pRenderContext, const RenderDat
 
     // Trace the photons
     FALCOR_PROFILE("collect photons");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Collect);
 
     
     // Full Collect
@@ -426,6 +719,9 @@ void PhotonMapper::collectPhotons(RenderContext* pRenderContext, const RenderDat
     mTracerCollect.pProgram->addDefine("RAY_TMAX", std::to_string(kCollectTMax));
     mTracerCollect.pProgram->addDefine("INFO_TEXTURE_HEIGHT", std::to_string(kInfoTexHeight));
     mTracerCollect.pProgram->addDefine("PHOTON_FACE_NORMAL", mUseFaceNormalToReject ? "1" : "0");
+    mTracerCollect.pProgram->addDefine("PHOTON_COMPACT", isCompactFormat(mInfoTexFormat) ? "1" : "0");
+    mTracerCollect.pProgram->addDefine("PHOTON_STORAGE_LINEAR", isLinearStorage(mPhotonStorage) ? "1" : "0");
+    mTracerCollect.pProgram->addDefine("PER_PIXEL_SPPM", mPerPixelSPPM ? "1" : "0");
 
     // Prepare program for full collect vars. This may trigger shader compilation.
     if (!mTracerCollect.pVars) {
@@ -449,6 +745,9 @@ void PhotonMapper::collectPhotons(RenderContext* pRenderContext, const RenderDat
     mTracerStochasticCollect.pProgram->addDefine("INFO_TEXTURE_HEIGHT", std::to_string(kInfoTexHeight));
     mTracerStochasticCollect.pProgram->addDefine("NUM_PHOTONS", std::to_string(mMaxNumberPhotonsSC));
     mTracerStochasticCollect.pProgram->addDefine("PHOTON_FACE_NORMAL", mUseFaceNormalToReject ? "1" : "0");
+    mTracerStochasticCollect.pProgram->addDefine("PHOTON_COMPACT", isCompactFormat(mInfoTexFormat) ? "1" : "0");
+    mTracerStochasticCollect.pProgram->addDefine("PHOTON_STORAGE_LINEAR", isLinearStorage(mPhotonStorage) ? "1" : "0");
+    mTracerStochasticCollect.pProgram->addDefine("PER_PIXEL_SPPM", mPerPixelSPPM ? "1" : "0");
 
     // Prepare program for full collect vars. This may trigger shader compilation.
     if (!mTracerStochasticCollect.pVars) {
@@ -471,13 +770,21 @@ void PhotonMapper::collectPhotons(RenderContext* pRenderContext, const RenderDat
     var[nameBuf]["gFrameCount"] = mFrameCount;
     var[nameBuf]["gCausticRadius"] = mCausticRadius;
     var[nameBuf]["gGlobalRadius"] = mGlobalRadius;
-    
+    var[nameBuf]["gCausticLayout"].setBlob(mCausticBuffers.layout);
+    var[nameBuf]["gGlobalLayout"].setBlob(mGlobalBuffers.layout);
+    var[nameBuf]["gSlotCapacity"] = uint2(mCausticBuffers.maxSize, mGlobalBuffers.maxSize);
+    for (uint slot = 0; slot < kMaxPhotonGenerations; slot++)
+        var[nameBuf]["gGenerationWeights"][slot] = slot < mPhotonRing.getGenerationCount() ? mPhotonRing.getWeight(slot) : 0.f;
 
     if (mResetConstantBuffers || shadersSwitched) {
         nameBuf = "CB";
         var[nameBuf]["gEmissiveScale"] = mIntensityScalar;
         var[nameBuf]["gCollectGlobalPhotons"] = !mDisableGlobalCollection;
         var[nameBuf]["gCollectCausticPhotons"] = !mDisableCausticCollection;
+        //Alpha of 1 keeps the start radius of every pixel
+        var[nameBuf]["gSPPMAlphaGlobal"] = mUseStatisticProgressivePM ? mSPPMAlphaGlobal : 1.f;
+        var[nameBuf]["gSPPMAlphaCaustic"] = mUseStatisticProgressivePM ? mSPPMAlphaCaustic : 1.f;
+        var[nameBuf]["gMinPhotonRadius"] = kMinPhotonRadius;
     }
 
     //set the buffers
@@ -488,6 +795,12 @@ void PhotonMapper::collectPhotons(RenderContext* pRenderContext, const RenderDat
     var["gGlobalAABB"] = mGlobalBuffers.aabb;
     var["gGlobalFlux"] = mGlobalBuffers.infoFlux;
     var["gGlobalDir"] = mGlobalBuffers.infoDir;
+    var["gCausticPacked"] = mCausticBuffers.packed;
+    var["gGlobalPacked"] = mGlobalBuffers.packed;
+    var["gCausticPhotons"] = mCausticBuffers.streams;
+    var["gGlobalPhotons"] = mGlobalBuffers.streams;
+    var["gProgressiveStats"] = mProgressiveStats;
+    var["gProgressiveEmission"] = mProgressiveEmission;
 
     // Lamda for binding textures. These needs to be done per-frame as the buffers may change anytime.
     auto bindAsTex = [&](const ChannelDesc& desc)
@@ -508,7 +821,7 @@ void PhotonMapper::collectPhotons(RenderContext* pRenderContext, const RenderDat
     FALCOR_ASSERT(pRenderContext && collectPass.pProgram && collectPass.pVars);
 
     //bind TLAS
-    bool tlasValid = var["gPhotonAS"].setSrv(mPhotonTlas.pSrv);
+    bool tlasValid = var["gPhotonAS"].setSrv(mPhotonAS.getSrv());
     FALCOR_ASSERT(tlasValid);
     
     //pRenderContext->raytrace(mTracerCollect.pProgram.get(), mTracerCollect.pVars.get(), targetDim.x, targetDim.y, 1);
@@ -527,6 +840,8 @@ void PhotonMapper::renderUI(Gui::Widgets& widget)
     widget.tooltip("Photons for current Iteration / Build Size Acceleration Structure / Max Buffer Size");
     widget.text("Global Photons: " + std::to_string(mPhotonCount[1]) + " / " + std::to_string(mPhotonAccelSizeLastIt[1]) + " / " + std::to_string(mGlobalBuffers.maxSize));
     widget.tooltip("Photons for current Iteration / Build Size Acceleration Structure / Max Buffer Size");
+    widget.text("Photon Counter Latency: " + std::to_string(mPhotonCounterReadback.getLatency()) + " frames");
+    widget.tooltip("The photon counts are read back without waiting for the GPU and lag behind by this many frames");
 
     widget.text("Current Global Radius: " + std::to_string(mGlobalRadius));
     widget.text("Current Caustic Radius: " + std::to_string(mCausticRadius));
@@ -542,6 +857,20 @@ void PhotonMapper::renderUI(Gui::Widgets& widget)
     widget.dummy("", float2(15,0), true);
     mFitBuffersToPhotonShot |= widget.button("Fit Max Size", true);
     widget.tooltip("Fitts the Caustic and Global Buffer to current number of photons shot *  Photon extra space.This is reccomended for better Performance when moving around");
+    widget.checkbox("Automatic Buffer Size", mAutoBufferSize);
+    widget.tooltip("Grows the photon buffers before they overflow and shrinks them after a longer time of low use. Manual sizes are used as the start size");
+    if (mAutoBufferSize) {
+        const auto& causticStats = mCausticSizePolicy.getStats();
+        const auto& globalStats = mGlobalSizePolicy.getStats();
+        widget.text("Resizes: " + std::to_string(causticStats.grows + causticStats.shrinks + globalStats.grows + globalStats.shrinks) + ", Overflows: " + std::to_string(causticStats.overflows + globalStats.overflows));
+        widget.tooltip("Number of automatic buffer resizes and of counts that exceeded the buffer size since the last scene change");
+    }
+    if (widget.var("Photon Generations", mPhotonGenerations, 1u, kMaxPhotonGenerations, 1u)) {
+        mResizePhotonBuffers = true;
+        dirty = true;
+    }
+    widget.tooltip("Number of photon generations kept in the acceleration structure while the camera is static. "
+        "Every generation gets its own BLAS and buffer space of the max buffer sizes, the photons are weighted by 1 / number of generations");
     widget.dummy("", dummySpacing);
 
     //If fit buffers is triggered, also trigger the photon change routine
@@ -556,6 +885,9 @@ void PhotonMapper::renderUI(Gui::Widgets& widget)
         widget.tooltip("Sets the Alpha in SPPM for the Global Photons");
         dirty |= widget.var("Caustic Alpha", mSPPMAlphaCaustic, 0.1f, 1.0f, 0.001f);
         widget.tooltip("Sets the Alpha in SPPM for the Caustic Photons");
+        dirty |= widget.checkbox("Per Pixel Radius", mPerPixelSPPM);
+        widget.tooltip("Every pixel shrinks its own radius with the photons it found (Hachisuka and Jensen).\n"
+                       "The photon AABBs keep the start radius");
     }
     
     widget.dummy("", dummySpacing);
@@ -599,6 +931,11 @@ void PhotonMapper::renderUI(Gui::Widgets& widget)
         dirty |= resetTimer;
     }
 
+    //Convergence measurement
+    if (auto group = widget.group("Convergence")) {
+        dirty |= mConvergence.renderUI(widget);
+    }
+
     //Radius settings
     if (auto group = widget.group("Radius Options")) {
         dirty |= widget.var("Caustic Radius Start", mCausticRadiusStart, kMinPhotonRadius, FLT_MAX, 0.001f);
@@ -623,17 +960,22 @@ void PhotonMapper::renderUI(Gui::Widgets& widget)
         dirty |= widget.checkbox("Enable Photon Culling", mEnablePhotonCulling);
         widget.tooltip("Enables photon culling. For reflected pixels outside of the camera frustrum ray tracing is used.");
         mRebuildCullingBuffer |= widget.slider("Culling Buffer Size", mCullingHashBufferSizeBytes, 10u, 32u);
-        widget.tooltip("Size of the hash buffer. 2^x");
+        widget.tooltip("Number of bits in the culling buffer. 2^x");
+        if (mCullingBuffer) widget.text(fmt::format("Culling buffer: {:.1f} KB", mCullingBuffer->getSize() / 1024.0));
+        dirty |= widget.slider("Culling Hashes", mCullingNumHashes, 1u, kCullingMaxHashes);
+        widget.tooltip("Bits that a cell sets. 1 is a plain bit set, more hashes make it a Bloom filter with fewer false positives as long as only a small part of the bits is set");
+        bool hashFunction = widget.dropdown("Culling Hash Function", kHashFunctionList, mCullingHashFunction);
+        widget.tooltip("Hash function that maps a cell to an entry in the culling buffer");
         bool projMatrix = widget.checkbox("Use Projection Matrix", mUseProjectionMatrixCulling);
         widget.tooltip("Uses Projection Matrix additionally for culling");
         if (mUseProjectionMatrixCulling) {
             dirty |= widget.var("Culling Projection Test Value", mPCullingrojectionTestOver, 1.0f, 1.5f, 0.001f);
             widget.tooltip("Value used for the test with the projected postions. Any absolute value above is culled for the xy coordinate.");
         }
-        if (projMatrix)
+        if (projMatrix || hashFunction)
             mPhotonCullingPass.reset();
 
-        dirty |= mRebuildCullingBuffer | projMatrix;
+        dirty |= mRebuildCullingBuffer | projMatrix | hashFunction;
     }
 
     if (auto group = widget.group("Stochastic Collect")) {
@@ -655,15 +997,49 @@ void PhotonMapper::renderUI(Gui::Widgets& widget)
     }
 
     if (auto group = widget.group("Acceleration Structure Settings")) {
-        dirty |= widget.checkbox("Fast Build", mAccelerationStructureFastBuildUI);
-        widget.tooltip("Enables Fast Build for Acceleration Structure. If enabled tracing time is worse");
+        if (mPhotonASUnsupported) {
+            widget.text("The device has no photon acceleration structure, the photons are gathered on the CPU");
+        }
+        else if (widget.checkbox("CPU Photon Gather", mCpuPhotonGather)) {
+            mRebuildAS = true;
+            dirty = true;
+        }
+        widget.tooltip("Gathers the photons with a BVH over the photon spheres on the CPU (PhotonSphereBVH) instead of the photon acceleration structure.\n"
+            "The AABBs and the hit points are read back every frame, stochastic collect is not used");
+        if (useCpuPhotonGather()) {
+            widget.dropdown("BVH Build", kPhotonBVHBuildModeList, mPhotonBVHBuildMode);
+            widget.tooltip("LBVH sorts the photons by Morton code, binned SAH gives a better hierarchy for a slower build");
+            const auto& stats = mSphereGather.stats;
+            widget.text("Photons found: " + std::to_string(stats.photonsFound) + ", nodes visited: " + std::to_string(stats.nodesVisited));
+            widget.text("BVH memory (MB): " + std::to_string(mSphereGather.gather.getSizeBytes() / (1024.0 * 1024.0)));
+        }
+        else {
+            dirty |= widget.checkbox("Fast Build", mAccelerationStructureFastBuildUI);
+            widget.tooltip("Enables Fast Build for Acceleration Structure. If enabled tracing time is worse");
+            if (mpPhotonASValidation) widget.text("AS validation errors: " + std::to_string(mpPhotonASValidation->getErrorCount()));
+        }
     }
 
-    if (auto group = widget.group("Light Sample Tex")) {
+    if (auto group = widget.group("Light Sampling")) {
         mRebuildLightTex |= widget.dropdown("Sample mode", kLightTexModeList, (uint32_t&)mLightTexMode);
-        widget.tooltip("Changes photon distribution for the light sampling texture. Also rebuilds the texture.");
-        mRebuildLightTex |= widget.button("Rebuild Light Tex");
+        widget.tooltip("Changes photon distribution over the lights. Also rebuilds the light table.");
+        mRebuildLightTex |= widget.button("Rebuild Light Table");
+        //Toggling rebuilds the table, so it starts from the power/area distribution
+        mRebuildLightTex |= widget.checkbox("Adaptive Emission", mAdaptiveEmission);
+        widget.tooltip("Counts per light the stored photons that land in cells marked by the culling pass and moves the light selection towards those lights. "
+            "The flux is divided by the adapted pdf, so the result stays unbiased. Without culling every stored photon counts");
+        if (mAdaptiveEmission) {
+            widget.var("Adaptation Interval", mAdaptiveEmissionInterval, 1u, 256u, 1u);
+            widget.tooltip("Frames the emission counters are accumulated before they are read back and the light table is rebuilt");
+            AdaptiveLightSampling::Options options = mLightAdaptation.getOptions();
+            if (widget.var("Base Share", options.minShare, 0.01f, 1.f, 0.01f))
+                mLightAdaptation.setOptions(options);
+            widget.tooltip("Share of the power/area distribution that is always kept. Keeps every light selectable");
+            widget.text("Visible photons per emitted: " + std::to_string(mLightAdaptation.getVisibleFraction()));
+        }
         dirty |= mRebuildLightTex;
+        widget.checkbox("Async Rebuild", mAsyncLightTexRebuild);
+        widget.tooltip("Rebuilds the light table on a worker thread. The old table is used until the new one is ready");
     }
 
     //Disable Photon Collection
@@ -681,9 +1057,15 @@ void PhotonMapper::renderUI(Gui::Widgets& widget)
     }
 
     mPhotonInfoFormatChanged |= widget.dropdown("Photon Info size", kInfoTexDropdownList, mInfoTexFormat);
-    widget.tooltip("Determines the resolution of each element of the photon info struct.");
+    widget.tooltip("Determines the resolution of each element of the photon info struct.\n"
+        "Compact stores flux, direction and face normal in 16 bytes with LogLuv flux and octahedral directions");
+
+    mPhotonStorageChanged |= widget.dropdown("Photon storage", kPhotonStorageList, mPhotonStorage);
+    widget.tooltip("2D Textures stores the photon infos in columns of 512 photons.\n"
+        "Linear Buffers stores every attribute as a stream in a raw buffer. Buffer sizes are not rounded and the streams are not cleared every iteration");
 
     dirty |= mPhotonInfoFormatChanged;  //Reset iterations if format is changed
+    dirty |= mPhotonStorageChanged;
 
     widget.dummy("", dummySpacing);
     //Reset Iterations
@@ -728,8 +1110,8 @@ void PhotonMapper::createCollectionProgram()
     }
     //Stochastic collect
     {
-        //payload size is num photons + a counter + sampleGenerator(16B)
-        uint maxPayloadSize = (mMaxNumberPhotonsSC + 5) * sizeof(uint);
+        //payload size is num photons + a counter + the radius + sampleGenerator(16B)
+        uint maxPayloadSize = (mMaxNumberPhotonsSC + 6) * sizeof(uint);
 
         RtProgram::Desc desc;
         desc.addShaderLibrary(kShaderCollectStochasticPhoton);
@@ -757,6 +1139,7 @@ void PhotonMapper::setScene(RenderContext* pRenderContext, const Scene::SharedPt
     // After changing scene, the raytracing program should to be recreated.
     mTracerGenerate = RayTraceProgramHelper::create();
     mPhotonASDebugPass = RayTraceProgramHelper::create();
+    mSphereGather.pCollectPass.reset();
     mResetConstantBuffers = true;
     if (mEnablePhotonCulling) mRebuildCullingBuffer = true;
     // Set new scene.
@@ -797,208 +1180,50 @@ void PhotonMapper::setScene(RenderContext* pRenderContext, const Scene::SharedPt
     }
 
     //init the photon counters
-    preparePhotonCounters();
+    preparePhotonCounters(pRenderContext);
 }
 
-void PhotonMapper::getActiveEmissiveTriangles(RenderContext* pRenderContext)
+void PhotonMapper::createLightSampleTable(RenderContext* pRenderContext)
 {
-    auto lightCollection = mpScene->getLightCollection(pRenderContext);
-
-    auto meshLightTriangles = lightCollection->getMeshLightTriangles();
-
-    mActiveEmissiveTriangles.clear();
-    mActiveEmissiveTriangles.reserve(meshLightTriangles.size());
+    FALCOR_ASSERT(mpScene);    //Scene has to be set
 
-    for (uint32_t triIdx = 0; triIdx < (uint32_t)meshLightTriangles.size(); triIdx++)
+    LightSampleTableBuilder::Table table;
     {
-        if (meshLightTriangles[triIdx].flux > 0.f)
-        {
-            mActiveEmissiveTriangles.push_back(triIdx);
-        }
+        FALCOR_PROFILE("light sample table");
+        auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::LightTable);
+        auto input = LightSampleTableBuilder::createInput(pRenderContext, mpScene, mNumPhotons, mMaxDispatchY, (LightSampleTableBuilder::Mode)mLightTexMode);
+        table = mLightTableBuilder.build(input);
     }
+    uploadLightSampleTable(table);
 }
 
-void PhotonMapper::createLightSampleTexture(RenderContext* pRenderContext)
+void PhotonMapper::uploadLightSampleTable(const LightSampleTableBuilder::Table& table)
 {
-    if (mPhotonsPerTriangle) mPhotonsPerTriangle.reset();
-    if (mLightSampleTex) mLightSampleTex.reset();
-
-    FALCOR_ASSERT(mpScene);    //Scene has to be set
-
-    auto analyticLights = mpScene->getActiveLights();
-    auto lightCollection = mpScene->getLightCollection(pRenderContext);
-
-    uint analyticPhotons = 0;
-    uint numEmissivePhotons = 0;
-    //If there are analytic Lights split number of Photons even between the analytic light and the number of emissive models (approximation of the number of emissive lights)
-    if (analyticLights.size() != 0){
-        uint lightsTotal = static_cast<uint>(analyticLights.size() + lightCollection->getMeshLights().size());
-        float percentAnalytic = static_cast<float>(analyticLights.size()) / static_cast<float>(lightsTotal);
-        analyticPhotons = static_cast<uint>(mNumPhotons * percentAnalytic);
-        analyticPhotons += (uint)analyticLights.size() - (analyticPhotons % (uint) analyticLights.size());  //add it up so every light gets the same number of photons
-        numEmissivePhotons = mNumPhotons - analyticPhotons;
-    }
-    else
-        numEmissivePhotons = mNumPhotons;
-
-    std::vector<uint> numPhotonsPerTriangle;    //only filled when there are emissive
-
-    if (numEmissivePhotons > 0) {
-        getActiveEmissiveTriangles(pRenderContext);
-        auto meshLightTriangles = lightCollection->getMeshLightTriangles();
-        //Get total area to distribute to get the number of photons per area.
-        float totalMode = 0;
-        for (uint i = 0; i < (uint) mActiveEmissiveTriangles.size(); i++) {
-            uint triIdx = mActiveEmissiveTriangles[i];
-
-            switch(mLightTexMode){
-            case LightTexMode::power:
-                totalMode += meshLightTriangles[triIdx].flux;
-                break;
-            case LightTexMode::area:
-                totalMode += meshLightTriangles[triIdx].area;
-                break;
-            default:
-                totalMode += meshLightTriangles[triIdx].flux;
-            }
-            
-        }
-        float photonsPerMode = numEmissivePhotons / totalMode;
-
-        //Calculate photons on a per triangle base
-        uint tmpNumEmissivePhotons = 0; //Real count will change due to rounding
-        numPhotonsPerTriangle.reserve(mActiveEmissiveTriangles.size());
-        for (uint i = 0; i < (uint)mActiveEmissiveTriangles.size(); i++) {
-            uint triIdx = mActiveEmissiveTriangles[i];
-            uint photons = 0;
-
-            switch (mLightTexMode) {
-            case LightTexMode::power:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].flux * photonsPerMode));
-                break;
-            case LightTexMode::area:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].area * photonsPerMode));
-                break;
-            default:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].flux * photonsPerMode));
-            }
-
-            
-            if (photons == 0) photons = 1;  //shoot at least one photon
-            tmpNumEmissivePhotons += photons;
-            numPhotonsPerTriangle.push_back(photons);
-        }
-        numEmissivePhotons = tmpNumEmissivePhotons;     //get real photon count
-    }
-
-    uint totalNumPhotons = numEmissivePhotons + analyticPhotons;
-
-    //calculate the pdf for analytic and emissive light
-    if (analyticPhotons > 0 && analyticLights.size() > 0) {
-        mAnalyticInvPdf = (static_cast<float>(totalNumPhotons) * static_cast<float>(analyticLights.size())) / static_cast<float>(analyticPhotons);
-    }
-    if (numEmissivePhotons > 0 && lightCollection->getActiveLightCount()) {
-        mEmissiveInvPdf = (static_cast<float>(totalNumPhotons) * lightCollection->getActiveLightCount()) / static_cast<float>(numEmissivePhotons);
-    }
-   
-
-    const uint blockSize = 16;
-    const uint blockSizeSq = blockSize * blockSize;
+    FALCOR_PROFILE("upload light sample table");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::LightTable);
 
-    //Create texture. The texture fills 16x16 fields with information
-    
-    uint xPhotons = (totalNumPhotons / mMaxDispatchY) + 1;
-    xPhotons += (xPhotons % blockSize == 0 && analyticPhotons > 0) ? blockSize : blockSize - (xPhotons % blockSize);  //Fill up so x to 16x16 block with at least 1 block extra when mixed
-
-    //Init the texture with the invalid index (zero)
-    //Negative indices are analytic and postivie indices are emissive
-    std::vector<int32_t> lightIdxTex(xPhotons * mMaxDispatchY, 0);
-
-    //Helper functions
-    auto getIndex = [&](uint2 idx) {
-        return idx.x + idx.y * xPhotons;
-    };
+    if (mLightAliasTable) mLightAliasTable.reset();
 
-    auto getBlockStartingIndex = [&](uint blockIdx) {
-        blockIdx = blockIdx * blockSize;          //Multiply by the expansion of the box in x
-        uint x = blockIdx % xPhotons;
-        uint y = (blockIdx / xPhotons) * blockSize;
-        return uint2(x, y);
-    };
-
-    //Fill analytic lights
-    if (analyticLights.size() > 0) {
-        uint numCurrentLight = 0;
-        uint step = analyticPhotons / static_cast<uint>(analyticLights.size());
-        bool stop = false;
-        for (uint i = 0; i <= analyticPhotons / blockSizeSq; i++) {
-            if (stop) break;
-            for (uint y = 0; y < blockSize; y++) {
-                if (stop) break;
-                for (uint x = 0; x < blockSize; x++) {
-                    if (numCurrentLight >= analyticPhotons) {
-                        stop = true;
-                        break;
-                    }
-                    uint2 idx = getBlockStartingIndex(i);
-                    idx += uint2(x, y);
-                    int32_t lightIdx = static_cast<int32_t>((numCurrentLight / step) + 1);  //current light index + 1
-                    lightIdx *= -1;                                                         //turn it negative as it is a analytic light
-                    lightIdxTex[getIndex(idx)] = lightIdx;
-                    numCurrentLight++;
-                }
-            }
-        }
+    //Create the alias table buffer. Memory scales with the number of lights
+    mLightAliasTableSize = static_cast<uint>(table.aliasTable.size());
+    if (mLightAliasTableSize > 0) {
+        mLightAliasTable = Buffer::createStructured(sizeof(LightAliasEntry), mLightAliasTableSize, ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, table.aliasTable.data());
     }
-    
-
-    //Fill emissive lights
-    if (numEmissivePhotons > 0) {
-        uint analyticEndBlock = analyticPhotons > 0 ? (analyticPhotons / blockSizeSq) + 1 : 0;    //we have guaranteed an extra block
-        uint currentActiveTri = 0;
-        uint lightInActiveTri = 0;
-        bool stop = false;
-        for (uint i = 0; i <= numEmissivePhotons / blockSizeSq; i++) {
-            if (stop) break;
-            for (uint y = 0; y < blockSize; y++) {
-                if (stop) break;
-                for (uint x = 0; x < blockSize; x++) {
-                    if (currentActiveTri >= static_cast<uint>(numPhotonsPerTriangle.size())) {
-                        stop = true;
-                        break;
-                    }
-                    uint2 idx = getBlockStartingIndex(i + analyticEndBlock);
-                    idx += uint2(x, y);
-                    int32_t lightIdx = static_cast<int32_t>(currentActiveTri + 1);      //emissive has the positive index
-                    lightIdxTex[getIndex(idx)] = lightIdx;
-
-                    //Check if the number of photons exeed that of the current active triangle
-                    lightInActiveTri++;
-                    if (lightInActiveTri >= numPhotonsPerTriangle[currentActiveTri]) {
-                        currentActiveTri++;
-                        lightInActiveTri = 0;
-                    }
-                }
-            }
-        }
+    else {
+        //Table with a single invalid light, so the generate pass stays valid in a scene without lights
+        LightAliasEntry invalid = { 1.f, 0, 0, 0.f };
+        mLightAliasTable = Buffer::createStructured(sizeof(LightAliasEntry), 1, ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, &invalid);
+        mLightAliasTableSize = 1;
     }
-    
-
-
-    //Create texture and Pdf buffer
-    mLightSampleTex = Texture::create2D(xPhotons, mMaxDispatchY, ResourceFormat::R32Int, 1, 1, lightIdxTex.data());
-    mLightSampleTex->setName("PhotonMapper::LightSampleTex");
-
-    //Create a buffer for num photons per triangle
-    if (numPhotonsPerTriangle.size() == 0) {
-        numPhotonsPerTriangle.push_back(0);
-    }
-    mPhotonsPerTriangle = Buffer::createStructured(sizeof(uint), static_cast<uint32_t>(numPhotonsPerTriangle.size()), ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, numPhotonsPerTriangle.data());
-    mPhotonsPerTriangle->setName("PhotonMapper::mPhotonsPerTriangleEmissive");
+    mLightAliasTable->setName("PhotonMapper::LightAliasTable");
 
+    //The adaptation history is kept while the table has the same entries
+    mLightModeProbabilities = table.modeProbabilities;
+    if (mLightAdaptation.getEntryCount() != mLightModeProbabilities.size())
+        mLightAdaptation.reset(mLightModeProbabilities.size());
 
     //Set numPhoton variable
-    mPGDispatchX = xPhotons;
+    mPGDispatchX = table.width;
 
     mNumPhotons = mPGDispatchX * mMaxDispatchY;
     mNumPhotonsUI = mNumPhotons;
@@ -1012,19 +1237,55 @@ void PhotonMapper::resetPhotonMapper()
     mResizePhotonBuffers = true; mPhotonBuffersReady = false;
     mCausticBuffers.maxSize = 0; mGlobalBuffers.maxSize = 0;
     mPhotonCount[0] = 0; mPhotonCount[1] = 0;
+    mCausticSizePolicy.reset(); mGlobalSizePolicy.reset();
     mCullingBuffer.reset();
 
-    //reset light sample tex
-    mLightSampleTex = nullptr;
+    //reset light table
+    mLightAliasTable = nullptr;
+    mLightAdaptation.reset(0);
+    mLightEmissionCounter.reset();
+}
+
+void PhotonMapper::updateAdaptiveEmission(RenderContext* pRenderContext)
+{
+    //Counters for every alias table entry. Recreated if the table size changed
+    const uint numValues = 2 * mLightAliasTableSize;
+    if (!mLightEmissionCounter || mLightEmissionCounter->getElementCount() != numValues) {
+        mLightEmissionCounter = Buffer::createStructured(sizeof(uint), numValues);
+        mLightEmissionCounter->setName("PhotonMapper::LightEmissionCounter");
+        pRenderContext->clearUAV(mLightEmissionCounter->getUAV().get(), uint4(0));
+        mLightEmissionReadback.init(FalcorReadbackDevice::create(pRenderContext, mLightEmissionCounter, sizeof(uint) * numValues));
+        mAdaptiveEmissionFrames = 0;
+    }
+
+    //Rebuild the table with the adapted probabilities. The current table is used until the build is done
+    if (mLightEmissionReadback.poll()) {
+        const auto& data = mLightEmissionReadback.getData();
+        std::vector<uint32_t> counts(data.size() / sizeof(uint32_t));
+        std::memcpy(counts.data(), data.data(), counts.size() * sizeof(uint32_t));
+        if (mLightAdaptation.addCounts(counts.data(), counts.size()) && !mLightTableBuilder.isBuilding()) {
+            auto input = LightSampleTableBuilder::createInput(pRenderContext, mpScene, mNumPhotons, mMaxDispatchY, (LightSampleTableBuilder::Mode)mLightTexMode);
+            input.entryProbabilities = mLightAdaptation.getProbabilities(mLightModeProbabilities);
+            mLightTableBuilder.buildAsync(std::move(input));
+        }
+    }
+
+    //Read back the counts of the last frames. The copy is recorded before the generate pass of this frame
+    if (mAdaptiveEmissionFrames >= mAdaptiveEmissionInterval) {
+        mLightEmissionReadback.enqueue();
+        pRenderContext->clearUAV(mLightEmissionCounter->getUAV().get(), uint4(0));
+        mAdaptiveEmissionFrames = 0;
+    }
+    mAdaptiveEmissionFrames++;
 }
 
 void PhotonMapper::changeNumPhotons()
 {
-    //If photon number differ reset the light sample texture
+    //If photon number differ reset the light table
     if (mNumPhotonsUI != mNumPhotons) {
-        //Reset light sample tex and frame counter
+        //Reset light table and frame counter
         mNumPhotons = mNumPhotonsUI;
-        mLightSampleTex = nullptr;
+        mLightAliasTable = nullptr;
         mFrameCount = 0;
     }
 
@@ -1039,12 +1300,29 @@ void PhotonMapper::changeNumPhotons()
 
 void PhotonMapper::copyPhotonCounter(RenderContext* pRenderContext)
 {
-    //Copy the photonConter to a CPU Buffer
-    pRenderContext->copyBufferRegion(mPhotonCounterBuffer.cpuCopy.get(), 0, mPhotonCounterBuffer.counter.get(), 0, sizeof(uint32_t) * 2);
+    //Counts from before a reset are not valid for the new iteration
+    if (mFrameCount == 0)
+        mPhotonCounterReadback.invalidate();
+
+    mPhotonCounterReadback.enqueue();
+}
 
-    void* data = mPhotonCounterBuffer.cpuCopy->map(Buffer::MapType::Read);
-    std::memcpy(mPhotonCount.data(), data, sizeof(uint) * 2);
-    mPhotonCounterBuffer.cpuCopy->unmap();
+void PhotonMapper::updatePhotonCounter()
+{
+    if (mPhotonCounterReadback.poll()) {
+        auto count = mPhotonCounterReadback.getValue<std::array<uint, 2>>();
+        mPhotonCount[0] = count[0]; mPhotonCount[1] = count[1];
+
+        //Resize the buffers before photons get clamped onto the last slot. The counters are not clamped, so overflows show up in the count
+        if (mAutoBufferSize && mPhotonBuffersReady && !mResizePhotonBuffers) {
+            uint causticSize = static_cast<uint>(mCausticSizePolicy.addCount(count[0]));
+            uint globalSize = static_cast<uint>(mGlobalSizePolicy.addCount(count[1]));
+            if (causticSize != mCausticBuffers.maxSize || globalSize != mGlobalBuffers.maxSize) {
+                mCausticBufferSizeUI = causticSize; mGlobalBufferSizeUI = globalSize;
+                mResizePhotonBuffers = true;
+            }
+        }
+    }
 }
 
 void PhotonMapper::prepareVars()
@@ -1085,52 +1363,111 @@ void PhotonMapper::preparePhotonInfoTexture()
 {
     FALCOR_ASSERT(mCausticBuffers.maxSize > 0 || mGlobalBuffers.maxSize > 0);
     //clean tex
-    mCausticBuffers.infoFlux.reset(); mCausticBuffers.infoDir.reset();
-    mGlobalBuffers.infoFlux.reset(); mGlobalBuffers.infoDir.reset();
+    mCausticBuffers.infoFlux.reset(); mCausticBuffers.infoDir.reset(); mCausticBuffers.packed.reset(); mCausticBuffers.streams.reset();
+    mGlobalBuffers.infoFlux.reset(); mGlobalBuffers.infoDir.reset(); mGlobalBuffers.packed.reset(); mGlobalBuffers.streams.reset();
+    mCausticBuffers.layout = {}; mGlobalBuffers.layout = {};
+
+    //Linear storage keeps all infos of a map in one buffer
+    if (isLinearStorage(mPhotonStorage)) {
+        mCausticBuffers.layout = createPhotonStreamLayout(mCausticBuffers.capacity, mInfoTexFormat);
+        mCausticBuffers.streams = PhotonStreams::createBuffer(mCausticBuffers.layout, "PhotonMapper::mCausticBuffers.streams");
+        mGlobalBuffers.layout = createPhotonStreamLayout(mGlobalBuffers.capacity, mInfoTexFormat);
+        mGlobalBuffers.streams = PhotonStreams::createBuffer(mGlobalBuffers.layout, "PhotonMapper::mGlobalBuffers.streams");
+        return;
+    }
+
+    //Compact photons need a single texture per map
+    if (isCompactFormat(mInfoTexFormat)) {
+        mCausticBuffers.packed = Texture::create2D(mCausticBuffers.capacity / kInfoTexHeight, kInfoTexHeight, ResourceFormat::RGBA32Uint, 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+        mCausticBuffers.packed->setName("PhotonMapper::mCausticBuffers.packed");
+        mGlobalBuffers.packed = Texture::create2D(mGlobalBuffers.capacity / kInfoTexHeight, kInfoTexHeight, ResourceFormat::RGBA32Uint, 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+        mGlobalBuffers.packed->setName("PhotonMapper::mGlobalBuffers.packed");
+
+        FALCOR_ASSERT(mCausticBuffers.packed); FALCOR_ASSERT(mGlobalBuffers.packed);
+        return;
+    }
 
     //Caustic
-    mCausticBuffers.infoFlux = Texture::create2D(mCausticBuffers.maxSize / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, true), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+    mCausticBuffers.infoFlux = Texture::create2D(mCausticBuffers.capacity / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, true), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
     mCausticBuffers.infoFlux->setName("PhotonMapper::mCausticBuffers.fluxInfo");
-    mCausticBuffers.infoDir = Texture::create2D(mCausticBuffers.maxSize / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, false), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+    mCausticBuffers.infoDir = Texture::create2D(mCausticBuffers.capacity / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, false), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
     mCausticBuffers.infoDir->setName("PhotonMapper::mCausticBuffers.dirInfo");
 
     FALCOR_ASSERT(mCausticBuffers.infoFlux); FALCOR_ASSERT(mCausticBuffers.infoDir);
 
-    mGlobalBuffers.infoFlux = Texture::create2D(mGlobalBuffers.maxSize / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, true), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+    mGlobalBuffers.infoFlux = Texture::create2D(mGlobalBuffers.capacity / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, true), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
     mGlobalBuffers.infoFlux->setName("PhotonMapper::mGlobalBuffers.fluxInfo");
-    mGlobalBuffers.infoDir = Texture::create2D(mGlobalBuffers.maxSize / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, false), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+    mGlobalBuffers.infoDir = Texture::create2D(mGlobalBuffers.capacity / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, false), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
     mGlobalBuffers.infoDir->setName("PhotonMapper::mGlobalBuffers.dirInfo");
 
     FALCOR_ASSERT(mGlobalBuffers.infoFlux); FALCOR_ASSERT(mGlobalBuffers.infoDir);
 }
 
+uint PhotonMapper::getPhotonBufferGranularity() const
+{
+    return isLinearStorage(mPhotonStorage) ? 1 : kInfoTexHeight;
+}
+
+void PhotonMapper::updateSizePolicyGranularity()
+{
+    for (PhotonBufferSizePolicy* policy : { &mCausticSizePolicy, &mGlobalSizePolicy }) {
+        PhotonBufferSizePolicy::Options options = policy->getOptions();
+        options.granularity = getPhotonBufferGranularity();
+        policy->setOptions(options);
+    }
+}
+
 bool PhotonMapper::preparePhotonBuffers()
 {
     FALCOR_ASSERT(mCausticBuffers.maxSize > 0 || mGlobalBuffers.maxSize > 0);
 
 
     //clean buffers
-    mCausticBuffers.aabb.reset(); mCausticBuffers.blas.reset();
-    mGlobalBuffers.aabb.reset(); mGlobalBuffers.blas.reset(); 
+    mPhotonAS.release();
+    mCausticBuffers.aabb.reset();
+    mGlobalBuffers.aabb.reset();
+    mAabbClearBuffer.reset();
+
+    //Every generation of the ring needs maxSize photons. The info textures are limited in width
+    uint generations = mPhotonGenerations;
+    if (!isLinearStorage(mPhotonStorage)) {
+        const uint maxSlotWidth = std::max(mCausticBuffers.maxSize, mGlobalBuffers.maxSize) / kInfoTexHeight;
+        const uint maxGenerations = std::max(kMaxInfoTexWidth / std::max(maxSlotWidth, 1u), 1u);
+        if (generations > maxGenerations) {
+            logWarning("PhotonMapper: " + std::to_string(generations) + " photon generations exceed the info texture width, using " + std::to_string(maxGenerations));
+            generations = maxGenerations;
+        }
+    }
+    mPhotonRing.setGenerationCount(generations);
+    mCausticBuffers.capacity = mCausticBuffers.maxSize * mPhotonRing.getGenerationCount();
+    mGlobalBuffers.capacity = mGlobalBuffers.maxSize * mPhotonRing.getGenerationCount();
 
     //TODO: Change Buffer Generation to initilize with program
-    mCausticBuffers.aabb = Buffer::createStructured(sizeof(D3D12_RAYTRACING_AABB), mCausticBuffers.maxSize);
+    mCausticBuffers.aabb = Buffer::createStructured(PhotonAccelerationStructure::kAABBStride, mCausticBuffers.capacity);
     mCausticBuffers.aabb->setName("PhotonMapper::mCausticBuffers.aabb");
     
     FALCOR_ASSERT(mCausticBuffers.aabb);
 
-    mGlobalBuffers.aabb = Buffer::createStructured(sizeof(D3D12_RAYTRACING_AABB), mGlobalBuffers.maxSize);
+    mGlobalBuffers.aabb = Buffer::createStructured(PhotonAccelerationStructure::kAABBStride, mGlobalBuffers.capacity);
     mGlobalBuffers.aabb->setName("PhotonMapper::mGlobalBuffers.aabb");
 
     FALCOR_ASSERT(mGlobalBuffers.aabb);
 
+    //Zeros for clearing the AABBs of one ring slot
+    if (mPhotonRing.getGenerationCount() > 1) {
+        const size_t clearSize = size_t(std::max(mCausticBuffers.maxSize, mGlobalBuffers.maxSize)) * PhotonAccelerationStructure::kAABBStride;
+        std::vector<uint8_t> zeros(clearSize, 0);
+        mAabbClearBuffer = Buffer::create(clearSize, ResourceBindFlags::None, Buffer::CpuAccess::None, zeros.data());
+        mAabbClearBuffer->setName("PhotonMapper::mAabbClearBuffer");
+    }
+
     //Create/recreate the textures
     preparePhotonInfoTexture();
     
     return true;
 }
 
-void PhotonMapper::preparePhotonCounters()
+void PhotonMapper::preparePhotonCounters(RenderContext* pRenderContext)
 {
     //photon counter
     mPhotonCounterBuffer.counter = Buffer::createStructured(sizeof(uint), 2);
@@ -1138,180 +1475,228 @@ void PhotonMapper::preparePhotonCounters()
     uint64_t zeroInit = 0;
     mPhotonCounterBuffer.reset = Buffer::create(sizeof(uint64_t), ResourceBindFlags::None, Buffer::CpuAccess::None, &zeroInit);
     mPhotonCounterBuffer.reset->setName("PhotonMapper::PhotonCounterReset");
-    uint32_t oneInit[2] = { 1,1 };
-    mPhotonCounterBuffer.cpuCopy = Buffer::create(sizeof(uint64_t), ResourceBindFlags::None, Buffer::CpuAccess::Read, oneInit);
-    mPhotonCounterBuffer.cpuCopy->setName("PhotonMapper::PhotonCounterCPU");
+    mPhotonCounterReadback.init(FalcorReadbackDevice::create(pRenderContext, mPhotonCounterBuffer.counter, sizeof(uint) * 2));
 }
 
 void PhotonMapper::createAccelerationStructure(RenderContext* pContext) {
-
-    //clear all previous data
-    if (mRebuildAS) {
-        mBlasData.clear();
-        mPhotonInstanceDesc.clear();
-        mTlasScratch = nullptr;
-        mPhotonTlas.pInstanceDescs = nullptr; mPhotonTlas.pSrv = nullptr; mPhotonTlas.pTlas = nullptr;
+    if (!mPhotonAS.hasBackend() && !mPhotonASUnsupported) {
+        auto pBackend = PhotonAccelerationStructure::createDeviceBackend();
+        if (pBackend) {
+            //The device backend runs through the checks of the null backend
+            if (mValidatePhotonAS) {
+                mpPhotonASValidation = NullPhotonASBackend::create(pBackend);
+                pBackend = mpPhotonASValidation;
+            }
+            mPhotonAS.setBackend(pBackend);
+        }
+        else {
+            logWarning("PhotonMapper: The device has no photon acceleration structure, gathering the photons with the CPU photon sphere BVH");
+            mPhotonASUnsupported = true;
+        }
     }
-    //Reset scratch max size here
-    mBlasScratchMaxSize = 0; mTlasScratchMaxSize = 0;
 
-    createBottomLevelAS(pContext);
-    createTopLevelAS(pContext);
-    if (mRebuildAS) mRebuildAS = false; //AS was rebuild so dont do that again
-
-}
-void PhotonMapper::createTopLevelAS(RenderContext* pContext) {
-    //TODO:: Enable Update
-
-    //fill the instance description if empty
-    for (int i = 0; i < 2; i++) {
-        D3D12_RAYTRACING_INSTANCE_DESC desc = {};
-        desc.AccelerationStructure = i == 0 ? mCausticBuffers.blas->getGpuAddress() : mGlobalBuffers.blas->getGpuAddress();
-        desc.Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
-        desc.InstanceID = i;
-        desc.InstanceMask = i + 1;  //0b01 for Caustic and 0b10 for Global
-        desc.InstanceContributionToHitGroupIndex = 0;
-
-        //Create a identity matrix for the transform and copy it to the instance desc
-        glm::mat4 transform4x4 = glm::identity<glm::mat4>();
-        std::memcpy(desc.Transform, &transform4x4, sizeof(desc.Transform));
-        mPhotonInstanceDesc.push_back(desc);
+    //The CPU gather has a BVH per ring slot and map instead of the BLAS
+    if (useCpuPhotonGather()) {
+        mPhotonAS.release();
+        mSphereGather.gather.setGenerationCount(mPhotonRing.getGenerationCount());
+        mPhotonRing.reset();
+        mRebuildAS = false;
+        return;
     }
-    
-
-    FALCOR_PROFILE("buildPhotonTlas");
+    mSphereGather.gather.setGenerationCount(0);
 
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
-    inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
-    inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-    inputs.NumDescs = (uint32_t)mPhotonInstanceDesc.size();
-    inputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD;
-
-    //if scratch is empty, create one
-    //Prebuild
-    FALCOR_GET_COM_INTERFACE(gpDevice->getApiHandle(), ID3D12Device5, pDevice5);
-    pDevice5->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &mTlasPrebuildInfo);
-    mTlasScratch = Buffer::create(std::max(mTlasPrebuildInfo.ScratchDataSizeInBytes, mTlasScratchMaxSize), Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
-    mTlasScratch->setName("PhotonMapper::TLAS_Scratch");
-
-    //if buffers for the tlas are empty create them
-    mPhotonTlas.pTlas = Buffer::create(mTlasPrebuildInfo.ResultDataMaxSizeInBytes, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
-    mPhotonTlas.pTlas->setName("PhotonMapper::TLAS");
-    mPhotonTlas.pInstanceDescs = Buffer::create((uint32_t)mPhotonInstanceDesc.size() * sizeof(D3D12_RAYTRACING_INSTANCE_DESC), Buffer::BindFlags::None, Buffer::CpuAccess::Write, mPhotonInstanceDesc.data());
-    mPhotonTlas.pInstanceDescs->setName("PhotonMapper::TLAS_Instance_Description");
-
-    mPhotonTlas.pSrv = ShaderResourceView::createViewForAccelerationStructure(mPhotonTlas.pTlas);
+    //A caustic and a global BLAS per ring slot, the index is the instance ID of PhotonGenerationRing.slang.
+    //All are allocated for the max number of photons and read the AABBs of their slot
+    std::vector<PhotonAccelerationStructure::Geometry> geometries;
+    for (uint slot = 0; slot < mPhotonRing.getGenerationCount(); slot++) {
+        geometries.push_back({ mCausticBuffers.aabb, mCausticBuffers.maxSize, slot * mCausticBuffers.maxSize, 1 });
+        geometries.push_back({ mGlobalBuffers.aabb, mGlobalBuffers.maxSize, slot * mGlobalBuffers.maxSize, 2 });
+    }
+    mPhotonAS.create(geometries, mAccelerationStructureFastBuild);
+    mPhotonRing.reset();    //The new BLAS are not built yet
+    mRebuildAS = false; //AS was rebuild so dont do that again
 }
 
 void PhotonMapper::buildTopLevelAS(RenderContext* pContext)
 {
+    if (useCpuPhotonGather()) return;
+
     FALCOR_PROFILE("buildPhotonTlas");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::TlasBuild);
     //TODO:: Enable Update option
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
-    inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
-    inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-    inputs.NumDescs = (uint32_t)mPhotonInstanceDesc.size();
-    inputs.Flags = mAccelerationStructureFastBuild ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
-
-    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
-    asDesc.Inputs = inputs;
-    asDesc.Inputs.InstanceDescs = mPhotonTlas.pInstanceDescs->getGpuAddress();
-    asDesc.ScratchAccelerationStructureData = mTlasScratch->getGpuAddress();
-    asDesc.DestAccelerationStructureData = mPhotonTlas.pTlas->getGpuAddress();
-
-    // Create TLAS
-    FALCOR_GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
-    pContext->resourceBarrier(mPhotonTlas.pInstanceDescs.get(), Resource::State::NonPixelShader);
-    pList4->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
-    pContext->uavBarrier(mPhotonTlas.pTlas.get());                   //barrier for the tlas so we can use it savely after creation
-}
-
-void PhotonMapper::createBottomLevelAS(RenderContext* pContext)
-{
-    mBlasData.resize(2);
-    //Prebuild
-    for (size_t i = 0; i < mBlasData.size(); i++) {
-        auto& blas = mBlasData[i];
-        //Create geometry description
-        D3D12_RAYTRACING_GEOMETRY_DESC& desc = blas.geomDescs;
-        desc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS;
-        desc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION;
-        desc.AABBs.AABBCount = i == 0 ? mCausticBuffers.maxSize : mGlobalBuffers.maxSize;
-        desc.AABBs.AABBs.StartAddress = i == 0 ? mCausticBuffers.aabb->getGpuAddress() : mGlobalBuffers.aabb->getGpuAddress();
-        desc.AABBs.AABBs.StrideInBytes = sizeof(D3D12_RAYTRACING_AABB);
-
-        //Create input for blas
-        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS& inputs = blas.buildInputs;
-        inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-        inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
-        inputs.NumDescs = 1;
-        inputs.pGeometryDescs = &blas.geomDescs;
-        inputs.Flags = mAccelerationStructureFastBuild ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
-        //get prebuild Info
-        FALCOR_GET_COM_INTERFACE(gpDevice->getApiHandle(), ID3D12Device5, pDevice5);
-        pDevice5->GetRaytracingAccelerationStructurePrebuildInfo(&blas.buildInputs, &blas.prebuildInfo);
-
-        // Figure out the padded allocation sizes to have proper alignment.
-        FALCOR_ASSERT(blas.prebuildInfo.ResultDataMaxSizeInBytes > 0);
-        blas.blasByteSize = align_to((uint64_t)D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, blas.prebuildInfo.ResultDataMaxSizeInBytes);
-
-        uint64_t scratchByteSize = std::max(blas.prebuildInfo.ScratchDataSizeInBytes, blas.prebuildInfo.UpdateScratchDataSizeInBytes);
-        blas.scratchByteSize = align_to((uint64_t)D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, scratchByteSize);
-
-        mBlasScratchMaxSize = std::max(blas.scratchByteSize, mBlasScratchMaxSize);
-    }
-
-    //Create the scratch and blas buffers
-    mBlasScratch = Buffer::create(mBlasScratchMaxSize, Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
-    mBlasScratch->setName("PhotonMapper::BlasScratch");
-
-    mCausticBuffers.blas = Buffer::create(mBlasData[0].blasByteSize, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
-    mCausticBuffers.blas->setName("PhotonMapper::CausticBlasBuffer");
-
-
-    mGlobalBuffers.blas = Buffer::create(mBlasData[1].blasByteSize, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
-    mGlobalBuffers.blas->setName("PhotonMapper::GlobalBlasBuffer");
+    mPhotonAS.buildTopLevel(pContext);
+    if (mpPhotonASValidation) mpPhotonASValidation->clearBuilds();
 }
 
 void PhotonMapper::buildBottomLevelAS(RenderContext* pContext, std::array<uint,2>& aabbCount) {
 
     FALCOR_PROFILE("buildPhotonBlas");
-    if (!gpDevice->isFeatureSupported(Device::SupportedFeatures::Raytracing))
-    {
-        throw std::exception("Raytracing is not supported by the current device");
-    }
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::BlasBuild);
 
     //aabb buffers need to be ready
     pContext->uavBarrier(mCausticBuffers.aabb.get());
     pContext->uavBarrier(mGlobalBuffers.aabb.get());
 
-    for (size_t i = 0; i < mBlasData.size(); i++) {
-        auto& blas = mBlasData[i];
+    if (useCpuPhotonGather()) {
+        buildPhotonSphereBVH(pContext, aabbCount);
+        return;
+    }
 
-        //barriers for the scratch and blas buffer
-        pContext->uavBarrier(mBlasScratch.get());
-        pContext->uavBarrier(i == 0 ? mCausticBuffers.blas.get() : mGlobalBuffers.blas.get());
+    const uint slot = mPhotonRing.getCurrentSlot();
+    for (uint i = 0; i < 2; i++)
+        aabbCount[i] = mPhotonAS.buildBottomLevel(pContext, getPhotonInstanceID(slot, i), aabbCount[i]);
 
-        //add the photon count for this iteration. geomDesc is saved as a pointer in blasInputs
-        uint maxPhotons = i == 0 ? mCausticBuffers.maxSize : mGlobalBuffers.maxSize;
-        aabbCount[i] = std::min(aabbCount[i], maxPhotons);
-        blas.geomDescs.AABBs.AABBCount = static_cast<UINT64>(aabbCount[i]);
+    //Slots without a generation since the last reset must not keep old photons
+    for (uint staleSlot : mPhotonRing.takeStaleSlots()) {
+        for (uint i = 0; i < 2; i++)
+            mPhotonAS.buildBottomLevel(pContext, getPhotonInstanceID(staleSlot, i), 0);
+    }
+}
 
-        //Fill the build desc struct
-        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
-        asDesc.Inputs = blas.buildInputs;
-        asDesc.ScratchAccelerationStructureData = mBlasScratch->getGpuAddress();
-        asDesc.DestAccelerationStructureData = i == 0 ? mCausticBuffers.blas->getGpuAddress(): mGlobalBuffers.blas->getGpuAddress();
+void PhotonMapper::buildPhotonSphereBVH(RenderContext* pContext, std::array<uint, 2>& aabbCount)
+{
+    if (!mSphereGather.pThreadPool) mSphereGather.pThreadPool = std::make_unique<WorkStealingThreadPool>();
 
-        //Build the acceleration structure
-        FALCOR_GET_COM_INTERFACE(pContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
-        pList4->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+    const uint slot = mPhotonRing.getCurrentSlot();
+    const auto mode = static_cast<PhotonSphereBVH::BuildMode>(mPhotonBVHBuildMode);
+    for (uint i = 0; i < 2; i++) {
+        const PhotonBuffers& buffers = i == 0 ? mCausticBuffers : mGlobalBuffers;
+        aabbCount[i] = std::min(aabbCount[i], buffers.maxSize);
+        //Waits for the generate pass. The AABBs have the radius of this iteration, later iterations gather with the same or a smaller one
+        const uint firstPhoton = slot * buffers.maxSize;
+        const std::vector<uint8_t> aabbs = PhotonStreams::readback(pContext, buffers.aabb.get(), uint64_t(firstPhoton) * PhotonAccelerationStructure::kAABBStride,
+            uint64_t(aabbCount[i]) * PhotonAccelerationStructure::kAABBStride);
+        mSphereGather.gather.buildSlot(i, slot, aabbs, firstPhoton, i == 0 ? mCausticRadius : mGlobalRadius, mode, mSphereGather.pThreadPool.get());
+    }
 
-        //Barrier for the blas
-        pContext->uavBarrier(i == 0 ? mCausticBuffers.blas.get() : mGlobalBuffers.blas.get());
+    //Slots without a generation since the last reset must not keep old photons
+    for (uint staleSlot : mPhotonRing.takeStaleSlots()) {
+        for (uint i = 0; i < 2; i++)
+            mSphereGather.gather.clearSlot(i, staleSlot);
     }
 }
 
+void PhotonMapper::collectPhotonsBVH(RenderContext* pRenderContext, const RenderData& renderData)
+{
+    FALCOR_PROFILE("collect photons");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Collect);
+
+    const uint2 targetDim = renderData.getDefaultTextureDims();
+    FALCOR_ASSERT(targetDim.x > 0 && targetDim.y > 0);
+    const uint pixelCount = targetDim.x * targetDim.y;
+
+    //The passes are recreated if a define changed
+    bool setConstants = mResetConstantBuffers;
+    Program::DefineList defines;
+    defines.add(mpScene->getSceneDefines());
+    defines.add(mpSampleGenerator->getDefines());
+    defines.add(getValidResourceDefines(kInputChannels, renderData));
+    defines.add(getValidResourceDefines(kOutputChannels, renderData));
+    defines.add("INFO_TEXTURE_HEIGHT", std::to_string(kInfoTexHeight));
+    defines.add("PHOTON_FACE_NORMAL", mUseFaceNormalToReject ? "1" : "0");
+    defines.add("PHOTON_COMPACT", isCompactFormat(mInfoTexFormat) ? "1" : "0");
+    defines.add("PHOTON_STORAGE_LINEAR", isLinearStorage(mPhotonStorage) ? "1" : "0");
+    defines.add("PER_PIXEL_SPPM", mPerPixelSPPM ? "1" : "0");
+    if (!mSphereGather.pCollectPass || defines != mSphereGather.defines) {
+        auto createPass = [&](const char* entry) {
+            Program::Desc desc;
+            desc.addShaderLibrary(kShaderCollectPhotonBVH).csEntry(entry).setShaderModel("6_5");
+            desc.addTypeConformances(mpScene->getTypeConformances());
+            return ComputePass::create(desc, defines, true);
+        };
+        mSphereGather.pPositionsPass = createPass("writePositions");
+        mSphereGather.pCollectPass = createPass("main");
+        mSphereGather.defines = defines;
+        setConstants = true;
+    }
+
+    if (!mSphereGather.positions || mSphereGather.positions->getElementCount() != pixelCount) {
+        mSphereGather.positions = Buffer::createStructured(sizeof(float4), pixelCount, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+        mSphereGather.positions->setName("PhotonMapper::mSphereGather.positions");
+    }
+
+    //Hit points of the pixels
+    {
+        auto var = mSphereGather.pPositionsPass->getRootVar();
+        mpScene->setRaytracingShaderData(pRenderContext, var, 1);
+        var["gVBuffer"] = renderData[kInputChannels[0].name]->asTexture();
+        var["gPhotonImage"] = renderData[kOutputChannels[0].name]->asTexture();
+        var["gGatherPositions"] = mSphereGather.positions;
+        mSphereGather.pPositionsPass->execute(pRenderContext, uint3(targetDim, 1));
+    }
+
+    //Photon lists of the pixels. Maps that are not collected get empty lists
+    const std::vector<uint8_t> positionData = PhotonStreams::readback(pRenderContext, mSphereGather.positions.get(), 0, uint64_t(pixelCount) * sizeof(float4));
+    std::vector<float4> positions(pixelCount);
+    std::memcpy(positions.data(), positionData.data(), positionData.size());
+    const std::array<float, PhotonSphereGather::kMapCount> radius = { mDisableCausticCollection ? 0.f : mCausticRadius, mDisableGlobalCollection ? 0.f : mGlobalRadius };
+    mSphereGather.stats = {};
+    mSphereGather.gather.query(positions, radius, mSphereGather.lists, mSphereGather.pThreadPool.get(), &mSphereGather.stats);
+
+    //The list buffers only grow
+    auto upload = [](Buffer::SharedPtr& pBuffer, const std::vector<uint>& data, const char* name) {
+        const uint count = std::max(static_cast<uint>(data.size()), 1u);
+        if (!pBuffer || pBuffer->getElementCount() < count) {
+            pBuffer = Buffer::createStructured(sizeof(uint), count + count / 2, ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, nullptr, false);
+            pBuffer->setName(name);
+        }
+        if (!data.empty()) pBuffer->setBlob(data.data(), 0, data.size() * sizeof(uint));
+    };
+    upload(mSphereGather.listOffsets, mSphereGather.lists.offsets, "PhotonMapper::mSphereGather.listOffsets");
+    upload(mSphereGather.listPhotons, mSphereGather.lists.photons, "PhotonMapper::mSphereGather.listPhotons");
+
+    auto var = mSphereGather.pCollectPass->getRootVar();
+    mpScene->setRaytracingShaderData(pRenderContext, var, 1);
+    mpSampleGenerator->setShaderData(var);
+
+    std::string nameBuf = "PerFrame";
+    var[nameBuf]["gFrameCount"] = mFrameCount;
+    var[nameBuf]["gCausticRadius"] = mCausticRadius;
+    var[nameBuf]["gGlobalRadius"] = mGlobalRadius;
+    var[nameBuf]["gCausticLayout"].setBlob(mCausticBuffers.layout);
+    var[nameBuf]["gGlobalLayout"].setBlob(mGlobalBuffers.layout);
+    var[nameBuf]["gSlotCapacity"] = uint2(mCausticBuffers.maxSize, mGlobalBuffers.maxSize);
+    for (uint slot = 0; slot < kMaxPhotonGenerations; slot++)
+        var[nameBuf]["gGenerationWeights"][slot] = slot < mPhotonRing.getGenerationCount() ? mPhotonRing.getWeight(slot) : 0.f;
+
+    if (setConstants) {
+        nameBuf = "CB";
+        var[nameBuf]["gEmissiveScale"] = mIntensityScalar;
+        var[nameBuf]["gCollectGlobalPhotons"] = !mDisableGlobalCollection;
+        var[nameBuf]["gCollectCausticPhotons"] = !mDisableCausticCollection;
+        //Alpha of 1 keeps the start radius of every pixel
+        var[nameBuf]["gSPPMAlphaGlobal"] = mUseStatisticProgressivePM ? mSPPMAlphaGlobal : 1.f;
+        var[nameBuf]["gSPPMAlphaCaustic"] = mUseStatisticProgressivePM ? mSPPMAlphaCaustic : 1.f;
+        var[nameBuf]["gMinPhotonRadius"] = kMinPhotonRadius;
+    }
+
+    var["gCausticAABB"] = mCausticBuffers.aabb;
+    var["gCausticFlux"] = mCausticBuffers.infoFlux;
+    var["gCausticDir"] = mCausticBuffers.infoDir;
+    var["gGlobalAABB"] = mGlobalBuffers.aabb;
+    var["gGlobalFlux"] = mGlobalBuffers.infoFlux;
+    var["gGlobalDir"] = mGlobalBuffers.infoDir;
+    var["gCausticPacked"] = mCausticBuffers.packed;
+    var["gGlobalPacked"] = mGlobalBuffers.packed;
+    var["gCausticPhotons"] = mCausticBuffers.streams;
+    var["gGlobalPhotons"] = mGlobalBuffers.streams;
+    var["gPhotonListOffsets"] = mSphereGather.listOffsets;
+    var["gPhotonLists"] = mSphereGather.listPhotons;
+    var["gProgressiveStats"] = mProgressiveStats;
+    var["gProgressiveEmission"] = mProgressiveEmission;
+
+    auto bindAsTex = [&](const ChannelDesc& desc)
+    {
+        if (!desc.texname.empty())
+        {
+            var[desc.texname] = renderData[desc.name]->asTexture();
+        }
+    };
+    for (auto& channel : kInputChannels) bindAsTex(channel);
+    bindAsTex(kOutputChannels[0]);
+
+    mSphereGather.pCollectPass->execute(pRenderContext, uint3(targetDim, 1));
+}
 
 void PhotonMapper::prepareRandomSeedBuffer(const uint2 screenDimensions)
 {
@@ -1329,14 +1714,26 @@ void PhotonMapper::prepareRandomSeedBuffer(const uint2 screenDimensions)
     FALCOR_ASSERT(mRandNumSeedBuffer);
 }
 
+void PhotonMapper::prepareProgressiveBuffers(const uint2 screenDimensions)
+{
+    FALCOR_ASSERT(screenDimensions.x > 0 && screenDimensions.y > 0);
+    if (mProgressiveEmission && mProgressiveEmission->getWidth() == screenDimensions.x && mProgressiveEmission->getHeight() == screenDimensions.y)
+        return;
+
+    mProgressiveStats = Buffer::createStructured(sizeof(ProgressivePhotonStats), 2 * screenDimensions.x * screenDimensions.y, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+    mProgressiveStats->setName("PhotonMapper::ProgressiveStats");
+    mProgressiveEmission = Texture::create2D(screenDimensions.x, screenDimensions.y, ResourceFormat::RGBA32Float, 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+    mProgressiveEmission->setName("PhotonMapper::ProgressiveEmission");
+    //The statistics are only initialized in the first iteration
+    mFrameCount = 0;
+}
+
 
 void PhotonMapper::initPhotonCulling(RenderContext* pRenderContext, uint2 windowDim)
 {
-    //Build hash buffer
-    uint size= 1 << mCullingHashBufferSizeBytes;
-    size = static_cast<uint>(sqrt(size));
-    mCullingYExtent = size;
-    mCullingBuffer = Texture::create2D(size, size, ResourceFormat::R8Uint, 1, 1, nullptr, ResourceBindFlags::UnorderedAccess | ResourceBindFlags::ShaderResource);
+    //One bit per slot
+    const uint numWords = static_cast<uint>(CullingBloomFilter::getWordCount(mCullingHashBufferSizeBytes));
+    mCullingBuffer = Buffer::createStructured(sizeof(uint), numWords);
     mCullingBuffer->setName("Culling hash buffer");
 }
 
@@ -1350,8 +1747,9 @@ void PhotonMapper::resetCullingVars()
 void PhotonMapper::photonCullingPass(RenderContext* pRenderContext, const RenderData& renderData)
 {
     FALCOR_PROFILE("PhotonCulling");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Culling);
     //Reset Counter and AABB
-    pRenderContext->clearUAV(mCullingBuffer->getUAV().get(), float4(0));
+    pRenderContext->clearUAV(mCullingBuffer->getUAV().get(), uint4(0));
 
    
     //Build shader
@@ -1363,6 +1761,7 @@ void PhotonMapper::photonCullingPass(RenderContext* pRenderContext, const Render
         Program::DefineList defines;
         defines.add(mpScene->getSceneDefines());
         defines.add("CULLING_USE_PROJECTION", std::to_string(mUseProjectionMatrixCulling));
+        defines.add("SPATIAL_HASH_FUNCTION", std::to_string(mCullingHashFunction));
 
         mPhotonCullingPass = ComputePass::create(desc, defines, true);
     }
@@ -1377,8 +1776,8 @@ void PhotonMapper::photonCullingPass(RenderContext* pRenderContext, const Render
     float fovX = static_cast<float>(2 * atan(tan(fovY * 0.5) * mpScene->getCamera()->getAspectRatio()));
 
     var["PerFrame"]["gHashScaleFactor"] = 1.0f/ (mGlobalRadius * 2);  //Radius needs to be double to ensure that all photons from the camera cell are in it
-    var["PerFrame"]["gHashSize"] = 1 << mCullingHashBufferSizeBytes;
-    var["PerFrame"]["gYExtend"] = mCullingYExtent;
+    var["PerFrame"]["gBitMask"] = CullingBloomFilter::getBitMask(mCullingHashBufferSizeBytes);
+    var["PerFrame"]["gNumHashes"] = mCullingNumHashes;
     var["PerFrame"]["gProjTest"] = mPCullingrojectionTestOver;
     
     var[kInputChannels[0].texname] = renderData[kInputChannels[0].name]->asTexture();    //VBuffer
@@ -1395,7 +1794,10 @@ void PhotonMapper::photonCullingPass(RenderContext* pRenderContext, const Render
 
 void PhotonMapper::checkTimer()
 {
-    if (!mUseTimer) return;
+    if (!mUseTimer) {
+        mStageTimes.setEnabled(false);
+        return;
+    }
 
     //reset timer
     if (mResetTimer) {
@@ -1403,10 +1805,8 @@ void PhotonMapper::checkTimer()
         mTimerStartTime = std::chrono::steady_clock::now();
         mTimerStopRenderer = false;
         mResetTimer = false;
-        if (mTimerRecordTimes) {
-            mTimesList.clear();
-            mTimesList.reserve(10000);
-        }
+        mStageTimes.clear();
+        mStageTimes.setEnabled(mTimerRecordTimes);
         return;
     }
 
@@ -1430,32 +1830,47 @@ void PhotonMapper::checkTimer()
         }
     }
 
-    //Add to times list
+    //Start the next iteration. The profiler holds the GPU times of the last frame, so they belong to the previous one
     if (mTimerRecordTimes) {
-        mTimesList.push_back(mCurrentElapsedTime);
+        StageTimingProfiler::setGpuTimes(mStageTimes);
+        mStageTimes.beginIteration(mFrameCount, mCurrentElapsedTime);
+    }
+
+    //Store the times as soon as the timer stops. Scripted runs set the output file via the dictionary
+    if (mTimerStopRenderer && mTimerRecordTimes) {
+        mStageTimes.endIteration();
+        outputTimes();
     }
 }
 
 void PhotonMapper::outputTimes()
 {
-    if (mTimesOutputFilePath.empty() || mTimesList.empty()) return;
-
-    std::ofstream file = std::ofstream(mTimesOutputFilePath, std::ios::trunc);
-
-    if (!file) {
-        reportError(fmt::format("Failed to open file '{}'.", mTimesOutputFilePath));
-        mTimesOutputFilePath.clear();
-        return;
+    if (mTimesOutputFilePath.empty() || mStageTimes.getIterations().empty()) return;
+
+    //Run metadata
+    mStageTimes.setMetadata("pass", "PhotonMapper");
+    if (mpScene) mStageTimes.setMetadata("scene", mpScene->getPath().string());
+    mStageTimes.setMetadata("numPhotons", mNumPhotons);
+    mStageTimes.setMetadata("globalBufferSize", mGlobalBufferSizeUI);
+    mStageTimes.setMetadata("causticBufferSize", mCausticBufferSizeUI);
+    mStageTimes.setMetadata("globalRadiusStart", mGlobalRadiusStart);
+    mStageTimes.setMetadata("causticRadiusStart", mCausticRadiusStart);
+    mStageTimes.setMetadata("useSPPM", mUseStatisticProgressivePM);
+    mStageTimes.setMetadata("perPixelSPPM", mPerPixelSPPM);
+    mStageTimes.setMetadata("maxBounces", mMaxBounces);
+    mStageTimes.setMetadata("enablePhotonCulling", mEnablePhotonCulling);
+    if (mEnablePhotonCulling) {
+        mStageTimes.setMetadata("cullingHashBufferBits", mCullingHashBufferSizeBytes);
+        mStageTimes.setMetadata("cullingNumHashes", mCullingNumHashes);
     }
+    mStageTimes.setMetadata("adaptiveEmission", mAdaptiveEmission);
+    mStageTimes.setMetadata("iterations", mFrameCount);
 
-    //Write into file
-    file << "RTPM_Times" << std::endl;
-    file << std::fixed << std::setprecision(16);
-    for (size_t i = 0; i < mTimesList.size(); i++) {
-        file << mTimesList[i];
-        file << std::endl;
+    std::filesystem::path jsonPath = std::filesystem::path(mTimesOutputFilePath).replace_extension(".json");
+    if (!mStageTimes.writeCsv(mTimesOutputFilePath) || !mStageTimes.writeJson(jsonPath.string())) {
+        reportError(fmt::format("Failed to write the times to '{}'.", mTimesOutputFilePath));
+        mTimesOutputFilePath.clear();
     }
-    file.close();
 }
 
 void PhotonMapper::photonASDebugPass(RenderContext* pRenderContext, const RenderData& renderData)
@@ -1507,6 +1922,7 @@ void PhotonMapper::photonASDebugPass(RenderContext* pRenderContext, const Render
     std::string nameBuf = "PerFrame";
     var[nameBuf]["gCausticRadius"] = mCausticRadius;
     var[nameBuf]["gGlobalRadius"] = mGlobalRadius;
+    var[nameBuf]["gSlotCapacity"] = uint2(mCausticBuffers.maxSize, mGlobalBuffers.maxSize);
 
     if (resetCamera) {
         nameBuf = "CB";
@@ -1540,7 +1956,7 @@ void PhotonMapper::photonASDebugPass(RenderContext* pRenderContext, const Render
     FALCOR_ASSERT(pRenderContext && mPhotonASDebugPass.pProgram && mPhotonASDebugPass.pVars);
 
     //bind TLAS
-    bool tlasValid = var["gPhotonAS"].setSrv(mPhotonTlas.pSrv);
+    bool tlasValid = var["gPhotonAS"].setSrv(mPhotonAS.getSrv());
     FALCOR_ASSERT(tlasValid);
 
     //pRenderContext->raytrace(mTracerCollect.pProgram.get(), mTracerCollect.pVars.get(), targetDim.x, targetDim.y, 1);
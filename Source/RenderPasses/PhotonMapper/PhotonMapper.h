@@ -28,6 +28,19 @@
 #pragma once
 #include "Falcor.h"
 #include "Utils/Sampling/SampleGenerator.h"
+#include "../PhotonMapperCommon/SpatialHash.slang"
+#include "../PhotonMapperCommon/ProgressiveRadius.slang"
+#include "../PhotonMapperCommon/LightSampleTableBuilder.h"
+#include "../PhotonMapperCommon/AdaptiveLightSampling.h"
+#include "../PhotonMapperCommon/CullingBloomFilter.h"
+#include "../PhotonMapperCommon/StageTimingProfiler.h"
+#include "../PhotonMapperCommon/ConvergenceMonitor.h"
+#include "../PhotonMapperCommon/PhotonBufferSizePolicy.h"
+#include "../PhotonMapperCommon/ReadbackRing.h"
+#include "../PhotonMapperCommon/PhotonStreams.h"
+#include "../PhotonMapperCommon/PhotonAccelerationStructure.h"
+#include "../PhotonMapperCommon/PhotonGenerationRing.h"
+#include "../PhotonMapperCommon/PhotonSphereGather.h"
 #include <chrono>
 
 using namespace Falcor;
@@ -58,7 +71,8 @@ public:
     enum class TextureFormat {
         _8Bit = 0u,
         _16Bit = 1u,
-        _32Bit = 2u
+        _32Bit = 2u,
+        Compact = 3u        ///< One 16 byte record for flux, direction and face normal, see PhotonPacking.slang
     };
 
     enum LightTexMode : uint32_t {
@@ -67,7 +81,11 @@ public:
     };
 
 private:
-    PhotonMapper();
+    PhotonMapper(const Dictionary& dict);
+
+    /** Parses the dictonary when creating the render pass
+    */
+    void parseDictionary(const Dictionary& dict);
 
     /** Prepares Program Variables and binds the sample generator
     */
@@ -81,9 +99,17 @@ private:
     */
     void preparePhotonInfoTexture();
 
-    /** Creates the photon counter for caustic and global photon buffers
+    /** Creates the photon counter for caustic and global photon buffers and its readback ring
     */
-    void preparePhotonCounters();
+    void preparePhotonCounters(RenderContext* pRenderContext);
+
+    /** Granularity of the photon buffer sizes. Texture storage needs whole columns of the info textures
+    */
+    uint getPhotonBufferGranularity() const;
+
+    /** Applies the granularity of the current photon storage to the size policies
+    */
+    void updateSizePolicyGranularity();
 
     /** Resets buffer and runtime vars. Used for scene change or number of photons change
     */
@@ -93,10 +119,14 @@ private:
     */
     void changeNumPhotons();
 
-    /** Copies the photon counter to a cpu buffer
+    /** Enqueues a copy of the photon counter into the readback ring. Has to be called after the generate pass
     */
     void copyPhotonCounter(RenderContext* pRenderContext);
 
+    /** Takes the newest photon counter from the readback ring without waiting for the GPU
+    */
+    void updatePhotonCounter();
+
     /** Creates the Generate Photon pass, where the photons are shot through the scene and saved in an AABB and information buffer
     */
     void generatePhotons(RenderContext* pRenderContext, const RenderData& renderData);
@@ -106,18 +136,10 @@ private:
     */
     void collectPhotons(RenderContext* pRenderContext, const RenderData& renderData);
 
-    /** Creates the AS. Calls the createTopLevelAS(..) and createBottomLevelAS(..) functions
+    /** Creates the BLAS and TLAS for the Photon AABBs. Creates the backend of the device on first use
     */
     void createAccelerationStructure(RenderContext* pContext);
 
-    /** Creates the TLAS for the Photon AABBs
-    */
-    void createTopLevelAS(RenderContext* pContext);
-
-    /** Creates the BLAS for the Photon AABBs
-   */
-    void createBottomLevelAS(RenderContext* pContext);
-
     /** Builds the Bottom Level Acceleration structure. aabbCount is the number of photon build for this acceleration structure
     * 0 index is always caustic, 1 index is global, everything above is ignored.
     * Photons counts above maxPhotons are ignored. 
@@ -128,25 +150,43 @@ private:
     */
     void buildTopLevelAS(RenderContext* pContext);
 
+    /** Replaces the BLAS build with the CPU gather: reads the AABBs of the current ring slot back and builds their photon sphere BVH.
+    */
+    void buildPhotonSphereBVH(RenderContext* pContext, std::array<uint, 2>& aabbCount);
+
+    /** Collect pass of the CPU gather. Reads the hit points back, looks up their photons in the photon sphere BVHs and shades them in a compute pass.
+    */
+    void collectPhotonsBVH(RenderContext* pRenderContext, const RenderData& renderData);
+
+    /** Devices without a photon AS backend always gather on the CPU
+    */
+    bool useCpuPhotonGather() const { return mCpuPhotonGather || mPhotonASUnsupported; }
+
     /** Prepares the buffer that holds the seeds for the SampleGenerator
     */
     void prepareRandomSeedBuffer(const uint2 screenDimensions);
 
-    /** Prepares a light sample texture for the photon generate pass
+    /** Creates the per pixel SPPM statistics if they do not match the screen size. The collect pass initializes them in the first iteration
     */
-    void createLightSampleTexture(RenderContext* pRenderContext);
+    void prepareProgressiveBuffers(const uint2 screenDimensions);
 
-    /** Gets the active emissive triangles from the light collection.
-    *  This is analogous to the function from LightCollection. It is here to prevent changes to the core of Falcor.
-    *  As this is done once it has no impact on performance and only a minimal impact on CPU-Memory
+    /** Prepares the light alias table for the photon generate pass
     */
-    void getActiveEmissiveTriangles(RenderContext* pRenderContext);
+    void createLightSampleTable(RenderContext* pRenderContext);
+
+    /** Uploads a built light sample table and sets the dispatch size and number of photons from it
+    */
+    void uploadLightSampleTable(const LightSampleTableBuilder::Table& table);
+
+    /** Reads back the per light emission counters every few frames and rebuilds the light table with the adapted probabilities
+    */
+    void updateAdaptiveEmission(RenderContext* pRenderContext);
 
     /** Creates the Photon Collection Program
     */
     void createCollectionProgram();
 
-    /** Inits the Hash buffer for the culling
+    /** Inits the culling bit set with 2^mCullingHashBufferSizeBytes bits
     */
     void initPhotonCulling(RenderContext* pRenderContext, uint2 windowDim);
 
@@ -162,7 +202,7 @@ private:
     */
     void checkTimer();
 
-    /** Writes the output times to file in mTimesOutputFilePath
+    /** Writes the recorded stage timings as CSV to mTimesOutputFilePath and as JSON next to it
     */
     void outputTimes();
 
@@ -179,6 +219,7 @@ private:
     const float                 kCollectTMin = 0.000001f;                   ///<non configurable constant for collection for now
     const float                 kCollectTMax = 0.000002f;                   ///< non configurable constant for collection for now
     const uint                  kInfoTexHeight = 512;                       ///< Height of the info tex as it is too big for 1D tex
+    const uint                  kMaxInfoTexWidth = 16384;                   ///< Largest 2D texture width. Limits the photon generations with texture storage
 
     //***************************************************************************
     // Configuration
@@ -187,6 +228,7 @@ private:
     bool                        mUseStatisticProgressivePM = true;     ///< Activate Statistically Progressive Photon Mapping(SPPM)
     float                       mSPPMAlphaGlobal = 0.7f;                 ///< Global Alpha for SPPM
     float                       mSPPMAlphaCaustic = 0.7f;                ///< Caustic Alpha for SPPM
+    bool                        mPerPixelSPPM = false;                  ///< Radius and photon statistics per pixel (ProgressiveRadius.slang). The map radius stays at the start radius for the AABBs
 
     float                       mPhotonBufferOverestimate = 1.1f;       ///< Percent the photon buffer is overestimated in compairison the the number of photons collected in the last iteration
 
@@ -202,6 +244,9 @@ private:
 
     bool                        mNumPhotonsChanged = false;             ///<If true buffers needs to be restarted and Number of photons needs to be changed
     bool                        mFitBuffersToPhotonShot = false;        ///<Changes the buffer size to be around the number of photons shot
+    bool                        mAutoBufferSize = true;                 ///< Resizes the photon buffers from the photon counter history
+    PhotonBufferSizePolicy      mCausticSizePolicy;                     ///< Size policy for the caustic photon buffer
+    PhotonBufferSizePolicy      mGlobalSizePolicy;                      ///< Size policy for the global photon buffer
 
     bool                        mUseAlphaTest = true;                   ///<Uses alpha test (Generate)
     bool                        mAdjustShadingNormals = true;           ///<Adjusts the shading normals (Generate)
@@ -219,11 +264,16 @@ private:
     uint                        mNumPhotonsUI = mNumPhotons;            ///< For UI. It is decopled from the runtime var because changes have to be confirmed
     uint                        mGlobalBufferSizeUI = mNumPhotons / 2;    ///< Size of the Global Photon Buffer
     uint                        mCausticBufferSizeUI = mNumPhotons / 4;   ///< Size of the Caustic Photon Buffer
+    uint                        mPhotonGenerations = 1;                 ///< Photon generations kept in the AS. Meant for a static camera
 
     float                       mIntensityScalar = 1.0f;                ///<Scales the intensity of emissive light sources
 
     bool                        mAccelerationStructureFastBuild = true;    ///< Build mode for acceleration structure
     bool                        mAccelerationStructureFastBuildUI = mAccelerationStructureFastBuild;
+    bool                        mCpuPhotonGather = false;               ///< Gathers with the photon sphere BVH on the CPU instead of the photon AS
+    bool                        mPhotonASUnsupported = false;           ///< The device has no photon AS backend
+    bool                        mValidatePhotonAS = false;              ///< Wraps the device backend in the checks of the null backend
+    uint                        mPhotonBVHBuildMode = static_cast<uint>(PhotonSphereBVH::BuildMode::LBVH);   ///< Build mode of the CPU gather
 
     // Collect only
     bool                        mDisableGlobalCollection = false;       ///<Disabled the collection of global photons
@@ -232,7 +282,9 @@ private:
     //Photon Culling
     bool                        mEnablePhotonCulling = true;            //<Photon Culling with AS
     bool                        mRebuildCullingBuffer = false;
-    uint                        mCullingHashBufferSizeBytes = 22;
+    uint                        mCullingHashBufferSizeBytes = 22;       ///< 2^x bits in the culling buffer
+    uint                        mCullingNumHashes = 1;                  ///< Bits per cell. 1 is a plain bit set, more make it a Bloom filter
+    uint                        mCullingHashFunction = (uint)SpatialHashFunction::Wang;   ///< Hash function for the culling buffer (SpatialHashFunction)
     bool                        mUseProjectionMatrixCulling = false;
     float                       mPCullingrojectionTestOver = 1.01f;            ///< Value used for determining what is inside the projection  
 
@@ -256,10 +308,10 @@ private:
     bool                        mPhotonInfoFormatChanged = false;         
     bool                        mRebuildAS = false;
     uint                        mInfoTexFormat = 1;
+    uint                        mPhotonStorage = (uint)PhotonStorage::Texture2D;  ///< Storage of the photon attributes (PhotonStorage)
+    bool                        mPhotonStorageChanged = false;
     bool                        mPhotonBuffersReady = false;
 
-    uint                        mCullingYExtent = 512;
-
     //Clock/Timer
     bool                        mUseTimer = false;                          //<Activates the timer
     bool                        mResetTimer = false;                        //<Resets the timer
@@ -269,22 +321,33 @@ private:
     double                      mCurrentElapsedTime = 0.0;                    //<Elapsed time for UI
     std::chrono::time_point<std::chrono::steady_clock> mTimerStartTime;     //<Start time for the timer
     bool                        mTimerRecordTimes = false;                   //< Enable Records times
-    std::vector<double>         mTimesList;                                 //< List with render times
+    StageTimingStats            mStageTimes;                                //< Per iteration stage timings while recording times
     std::string                 mTimesOutputFilePath;                       //< Output file path for the times
 
+    //Convergence
+    ConvergenceMonitor          mConvergence;                               ///< Error-versus-time measurement against a reference image
+
 
     //Light
-    std::vector<uint> mActiveEmissiveTriangles;
+    LightSampleTableBuilder mLightTableBuilder;     ///< Builds the light sample table. Rebuilds can run on a worker thread
     bool            mRebuildLightTex = false;
+    bool            mAsyncLightTexRebuild = true;   ///< Keep rendering with the old light table while a rebuild is running
     LightTexMode mLightTexMode = LightTexMode::power;
-    Texture::SharedPtr mLightSampleTex;
-    Buffer::SharedPtr mPhotonsPerTriangle;
+    Buffer::SharedPtr mLightAliasTable;             ///< Light alias table (LightAliasEntry)
+    uint            mLightAliasTableSize = 0;
+    std::vector<double> mLightModeProbabilities;    ///< Power/area probabilities of the alias table entries, the base of adaptive emission
+
+    //Adaptive emission
+    bool            mAdaptiveEmission = false;          ///< Moves the light selection towards lights whose photons land in visible culling cells
+    uint            mAdaptiveEmissionInterval = 8;      ///< Frames the emission counters are accumulated before they are read back
+    uint            mAdaptiveEmissionFrames = 0;        ///< Frames since the last readback
+    AdaptiveLightSampling mLightAdaptation;
+    Buffer::SharedPtr mLightEmissionCounter;            ///< Emitted and visible stored photons per alias table entry
+    ReadbackRing    mLightEmissionReadback;
     const uint mMaxDispatchY = 512;
     uint mPGDispatchX = 0;
     uint mAnalyticEndIndex = 0;
     uint mNumLights = 0;
-    float mAnalyticInvPdf = 0.0f;
-    float mEmissiveInvPdf = 0.0f;
 
     // Ray tracing program.
     struct RayTraceProgramHelper
@@ -303,37 +366,24 @@ private:
         }
     };
 
-    struct BlasData
-    {
-        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO prebuildInfo;
-        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS buildInputs;
-        D3D12_RAYTRACING_GEOMETRY_DESC geomDescs;
-
-        uint64_t blasByteSize = 0;                    ///< Maximum result data size for the BLAS build, including padding.
-        uint64_t scratchByteSize = 0;                   ///< Maximum scratch data size for the BLAS build, including padding.
-    };
-
-    struct TlasData
-    {
-        Buffer::SharedPtr pTlas;
-        ShaderResourceView::SharedPtr pSrv;             ///< Shader Resource View for binding the TLAS.
-        Buffer::SharedPtr pInstanceDescs;               ///< Buffer holding instance descs for the TLAS.
-    };
-
     struct PhotonBuffers {
-        uint maxSize = 0;
+        uint maxSize = 0;                   ///< Photons per generation
+        uint capacity = 0;                  ///< Photons of all generations, maxSize per ring slot
         Texture::SharedPtr infoFlux;
         Texture::SharedPtr infoDir;
+        Texture::SharedPtr packed;          ///< Compact photons. Replaces the info textures in the compact format
+        Buffer::SharedPtr streams;          ///< Linear storage. Replaces all info textures
+        PhotonStreamLayout layout = {};     ///< Layout of the streams
         Buffer::SharedPtr aabb;
-        Buffer::SharedPtr blas;
     };
 
     struct {
         Buffer::SharedPtr counter;
         Buffer::SharedPtr reset;
-        Buffer::SharedPtr cpuCopy;
     }mPhotonCounterBuffer;
 
+    ReadbackRing mPhotonCounterReadback;            ///< Photon counter readback. Lags a few frames behind the GPU
+
     RayTraceProgramHelper mTracerGenerate;          ///<Description for the Generate Photon pass 
     RayTraceProgramHelper mTracerCollect;                       ///<Collect pass collects the photons that where shot
     RayTraceProgramHelper mTracerStochasticCollect;           ///<Collect pass with stochastic collect shader instead of the normal one
@@ -343,22 +393,33 @@ private:
     //
     //Photon Culling vars
     //
-    Texture::SharedPtr               mCullingBuffer;
+    Buffer::SharedPtr                mCullingBuffer;     ///< Culling bits, 32 per word (CullingBloomFilter.slang)
 
     //
     //Photon Buffers
     //
     PhotonBuffers mCausticBuffers;              ///< Buffers for the caustic photons
     PhotonBuffers mGlobalBuffers;               ///< Buffers for the global photons
+    Buffer::SharedPtr mAabbClearBuffer;         ///< Zeros for clearing one ring slot of the AABB buffers
 
     Texture::SharedPtr mRandNumSeedBuffer;       ///< Buffer for the random seeds
+    Buffer::SharedPtr mProgressiveStats;         ///< Per pixel SPPM statistics, caustic and global per pixel
+    Texture::SharedPtr mProgressiveEmission;     ///< Per pixel SPPM mean of the emission
 
-    size_t                    mBlasScratchMaxSize = 0;
-    size_t                    mTlasScratchMaxSize = 0;
-    std::vector<BlasData> mBlasData;
-    Buffer::SharedPtr mBlasScratch;
-    std::vector<D3D12_RAYTRACING_INSTANCE_DESC> mPhotonInstanceDesc;
-    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO mTlasPrebuildInfo;
-    Buffer::SharedPtr mTlasScratch;
-    TlasData mPhotonTlas;
+    PhotonAccelerationStructure mPhotonAS;      ///< BLAS per ring slot of the caustic and global photon AABBs and the TLAS
+    PhotonGenerationRing mPhotonRing;           ///< Ring slots of the photon generations in the AS
+    NullPhotonASBackend::SharedPtr mpPhotonASValidation;    ///< Validating wrapper of the device backend if mValidatePhotonAS
+
+    struct {
+        PhotonSphereGather gather;                  ///< Photon sphere BVH per ring slot and map
+        PhotonSphereGather::Lists lists;            ///< Photons of every pixel of the last collect
+        PhotonSphereGather::Stats stats;            ///< Query counters of the last collect
+        std::unique_ptr<WorkStealingThreadPool> pThreadPool;
+        Program::DefineList defines;                ///< Defines the passes were created with
+        ComputePass::SharedPtr pPositionsPass;      ///< Writes the hit point of every pixel
+        ComputePass::SharedPtr pCollectPass;
+        Buffer::SharedPtr positions;
+        Buffer::SharedPtr listOffsets;
+        Buffer::SharedPtr listPhotons;
+    } mSphereGather;                            ///< CPU gather, replaces the photon AS if useCpuPhotonGather()
 };
@@ -0,0 +1,96 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "AdaptiveLightSampling.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const float kMinShareLimit = 0.01f;         ///< Lower limit of the base share
+}
+
+void AdaptiveLightSampling::reset(size_t numEntries)
+{
+    mEmitted.assign(numEntries, 0.0);
+    mVisible.assign(numEntries, 0.0);
+    mTotalEmitted = 0.0;
+    mTotalVisible = 0.0;
+    mUpdateCount = 0;
+}
+
+bool AdaptiveLightSampling::addCounts(const uint32_t* pCounts, size_t numValues)
+{
+    if (numValues != 2 * mEmitted.size()) return false;
+
+    const double decay = std::clamp(static_cast<double>(mOptions.historyDecay), 0.0, 1.0);
+    mTotalEmitted *= decay;
+    mTotalVisible *= decay;
+    for (size_t i = 0; i < mEmitted.size(); i++)
+    {
+        mEmitted[i] = mEmitted[i] * decay + pCounts[2 * i];
+        mVisible[i] = mVisible[i] * decay + pCounts[2 * i + 1];
+        mTotalEmitted += pCounts[2 * i];
+        mTotalVisible += pCounts[2 * i + 1];
+    }
+    mUpdateCount++;
+    return true;
+}
+
+double AdaptiveLightSampling::getVisibleFraction() const
+{
+    return mTotalEmitted > 0.0 ? mTotalVisible / mTotalEmitted : 0.0;
+}
+
+std::vector<double> AdaptiveLightSampling::getProbabilities(const std::vector<double>& baseProbabilities) const
+{
+    const size_t n = baseProbabilities.size();
+    const double mean = getVisibleFraction();
+    if (n != mEmitted.size() || mean <= 0.0) return baseProbabilities;
+
+    double baseSum = 0.0;
+    for (double p : baseProbabilities) baseSum += p;
+    if (baseSum <= 0.0) return baseProbabilities;
+
+    //Usefulness pulled towards the mean while an entry has few samples
+    const double prior = std::max(static_cast<double>(mOptions.priorCount), 0.0);
+    std::vector<double> probabilities(n);
+    double weightedSum = 0.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const double usefulness = (mVisible[i] + prior * mean) / (mEmitted[i] + prior);
+        probabilities[i] = baseProbabilities[i] / baseSum * usefulness;
+        weightedSum += probabilities[i];
+    }
+    if (weightedSum <= 0.0) return baseProbabilities;
+
+    //Mix with the base so every light that can emit keeps a nonzero pdf
+    const double minShare = std::clamp(static_cast<double>(mOptions.minShare), static_cast<double>(kMinShareLimit), 1.0);
+    for (size_t i = 0; i < n; i++)
+        probabilities[i] = (1.0 - minShare) * probabilities[i] / weightedSum + minShare * baseProbabilities[i] / baseSum;
+    return probabilities;
+}
@@ -0,0 +1,86 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/** Adapts the light selection of the photon emission to the visual importance of the lights.
+    The generate pass counts per light table entry the emitted photons and the stored photons that landed in a hash cell
+    marked by the culling pass. Every readback of the counts is added to a decayed history. An entry's usefulness u is its
+    visible photons per emitted photon, pulled towards the mean while the entry has few samples. The selection probability
+    of an entry with the power/area probability p_base becomes
+        p = (1 - minShare) * p_base * u / sum(p_base * u) + minShare * p_base.
+    The base share keeps every light selectable, so dividing the flux by the pdf of the table the photon was emitted
+    with keeps the estimate unbiased. The class has no device dependency, so it can be driven by synthetic statistics.
+*/
+class AdaptiveLightSampling
+{
+public:
+    struct Options
+    {
+        float minShare = 0.2f;          ///< Share of the base distribution that is always kept. Has to be > 0 to stay unbiased
+        float historyDecay = 0.5f;      ///< Weight of the history when new counts are added. 0 only keeps the newest counts
+        float priorCount = 16.f;        ///< Emitted photons after which an entry's own usefulness and the mean are weighted equally
+    };
+
+    void setOptions(const Options& options) { mOptions = options; }
+    const Options& getOptions() const { return mOptions; }
+
+    /** Clears the history, e.g. after the light table was rebuilt from scratch.
+    */
+    void reset(size_t numEntries);
+
+    size_t getEntryCount() const { return mEmitted.size(); }
+
+    /** Adds a readback of the counters.
+        \param[in] pCounts Emitted and visible count of every entry, interleaved.
+        \param[in] numValues Number of values. Has to be twice the entry count.
+        \return False if the counts do not match the entry count and were ignored.
+    */
+    bool addCounts(const uint32_t* pCounts, size_t numValues);
+
+    uint32_t getUpdateCount() const { return mUpdateCount; }
+
+    /** Visible photons per emitted photon over the history.
+    */
+    double getVisibleFraction() const;
+
+    /** Selection probabilities adapted from the base probabilities. Returns the base if there is no history yet.
+        \param[in] baseProbabilities Power or area probability of every entry. Does not need to be normalized.
+    */
+    std::vector<double> getProbabilities(const std::vector<double>& baseProbabilities) const;
+
+private:
+    Options                 mOptions;
+    std::vector<double>     mEmitted;           ///< Decayed history of the emitted photons per entry
+    std::vector<double>     mVisible;           ///< Decayed history of the visible stored photons per entry
+    double                  mTotalEmitted = 0.0;
+    double                  mTotalVisible = 0.0;
+    uint32_t                mUpdateCount = 0;
+};
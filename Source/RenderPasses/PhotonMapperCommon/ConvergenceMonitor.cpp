@@ -0,0 +1,195 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "ConvergenceMonitor.h"
+#include <cstring>
+#include <iomanip>
+
+namespace
+{
+    /** Reads a texture back as RGBA32Float. Other formats are converted with a blit first.
+    */
+    std::vector<float> readRGBA32Float(RenderContext* pRenderContext, const Texture::SharedPtr& pTexture)
+    {
+        Texture::SharedPtr pSrc = pTexture;
+        if (pTexture->getFormat() != ResourceFormat::RGBA32Float)
+        {
+            pSrc = Texture::create2D(pTexture->getWidth(), pTexture->getHeight(), ResourceFormat::RGBA32Float, 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::RenderTarget);
+            pRenderContext->blit(pTexture->getSRV(0, 1, 0, 1), pSrc->getRTV());
+        }
+
+        std::vector<uint8_t> bytes = pRenderContext->readTextureSubresource(pSrc.get(), 0);
+        std::vector<float> data(bytes.size() / sizeof(float));
+        std::memcpy(data.data(), bytes.data(), data.size() * sizeof(float));
+        return data;
+    }
+}
+
+void ConvergenceMonitor::restart()
+{
+    mSamples.clear();
+    if (mOutputFile.is_open()) mOutputFile.close();
+    mStartTime = std::chrono::steady_clock::now();
+    mOverheadSec = 0.0;
+    mLastSampleIteration = 0;
+    mLastSampleTimeSec = 0.0;
+}
+
+bool ConvergenceMonitor::loadReference(RenderContext* pRenderContext)
+{
+    if (mLoadedReferencePath == mOptions.referencePath) return !mReferenceData.empty();
+
+    mLoadedReferencePath = mOptions.referencePath;
+    mReferenceData.clear();
+    mSizeWarningIssued = false;
+
+    Texture::SharedPtr pReference = Texture::createFromFile(mOptions.referencePath, false, false);
+    if (!pReference)
+    {
+        logWarning("ConvergenceMonitor: Failed to load reference image '" + mOptions.referencePath + "'");
+        return false;
+    }
+    mReferenceSize = uint2(pReference->getWidth(), pReference->getHeight());
+    mReferenceData = readRGBA32Float(pRenderContext, pReference);
+    return true;
+}
+
+void ConvergenceMonitor::update(RenderContext* pRenderContext, const Texture::SharedPtr& pImage, uint iteration, float globalRadius, float causticRadius)
+{
+    if (!mOptions.enabled || mOptions.referencePath.empty() || !pImage) return;
+
+    //Check if a sample is due
+    auto elapsedSec = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - mStartTime).count() - mOverheadSec; };
+    bool due = mOptions.intervalIterations > 0 && iteration >= mLastSampleIteration + mOptions.intervalIterations;
+    due |= mOptions.intervalMs > 0.f && (elapsedSec() - mLastSampleTimeSec) * 1000.0 >= mOptions.intervalMs;
+    if (!due) return;
+
+    //Wait for the GPU so the work of this iteration is part of the render time
+    pRenderContext->flush(true);
+    auto measureStart = std::chrono::steady_clock::now();
+    const double renderTimeSec = elapsedSec();
+
+    if (loadReference(pRenderContext))
+    {
+        if (pImage->getWidth() != mReferenceSize.x || pImage->getHeight() != mReferenceSize.y)
+        {
+            if (!mSizeWarningIssued)
+                logWarning(fmt::format("ConvergenceMonitor: Reference size {}x{} does not match the output size {}x{}", mReferenceSize.x, mReferenceSize.y, pImage->getWidth(), pImage->getHeight()));
+            mSizeWarningIssued = true;
+        }
+        else
+        {
+            std::vector<float> image = readRGBA32Float(pRenderContext, pImage);
+
+            ImageMetrics::ImageView imageView = { image.data(), mReferenceSize.x, mReferenceSize.y, 4 };
+            ImageMetrics::ImageView referenceView = { mReferenceData.data(), mReferenceSize.x, mReferenceSize.y, 4 };
+            ImageMetrics::Options metricOptions;
+            metricOptions.computeSsim = mOptions.computeSsim;
+            if (!mpMetrics) mpMetrics = std::make_unique<ImageMetrics>();
+            ImageMetrics::Result result = mpMetrics->compute(imageView, referenceView, metricOptions);
+
+            Sample sample;
+            sample.iteration = iteration;
+            sample.renderTimeSec = renderTimeSec;
+            sample.mse = result.mse;
+            sample.relMse = result.relMse;
+            sample.ssim = result.ssim;
+            sample.globalRadius = globalRadius;
+            sample.causticRadius = causticRadius;
+            mSamples.push_back(sample);
+            writeSample(sample);
+        }
+    }
+
+    mLastSampleIteration = iteration;
+    mLastSampleTimeSec = renderTimeSec;
+    mOverheadSec += std::chrono::duration<double>(std::chrono::steady_clock::now() - measureStart).count();
+}
+
+void ConvergenceMonitor::writeSample(const Sample& sample)
+{
+    logInfo(fmt::format("Convergence: iteration {} time {:.3f}s MSE {:.6g} relMSE {:.6g} SSIM {:.5f} global radius {:.6f} caustic radius {:.6f}",
+        sample.iteration, sample.renderTimeSec, sample.mse, sample.relMse, sample.ssim, sample.globalRadius, sample.causticRadius));
+
+    if (mOptions.outputPath.empty()) return;
+
+    //The file is opened with the first sample of a curve, so every restart starts a new file
+    if (!mOutputFile.is_open())
+    {
+        mOutputFile.open(mOptions.outputPath, std::ios::trunc);
+        if (!mOutputFile)
+        {
+            reportError(fmt::format("Failed to open file '{}'.", mOptions.outputPath));
+            mOptions.outputPath.clear();
+            return;
+        }
+        mOutputFile << "iteration,renderTimeSec,mse,relMse,ssim,globalRadius,causticRadius" << std::endl;
+    }
+
+    mOutputFile << std::setprecision(9) << sample.iteration << ',' << sample.renderTimeSec << ',' << sample.mse << ',' << sample.relMse << ','
+        << sample.ssim << ',' << sample.globalRadius << ',' << sample.causticRadius << std::endl;
+}
+
+bool ConvergenceMonitor::renderUI(Gui::Widgets& widget)
+{
+    bool changed = widget.checkbox("Enable Convergence Measurement", mOptions.enabled);
+    widget.tooltip("Periodically compares the output with a reference image (MSE, relMSE, SSIM). Measurements stall the GPU; their time is excluded from the curve");
+    if (!mOptions.enabled) return changed;
+
+    widget.text("Reference: " + (mOptions.referencePath.empty() ? std::string("none") : mOptions.referencePath));
+    if (widget.button("Load Reference")) {
+        FileDialogFilterVec filters;
+        filters.push_back({ "exr", "EXR Files" });
+        std::filesystem::path path;
+        if (openFileDialog(filters, path)) {
+            mOptions.referencePath = path.string();
+            changed = true;
+        }
+    }
+    changed |= widget.var("Interval Iterations", mOptions.intervalIterations, 0u, UINT_MAX, 1u);
+    widget.tooltip("Measure every N iterations. When 0 iterations are not used");
+    changed |= widget.var("Interval ms", mOptions.intervalMs, 0.f, FLT_MAX, 10.f);
+    widget.tooltip("Measure every T milliseconds of render time. When 0 time is not used");
+    changed |= widget.checkbox("Compute SSIM", mOptions.computeSsim);
+
+    widget.text("Output: " + (mOptions.outputPath.empty() ? std::string("log only") : mOptions.outputPath));
+    if (widget.button("Set Output File", true)) {
+        FileDialogFilterVec filters;
+        filters.push_back({ "csv", "CSV Files" });
+        std::filesystem::path path;
+        if (saveFileDialog(filters, path)) {
+            mOptions.outputPath = path.string();
+            changed = true;
+        }
+    }
+
+    if (!mSamples.empty()) {
+        const Sample& s = mSamples.back();
+        widget.text(fmt::format("It {}: {:.2f}s MSE {:.4g} relMSE {:.4g} SSIM {:.4f}", s.iteration, s.renderTimeSec, s.mse, s.relMse, s.ssim));
+    }
+    return changed;
+}
@@ -0,0 +1,102 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "ImageMetrics.h"
+#include <chrono>
+#include <fstream>
+
+using namespace Falcor;
+
+/** Convergence-versus-time measurement of a pass output against a reference image.
+    Every N iterations or T milliseconds the output is read back and compared with ImageMetrics (MSE, relMSE, SSIM).
+    The readback waits for the GPU, so the time spent on a measurement is excluded from the render time of the curve.
+    Samples are logged and appended to a CSV file together with the iteration and the photon radii of that iteration.
+*/
+class ConvergenceMonitor
+{
+public:
+    struct Options
+    {
+        bool enabled = false;
+        std::string referencePath;              ///< Reference image (EXR). Needs the resolution of the output
+        uint intervalIterations = 16;           ///< Measure every N iterations. 0 disables the iteration trigger
+        float intervalMs = 0.f;                 ///< Measure every T milliseconds of render time. 0 disables the time trigger
+        bool computeSsim = true;
+        std::string outputPath;                 ///< CSV file for the curve. If empty the samples are only logged
+    };
+
+    struct Sample
+    {
+        uint iteration = 0;
+        double renderTimeSec = 0.0;             ///< Time since the restart without the measurement overhead
+        double mse = 0.0;
+        double relMse = 0.0;
+        double ssim = 0.0;
+        float globalRadius = 0.f;
+        float causticRadius = 0.f;
+    };
+
+    Options& getOptions() { return mOptions; }
+    const Options& getOptions() const { return mOptions; }
+
+    /** Starts a new curve and its clock. Call before the first iteration after a reset.
+    */
+    void restart();
+
+    /** Takes a sample if one is due. Call after the output of an iteration was written.
+        \param[in] pImage Output image. Any format that can be blit to RGBA32Float.
+        \param[in] iteration Number of finished iterations since the restart.
+    */
+    void update(RenderContext* pRenderContext, const Texture::SharedPtr& pImage, uint iteration, float globalRadius, float causticRadius);
+
+    const std::vector<Sample>& getSamples() const { return mSamples; }
+
+    /** Renders the options. Returns true if an option changed, which should restart the curve.
+    */
+    bool renderUI(Gui::Widgets& widget);
+
+private:
+    bool loadReference(RenderContext* pRenderContext);
+    void writeSample(const Sample& sample);
+
+    Options                     mOptions;
+    std::unique_ptr<ImageMetrics> mpMetrics;                ///< Created with the first measurement
+
+    std::string                 mLoadedReferencePath;       ///< Path of the reference in mReferenceData
+    std::vector<float>          mReferenceData;             ///< RGBA32Float
+    uint2                       mReferenceSize = uint2(0);
+    bool                        mSizeWarningIssued = false;
+
+    std::vector<Sample>         mSamples;
+    std::ofstream               mOutputFile;
+    std::chrono::steady_clock::time_point mStartTime;
+    double                      mOverheadSec = 0.0;         ///< Accumulated time of the measurements
+    uint                        mLastSampleIteration = 0;
+    double                      mLastSampleTimeSec = 0.0;
+};
@@ -0,0 +1,362 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "CpuPhotonGather.h"
+#include "SimdUtils.h"
+#include <immintrin.h>
+#include <chrono>
+#include <numeric>
+
+namespace
+{
+    const float kPi = 3.14159265358979323846f;
+    const float kInvPi = 0.31830988618379067154f;
+    const float kFaceNormalCosThreshold = 0.9f;    //Same threshold as the collect shader
+    const uint64_t kEmptyKey = ~0ull;
+
+    uint64_t packCellKey(int3 cell)
+    {
+        return (uint64_t(uint32_t(cell.x)) & 0x1FFFFF) | ((uint64_t(uint32_t(cell.y)) & 0x1FFFFF) << 21) | ((uint64_t(uint32_t(cell.z)) & 0x1FFFFF) << 42);
+    }
+
+    uint64_t mixKey(uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    /** Pointers to the photon streams of one grid, plus the per pixel query.
+    */
+    struct GatherQuery
+    {
+        const float* posX; const float* posY; const float* posZ;
+        const float* fluxR; const float* fluxG; const float* fluxB;
+        const float* dirX; const float* dirY; const float* dirZ;
+        const float* faceNX; const float* faceNY; const float* faceNZ;
+        float3 pos;
+        float3 normal;
+        float3 faceN;
+        float radiusSq;
+        bool faceTest;
+    };
+
+    float3 accumulateScalar(const GatherQuery& q, size_t begin, size_t end)
+    {
+        float3 sum = float3(0.f);
+        for (size_t i = begin; i < end; i++)
+        {
+            float dx = q.posX[i] - q.pos.x;
+            float dy = q.posY[i] - q.pos.y;
+            float dz = q.posZ[i] - q.pos.z;
+            if (dx * dx + dy * dy + dz * dz >= q.radiusSq) continue;
+            if (q.faceTest && q.faceN.x * q.faceNX[i] + q.faceN.y * q.faceNY[i] + q.faceN.z * q.faceNZ[i] < kFaceNormalCosThreshold) continue;
+            //Lambert with the cosine towards the incoming photon direction
+            float cosTheta = -(q.normal.x * q.dirX[i] + q.normal.y * q.dirY[i] + q.normal.z * q.dirZ[i]);
+            if (cosTheta <= 0.f) continue;
+            sum += float3(q.fluxR[i], q.fluxG[i], q.fluxB[i]) * cosTheta;
+        }
+        return sum;
+    }
+
+    PM_TARGET_AVX2 float horizontalSum(__m256 v)
+    {
+        __m128 lo = _mm256_castps256_ps128(v);
+        __m128 hi = _mm256_extractf128_ps(v, 1);
+        lo = _mm_add_ps(lo, hi);
+        lo = _mm_hadd_ps(lo, lo);
+        lo = _mm_hadd_ps(lo, lo);
+        return _mm_cvtss_f32(lo);
+    }
+
+    PM_TARGET_AVX2 float3 accumulateAVX2(const GatherQuery& q, size_t begin, size_t end)
+    {
+        const __m256 px = _mm256_set1_ps(q.pos.x), py = _mm256_set1_ps(q.pos.y), pz = _mm256_set1_ps(q.pos.z);
+        const __m256 nx = _mm256_set1_ps(-q.normal.x), ny = _mm256_set1_ps(-q.normal.y), nz = _mm256_set1_ps(-q.normal.z);
+        const __m256 fx = _mm256_set1_ps(q.faceN.x), fy = _mm256_set1_ps(q.faceN.y), fz = _mm256_set1_ps(q.faceN.z);
+        const __m256 r2 = _mm256_set1_ps(q.radiusSq);
+        const __m256 faceThreshold = _mm256_set1_ps(kFaceNormalCosThreshold);
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 sumR = zero, sumG = zero, sumB = zero;
+
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(q.posX + i), px);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(q.posY + i), py);
+            __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(q.posZ + i), pz);
+            __m256 d2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+            __m256 mask = _mm256_cmp_ps(d2, r2, _CMP_LT_OQ);
+            if (_mm256_movemask_ps(mask) == 0) continue;
+
+            if (q.faceTest)
+            {
+                __m256 fDot = _mm256_fmadd_ps(fz, _mm256_loadu_ps(q.faceNZ + i), _mm256_fmadd_ps(fy, _mm256_loadu_ps(q.faceNY + i), _mm256_mul_ps(fx, _mm256_loadu_ps(q.faceNX + i))));
+                mask = _mm256_and_ps(mask, _mm256_cmp_ps(fDot, faceThreshold, _CMP_GE_OQ));
+            }
+
+            __m256 cosTheta = _mm256_fmadd_ps(nz, _mm256_loadu_ps(q.dirZ + i), _mm256_fmadd_ps(ny, _mm256_loadu_ps(q.dirY + i), _mm256_mul_ps(nx, _mm256_loadu_ps(q.dirX + i))));
+            __m256 w = _mm256_and_ps(mask, _mm256_max_ps(cosTheta, zero));
+            sumR = _mm256_fmadd_ps(_mm256_loadu_ps(q.fluxR + i), w, sumR);
+            sumG = _mm256_fmadd_ps(_mm256_loadu_ps(q.fluxG + i), w, sumG);
+            sumB = _mm256_fmadd_ps(_mm256_loadu_ps(q.fluxB + i), w, sumB);
+        }
+
+        float3 sum = float3(horizontalSum(sumR), horizontalSum(sumG), horizontalSum(sumB));
+        return sum + accumulateScalar(q, i, end);
+    }
+}
+
+void CpuPhotonGather::PhotonSet::resize(size_t count)
+{
+    for (auto* stream : { &posX, &posY, &posZ, &fluxR, &fluxG, &fluxB, &dirX, &dirY, &dirZ, &faceNX, &faceNY, &faceNZ })
+        stream->resize(count);
+}
+
+CpuPhotonGather::PhotonSet CpuPhotonGather::PhotonSet::fromInfoArrays(const CpuPhotonTracer::PhotonArrays& arrays)
+{
+    PhotonSet set;
+    const uint count = std::min<uint>(arrays.count, arrays.width * arrays.height);
+    set.resize(count);
+    for (uint i = 0; i < count; i++)
+    {
+        size_t offset = arrays.getOffset(i);
+        const float4& pos = arrays.position[offset];
+        const float4& flux = arrays.flux[offset];
+        const float4& dir = arrays.dir[offset];
+        set.posX[i] = pos.x; set.posY[i] = pos.y; set.posZ[i] = pos.z;
+        set.fluxR[i] = flux.x; set.fluxG[i] = flux.y; set.fluxB[i] = flux.z;
+        set.dirX[i] = dir.x; set.dirY[i] = dir.y; set.dirZ[i] = dir.z;
+        //Spherical to cartesian, same as the collect shader
+        float sinTheta = std::sin(flux.w);
+        float3 faceN = glm::normalize(float3(std::cos(dir.w) * sinTheta, std::cos(flux.w), std::sin(dir.w) * sinTheta));
+        set.faceNX[i] = faceN.x; set.faceNY[i] = faceN.y; set.faceNZ[i] = faceN.z;
+    }
+    return set;
+}
+
+bool CpuPhotonGather::CellGrid::find(int3 cell, uint2& range) const
+{
+    if (keys.empty()) return false;
+    const uint64_t key = packCellKey(cell);
+    for (uint64_t slot = mixKey(key) & mask;; slot = (slot + 1) & mask)
+    {
+        if (keys[slot] == key)
+        {
+            range = ranges[slot];
+            return true;
+        }
+        if (keys[slot] == kEmptyKey)
+            return false;
+    }
+}
+
+CpuPhotonGather::CpuPhotonGather(uint threadCount)
+    : mThreadPool(threadCount)
+{
+}
+
+void CpuPhotonGather::setPhotons(PhotonSet caustic, PhotonSet global)
+{
+    mCausticPhotons = std::move(caustic);
+    mGlobalPhotons = std::move(global);
+    //Invalidate the grids
+    mCausticGrid.scale = 0.f;
+    mGlobalGrid.scale = 0.f;
+}
+
+void CpuPhotonGather::buildGrid(const PhotonSet& src, float radius, float cellSize, CellGrid& grid)
+{
+    const float scale = 1.f / (radius * cellSize);
+    if (grid.scale == scale) return;
+    grid.scale = scale;
+
+    const size_t count = src.size();
+    std::vector<uint64_t> photonKeys(count);
+    mThreadPool.parallelFor(count, 1 << 16, [&](size_t begin, size_t end, uint32_t) {
+        for (size_t i = begin; i < end; i++)
+            photonKeys[i] = packCellKey(int3(glm::floor(float3(src.posX[i], src.posY[i], src.posZ[i]) * scale)));
+    });
+
+    //Sort photons by cell so each cell becomes a contiguous range
+    std::vector<uint> order(count);
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&](uint a, uint b) { return photonKeys[a] < photonKeys[b]; });
+
+    grid.photons.resize(count);
+    mThreadPool.parallelFor(count, 1 << 16, [&](size_t begin, size_t end, uint32_t) {
+        for (size_t i = begin; i < end; i++)
+        {
+            uint s = order[i];
+            grid.photons.posX[i] = src.posX[s]; grid.photons.posY[i] = src.posY[s]; grid.photons.posZ[i] = src.posZ[s];
+            grid.photons.fluxR[i] = src.fluxR[s]; grid.photons.fluxG[i] = src.fluxG[s]; grid.photons.fluxB[i] = src.fluxB[s];
+            grid.photons.dirX[i] = src.dirX[s]; grid.photons.dirY[i] = src.dirY[s]; grid.photons.dirZ[i] = src.dirZ[s];
+            grid.photons.faceNX[i] = src.faceNX[s]; grid.photons.faceNY[i] = src.faceNY[s]; grid.photons.faceNZ[i] = src.faceNZ[s];
+        }
+    });
+
+    //Count cells and fill the lookup table with a load factor <= 0.5
+    size_t numCells = 0;
+    for (size_t i = 0; i < count; i++)
+        if (i == 0 || photonKeys[order[i]] != photonKeys[order[i - 1]]) numCells++;
+    size_t tableSize = 16;
+    while (tableSize < 2 * numCells) tableSize <<= 1;
+    grid.mask = tableSize - 1;
+    grid.keys.assign(tableSize, kEmptyKey);
+    grid.ranges.assign(tableSize, uint2(0));
+
+    size_t first = 0;
+    while (first < count)
+    {
+        const uint64_t key = photonKeys[order[first]];
+        size_t last = first + 1;
+        while (last < count && photonKeys[order[last]] == key) last++;
+        uint64_t slot = mixKey(key) & grid.mask;
+        while (grid.keys[slot] != kEmptyKey) slot = (slot + 1) & grid.mask;
+        grid.keys[slot] = key;
+        grid.ranges[slot] = uint2(static_cast<uint>(first), static_cast<uint>(last - first));
+        first = last;
+    }
+}
+
+float3 CpuPhotonGather::gatherPixel(const CellGrid& grid, float radius, const float3& posW, const float3& normalW, const float3& faceN, const Options& options, bool useAVX2, uint64_t& tested, uint64_t& visited) const
+{
+    const PhotonSet& p = grid.photons;
+    GatherQuery q{ p.posX.data(), p.posY.data(), p.posZ.data(), p.fluxR.data(), p.fluxG.data(), p.fluxB.data(),
+        p.dirX.data(), p.dirY.data(), p.dirZ.data(), p.faceNX.data(), p.faceNY.data(), p.faceNZ.data(),
+        posW, normalW, faceN, radius * radius, options.usePhotonFaceNormal };
+
+    float3 radiance = float3(0.f);
+    auto collectCell = [&](int3 cell) {
+        visited++;
+        uint2 range;
+        if (!grid.find(cell, range)) return;
+        uint collect = options.maxPhotonsPerCell > 0 ? std::min(range.y, options.maxPhotonsPerCell) : range.y;
+        float3 cellRadiance = useAVX2 ? accumulateAVX2(q, range.x, range.x + collect) : accumulateScalar(q, range.x, range.x + collect);
+        //Scale up if only a part of the cell was collected
+        radiance += cellRadiance * (float(range.y) / float(collect));
+        tested += collect;
+    };
+
+    //Same traversals as the collect shaders, every variant visits the cells in z, y, x order
+    if (options.traversal == GatherTraversal::Cube)
+    {
+        const int3 gridCenter = int3(glm::floor(posW * grid.scale));
+        const int gridRadius = static_cast<int>(std::ceil(radius * grid.scale));
+        for (int z = gridCenter.z - gridRadius; z <= gridCenter.z + gridRadius; z++)
+            for (int y = gridCenter.y - gridRadius; y <= gridCenter.y + gridRadius; y++)
+                for (int x = gridCenter.x - gridRadius; x <= gridCenter.x + gridRadius; x++)
+                    collectCell(int3(x, y, z));
+        return radiance;
+    }
+
+    const GatherCells cells = getGatherCells(posW, radius, grid.scale);
+    if (isGatherFixed8(cells))
+    {
+        for (uint i = 0; i < 8; i++)
+        {
+            const int3 cell = getGatherFixed8Cell(cells, i);
+            if (gatherSphereOverlapsCell(cells, cell)) collectCell(cell);
+        }
+        return radiance;
+    }
+    for (int z = cells.first.z; z <= cells.last.z; z++)
+        for (int y = cells.first.y; y <= cells.last.y; y++)
+            for (int x = cells.first.x; x <= cells.last.x; x++)
+                if (gatherSphereOverlapsCell(cells, int3(x, y, z))) collectCell(int3(x, y, z));
+    return radiance;
+}
+
+CpuPhotonGather::Result CpuPhotonGather::gather(const GBuffer& gBuffer, const Options& options)
+{
+    const size_t numPixels = size_t(gBuffer.width) * gBuffer.height;
+    FALCOR_ASSERT(gBuffer.posW.size() == numPixels && gBuffer.normalW.size() == numPixels && gBuffer.throughput.size() == numPixels);
+
+    Result result;
+    result.radiance.assign(numPixels, float3(0.f));
+
+    auto buildStart = std::chrono::steady_clock::now();
+    if (options.collectGlobal) buildGrid(mGlobalPhotons, options.globalRadius, options.cellSize, mGlobalGrid);
+    if (options.collectCaustic) buildGrid(mCausticPhotons, options.causticRadius, options.cellSize, mCausticGrid);
+    auto gatherStart = std::chrono::steady_clock::now();
+
+    const bool useAVX2 = options.useAVX2 && PhotonMapperSimd::hasAVX2();
+    const float wGlobal = 1.f / (kPi * options.globalRadius * options.globalRadius);
+    const float wCaustic = 1.f / (kPi * options.causticRadius * options.causticRadius);
+    const uint tileSize = std::max(1u, options.tileSize);
+    const uint tilesX = (gBuffer.width + tileSize - 1) / tileSize;
+    const uint tilesY = (gBuffer.height + tileSize - 1) / tileSize;
+    std::vector<uint64_t> tested(mThreadPool.getThreadCount(), 0);
+    std::vector<uint64_t> visited(mThreadPool.getThreadCount(), 0);
+
+    mThreadPool.parallelFor(size_t(tilesX) * tilesY, 1, [&](size_t begin, size_t end, uint32_t threadIndex) {
+        for (size_t tile = begin; tile < end; tile++)
+        {
+            const uint x0 = static_cast<uint>(tile % tilesX) * tileSize;
+            const uint y0 = static_cast<uint>(tile / tilesX) * tileSize;
+            for (uint y = y0; y < std::min(y0 + tileSize, gBuffer.height); y++)
+                for (uint x = x0; x < std::min(x0 + tileSize, gBuffer.width); x++)
+                {
+                    const size_t idx = size_t(y) * gBuffer.width + x;
+                    if (!gBuffer.valid.empty() && !gBuffer.valid[idx]) continue;
+
+                    const float3& posW = gBuffer.posW[idx];
+                    float3 normalW = gBuffer.normalW[idx];
+                    float3 faceN = gBuffer.faceNormalW.empty() ? normalW : gBuffer.faceNormalW[idx];
+                    //Normals have to point towards the viewer
+                    if (!gBuffer.viewW.empty())
+                    {
+                        if (glm::dot(gBuffer.viewW[idx], faceN) > 0.f) faceN = -faceN;
+                        if (glm::dot(gBuffer.viewW[idx], normalW) > 0.f) normalW = -normalW;
+                    }
+
+                    float3 radiance = float3(0.f);
+                    if (options.collectGlobal)
+                        radiance += wGlobal * gatherPixel(mGlobalGrid, options.globalRadius, posW, normalW, faceN, options, useAVX2, tested[threadIndex], visited[threadIndex]);
+                    if (options.collectCaustic)
+                        radiance += wCaustic * gatherPixel(mCausticGrid, options.causticRadius, posW, normalW, faceN, options, useAVX2, tested[threadIndex], visited[threadIndex]);
+
+                    const float3 albedo = gBuffer.diffuseAlbedo.empty() ? float3(1.f) : gBuffer.diffuseAlbedo[idx];
+                    radiance *= albedo * kInvPi;
+                    radiance *= gBuffer.throughput[idx];
+                    if (!gBuffer.emissive.empty())
+                        radiance += gBuffer.emissive[idx] * gBuffer.throughput[idx];
+                    result.radiance[idx] = radiance;
+                }
+        }
+    });
+    auto gatherEnd = std::chrono::steady_clock::now();
+
+    for (uint64_t t : tested) result.photonsTested += t;
+    for (uint64_t v : visited) result.cellsVisited += v;
+    result.buildTimeMs = std::chrono::duration<double, std::milli>(gatherStart - buildStart).count();
+    result.gatherTimeMs = std::chrono::duration<double, std::milli>(gatherEnd - gatherStart).count();
+    return result;
+}
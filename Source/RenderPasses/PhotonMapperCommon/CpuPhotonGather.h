@@ -0,0 +1,132 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "CpuPhotonTracer.h"
+#include "GatherCells.slang"
+#include "WorkStealingThreadPool.h"
+
+using namespace Falcor;
+
+/** CPU reference of the photon collect pass (PhotonMapperHashCollect.cs.slang).
+    Takes a photon set and a captured G-buffer and computes the photon density estimate per pixel:
+    cell traversal (GatherCells.slang), radius test, face normal test,
+    Lambert weighting and the 1 / (pi r^2) normalization.
+    Photons are sorted by cell into SoA streams so every cell is a contiguous range, which the AVX2 kernel processes 8 photons at a time.
+    The grid only depends on the radius, so re-gathering at a new radius does not require re-tracing.
+*/
+class CpuPhotonGather
+{
+public:
+    /** Photon attributes as structure of arrays. The face normal is stored decoded.
+    */
+    struct PhotonSet
+    {
+        std::vector<float> posX, posY, posZ;
+        std::vector<float> fluxR, fluxG, fluxB;
+        std::vector<float> dirX, dirY, dirZ;
+        std::vector<float> faceNX, faceNY, faceNZ;
+
+        size_t size() const { return posX.size(); }
+        void resize(size_t count);
+
+        /** Converts photons from the GPU info texture layout (see CpuPhotonTracer::PhotonArrays).
+        */
+        static PhotonSet fromInfoArrays(const CpuPhotonTracer::PhotonArrays& arrays);
+    };
+
+    /** Per pixel inputs as written by PTVBuffer (after resolving the hit).
+    */
+    struct GBuffer
+    {
+        uint width = 0;
+        uint height = 0;
+        std::vector<uint8_t> valid;             ///< 0 for pixels without a hit
+        std::vector<float3> posW;
+        std::vector<float3> normalW;            ///< Shading normal
+        std::vector<float3> faceNormalW;        ///< Optional. The shading normal is used if empty
+        std::vector<float3> viewW;              ///< Direction from the camera to the hit
+        std::vector<float3> throughput;         ///< Path throughput (thpMatID.xyz)
+        std::vector<float3> diffuseAlbedo;      ///< Optional Lambert albedo. 1 is used if empty
+        std::vector<float3> emissive;           ///< Optional emission
+    };
+
+    struct Options
+    {
+        float globalRadius = 0.05f;
+        float causticRadius = 0.01f;
+        bool collectGlobal = true;
+        bool collectCaustic = true;
+        bool usePhotonFaceNormal = true;
+        uint maxPhotonsPerCell = 0;             ///< Emulates the bucket capacity of the GPU hash (NUM_PHOTONS_PER_BUCKET). 0 is unlimited
+        GatherTraversal traversal = GatherTraversal::SphereOverlap;
+        float cellSize = 1.f;                   ///< Edge length of the cells in radii
+        bool useAVX2 = true;                    ///< Uses the scalar path if false or if the CPU has no AVX2
+        uint tileSize = 16;
+    };
+
+    struct Result
+    {
+        std::vector<float3> radiance;           ///< width * height, row major
+        uint64_t photonsTested = 0;
+        uint64_t cellsVisited = 0;              ///< Cell lookups of the traversal
+        double buildTimeMs = 0.0;               ///< Time to (re)build the cell grids
+        double gatherTimeMs = 0.0;
+    };
+
+    explicit CpuPhotonGather(uint threadCount = 0);
+
+    void setPhotons(PhotonSet caustic, PhotonSet global);
+
+    /** Computes the photon density estimate for every valid pixel.
+    */
+    Result gather(const GBuffer& gBuffer, const Options& options);
+
+private:
+    /** Photons sorted by cell with an open addressing table from cell key to photon range.
+    */
+    struct CellGrid
+    {
+        float scale = 0.f;                      ///< 1 / (radius * cell size) the grid was built for
+        PhotonSet photons;
+        std::vector<uint64_t> keys;
+        std::vector<uint2> ranges;              ///< (first photon, count)
+        uint64_t mask = 0;
+
+        bool find(int3 cell, uint2& range) const;
+    };
+
+    void buildGrid(const PhotonSet& src, float radius, float cellSize, CellGrid& grid);
+    float3 gatherPixel(const CellGrid& grid, float radius, const float3& posW, const float3& normalW, const float3& faceN, const Options& options, bool useAVX2, uint64_t& tested, uint64_t& visited) const;
+
+    WorkStealingThreadPool  mThreadPool;
+    PhotonSet               mCausticPhotons;
+    PhotonSet               mGlobalPhotons;
+    CellGrid                mCausticGrid;
+    CellGrid                mGlobalGrid;
+};
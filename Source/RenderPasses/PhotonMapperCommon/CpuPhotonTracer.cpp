@@ -0,0 +1,494 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "CpuPhotonTracer.h"
+#include "SpatialHash.slang"
+#include <chrono>
+#include <unordered_map>
+
+namespace
+{
+    const float kPi = 3.14159265358979323846f;
+    const float k2Pi = 6.28318530717958647692f;
+    const float k4Pi = 12.5663706143591729538f;
+    const float kPiOver2 = 1.57079632679489661923f;
+
+    const float kRayTMin = 0.01f;               //Same values as in the generate shader
+    const float kRayTMax = 1000.f;
+    const float kRayOriginOffset = 1e-4f;
+
+    const uint kGrainSize = 4096;               //Photons per work item
+
+    /** PCG32 random number generator, one per path.
+    */
+    struct Pcg32
+    {
+        uint64_t state;
+
+        Pcg32(uint64_t seed, uint64_t stream)
+        {
+            state = 0;
+            mInc = (stream << 1u) | 1u;
+            next();
+            state += seed;
+            next();
+        }
+
+        uint next()
+        {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + mInc;
+            uint xorShifted = static_cast<uint>(((old >> 18u) ^ old) >> 27u);
+            uint rot = static_cast<uint>(old >> 59u);
+            return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+        }
+
+        float next1D() { return (next() >> 8) * (1.f / 16777216.f); }
+        float2 next2D() { float x = next1D(); return float2(x, next1D()); }
+        float3 next3D() { float x = next1D(); float y = next1D(); return float3(x, y, next1D()); }
+
+    private:
+        uint64_t mInc;
+    };
+
+    float3 sampleSphere(float2 u)
+    {
+        float z = 1.f - 2.f * u.x;
+        float r = std::sqrt(std::max(0.f, 1.f - z * z));
+        float phi = k2Pi * u.y;
+        return float3(r * std::cos(phi), r * std::sin(phi), z);
+    }
+
+    float3 sampleCosineHemisphere(float2 u, float& pdf)
+    {
+        float r = std::sqrt(u.x);
+        float phi = k2Pi * u.y;
+        float3 p = float3(r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.f, 1.f - u.x)));
+        pdf = p.z / kPi;
+        return p;
+    }
+
+    float3 sampleCone(float2 u, float cosTheta)
+    {
+        float z = u.x * (1.f - cosTheta) + cosTheta;
+        float r = std::sqrt(std::max(0.f, 1.f - z * z));
+        float phi = k2Pi * u.y;
+        return float3(r * std::cos(phi), r * std::sin(phi), z);
+    }
+
+    float3 sampleTriangle(float2 u)
+    {
+        float su = std::sqrt(u.x);
+        float2 b = float2(1.f - su, u.y * su);
+        return float3(1.f - b.x - b.y, b.x, b.y);
+    }
+
+    //Same basis as fromLocalToWorld in the generate shader
+    float3 fromLocalToWorld(const float3& n, const float3& dir)
+    {
+        float3 tangent = std::abs(n.x) < 0.99f ? glm::cross(n, float3(1.f, 0.f, 0.f)) : glm::cross(n, float3(0.f, 1.f, 0.f));
+        float3 bitangent = glm::cross(tangent, n);
+        return dir.x * tangent + dir.y * bitangent + dir.z * n;
+    }
+
+    float3 buildOrthonormalLocal(const float3& n, const float3& dir)
+    {
+        float3 tangent = glm::normalize(std::abs(n.x) < 0.99f ? glm::cross(n, float3(1.f, 0.f, 0.f)) : glm::cross(n, float3(0.f, 1.f, 0.f)));
+        float3 bitangent = glm::cross(n, tangent);
+        return dir.x * tangent + dir.y * bitangent + dir.z * n;
+    }
+
+    float lum(const float3& c) { return glm::dot(c, float3(0.2126f, 0.7152f, 0.0722f)); }
+
+    float fresnelDielectric(float cosI, float eta)
+    {
+        float sinT2 = eta * eta * (1.f - cosI * cosI);
+        if (sinT2 >= 1.f) return 1.f;
+        float cosT = std::sqrt(1.f - sinT2);
+        float rs = (cosI - eta * cosT) / (cosI + eta * cosT);
+        float rp = (eta * cosI - cosT) / (eta * cosI + cosT);
+        return 0.5f * (rs * rs + rp * rp);
+    }
+}
+
+struct CpuPhotonTracer::PathState
+{
+    uint64_t rays = 0;
+    uint64_t paths = 0;
+};
+
+CpuPhotonTracer::CpuPhotonTracer(SceneData scene, uint threadCount)
+    : mScene(std::move(scene))
+    , mThreadPool(threadCount)
+{
+    PM_ASSERT(mScene.positions.size() % 3 == 0);
+    PM_ASSERT(mScene.materialIDs.size() * 3 == mScene.positions.size());
+    if (mScene.materials.empty()) mScene.materials.push_back({});
+    mBVH.build(mScene.positions);
+}
+
+void CpuPhotonTracer::setLights(std::vector<AnalyticLight> analyticLights, std::vector<EmissiveTriangle> emissiveTriangles)
+{
+    mAnalyticLights = std::move(analyticLights);
+    mEmissiveTriangles = std::move(emissiveTriangles);
+}
+
+CpuPhotonTracer::Result CpuPhotonTracer::trace(const LightSampleTable& lightTable, const Options& options)
+{
+    PM_ASSERT(!lightTable.aliasTable.empty());
+    PM_ASSERT(options.infoTexHeight > 0);
+
+    Result result;
+    auto initArrays = [&](PhotonArrays& arrays, uint maxSize) {
+        arrays.height = options.infoTexHeight;
+        arrays.width = (maxSize + options.infoTexHeight - 1) / options.infoTexHeight;
+        size_t texels = size_t(arrays.width) * arrays.height;
+        arrays.position.assign(texels, float4(0.f));
+        arrays.flux.assign(texels, float4(0.f));
+        arrays.dir.assign(texels, float4(0.f));
+    };
+    initArrays(result.caustic, options.causticMaxSize);
+    initArrays(result.global, options.globalMaxSize);
+    if (!options.cellRangeGrid)
+    {
+        result.causticBuckets.init(options.buckets);
+        result.globalBuckets.init(options.buckets);
+    }
+
+    const uint2 launchDim = uint2(lightTable.width, lightTable.height);
+    const size_t numLaunches = size_t(launchDim.x) * launchDim.y;
+    const size_t numChunks = (numLaunches + kGrainSize - 1) / kGrainSize;
+    std::vector<PathState> threadStates(mThreadPool.getThreadCount());
+    std::vector<std::vector<PhotonCandidate>> chunkPhotons(numChunks);
+
+    auto start = std::chrono::steady_clock::now();
+    mThreadPool.parallelFor(numChunks, 1, [&](size_t begin, size_t end, uint32_t threadIndex) {
+        PathState& state = threadStates[threadIndex];
+        for (size_t chunk = begin; chunk < end; chunk++)
+        {
+            for (size_t i = chunk * kGrainSize; i < std::min(numLaunches, (chunk + 1) * kGrainSize); i++)
+            {
+                uint2 launchIndex = uint2(static_cast<uint>(i % launchDim.x), static_cast<uint>(i / launchDim.x));
+                tracePhoton(launchIndex, launchDim, lightTable, options, chunkPhotons[chunk], state);
+            }
+        }
+    });
+
+    //The chunks are in launch order, so the photons reach the buckets in the same order in every run
+    for (auto& photons : chunkPhotons)
+    {
+        for (const PhotonCandidate& photon : photons)
+            storePhoton(photon, options, result);
+        photons = {};
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (const auto& state : threadStates)
+    {
+        result.pathsTraced += state.paths;
+        result.raysTraced += state.rays;
+    }
+    result.traceTimeMs = std::chrono::duration<double, std::milli>(end - start).count();
+    uint64_t stored = uint64_t(std::min(result.caustic.count, options.causticMaxSize)) + std::min(result.global.count, options.globalMaxSize);
+    result.photonsPerSecond = result.traceTimeMs > 0.0 ? stored / (result.traceTimeMs * 1e-3) : 0.0;
+    return result;
+}
+
+void CpuPhotonTracer::storePhoton(const PhotonCandidate& photon, const Options& options, Result& result)
+{
+    PhotonArrays& arrays = photon.caustic ? result.caustic : result.global;
+    const uint maxSize = photon.caustic ? options.causticMaxSize : options.globalMaxSize;
+
+    //Same order as the generate pass: bucket first, the photon counter only counts photons that got a slot
+    uint slot = 0, bucket = 0;
+    if (!options.cellRangeGrid)
+    {
+        HashTableStats::BucketTable& table = photon.caustic ? result.causticBuckets : result.globalBuckets;
+        slot = HashTableStats::insert(table, options.buckets, photon.cell, photon.u, photon.caustic, result.hashStats, bucket);
+        if (slot == HashTableStats::kNotStored) return;
+    }
+
+    uint photonIndex = arrays.count++;
+    if (maxSize == 0) return;
+    //The GPU clamps overflowing photons onto the last slot
+    photonIndex = std::min(photonIndex, maxSize - 1);
+    if (!options.cellRangeGrid)
+    {
+        HashTableStats::BucketTable& table = photon.caustic ? result.causticBuckets : result.globalBuckets;
+        table.photonIdx[size_t(bucket) * options.buckets.photonsPerBucket + slot] = photonIndex;
+    }
+    size_t offset = arrays.getOffset(photonIndex);
+    arrays.position[offset] = float4(photon.pos, static_cast<float>(static_cast<int>(hashCellKey(photon.cell))));
+    arrays.flux[offset] = photon.flux;
+    arrays.dir[offset] = photon.dir;
+}
+
+void CpuPhotonTracer::tracePhoton(uint2 launchIndex, uint2 launchDim, const LightSampleTable& lightTable, const Options& options, std::vector<PhotonCandidate>& photons, PathState& state)
+{
+    //One stream per launch index, seeded per frame like the GPU sample generator
+    const uint64_t launchId = uint64_t(launchIndex.y) * launchDim.x + launchIndex.x;
+    Pcg32 sg(uint64_t(options.seed + options.frameCount), launchId);
+
+    //Select the light from the alias table
+    float invPdf = 0.f;
+    int lightIndex = LightAliasTable::sample(lightTable.aliasTable, static_cast<uint>(launchId), launchDim.x * launchDim.y, sg.next1D(), invPdf);
+    // 0 means invalid light index
+    if (lightIndex == 0)
+        return;
+    bool analytic = lightIndex < 0;
+    if (analytic)
+        lightIndex *= -1;
+    lightIndex -= 1;
+    state.paths++;
+
+    float3 lightPos = float3(0.f);
+    float3 lightDir = float3(0.f, 1.f, 0.f);
+    float3 lightIntensity = float3(0.f);
+    float maxSpotAngle = 0.f;
+    float penumbra = 0.f;
+    uint type = 0; //0 == Point, 1 == Area, 2 == Spot
+    float lightArea = 1.f;
+
+    if (analytic)
+    {
+        if (lightIndex >= static_cast<int>(mAnalyticLights.size())) return;
+        const AnalyticLight& light = mAnalyticLights[lightIndex];
+        if (light.openingAngle < kPiOver2)
+            type = 2;
+        lightPos = light.posW;
+        lightDir = light.dirW;
+        lightIntensity = light.intensity;
+        maxSpotAngle = light.openingAngle;
+        penumbra = light.penumbraAngle;
+    }
+    else
+    {
+        if (lightIndex >= static_cast<int>(mEmissiveTriangles.size())) return;
+        const EmissiveTriangle& tri = mEmissiveTriangles[lightIndex];
+        float3 bary = sampleTriangle(sg.next2D());
+        lightPos = bary.x * tri.posW[0] + bary.y * tri.posW[1] + bary.z * tri.posW[2];
+        lightDir = tri.normal;
+        lightArea = tri.area;
+        lightIntensity = tri.radiance;
+        type = 1;
+    }
+
+    float3 lightRnd = sg.next3D();
+    float spotAngle = maxSpotAngle - penumbra * lightRnd.z;
+    float lightDirPdf = 0.f;
+    float3 rayDir;
+    switch (type)
+    {
+    case 0:
+        rayDir = sampleSphere(float2(lightRnd.x, lightRnd.y));
+        lightDirPdf = k4Pi;     //Same (inverse) value the GPU uses
+        break;
+    case 1:
+        rayDir = sampleCosineHemisphere(float2(lightRnd.x, lightRnd.y), lightDirPdf);
+        break;
+    default:
+        rayDir = sampleCone(float2(lightRnd.x, lightRnd.y), std::cos(spotAngle));
+        lightDirPdf = 1.f / (k2Pi * (1.f - std::cos(spotAngle)));
+    }
+    rayDir = fromLocalToWorld(lightDir, rayDir);
+    if (lightDirPdf <= 0.f) return;
+
+    float3 lightFlux = lightIntensity * invPdf;
+    if (!analytic) lightFlux *= std::abs(glm::dot(lightDir, rayDir)) * lightArea * kPiOver2;
+    lightFlux /= float(launchDim.x) * float(launchDim.y) * lightDirPdf;     //invPdf is the light selection pdf
+
+    float3 rayOrigin = lightPos + 0.01f * rayDir;
+    float3 thp = float3(1.f);
+    bool wasReflectedSpecular = false;
+
+    for (uint bounce = 0; bounce < options.maxBounces; bounce++)
+    {
+        float3 photonFlux = lightFlux * thp;
+
+        TriangleBVH::Hit hit;
+        state.rays++;
+        if (!mBVH.intersect(rayOrigin, rayDir, kRayTMin, kRayTMax, hit))
+            break;
+
+        //Shading frame at the hit
+        const uint tri = hit.triIndex;
+        const float3& p0 = mScene.positions[3 * tri];
+        const float3& p1 = mScene.positions[3 * tri + 1];
+        const float3& p2 = mScene.positions[3 * tri + 2];
+        const float3 bary = float3(1.f - hit.barycentrics.x - hit.barycentrics.y, hit.barycentrics.x, hit.barycentrics.y);
+        const float3 hitPos = bary.x * p0 + bary.y * p1 + bary.z * p2;
+        const float3 wi = -rayDir;
+        float3 faceN = glm::normalize(glm::cross(p1 - p0, p2 - p0));
+        float3 shadingN = faceN;
+        if (!mScene.normals.empty())
+            shadingN = glm::normalize(bary.x * mScene.normals[3 * tri] + bary.y * mScene.normals[3 * tri + 1] + bary.z * mScene.normals[3 * tri + 2]);
+        const bool frontFacing = glm::dot(faceN, wi) > 0.f;
+        if (!frontFacing) faceN = -faceN;
+        if (glm::dot(shadingN, wi) < 0.f) shadingN = -shadingN;
+
+        const Material& mat = mScene.materials[std::min<size_t>(mScene.materialIDs[tri], mScene.materials.size() - 1)];
+
+        //Pick a lobe proportional to its luminance
+        float wDiffuse = lum(mat.diffuse) * (1.f - mat.specularTransmission);
+        float wSpecular = lum(mat.specular);
+        float wTransmission = lum(mat.transmission) * mat.specularTransmission;
+        float wTotal = wDiffuse + wSpecular + wTransmission;
+        if (wTotal <= 0.f)
+            break;
+
+        float lobeRnd = sg.next1D() * wTotal;
+        float3 wo;
+        float3 weight;
+        bool diffuseHit = false;
+        bool transmission = false;
+        bool valid = true;
+        if (lobeRnd < wDiffuse)
+        {
+            float pdf;
+            wo = buildOrthonormalLocal(shadingN, sampleCosineHemisphere(sg.next2D(), pdf));
+            weight = mat.diffuse * (1.f - mat.specularTransmission) * (wTotal / wDiffuse);
+            diffuseHit = true;
+        }
+        else if (lobeRnd < wDiffuse + wSpecular)
+        {
+            float3 mirror = 2.f * glm::dot(wi, shadingN) * shadingN - wi;
+            float2 u = sg.next2D();
+            wo = glm::normalize(mirror + mat.roughness * sampleSphere(u));
+            valid = glm::dot(wo, faceN) > 0.f;
+            weight = mat.specular * (wTotal / wSpecular);
+            diffuseHit = mat.roughness > options.specRoughCutoff;
+        }
+        else
+        {
+            //Smooth dielectric, choose between reflection and refraction by the fresnel term
+            float eta = frontFacing ? 1.f / mat.ior : mat.ior;
+            float cosI = glm::dot(wi, shadingN);
+            float F = fresnelDielectric(cosI, eta);
+            if (sg.next1D() < F)
+            {
+                wo = 2.f * cosI * shadingN - wi;
+            }
+            else
+            {
+                float cosT = std::sqrt(std::max(0.f, 1.f - eta * eta * (1.f - cosI * cosI)));
+                wo = glm::normalize(-wi * eta + (eta * cosI - cosT) * shadingN);
+                transmission = true;
+            }
+            weight = mat.transmission * mat.specularTransmission * (wTotal / wTransmission);
+        }
+
+        float3 newOrigin = hitPos + (transmission ? -faceN : faceN) * kRayOriginOffset * (1.f + std::max(std::abs(hitPos.x), std::max(std::abs(hitPos.y), std::abs(hitPos.z))));
+        thp *= valid ? weight : float3(0.f);
+        if (!valid || thp.x < 0.f || thp.y < 0.f || thp.z < 0.f)
+            break;
+
+        //Store photon on diffuse hits
+        if (diffuseHit)
+        {
+            float faceNTheta = 1.f;
+            float faceNPhi = 1.f;
+            if (options.usePhotonFaceNormal)
+            {
+                faceNTheta = std::acos(std::clamp(faceN.y, -1.f, 1.f));
+                faceNPhi = std::atan2(faceN.z, faceN.x);
+            }
+
+            bool roulette = sg.next1D() <= options.globalRejection;
+            float cellScale = wasReflectedSpecular ? options.causticHashScaleFactor : options.globalHashScaleFactor;
+            int3 cell = int3(glm::floor(newOrigin * cellScale));
+            //Drawn for every photon, so the paths do not depend on the bucket settings
+            float u = sg.next1D();
+
+            if (wasReflectedSpecular)
+                photons.push_back({ newOrigin, cell, float4(photonFlux, faceNTheta), float4(rayDir, faceNPhi), u, true });
+            else if (roulette)
+                photons.push_back({ newOrigin, cell, float4(photonFlux / options.globalRejection, faceNTheta), float4(rayDir, faceNPhi), u, false });
+        }
+
+        //Russian Roulette
+        const float prob = std::max(0.f, 1.f - lum(thp));
+        if (sg.next1D() < prob)
+            break;
+        thp /= (1.f - prob);
+
+        wasReflectedSpecular = !diffuseHit;
+        rayOrigin = newOrigin;
+        rayDir = wo;
+    }
+}
+
+CpuPhotonTracer::Comparison CpuPhotonTracer::compare(const Result& reference, const GpuReadback& gpu, const Options& options)
+{
+    //Flux luminance per cell key of the stored photons
+    auto getCellFlux = [](const PhotonArrays& arrays, uint count, uint maxSize, double& total) {
+        std::unordered_map<int64_t, double> cells;
+        total = 0.0;
+        const uint stored = std::min(count, maxSize);
+        for (uint i = 0; i < stored && !arrays.position.empty(); i++)
+        {
+            const size_t offset = arrays.getOffset(i);
+            const float4& f = arrays.flux[offset];
+            const double flux = lum(float3(f.x, f.y, f.z));
+            cells[static_cast<int64_t>(arrays.position[offset].w)] += flux;
+            total += flux;
+        }
+        return cells;
+    };
+
+    auto compareMap = [&](const PhotonArrays& cpu, const PhotonArrays& gpuArrays, uint gpuCount, uint maxSize) {
+        MapComparison c;
+        c.countRatio = cpu.count > 0 ? double(gpuCount) / cpu.count : (gpuCount == 0 ? 1.0 : 0.0);
+        if (gpuArrays.position.empty()) return c;
+
+        double cpuTotal, gpuTotal;
+        auto cpuCells = getCellFlux(cpu, cpu.count, maxSize, cpuTotal);
+        auto gpuCells = getCellFlux(gpuArrays, gpuCount, maxSize, gpuTotal);
+        c.fluxRatio = cpuTotal > 0.0 ? gpuTotal / cpuTotal : 0.0;
+        if (cpuTotal <= 0.0 || gpuTotal <= 0.0) return c;
+
+        double distance = 0.0;
+        for (const auto& [key, flux] : cpuCells)
+        {
+            auto it = gpuCells.find(key);
+            distance += std::abs(flux / cpuTotal - (it != gpuCells.end() ? it->second / gpuTotal : 0.0));
+        }
+        for (const auto& [key, flux] : gpuCells)
+        {
+            if (cpuCells.find(key) == cpuCells.end()) distance += flux / gpuTotal;
+        }
+        c.cellDistance = 0.5 * distance;
+        return c;
+    };
+
+    Comparison comparison;
+    comparison.caustic = compareMap(reference.caustic, gpu.caustic, gpu.causticCount, options.causticMaxSize);
+    comparison.global = compareMap(reference.global, gpu.global, gpu.globalCount, options.globalMaxSize);
+    comparison.cpuReport = HashTableStats::createReport("CPU", reference.hashStats, options.buckets);
+    if (gpu.hasHashStats)
+        comparison.gpuReport = HashTableStats::createReport("GPU", gpu.hashStats, options.buckets);
+    return comparison;
+}
@@ -0,0 +1,215 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "CpuMath.h"
+#include "HashTableStats.h"
+#include "LightAliasTable.h"
+#include "TriangleBVH.h"
+#include "WorkStealingThreadPool.h"
+
+using namespace Falcor;
+
+/** CPU reference of the photon generation pass (PhotonMapperHashGenerate.rt.slang).
+    Photons are emitted through the same light sample table, use the same light flux normalization,
+    Russian roulette, global rejection and caustic/global split as the GPU. The results are written in
+    the layout of the GPU photon info textures so they can be uploaded or compared directly.
+    The paths are traced in parallel, the photons are then inserted into the buckets in launch order with the insert of
+    the generate pass (HashTableStats::insert), so a trace is deterministic. compare() checks a GPU readback against it.
+*/
+class CpuPhotonTracer
+{
+public:
+    /** Simplified material. Lobes are picked proportional to their luminance.
+    */
+    struct Material
+    {
+        float3 diffuse = float3(0.5f);          ///< Lambert albedo
+        float3 specular = float3(0.f);          ///< Specular reflectance
+        float roughness = 1.f;                  ///< Roughness of the specular lobe
+        float3 transmission = float3(1.f);      ///< Tint of the specular transmission lobe
+        float specularTransmission = 0.f;       ///< Fraction of light that is transmitted
+        float ior = 1.5f;                       ///< Index of refraction for transmission
+    };
+
+    /** Scene geometry. Vertex arrays hold 3 consecutive entries per triangle.
+    */
+    struct SceneData
+    {
+        std::vector<float3> positions;
+        std::vector<float3> normals;            ///< Optional shading normals. Face normals are used if empty
+        std::vector<uint> materialIDs;          ///< One material per triangle
+        std::vector<Material> materials;
+    };
+
+    /** Point or spot light, mirrors the fields read from LightData on the GPU.
+    */
+    struct AnalyticLight
+    {
+        float3 posW = float3(0.f);
+        float3 dirW = float3(0.f, 0.f, -1.f);
+        float3 intensity = float3(1.f);
+        float openingAngle = 3.14159265f;        ///< Opening angles >= pi/2 are treated as point lights
+        float penumbraAngle = 0.f;
+    };
+
+    /** Active emissive triangle (index = position in the active list, as in the light sample table).
+    */
+    struct EmissiveTriangle
+    {
+        float3 posW[3];
+        float3 normal;
+        float area = 0.f;
+        float3 radiance = float3(0.f);          ///< Emitted radiance (already scaled by the emissive scale)
+    };
+
+    /** CPU copy of the light sample table created by createLightSampleTable. Photons are launched as width x height
+        and select their light from the alias table like the generate shaders.
+    */
+    struct LightSampleTable
+    {
+        uint width = 0;
+        uint height = 0;
+        std::vector<LightAliasEntry> aliasTable;
+    };
+
+    struct Options
+    {
+        uint maxBounces = 10;
+        float globalRejection = 0.3f;           ///< Probability that a global photon is stored
+        float specRoughCutoff = 0.5f;           ///< Reflections rougher than this count as diffuse
+        float causticHashScaleFactor = 1.f;     ///< 1 / caustic radius
+        float globalHashScaleFactor = 1.f;      ///< 1 / global radius
+        uint causticMaxSize = 0;                ///< Size of the caustic photon buffer
+        uint globalMaxSize = 0;                 ///< Size of the global photon buffer
+        uint infoTexHeight = 512;               ///< Height of the photon info textures
+        HashTableStats::Settings buckets;       ///< Buckets of the hash pass
+        bool cellRangeGrid = false;             ///< Stores every photon without buckets, like the cell range grid
+        bool usePhotonFaceNormal = true;
+        uint seed = 0;
+        uint frameCount = 0;
+    };
+
+    /** Photon list in the GPU info texture layout. Texel (idx / height, idx % height), stored row major.
+    */
+    struct PhotonArrays
+    {
+        uint width = 0;
+        uint height = 0;
+        uint count = 0;                         ///< Number of photons written (before clamping, as the GPU counter). Photons dropped by the buckets are not counted
+        std::vector<float4> position;           ///< xyz = position, w = packed cell xy
+        std::vector<float4> flux;               ///< xyz = flux, w = face normal theta
+        std::vector<float4> dir;                ///< xyz = incident direction, w = face normal phi
+
+        /** Linear offset in the arrays for photon index idx.
+        */
+        size_t getOffset(uint idx) const { return static_cast<size_t>(idx % height) * width + idx / height; }
+    };
+
+    struct Result
+    {
+        PhotonArrays caustic;
+        PhotonArrays global;
+        HashTableStats::BucketTable causticBuckets;     ///< Empty with cellRangeGrid
+        HashTableStats::BucketTable globalBuckets;
+        HashTableStats::Counters hashStats = {};        ///< Generate counters in the layout of the GPU counters
+        uint64_t pathsTraced = 0;
+        uint64_t raysTraced = 0;
+        double traceTimeMs = 0.0;
+        double photonsPerSecond = 0.0;          ///< Stored photons (caustic + global) per second
+    };
+
+    /** Photon counters, hash table counters and optionally the photon info textures read back from the hash pass.
+    */
+    struct GpuReadback
+    {
+        uint causticCount = 0;
+        uint globalCount = 0;
+        bool hasHashStats = false;              ///< The pass ran with hash table statistics
+        HashTableStats::Counters hashStats = {};
+        PhotonArrays caustic;                   ///< Empty if the info textures were not read back
+        PhotonArrays global;
+    };
+
+    struct MapComparison
+    {
+        double countRatio = 0.0;                ///< GPU / CPU photon counter
+        double fluxRatio = 0.0;                 ///< GPU / CPU summed flux luminance of the stored photons. 0 without photon arrays
+        double cellDistance = 0.0;              ///< Total variation distance of the flux over the cell keys, 0 (equal) to 1. 0 without photon arrays
+    };
+
+    struct Comparison
+    {
+        MapComparison caustic;
+        MapComparison global;
+        HashTableStats::Report cpuReport;
+        HashTableStats::Report gpuReport;       ///< Default constructed without GPU hash table statistics
+    };
+
+    /** Compares a GPU photon pass with a CPU trace of the same light sample table and options.
+        The random numbers of both differ, so only counts and distributions agree. cellDistance needs enough photons per cell to get small.
+    */
+    static Comparison compare(const Result& reference, const GpuReadback& gpu, const Options& options);
+
+    /** Create the tracer. Builds the BVH over the scene triangles.
+        \param[in] threadCount Number of threads, 0 uses all hardware threads.
+    */
+    CpuPhotonTracer(SceneData scene, uint threadCount = 0);
+
+    void setLights(std::vector<AnalyticLight> analyticLights, std::vector<EmissiveTriangle> emissiveTriangles);
+
+    /** Traces one photon batch (one GPU dispatch of lightTable.width x lightTable.height).
+    */
+    Result trace(const LightSampleTable& lightTable, const Options& options);
+
+    const TriangleBVH& getBVH() const { return mBVH; }
+    uint getThreadCount() const { return mThreadPool.getThreadCount(); }
+
+private:
+    struct PathState;
+
+    /** Photon of a diffuse hit before it is inserted into its map.
+    */
+    struct PhotonCandidate
+    {
+        float3 pos;
+        int3 cell;
+        float4 flux;                            ///< w = face normal theta
+        float4 dir;                             ///< w = face normal phi
+        float u;                                ///< Picks the slot if the bucket is full
+        bool caustic;
+    };
+
+    void tracePhoton(uint2 launchIndex, uint2 launchDim, const LightSampleTable& lightTable, const Options& options, std::vector<PhotonCandidate>& photons, PathState& state);
+    void storePhoton(const PhotonCandidate& photon, const Options& options, Result& result);
+
+    SceneData                       mScene;
+    TriangleBVH                     mBVH;
+    std::vector<AnalyticLight>      mAnalyticLights;
+    std::vector<EmissiveTriangle>   mEmissiveTriangles;
+    WorkStealingThreadPool          mThreadPool;
+};
@@ -0,0 +1,155 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "CpuPhotonTracerScene.h"
+#include "PhotonStreams.h"
+
+namespace
+{
+    /** Metal/rough parameters of a standard material. Other materials keep the default diffuse tracer material.
+    */
+    CpuPhotonTracer::Material convertMaterial(const Material::SharedPtr& pMaterial)
+    {
+        CpuPhotonTracer::Material material;
+        auto pBasic = std::dynamic_pointer_cast<BasicMaterial>(pMaterial);
+        if (!pBasic) return material;
+
+        float roughness = 1.f;
+        float metallic = 0.f;
+        auto pStandard = std::dynamic_pointer_cast<StandardMaterial>(pMaterial);
+        if (pStandard && pStandard->getShadingModel() == ShadingModel::MetalRough)
+        {
+            roughness = pStandard->getRoughness();
+            metallic = pStandard->getMetallic();
+        }
+        const float3 baseColor = float3(pBasic->getBaseColor());
+        material.diffuse = baseColor * (1.f - metallic);
+        material.specular = glm::mix(float3(0.04f), baseColor, metallic);
+        material.roughness = roughness;
+        material.transmission = pBasic->getTransmissionColor();
+        material.specularTransmission = pBasic->getSpecularTransmission();
+        material.ior = pBasic->getIndexOfRefraction();
+        return material;
+    }
+}
+
+CpuPhotonTracer::SceneData CpuPhotonTracerScene::extractGeometry(RenderContext* pRenderContext, const Scene::SharedPtr& pScene)
+{
+    FALCOR_ASSERT(pScene);
+    CpuPhotonTracer::SceneData data;
+
+    //Materials in scene order, so the material IDs of the instances index them directly
+    for (uint materialID = 0; materialID < pScene->getMaterialCount(); materialID++)
+        data.materials.push_back(convertMaterial(pScene->getMaterial(materialID)));
+
+    const Vao::SharedPtr& pVao = pScene->getMeshVao();
+    if (!pVao) return data;
+    Buffer* pVertexBuffer = pVao->getVertexBuffer(Scene::kStaticDataBufferIndex).get();
+    const std::vector<uint8_t> vertexData = PhotonStreams::readback(pRenderContext, pVertexBuffer, 0, pVertexBuffer->getSize());
+    const PackedStaticVertexData* pVertices = reinterpret_cast<const PackedStaticVertexData*>(vertexData.data());
+    std::vector<uint8_t> indexData;
+    if (Buffer* pIndexBuffer = pVao->getIndexBuffer().get())
+        indexData = PhotonStreams::readback(pRenderContext, pIndexBuffer, 0, pIndexBuffer->getSize());
+
+    const auto& globalMatrices = pScene->getAnimationController()->getGlobalMatrices();
+    for (uint instanceID = 0; instanceID < pScene->getGeometryInstanceCount(); instanceID++)
+    {
+        const GeometryInstanceData& instance = pScene->getGeometryInstance(instanceID);
+        if (instance.getType() != Scene::GeometryType::TriangleMesh) continue;
+        const MeshDesc& mesh = pScene->getMesh(instance.geometryID);
+
+        //Dynamic (skinned) meshes store their vertices in world space
+        const glm::mat4 transform = mesh.isDynamic() ? glm::identity<glm::mat4>() : globalMatrices[instance.globalMatrixID];
+        const glm::mat3 normalTransform = glm::transpose(glm::inverse(glm::mat3(transform)));
+        //The index buffer offset is in 32 bit words, also for 16 bit indices
+        const uint32_t* pIndices32 = reinterpret_cast<const uint32_t*>(indexData.data()) + mesh.ibOffset;
+        const uint16_t* pIndices16 = reinterpret_cast<const uint16_t*>(pIndices32);
+
+        for (uint tri = 0; tri < mesh.getTriangleCount(); tri++)
+        {
+            for (uint k = 0; k < 3; k++)
+            {
+                uint index = 3 * tri + k;
+                if (mesh.indexCount > 0) index = mesh.use16BitIndices() ? pIndices16[index] : pIndices32[index];
+                const StaticVertexData vertex = pVertices[mesh.vbOffset + index].unpack();
+                data.positions.push_back(float3(transform * float4(vertex.position, 1.f)));
+                data.normals.push_back(glm::normalize(normalTransform * vertex.normal));
+            }
+            data.materialIDs.push_back(instance.materialID);
+        }
+    }
+    return data;
+}
+
+CpuPhotonTracerScene::Lights CpuPhotonTracerScene::extractLights(RenderContext* pRenderContext, const Scene::SharedPtr& pScene)
+{
+    FALCOR_ASSERT(pScene);
+    Lights lights;
+
+    //The generate pass treats every analytic light as a point or spot light
+    for (const Light::SharedPtr& pLight : pScene->getActiveLights())
+    {
+        const LightData& data = pLight->getData();
+        CpuPhotonTracer::AnalyticLight light;
+        light.posW = data.posW;
+        light.dirW = data.dirW;
+        light.intensity = data.intensity;
+        light.openingAngle = data.openingAngle;
+        light.penumbraAngle = data.penumbraAngle;
+        lights.analytic.push_back(light);
+    }
+
+    auto lightCollection = pScene->getLightCollection(pRenderContext);
+    for (const auto& tri : lightCollection->getMeshLightTriangles())
+    {
+        if (tri.flux <= 0.f) continue;
+        CpuPhotonTracer::EmissiveTriangle emissive;
+        for (uint k = 0; k < 3; k++) emissive.posW[k] = tri.vtx[k].pos;
+        emissive.normal = tri.normal;
+        emissive.area = tri.area;
+        emissive.radiance = tri.averageRadiance;
+        lights.emissive.push_back(emissive);
+    }
+    return lights;
+}
+
+std::unique_ptr<CpuPhotonTracer> CpuPhotonTracerScene::createTracer(RenderContext* pRenderContext, const Scene::SharedPtr& pScene, uint threadCount)
+{
+    auto pTracer = std::make_unique<CpuPhotonTracer>(extractGeometry(pRenderContext, pScene), threadCount);
+    Lights lights = extractLights(pRenderContext, pScene);
+    pTracer->setLights(std::move(lights.analytic), std::move(lights.emissive));
+    return pTracer;
+}
+
+CpuPhotonTracer::LightSampleTable CpuPhotonTracerScene::getLightSampleTable(const LightSampleTableBuilder::Table& table)
+{
+    CpuPhotonTracer::LightSampleTable lightTable;
+    lightTable.width = table.width;
+    lightTable.height = table.height;
+    lightTable.aliasTable = table.aliasTable;
+    return lightTable;
+}
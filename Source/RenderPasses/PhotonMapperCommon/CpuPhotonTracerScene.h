@@ -0,0 +1,65 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "CpuPhotonTracer.h"
+#include "LightSampleTableBuilder.h"
+#include <memory>
+
+using namespace Falcor;
+
+/** Extracts the input of the CPU photon tracer from a loaded scene, so the tracer runs on the same scene as the hash passes.
+    Kept apart from CpuPhotonTracer, which builds without Falcor.
+    The triangle meshes are read back from the scene vertex and index buffers and transformed to world space. Materials are
+    reduced to the constant parameters of CpuPhotonTracer::Material, textures are ignored. Analytic lights and active
+    emissive triangles are listed in the order the light sample table indexes them.
+*/
+class CpuPhotonTracerScene
+{
+public:
+    struct Lights
+    {
+        std::vector<CpuPhotonTracer::AnalyticLight> analytic;   ///< Active lights of the scene
+        std::vector<CpuPhotonTracer::EmissiveTriangle> emissive;    ///< Emissive triangles with flux, as in LightSampleTableBuilder::createInput
+    };
+
+    /** Reads the triangle meshes of the scene. Blocks until the GPU is done.
+    */
+    static CpuPhotonTracer::SceneData extractGeometry(RenderContext* pRenderContext, const Scene::SharedPtr& pScene);
+
+    static Lights extractLights(RenderContext* pRenderContext, const Scene::SharedPtr& pScene);
+
+    /** Creates a tracer with the geometry and lights of the scene.
+        \param[in] threadCount Number of threads, 0 uses all hardware threads.
+    */
+    static std::unique_ptr<CpuPhotonTracer> createTracer(RenderContext* pRenderContext, const Scene::SharedPtr& pScene, uint threadCount = 0);
+
+    /** Light sample table of a generate dispatch, so the tracer emits from the same table as the pass.
+    */
+    static CpuPhotonTracer::LightSampleTable getLightSampleTable(const LightSampleTableBuilder::Table& table);
+};
@@ -0,0 +1,111 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "CullingBloomFilter.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    uint countBits(uint v)
+    {
+        v = v - ((v >> 1) & 0x55555555u);
+        v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+        return (((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+    }
+}
+
+CullingBloomFilter::CullingBloomFilter(uint bits, uint numHashes, SpatialHashFunction function)
+    : mBits(std::clamp(bits, 5u, 32u))
+    , mNumHashes(std::clamp(numHashes, 1u, kCullingMaxHashes))
+    , mFunction(function)
+{
+    mBitMask = getBitMask(mBits);
+    mWords.assign(size_t(getWordCount(mBits)), 0u);
+}
+
+void CullingBloomFilter::insert(int3 cell)
+{
+    const uint h1 = spatialHash(mFunction, cell);
+    const uint h2 = hashCellKey(cell);
+    for (uint i = 0; i < mNumHashes; i++)
+    {
+        const uint bit = getCullingBit(h1, h2, i, mBitMask);
+        mWords[getCullingWord(bit)] |= getCullingWordMask(bit);
+    }
+}
+
+bool CullingBloomFilter::contains(int3 cell) const
+{
+    const uint h1 = spatialHash(mFunction, cell);
+    const uint h2 = hashCellKey(cell);
+    for (uint i = 0; i < mNumHashes; i++)
+    {
+        const uint bit = getCullingBit(h1, h2, i, mBitMask);
+        if ((mWords[getCullingWord(bit)] & getCullingWordMask(bit)) == 0)
+            return false;
+    }
+    return true;
+}
+
+void CullingBloomFilter::clear()
+{
+    std::fill(mWords.begin(), mWords.end(), 0u);
+}
+
+double CullingBloomFilter::getFillRate() const
+{
+    uint64_t setBits = 0;
+    for (uint word : mWords)
+        setBits += countBits(word);
+    return double(setBits) / double(getBitCount());
+}
+
+uint CullingBloomFilter::getBitMask(uint bits)
+{
+    return uint((uint64_t(1) << bits) - 1);
+}
+
+uint64_t CullingBloomFilter::getWordCount(uint bits)
+{
+    return std::max<uint64_t>((uint64_t(1) << bits) / 32, 1);
+}
+
+double CullingBloomFilter::getExpectedFalsePositiveRate(uint64_t numBits, uint numHashes, uint64_t numCells)
+{
+    if (numBits == 0)
+        return 1.0;
+    return std::pow(1.0 - std::exp(-double(numHashes) * double(numCells) / double(numBits)), double(numHashes));
+}
+
+uint CullingBloomFilter::getOptimalNumHashes(uint64_t numBits, uint64_t numCells)
+{
+    if (numCells == 0)
+        return 1;
+    const double k = std::round(double(numBits) / double(numCells) * std::log(2.0));
+    return uint(std::clamp(k, 1.0, double(kCullingMaxHashes)));
+}
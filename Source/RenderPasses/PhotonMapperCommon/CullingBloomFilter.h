@@ -0,0 +1,83 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "SpatialHash.slang"
+#include "CullingBloomFilter.slang"
+
+using namespace Falcor;
+
+/** CPU version of the culling bit set of PhotonCulling.slang, with the same bit layout and hashes as the GPU buffer.
+    With one hash it is the bit set the culling pass writes by default, with more hashes a Bloom filter.
+*/
+class CullingBloomFilter
+{
+public:
+    /** Creates a filter with 2^bits bits (5 <= bits <= 32). numHashes is clamped to [1, kCullingMaxHashes].
+    */
+    CullingBloomFilter(uint bits, uint numHashes, SpatialHashFunction function);
+
+    void insert(int3 cell);
+    bool contains(int3 cell) const;
+    void clear();
+
+    uint64_t getBitCount() const { return uint64_t(1) << mBits; }
+    uint getNumHashes() const { return mNumHashes; }
+    size_t getSizeBytes() const { return mWords.size() * sizeof(uint); }
+
+    /** Words in the layout of the GPU buffer, bit b is bit (b & 31) of word b >> 5.
+    */
+    const std::vector<uint>& getWords() const { return mWords; }
+
+    /** Fraction of the bits that are set.
+    */
+    double getFillRate() const;
+
+    /** Mask of a bit set with 2^bits bits, the gCullingBitMask of the shaders.
+    */
+    static uint getBitMask(uint bits);
+
+    /** Number of 32 bit words of a bit set with 2^bits bits.
+    */
+    static uint64_t getWordCount(uint bits);
+
+    /** False positive rate of an ideal Bloom filter with numBits bits and numHashes hashes after numCells inserts.
+    */
+    static double getExpectedFalsePositiveRate(uint64_t numBits, uint numHashes, uint64_t numCells);
+
+    /** Number of hashes with the lowest false positive rate, round(m / n * ln 2), clamped to [1, kCullingMaxHashes].
+    */
+    static uint getOptimalNumHashes(uint64_t numBits, uint64_t numCells);
+
+private:
+    uint mBits = 0;
+    uint mBitMask = 0;
+    uint mNumHashes = 1;
+    SpatialHashFunction mFunction = SpatialHashFunction::Wang;
+    std::vector<uint> mWords;
+};
@@ -0,0 +1,130 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "HashGridLevels.h"
+#include "GatherCells.slang"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+    const uint kMaxLevels = 16;
+
+    //Level in the top 4 bits, 20 bits per axis. Cells that wrap around share a key, the radius test filters their photons
+    uint64_t getCellKey(uint level, int3 cell)
+    {
+        const uint64_t mask = (1u << 20) - 1;
+        return (uint64_t(level) << 60) | ((uint64_t(uint32_t(cell.x)) & mask) << 40) | ((uint64_t(uint32_t(cell.y)) & mask) << 20) | (uint64_t(uint32_t(cell.z)) & mask);
+    }
+}
+
+HashGridLevels::Levels HashGridLevels::create(float startRadius, uint numLevels, float cellSizeInRadii)
+{
+    Levels levels;
+    levels.cellSizeInRadii = cellSizeInRadii;
+    levels.numLevels = std::clamp(numLevels, 1u, kMaxLevels);
+    levels.baseCellSize = std::exp2(std::ceil(std::log2(cellSizeInRadii * startRadius)));
+    return levels;
+}
+
+uint HashGridLevels::getLevel(const Levels& levels, float radius)
+{
+    const float minCellSize = levels.cellSizeInRadii * radius;
+    if (!(minCellSize > 0.f) || minCellSize >= levels.baseCellSize) return 0;
+    const int level = static_cast<int>(std::floor(std::log2(levels.baseCellSize / minCellSize)));
+    //log2 may round up right below a power of two
+    uint l = static_cast<uint>(std::clamp(level, 0, int(levels.numLevels) - 1));
+    while (l > 0 && getCellSize(levels, l) < minCellSize) l--;
+    return l;
+}
+
+float HashGridLevels::getCellSize(const Levels& levels, uint level)
+{
+    return std::ldexp(levels.baseCellSize, -int(level));
+}
+
+void HashGridLevels::Grid::build(const Levels& levels, const std::vector<float3>& positions, const std::vector<uint>& photonLevels)
+{
+    FALCOR_ASSERT(photonLevels.empty() || photonLevels.size() == positions.size());
+    mLevels = levels;
+    mUsedLevels = 0;
+    mRanges.clear();
+
+    const size_t count = positions.size();
+    std::vector<uint64_t> keys(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint level = photonLevels.empty() ? 0 : std::min(photonLevels[i], levels.numLevels - 1);
+        keys[i] = getCellKey(level, int3(glm::floor(positions[i] * getCellScale(levels, level))));
+        mUsedLevels |= 1u << level;
+    }
+
+    //Sort photons by level and cell so each cell becomes a contiguous range
+    mIndices.resize(count);
+    std::iota(mIndices.begin(), mIndices.end(), 0u);
+    std::sort(mIndices.begin(), mIndices.end(), [&](uint a, uint b) { return keys[a] < keys[b] || (keys[a] == keys[b] && a < b); });
+    mPositions.resize(count);
+    for (size_t i = 0; i < count; i++) mPositions[i] = positions[mIndices[i]];
+
+    size_t first = 0;
+    while (first < count)
+    {
+        const uint64_t key = keys[mIndices[first]];
+        size_t last = first + 1;
+        while (last < count && keys[mIndices[last]] == key) last++;
+        mRanges[key] = uint2(static_cast<uint>(first), static_cast<uint>(last - first));
+        first = last;
+    }
+}
+
+uint HashGridLevels::Grid::query(const float3& pos, float radius, std::vector<uint>& photons, uint64_t* pTested) const
+{
+    uint visited = 0;
+    for (uint level = 0; level < mLevels.numLevels; level++)
+    {
+        if ((mUsedLevels & (1u << level)) == 0) continue;
+        const GatherCells cells = getGatherCells(pos, radius, getCellScale(mLevels, level));
+        for (int z = cells.first.z; z <= cells.last.z; z++)
+            for (int y = cells.first.y; y <= cells.last.y; y++)
+                for (int x = cells.first.x; x <= cells.last.x; x++)
+                {
+                    if (!gatherSphereOverlapsCell(cells, int3(x, y, z))) continue;
+                    visited++;
+                    auto it = mRanges.find(getCellKey(level, int3(x, y, z)));
+                    if (it == mRanges.end()) continue;
+                    const uint2 range = it->second;
+                    if (pTested) *pTested += range.y;
+                    for (uint i = range.x; i < range.x + range.y; i++)
+                    {
+                        const float3 d = mPositions[i] - pos;
+                        if (glm::dot(d, d) < radius * radius) photons.push_back(mIndices[i]);
+                    }
+                }
+    }
+    return visited;
+}
@@ -0,0 +1,93 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include <unordered_map>
+
+using namespace Falcor;
+
+/** Power of two cell sizes for the hash grid that do not follow every step of the progressive radius.
+    Level 0 has the cell size of the start radius (times the cell size in radii) rounded up to a power of two, every
+    further level halves it. Photons are inserted at the finest level whose cells are at least cellSizeInRadii * radius,
+    so the cells only change when the radius crosses a power of two instead of in every SPPM iteration. Cells of a level
+    are nested in the cells of the coarser levels, and the scales are powers of two, so floor(pos * scale) is exact.
+    Below the finest level the cells stop shrinking, the gather then visits at most 2x2x2 cells and tests more photons.
+*/
+class HashGridLevels
+{
+public:
+    struct Levels
+    {
+        float baseCellSize = 1.f;               ///< Cell size of level 0
+        uint numLevels = 1;
+        float cellSizeInRadii = 1.f;            ///< Minimum cell size relative to the radius
+    };
+
+    /** Levels for a progressive run that starts at startRadius.
+    */
+    static Levels create(float startRadius, uint numLevels, float cellSizeInRadii = 1.f);
+
+    /** Finest level with a cell size of at least cellSizeInRadii * radius, clamped to the existing levels.
+    */
+    static uint getLevel(const Levels& levels, float radius);
+
+    static float getCellSize(const Levels& levels, uint level);
+
+    /** Scale from world position to the cells of a level, 1 / cell size.
+    */
+    static float getCellScale(const Levels& levels, uint level) { return 1.f / getCellSize(levels, level); }
+
+    /** CPU build and query of a multi level grid. Every photon is in exactly one level.
+        A query visits the cells that overlap its sphere (GatherCells.slang) on every level that holds photons, so its cost
+        is bounded as long as the photons were inserted at the level of the query radius.
+    */
+    class Grid
+    {
+    public:
+        /** \param[in] photonLevels Level of every photon, all photons are at level 0 if empty.
+        */
+        void build(const Levels& levels, const std::vector<float3>& positions, const std::vector<uint>& photonLevels = {});
+
+        /** Appends the indices of the photons closer than radius to pos.
+            \param[out] pTested Optional, adds the number of photons in the visited cells.
+            \return Number of cells that were looked up.
+        */
+        uint query(const float3& pos, float radius, std::vector<uint>& photons, uint64_t* pTested = nullptr) const;
+
+        /** Number of cells that hold photons, over all levels.
+        */
+        size_t getCellCount() const { return mRanges.size(); }
+
+    private:
+        Levels mLevels;
+        std::vector<float3> mPositions;         ///< Sorted by level and cell
+        std::vector<uint> mIndices;             ///< Original photon index of every sorted photon
+        std::unordered_map<uint64_t, uint2> mRanges;    ///< Level and cell key to (first photon, count)
+        uint mUsedLevels = 0;                   ///< Bit mask of the levels that hold photons
+    };
+};
@@ -0,0 +1,223 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "HashTableStats.h"
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+    struct CellKeyHash
+    {
+        size_t operator()(const int3& c) const { return hashWang(c); }
+    };
+
+    struct CellKeyEqual
+    {
+        bool operator()(const int3& a, const int3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+    };
+
+    //Bucket key of the hash passes, 0 marks an empty bucket
+    uint getBucketKey(int3 cell)
+    {
+        return hashCellKey(cell);
+    }
+
+    //Mean and last used bin of a probe length histogram
+    void summarizeHistogram(const HashTableStats::Counters& counters, uint firstBin, double& mean, uint* pMax)
+    {
+        uint64_t count = 0, sum = 0;
+        for (uint i = 0; i < kHashStatsProbeBins; i++)
+        {
+            const uint64_t n = counters[firstBin + i];
+            count += n;
+            sum += n * i;
+            if (n > 0 && pMax) *pMax = i;
+        }
+        mean = count > 0 ? double(sum) / count : 0.0;
+    }
+}
+
+HashTableStats::Report HashTableStats::createReport(const std::string& source, const Counters& counters, const Settings& settings)
+{
+    Report r;
+    r.source = source;
+    r.settings = settings;
+    r.inserts = counters[kHashStatsGenerateInserts];
+    r.probeFailures = counters[kHashStatsGenerateProbeFailures];
+    r.overflows = counters[kHashStatsGenerateOverflows];
+    const double numBuckets = double(1ull << settings.bucketBits);
+    r.causticLoadFactor = counters[kHashStatsCausticBuckets] / numBuckets;
+    r.globalLoadFactor = counters[kHashStatsGlobalBuckets] / numBuckets;
+    r.dropRate = r.inserts > 0 ? double(r.probeFailures + r.overflows) / r.inserts : 0.0;
+    summarizeHistogram(counters, kHashStatsGenerateHistogram, r.avgInsertProbe, &r.maxInsertProbe);
+
+    r.lookups = counters[kHashStatsCollectLookups];
+    if (r.lookups > 0)
+    {
+        r.hitRate = double(counters[kHashStatsCollectHits]) / r.lookups;
+        r.probeLimitRate = double(counters[kHashStatsCollectProbeLimit]) / r.lookups;
+    }
+    summarizeHistogram(counters, kHashStatsCollectHistogram, r.avgLookupProbe, nullptr);
+
+    r.collectPhotons = counters[kHashStatsCollectPhotons];
+    if (r.collectPhotons > 0)
+    {
+        r.cellRejectRate = double(counters[kHashStatsCollectCellRejects]) / r.collectPhotons;
+        r.radiusRejectRate = double(counters[kHashStatsCollectRadiusRejects]) / r.collectPhotons;
+    }
+    return r;
+}
+
+void HashTableStats::BucketTable::init(const Settings& settings)
+{
+    const size_t numBuckets = size_t(1) << settings.bucketBits;
+    cell.assign(numBuckets, 0);
+    size.assign(numBuckets, 0);
+    photonIdx.assign(numBuckets * settings.photonsPerBucket, 0);
+}
+
+uint HashTableStats::insert(BucketTable& table, const Settings& settings, int3 cell, float u, bool caustic, Counters& counters, uint& bucket)
+{
+    const uint mask = (1u << settings.bucketBits) - 1;
+    const uint key = getBucketKey(cell);
+    uint b = spatialHash(settings.function, cell) & mask;
+    uint d = 0;
+    bool success = false;
+    bool claimed = false;
+    for (uint i = 0; i <= settings.quadraticProbeIterations; i++)
+    {
+        if (table.cell[b] == 0)
+        {
+            table.cell[b] = key;
+            claimed = true;
+        }
+        if (table.cell[b] == key)
+        {
+            success = true;
+            break;
+        }
+        ++d;
+        b = (b + ((d + d * d) >> 1)) & mask;
+    }
+
+    counters[kHashStatsGenerateInserts]++;
+    if (!success)
+    {
+        counters[kHashStatsGenerateProbeFailures]++;
+        return kNotStored;
+    }
+    counters[kHashStatsGenerateHistogram + getHashStatsProbeBin(d)]++;
+    if (claimed) counters[caustic ? kHashStatsCausticBuckets : kHashStatsGlobalBuckets]++;
+
+    //A full bucket keeps its photons, the photon replaces a random one or is dropped
+    uint slot = table.size[b]++;
+    if (slot >= settings.photonsPerBucket)
+    {
+        counters[kHashStatsGenerateOverflows]++;
+        slot = std::min(static_cast<uint>(u * slot + 1.f), slot);
+    }
+    bucket = b;
+    return slot < settings.photonsPerBucket ? slot : kNotStored;
+}
+
+HashTableStats::Report HashTableStats::simulate(const std::vector<float3>& positions, float cellScale, const Settings& settings, uint maxLookups)
+{
+    const uint mask = (1u << settings.bucketBits) - 1;
+    BucketTable table;
+    table.init(settings);
+    Counters counters = {};
+
+    std::unordered_set<int3, CellKeyHash, CellKeyEqual> cells;
+    std::unordered_set<uint> keys;
+
+    //Generate: claim or find the bucket of the cell, probing up to quadraticProbeIterations times.
+    //The counters do not depend on the slot a full bucket replaces
+    for (const float3& p : positions)
+    {
+        const int3 cell = int3(floor(p * cellScale));
+        if (cells.insert(cell).second) keys.insert(getBucketKey(cell));
+        uint bucket;
+        insert(table, settings, cell, 0.f, false, counters, bucket);
+    }
+
+    //Collect: the cells around every stride-th photon, the gather radius is one cell
+    const size_t stride = std::max<size_t>(1, (positions.size() + maxLookups - 1) / std::max(maxLookups, 1u));
+    for (size_t q = 0; q < positions.size() && maxLookups > 0; q += stride)
+    {
+        const int3 center = int3(floor(positions[q] * cellScale));
+        for (int z = center.z - 1; z <= center.z + 1; z++)
+            for (int y = center.y - 1; y <= center.y + 1; y++)
+                for (int x = center.x - 1; x <= center.x + 1; x++)
+                {
+                    const int3 cell = int3(x, y, z);
+                    const uint key = getBucketKey(cell);
+                    uint b = spatialHash(settings.function, cell) & mask;
+                    uint d = 0;
+                    uint size = 0;
+                    bool hit = false;
+                    for (uint i = 0; i < settings.quadraticProbeIterations; i++)
+                    {
+                        size = table.size[b];
+                        if (size == 0) break;
+                        if (table.cell[b] == key)
+                        {
+                            hit = true;
+                            break;
+                        }
+                        ++d;
+                        b = (b + ((d + d * d) >> 1)) & mask;
+                    }
+
+                    counters[kHashStatsCollectLookups]++;
+                    if (hit) counters[kHashStatsCollectHits]++;
+                    if (!hit && size != 0) counters[kHashStatsCollectProbeLimit]++;
+                    else counters[kHashStatsCollectHistogram + getHashStatsProbeBin(d)]++;
+                }
+    }
+
+    Report r = createReport("Simulated", counters, settings);
+    r.distinctCells = cells.size();
+    r.aliasedCells = cells.size() - keys.size();
+    return r;
+}
+
+void HashTableStats::accumulate(std::array<uint64_t, kHashStatsCount>& totals, const Counters& counters)
+{
+    for (uint i = 0; i < kHashStatsCount; i++)
+        totals[i] += counters[i];
+}
+
+std::string HashTableStats::histogramToString(const std::array<uint64_t, kHashStatsCount>& totals, uint firstBin)
+{
+    std::ostringstream ss;
+    for (uint i = 0; i < kHashStatsProbeBins; i++)
+        ss << (i ? ";" : "") << totals[firstBin + i];
+    return ss.str();
+}
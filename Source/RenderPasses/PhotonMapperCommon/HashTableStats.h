@@ -0,0 +1,123 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "CpuMath.h"
+#include "SpatialHash.slang"
+#include "HashTableStats.slang"
+#include <array>
+#include <string>
+#include <vector>
+
+using namespace Falcor;
+
+/** Health of the bucket hash table of the hash passes.
+    The GPU counters (HashTableStats.slang) count the probes, probe failures and bucket overflows of the generate pass
+    and the lookups of the collect pass. simulate() replays photon positions through the same quadratic probe insert
+    and lookup on the CPU, so load factor and dropped photons can be predicted for other bucket settings before they
+    are changed. Both end up in a Report. insert() is the same insert for a single photon, the CPU photon tracer stores its photons with it.
+*/
+class HashTableStats
+{
+public:
+    using Counters = std::array<uint, kHashStatsCount>;
+
+    /** Bucket settings of the hash passes.
+    */
+    struct Settings
+    {
+        uint bucketBits = 20;                   ///< mNumBucketBits
+        uint photonsPerBucket = 12;             ///< NUM_PHOTONS_PER_BUCKET
+        uint quadraticProbeIterations = 10;     ///< mQuadraticProbeIterations
+        SpatialHashFunction function = SpatialHashFunction::Wang;
+    };
+
+    /** CPU copy of the buckets of the hash passes (PhotonBucket in PhotonMapperHashGenerate.rt.slang).
+    */
+    struct BucketTable
+    {
+        std::vector<uint> cell;                 ///< Key of the cell (hashCellKey), 0 for a free bucket
+        std::vector<uint> size;                 ///< Photons that reached the bucket, including the replaced and dropped ones
+        std::vector<uint> photonIdx;            ///< photonsPerBucket photon indices per bucket
+
+        /** Allocates empty buckets for the settings.
+        */
+        void init(const Settings& settings);
+    };
+
+    static const uint kNotStored = ~0u;
+
+    struct Report
+    {
+        std::string source;                     ///< GPU or Simulated
+        Settings settings;
+        uint64_t inserts = 0;
+        uint64_t probeFailures = 0;
+        uint64_t overflows = 0;
+        double causticLoadFactor = 0.0;         ///< Claimed buckets / buckets of the caustic map. 0 for simulations
+        double globalLoadFactor = 0.0;          ///< Claimed buckets / buckets of the global map
+        double dropRate = 0.0;                  ///< (probe failures + overflows) / inserts, photons lost per inserted photon
+        double avgInsertProbe = 0.0;            ///< Mean probe length of the successful inserts
+        uint maxInsertProbe = 0;                ///< Longest probe of the successful inserts, kHashStatsProbeBins - 1 means at least that
+        uint64_t lookups = 0;
+        double hitRate = 0.0;                   ///< Lookups that found the bucket of their cell
+        double probeLimitRate = 0.0;            ///< Lookups that ran out of probes
+        double avgLookupProbe = 0.0;            ///< Mean probe length of the lookups that stopped on a bucket
+        uint64_t collectPhotons = 0;            ///< GPU only: photons loaded by the collect pass
+        double cellRejectRate = 0.0;            ///< GPU only: loaded photons of another cell (tag collision, compact or grid slot)
+        double radiusRejectRate = 0.0;          ///< GPU only: loaded photons outside of the gather radius
+        uint64_t distinctCells = 0;             ///< Simulated only: distinct cells of the photons
+        uint64_t aliasedCells = 0;              ///< Simulated only: cells that share their bucket key with another cell
+    };
+
+    /** Summarizes the counters of the global (and caustic) map.
+    */
+    static Report createReport(const std::string& source, const Counters& counters, const Settings& settings);
+
+    /** Inserts a photon like the generate pass. The bucket of the cell is found or claimed with the quadratic probe.
+        A photon that reaches a full bucket replaces a stored one with the same reservoir step as the GPU, u picks the slot.
+        Adds the insert to the generate counters; caustic selects the bucket counter.
+        \param[out] bucket Bucket of the cell. Only valid if the photon is stored.
+        \return Slot in the bucket the photon index goes to, or kNotStored if the photon is dropped.
+    */
+    static uint insert(BucketTable& table, const Settings& settings, int3 cell, float u, bool caustic, Counters& counters, uint& bucket);
+
+    /** Inserts the photons in order into an empty global map with the probe of the generate pass and looks up the 27 cells
+        around up to maxLookups of the photons with the probe of the collect pass. The GPU inserts the photons concurrently
+        and in another order, so its counters differ slightly.
+        \param[in] cellScale Scale from world position to cell (1 / radius).
+    */
+    static Report simulate(const std::vector<float3>& positions, float cellScale, const Settings& settings, uint maxLookups = 1 << 16);
+
+    /** Adds counters to 64 bit totals, e.g. to sum the counters over the recorded iterations.
+    */
+    static void accumulate(std::array<uint64_t, kHashStatsCount>& totals, const Counters& counters);
+
+    /** Histogram bins separated by ';', starting at the first bin index (kHashStatsGenerateHistogram or kHashStatsCollectHistogram).
+    */
+    static std::string histogramToString(const std::array<uint64_t, kHashStatsCount>& totals, uint firstBin);
+};
@@ -0,0 +1,360 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "ImageMetrics.h"
+#include "SimdUtils.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+    const uint32_t kNumPlanes = 5;              //x, y, x^2, y^2, xy
+
+    struct SsimConstants
+    {
+        float c1;
+        float c2;
+    };
+
+    SsimConstants getSsimConstants(float maxValue)
+    {
+        //Constants of the original SSIM paper (K1 = 0.01, K2 = 0.03)
+        return { (0.01f * maxValue) * (0.01f * maxValue), (0.03f * maxValue) * (0.03f * maxValue) };
+    }
+
+    std::vector<float> gaussianWeights(uint32_t radius, float sigma)
+    {
+        std::vector<float> weights(2 * radius + 1);
+        float sum = 0.f;
+        for (uint32_t i = 0; i < weights.size(); i++)
+        {
+            float d = static_cast<float>(i) - static_cast<float>(radius);
+            weights[i] = std::exp(-d * d / (2.f * sigma * sigma));
+            sum += weights[i];
+        }
+        for (float& w : weights) w /= sum;
+        return weights;
+    }
+
+    size_t getRowGrain(uint32_t width)
+    {
+        return std::max<size_t>(1, (1 << 14) / std::max(width, 1u));
+    }
+
+    float ssimValue(float muX, float muY, float xx, float yy, float xy, const SsimConstants& c)
+    {
+        const float varX = xx - muX * muX;
+        const float varY = yy - muY * muY;
+        const float covXY = xy - muX * muY;
+        return ((2.f * muX * muY + c.c1) * (2.f * covXY + c.c2)) / ((muX * muX + muY * muY + c.c1) * (varX + varY + c.c2));
+    }
+
+    void squaredErrorRow(const float* x, const float* y, uint32_t begin, uint32_t end, float epsilon, double& se, double& rel)
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const float d2 = (x[i] - y[i]) * (x[i] - y[i]);
+            se += d2;
+            rel += d2 / (y[i] * y[i] + epsilon);
+        }
+    }
+
+    PM_TARGET_AVX2 float horizontalSum(__m256 v)
+    {
+        __m128 lo = _mm256_castps256_ps128(v);
+        __m128 hi = _mm256_extractf128_ps(v, 1);
+        lo = _mm_add_ps(lo, hi);
+        lo = _mm_hadd_ps(lo, lo);
+        lo = _mm_hadd_ps(lo, lo);
+        return _mm_cvtss_f32(lo);
+    }
+
+    PM_TARGET_AVX2 void squaredErrorRowAVX2(const float* x, const float* y, uint32_t count, float epsilon, double& se, double& rel)
+    {
+        const __m256 eps = _mm256_set1_ps(epsilon);
+        __m256 sumSe = _mm256_setzero_ps();
+        __m256 sumRel = _mm256_setzero_ps();
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 b = _mm256_loadu_ps(y + i);
+            const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i), b);
+            const __m256 d2 = _mm256_mul_ps(d, d);
+            sumSe = _mm256_add_ps(sumSe, d2);
+            sumRel = _mm256_add_ps(sumRel, _mm256_div_ps(d2, _mm256_fmadd_ps(b, b, eps)));
+        }
+        se += horizontalSum(sumSe);
+        rel += horizontalSum(sumRel);
+        squaredErrorRow(x, y, i, count, epsilon, se, rel);
+    }
+
+    /** Horizontal blur of x, y, x^2, y^2 and xy. padX/padY are edge padded by the window radius.
+    */
+    void blurRow(const float* padX, const float* padY, const std::vector<float>& weights, uint32_t begin, uint32_t end, float* const* out)
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            float s[kNumPlanes] = {};
+            for (size_t k = 0; k < weights.size(); k++)
+            {
+                const float a = padX[i + k], b = padY[i + k], w = weights[k];
+                s[0] += w * a; s[1] += w * b; s[2] += w * a * a; s[3] += w * b * b; s[4] += w * a * b;
+            }
+            for (uint32_t p = 0; p < kNumPlanes; p++) out[p][i] = s[p];
+        }
+    }
+
+    PM_TARGET_AVX2 void blurRowAVX2(const float* padX, const float* padY, const std::vector<float>& weights, uint32_t count, float* const* out)
+    {
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps(), s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps(), s4 = _mm256_setzero_ps();
+            for (size_t k = 0; k < weights.size(); k++)
+            {
+                const __m256 w = _mm256_set1_ps(weights[k]);
+                const __m256 a = _mm256_loadu_ps(padX + i + k);
+                const __m256 b = _mm256_loadu_ps(padY + i + k);
+                const __m256 wa = _mm256_mul_ps(w, a);
+                const __m256 wb = _mm256_mul_ps(w, b);
+                s0 = _mm256_add_ps(s0, wa);
+                s1 = _mm256_add_ps(s1, wb);
+                s2 = _mm256_fmadd_ps(wa, a, s2);
+                s3 = _mm256_fmadd_ps(wb, b, s3);
+                s4 = _mm256_fmadd_ps(wa, b, s4);
+            }
+            _mm256_storeu_ps(out[0] + i, s0);
+            _mm256_storeu_ps(out[1] + i, s1);
+            _mm256_storeu_ps(out[2] + i, s2);
+            _mm256_storeu_ps(out[3] + i, s3);
+            _mm256_storeu_ps(out[4] + i, s4);
+        }
+        blurRow(padX, padY, weights, i, count, out);
+    }
+
+    /** Vertical blur of the horizontally blurred planes followed by the SSIM of every pixel in the row. Returns the sum.
+        rows[k][p] points to the row of plane p for window tap k.
+    */
+    double ssimRow(const std::vector<const float*>& rows, const std::vector<float>& weights, uint32_t begin, uint32_t end, const SsimConstants& c)
+    {
+        double sum = 0.0;
+        for (uint32_t i = begin; i < end; i++)
+        {
+            float s[kNumPlanes] = {};
+            for (size_t k = 0; k < weights.size(); k++)
+                for (uint32_t p = 0; p < kNumPlanes; p++)
+                    s[p] += weights[k] * rows[k * kNumPlanes + p][i];
+            sum += ssimValue(s[0], s[1], s[2], s[3], s[4], c);
+        }
+        return sum;
+    }
+
+    PM_TARGET_AVX2 double ssimRowAVX2(const std::vector<const float*>& rows, const std::vector<float>& weights, uint32_t count, const SsimConstants& c)
+    {
+        const __m256 c1 = _mm256_set1_ps(c.c1);
+        const __m256 c2 = _mm256_set1_ps(c.c2);
+        const __m256 two = _mm256_set1_ps(2.f);
+        __m256 sum = _mm256_setzero_ps();
+        uint32_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 s[kNumPlanes];
+            for (uint32_t p = 0; p < kNumPlanes; p++) s[p] = _mm256_setzero_ps();
+            for (size_t k = 0; k < weights.size(); k++)
+            {
+                const __m256 w = _mm256_set1_ps(weights[k]);
+                for (uint32_t p = 0; p < kNumPlanes; p++)
+                    s[p] = _mm256_fmadd_ps(w, _mm256_loadu_ps(rows[k * kNumPlanes + p] + i), s[p]);
+            }
+            const __m256 muXY = _mm256_mul_ps(s[0], s[1]);
+            const __m256 muXX = _mm256_mul_ps(s[0], s[0]);
+            const __m256 muYY = _mm256_mul_ps(s[1], s[1]);
+            const __m256 varSum = _mm256_sub_ps(_mm256_add_ps(s[2], s[3]), _mm256_add_ps(muXX, muYY));
+            const __m256 cov = _mm256_sub_ps(s[4], muXY);
+            const __m256 num = _mm256_mul_ps(_mm256_fmadd_ps(two, muXY, c1), _mm256_fmadd_ps(two, cov, c2));
+            const __m256 den = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(muXX, muYY), c1), _mm256_add_ps(varSum, c2));
+            sum = _mm256_add_ps(sum, _mm256_div_ps(num, den));
+        }
+        return horizontalSum(sum) + ssimRow(rows, weights, i, count, c);
+    }
+}
+
+ImageMetrics::ImageMetrics(uint32_t threadCount)
+    : mThreadPool(threadCount)
+{
+    mRowScratch.resize(mThreadPool.getThreadCount());
+}
+
+uint64_t ImageMetrics::splitChannels(const ImageView& view, Planes& planes)
+{
+    planes.width = view.width;
+    planes.height = view.height;
+    const size_t pixelCount = size_t(view.width) * view.height;
+    for (auto& c : planes.channels) c.resize(pixelCount);
+
+    const size_t rowPitch = view.rowPitch != 0 ? view.rowPitch : size_t(view.width) * view.channelCount;
+    std::vector<uint64_t> nonFinite(mThreadPool.getThreadCount(), 0);
+    mThreadPool.parallelFor(view.height, getRowGrain(view.width), [&](size_t begin, size_t end, uint32_t threadIndex) {
+        for (size_t y = begin; y < end; y++)
+        {
+            const float* src = view.data + y * rowPitch;
+            const size_t rowOffset = y * view.width;
+            for (uint32_t x = 0; x < view.width; x++)
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                    float v = src[size_t(x) * view.channelCount + c];
+                    if (!std::isfinite(v))
+                    {
+                        v = 0.f;
+                        nonFinite[threadIndex]++;
+                    }
+                    planes.channels[c][rowOffset + x] = v;
+                }
+        }
+    });
+
+    uint64_t count = 0;
+    for (uint64_t n : nonFinite) count += n;
+    return count;
+}
+
+ImageMetrics::Result ImageMetrics::compute(const ImageView& image, const ImageView& reference, const Options& options)
+{
+    Result result;
+    if (!image.data || !reference.data || image.width == 0 || image.height == 0) return result;
+    if (image.width != reference.width || image.height != reference.height) return result;
+    if (image.channelCount < 3 || reference.channelCount < 3) return result;
+
+    auto start = std::chrono::steady_clock::now();
+    const bool useAVX2 = options.useAVX2 && PhotonMapperSimd::hasAVX2();
+
+    result.nonFiniteCount = splitChannels(image, mImage);
+    splitChannels(reference, mReference);
+
+    computeMse(options, useAVX2, result);
+
+    if (options.computeSsim)
+    {
+        double ssim = 0.0;
+        for (uint32_t c = 0; c < 3; c++)
+            ssim += computeSsim(c, options, useAVX2);
+        result.ssim = ssim / 3.0;
+    }
+
+    result.valid = true;
+    result.timeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+void ImageMetrics::computeMse(const Options& options, bool useAVX2, Result& result)
+{
+    const uint32_t width = mImage.width;
+    std::vector<double> se(mThreadPool.getThreadCount(), 0.0);
+    std::vector<double> rel(mThreadPool.getThreadCount(), 0.0);
+
+    mThreadPool.parallelFor(mImage.height, getRowGrain(width), [&](size_t begin, size_t end, uint32_t threadIndex) {
+        for (size_t y = begin; y < end; y++)
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                //Accumulate every row separately, so the float partial sums stay short
+                double rowSe = 0.0, rowRel = 0.0;
+                const float* x = mImage.channels[c].data() + y * width;
+                const float* r = mReference.channels[c].data() + y * width;
+                if (useAVX2) squaredErrorRowAVX2(x, r, width, options.relMseEpsilon, rowSe, rowRel);
+                else squaredErrorRow(x, r, 0, width, options.relMseEpsilon, rowSe, rowRel);
+                se[threadIndex] += rowSe;
+                rel[threadIndex] += rowRel;
+            }
+    });
+
+    const double count = 3.0 * double(width) * double(mImage.height);
+    for (size_t i = 0; i < se.size(); i++)
+    {
+        result.mse += se[i];
+        result.relMse += rel[i];
+    }
+    result.mse /= count;
+    result.relMse /= count;
+}
+
+double ImageMetrics::computeSsim(uint32_t channel, const Options& options, bool useAVX2)
+{
+    const uint32_t width = mImage.width;
+    const uint32_t height = mImage.height;
+    const uint32_t radius = options.ssimRadius;
+    const std::vector<float> weights = gaussianWeights(radius, std::max(options.ssimSigma, 1e-3f));
+    const SsimConstants constants = getSsimConstants(options.ssimMaxValue);
+    const float maxValue = options.ssimMaxValue;
+    for (auto& plane : mBlurred) plane.resize(size_t(width) * height);
+
+    //Horizontal pass on the clamped values
+    mThreadPool.parallelFor(height, getRowGrain(width), [&](size_t begin, size_t end, uint32_t threadIndex) {
+        std::vector<float>& scratch = mRowScratch[threadIndex];
+        const size_t padWidth = size_t(width) + 2 * radius;
+        scratch.resize(2 * padWidth);
+        float* padX = scratch.data();
+        float* padY = scratch.data() + padWidth;
+
+        for (size_t y = begin; y < end; y++)
+        {
+            const float* x = mImage.channels[channel].data() + y * width;
+            const float* r = mReference.channels[channel].data() + y * width;
+            for (size_t i = 0; i < padWidth; i++)
+            {
+                const size_t src = std::min<size_t>(size_t(std::max<int64_t>(int64_t(i) - radius, 0)), width - 1);
+                padX[i] = std::clamp(x[src], 0.f, maxValue);
+                padY[i] = std::clamp(r[src], 0.f, maxValue);
+            }
+            float* out[kNumPlanes];
+            for (uint32_t p = 0; p < kNumPlanes; p++) out[p] = mBlurred[p].data() + y * width;
+            if (useAVX2) blurRowAVX2(padX, padY, weights, width, out);
+            else blurRow(padX, padY, weights, 0, width, out);
+        }
+    });
+
+    //Vertical pass and SSIM
+    std::vector<double> sums(mThreadPool.getThreadCount(), 0.0);
+    mThreadPool.parallelFor(height, getRowGrain(width), [&](size_t begin, size_t end, uint32_t threadIndex) {
+        std::vector<const float*> rows(weights.size() * kNumPlanes);
+        for (size_t y = begin; y < end; y++)
+        {
+            for (size_t k = 0; k < weights.size(); k++)
+            {
+                const int64_t srcRow = std::clamp<int64_t>(int64_t(y) + int64_t(k) - radius, 0, int64_t(height) - 1);
+                for (uint32_t p = 0; p < kNumPlanes; p++)
+                    rows[k * kNumPlanes + p] = mBlurred[p].data() + size_t(srcRow) * width;
+            }
+            sums[threadIndex] += useAVX2 ? ssimRowAVX2(rows, weights, width, constants) : ssimRow(rows, weights, 0, width, constants);
+        }
+    });
+
+    double sum = 0.0;
+    for (double s : sums) sum += s;
+    return sum / (double(width) * double(height));
+}
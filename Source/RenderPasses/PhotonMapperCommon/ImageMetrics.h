@@ -0,0 +1,96 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "WorkStealingThreadPool.h"
+#include <cstdint>
+#include <vector>
+
+/** Error metrics of an image against a reference: MSE, relMSE and SSIM.
+    Works on float RGB(A) buffers and has no device dependency, so saved frames can also be compared offline.
+    The images are split into channel planes first; all kernels run row parallel on the thread pool and use AVX2 if available.
+*/
+class ImageMetrics
+{
+public:
+    /** Interleaved float image. Alpha of RGBA images is ignored.
+    */
+    struct ImageView
+    {
+        const float* data = nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t channelCount = 3;              ///< 3 (RGB) or 4 (RGBA)
+        size_t rowPitch = 0;                    ///< In floats. 0 for tightly packed rows
+    };
+
+    struct Options
+    {
+        float relMseEpsilon = 0.01f;            ///< relMSE = (x - y)^2 / (y^2 + epsilon)
+        bool computeSsim = true;
+        uint32_t ssimRadius = 5;                ///< Gaussian window of (2 * radius + 1)^2 pixels
+        float ssimSigma = 1.5f;
+        float ssimMaxValue = 1.f;               ///< SSIM is computed on values clamped to [0, ssimMaxValue] as it needs a bounded range
+        bool useAVX2 = true;                    ///< Uses the scalar path if false or if the CPU has no AVX2
+    };
+
+    struct Result
+    {
+        bool valid = false;                     ///< False if the image sizes differ or an image is empty
+        double mse = 0.0;                       ///< Mean over all pixels and RGB channels
+        double relMse = 0.0;
+        double ssim = 0.0;                      ///< Mean SSIM of the RGB channels
+        uint64_t nonFiniteCount = 0;            ///< NaN/Inf values in the image. They are treated as 0
+        double timeMs = 0.0;
+    };
+
+    explicit ImageMetrics(uint32_t threadCount = 0);
+
+    /** Compares image against reference. Both need the same size.
+    */
+    Result compute(const ImageView& image, const ImageView& reference, const Options& options);
+
+private:
+    /** Image split into RGB planes of width * height floats.
+    */
+    struct Planes
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<float> channels[3];
+    };
+
+    uint64_t splitChannels(const ImageView& view, Planes& planes);
+    void computeMse(const Options& options, bool useAVX2, Result& result);
+    double computeSsim(uint32_t channel, const Options& options, bool useAVX2);
+
+    WorkStealingThreadPool  mThreadPool;
+    Planes                  mImage;
+    Planes                  mReference;
+    std::vector<float>      mBlurred[5];        ///< Horizontally blurred x, y, x^2, y^2 and xy for SSIM
+    std::vector<std::vector<float>> mRowScratch;    ///< Per thread edge padded rows for the horizontal blur
+};
@@ -0,0 +1,95 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "LightAliasTable.h"
+
+namespace
+{
+    uint sampleEntry(const std::vector<LightAliasEntry>& table, uint launchIdx, uint numLaunches, float xi)
+    {
+        AliasTableSample s = getAliasTableSample(launchIdx, numLaunches, static_cast<uint>(table.size()), xi);
+        const LightAliasEntry& entry = table[s.column];
+        return s.frac < entry.threshold ? s.column : entry.alias;
+    }
+}
+
+std::vector<LightAliasEntry> LightAliasTable::build(const std::vector<double>& probabilities, const std::vector<int32_t>& lightIndices)
+{
+    PM_ASSERT(probabilities.size() == lightIndices.size());
+    const uint n = static_cast<uint>(probabilities.size());
+    std::vector<LightAliasEntry> table(n);
+    if (n == 0) return table;
+
+    double sum = 0.0;
+    for (double p : probabilities) sum += p;
+
+    //Scaled probabilities, the average entry has 1
+    std::vector<double> scaled(n);
+    std::vector<uint> small, large;
+    small.reserve(n);
+    large.reserve(n);
+    for (uint i = 0; i < n; i++)
+    {
+        table[i].lightIndex = lightIndices[i];
+        table[i].invPdf = probabilities[i] > 0.0 ? static_cast<float>(sum / probabilities[i]) : 0.f;
+        table[i].alias = i;
+        table[i].threshold = 1.f;
+        scaled[i] = sum > 0.0 ? probabilities[i] * n / sum : 1.0;
+        if (scaled[i] < 1.0) small.push_back(i);
+        else large.push_back(i);
+    }
+
+    //Vose: fill every small entry up with the rest of a large one
+    while (!small.empty() && !large.empty())
+    {
+        uint s = small.back(); small.pop_back();
+        uint l = large.back(); large.pop_back();
+        table[s].threshold = static_cast<float>(scaled[s]);
+        table[s].alias = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) small.push_back(l);
+        else large.push_back(l);
+    }
+
+    //Leftovers are 1 up to rounding errors
+    for (uint i : large) table[i].threshold = 1.f;
+    for (uint i : small) table[i].threshold = 1.f;
+
+    return table;
+}
+
+int32_t LightAliasTable::sample(const std::vector<LightAliasEntry>& table, uint launchIdx, uint numLaunches, float xi, float& invPdf)
+{
+    if (table.empty())
+    {
+        invPdf = 0.f;
+        return 0;
+    }
+    const LightAliasEntry& entry = table[sampleEntry(table, launchIdx, numLaunches, xi)];
+    invPdf = entry.invPdf;
+    return entry.lightIndex;
+}
@@ -0,0 +1,54 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "CpuMath.h"
+#include "LightAliasTable.slang"
+#include <vector>
+
+using namespace Falcor;
+
+/** CPU side of the light alias table used by the photon generate passes.
+    Memory scales with the number of lights instead of the number of photons. A launch selects its light in O(1)
+    with getAliasTableSample() followed by a threshold test, the same way as the generate shaders.
+*/
+class LightAliasTable
+{
+public:
+    /** Builds the table with Vose's alias method.
+        \param[in] probabilities Selection probability of every entry. Does not need to be normalized.
+        \param[in] lightIndices Light of every entry, see LightAliasEntry::lightIndex.
+        \return Table with one entry per light. Entries with zero probability are never selected.
+    */
+    static std::vector<LightAliasEntry> build(const std::vector<double>& probabilities, const std::vector<int32_t>& lightIndices);
+
+    /** Selects the light for a launch. Mirrors the generate shaders.
+        \param[out] invPdf Inverse selection probability of the returned light.
+        \return Light index as stored in the table.
+    */
+    static int32_t sample(const std::vector<LightAliasEntry>& table, uint launchIdx, uint numLaunches, float xi, float& invPdf);
+};
@@ -0,0 +1,323 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "LightSampleTableBuilder.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    const uint kBlockSizeSq = LightSampleTableBuilder::kBlockSize * LightSampleTableBuilder::kBlockSize;
+    const size_t kTriangleGrainSize = 1 << 14;
+    const size_t kBlockGrainSize = 64;
+
+    /** Top left texel of a 16x16 block. Blocks are laid out row by row over the table width.
+    */
+    uint2 getBlockStartingIndex(uint blockIdx, uint width)
+    {
+        const uint bs = LightSampleTableBuilder::kBlockSize;
+        uint x = (blockIdx * bs) % width;
+        uint y = ((blockIdx * bs) / width) * bs;
+        return uint2(x, y);
+    }
+
+    /** Per chunk partial results of a range split into grainSize chunks. The pool splits at multiples of grainSize.
+    */
+    size_t getChunkCount(size_t count, size_t grainSize) { return (count + grainSize - 1) / grainSize; }
+
+    /** Share of the photons that goes to analytic lights. The photons are split even between the analytic lights and the
+        emissive meshes (approximation of the number of emissive lights).
+    */
+    float getAnalyticShare(const LightSampleTableBuilder::Input& input, size_t numTriangles)
+    {
+        if (input.numAnalyticLights == 0) return 0.f;
+        if (numTriangles == 0) return 1.f;
+        uint lightsTotal = input.numAnalyticLights + input.numMeshLights;
+        return static_cast<float>(input.numAnalyticLights) / static_cast<float>(lightsTotal);
+    }
+
+    /** Per photon light table of the former light sample texture. Every triangle shoots at least one photon.
+    */
+    void buildPhotonTable(const LightSampleTableBuilder::Input& input, double totalWeight, WorkStealingThreadPool& pool, LightSampleTableBuilder::Table& table)
+    {
+        const uint bs = LightSampleTableBuilder::kBlockSize;
+        const uint numAnalytic = input.numAnalyticLights;
+
+        //If there are analytic Lights split number of Photons even between the analytic light and the number of emissive models
+        uint analyticPhotons = 0;
+        uint numEmissivePhotons = input.numPhotons;
+        if (numAnalytic != 0)
+        {
+            float percentAnalytic = static_cast<float>(numAnalytic) / static_cast<float>(numAnalytic + input.numMeshLights);
+            analyticPhotons = static_cast<uint>(input.numPhotons * percentAnalytic);
+            analyticPhotons += numAnalytic - (analyticPhotons % numAnalytic);  //add it up so every light gets the same number of photons
+            numEmissivePhotons = input.numPhotons - analyticPhotons;
+        }
+
+        //Photons per triangle and their exclusive prefix sum. triangleOffsets has one extra entry holding the total
+        const size_t numTriangles = numEmissivePhotons > 0 ? input.triangleWeights.size() : 0;
+        std::vector<uint> triangleOffsets(numTriangles + 1, 0);
+        table.photonsPerTriangle.clear();
+
+        if (numTriangles > 0)
+        {
+            const size_t numChunks = getChunkCount(numTriangles, kTriangleGrainSize);
+            const auto& weights = input.triangleWeights;
+            const float photonsPerMode = static_cast<float>(numEmissivePhotons / totalWeight);
+
+            //Count photons per triangle. The real count changes due to rounding
+            table.photonsPerTriangle.resize(numTriangles);
+            std::vector<uint> chunkPhotons(numChunks, 0);
+            pool.parallelFor(numTriangles, kTriangleGrainSize, [&](size_t begin, size_t end, uint32_t)
+            {
+                uint sum = 0;
+                for (size_t i = begin; i < end; i++)
+                {
+                    uint photons = std::max(static_cast<uint>(std::ceil(weights[i] * photonsPerMode)), 1u);
+                    table.photonsPerTriangle[i] = photons;
+                    sum += photons;
+                }
+                chunkPhotons[begin / kTriangleGrainSize] = sum;
+            });
+
+            //Scan over the chunks, then every chunk writes its offsets
+            std::vector<uint> chunkOffsets(numChunks, 0);
+            for (size_t c = 1; c < numChunks; c++)
+                chunkOffsets[c] = chunkOffsets[c - 1] + chunkPhotons[c - 1];
+
+            pool.parallelFor(numTriangles, kTriangleGrainSize, [&](size_t begin, size_t end, uint32_t)
+            {
+                uint offset = chunkOffsets[begin / kTriangleGrainSize];
+                for (size_t i = begin; i < end; i++)
+                {
+                    triangleOffsets[i] = offset;
+                    offset += table.photonsPerTriangle[i];
+                }
+            });
+            triangleOffsets[numTriangles] = chunkOffsets[numChunks - 1] + chunkPhotons[numChunks - 1];
+        }
+        numEmissivePhotons = triangleOffsets[numTriangles];     //get real photon count
+
+        //Fill up so x to 16x16 block with at least 1 block extra when mixed
+        const uint totalNumPhotons = numEmissivePhotons + analyticPhotons;
+        uint width = (totalNumPhotons / input.dispatchY) + 1;
+        width += (width % bs == 0 && analyticPhotons > 0) ? bs : bs - (width % bs);
+
+        table.photonTableWidth = width;
+        table.analyticPhotons = analyticPhotons;
+        table.emissivePhotons = numEmissivePhotons;
+
+        //Init the table with the invalid index (zero)
+        table.lightIndex.assign(static_cast<size_t>(width) * input.dispatchY, 0);
+        int32_t* lightIndex = table.lightIndex.data();
+        const size_t tableSize = table.lightIndex.size();
+
+        //Fills one block with entries [blockIdx * 256, min((blockIdx + 1) * 256, count)) of a light category
+        auto fillBlock = [&](uint blockIdx, uint blockOffset, uint count, auto&& getLightIdx)
+        {
+            const uint2 blockStart = getBlockStartingIndex(blockIdx + blockOffset, width);
+            const uint first = blockIdx * kBlockSizeSq;
+            const uint last = std::min(first + kBlockSizeSq, count);
+            for (uint i = first; i < last; i++)
+            {
+                const uint local = i - first;
+                const uint2 idx = blockStart + uint2(local % bs, local / bs);
+                const size_t texel = idx.x + static_cast<size_t>(idx.y) * width;
+                FALCOR_ASSERT(texel < tableSize);
+                if (texel < tableSize) lightIndex[texel] = getLightIdx(i);
+            }
+        };
+
+        //Analytic lights. Negative indices are analytic
+        if (analyticPhotons > 0)
+        {
+            const uint step = analyticPhotons / numAnalytic;
+            const uint numBlocks = (analyticPhotons + kBlockSizeSq - 1) / kBlockSizeSq;
+            pool.parallelFor(numBlocks, kBlockGrainSize, [&](size_t begin, size_t end, uint32_t)
+            {
+                for (size_t b = begin; b < end; b++)
+                    fillBlock(static_cast<uint>(b), 0, analyticPhotons, [&](uint i) { return -static_cast<int32_t>((i / step) + 1); });
+            });
+        }
+
+        //Emissive triangles. Positive indices are emissive
+        if (numEmissivePhotons > 0)
+        {
+            const uint analyticEndBlock = analyticPhotons > 0 ? (analyticPhotons / kBlockSizeSq) + 1 : 0;    //we have guaranteed an extra block
+            const uint numBlocks = (numEmissivePhotons + kBlockSizeSq - 1) / kBlockSizeSq;
+            pool.parallelFor(numBlocks, kBlockGrainSize, [&](size_t begin, size_t end, uint32_t)
+            {
+                //Find the triangle of the first photon in the range, afterwards walk the offsets
+                const uint firstPhoton = static_cast<uint>(begin) * kBlockSizeSq;
+                size_t tri = std::upper_bound(triangleOffsets.begin(), triangleOffsets.end(), firstPhoton) - triangleOffsets.begin() - 1;
+                for (size_t b = begin; b < end; b++)
+                {
+                    fillBlock(static_cast<uint>(b), analyticEndBlock, numEmissivePhotons, [&](uint i)
+                    {
+                        while (i >= triangleOffsets[tri + 1]) tri++;
+                        return static_cast<int32_t>(tri + 1);
+                    });
+                }
+            });
+        }
+
+        if (table.photonsPerTriangle.empty())
+            table.photonsPerTriangle.push_back(0);
+    }
+}
+
+LightSampleTableBuilder::LightSampleTableBuilder(uint threadCount)
+{
+    mpThreadPool = std::make_unique<WorkStealingThreadPool>(threadCount);
+}
+
+LightSampleTableBuilder::~LightSampleTableBuilder()
+{
+    cancel();
+}
+
+LightSampleTableBuilder::Input LightSampleTableBuilder::createInput(RenderContext* pRenderContext, const Scene::SharedPtr& pScene, uint numPhotons, uint dispatchY, Mode mode)
+{
+    FALCOR_ASSERT(pScene);
+
+    auto lightCollection = pScene->getLightCollection(pRenderContext);
+    const auto& meshLightTriangles = lightCollection->getMeshLightTriangles();
+
+    Input input;
+    input.numPhotons = numPhotons;
+    input.dispatchY = dispatchY;
+    input.numAnalyticLights = static_cast<uint>(pScene->getActiveLights().size());
+    input.numMeshLights = static_cast<uint>(lightCollection->getMeshLights().size());
+
+    //Only triangles with flux are active. This is analogous to the LightCollection and avoids changes to the core of Falcor
+    input.triangleWeights.reserve(meshLightTriangles.size());
+    for (const auto& tri : meshLightTriangles)
+    {
+        if (tri.flux > 0.f)
+            input.triangleWeights.push_back(mode == Mode::Area ? tri.area : tri.flux);
+    }
+
+    return input;
+}
+
+LightSampleTableBuilder::Table LightSampleTableBuilder::build(const Input& input, WorkStealingThreadPool& pool)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    Table table;
+    table.height = input.dispatchY;
+    table.width = std::max((input.numPhotons + input.dispatchY - 1) / input.dispatchY, 1u);
+
+    const uint numAnalytic = input.numAnalyticLights;
+    const size_t numTriangles = input.numPhotons > 0 ? input.triangleWeights.size() : 0;
+    const auto& weights = input.triangleWeights;
+
+    //Total weight. Chunk sums are added in order so the result does not depend on the thread count
+    double totalWeight = 0.0;
+    if (numTriangles > 0)
+    {
+        std::vector<double> chunkWeights(getChunkCount(numTriangles, kTriangleGrainSize), 0.0);
+        pool.parallelFor(numTriangles, kTriangleGrainSize, [&](size_t begin, size_t end, uint32_t)
+        {
+            double sum = 0.0;
+            for (size_t i = begin; i < end; i++) sum += weights[i];
+            chunkWeights[begin / kTriangleGrainSize] = sum;
+        });
+        for (double w : chunkWeights) totalWeight += w;
+    }
+
+    //Selection probabilities. Analytic lights share their part evenly, triangles get theirs by flux or area
+    const double analyticShare = getAnalyticShare(input, numTriangles);
+    const size_t numEntries = (input.numPhotons > 0 ? numAnalytic : 0) + numTriangles;
+    std::vector<double> probabilities(numEntries);
+    std::vector<int32_t> lightIndices(numEntries);
+    for (uint i = 0; i < numEntries - numTriangles; i++)
+    {
+        probabilities[i] = analyticShare / numAnalytic;
+        lightIndices[i] = -static_cast<int32_t>(i + 1);
+    }
+    if (numTriangles > 0)
+    {
+        const size_t offset = numEntries - numTriangles;
+        const double emissiveScale = totalWeight > 0.0 ? (1.0 - analyticShare) / totalWeight : 0.0;
+        pool.parallelFor(numTriangles, kTriangleGrainSize, [&](size_t begin, size_t end, uint32_t)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                probabilities[offset + i] = weights[i] * emissiveScale;
+                lightIndices[offset + i] = static_cast<int32_t>(i + 1);
+            }
+        });
+    }
+    table.modeProbabilities = probabilities;
+    if (input.entryProbabilities.size() == numEntries)
+        probabilities = input.entryProbabilities;
+    table.aliasTable = LightAliasTable::build(probabilities, lightIndices);
+
+    if (input.buildReference)
+    {
+        table.probabilities = std::move(probabilities);
+        buildPhotonTable(input, totalWeight, pool, table);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    table.buildTimeMs = std::chrono::duration<double, std::milli>(end - start).count();
+    return table;
+}
+
+LightSampleTableBuilder::Table LightSampleTableBuilder::build(const Input& input)
+{
+    cancel();
+    return build(input, *mpThreadPool);
+}
+
+void LightSampleTableBuilder::buildAsync(Input input)
+{
+    cancel();
+    WorkStealingThreadPool* pPool = mpThreadPool.get();
+    mPendingTable = std::async(std::launch::async, [pPool, input = std::move(input)]() { return build(input, *pPool); });
+}
+
+bool LightSampleTableBuilder::isReady() const
+{
+    return mPendingTable.valid() && mPendingTable.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+LightSampleTableBuilder::Table LightSampleTableBuilder::takeResult()
+{
+    FALCOR_ASSERT(mPendingTable.valid());
+    return mPendingTable.get();
+}
+
+void LightSampleTableBuilder::cancel()
+{
+    if (mPendingTable.valid())
+    {
+        mPendingTable.wait();
+        mPendingTable = {};
+    }
+}
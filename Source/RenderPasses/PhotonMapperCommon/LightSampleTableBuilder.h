@@ -0,0 +1,130 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "LightAliasTable.h"
+#include "WorkStealingThreadPool.h"
+#include <future>
+
+using namespace Falcor;
+
+/** Builds the light sample table used by the photon generate passes.
+    The table is an alias table over all analytic lights and active emissive triangles (see LightAliasTable.slang),
+    so its size scales with the light count. Each photon launch selects its light from the table; the inverse selection
+    pdf is stored per entry. A build can run on a worker thread so the old table keeps rendering until the new one is ready.
+    Adaptive emission (see AdaptiveLightSampling) replaces the power/area distribution with its own entry probabilities.
+
+    For validation the builder can also create the former per photon table: every texel holds the light a photon is
+    emitted from (negative analytic, positive emissive, 1-based, 0 invalid), filled in 16x16 blocks with at least one
+    photon per triangle. Its per triangle counts use a parallel prefix sum and the blocks are filled in parallel.
+*/
+class LightSampleTableBuilder
+{
+public:
+    static const uint kBlockSize = 16;
+
+    enum class Mode : uint32_t
+    {
+        Power = 0,      ///< Photons are distributed by triangle flux
+        Area = 1        ///< Photons are distributed by triangle area
+    };
+
+    /** Scene independent input of a build.
+    */
+    struct Input
+    {
+        uint numPhotons = 0;                    ///< Requested number of photons
+        uint dispatchY = 512;                   ///< Height of the generate dispatch
+        uint numAnalyticLights = 0;
+        uint numMeshLights = 0;                 ///< Number of emissive meshes. Used to split the photons between analytic and emissive
+        std::vector<float> triangleWeights;     ///< Flux or area of every active emissive triangle
+        bool buildReference = false;            ///< Also build the per photon table and keep the entry probabilities
+        std::vector<double> entryProbabilities; ///< Replaces the power/area distribution if it has one value per entry (adaptive emission)
+    };
+
+    struct Table
+    {
+        uint width = 0;                         ///< Dispatch width. The dispatch covers at least the requested photons
+        uint height = 0;
+        std::vector<LightAliasEntry> aliasTable;    ///< Analytic lights first, followed by the active emissive triangles
+        std::vector<double> modeProbabilities;  ///< Power/area probability of every alias table entry, also if it was replaced
+        double buildTimeMs = 0.0;
+
+        // Reference data, only filled with Input::buildReference
+        std::vector<double> probabilities;      ///< Selection probability of every alias table entry
+        uint photonTableWidth = 0;              ///< Width of the per photon table. A multiple of kBlockSize
+        std::vector<int32_t> lightIndex;        ///< Per photon table with photonTableWidth * height entries
+        std::vector<uint> photonsPerTriangle;   ///< Photons per active emissive triangle. Holds a single 0 if there are none
+        uint analyticPhotons = 0;
+        uint emissivePhotons = 0;               ///< Real emissive count after rounding up per triangle
+
+        uint getNumPhotons() const { return width * height; }
+    };
+
+    /** Create the builder.
+        \param[in] threadCount Threads used for a build. 0 uses all hardware threads.
+    */
+    explicit LightSampleTableBuilder(uint threadCount = 0);
+    ~LightSampleTableBuilder();
+
+    /** Gathers the build input from the scene. Has to be called on the render thread.
+    */
+    static Input createInput(RenderContext* pRenderContext, const Scene::SharedPtr& pScene, uint numPhotons, uint dispatchY, Mode mode);
+
+    /** Builds the table on the given pool.
+    */
+    static Table build(const Input& input, WorkStealingThreadPool& pool);
+
+    /** Builds the table synchronously. A running background build is discarded.
+    */
+    Table build(const Input& input);
+
+    /** Starts a build on a worker thread. A running background build is discarded.
+    */
+    void buildAsync(Input input);
+
+    /** True while a background build is running or its result was not taken yet.
+    */
+    bool isBuilding() const { return mPendingTable.valid(); }
+
+    /** True if a background build finished and its result can be taken.
+    */
+    bool isReady() const;
+
+    /** Returns the result of the finished background build. Only valid if isReady() is true.
+    */
+    Table takeResult();
+
+    /** Waits for a running background build and drops its result.
+    */
+    void cancel();
+
+private:
+    std::unique_ptr<WorkStealingThreadPool> mpThreadPool;
+    std::future<Table>          mPendingTable;          ///< Result of the background build
+};
@@ -0,0 +1,163 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonAccelerationStructure.h"
+
+#if FALCOR_D3D12
+namespace
+{
+    class D3D12PhotonASBackend : public PhotonASBackend
+    {
+    public:
+        PhotonASBackendType getType() const override { return PhotonASBackendType::D3D12; }
+
+        PhotonASPrebuildInfo getPrebuildInfo(const PhotonASBuildInputs& inputs) override
+        {
+            D3D12_RAYTRACING_GEOMETRY_DESC geometry = {};
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS d3dInputs = getInputs(inputs, geometry);
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO d3dInfo = {};
+            FALCOR_GET_COM_INTERFACE(gpDevice->getApiHandle(), ID3D12Device5, pDevice5);
+            pDevice5->GetRaytracingAccelerationStructurePrebuildInfo(&d3dInputs, &d3dInfo);
+            FALCOR_ASSERT(d3dInfo.ResultDataMaxSizeInBytes > 0);
+
+            PhotonASPrebuildInfo info;
+            info.resultBytes = d3dInfo.ResultDataMaxSizeInBytes;
+            info.scratchBytes = d3dInfo.ScratchDataSizeInBytes;
+            info.updateScratchBytes = d3dInfo.UpdateScratchDataSizeInBytes;
+            return info;
+        }
+
+        void reset() override
+        {
+            mAccelerationStructures.clear();
+            mpScratch = nullptr;
+            mpInstanceDescs = nullptr;
+            mInstanceCount = 0;
+        }
+
+        uint createAccelerationStructure(bool topLevel, uint64_t byteSize, const std::string& name) override
+        {
+            auto pBuffer = Buffer::create(byteSize, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
+            pBuffer->setName(name);
+            mAccelerationStructures.push_back(pBuffer);
+            return uint(mAccelerationStructures.size() - 1);
+        }
+
+        void createScratch(uint64_t byteSize) override
+        {
+            mpScratch = Buffer::create(byteSize, Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+            mpScratch->setName("PhotonAccelerationStructure::Scratch");
+        }
+
+        void setInstances(const std::vector<PhotonASInstance>& instances) override
+        {
+            std::vector<D3D12_RAYTRACING_INSTANCE_DESC> descs(instances.size());
+            for (size_t i = 0; i < instances.size(); i++) {
+                D3D12_RAYTRACING_INSTANCE_DESC& desc = descs[i];
+                desc = {};
+                desc.AccelerationStructure = mAccelerationStructures[instances[i].blas]->getGpuAddress();
+                desc.Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
+                desc.InstanceID = instances[i].instanceID;
+                desc.InstanceMask = instances[i].instanceMask;
+                desc.InstanceContributionToHitGroupIndex = 0;
+
+                //Create a identity matrix for the transform and copy it to the instance desc
+                glm::mat4 transform4x4 = glm::identity<glm::mat4>();
+                std::memcpy(desc.Transform, &transform4x4, sizeof(desc.Transform));
+            }
+            mInstanceCount = uint(descs.size());
+            mpInstanceDescs = Buffer::create(mInstanceCount * sizeof(D3D12_RAYTRACING_INSTANCE_DESC), Buffer::BindFlags::None, Buffer::CpuAccess::Write, descs.data());
+            mpInstanceDescs->setName("PhotonAccelerationStructure::InstanceDescs");
+        }
+
+        void build(RenderContext* pRenderContext, const PhotonASBuildInputs& inputs, uint dest) override
+        {
+            Buffer* pDest = mAccelerationStructures[dest].get();
+
+            D3D12_RAYTRACING_GEOMETRY_DESC geometry = {};
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
+            asDesc.Inputs = getInputs(inputs, geometry);
+            asDesc.ScratchAccelerationStructureData = mpScratch->getGpuAddress();
+            asDesc.DestAccelerationStructureData = pDest->getGpuAddress();
+
+            if (inputs.topLevel) pRenderContext->resourceBarrier(mpInstanceDescs.get(), Resource::State::NonPixelShader);
+            pRenderContext->uavBarrier(mpScratch.get());
+            pRenderContext->uavBarrier(pDest);
+
+            FALCOR_GET_COM_INTERFACE(pRenderContext->getLowLevelData()->getCommandList(), ID3D12GraphicsCommandList4, pList4);
+            pList4->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+
+            //The acceleration structure can be used right after the build
+            pRenderContext->uavBarrier(pDest);
+        }
+
+        ShaderResourceView::SharedPtr getSrv(uint handle) override
+        {
+            return ShaderResourceView::createViewForAccelerationStructure(mAccelerationStructures[handle]);
+        }
+
+    private:
+        /** The geometry desc is referenced by the inputs of a bottom level and has to outlive them.
+        */
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS getInputs(const PhotonASBuildInputs& inputs, D3D12_RAYTRACING_GEOMETRY_DESC& geometry) const
+        {
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS d3dInputs = {};
+            d3dInputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            d3dInputs.Flags = inputs.fastBuild ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+            if (inputs.topLevel) {
+                FALCOR_ASSERT(inputs.count == mInstanceCount);
+                d3dInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+                d3dInputs.NumDescs = inputs.count;
+                d3dInputs.InstanceDescs = mpInstanceDescs ? mpInstanceDescs->getGpuAddress() : 0;
+            }
+            else {
+                geometry.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS;
+                geometry.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION;
+                geometry.AABBs.AABBCount = inputs.count;
+                geometry.AABBs.AABBs.StartAddress = inputs.pAabbs ? inputs.pAabbs->getGpuAddress() + uint64_t(inputs.aabbOffset) * PhotonAccelerationStructure::kAABBStride : 0;
+                geometry.AABBs.AABBs.StrideInBytes = PhotonAccelerationStructure::kAABBStride;
+
+                d3dInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+                d3dInputs.NumDescs = 1;
+                d3dInputs.pGeometryDescs = &geometry;
+            }
+            return d3dInputs;
+        }
+
+        std::vector<Buffer::SharedPtr> mAccelerationStructures;
+        Buffer::SharedPtr mpScratch;
+        Buffer::SharedPtr mpInstanceDescs;
+        uint mInstanceCount = 0;
+    };
+}
+
+PhotonASBackend::SharedPtr createD3D12PhotonASBackend()
+{
+    static_assert(sizeof(D3D12_RAYTRACING_AABB) == PhotonAccelerationStructure::kAABBStride);
+    return std::make_shared<D3D12PhotonASBackend>();
+}
+#endif
@@ -0,0 +1,184 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonAccelerationStructure.h"
+
+#if FALCOR_GFX
+#include <slang-gfx.h>
+
+namespace
+{
+    using gfx::IAccelerationStructure;
+
+    /** Vulkan backend through slang-gfx. The acceleration structures live in Falcor buffers, gfx only adds the
+        acceleration structure objects on top of them.
+    */
+    class VulkanPhotonASBackend : public PhotonASBackend
+    {
+    public:
+        PhotonASBackendType getType() const override { return PhotonASBackendType::Vulkan; }
+
+        PhotonASPrebuildInfo getPrebuildInfo(const PhotonASBuildInputs& inputs) override
+        {
+            IAccelerationStructure::GeometryDesc geometry = {};
+            const IAccelerationStructure::BuildInputs gfxInputs = getInputs(inputs, geometry);
+            IAccelerationStructure::PrebuildInfo gfxInfo = {};
+            if (SLANG_FAILED(gpDevice->getApiHandle()->getAccelerationStructurePrebuildInfo(gfxInputs, &gfxInfo)))
+                throw std::runtime_error("Failed to get the prebuild info of the photon acceleration structure");
+
+            PhotonASPrebuildInfo info;
+            info.resultBytes = gfxInfo.resultDataMaxSize;
+            info.scratchBytes = gfxInfo.scratchDataSize;
+            info.updateScratchBytes = gfxInfo.updateScratchDataSize;
+            return info;
+        }
+
+        void reset() override
+        {
+            mAccelerationStructures.clear();
+            mpScratch = nullptr;
+            mpInstanceDescs = nullptr;
+            mInstanceCount = 0;
+        }
+
+        uint createAccelerationStructure(bool topLevel, uint64_t byteSize, const std::string& name) override
+        {
+            AccelerationStructure as;
+            as.pBuffer = Buffer::create(byteSize, Buffer::BindFlags::AccelerationStructure, Buffer::CpuAccess::None);
+            as.pBuffer->setName(name);
+
+            IAccelerationStructure::CreateDesc desc = {};
+            desc.kind = topLevel ? IAccelerationStructure::Kind::TopLevel : IAccelerationStructure::Kind::BottomLevel;
+            desc.buffer = static_cast<gfx::IBufferResource*>(as.pBuffer->getApiHandle().get());
+            desc.offset = 0;
+            desc.size = byteSize;
+            if (SLANG_FAILED(gpDevice->getApiHandle()->createAccelerationStructure(desc, as.pAccelerationStructure.writeRef())))
+                throw std::runtime_error("Failed to create " + name);
+
+            mAccelerationStructures.push_back(as);
+            return uint(mAccelerationStructures.size() - 1);
+        }
+
+        void createScratch(uint64_t byteSize) override
+        {
+            mpScratch = Buffer::create(byteSize, Buffer::BindFlags::UnorderedAccess, Buffer::CpuAccess::None);
+            mpScratch->setName("PhotonAccelerationStructure::Scratch");
+        }
+
+        void setInstances(const std::vector<PhotonASInstance>& instances) override
+        {
+            std::vector<IAccelerationStructure::InstanceDesc> descs(instances.size());
+            for (size_t i = 0; i < instances.size(); i++) {
+                IAccelerationStructure::InstanceDesc& desc = descs[i];
+                desc = {};
+                desc.accelerationStructure = mAccelerationStructures[instances[i].blas].pBuffer->getGpuAddress();
+                desc.flags = IAccelerationStructure::GeometryInstanceFlags::None;
+                desc.instanceID = instances[i].instanceID;
+                desc.instanceMask = instances[i].instanceMask;
+                desc.instanceContributionToHitGroupIndex = 0;
+
+                //Identity transform, 3x4 row major
+                for (uint row = 0; row < 3; row++) desc.transform[row][row] = 1.f;
+            }
+            mInstanceCount = uint(descs.size());
+            mpInstanceDescs = Buffer::create(mInstanceCount * sizeof(IAccelerationStructure::InstanceDesc), Buffer::BindFlags::None, Buffer::CpuAccess::Write, descs.data());
+            mpInstanceDescs->setName("PhotonAccelerationStructure::InstanceDescs");
+        }
+
+        void build(RenderContext* pRenderContext, const PhotonASBuildInputs& inputs, uint dest) override
+        {
+            const AccelerationStructure& as = mAccelerationStructures[dest];
+
+            IAccelerationStructure::GeometryDesc geometry = {};
+            IAccelerationStructure::BuildDesc desc = {};
+            desc.inputs = getInputs(inputs, geometry);
+            desc.source = nullptr;
+            desc.dest = as.pAccelerationStructure.get();
+            desc.scratchData = mpScratch->getGpuAddress();
+
+            if (inputs.topLevel) pRenderContext->resourceBarrier(mpInstanceDescs.get(), Resource::State::NonPixelShader);
+            pRenderContext->uavBarrier(mpScratch.get());
+            pRenderContext->uavBarrier(as.pBuffer.get());
+
+            auto pEncoder = pRenderContext->getLowLevelData()->getApiData()->getRayTracingCommandEncoder();
+            pEncoder->buildAccelerationStructure(desc, 0, nullptr);
+
+            //The acceleration structure can be used right after the build
+            pRenderContext->uavBarrier(as.pBuffer.get());
+        }
+
+        ShaderResourceView::SharedPtr getSrv(uint handle) override
+        {
+            return ShaderResourceView::createViewForAccelerationStructure(mAccelerationStructures[handle].pBuffer);
+        }
+
+    private:
+        struct AccelerationStructure
+        {
+            Buffer::SharedPtr pBuffer;
+            Slang::ComPtr<IAccelerationStructure> pAccelerationStructure;
+        };
+
+        /** The geometry desc is referenced by the inputs of a bottom level and has to outlive them.
+        */
+        IAccelerationStructure::BuildInputs getInputs(const PhotonASBuildInputs& inputs, IAccelerationStructure::GeometryDesc& geometry) const
+        {
+            IAccelerationStructure::BuildInputs gfxInputs = {};
+            gfxInputs.flags = inputs.fastBuild ? IAccelerationStructure::BuildFlags::PreferFastBuild : IAccelerationStructure::BuildFlags::PreferFastTrace;
+            if (inputs.topLevel) {
+                FALCOR_ASSERT(inputs.count == mInstanceCount);
+                gfxInputs.kind = IAccelerationStructure::Kind::TopLevel;
+                gfxInputs.descCount = inputs.count;
+                gfxInputs.instanceDescs = mpInstanceDescs ? mpInstanceDescs->getGpuAddress() : 0;
+            }
+            else {
+                geometry.type = IAccelerationStructure::GeometryType::ProcedurePrimitives;
+                geometry.flags = IAccelerationStructure::GeometryFlags::NoDuplicateAnyHitInvocation;
+                geometry.content.proceduralAABBs.count = inputs.count;
+                geometry.content.proceduralAABBs.data = inputs.pAabbs ? inputs.pAabbs->getGpuAddress() + uint64_t(inputs.aabbOffset) * PhotonAccelerationStructure::kAABBStride : 0;
+                geometry.content.proceduralAABBs.stride = PhotonAccelerationStructure::kAABBStride;
+
+                gfxInputs.kind = IAccelerationStructure::Kind::BottomLevel;
+                gfxInputs.descCount = 1;
+                gfxInputs.geometryDescs = &geometry;
+            }
+            return gfxInputs;
+        }
+
+        std::vector<AccelerationStructure> mAccelerationStructures;
+        Buffer::SharedPtr mpScratch;
+        Buffer::SharedPtr mpInstanceDescs;
+        uint mInstanceCount = 0;
+    };
+}
+
+PhotonASBackend::SharedPtr createVulkanPhotonASBackend()
+{
+    static_assert(sizeof(IAccelerationStructure::InstanceDesc) == 64);
+    return std::make_shared<VulkanPhotonASBackend>();
+}
+#endif
@@ -0,0 +1,239 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonAccelerationStructure.h"
+#include <algorithm>
+
+namespace
+{
+    uint64_t alignBytes(uint64_t bytes)
+    {
+        return (bytes + PhotonAccelerationStructure::kByteAlignment - 1) & ~(PhotonAccelerationStructure::kByteAlignment - 1);
+    }
+
+    /** Scratch bytes of a build or a refit, whichever is larger.
+    */
+    uint64_t getScratchBytes(const PhotonASPrebuildInfo& info)
+    {
+        return alignBytes(std::max(info.scratchBytes, info.updateScratchBytes));
+    }
+
+    PhotonASBuildInputs getBottomLevelInputs(const PhotonAccelerationStructure::Geometry& geometry, uint count, bool fastBuild)
+    {
+        PhotonASBuildInputs inputs;
+        inputs.topLevel = false;
+        inputs.fastBuild = fastBuild;
+        inputs.pAabbs = geometry.pAabbs;
+        inputs.aabbOffset = geometry.aabbOffset;
+        inputs.count = count;
+        return inputs;
+    }
+
+    PhotonASBuildInputs getTopLevelInputs(uint instanceCount, bool fastBuild)
+    {
+        PhotonASBuildInputs inputs;
+        inputs.topLevel = true;
+        inputs.fastBuild = fastBuild;
+        inputs.count = instanceCount;
+        return inputs;
+    }
+}
+
+NullPhotonASBackend::SharedPtr NullPhotonASBackend::create()
+{
+    return SharedPtr(new NullPhotonASBackend());
+}
+
+NullPhotonASBackend::SharedPtr NullPhotonASBackend::create(const PhotonASBackend::SharedPtr& pDevice)
+{
+    SharedPtr pBackend(new NullPhotonASBackend());
+    pBackend->mpDevice = pDevice;
+    return pBackend;
+}
+
+void NullPhotonASBackend::addError(const std::string& msg)
+{
+    mErrorCount++;
+    if (mpDevice) logWarning("PhotonASBackend validation: " + msg);
+}
+
+PhotonASPrebuildInfo NullPhotonASBackend::getPrebuildInfo(const PhotonASBuildInputs& inputs)
+{
+    if (mpDevice) return mpDevice->getPrebuildInfo(inputs);
+
+    //Odd sizes, so a missing alignment shows up
+    const uint64_t count = inputs.count;
+    PhotonASPrebuildInfo info;
+    if (inputs.topLevel) {
+        info.resultBytes = 1000 + count * 64;
+        info.scratchBytes = 500 + count * 8;
+    }
+    else {
+        info.resultBytes = 1000 + count * (inputs.fastBuild ? 65 : 97);
+        info.scratchBytes = 500 + count * (inputs.fastBuild ? 33 : 49);
+    }
+    info.updateScratchBytes = info.scratchBytes / 3;
+    return info;
+}
+
+void NullPhotonASBackend::reset()
+{
+    mAllocations.clear();
+    mBuilds.clear();
+    mInstances.clear();
+    mScratchBytes = 0;
+    mResetCount++;
+    if (mpDevice) mpDevice->reset();
+}
+
+uint NullPhotonASBackend::createAccelerationStructure(bool topLevel, uint64_t byteSize, const std::string& name)
+{
+    Allocation allocation;
+    allocation.topLevel = topLevel;
+    allocation.byteSize = byteSize;
+    allocation.name = name;
+    mAllocations.push_back(allocation);
+    const uint handle = uint(mAllocations.size() - 1);
+    //The checks index the allocations with the handles
+    if (mpDevice && mpDevice->createAccelerationStructure(topLevel, byteSize, name) != handle) addError("handle of " + name + " is not its allocation index");
+    return handle;
+}
+
+void NullPhotonASBackend::createScratch(uint64_t byteSize)
+{
+    mScratchBytes = byteSize;
+    if (mpDevice) mpDevice->createScratch(byteSize);
+}
+
+void NullPhotonASBackend::setInstances(const std::vector<PhotonASInstance>& instances)
+{
+    for (const auto& instance : instances)
+        if (instance.blas >= mAllocations.size() || mAllocations[instance.blas].topLevel) addError("instance " + std::to_string(instance.instanceID) + " references no bottom level");
+    mInstances = instances;
+    if (mpDevice) mpDevice->setInstances(instances);
+}
+
+void NullPhotonASBackend::build(RenderContext* pRenderContext, const PhotonASBuildInputs& inputs, uint dest)
+{
+    const PhotonASPrebuildInfo info = getPrebuildInfo(inputs);
+    const uint errorCount = mErrorCount;
+    if (dest >= mAllocations.size() || mAllocations[dest].topLevel != inputs.topLevel || mAllocations[dest].byteSize < info.resultBytes) addError("build into handle " + std::to_string(dest) + " does not fit");
+    if (mScratchBytes < info.scratchBytes) addError("scratch buffer is smaller than the build needs");
+    if (inputs.topLevel && inputs.count != mInstances.size()) addError("top level count is not the instance count");
+    //An invalid build is not passed on, it would write out of bounds on the GPU
+    if (mpDevice && mErrorCount == errorCount) mpDevice->build(pRenderContext, inputs, dest);
+
+    BuildRecord record;
+    record.inputs = inputs;
+    record.dest = dest;
+    mBuilds.push_back(record);
+}
+
+PhotonASBackend::SharedPtr PhotonAccelerationStructure::createDeviceBackend()
+{
+    if (!gpDevice || !gpDevice->isFeatureSupported(Device::SupportedFeatures::Raytracing)) return nullptr;
+#if FALCOR_D3D12
+    return createD3D12PhotonASBackend();
+#elif FALCOR_GFX
+    return createVulkanPhotonASBackend();
+#else
+    return nullptr;
+#endif
+}
+
+void PhotonAccelerationStructure::setBackend(const PhotonASBackend::SharedPtr& pBackend)
+{
+    release();
+    mpBackend = pBackend;
+}
+
+void PhotonAccelerationStructure::create(const std::vector<Geometry>& geometries, bool fastBuild)
+{
+    if (!mpBackend) throw std::runtime_error("PhotonAccelerationStructure::create() needs a backend");
+    release();
+    mFastBuild = fastBuild;
+
+    //Bottom levels for the maximum number of AABBs
+    mBlas.resize(geometries.size());
+    for (size_t i = 0; i < geometries.size(); i++) {
+        const PhotonASPrebuildInfo info = mpBackend->getPrebuildInfo(getBottomLevelInputs(geometries[i], geometries[i].maxCount, fastBuild));
+        mBlas[i].geometry = geometries[i];
+        mBlas[i].byteSize = alignBytes(info.resultBytes);
+        mBlas[i].handle = mpBackend->createAccelerationStructure(false, mBlas[i].byteSize, "PhotonAccelerationStructure::Blas" + std::to_string(i));
+        mScratchByteSize = std::max(mScratchByteSize, getScratchBytes(info));
+    }
+
+    //One instance per bottom level
+    std::vector<PhotonASInstance> instances(mBlas.size());
+    for (size_t i = 0; i < mBlas.size(); i++) {
+        instances[i].instanceID = uint(i);
+        instances[i].instanceMask = mBlas[i].geometry.instanceMask;
+        instances[i].blas = mBlas[i].handle;
+    }
+    mpBackend->setInstances(instances);
+
+    //The top level is built with the same flags it is sized for
+    const PhotonASPrebuildInfo info = mpBackend->getPrebuildInfo(getTopLevelInputs(uint(instances.size()), fastBuild));
+    mTlasByteSize = alignBytes(info.resultBytes);
+    mTlas = mpBackend->createAccelerationStructure(true, mTlasByteSize, "PhotonAccelerationStructure::Tlas");
+    mScratchByteSize = std::max(mScratchByteSize, getScratchBytes(info));
+
+    mpBackend->createScratch(mScratchByteSize);
+    mpSrv = mpBackend->getSrv(mTlas);
+}
+
+void PhotonAccelerationStructure::release()
+{
+    if (mpBackend) mpBackend->reset();
+    mBlas.clear();
+    mTlas = 0;
+    mTlasByteSize = 0;
+    mScratchByteSize = 0;
+    mpSrv = nullptr;
+}
+
+uint PhotonAccelerationStructure::buildBottomLevel(RenderContext* pRenderContext, uint geometry, uint aabbCount)
+{
+    FALCOR_ASSERT(geometry < mBlas.size());
+    const Blas& blas = mBlas[geometry];
+    aabbCount = std::min(aabbCount, blas.geometry.maxCount);
+    mpBackend->build(pRenderContext, getBottomLevelInputs(blas.geometry, aabbCount, mFastBuild), blas.handle);
+    return aabbCount;
+}
+
+void PhotonAccelerationStructure::buildTopLevel(RenderContext* pRenderContext)
+{
+    FALCOR_ASSERT(isCreated());
+    mpBackend->build(pRenderContext, getTopLevelInputs(uint(mBlas.size()), mFastBuild), mTlas);
+}
+
+uint64_t PhotonAccelerationStructure::getSizeBytes() const
+{
+    uint64_t bytes = mTlasByteSize + mScratchByteSize;
+    for (const auto& blas : mBlas) bytes += blas.byteSize;
+    return bytes;
+}
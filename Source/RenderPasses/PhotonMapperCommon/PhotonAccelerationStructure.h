@@ -0,0 +1,252 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+
+using namespace Falcor;
+
+enum class PhotonASBackendType : uint32_t
+{
+    D3D12 = 0,
+    Vulkan = 1,
+    Null = 2,
+};
+
+/** Inputs of an acceleration structure build. A bottom level has one geometry of procedural AABBs, a top level the
+    instances set with PhotonASBackend::setInstances().
+*/
+struct PhotonASBuildInputs
+{
+    bool topLevel = false;
+    bool fastBuild = true;          ///< Prefer fast build over fast trace
+    Buffer::SharedPtr pAabbs;       ///< Bottom level only. PhotonAccelerationStructure::kAABBStride bytes per AABB
+    uint aabbOffset = 0;            ///< Bottom level only. Index of the first AABB in pAabbs
+    uint count = 0;                 ///< Number of AABBs or instances
+};
+
+struct PhotonASPrebuildInfo
+{
+    uint64_t resultBytes = 0;
+    uint64_t scratchBytes = 0;
+    uint64_t updateScratchBytes = 0;
+};
+
+/** Instance of a bottom level in the top level. The transform is the identity and the hit group offset 0.
+*/
+struct PhotonASInstance
+{
+    uint instanceID = 0;
+    uint instanceMask = 0xFF;
+    uint blas = 0;                  ///< Handle of the bottom level
+};
+
+/** Graphics API side of the photon acceleration structure. Owns the acceleration structures, the scratch buffer and the
+    instances and records the builds. Acceleration structures are referenced by handles, so PhotonAccelerationStructure
+    can run against the null backend without a GPU.
+*/
+class PhotonASBackend
+{
+public:
+    using SharedPtr = std::shared_ptr<PhotonASBackend>;
+
+    virtual ~PhotonASBackend() = default;
+
+    virtual PhotonASBackendType getType() const = 0;
+
+    /** Result and scratch sizes of a build. The sizes are not aligned.
+    */
+    virtual PhotonASPrebuildInfo getPrebuildInfo(const PhotonASBuildInputs& inputs) = 0;
+
+    /** Releases all acceleration structures, the scratch buffer and the instances.
+    */
+    virtual void reset() = 0;
+
+    /** Allocates an acceleration structure.
+        \return Handle of the acceleration structure. Handles count up from 0 after reset().
+    */
+    virtual uint createAccelerationStructure(bool topLevel, uint64_t byteSize, const std::string& name) = 0;
+
+    /** (Re)creates the scratch buffer that all builds share.
+    */
+    virtual void createScratch(uint64_t byteSize) = 0;
+
+    /** Uploads the instances the top level builds use.
+    */
+    virtual void setInstances(const std::vector<PhotonASInstance>& instances) = 0;
+
+    /** Records a build into an acceleration structure, including the barriers of the scratch and the destination.
+    */
+    virtual void build(RenderContext* pRenderContext, const PhotonASBuildInputs& inputs, uint dest) = 0;
+
+    /** View for binding a top level acceleration structure. nullptr for the null backend.
+    */
+    virtual ShaderResourceView::SharedPtr getSrv(uint handle) = 0;
+};
+
+#if FALCOR_D3D12
+/** Backend for D3D12 builds of Falcor (PhotonASBackendD3D12.cpp).
+*/
+PhotonASBackend::SharedPtr createD3D12PhotonASBackend();
+#endif
+
+#if FALCOR_GFX
+/** Backend for slang-gfx builds of Falcor, used for Vulkan on Linux (PhotonASBackendVulkan.cpp).
+*/
+PhotonASBackend::SharedPtr createVulkanPhotonASBackend();
+#endif
+
+/** Backend without a device. Records the allocations and builds and counts calls that would be invalid on a GPU:
+    builds into unknown handles, results or scratch buffers smaller than the prebuild sizes of the build and instances
+    of unknown bottom levels. The prebuild sizes grow with the count, depend on the build flag and are not aligned.
+    Created with a device backend, it forwards every call to it and runs the same checks against the prebuild sizes of
+    the device, so a device backend can be validated in a running pass.
+*/
+class NullPhotonASBackend : public PhotonASBackend
+{
+public:
+    using SharedPtr = std::shared_ptr<NullPhotonASBackend>;
+
+    struct Allocation
+    {
+        bool topLevel = false;
+        uint64_t byteSize = 0;
+        std::string name;
+    };
+
+    struct BuildRecord
+    {
+        PhotonASBuildInputs inputs;
+        uint dest = 0;
+    };
+
+    static SharedPtr create();
+
+    /** Validating wrapper of a device backend. Invalid calls are counted and logged.
+    */
+    static SharedPtr create(const PhotonASBackend::SharedPtr& pDevice);
+
+    const std::vector<Allocation>& getAllocations() const { return mAllocations; }
+    const std::vector<BuildRecord>& getBuilds() const { return mBuilds; }
+    const std::vector<PhotonASInstance>& getInstances() const { return mInstances; }
+    uint64_t getScratchBytes() const { return mScratchBytes; }
+    uint getResetCount() const { return mResetCount; }
+    uint getErrorCount() const { return mErrorCount; }
+    void clearBuilds() { mBuilds.clear(); }
+
+    PhotonASBackendType getType() const override { return mpDevice ? mpDevice->getType() : PhotonASBackendType::Null; }
+    PhotonASPrebuildInfo getPrebuildInfo(const PhotonASBuildInputs& inputs) override;
+    void reset() override;
+    uint createAccelerationStructure(bool topLevel, uint64_t byteSize, const std::string& name) override;
+    void createScratch(uint64_t byteSize) override;
+    void setInstances(const std::vector<PhotonASInstance>& instances) override;
+    void build(RenderContext* pRenderContext, const PhotonASBuildInputs& inputs, uint dest) override;
+    ShaderResourceView::SharedPtr getSrv(uint handle) override { return mpDevice ? mpDevice->getSrv(handle) : nullptr; }
+
+private:
+    NullPhotonASBackend() = default;
+
+    void addError(const std::string& msg);
+
+    PhotonASBackend::SharedPtr mpDevice;
+
+    std::vector<Allocation> mAllocations;
+    std::vector<BuildRecord> mBuilds;
+    std::vector<PhotonASInstance> mInstances;
+    uint64_t mScratchBytes = 0;
+    uint mResetCount = 0;
+    uint mErrorCount = 0;
+};
+
+/** Photon acceleration structure of the AS photon mapper: bottom levels of procedural AABBs and a top level with one
+    instance per bottom level. Geometry i is instance i (InstanceID() i) with the instance mask of the geometry.
+    The bottom levels are allocated for the maximum number of AABBs and rebuilt with the current count.
+    All builds share one scratch buffer.
+*/
+class PhotonAccelerationStructure
+{
+public:
+    static const uint32_t kAABBStride = 24;             ///< Min and max as float3, the AABB struct of the shaders
+    static const uint64_t kByteAlignment = 256;         ///< Alignment of the results and the scratch (D3D12 and Vulkan)
+
+    struct Geometry
+    {
+        Buffer::SharedPtr pAabbs;
+        uint maxCount = 0;              ///< Number of AABBs the bottom level is allocated for
+        uint aabbOffset = 0;            ///< Index of the first AABB in pAabbs. Geometries can share a buffer
+        uint instanceMask = 0xFF;
+    };
+
+    /** Backend of the device: D3D12 or Vulkan, depending on the graphics API Falcor was built for.
+        Returns nullptr if the device does not support raytracing.
+    */
+    static PhotonASBackend::SharedPtr createDeviceBackend();
+
+    void setBackend(const PhotonASBackend::SharedPtr& pBackend);
+    bool hasBackend() const { return mpBackend != nullptr; }
+    PhotonASBackendType getBackendType() const { return mpBackend ? mpBackend->getType() : PhotonASBackendType::Null; }
+
+    /** (Re)creates all acceleration structures. Needs a backend.
+    */
+    void create(const std::vector<Geometry>& geometries, bool fastBuild);
+
+    /** Releases all acceleration structures.
+    */
+    void release();
+
+    bool isCreated() const { return !mBlas.empty(); }
+
+    /** Builds the bottom level of a geometry.
+        \param[in] aabbCount Number of AABBs. Clamped to the maximum of the geometry.
+        \return Number of AABBs that were built.
+    */
+    uint buildBottomLevel(RenderContext* pRenderContext, uint geometry, uint aabbCount);
+
+    void buildTopLevel(RenderContext* pRenderContext);
+
+    ShaderResourceView::SharedPtr getSrv() const { return mpSrv; }
+
+    /** Bytes of all results and the scratch buffer.
+    */
+    uint64_t getSizeBytes() const;
+
+private:
+    struct Blas
+    {
+        Geometry geometry;
+        uint handle = 0;
+        uint64_t byteSize = 0;
+    };
+
+    PhotonASBackend::SharedPtr mpBackend;
+    std::vector<Blas> mBlas;
+    uint mTlas = 0;
+    uint64_t mTlasByteSize = 0;
+    uint64_t mScratchByteSize = 0;
+    bool mFastBuild = true;
+    ShaderResourceView::SharedPtr mpSrv;
+};
@@ -0,0 +1,154 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonBufferSizePolicy.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const size_t kTrendWindow = 8;              //Counts the trend is fitted over
+
+    uint64_t nextPowerOfTwo(uint64_t v)
+    {
+        uint64_t p = 1;
+        while (p < v && p < (1ull << 63)) p <<= 1;
+        return p;
+    }
+}
+
+void PhotonBufferSizePolicy::setOptions(const Options& options)
+{
+    mOptions = options;
+    mOptions.granularity = std::max<uint64_t>(mOptions.granularity, 1);
+    mOptions.maxCapacity = std::max(mOptions.maxCapacity, mOptions.minCapacity);
+    //Without enough headroom a buffer that just grew would immediately want to grow again
+    mOptions.headroom = std::max(mOptions.headroom, 1.f / std::max(mOptions.growThreshold, 0.01f) + 0.01f);
+    mOptions.maxShrinkDelay = std::max(mOptions.maxShrinkDelay, mOptions.shrinkDelay);
+    mShrinkDelay = mOptions.shrinkDelay;
+}
+
+void PhotonBufferSizePolicy::setCapacity(uint64_t capacity)
+{
+    if (capacity != mCapacity) mCountsSinceResize = 0;
+    mCapacity = capacity;
+}
+
+void PhotonBufferSizePolicy::reset()
+{
+    mHistory.clear();
+    mCountsSinceResize = 0;
+    mCountsSinceGrow = 0;
+    mShrinkDelay = mOptions.shrinkDelay;
+    mLastResizeWasShrink = false;
+    mStats = {};
+}
+
+uint64_t PhotonBufferSizePolicy::roundCapacity(double capacity) const
+{
+    uint64_t c = static_cast<uint64_t>(std::ceil(std::max(capacity, 1.0)));
+    if (mOptions.powerOfTwo) c = nextPowerOfTwo(c);
+    c = (c + mOptions.granularity - 1) / mOptions.granularity * mOptions.granularity;
+    return std::clamp(c, mOptions.minCapacity, mOptions.maxCapacity);
+}
+
+uint64_t PhotonBufferSizePolicy::getPeak(size_t window) const
+{
+    const size_t n = std::min(window, mHistory.size());
+    return n > 0 ? *std::max_element(mHistory.end() - n, mHistory.end()) : 0;
+}
+
+double PhotonBufferSizePolicy::getTrend(size_t window) const
+{
+    //Least squares slope over the newest counts
+    const size_t n = std::min(window, mHistory.size());
+    if (n < 2) return 0.0;
+    double meanX = (n - 1) * 0.5, meanY = 0.0;
+    for (size_t i = 0; i < n; i++) meanY += static_cast<double>(mHistory[mHistory.size() - n + i]);
+    meanY /= n;
+    double sxy = 0.0, sxx = 0.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const double dx = i - meanX;
+        sxy += dx * (static_cast<double>(mHistory[mHistory.size() - n + i]) - meanY);
+        sxx += dx * dx;
+    }
+    return sxy / sxx;
+}
+
+uint64_t PhotonBufferSizePolicy::addCount(uint64_t count)
+{
+    mHistory.push_back(count);
+    const size_t historySize = std::max<size_t>({ mOptions.peakWindow, mOptions.maxShrinkDelay, kTrendWindow, 1 });
+    while (mHistory.size() > historySize) mHistory.pop_front();
+    mCountsSinceResize++;
+    mCountsSinceGrow++;
+
+    const bool overflow = count > mCapacity;
+    if (overflow) mStats.overflows++;
+
+    //Grow if the peak or the extrapolated count gets close to the capacity
+    const double expected = std::max(static_cast<double>(getPeak(mOptions.peakWindow)), count + std::max(getTrend(kTrendWindow), 0.0) * mOptions.lookahead);
+    if (expected > mOptions.growThreshold * mCapacity)
+    {
+        if (overflow || mCountsSinceResize >= mOptions.minResizeInterval)
+        {
+            const uint64_t target = roundCapacity(expected * mOptions.headroom);
+            if (target > mCapacity)
+            {
+                //Growing again soon after a shrink means the counts peak periodically. The time since the previous grow
+                //is about one period, so wait at least two periods before the next shrink
+                if (mLastResizeWasShrink && mCountsSinceResize < 2 * mShrinkDelay)
+                    mShrinkDelay = std::min(std::max(2 * mShrinkDelay, 2 * mCountsSinceGrow), mOptions.maxShrinkDelay);
+                mLastResizeWasShrink = false;
+                mCapacity = target;
+                mCountsSinceResize = 0;
+                mCountsSinceGrow = 0;
+                mStats.grows++;
+            }
+        }
+        return mCapacity;
+    }
+
+    //Shrink if all counts in the shrink window stayed low
+    if (mHistory.size() >= mShrinkDelay && mCountsSinceResize >= std::max(mShrinkDelay, mOptions.minResizeInterval))
+    {
+        const uint64_t peak = getPeak(mShrinkDelay);
+        if (peak < mOptions.shrinkThreshold * mCapacity)
+        {
+            const uint64_t target = roundCapacity(peak * mOptions.headroom);
+            if (target < mCapacity)
+            {
+                mLastResizeWasShrink = true;
+                mCapacity = target;
+                mCountsSinceResize = 0;
+                mStats.shrinks++;
+            }
+        }
+    }
+    return mCapacity;
+}
@@ -0,0 +1,102 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+/** Automatic sizing of a photon buffer from the history of its photon counter.
+    Grows as soon as the recent peak or the extrapolated trend gets close to the capacity, so the buffer is resized
+    before photons are clamped onto the last slot. Shrinks only after the counts stayed far below the capacity for a
+    longer time. Resizes are rate limited; only an actual overflow may grow the buffer earlier.
+    The policy does not allocate anything, it only decides on capacities. It has no device dependency, so it can be driven by simulated count traces.
+*/
+class PhotonBufferSizePolicy
+{
+public:
+    struct Options
+    {
+        float growThreshold = 0.9f;             ///< Grow once the expected count exceeds this fraction of the capacity
+        float shrinkThreshold = 0.5f;           ///< Shrink once the peak count stayed below this fraction of the capacity
+        float headroom = 1.25f;                 ///< Capacity after a resize relative to the count. headroom * growThreshold has to be > 1 to avoid oscillation
+        uint32_t peakWindow = 16;               ///< Number of counts the peak for growing is taken from
+        uint32_t shrinkDelay = 120;             ///< Number of counts that have to stay below the shrink threshold
+        uint32_t maxShrinkDelay = 1920;         ///< The delay backs off up to this (at least doubling) if the buffer has to grow again shortly after shrinking
+        uint32_t lookahead = 4;                 ///< Counts the trend is extrapolated. Should cover the readback latency
+        uint32_t minResizeInterval = 30;        ///< Minimum number of counts between two resizes. An overflow may grow earlier
+        uint64_t minCapacity = 1024;
+        uint64_t maxCapacity = 1ull << 31;
+        uint64_t granularity = 1;               ///< Capacities are rounded up to a multiple of this
+        bool powerOfTwo = false;                ///< Capacities are rounded up to a power of two (before the granularity)
+    };
+
+    struct Stats
+    {
+        uint32_t grows = 0;
+        uint32_t shrinks = 0;
+        uint32_t overflows = 0;                 ///< Counts that were larger than the capacity
+    };
+
+    void setOptions(const Options& options);
+    const Options& getOptions() const { return mOptions; }
+
+    /** Sets the capacity that is currently allocated, e.g. after a manual resize. Keeps the count history.
+    */
+    void setCapacity(uint64_t capacity);
+    uint64_t getCapacity() const { return mCapacity; }
+
+    /** Clears the count history and the stats, e.g. after a scene change.
+    */
+    void reset();
+
+    /** Adds the newest counter value.
+        \return The capacity the buffer should have. Equal to getCapacity() before the call if no resize is needed.
+    */
+    uint64_t addCount(uint64_t count);
+
+    const Stats& getStats() const { return mStats; }
+
+    uint32_t getShrinkDelay() const { return mShrinkDelay; }
+
+    /** Rounds a capacity with the granularity, power of two and limit options.
+    */
+    uint64_t roundCapacity(double capacity) const;
+
+private:
+    uint64_t getPeak(size_t window) const;
+    double getTrend(size_t window) const;
+
+    Options                 mOptions;
+    uint64_t                mCapacity = 0;
+    std::deque<uint64_t>    mHistory;           ///< Newest count at the back
+    uint32_t                mCountsSinceResize = 0;
+    uint32_t                mCountsSinceGrow = 0;
+    uint32_t                mShrinkDelay = 0;   ///< Current shrink delay, backs off for periodic peaks
+    bool                    mLastResizeWasShrink = false;
+    Stats                   mStats;
+};
@@ -0,0 +1,74 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonGenerationRing.h"
+#include <algorithm>
+#include <cmath>
+
+void PhotonGenerationRing::setGenerationCount(uint generations)
+{
+    generations = std::clamp(generations, 1u, kMaxPhotonGenerations);
+    mWritten.resize(generations);
+    mStale.resize(generations);
+    reset();
+}
+
+void PhotonGenerationRing::reset()
+{
+    //Also slots that were never written, the BLAS may have been recreated
+    mWritten.assign(mWritten.size(), false);
+    mStale.assign(mStale.size(), true);
+    mCurrent = 0;
+    mNext = 0;
+    mValidCount = 0;
+}
+
+uint PhotonGenerationRing::beginGeneration()
+{
+    mCurrent = mNext;
+    mNext = (mNext + 1) % getGenerationCount();
+    mWritten[mCurrent] = true;
+    mStale[mCurrent] = false;
+    mValidCount = std::min(mValidCount + 1, getGenerationCount());
+    return mCurrent;
+}
+
+float PhotonGenerationRing::getWeight(uint slot) const
+{
+    FALCOR_ASSERT(slot < getGenerationCount());
+    return mWritten[slot] ? 1.f / mValidCount : 0.f;
+}
+
+std::vector<uint> PhotonGenerationRing::takeStaleSlots()
+{
+    std::vector<uint> slots;
+    for (uint i = 0; i < getGenerationCount(); i++) {
+        if (mStale[i]) slots.push_back(i);
+        mStale[i] = false;
+    }
+    return slots;
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "PhotonGenerationRing.slang"
+
+using namespace Falcor;
+
+/** Ring of the last photon generations of the AS photon mapper. With a static camera the photons of the last iterations
+    stay in the acceleration structure, each generation in its own slot of the photon buffers with its own BLAS, so a
+    collect ray gathers up to getGenerationCount() times as many photons without tracing more of them.
+    Every generation is a full estimate of the photon density. The collect passes weight a photon with the weight of its
+    slot, 1 / getValidCount() for the slots written since the last reset and 0 for the others. The weighted photon count
+    and flux have the expectation of a single generation, so the radius shrinks as without the ring.
+    The SPPM update deliberately uses this weighted count and not the combined count of all slots. A slot is gathered in
+    up to getGenerationCount() consecutive iterations, so the combined count adds every photon to N that many times. The
+    radius would then shrink as if that many more photons had been traced, and the estimate gets more variance without
+    getting more photons (PhotonGenerationRing_RadiusConvergence).
+*/
+class PhotonGenerationRing
+{
+public:
+    /** Sets the number of generations, clamped to [1, kMaxPhotonGenerations], and resets the ring.
+    */
+    void setGenerationCount(uint generations);
+
+    uint getGenerationCount() const { return uint(mWritten.size()); }
+
+    /** Drops all generations, e.g. if the camera moved or the BLAS were recreated.
+    */
+    void reset();
+
+    /** Starts the next generation and returns its slot. The generation replaces the oldest one once the ring is full.
+    */
+    uint beginGeneration();
+
+    uint getCurrentSlot() const { return mCurrent; }
+
+    /** Number of generations since the last reset, at most getGenerationCount().
+    */
+    uint getValidCount() const { return mValidCount; }
+
+    float getWeight(uint slot) const;
+
+    /** Slots that were written before the last reset and not since. Their BLAS has to be rebuilt without photons once.
+        After a reset all slots but the current one are returned, this also covers newly created BLAS.
+    */
+    std::vector<uint> takeStaleSlots();
+
+private:
+    std::vector<bool> mWritten = { false };     ///< Slot holds a generation since the last reset
+    std::vector<bool> mStale = { true };        ///< Slot needs a BLAS without photons
+    uint mCurrent = 0;
+    uint mNext = 0;
+    uint mValidCount = 0;
+};
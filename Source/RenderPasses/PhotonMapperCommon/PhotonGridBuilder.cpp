@@ -0,0 +1,134 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonGridBuilder.h"
+#include <algorithm>
+#include <atomic>
+
+namespace
+{
+    const size_t kMinParallelCount = 1 << 14;       ///< Smaller ranges are processed on the calling thread
+    const size_t kGrainSize = 1 << 12;
+
+    template<typename Func>
+    void parallelRange(WorkStealingThreadPool* pPool, size_t count, Func func)
+    {
+        if (pPool && count >= kMinParallelCount)
+            pPool->parallelFor(count, kGrainSize, [&](size_t begin, size_t end, uint32_t) { func(begin, end); });
+        else
+            func(0, count);
+    }
+
+    /** Slot of every photon index in the grid, numSlots for photons that are not in the grid.
+    */
+    std::vector<uint> getSlotPerPhoton(const PhotonGridBuilder::Grid& grid, size_t numPhotons)
+    {
+        const uint numSlots = static_cast<uint>(grid.cellStart.size()) - 1;
+        std::vector<uint> slotOf(numPhotons, numSlots);
+        for (uint s = 0; s < numSlots; s++)
+            for (uint i = grid.cellStart[s]; i < grid.cellStart[s + 1] && i < grid.photonIndices.size(); i++)
+                if (grid.photonIndices[i] < numPhotons) slotOf[grid.photonIndices[i]] = s;
+        return slotOf;
+    }
+}
+
+std::vector<uint> PhotonGridBuilder::computeSlots(const std::vector<float3>& positions, float cellScale, SpatialHashFunction function, uint slotBits, WorkStealingThreadPool* pPool)
+{
+    const uint mask = slotBits >= 32 ? ~0u : (1u << slotBits) - 1;
+    std::vector<uint> slots(positions.size());
+    parallelRange(pPool, positions.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            slots[i] = spatialHash(function, int3(floor(positions[i] * cellScale))) & mask;
+    });
+    return slots;
+}
+
+PhotonGridBuilder::Grid PhotonGridBuilder::build(const std::vector<uint>& slots, uint numSlots, WorkStealingThreadPool* pPool)
+{
+    const size_t count = slots.size();
+    Grid grid;
+    grid.cellStart.assign(size_t(numSlots) + 1, 0);
+    grid.photonIndices.resize(count);
+
+    //Count. The old count is the offset of the photon inside its slot
+    std::vector<std::atomic<uint>> counts(numSlots);
+    std::vector<uint> localOffsets(count);
+    parallelRange(pPool, count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            localOffsets[i] = counts[slots[i]].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    //Exclusive prefix sum over chunks of slots: chunk sums, serial scan of the chunk sums, scan inside the chunks
+    const size_t numChunks = pPool && numSlots >= kMinParallelCount ? size_t(pPool->getThreadCount()) * 4 : 1;
+    const size_t chunkSize = (size_t(numSlots) + numChunks - 1) / numChunks;
+    std::vector<uint> chunkOffsets(numChunks, 0);
+    parallelRange(numChunks > 1 ? pPool : nullptr, numChunks, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++)
+            for (size_t s = c * chunkSize; s < std::min(size_t(numSlots), (c + 1) * chunkSize); s++)
+                chunkOffsets[c] += counts[s].load(std::memory_order_relaxed);
+    });
+    uint total = 0;
+    for (uint& o : chunkOffsets) {
+        const uint c = o;
+        o = total;
+        total += c;
+    }
+    parallelRange(numChunks > 1 ? pPool : nullptr, numChunks, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            uint offset = chunkOffsets[c];
+            for (size_t s = c * chunkSize; s < std::min(size_t(numSlots), (c + 1) * chunkSize); s++) {
+                grid.cellStart[s] = offset;
+                offset += counts[s].load(std::memory_order_relaxed);
+            }
+        }
+    });
+    grid.cellStart[numSlots] = total;
+
+    //Scatter
+    parallelRange(pPool, count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            grid.photonIndices[grid.cellStart[slots[i]] + localOffsets[i]] = static_cast<uint>(i);
+    });
+    return grid;
+}
+
+uint64_t PhotonGridBuilder::compare(const Grid& a, const Grid& b)
+{
+    if (a.cellStart.size() != b.cellStart.size() || a.cellStart.empty())
+        return std::max(a.cellStart.size(), b.cellStart.size());
+
+    uint64_t mismatches = 0;
+    for (size_t s = 0; s < a.cellStart.size(); s++)
+        if (a.cellStart[s] != b.cellStart[s]) mismatches++;
+
+    const size_t numPhotons = std::max(a.photonIndices.size(), b.photonIndices.size());
+    const std::vector<uint> slotsA = getSlotPerPhoton(a, numPhotons);
+    const std::vector<uint> slotsB = getSlotPerPhoton(b, numPhotons);
+    for (size_t i = 0; i < numPhotons; i++)
+        if (slotsA[i] != slotsB[i] || slotsA[i] == a.cellStart.size() - 1) mismatches++;
+    return mismatches;
+}
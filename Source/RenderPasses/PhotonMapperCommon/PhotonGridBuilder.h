@@ -0,0 +1,64 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "SpatialHash.slang"
+#include "WorkStealingThreadPool.h"
+
+using namespace Falcor;
+
+/** CPU version of the cell range grid build of the hash passes (PhotonMapperHashGrid.cs.slang).
+    Every photon has a slot, the masked spatial hash of its cell. The build counts the photons per slot, an exclusive prefix
+    sum over the counts gives the start of every slot and the photons are scattered into one compact array. The photons of
+    slot s are [cellStart[s], cellStart[s + 1]). Cells that share a slot share its range, readers filter by cell.
+    Like the GPU the count returns the offset of every photon inside its slot, so the order inside a slot depends on the
+    thread timing. Compare grids with compare(), which ignores the order inside a slot.
+*/
+class PhotonGridBuilder
+{
+public:
+    struct Grid
+    {
+        std::vector<uint> cellStart;        ///< numSlots + 1 entries, the last one is the number of photons
+        std::vector<uint> photonIndices;    ///< Photon indices ordered by slot
+    };
+
+    /** Computes the slot of every photon.
+        \param[in] cellScale Scale from world position to cell (1 / radius).
+    */
+    static std::vector<uint> computeSlots(const std::vector<float3>& positions, float cellScale, SpatialHashFunction function, uint slotBits, WorkStealingThreadPool* pPool = nullptr);
+
+    /** Builds the grid of photons with the given slots.
+        \param[in] pPool Counts and scatters in parallel. Without a pool the build is single threaded.
+    */
+    static Grid build(const std::vector<uint>& slots, uint numSlots, WorkStealingThreadPool* pPool = nullptr);
+
+    /** Number of differing slot starts plus the number of photons that are not in the range of their slot in both grids.
+    */
+    static uint64_t compare(const Grid& a, const Grid& b);
+};
@@ -0,0 +1,489 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonPacking.h"
+#include "SimdUtils.h"
+#include <immintrin.h>
+#include <cstring>
+
+namespace
+{
+    //2 / ln(2) / (2k + 1), series of log2((1 + t) / (1 - t))
+    const float kLog2C1 = 2.88539008f;
+    const float kLog2C3 = 0.96179669f;
+    const float kLog2C5 = 0.57707802f;
+    const float kLog2C7 = 0.41219858f;
+
+    const float kLogLuvU = kLogLuvUVScale * 4.f;
+    const float kLogLuvV = kLogLuvUVScale * 9.f;
+    const float kPosScale = float(1u << kPackedPhotonPosBits);
+    const uint kPosMask = (1u << kPackedPhotonPosBits) - 1;
+    const uint kCellTagMask = (1u << kPackedPhotonCellTagBits) - 1;
+
+    //2^((i + 0.5) / 256), the fractional part of the LogLuv decode
+    const std::array<float, 256> kExp2Table = []() {
+        std::array<float, 256> table;
+        for (uint i = 0; i < 256; i++)
+            table[i] = float(std::exp2((double(i) + 0.5) / double(kLogLuvLogScale)));
+        return table;
+    }();
+
+    uint32_t asUint(float f)
+    {
+        uint32_t u;
+        std::memcpy(&u, &f, sizeof(u));
+        return u;
+    }
+
+    float asFloat(uint32_t u)
+    {
+        float f;
+        std::memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+
+    //Same semantics as _mm256_max_ps/_mm256_min_ps, so the scalar and the AVX2 path agree
+    float maxf(float a, float b) { return a > b ? a : b; }
+    float minf(float a, float b) { return a < b ? a : b; }
+    float clampf(float v, float lo, float hi) { return minf(maxf(v, lo), hi); }
+    float signNotZero(float v) { return v >= 0.f ? 1.f : -1.f; }
+
+    //log2 for positive normal floats. Good to ~2e-5, enough for 8 fractional bits
+    float log2Poly(float y)
+    {
+        const uint32_t bits = asUint(y);
+        const float e = float(int32_t((bits >> 23) & 0xFF) - 127);
+        const float m = asFloat((bits & 0x007FFFFF) | 0x3F800000);
+        const float t = (m - 1.f) / (m + 1.f);
+        const float t2 = t * t;
+        return e + t * (kLog2C1 + t2 * (kLog2C3 + t2 * (kLog2C5 + t2 * kLog2C7)));
+    }
+
+    //2^((le + 0.5) / 256 - 64)
+    float exp2LogLuv(uint32_t le)
+    {
+        const int32_t biased = std::clamp(int32_t(le >> 8) - int32_t(kLogLuvLogBias) + 127, 1, 254);
+        return kExp2Table[le & 0xFF] * asFloat(uint32_t(biased) << 23);
+    }
+
+    uint packSnorm(float v, uint bits)
+    {
+        const float scale = float((1u << (bits - 1)) - 1);
+        return uint(int32_t(std::floor(clampf(v, -1.f, 1.f) * scale + 0.5f))) & ((1u << bits) - 1);
+    }
+
+    float unpackSnorm(uint v, uint bits)
+    {
+        const uint signBit = 1u << (bits - 1);
+        const int32_t i = int32_t(v ^ signBit) - int32_t(signBit);
+        return maxf(float(i) / float(signBit - 1), -1.f);
+    }
+
+    void packScalar(const PhotonPacking::Streams& photons, float cellScale, uint4* out, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const float3 cellPos = float3(photons.pos[0][i], photons.pos[1][i], photons.pos[2][i]) * cellScale;
+            const int3 cell = int3(int32_t(std::floor(cellPos.x)), int32_t(std::floor(cellPos.y)), int32_t(std::floor(cellPos.z)));
+            out[i] = PhotonPacking::packPhoton(float3(photons.flux[0][i], photons.flux[1][i], photons.flux[2][i]),
+                float3(photons.dir[0][i], photons.dir[1][i], photons.dir[2][i]),
+                float3(photons.faceN[0][i], photons.faceN[1][i], photons.faceN[2][i]), cellPos, cell);
+        }
+    }
+
+    void unpackScalar(const uint4* packed, const PhotonPacking::CellStreams& cells, float cellScale, PhotonPacking::Streams& photons, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const uint4& p = packed[i];
+            const float3 pos = PhotonPacking::unpackPosition(p, int3(cells[0][i], cells[1][i], cells[2][i]), cellScale);
+            const float3 flux = PhotonPacking::unpackFlux(p);
+            const float3 dir = PhotonPacking::unpackDir(p);
+            const float3 faceN = PhotonPacking::unpackFaceNormal(p);
+            for (uint c = 0; c < 3; c++)
+            {
+                photons.pos[c][i] = pos[c];
+                photons.flux[c][i] = flux[c];
+                photons.dir[c][i] = dir[c];
+                photons.faceN[c][i] = faceN[c];
+            }
+        }
+    }
+
+    PM_TARGET_AVX2 __m256 absAVX2(__m256 v)
+    {
+        return _mm256_andnot_ps(_mm256_set1_ps(-0.f), v);
+    }
+
+    PM_TARGET_AVX2 __m256 clampAVX2(__m256 v, float lo, float hi)
+    {
+        return _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(lo)), _mm256_set1_ps(hi));
+    }
+
+    PM_TARGET_AVX2 __m256 signNotZeroAVX2(__m256 v)
+    {
+        return _mm256_blendv_ps(_mm256_set1_ps(-1.f), _mm256_set1_ps(1.f), _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ));
+    }
+
+    /** c0 * a + c1 * b + c2 * c, one row of a color matrix.
+    */
+    PM_TARGET_AVX2 __m256 dot3AVX2(float c0, float c1, float c2, __m256 a, __m256 b, __m256 c)
+    {
+        return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(c0), a), _mm256_mul_ps(_mm256_set1_ps(c1), b)), _mm256_mul_ps(_mm256_set1_ps(c2), c));
+    }
+
+    PM_TARGET_AVX2 __m256i packSnormAVX2(__m256 v, uint bits)
+    {
+        const __m256 scale = _mm256_set1_ps(float((1u << (bits - 1)) - 1));
+        const __m256 q = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(clampAVX2(v, -1.f, 1.f), scale), _mm256_set1_ps(0.5f)));
+        return _mm256_and_si256(_mm256_cvttps_epi32(q), _mm256_set1_epi32(int32_t((1u << bits) - 1)));
+    }
+
+    PM_TARGET_AVX2 __m256 unpackSnormAVX2(__m256i v, uint bits)
+    {
+        const uint signBit = 1u << (bits - 1);
+        const __m256i i = _mm256_sub_epi32(_mm256_xor_si256(v, _mm256_set1_epi32(int32_t(signBit))), _mm256_set1_epi32(int32_t(signBit)));
+        return _mm256_max_ps(_mm256_div_ps(_mm256_cvtepi32_ps(i), _mm256_set1_ps(float(signBit - 1))), _mm256_set1_ps(-1.f));
+    }
+
+    PM_TARGET_AVX2 __m256i packOctahedralAVX2(__m256 x, __m256 y, __m256 z, uint bits)
+    {
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 sum = _mm256_add_ps(_mm256_add_ps(absAVX2(x), absAVX2(y)), absAVX2(z));
+        __m256 px = _mm256_div_ps(x, sum);
+        __m256 py = _mm256_div_ps(y, sum);
+        const __m256 wx = _mm256_mul_ps(_mm256_sub_ps(one, absAVX2(py)), signNotZeroAVX2(px));
+        const __m256 wy = _mm256_mul_ps(_mm256_sub_ps(one, absAVX2(px)), signNotZeroAVX2(py));
+        const __m256 lower = _mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_LT_OQ);
+        px = _mm256_blendv_ps(px, wx, lower);
+        py = _mm256_blendv_ps(py, wy, lower);
+        return _mm256_or_si256(packSnormAVX2(px, bits), _mm256_slli_epi32(packSnormAVX2(py, bits), int(bits)));
+    }
+
+    PM_TARGET_AVX2 void unpackOctahedralAVX2(__m256i v, uint bits, __m256& x, __m256& y, __m256& z)
+    {
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256i mask = _mm256_set1_epi32(int32_t((1u << bits) - 1));
+        const __m256 px = unpackSnormAVX2(_mm256_and_si256(v, mask), bits);
+        const __m256 py = unpackSnormAVX2(_mm256_and_si256(_mm256_srli_epi32(v, int(bits)), mask), bits);
+        z = _mm256_sub_ps(_mm256_sub_ps(one, absAVX2(px)), absAVX2(py));
+        const __m256 lower = _mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_LT_OQ);
+        x = _mm256_blendv_ps(px, _mm256_mul_ps(_mm256_sub_ps(one, absAVX2(py)), signNotZeroAVX2(px)), lower);
+        y = _mm256_blendv_ps(py, _mm256_mul_ps(_mm256_sub_ps(one, absAVX2(px)), signNotZeroAVX2(py)), lower);
+        const __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+        x = _mm256_div_ps(x, len);
+        y = _mm256_div_ps(y, len);
+        z = _mm256_div_ps(z, len);
+    }
+
+    PM_TARGET_AVX2 __m256i encodeLogLuvAVX2(__m256 r, __m256 g, __m256 b)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        r = _mm256_max_ps(r, zero);
+        g = _mm256_max_ps(g, zero);
+        b = _mm256_max_ps(b, zero);
+        const __m256 X = dot3AVX2(0.4124564f, 0.3575761f, 0.1804375f, r, g, b);
+        const __m256 Y = dot3AVX2(0.2126729f, 0.7151522f, 0.0721750f, r, g, b);
+        const __m256 Z = dot3AVX2(0.0193339f, 0.1191920f, 0.9503041f, r, g, b);
+
+        //log2Poly
+        const __m256i bits = _mm256_castps_si256(Y);
+        const __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xFF)), _mm256_set1_epi32(127)));
+        const __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+        const __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+        const __m256 t2 = _mm256_mul_ps(t, t);
+        __m256 poly = _mm256_add_ps(_mm256_set1_ps(kLog2C5), _mm256_mul_ps(t2, _mm256_set1_ps(kLog2C7)));
+        poly = _mm256_add_ps(_mm256_set1_ps(kLog2C3), _mm256_mul_ps(t2, poly));
+        poly = _mm256_add_ps(_mm256_set1_ps(kLog2C1), _mm256_mul_ps(t2, poly));
+        const __m256 log2Y = _mm256_add_ps(e, _mm256_mul_ps(t, poly));
+
+        const __m256 le = _mm256_floor_ps(_mm256_mul_ps(_mm256_set1_ps(kLogLuvLogScale), _mm256_add_ps(log2Y, _mm256_set1_ps(kLogLuvLogBias))));
+        const __m256 valid = _mm256_cmp_ps(le, one, _CMP_GE_OQ);
+        const __m256 s = _mm256_add_ps(_mm256_add_ps(X, _mm256_mul_ps(_mm256_set1_ps(15.f), Y)), _mm256_mul_ps(_mm256_set1_ps(3.f), Z));
+        const __m256i ue = _mm256_cvttps_epi32(clampAVX2(_mm256_floor_ps(_mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(kLogLuvU), X), s)), 0.f, 255.f));
+        const __m256i ve = _mm256_cvttps_epi32(clampAVX2(_mm256_floor_ps(_mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(kLogLuvV), Y), s)), 0.f, 255.f));
+        const __m256i lei = _mm256_cvttps_epi32(_mm256_min_ps(le, _mm256_set1_ps(65535.f)));
+        const __m256i code = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(lei, 16), _mm256_slli_epi32(ue, 8)), ve);
+        return _mm256_and_si256(code, _mm256_castps_si256(valid));
+    }
+
+    PM_TARGET_AVX2 void decodeLogLuvAVX2(__m256i v, __m256& r, __m256& g, __m256& b)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 uvScale = _mm256_set1_ps(kLogLuvUVScale);
+        const __m256i le = _mm256_srli_epi32(v, 16);
+        const __m256i byteMask = _mm256_set1_epi32(0xFF);
+
+        //exp2LogLuv
+        __m256i biased = _mm256_add_epi32(_mm256_srli_epi32(le, 8), _mm256_set1_epi32(127 - int32_t(kLogLuvLogBias)));
+        biased = _mm256_min_epi32(_mm256_max_epi32(biased, _mm256_set1_epi32(1)), _mm256_set1_epi32(254));
+        const __m256 frac = _mm256_i32gather_ps(kExp2Table.data(), _mm256_and_si256(le, byteMask), 4);
+        const __m256 Y = _mm256_mul_ps(frac, _mm256_castsi256_ps(_mm256_slli_epi32(biased, 23)));
+
+        const __m256 u = _mm256_div_ps(_mm256_add_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), byteMask)), half), uvScale);
+        const __m256 w = _mm256_div_ps(_mm256_add_ps(_mm256_cvtepi32_ps(_mm256_and_si256(v, byteMask)), half), uvScale);
+        const __m256 w4 = _mm256_mul_ps(_mm256_set1_ps(4.f), w);
+        const __m256 X = _mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(9.f), u), w4), Y);
+        const __m256 zNum = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(12.f), _mm256_mul_ps(_mm256_set1_ps(3.f), u)), _mm256_mul_ps(_mm256_set1_ps(20.f), w));
+        const __m256 Z = _mm256_mul_ps(_mm256_div_ps(zNum, w4), Y);
+
+        //Black where le == 0
+        const __m256 black = _mm256_castsi256_ps(_mm256_cmpeq_epi32(le, _mm256_setzero_si256()));
+        r = _mm256_andnot_ps(black, _mm256_max_ps(dot3AVX2(3.2404542f, -1.5371385f, -0.4985314f, X, Y, Z), zero));
+        g = _mm256_andnot_ps(black, _mm256_max_ps(dot3AVX2(-0.9692660f, 1.8760108f, 0.0415560f, X, Y, Z), zero));
+        b = _mm256_andnot_ps(black, _mm256_max_ps(dot3AVX2(0.0556434f, -0.2040259f, 1.0572252f, X, Y, Z), zero));
+    }
+
+    /** Packs photons in blocks of 8. Returns the number of packed photons, the rest is left for the scalar loop.
+    */
+    PM_TARGET_AVX2 size_t packAVX2(const PhotonPacking::Streams& photons, float cellScale, uint4* out, size_t count)
+    {
+        const __m256 scale = _mm256_set1_ps(cellScale);
+        const __m256 posScale = _mm256_set1_ps(kPosScale);
+        const __m256i cellTagMask = _mm256_set1_epi32(int32_t(kCellTagMask));
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            //Position in the cell and cell tag
+            __m256i q[3];
+            __m256i tag = _mm256_setzero_si256();
+            for (int c = 0; c < 3; c++)
+            {
+                const __m256 cellPos = _mm256_mul_ps(_mm256_loadu_ps(photons.pos[c].data() + i), scale);
+                const __m256 cell = _mm256_floor_ps(cellPos);
+                const __m256 inCell = _mm256_floor_ps(_mm256_mul_ps(_mm256_sub_ps(cellPos, cell), posScale));
+                q[c] = _mm256_cvttps_epi32(clampAVX2(inCell, 0.f, kPosScale - 1.f));
+                const __m256i cellTag = _mm256_and_si256(_mm256_cvttps_epi32(cell), cellTagMask);
+                tag = _mm256_or_si256(tag, _mm256_slli_epi32(cellTag, c * int(kPackedPhotonCellTagBits)));
+            }
+
+            const __m256i px = encodeLogLuvAVX2(_mm256_loadu_ps(photons.flux[0].data() + i), _mm256_loadu_ps(photons.flux[1].data() + i), _mm256_loadu_ps(photons.flux[2].data() + i));
+            const __m256i py = packOctahedralAVX2(_mm256_loadu_ps(photons.dir[0].data() + i), _mm256_loadu_ps(photons.dir[1].data() + i), _mm256_loadu_ps(photons.dir[2].data() + i), kPackedPhotonDirBits);
+            const __m256i faceN = packOctahedralAVX2(_mm256_loadu_ps(photons.faceN[0].data() + i), _mm256_loadu_ps(photons.faceN[1].data() + i), _mm256_loadu_ps(photons.faceN[2].data() + i), kPackedPhotonFaceNBits);
+            const __m256i pz = _mm256_or_si256(faceN, _mm256_slli_epi32(tag, int(kPackedPhotonCellTagShift)));
+            const __m256i pw = _mm256_or_si256(q[0], _mm256_or_si256(_mm256_slli_epi32(q[1], int(kPackedPhotonPosBits)), _mm256_slli_epi32(q[2], int(2 * kPackedPhotonPosBits))));
+
+            //Transpose the x, y, z, w streams into 8 uint4
+            const __m256i t0 = _mm256_unpacklo_epi32(px, py);
+            const __m256i t1 = _mm256_unpackhi_epi32(px, py);
+            const __m256i t2 = _mm256_unpacklo_epi32(pz, pw);
+            const __m256i t3 = _mm256_unpackhi_epi32(pz, pw);
+            const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+            const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+            const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+            const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+            __m256i* dst = reinterpret_cast<__m256i*>(out + i);
+            _mm256_storeu_si256(dst + 0, _mm256_permute2x128_si256(u0, u1, 0x20));
+            _mm256_storeu_si256(dst + 1, _mm256_permute2x128_si256(u2, u3, 0x20));
+            _mm256_storeu_si256(dst + 2, _mm256_permute2x128_si256(u0, u1, 0x31));
+            _mm256_storeu_si256(dst + 3, _mm256_permute2x128_si256(u2, u3, 0x31));
+        }
+        return i;
+    }
+
+    PM_TARGET_AVX2 size_t unpackAVX2(const uint4* packed, const PhotonPacking::CellStreams& cells, float cellScale, PhotonPacking::Streams& photons, size_t count)
+    {
+        const __m256 scale = _mm256_set1_ps(cellScale);
+        const __m256i posMask = _mm256_set1_epi32(int32_t(kPosMask));
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            //Transpose 8 uint4 into x, y, z, w streams
+            const __m256i* src = reinterpret_cast<const __m256i*>(packed + i);
+            const __m256i r0 = _mm256_loadu_si256(src + 0);
+            const __m256i r1 = _mm256_loadu_si256(src + 1);
+            const __m256i r2 = _mm256_loadu_si256(src + 2);
+            const __m256i r3 = _mm256_loadu_si256(src + 3);
+            const __m256i u0 = _mm256_permute2x128_si256(r0, r2, 0x20);
+            const __m256i u1 = _mm256_permute2x128_si256(r0, r2, 0x31);
+            const __m256i u2 = _mm256_permute2x128_si256(r1, r3, 0x20);
+            const __m256i u3 = _mm256_permute2x128_si256(r1, r3, 0x31);
+            const __m256i t0 = _mm256_unpacklo_epi32(u0, u1);
+            const __m256i t1 = _mm256_unpackhi_epi32(u0, u1);
+            const __m256i t2 = _mm256_unpacklo_epi32(u2, u3);
+            const __m256i t3 = _mm256_unpackhi_epi32(u2, u3);
+            const __m256i px = _mm256_unpacklo_epi64(t0, t2);
+            const __m256i py = _mm256_unpackhi_epi64(t0, t2);
+            const __m256i pz = _mm256_unpacklo_epi64(t1, t3);
+            const __m256i pw = _mm256_unpackhi_epi64(t1, t3);
+
+            __m256 v[3];
+            decodeLogLuvAVX2(px, v[0], v[1], v[2]);
+            for (int c = 0; c < 3; c++) _mm256_storeu_ps(photons.flux[c].data() + i, v[c]);
+            unpackOctahedralAVX2(py, kPackedPhotonDirBits, v[0], v[1], v[2]);
+            for (int c = 0; c < 3; c++) _mm256_storeu_ps(photons.dir[c].data() + i, v[c]);
+            unpackOctahedralAVX2(pz, kPackedPhotonFaceNBits, v[0], v[1], v[2]);
+            for (int c = 0; c < 3; c++) _mm256_storeu_ps(photons.faceN[c].data() + i, v[c]);
+
+            for (int c = 0; c < 3; c++)
+            {
+                const __m256 q = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pw, c * int(kPackedPhotonPosBits)), posMask));
+                const __m256 inCell = _mm256_div_ps(_mm256_add_ps(q, _mm256_set1_ps(0.5f)), _mm256_set1_ps(kPosScale));
+                const __m256 cell = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(cells[c].data() + i)));
+                _mm256_storeu_ps(photons.pos[c].data() + i, _mm256_div_ps(_mm256_add_ps(cell, inCell), scale));
+            }
+        }
+        return i;
+    }
+}
+
+void PhotonPacking::Streams::resize(size_t count)
+{
+    for (uint c = 0; c < 3; c++)
+    {
+        pos[c].resize(count);
+        flux[c].resize(count);
+        dir[c].resize(count);
+        faceN[c].resize(count);
+    }
+}
+
+uint PhotonPacking::encodeLogLuv(float3 rgb)
+{
+    const float r = maxf(rgb.x, 0.f);
+    const float g = maxf(rgb.y, 0.f);
+    const float b = maxf(rgb.z, 0.f);
+    const float X = 0.4124564f * r + 0.3575761f * g + 0.1804375f * b;
+    const float Y = 0.2126729f * r + 0.7151522f * g + 0.0721750f * b;
+    const float Z = 0.0193339f * r + 0.1191920f * g + 0.9503041f * b;
+    const float le = std::floor(kLogLuvLogScale * (log2Poly(Y) + kLogLuvLogBias));
+    if (!(le >= 1.f)) return 0;
+    const float s = X + 15.f * Y + 3.f * Z;
+    const uint ue = uint(clampf(std::floor(kLogLuvU * X / s), 0.f, 255.f));
+    const uint ve = uint(clampf(std::floor(kLogLuvV * Y / s), 0.f, 255.f));
+    return (uint(minf(le, 65535.f)) << 16) | (ue << 8) | ve;
+}
+
+float3 PhotonPacking::decodeLogLuv(uint v)
+{
+    const uint le = v >> 16;
+    if (le == 0) return float3(0.f);
+    const float Y = exp2LogLuv(le);
+    const float u = (float((v >> 8) & 0xFF) + 0.5f) / kLogLuvUVScale;
+    const float w = (float(v & 0xFF) + 0.5f) / kLogLuvUVScale;
+    const float X = 9.f * u / (4.f * w) * Y;
+    const float Z = (12.f - 3.f * u - 20.f * w) / (4.f * w) * Y;
+    const float r = 3.2404542f * X - 1.5371385f * Y - 0.4985314f * Z;
+    const float g = -0.9692660f * X + 1.8760108f * Y + 0.0415560f * Z;
+    const float b = 0.0556434f * X - 0.2040259f * Y + 1.0572252f * Z;
+    return float3(maxf(r, 0.f), maxf(g, 0.f), maxf(b, 0.f));
+}
+
+uint PhotonPacking::packOctahedral(float3 n, uint bits)
+{
+    const float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    float px = n.x / sum;
+    float py = n.y / sum;
+    if (n.z < 0.f)
+    {
+        const float wx = (1.f - std::abs(py)) * signNotZero(px);
+        const float wy = (1.f - std::abs(px)) * signNotZero(py);
+        px = wx;
+        py = wy;
+    }
+    return packSnorm(px, bits) | (packSnorm(py, bits) << bits);
+}
+
+float3 PhotonPacking::unpackOctahedral(uint v, uint bits)
+{
+    const uint mask = (1u << bits) - 1;
+    const float px = unpackSnorm(v & mask, bits);
+    const float py = unpackSnorm((v >> bits) & mask, bits);
+    float x = px;
+    float y = py;
+    const float z = 1.f - std::abs(px) - std::abs(py);
+    if (z < 0.f)
+    {
+        x = (1.f - std::abs(py)) * signNotZero(px);
+        y = (1.f - std::abs(px)) * signNotZero(py);
+    }
+    const float len = std::sqrt(x * x + y * y + z * z);
+    return float3(x / len, y / len, z / len);
+}
+
+uint PhotonPacking::getCellTag(int3 cell)
+{
+    return (uint(cell.x) & kCellTagMask) | ((uint(cell.y) & kCellTagMask) << kPackedPhotonCellTagBits) | ((uint(cell.z) & kCellTagMask) << (2 * kPackedPhotonCellTagBits));
+}
+
+uint4 PhotonPacking::packPhoton(float3 flux, float3 dir, float3 faceN, float3 cellPos, int3 cell)
+{
+    uint q[3];
+    for (int c = 0; c < 3; c++)
+        q[c] = uint(clampf(std::floor((cellPos[c] - float(cell[c])) * kPosScale), 0.f, kPosScale - 1.f));
+
+    uint4 p;
+    p.x = encodeLogLuv(flux);
+    p.y = packOctahedral(dir, kPackedPhotonDirBits);
+    p.z = packOctahedral(faceN, kPackedPhotonFaceNBits) | (getCellTag(cell) << kPackedPhotonCellTagShift);
+    p.w = q[0] | (q[1] << kPackedPhotonPosBits) | (q[2] << (2 * kPackedPhotonPosBits));
+    return p;
+}
+
+float3 PhotonPacking::unpackPosition(const uint4& p, int3 cell, float cellScale)
+{
+    float3 pos;
+    for (int c = 0; c < 3; c++)
+    {
+        const float q = float((p.w >> (c * kPackedPhotonPosBits)) & kPosMask);
+        pos[c] = (float(cell[c]) + (q + 0.5f) / kPosScale) / cellScale;
+    }
+    return pos;
+}
+
+void PhotonPacking::computeCells(const Streams& photons, float cellScale, CellStreams& cells)
+{
+    for (uint c = 0; c < 3; c++)
+    {
+        cells[c].resize(photons.size());
+        for (size_t i = 0; i < photons.size(); i++)
+            cells[c][i] = int32_t(std::floor(photons.pos[c][i] * cellScale));
+    }
+}
+
+void PhotonPacking::pack(const Streams& photons, float cellScale, std::vector<uint4>& packed, bool useAVX2)
+{
+    const size_t count = photons.size();
+    packed.resize(count);
+    size_t begin = 0;
+    if (useAVX2 && PhotonMapperSimd::hasAVX2())
+        begin = packAVX2(photons, cellScale, packed.data(), count);
+    packScalar(photons, cellScale, packed.data(), begin, count);
+}
+
+void PhotonPacking::unpack(const std::vector<uint4>& packed, const CellStreams& cells, float cellScale, Streams& photons, bool useAVX2)
+{
+    const size_t count = packed.size();
+    FALCOR_ASSERT(cells[0].size() >= count && cells[1].size() >= count && cells[2].size() >= count);
+    photons.resize(count);
+    size_t begin = 0;
+    if (useAVX2 && PhotonMapperSimd::hasAVX2())
+        begin = unpackAVX2(packed.data(), cells, cellScale, photons, count);
+    unpackScalar(packed.data(), cells, cellScale, photons, begin, count);
+}
@@ -0,0 +1,89 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "PhotonPacking.slang"
+#include <array>
+
+using namespace Falcor;
+
+/** CPU side of the compact 16 byte photon format (see PhotonPacking.slang).
+    The scalar functions follow the shader functions. Luminance uses a polynomial log2 and a table exp2 instead of the
+    hardware versions, so the CPU and the GPU can differ by one luminance step at step boundaries. The scalar and the
+    AVX2 batch path give the same codes, unless the compiler contracts the AVX2 multiply-adds into FMAs.
+*/
+class PhotonPacking
+{
+public:
+    /** Photon attributes as SoA streams, the layout the CPU tools and the AVX2 kernels work on.
+    */
+    struct Streams
+    {
+        std::array<std::vector<float>, 3> pos;
+        std::array<std::vector<float>, 3> flux;
+        std::array<std::vector<float>, 3> dir;
+        std::array<std::vector<float>, 3> faceN;
+
+        void resize(size_t count);
+        size_t size() const { return pos[0].size(); }
+    };
+
+    /** Cell of every photon as x, y, z streams.
+    */
+    using CellStreams = std::array<std::vector<int32_t>, 3>;
+
+    static uint encodeLogLuv(float3 rgb);
+    static float3 decodeLogLuv(uint v);
+    static uint packOctahedral(float3 n, uint bits);
+    static float3 unpackOctahedral(uint v, uint bits);
+    static uint getCellTag(int3 cell);
+
+    /** Packs a photon, see packPhoton() in PhotonPacking.slang.
+        \param[in] cellPos Position in cell units (world position * cell scale).
+        \param[in] cell floor(cellPos).
+    */
+    static uint4 packPhoton(float3 flux, float3 dir, float3 faceN, float3 cellPos, int3 cell);
+    static float3 unpackFlux(const uint4& p) { return decodeLogLuv(p.x); }
+    static float3 unpackDir(const uint4& p) { return unpackOctahedral(p.y, kPackedPhotonDirBits); }
+    static float3 unpackFaceNormal(const uint4& p) { return unpackOctahedral(p.z, kPackedPhotonFaceNBits); }
+    static bool isInCell(const uint4& p, int3 cell) { return (p.z >> kPackedPhotonCellTagShift) == getCellTag(cell); }
+    static float3 unpackPosition(const uint4& p, int3 cell, float cellScale);
+
+    /** Computes the cell of every photon, floor(pos * cellScale).
+    */
+    static void computeCells(const Streams& photons, float cellScale, CellStreams& cells);
+
+    /** Packs all photons. packed is resized to the photon count.
+        \param[in] useAVX2 Uses the AVX2 kernel if the CPU supports it, the scalar loop otherwise.
+    */
+    static void pack(const Streams& photons, float cellScale, std::vector<uint4>& packed, bool useAVX2 = true);
+
+    /** Unpacks all photons. The cells are the ones a lookup would search, usually the cells from computeCells().
+    */
+    static void unpack(const std::vector<uint4>& packed, const CellStreams& cells, float cellScale, Streams& photons, bool useAVX2 = true);
+};
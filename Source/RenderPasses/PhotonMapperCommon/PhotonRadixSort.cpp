@@ -0,0 +1,169 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonRadixSort.h"
+#include <algorithm>
+
+namespace
+{
+    const char kShaderFile[] = "RenderPasses/PhotonMapperCommon/PhotonRadixSort.cs.slang";
+
+    const uint kCpuRadix = 1u << PhotonRadixSort::kCpuRadixBits;
+    const size_t kCpuMinTileSize = 1 << 16;         ///< Smaller tiles cost more in the serial scan than they save
+
+    Buffer::SharedPtr createUintBuffer(uint count)
+    {
+        return Buffer::createStructured(sizeof(uint), count, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+    }
+}
+
+void PhotonRadixSort::createPasses()
+{
+    Program::DefineList defines;
+    defines.add("GROUP_SIZE", std::to_string(kGroupSize));
+    defines.add("ITEMS_PER_THREAD", std::to_string(kItemsPerThread));
+    defines.add("RADIX_BITS", std::to_string(kRadixBits));
+
+    auto createPass = [&](const char* entry) {
+        Program::Desc desc;
+        desc.addShaderLibrary(kShaderFile).csEntry(entry).setShaderModel("6_5");
+        return ComputePass::create(desc, defines, true);
+    };
+    mpHistogramPass = createPass("histogram");
+    mpScanPass = createPass("scan");
+    mpScatterPass = createPass("scatter");
+}
+
+void PhotonRadixSort::sort(RenderContext* pRenderContext, const Buffer::SharedPtr& pKeys, const Buffer::SharedPtr& pValues, uint count, uint keyBits)
+{
+    FALCOR_ASSERT(pKeys && pValues && pKeys->getElementCount() >= count && pValues->getElementCount() >= count);
+    if (count == 0) return;
+    if (!mpHistogramPass) createPasses();
+
+    const uint tileSize = kGroupSize * kItemsPerThread;
+    const uint numTiles = (count + tileSize - 1) / tileSize;
+    if (!mpKeysTemp || mpKeysTemp->getElementCount() < count) {
+        mpKeysTemp = createUintBuffer(count);
+        mpKeysTemp->setName("PhotonRadixSort::KeysTemp");
+        mpValuesTemp = createUintBuffer(count);
+        mpValuesTemp->setName("PhotonRadixSort::ValuesTemp");
+    }
+    if (!mpTileCounts || mpTileCounts->getElementCount() < (1u << kRadixBits) * numTiles) {
+        mpTileCounts = createUintBuffer((1u << kRadixBits) * numTiles);
+        mpTileCounts->setName("PhotonRadixSort::TileCounts");
+    }
+
+    Buffer::SharedPtr pKeysIn = pKeys, pValuesIn = pValues;
+    Buffer::SharedPtr pKeysOut = mpKeysTemp, pValuesOut = mpValuesTemp;
+    const uint numPasses = (std::min(keyBits, 32u) + kRadixBits - 1) / kRadixBits;
+    for (uint pass = 0; pass < numPasses; pass++)
+    {
+        for (ComputePass* pPass : { mpHistogramPass.get(), mpScanPass.get(), mpScatterPass.get() }) {
+            auto var = pPass->getRootVar();
+            var["CB"]["gCount"] = count;
+            var["CB"]["gShift"] = pass * kRadixBits;
+            var["CB"]["gNumTiles"] = numTiles;
+            var["gTileCounts"] = mpTileCounts;
+        }
+        mpHistogramPass->getRootVar()["gKeysIn"] = pKeysIn;
+        auto scatterVar = mpScatterPass->getRootVar();
+        scatterVar["gKeysIn"] = pKeysIn;
+        scatterVar["gValuesIn"] = pValuesIn;
+        scatterVar["gKeysOut"] = pKeysOut;
+        scatterVar["gValuesOut"] = pValuesOut;
+
+        mpHistogramPass->execute(pRenderContext, uint3(numTiles * kGroupSize, 1, 1));
+        pRenderContext->uavBarrier(mpTileCounts.get());
+        mpScanPass->execute(pRenderContext, uint3(kGroupSize, 1, 1));
+        pRenderContext->uavBarrier(mpTileCounts.get());
+        mpScatterPass->execute(pRenderContext, uint3(numTiles * kGroupSize, 1, 1));
+
+        std::swap(pKeysIn, pKeysOut);
+        std::swap(pValuesIn, pValuesOut);
+    }
+
+    //After an odd number of passes the result is in the temp buffers
+    if (pKeysIn != pKeys) {
+        pRenderContext->copyBufferRegion(pKeys.get(), 0, pKeysIn.get(), 0, sizeof(uint) * count);
+        pRenderContext->copyBufferRegion(pValues.get(), 0, pValuesIn.get(), 0, sizeof(uint) * count);
+    }
+}
+
+void PhotonRadixSort::sortCpu(std::vector<uint>& keys, std::vector<uint>& values, uint keyBits, WorkStealingThreadPool* pPool)
+{
+    FALCOR_ASSERT(keys.size() == values.size());
+    const size_t count = keys.size();
+    if (count <= 1) return;
+
+    const size_t maxTiles = pPool ? size_t(pPool->getThreadCount()) * 4 : 1;
+    const size_t numTiles = std::clamp<size_t>((count + kCpuMinTileSize - 1) / kCpuMinTileSize, 1, maxTiles);
+    const size_t tileSize = (count + numTiles - 1) / numTiles;
+    auto forEachTile = [&](const std::function<void(size_t)>& func) {
+        if (pPool)
+            pPool->parallelFor(numTiles, 1, [&](size_t begin, size_t end, uint32_t) { for (size_t t = begin; t < end; t++) func(t); });
+        else
+            for (size_t t = 0; t < numTiles; t++) func(t);
+    };
+
+    std::vector<uint> keysTemp(count), valuesTemp(count);
+    std::vector<size_t> offsets(kCpuRadix * numTiles);     //Digit major, like the GPU tile counts
+    const uint numPasses = (std::min(keyBits, 32u) + kCpuRadixBits - 1) / kCpuRadixBits;
+    for (uint pass = 0; pass < numPasses; pass++)
+    {
+        const uint shift = pass * kCpuRadixBits;
+        forEachTile([&](size_t tile) {
+            size_t counts[kCpuRadix] = {};
+            const size_t end = std::min(count, (tile + 1) * tileSize);
+            for (size_t i = tile * tileSize; i < end; i++)
+                counts[(keys[i] >> shift) & (kCpuRadix - 1)]++;
+            for (uint d = 0; d < kCpuRadix; d++)
+                offsets[d * numTiles + tile] = counts[d];
+        });
+
+        size_t offset = 0;
+        for (size_t& o : offsets) {
+            const size_t c = o;
+            o = offset;
+            offset += c;
+        }
+
+        forEachTile([&](size_t tile) {
+            size_t dst[kCpuRadix];
+            for (uint d = 0; d < kCpuRadix; d++)
+                dst[d] = offsets[d * numTiles + tile];
+            const size_t end = std::min(count, (tile + 1) * tileSize);
+            for (size_t i = tile * tileSize; i < end; i++) {
+                const size_t o = dst[(keys[i] >> shift) & (kCpuRadix - 1)]++;
+                keysTemp[o] = keys[i];
+                valuesTemp[o] = values[i];
+            }
+        });
+
+        keys.swap(keysTemp);
+        values.swap(valuesTemp);
+    }
+}
@@ -0,0 +1,66 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "WorkStealingThreadPool.h"
+
+using namespace Falcor;
+
+/** Stable LSD radix sort of uint key/value pairs on the GPU (PhotonRadixSort.cs.slang) with a parallel CPU reference.
+    Both sort tiles of keys: every tile counts its digits, an exclusive prefix sum over the digit major counts gives the
+    output offset of every digit of every tile, then every tile scatters its keys in order. The GPU sorts 4 bits per pass,
+    the CPU 8 bits.
+*/
+class PhotonRadixSort
+{
+public:
+    static const uint kGroupSize = 256;
+    static const uint kItemsPerThread = 8;
+    static const uint kRadixBits = 4;                   ///< Key bits per GPU pass
+    static const uint kCpuRadixBits = 8;                ///< Key bits per CPU pass
+
+    /** Sorts the first count key/value pairs of two structured uint buffers by key. The result is in the same buffers.
+        \param[in] keyBits Number of low key bits that are sorted. Rounded up to whole passes.
+    */
+    void sort(RenderContext* pRenderContext, const Buffer::SharedPtr& pKeys, const Buffer::SharedPtr& pValues, uint count, uint keyBits = 32);
+
+    /** CPU version of the sort.
+        \param[in] pPool Sorts the tiles in parallel. Without a pool the sort is single threaded.
+    */
+    static void sortCpu(std::vector<uint>& keys, std::vector<uint>& values, uint keyBits = 32, WorkStealingThreadPool* pPool = nullptr);
+
+private:
+    void createPasses();
+
+    ComputePass::SharedPtr mpHistogramPass;
+    ComputePass::SharedPtr mpScanPass;
+    ComputePass::SharedPtr mpScatterPass;
+    Buffer::SharedPtr mpKeysTemp;                   ///< Ping-pong buffers of the passes
+    Buffer::SharedPtr mpValuesTemp;
+    Buffer::SharedPtr mpTileCounts;
+};
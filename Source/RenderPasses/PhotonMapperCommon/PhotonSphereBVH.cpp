@@ -0,0 +1,539 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonSphereBVH.h"
+#include "PhotonRadixSort.h"
+#include "SpatialHash.slang"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    const uint kNumBins = 16;
+    const uint kMaxSahLeafSize = 16;                ///< Nodes up to this size become leaves if no split is cheaper
+    const uint kMaxDepth = 64;
+    const uint kStackSize = 128;                    ///< LBVH trees can be deeper than kMaxDepth with many equal Morton codes
+    const uint kMortonBits = 10;                    ///< Bits per axis
+    const size_t kMinParallelCount = 1 << 14;       ///< Smaller ranges are processed on the calling thread
+    const size_t kGrainSize = 1 << 12;
+    const float kFloatMax = std::numeric_limits<float>::max();
+
+    struct CentroidBounds
+    {
+        float3 cMin = float3(kFloatMax);
+        float3 cMax = float3(-kFloatMax);
+        uint count = 0;
+
+        void grow(const float3& c)
+        {
+            cMin = glm::min(cMin, c);
+            cMax = glm::max(cMax, c);
+            count++;
+        }
+
+        void grow(const CentroidBounds& b)
+        {
+            cMin = glm::min(cMin, b.cMin);
+            cMax = glm::max(cMax, b.cMax);
+            count += b.count;
+        }
+    };
+
+    struct BinSet
+    {
+        CentroidBounds bins[3][kNumBins];
+    };
+
+    float surfaceArea(const float3& bMin, const float3& bMax)
+    {
+        float3 e = bMax - bMin;
+        return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    /** Radius the bounds are built with. The padding keeps the box test conservative against the rounding of the sphere test.
+    */
+    float getBoundsRadius(float radius)
+    {
+        return radius * (1.f + 1e-5f);
+    }
+
+    float3 lowerBound(const float3& c, float r)
+    {
+        const float3 b = c - r;
+        return float3(std::nextafter(b.x, -kFloatMax), std::nextafter(b.y, -kFloatMax), std::nextafter(b.z, -kFloatMax));
+    }
+
+    float3 upperBound(const float3& c, float r)
+    {
+        const float3 b = c + r;
+        return float3(std::nextafter(b.x, kFloatMax), std::nextafter(b.y, kFloatMax), std::nextafter(b.z, kFloatMax));
+    }
+
+    bool isInside(const float3& p, const float3& bMin, const float3& bMax)
+    {
+        return p.x >= bMin.x && p.y >= bMin.y && p.z >= bMin.z && p.x <= bMax.x && p.y <= bMax.y && p.z <= bMax.z;
+    }
+
+    uint countLeadingZeros(uint v)
+    {
+        if (v == 0) return 32;
+        uint n = 0;
+        if ((v & 0xFFFF0000u) == 0) { n += 16; v <<= 16; }
+        if ((v & 0xFF000000u) == 0) { n += 8; v <<= 8; }
+        if ((v & 0xF0000000u) == 0) { n += 4; v <<= 4; }
+        if ((v & 0xC0000000u) == 0) { n += 2; v <<= 2; }
+        if ((v & 0x80000000u) == 0) { n += 1; }
+        return n;
+    }
+
+    template<typename Func>
+    void parallelRange(WorkStealingThreadPool* pPool, size_t count, Func func)
+    {
+        if (pPool && count >= kMinParallelCount)
+            pPool->parallelFor(count, kGrainSize, [&](size_t begin, size_t end, uint32_t) { func(begin, end); });
+        else
+            func(0, count);
+    }
+
+    /** Reduces a range with one partial result per thread. func(partial, begin, end) processes a chunk, merge(a, b) adds b to a.
+    */
+    template<typename T, typename Func, typename Merge>
+    T parallelReduce(WorkStealingThreadPool* pPool, size_t count, Func func, Merge merge)
+    {
+        T result;
+        if (!pPool || count < kMinParallelCount) {
+            func(result, 0, count);
+            return result;
+        }
+        std::vector<T> partials(pPool->getThreadCount());
+        pPool->parallelFor(count, kGrainSize, [&](size_t begin, size_t end, uint32_t threadIndex) { func(partials[threadIndex], begin, end); });
+        for (const T& p : partials) merge(result, p);
+        return result;
+    }
+
+    uint getBin(float c, float cMin, float binScale)
+    {
+        return std::min(kNumBins - 1, static_cast<uint>((c - cMin) * binScale));
+    }
+}
+
+void PhotonSphereBVH::build(const std::vector<float3>& centers, float radius, BuildMode mode, WorkStealingThreadPool* pPool)
+{
+    mRadius = radius;
+    mNodes.clear();
+    mPhotonIndices.resize(centers.size());
+    if (mode == BuildMode::LBVH)
+        buildLBVH(centers, pPool);
+    else
+        buildBinnedSAH(centers, pPool);
+
+    //Store the centers in leaf order so leaves touch contiguous memory
+    mCenters.resize(centers.size());
+    parallelRange(pPool, centers.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            mCenters[i] = centers[mPhotonIndices[i]];
+    });
+}
+
+void PhotonSphereBVH::buildLBVH(const std::vector<float3>& centers, WorkStealingThreadPool* pPool)
+{
+    const uint count = static_cast<uint>(centers.size());
+    if (count == 0) return;
+
+    //Morton codes of the centers in the bounds of all centers
+    const CentroidBounds bounds = parallelReduce<CentroidBounds>(pPool, count,
+        [&](CentroidBounds& b, size_t begin, size_t end) { for (size_t i = begin; i < end; i++) b.grow(centers[i]); },
+        [](CentroidBounds& a, const CentroidBounds& b) { a.grow(b); });
+    const float3 extent = bounds.cMax - bounds.cMin;
+    const float gridMax = float((1u << kMortonBits) - 1);
+    const float3 scale = float3(extent.x > 0.f ? gridMax / extent.x : 0.f, extent.y > 0.f ? gridMax / extent.y : 0.f, extent.z > 0.f ? gridMax / extent.z : 0.f);
+
+    std::vector<uint> keys(count);
+    parallelRange(pPool, count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const float3 q = glm::clamp((centers[i] - bounds.cMin) * scale, float3(0.f), float3(gridMax));
+            keys[i] = hashMorton(int3(q));
+            mPhotonIndices[i] = static_cast<uint>(i);
+        }
+    });
+    //The sort is stable, so photons with the same code stay in index order
+    PhotonRadixSort::sortCpu(keys, mPhotonIndices, 3 * kMortonBits, pPool);
+
+    //Leaves are clusters of kLbvhLeafSize consecutive photons. Inner nodes are [0, numLeaves - 1), leaves follow
+    const uint numLeaves = (count + kLbvhLeafSize - 1) / kLbvhLeafSize;
+    const uint numInner = numLeaves - 1;
+    mNodes.resize(size_t(numInner) + numLeaves);
+    std::vector<uint> parents(mNodes.size(), kInvalidIndex);
+
+    //Common prefix of the codes of two leaves. Equal codes are ordered by the leaf index
+    auto delta = [&](int i, int j) -> int {
+        if (j < 0 || j >= int(numLeaves)) return -1;
+        const uint ki = keys[size_t(i) * kLbvhLeafSize];
+        const uint kj = keys[size_t(j) * kLbvhLeafSize];
+        if (ki == kj) return 32 + int(countLeadingZeros(uint(i) ^ uint(j)));
+        return int(countLeadingZeros(ki ^ kj));
+    };
+
+    //Every inner node finds its leaf range and split independently (Karras 2012)
+    parallelRange(pPool, numInner, [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++) {
+            const int i = static_cast<int>(n);
+            const int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+
+            //Upper bound of the range length, then binary search of the other end
+            const int deltaMin = delta(i, i - d);
+            int lengthMax = 2;
+            while (delta(i, i + lengthMax * d) > deltaMin) lengthMax *= 2;
+            int length = 0;
+            for (int t = lengthMax / 2; t >= 1; t /= 2)
+                if (delta(i, i + (length + t) * d) > deltaMin) length += t;
+            const int j = i + length * d;
+
+            //Binary search of the split position
+            const int deltaNode = delta(i, j);
+            int split = 0;
+            for (int div = 2; ; div *= 2) {
+                const int t = (length + div - 1) / div;
+                if (delta(i, i + (split + t) * d) > deltaNode) split += t;
+                if (t == 1) break;
+            }
+            const int gamma = i + split * d + std::min(d, 0);
+
+            const uint left = std::min(i, j) == gamma ? numInner + gamma : gamma;
+            const uint right = std::max(i, j) == gamma + 1 ? numInner + gamma + 1 : gamma + 1;
+            mNodes[n].leftOrFirst = left;
+            mNodes[n].rightOrCount = right;
+            parents[left] = static_cast<uint>(n);
+            parents[right] = static_cast<uint>(n);
+        }
+    });
+
+    //Leaf bounds, then merge up. The second child that arrives at a node computes its bounds
+    const float boundsRadius = getBoundsRadius(mRadius);
+    std::vector<std::atomic<uint>> visits(numInner);
+    parallelRange(pPool, numLeaves, [&](size_t begin, size_t end) {
+        for (size_t leaf = begin; leaf < end; leaf++) {
+            const uint first = static_cast<uint>(leaf) * kLbvhLeafSize;
+            const uint leafCount = std::min(kLbvhLeafSize, count - first);
+            CentroidBounds b;
+            for (uint i = first; i < first + leafCount; i++) b.grow(centers[mPhotonIndices[i]]);
+
+            uint node = numInner + static_cast<uint>(leaf);
+            mNodes[node].boundsMin = lowerBound(b.cMin, boundsRadius);
+            mNodes[node].boundsMax = upperBound(b.cMax, boundsRadius);
+            mNodes[node].leftOrFirst = first;
+            mNodes[node].rightOrCount = kLeafFlag | leafCount;
+
+            for (node = parents[node]; node != kInvalidIndex; node = parents[node]) {
+                if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0) break;
+                const Node& left = mNodes[mNodes[node].leftOrFirst];
+                const Node& right = mNodes[mNodes[node].rightOrCount];
+                mNodes[node].boundsMin = glm::min(left.boundsMin, right.boundsMin);
+                mNodes[node].boundsMax = glm::max(left.boundsMax, right.boundsMax);
+            }
+        }
+    });
+}
+
+void PhotonSphereBVH::buildBinnedSAH(const std::vector<float3>& centers, WorkStealingThreadPool* pPool)
+{
+    const uint count = static_cast<uint>(centers.size());
+    if (count == 0) return;
+
+    //The splits partition centers and indices together, so the passes over a range read contiguous memory
+    std::vector<BuildPhoton> photons(count);
+    parallelRange(pPool, count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) photons[i] = { centers[i], static_cast<uint>(i) };
+    });
+
+    //Split the top levels with parallel binning until there are enough subtrees for all threads.
+    //The children get their centroid bounds from the bins, only the root bounds need a pass over the photons
+    const CentroidBounds bounds = parallelReduce<CentroidBounds>(pPool, count,
+        [&](CentroidBounds& b, size_t begin, size_t end) { for (size_t i = begin; i < end; i++) b.grow(centers[i]); },
+        [](CentroidBounds& a, const CentroidBounds& b) { a.grow(b); });
+    const uint subtreeSize = pPool ? std::max(static_cast<uint>(kMinParallelCount), count / (4 * pPool->getThreadCount())) : count;
+    mNodes.push_back({});
+    std::vector<BuildTask> subtrees;
+    buildNodesSAH(photons, { 0, 0, count, 0, bounds.cMin, bounds.cMax }, subtreeSize, pPool, mNodes, subtrees);
+
+    //Build the subtrees on the threads, biggest first, and append their nodes
+    std::sort(subtrees.begin(), subtrees.end(), [](const BuildTask& a, const BuildTask& b) { return a.count > b.count; });
+    std::vector<std::vector<Node>> subtreeNodes(subtrees.size());
+    auto buildSubtrees = [&](size_t begin, size_t end, uint32_t) {
+        for (size_t s = begin; s < end; s++) {
+            std::vector<BuildTask> unused;
+            BuildTask task = subtrees[s];
+            task.node = 0;
+            subtreeNodes[s].push_back({});
+            buildNodesSAH(photons, task, 0, nullptr, subtreeNodes[s], unused);
+        }
+    };
+    if (pPool && subtrees.size() > 1)
+        pPool->parallelFor(subtrees.size(), 1, buildSubtrees);
+    else
+        buildSubtrees(0, subtrees.size(), 0);
+
+    for (size_t s = 0; s < subtrees.size(); s++) {
+        //Local node k > 0 is appended at base + k - 1
+        const uint base = static_cast<uint>(mNodes.size());
+        auto remap = [&](Node node) {
+            if (!(node.rightOrCount & kLeafFlag)) {
+                node.leftOrFirst += base - 1;
+                node.rightOrCount += base - 1;
+            }
+            return node;
+        };
+        const std::vector<Node>& nodes = subtreeNodes[s];
+        mNodes[subtrees[s].node] = remap(nodes[0]);
+        for (size_t k = 1; k < nodes.size(); k++) mNodes.push_back(remap(nodes[k]));
+    }
+
+    parallelRange(pPool, count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) mPhotonIndices[i] = photons[i].index;
+    });
+}
+
+void PhotonSphereBVH::buildNodesSAH(std::vector<BuildPhoton>& photons, const BuildTask& root, uint subtreeSize, WorkStealingThreadPool* pPool, std::vector<Node>& nodes, std::vector<BuildTask>& subtrees)
+{
+    const float boundsRadius = getBoundsRadius(mRadius);
+    std::vector<BuildTask> tasks = { root };
+    while (!tasks.empty())
+    {
+        const BuildTask task = tasks.back();
+        tasks.pop_back();
+        if (task.count <= subtreeSize) {
+            subtrees.push_back(task);
+            continue;
+        }
+
+        nodes[task.node].boundsMin = lowerBound(task.cMin, boundsRadius);
+        nodes[task.node].boundsMax = upperBound(task.cMax, boundsRadius);
+        BuildTask left, right;
+        if (!splitSAH(photons, task, pPool, left, right)) {
+            nodes[task.node].leftOrFirst = task.first;
+            nodes[task.node].rightOrCount = kLeafFlag | task.count;
+            continue;
+        }
+
+        left.node = static_cast<uint>(nodes.size());
+        right.node = left.node + 1;
+        nodes.resize(nodes.size() + 2);
+        nodes[task.node].leftOrFirst = left.node;
+        nodes[task.node].rightOrCount = right.node;
+        tasks.push_back(left);
+        tasks.push_back(right);
+    }
+}
+
+bool PhotonSphereBVH::splitSAH(std::vector<BuildPhoton>& photons, const BuildTask& task, WorkStealingThreadPool* pPool, BuildTask& left, BuildTask& right) const
+{
+    if (task.count <= kMaxLeafSize || task.depth >= kMaxDepth)
+        return false;
+
+    BuildPhoton* pPhotons = photons.data() + task.first;
+    const float3 extent = task.cMax - task.cMin;
+    float3 binScale;
+    for (int axis = 0; axis < 3; axis++) binScale[axis] = extent[axis] > 0.f ? kNumBins / extent[axis] : 0.f;
+    const BinSet binSet = parallelReduce<BinSet>(pPool, task.count,
+        [&](BinSet& s, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const float3& c = pPhotons[i].center;
+                for (int axis = 0; axis < 3; axis++)
+                    if (extent[axis] > 0.f) s.bins[axis][getBin(c[axis], task.cMin[axis], binScale[axis])].grow(c);
+            }
+        },
+        [](BinSet& a, const BinSet& b) {
+            for (int axis = 0; axis < 3; axis++)
+                for (uint i = 0; i < kNumBins; i++) a.bins[axis][i].grow(b.bins[axis][i]);
+        });
+
+    //All spheres have the same radius, so the bounds of a bin are its centroid bounds grown by the radius
+    float bestCost = kFloatMax;
+    int bestAxis = -1;
+    uint bestBin = 0;
+    CentroidBounds bestLeft, bestRight;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent[axis] <= 0.f) continue;
+        const CentroidBounds* bins = binSet.bins[axis];
+
+        //Sweep from the right to get the suffix bounds, then evaluate from the left
+        CentroidBounds rightBounds[kNumBins];
+        for (uint b = kNumBins - 1; b > 0; b--)
+        {
+            rightBounds[b] = b + 1 < kNumBins ? rightBounds[b + 1] : CentroidBounds();
+            rightBounds[b].grow(bins[b]);
+        }
+        CentroidBounds acc;
+        for (uint b = 0; b < kNumBins - 1; b++)
+        {
+            acc.grow(bins[b]);
+            const CentroidBounds& r = rightBounds[b + 1];
+            if (acc.count == 0 || r.count == 0) continue;
+            float cost = acc.count * surfaceArea(acc.cMin - mRadius, acc.cMax + mRadius) + r.count * surfaceArea(r.cMin - mRadius, r.cMax + mRadius);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+                bestLeft = acc;
+                bestRight = r;
+            }
+        }
+    }
+    if (bestAxis < 0)
+        return false;
+
+    //Small nodes stay leaves if testing all spheres is cheaper than the traversal step and the children
+    const float nodeArea = surfaceArea(task.cMin - mRadius, task.cMax + mRadius);
+    if (task.count <= kMaxSahLeafSize && bestCost + nodeArea >= task.count * nodeArea)
+        return false;
+
+    std::partition(pPhotons, pPhotons + task.count, [&](const BuildPhoton& p) {
+        return getBin(p.center[bestAxis], task.cMin[bestAxis], binScale[bestAxis]) <= bestBin;
+    });
+    left = { kInvalidIndex, task.first, bestLeft.count, task.depth + 1, bestLeft.cMin, bestLeft.cMax };
+    right = { kInvalidIndex, task.first + bestLeft.count, bestRight.count, task.depth + 1, bestRight.cMin, bestRight.cMax };
+    return true;
+}
+
+void PhotonSphereBVH::query(const float3& posW, std::vector<uint>& photonIndices, QueryStats* pStats) const
+{
+    if (mNodes.empty()) return;
+
+    const float radiusSq = mRadius * mRadius;
+    uint64_t nodesVisited = 0;
+    uint64_t spheresTested = 0;
+    uint stack[kStackSize];
+    uint stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const Node& node = mNodes[stack[--stackSize]];
+        nodesVisited++;
+        if (!isInside(posW, node.boundsMin, node.boundsMax)) continue;
+
+        if (node.rightOrCount & kLeafFlag) {
+            const uint end = node.leftOrFirst + (node.rightOrCount & ~kLeafFlag);
+            for (uint i = node.leftOrFirst; i < end; i++) {
+                const float3 d = mCenters[i] - posW;
+                if (dot(d, d) <= radiusSq) photonIndices.push_back(mPhotonIndices[i]);
+            }
+            spheresTested += end - node.leftOrFirst;
+        }
+        else {
+            FALCOR_ASSERT(stackSize + 2 <= kStackSize);
+            stack[stackSize++] = node.rightOrCount;
+            stack[stackSize++] = node.leftOrFirst;
+        }
+    }
+
+    if (pStats) {
+        pStats->nodesVisited += nodesVisited;
+        pStats->spheresTested += spheresTested;
+    }
+}
+
+double PhotonSphereBVH::getSahCost() const
+{
+    if (mNodes.empty()) return 0.0;
+    const double rootArea = surfaceArea(mNodes[0].boundsMin, mNodes[0].boundsMax);
+    if (rootArea <= 0.0) return 0.0;
+
+    double cost = 0.0;
+    for (const Node& node : mNodes)
+    {
+        const double area = surfaceArea(node.boundsMin, node.boundsMax);
+        cost += node.rightOrCount & kLeafFlag ? area * (node.rightOrCount & ~kLeafFlag) : area;
+    }
+    return cost / rootArea;
+}
+
+size_t PhotonSphereBVH::getSizeBytes() const
+{
+    return mNodes.size() * sizeof(Node) + mPhotonIndices.size() * sizeof(uint) + mCenters.size() * sizeof(float3);
+}
+
+const char* PhotonSphereBVH::getBuildModeName(BuildMode mode)
+{
+    switch (mode)
+    {
+    case BuildMode::LBVH: return "LBVH";
+    case BuildMode::BinnedSAH: return "Binned SAH";
+    default: return "Unknown";
+    }
+}
+
+uint64_t PhotonSphereBVH::countStructureErrors(const std::vector<float3>& centers) const
+{
+    uint64_t errors = 0;
+    if (mPhotonIndices.size() != centers.size() || mCenters.size() != centers.size())
+        return std::max(centers.size(), size_t(1));
+    if (mNodes.empty())
+        return centers.empty() ? 0 : centers.size();
+
+    std::vector<uint> photonVisits(centers.size(), 0);
+    std::vector<uint> nodeVisits(mNodes.size(), 0);
+    std::vector<uint> stack = { 0 };
+    while (!stack.empty())
+    {
+        const uint nodeIndex = stack.back();
+        stack.pop_back();
+        if (nodeIndex >= mNodes.size() || nodeVisits[nodeIndex]++ > 0) {
+            errors++;
+            continue;
+        }
+        const Node& node = mNodes[nodeIndex];
+        if (node.rightOrCount & kLeafFlag) {
+            const uint end = node.leftOrFirst + (node.rightOrCount & ~kLeafFlag);
+            for (uint i = node.leftOrFirst; i < end && i < mPhotonIndices.size(); i++) {
+                const uint photon = mPhotonIndices[i];
+                if (photon >= centers.size() || photonVisits[photon]++ > 0 || mCenters[i] != centers[photon]) {
+                    errors++;
+                    continue;
+                }
+                const float3& c = centers[photon];
+                if (!isInside(c - mRadius, node.boundsMin, node.boundsMax) || !isInside(c + mRadius, node.boundsMin, node.boundsMax)) errors++;
+            }
+        }
+        else {
+            for (uint child : { node.leftOrFirst, node.rightOrCount }) {
+                if (child >= mNodes.size()) {
+                    errors++;
+                    continue;
+                }
+                if (!isInside(mNodes[child].boundsMin, node.boundsMin, node.boundsMax) || !isInside(mNodes[child].boundsMax, node.boundsMin, node.boundsMax)) errors++;
+                stack.push_back(child);
+            }
+        }
+    }
+    for (uint v : photonVisits) if (v != 1) errors++;
+    for (uint v : nodeVisits) if (v != 1) errors++;
+    return errors;
+}
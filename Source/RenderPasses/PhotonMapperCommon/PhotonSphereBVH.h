@@ -0,0 +1,137 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "WorkStealingThreadPool.h"
+
+using namespace Falcor;
+
+/** Bounding volume hierarchy over photon spheres on the CPU. All photons of a build have the same radius, like the
+    procedural AABBs of the photon BLAS (PhotonMapper::buildBottomLevelAS). A query returns the photons whose sphere
+    contains a point, the same test the collect pass does in its any hit shader.
+    LBVH sorts the photons by the Morton code of their center and builds the hierarchy of the sorted clusters of
+    kLbvhLeafSize photons in one parallel pass (Karras 2012). The bounds are merged bottom up.
+    BinnedSAH splits the top levels with binned SAH over the photon centers in parallel and builds the subtrees below
+    them on separate threads.
+    Used as a gather structure for devices without raytracing and as a CPU baseline for the BLAS build modes.
+*/
+class PhotonSphereBVH
+{
+public:
+    enum class BuildMode : uint32_t
+    {
+        LBVH = 0,
+        BinnedSAH = 1,
+    };
+
+    static const uint kInvalidIndex = 0xFFFFFFFFu;
+    static const uint kLbvhLeafSize = 4;        ///< Photons per LBVH leaf. The last leaf can have less
+    static const uint kMaxLeafSize = 4;         ///< Binned SAH splits nodes with more photons unless the split costs more
+
+    struct QueryStats
+    {
+        uint64_t nodesVisited = 0;
+        uint64_t spheresTested = 0;
+    };
+
+    /** Builds the hierarchy.
+        \param[in] centers Photon positions.
+        \param[in] radius Radius of all photon spheres.
+        \param[in] pPool Builds in parallel. Without a pool the build is single threaded.
+    */
+    void build(const std::vector<float3>& centers, float radius, BuildMode mode, WorkStealingThreadPool* pPool = nullptr);
+
+    /** Appends the indices of all photons whose sphere contains posW.
+        \param[in] pStats Optional. Traversal counters are added to it.
+    */
+    void query(const float3& posW, std::vector<uint>& photonIndices, QueryStats* pStats = nullptr) const;
+
+    uint getPhotonCount() const { return static_cast<uint>(mPhotonIndices.size()); }
+    uint getNodeCount() const { return static_cast<uint>(mNodes.size()); }
+    float getRadius() const { return mRadius; }
+
+    /** Expected cost of a query relative to the root: sum of the node areas plus the leaf areas times their photon count,
+        divided by the root area.
+    */
+    double getSahCost() const;
+
+    size_t getSizeBytes() const;
+
+    static const char* getBuildModeName(BuildMode mode);
+
+    /** Number of errors of the hierarchy: photons that are not in exactly one leaf, bounds that do not contain the
+        children or the photon spheres and unreachable nodes. 0 for a valid hierarchy over centers.
+    */
+    uint64_t countStructureErrors(const std::vector<float3>& centers) const;
+
+private:
+    struct Node
+    {
+        float3 boundsMin;
+        uint leftOrFirst;   ///< Left child index for inner nodes, first photon for leaves
+        float3 boundsMax;
+        uint rightOrCount;  ///< Right child index for inner nodes, kLeafFlag | number of photons for leaves
+    };
+
+    static const uint kLeafFlag = 0x80000000u;
+
+    struct BuildPhoton
+    {
+        float3 center;
+        uint index;
+    };
+
+    struct BuildTask
+    {
+        uint node;
+        uint first;
+        uint count;
+        uint depth;
+        float3 cMin;        ///< Bounds of the photon centers
+        float3 cMax;
+    };
+
+    void buildLBVH(const std::vector<float3>& centers, WorkStealingThreadPool* pPool);
+    void buildBinnedSAH(const std::vector<float3>& centers, WorkStealingThreadPool* pPool);
+
+    /** Splits the photons of a task with binned SAH over the photon centers and partitions them.
+        Returns false if the task becomes a leaf. Sets everything but the node of the children.
+        \param[in] pPool Bins in parallel. Only used for the top levels.
+    */
+    bool splitSAH(std::vector<BuildPhoton>& photons, const BuildTask& task, WorkStealingThreadPool* pPool, BuildTask& left, BuildTask& right) const;
+
+    /** Splits a task and its children into nodes, nodes[root.node] has to exist. Tasks with at most subtreeSize photons
+        are added to subtrees instead of being split.
+    */
+    void buildNodesSAH(std::vector<BuildPhoton>& photons, const BuildTask& root, uint subtreeSize, WorkStealingThreadPool* pPool, std::vector<Node>& nodes, std::vector<BuildTask>& subtrees);
+
+    std::vector<Node>   mNodes;             ///< mNodes[0] is the root
+    std::vector<uint>   mPhotonIndices;     ///< Leaf photon order
+    std::vector<float3> mCenters;           ///< Photon centers in leaf order
+    float mRadius = 0.f;
+};
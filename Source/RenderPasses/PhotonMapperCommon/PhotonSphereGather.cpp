@@ -0,0 +1,160 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonSphereGather.h"
+#include "PhotonAccelerationStructure.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    const size_t kQueryChunkSize = 1024;        ///< Pixels per task of a parallel query
+}
+
+void PhotonSphereGather::setGenerationCount(uint generations)
+{
+    for (auto& slots : mSlots)
+    {
+        slots.clear();
+        slots.resize(generations);
+    }
+}
+
+void PhotonSphereGather::buildSlot(uint map, uint slot, const std::vector<uint8_t>& aabbs, uint firstPhoton, float radius, PhotonSphereBVH::BuildMode mode, WorkStealingThreadPool* pPool)
+{
+    FALCOR_ASSERT(map < kMapCount && slot < mSlots[map].size());
+    Slot& s = mSlots[map][slot];
+    s.photonIndices.clear();
+    s.centers.clear();
+
+    const size_t count = aabbs.size() / PhotonAccelerationStructure::kAABBStride;
+    s.centers.reserve(count);
+    s.photonIndices.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        float bounds[6];
+        std::memcpy(bounds, aabbs.data() + i * PhotonAccelerationStructure::kAABBStride, sizeof(bounds));
+        //The generate pass clears the AABBs of a slot to zero before it writes its photons
+        if (!(bounds[3] > bounds[0])) continue;
+        s.centers.push_back(float3(bounds[0] + bounds[3], bounds[1] + bounds[4], bounds[2] + bounds[5]) * 0.5f);
+        s.photonIndices.push_back(firstPhoton + static_cast<uint>(i));
+    }
+    s.bvh.build(s.centers, radius, mode, pPool);
+}
+
+void PhotonSphereGather::clearSlot(uint map, uint slot)
+{
+    FALCOR_ASSERT(map < kMapCount && slot < mSlots[map].size());
+    Slot& s = mSlots[map][slot];
+    s.photonIndices.clear();
+    s.centers.clear();
+    s.bvh.build(s.centers, 0.f, PhotonSphereBVH::BuildMode::LBVH);
+}
+
+void PhotonSphereGather::query(const std::vector<float4>& positions, const std::array<float, kMapCount>& radius, Lists& lists, WorkStealingThreadPool* pPool, Stats* pStats) const
+{
+    const size_t pixelCount = positions.size();
+    lists.offsets.assign(pixelCount * kMapCount + 1, 0);
+    lists.photons.clear();
+
+    //Every chunk of pixels collects its photons on its own, the chunks are concatenated in pixel order afterwards.
+    //The counts of the lists are written to offsets[list + 1] and summed up at the end
+    const size_t chunkCount = (pixelCount + kQueryChunkSize - 1) / kQueryChunkSize;
+    std::vector<std::vector<uint>> chunkPhotons(chunkCount);
+    std::vector<Stats> chunkStats(chunkCount);
+    auto queryChunk = [&](size_t chunk) {
+        std::vector<uint>& photons = chunkPhotons[chunk];
+        std::vector<uint> found;
+        PhotonSphereBVH::QueryStats queryStats;
+        const size_t end = std::min(pixelCount, (chunk + 1) * kQueryChunkSize);
+        for (size_t pixel = chunk * kQueryChunkSize; pixel < end; pixel++)
+        {
+            const float3 posW = float3(positions[pixel].x, positions[pixel].y, positions[pixel].z);
+            for (uint map = 0; map < kMapCount; map++)
+            {
+                const size_t listStart = photons.size();
+                const float radiusSq = radius[map] * radius[map];
+                if (positions[pixel].w != 0.f && radius[map] > 0.f)
+                {
+                    for (const Slot& slot : mSlots[map])
+                    {
+                        FALCOR_ASSERT(slot.centers.empty() || radius[map] <= slot.bvh.getRadius());
+                        found.clear();
+                        slot.bvh.query(posW, found, &queryStats);
+                        //The hierarchy tests the radius of its build, the collect shader the same radius as here
+                        for (uint i : found)
+                        {
+                            const float3 d = slot.centers[i] - posW;
+                            if (dot(d, d) < radiusSq) photons.push_back(slot.photonIndices[i]);
+                        }
+                    }
+                }
+                lists.offsets[pixel * kMapCount + map + 1] = static_cast<uint>(photons.size() - listStart);
+            }
+        }
+        chunkStats[chunk].nodesVisited = queryStats.nodesVisited;
+        chunkStats[chunk].spheresTested = queryStats.spheresTested;
+        chunkStats[chunk].photonsFound = photons.size();
+    };
+
+    if (pPool)
+        pPool->parallelFor(chunkCount, 1, [&](size_t begin, size_t end, uint32_t) { for (size_t chunk = begin; chunk < end; chunk++) queryChunk(chunk); });
+    else
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) queryChunk(chunk);
+
+    for (size_t i = 1; i < lists.offsets.size(); i++) lists.offsets[i] += lists.offsets[i - 1];
+    lists.photons.reserve(lists.offsets.back());
+    for (size_t chunk = 0; chunk < chunkCount; chunk++)
+    {
+        lists.photons.insert(lists.photons.end(), chunkPhotons[chunk].begin(), chunkPhotons[chunk].end());
+        if (pStats)
+        {
+            pStats->nodesVisited += chunkStats[chunk].nodesVisited;
+            pStats->spheresTested += chunkStats[chunk].spheresTested;
+            pStats->photonsFound += chunkStats[chunk].photonsFound;
+        }
+    }
+}
+
+uint PhotonSphereGather::getPhotonCount(uint map) const
+{
+    FALCOR_ASSERT(map < kMapCount);
+    uint count = 0;
+    for (const Slot& slot : mSlots[map]) count += static_cast<uint>(slot.centers.size());
+    return count;
+}
+
+size_t PhotonSphereGather::getSizeBytes() const
+{
+    size_t bytes = 0;
+    for (const auto& slots : mSlots)
+    {
+        for (const Slot& slot : slots)
+            bytes += slot.bvh.getSizeBytes() + slot.photonIndices.capacity() * sizeof(uint) + slot.centers.capacity() * sizeof(float3);
+    }
+    return bytes;
+}
@@ -0,0 +1,96 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "PhotonSphereBVH.h"
+#include "PhotonGenerationRing.slang"
+#include <array>
+
+using namespace Falcor;
+
+/** Photon gather of the AS photon mapper for devices without a photon acceleration structure backend.
+    Every ring slot of a map gets a PhotonSphereBVH over its photons, built from a CPU copy of its AABBs. query() looks up
+    the photons around the hit point of every pixel and returns them as per pixel lists, which the collect compute shader
+    (PhotonMapperCollectBVH.cs.slang) shades like the any hit shader of the collect pass.
+*/
+class PhotonSphereGather
+{
+public:
+    static const uint kMapCount = 2;            ///< Caustic (map 0) and global (map 1), like the instance IDs of PhotonGenerationRing.slang
+
+    /** Photon lists of all pixels. The photons of pixel p in map m are photons[offsets[2p + m]] to photons[offsets[2p + m + 1] - 1].
+        Photons are indices in the photon buffers of the map (getRingPhotonIndex()).
+    */
+    struct Lists
+    {
+        std::vector<uint> offsets;
+        std::vector<uint> photons;
+    };
+
+    struct Stats
+    {
+        uint64_t nodesVisited = 0;
+        uint64_t spheresTested = 0;
+        uint64_t photonsFound = 0;
+    };
+
+    /** Sets the number of ring slots and drops all hierarchies.
+    */
+    void setGenerationCount(uint generations);
+
+    /** Builds the hierarchy of a ring slot of a map.
+        \param[in] aabbs CPU copy of the AABBs of the slot, PhotonAccelerationStructure::kAABBStride bytes each. Cleared AABBs are skipped.
+        \param[in] firstPhoton Index of the first AABB in the photon buffers of the map.
+        \param[in] radius Radius of the photon spheres. Later queries must not use a larger radius.
+    */
+    void buildSlot(uint map, uint slot, const std::vector<uint8_t>& aabbs, uint firstPhoton, float radius, PhotonSphereBVH::BuildMode mode, WorkStealingThreadPool* pPool = nullptr);
+
+    /** Drops the photons of a ring slot, e.g. a stale slot of PhotonGenerationRing.
+    */
+    void clearSlot(uint map, uint slot);
+
+    /** Looks up the photons of every position in all slots.
+        \param[in] positions Hit points of the pixels. Pixels with w == 0 have no hit and get empty lists.
+        \param[in] radius Gather radius of each map. Maps with radius 0 are not gathered.
+        \param[in] pStats Optional. The counters of this query are added to it.
+    */
+    void query(const std::vector<float4>& positions, const std::array<float, kMapCount>& radius, Lists& lists, WorkStealingThreadPool* pPool = nullptr, Stats* pStats = nullptr) const;
+
+    uint getPhotonCount(uint map) const;
+    size_t getSizeBytes() const;
+
+private:
+    struct Slot
+    {
+        PhotonSphereBVH bvh;
+        std::vector<uint> photonIndices;    ///< Index in the photon buffers of every BVH photon
+        std::vector<float3> centers;
+    };
+
+    std::array<std::vector<Slot>, kMapCount> mSlots;
+};
@@ -0,0 +1,146 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonStreamFormat.h"
+#include "PhotonPacking.slang"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+PhotonStreamLayout PhotonStreamFormat::createLayout(uint capacity, uint posStride, uint fluxStride, uint dirStride)
+{
+    PM_ASSERT(posStride % 8 == 0 && fluxStride % 8 == 0 && dirStride % 8 == 0);
+
+    //Streams one after another, each starting on an aligned offset
+    PhotonStreamLayout layout = {};
+    layout.capacity = capacity;
+    uint64_t offset = 0;
+    auto addStream = [&](uint stride, uint& streamOffset) {
+        streamOffset = static_cast<uint>(offset);
+        offset = alignUp(offset + uint64_t(capacity) * stride, kAlignment);
+    };
+    addStream(posStride, layout.posOffset);
+    addStream(fluxStride, layout.fluxOffset);
+    addStream(dirStride, layout.dirOffset);
+    layout.posStride = posStride;
+    layout.fluxStride = fluxStride;
+    layout.dirStride = dirStride;
+
+    //Offsets are 32 bit in the shaders
+    PM_ASSERT(offset <= std::numeric_limits<uint>::max());
+    layout.totalBytes = static_cast<uint>(std::max<uint64_t>(offset, kAlignment));
+    return layout;
+}
+
+PhotonStreamLayout PhotonStreamFormat::createMapLayout(uint capacity, Infos infos, bool storePosition)
+{
+    //The compact record holds the position inside its cell
+    if (infos == Infos::Compact)
+        return createLayout(capacity, 0, kPackedPhotonBytes, 0);
+    const uint infoStride = infos == Infos::Full ? 16 : 8;
+    return createLayout(capacity, storePosition ? 16 : 0, infoStride, infoStride);
+}
+
+std::vector<float4> PhotonStreamFormat::readStream(const std::vector<uint8_t>& data, uint64_t dataOffset, uint streamOffset, uint stride, uint count)
+{
+    std::vector<float4> values;
+    if (stride == 0 || count == 0) return values;
+    PM_ASSERT(stride == 8 || stride == 16);
+    PM_ASSERT(streamOffset >= dataOffset && streamOffset - dataOffset + uint64_t(count) * stride <= data.size());
+
+    values.resize(count);
+    const uint8_t* pStream = data.data() + (streamOffset - dataOffset);
+    for (uint i = 0; i < count; i++)
+    {
+        const uint8_t* pElement = pStream + uint64_t(i) * stride;
+        if (stride == 8)
+        {
+            uint16_t h[4];
+            std::memcpy(h, pElement, sizeof(h));
+            values[i] = float4(halfToFloat(h[0]), halfToFloat(h[1]), halfToFloat(h[2]), halfToFloat(h[3]));
+        }
+        else
+            std::memcpy(&values[i], pElement, sizeof(float4));
+    }
+    return values;
+}
+
+std::vector<float3> PhotonStreamFormat::readPositions(const std::vector<uint8_t>& data, uint64_t dataOffset, const PhotonStreamLayout& layout, uint count)
+{
+    //.w is unused
+    const std::vector<float4> values = readStream(data, dataOffset, layout.posOffset, layout.posStride, std::min(count, layout.capacity));
+    std::vector<float3> positions(values.size());
+    for (size_t i = 0; i < values.size(); i++) positions[i] = float3(values[i].x, values[i].y, values[i].z);
+    return positions;
+}
+
+std::vector<float4> PhotonStreamFormat::readFlux(const std::vector<uint8_t>& data, uint64_t dataOffset, const PhotonStreamLayout& layout, uint count)
+{
+    return readStream(data, dataOffset, layout.fluxOffset, layout.fluxStride, std::min(count, layout.capacity));
+}
+
+std::vector<float4> PhotonStreamFormat::readDir(const std::vector<uint8_t>& data, uint64_t dataOffset, const PhotonStreamLayout& layout, uint count)
+{
+    return readStream(data, dataOffset, layout.dirOffset, layout.dirStride, std::min(count, layout.capacity));
+}
+
+float PhotonStreamFormat::halfToFloat(uint16_t h)
+{
+    const uint32_t sign = uint32_t(h & 0x8000u) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1fu;
+    uint32_t mantissa = h & 0x3ffu;
+
+    uint32_t bits;
+    if (exponent == 0x1f)
+        bits = sign | 0x7f800000u | (mantissa << 13);   //Inf, NaN
+    else if (exponent != 0)
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else
+    {
+        //Denormal, normalize the mantissa
+        uint32_t e = 113;
+        while ((mantissa & 0x400u) == 0)
+        {
+            mantissa <<= 1;
+            e--;
+        }
+        bits = sign | (e << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
@@ -0,0 +1,78 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "CpuMath.h"
+#include "PhotonStreams.slang"
+#include <vector>
+
+using namespace Falcor;
+
+/** Layouts of the linear photon storage and the CPU decoding of its streams (see PhotonStreams.slang).
+    Has no Falcor dependency, so the headless tests check the layouts and the CPU tools decode buffer copies and file dumps
+    with the same offsets and strides the shaders use. PhotonStreams creates and reads back the GPU buffers.
+*/
+class PhotonStreamFormat
+{
+public:
+    static const uint kAlignment = 256;     ///< Alignment of the stream offsets in bytes
+
+    /** Element type of the flux and direction streams.
+    */
+    enum class Infos
+    {
+        Full,       ///< float4
+        Half,       ///< half4
+        Compact,    ///< PhotonPacking record in the flux stream, no direction stream
+    };
+
+    /** Creates the layout of one photon map.
+        \param[in] posStride, fluxStride, dirStride Bytes per element (16 for float4, 8 for half4), 0 if the stream is not stored.
+    */
+    static PhotonStreamLayout createLayout(uint capacity, uint posStride, uint fluxStride, uint dirStride);
+
+    /** Creates the layout the passes use for a photon info format.
+        \param[in] storePosition Adds a float4 position stream. The AS pass keeps the positions in its AABBs instead.
+            Compact layouts never have one, the record holds the position inside its cell.
+    */
+    static PhotonStreamLayout createMapLayout(uint capacity, Infos infos, bool storePosition);
+
+    /** Decodes elements [0, count) of a stream from a CPU copy of the buffer. Half elements are converted to float.
+        \param[in] data Bytes of the buffer starting at byte dataOffset. Must hold all requested elements.
+    */
+    static std::vector<float4> readStream(const std::vector<uint8_t>& data, uint64_t dataOffset, uint streamOffset, uint stride, uint count);
+
+    /** Per stream versions of readStream. They return an empty vector if the stream is not stored.
+    */
+    static std::vector<float3> readPositions(const std::vector<uint8_t>& data, uint64_t dataOffset, const PhotonStreamLayout& layout, uint count);
+    static std::vector<float4> readFlux(const std::vector<uint8_t>& data, uint64_t dataOffset, const PhotonStreamLayout& layout, uint count);
+    static std::vector<float4> readDir(const std::vector<uint8_t>& data, uint64_t dataOffset, const PhotonStreamLayout& layout, uint count);
+
+    /** CPU version of f16tof32.
+    */
+    static float halfToFloat(uint16_t h);
+};
@@ -0,0 +1,63 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonStreams.h"
+#include <cstring>
+
+Buffer::SharedPtr PhotonStreams::createBuffer(const PhotonStreamLayout& layout, const std::string& name)
+{
+    Buffer::SharedPtr pBuffer = Buffer::create(layout.totalBytes, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr);
+    FALCOR_ASSERT(pBuffer);
+    pBuffer->setName(name);
+    return pBuffer;
+}
+
+std::vector<uint8_t> PhotonStreams::readback(RenderContext* pRenderContext, Buffer* pBuffer, uint64_t offset, uint64_t size)
+{
+    std::vector<uint8_t> data;
+    if (size == 0) return data;
+    FALCOR_ASSERT(offset + size <= pBuffer->getSize());
+
+    Buffer::SharedPtr pStaging = Buffer::create(size, ResourceBindFlags::None, Buffer::CpuAccess::Read, nullptr);
+    pRenderContext->copyBufferRegion(pStaging.get(), 0, pBuffer, offset, size);
+    pRenderContext->flush(true);
+
+    data.resize(size);
+    const void* pData = pStaging->map(Buffer::MapType::Read);
+    std::memcpy(data.data(), pData, size);
+    pStaging->unmap();
+    return data;
+}
+
+std::vector<float3> PhotonStreams::readPositions(RenderContext* pRenderContext, Buffer* pBuffer, const PhotonStreamLayout& layout, uint count)
+{
+    count = std::min(count, layout.capacity);
+    if (layout.posStride == 0 || count == 0) return {};
+
+    std::vector<uint8_t> data = readback(pRenderContext, pBuffer, layout.posOffset, uint64_t(count) * layout.posStride);
+    return PhotonStreamFormat::readPositions(data, layout.posOffset, layout, count);
+}
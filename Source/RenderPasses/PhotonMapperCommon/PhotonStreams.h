@@ -0,0 +1,50 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include "PhotonStreamFormat.h"
+
+using namespace Falcor;
+
+/** GPU buffers of the linear photon storage (see PhotonStreams.slang). PhotonStreamFormat creates the layouts.
+*/
+class PhotonStreams
+{
+public:
+    /** Creates the raw buffer for a layout. It can be bound as (RW)ByteAddressBuffer.
+    */
+    static Buffer::SharedPtr createBuffer(const PhotonStreamLayout& layout, const std::string& name);
+
+    /** Copies a byte range of a buffer to the CPU. Blocks until the GPU is done.
+    */
+    static std::vector<uint8_t> readback(RenderContext* pRenderContext, Buffer* pBuffer, uint64_t offset, uint64_t size);
+
+    /** Reads the positions of the first count photons. Only this part of the position stream is copied, it is decoded by PhotonStreamFormat.
+    */
+    static std::vector<float3> readPositions(RenderContext* pRenderContext, Buffer* pBuffer, const PhotonStreamLayout& layout, uint count);
+};
@@ -0,0 +1,225 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "ReadbackRing.h"
+
+ReadbackDevice::SharedPtr FalcorReadbackDevice::create(RenderContext* pRenderContext, const Buffer::SharedPtr& pSource, size_t byteSize)
+{
+    return SharedPtr(new FalcorReadbackDevice(pRenderContext, pSource, byteSize));
+}
+
+FalcorReadbackDevice::FalcorReadbackDevice(RenderContext* pRenderContext, const Buffer::SharedPtr& pSource, size_t byteSize)
+    : mpRenderContext(pRenderContext)
+    , mpSource(pSource)
+    , mByteSize(byteSize)
+{
+    FALCOR_ASSERT(mpRenderContext && mpSource);
+    FALCOR_ASSERT(byteSize > 0 && byteSize <= mpSource->getSize());
+    mpFence = GpuFence::create();
+}
+
+void FalcorReadbackDevice::createStagingBuffers(uint32_t slotCount)
+{
+    mStaging.resize(slotCount);
+    for (uint32_t i = 0; i < slotCount; i++)
+    {
+        mStaging[i] = Buffer::create(mByteSize, ResourceBindFlags::None, Buffer::CpuAccess::Read, nullptr);
+        mStaging[i]->setName("ReadbackRing::Staging" + std::to_string(i));
+    }
+}
+
+uint64_t FalcorReadbackDevice::copyToStaging(uint32_t slot)
+{
+    mpRenderContext->copyBufferRegion(mStaging[slot].get(), 0, mpSource.get(), 0, mByteSize);
+    //Submit without waiting so the fence is signaled right after the copy
+    mpRenderContext->flush(false);
+    return mpFence->gpuSignal(mpRenderContext->getLowLevelData()->getCommandQueue());
+}
+
+uint64_t FalcorReadbackDevice::getCompletedValue()
+{
+    return mpFence->getGpuValue();
+}
+
+void FalcorReadbackDevice::waitForValue(uint64_t value)
+{
+    mpFence->syncCpu(value);
+}
+
+void FalcorReadbackDevice::readStaging(uint32_t slot, void* pDst)
+{
+    const void* pData = mStaging[slot]->map(Buffer::MapType::Read);
+    std::memcpy(pDst, pData, mByteSize);
+    mStaging[slot]->unmap();
+}
+
+FakeReadbackDevice::SharedPtr FakeReadbackDevice::create(size_t byteSize, uint32_t gpuLatency)
+{
+    return SharedPtr(new FakeReadbackDevice(byteSize, gpuLatency));
+}
+
+void FakeReadbackDevice::setSource(const void* pData)
+{
+    std::memcpy(mSource.data(), pData, mByteSize);
+}
+
+void FakeReadbackDevice::advance()
+{
+    mFrame++;
+    completeCopies();
+}
+
+void FakeReadbackDevice::completeCopies()
+{
+    //Copies finish in submission order
+    while (!mPending.empty() && mPending.front().doneFrame <= mFrame)
+    {
+        PendingCopy& copy = mPending.front();
+        mStaging[copy.slot] = std::move(copy.data);
+        mCompletedValue = copy.fenceValue;
+        mPending.pop_front();
+    }
+}
+
+void FakeReadbackDevice::createStagingBuffers(uint32_t slotCount)
+{
+    mStaging.assign(slotCount, std::vector<uint8_t>(mByteSize, 0));
+    mStagingFenceValue.assign(slotCount, 0);
+    mPending.clear();
+    mCompletedValue = mNextFenceValue - 1;
+}
+
+uint64_t FakeReadbackDevice::copyToStaging(uint32_t slot)
+{
+    FALCOR_ASSERT(slot < mStaging.size());
+    PendingCopy copy;
+    copy.slot = slot;
+    copy.fenceValue = mNextFenceValue++;
+    copy.doneFrame = mFrame + mGpuLatency;
+    copy.data = mSource;
+    mStagingFenceValue[slot] = copy.fenceValue;
+    mPending.push_back(std::move(copy));
+    completeCopies();
+    return mStagingFenceValue[slot];
+}
+
+void FakeReadbackDevice::waitForValue(uint64_t value)
+{
+    if (mCompletedValue >= value) return;
+    mWaitCount++;
+    //Blocking on the CPU lets the emulated GPU catch up
+    while (mCompletedValue < value && !mPending.empty())
+    {
+        mFrame = mPending.front().doneFrame;
+        completeCopies();
+    }
+}
+
+void FakeReadbackDevice::readStaging(uint32_t slot, void* pDst)
+{
+    FALCOR_ASSERT(slot < mStaging.size());
+    if (mStagingFenceValue[slot] > mCompletedValue) mInvalidReadCount++;
+    std::memcpy(pDst, mStaging[slot].data(), mByteSize);
+}
+
+void ReadbackRing::init(const ReadbackDevice::SharedPtr& pDevice, uint32_t slotCount)
+{
+    FALCOR_ASSERT(pDevice && slotCount > 0);
+    mpDevice = pDevice;
+    mpDevice->createStagingBuffers(slotCount);
+    mSlots.assign(slotCount, Slot());
+    mData.assign(mpDevice->getByteSize(), 0);
+    mNextSlot = 0;
+    mEnqueueCount = 0;
+    mValueSequence = 0;
+    mHasValue = false;
+    mMaxLatency = 0;
+    mStallCount = 0;
+}
+
+void ReadbackRing::enqueue()
+{
+    FALCOR_ASSERT(isInitialized());
+    Slot& slot = mSlots[mNextSlot];
+
+    //All slots in flight. Wait for the oldest one, this bounds the latency to the slot count
+    if (slot.inFlight)
+    {
+        if (mpDevice->getCompletedValue() < slot.fenceValue)
+        {
+            mpDevice->waitForValue(slot.fenceValue);
+            mStallCount++;
+        }
+        collect(mNextSlot);
+    }
+
+    mEnqueueCount++;
+    slot.fenceValue = mpDevice->copyToStaging(mNextSlot);
+    slot.sequence = mEnqueueCount;
+    slot.inFlight = true;
+    slot.stale = false;
+    mNextSlot = (mNextSlot + 1) % static_cast<uint32_t>(mSlots.size());
+}
+
+bool ReadbackRing::poll()
+{
+    if (!isInitialized()) return false;
+
+    const uint64_t completed = mpDevice->getCompletedValue();
+    const uint32_t slotCount = static_cast<uint32_t>(mSlots.size());
+    bool updated = false;
+    //Oldest slot first, so the newest completed copy ends up as value
+    for (uint32_t i = 0; i < slotCount; i++)
+    {
+        uint32_t s = (mNextSlot + i) % slotCount;
+        if (mSlots[s].inFlight && mSlots[s].fenceValue <= completed)
+            updated |= collect(s);
+    }
+    return updated;
+}
+
+bool ReadbackRing::collect(uint32_t slot)
+{
+    Slot& s = mSlots[slot];
+    FALCOR_ASSERT(s.inFlight);
+    s.inFlight = false;
+    if (s.stale || (mHasValue && s.sequence <= mValueSequence)) return false;
+
+    mpDevice->readStaging(slot, mData.data());
+    mValueSequence = s.sequence;
+    mHasValue = true;
+    mMaxLatency = std::max(mMaxLatency, mEnqueueCount - mValueSequence);
+    return true;
+}
+
+void ReadbackRing::invalidate()
+{
+    for (auto& slot : mSlots)
+        slot.stale |= slot.inFlight;
+    mHasValue = false;
+    std::fill(mData.begin(), mData.end(), uint8_t(0));
+}
@@ -0,0 +1,237 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "Falcor.h"
+#include <cstring>
+#include <deque>
+#include <type_traits>
+
+using namespace Falcor;
+
+/** Device side of a readback ring. Owns the CPU readable staging buffers and a fence that is signaled once a copy into
+    one of them is done. The ring only talks to this interface, so it can run against the in-memory fake without a GPU.
+*/
+class ReadbackDevice
+{
+public:
+    using SharedPtr = std::shared_ptr<ReadbackDevice>;
+
+    virtual ~ReadbackDevice() = default;
+
+    /** Size of the source and of every staging buffer in bytes.
+    */
+    virtual size_t getByteSize() const = 0;
+
+    /** (Re)creates slotCount staging buffers.
+    */
+    virtual void createStagingBuffers(uint32_t slotCount) = 0;
+
+    /** Records a copy of the source into a staging buffer and submits it.
+        \return Fence value that is reached once the copy is done. Values increase with every call.
+    */
+    virtual uint64_t copyToStaging(uint32_t slot) = 0;
+
+    /** Last fence value reached by the device. Does not wait.
+    */
+    virtual uint64_t getCompletedValue() = 0;
+
+    /** Blocks until the fence value is reached.
+    */
+    virtual void waitForValue(uint64_t value) = 0;
+
+    /** Reads a staging buffer. Only valid once the fence value of its last copy is reached.
+    */
+    virtual void readStaging(uint32_t slot, void* pDst) = 0;
+};
+
+/** Readback device for a Falcor buffer. Every copy is followed by a flush without wait and a fence signal on the
+    command queue, so the staging buffer is only mapped once the GPU is done with it.
+*/
+class FalcorReadbackDevice : public ReadbackDevice
+{
+public:
+    /** \param[in] pRenderContext Render context the copies are recorded on. Has to outlive the device.
+        \param[in] pSource Buffer that is read back.
+        \param[in] byteSize Bytes read back from the start of the source.
+    */
+    static SharedPtr create(RenderContext* pRenderContext, const Buffer::SharedPtr& pSource, size_t byteSize);
+
+    size_t getByteSize() const override { return mByteSize; }
+    void createStagingBuffers(uint32_t slotCount) override;
+    uint64_t copyToStaging(uint32_t slot) override;
+    uint64_t getCompletedValue() override;
+    void waitForValue(uint64_t value) override;
+    void readStaging(uint32_t slot, void* pDst) override;
+
+private:
+    FalcorReadbackDevice(RenderContext* pRenderContext, const Buffer::SharedPtr& pSource, size_t byteSize);
+
+    RenderContext* mpRenderContext = nullptr;
+    Buffer::SharedPtr mpSource;
+    size_t mByteSize = 0;
+    std::vector<Buffer::SharedPtr> mStaging;
+    GpuFence::SharedPtr mpFence;
+};
+
+/** In-memory readback device that emulates a GPU running a fixed number of frames behind the CPU.
+    A copy takes a snapshot of the source when it is recorded and lands in the staging buffer gpuLatency calls to
+    advance() later. Reads of a staging buffer whose copy is not done yet are counted, so a ring that reads too early is
+    caught even if the stale data happens to look plausible.
+*/
+class FakeReadbackDevice : public ReadbackDevice
+{
+public:
+    using SharedPtr = std::shared_ptr<FakeReadbackDevice>;
+
+    /** \param[in] gpuLatency Frames (calls to advance()) until a recorded copy is done. 0 completes copies immediately.
+    */
+    static SharedPtr create(size_t byteSize, uint32_t gpuLatency);
+
+    /** Sets the source content that the next copies take.
+    */
+    void setSource(const void* pData);
+
+    /** Advances the emulated GPU by one frame.
+    */
+    void advance();
+
+    uint32_t getInvalidReadCount() const { return mInvalidReadCount; }  ///< Reads of staging buffers with a pending copy
+    uint32_t getWaitCount() const { return mWaitCount; }                ///< Calls to waitForValue() that had to block
+
+    size_t getByteSize() const override { return mByteSize; }
+    void createStagingBuffers(uint32_t slotCount) override;
+    uint64_t copyToStaging(uint32_t slot) override;
+    uint64_t getCompletedValue() override { return mCompletedValue; }
+    void waitForValue(uint64_t value) override;
+    void readStaging(uint32_t slot, void* pDst) override;
+
+private:
+    FakeReadbackDevice(size_t byteSize, uint32_t gpuLatency) : mByteSize(byteSize), mGpuLatency(gpuLatency), mSource(byteSize, 0) {}
+
+    /** Lands all copies that are due at the current frame.
+    */
+    void completeCopies();
+
+    struct PendingCopy
+    {
+        uint32_t slot = 0;
+        uint64_t fenceValue = 0;
+        uint64_t doneFrame = 0;
+        std::vector<uint8_t> data;
+    };
+
+    size_t mByteSize = 0;
+    uint32_t mGpuLatency = 0;
+    uint64_t mFrame = 0;
+    uint64_t mNextFenceValue = 1;
+    uint64_t mCompletedValue = 0;
+    std::vector<uint8_t> mSource;
+    std::vector<std::vector<uint8_t>> mStaging;
+    std::vector<uint64_t> mStagingFenceValue;       ///< Fence value of the last copy into each staging buffer
+    std::deque<PendingCopy> mPending;               ///< Recorded copies in submission order
+    uint32_t mInvalidReadCount = 0;
+    uint32_t mWaitCount = 0;
+};
+
+/** Ring of staging buffers for reading back small GPU values (e.g. the photon counters) without a CPU/GPU sync point.
+    Every frame enqueue() copies the source into the next slot and poll() picks up all slots whose copy is done.
+    The value is the newest completed copy, so it lags behind the GPU by a few frames. If all slots are still in flight,
+    enqueue() waits for the oldest one, which bounds the lag to the number of slots.
+*/
+class ReadbackRing
+{
+public:
+    static const uint32_t kDefaultSlotCount = 3;
+
+    /** Creates the staging buffers on the device. Resets the ring.
+    */
+    void init(const ReadbackDevice::SharedPtr& pDevice, uint32_t slotCount = kDefaultSlotCount);
+
+    bool isInitialized() const { return mpDevice != nullptr; }
+
+    /** Records a copy of the source into the next slot. Waits for the oldest copy if all slots are in flight.
+    */
+    void enqueue();
+
+    /** Reads all slots whose copy is done without waiting.
+        \return True if a newer value is available.
+    */
+    bool poll();
+
+    /** Drops the current value and the results of all copies still in flight, e.g. after the source was reset.
+        Only copies enqueued after this call produce a value again.
+    */
+    void invalidate();
+
+    bool hasValue() const { return mHasValue; }
+
+    /** Newest completed value. Zeroed if there is none.
+    */
+    const std::vector<uint8_t>& getData() const { return mData; }
+
+    template<typename T>
+    T getValue() const
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Readback values have to be trivially copyable");
+        FALCOR_ASSERT(sizeof(T) <= mData.size());
+        T value{};
+        std::memcpy(&value, mData.data(), sizeof(T));
+        return value;
+    }
+
+    /** Number of enqueues between the copy of the current value and the newest copy.
+    */
+    uint64_t getLatency() const { return mHasValue ? mEnqueueCount - mValueSequence : 0; }
+
+    uint64_t getMaxLatency() const { return mMaxLatency; }      ///< Largest latency seen since init()
+    uint32_t getStallCount() const { return mStallCount; }      ///< Enqueues that had to wait for a slot
+
+private:
+    struct Slot
+    {
+        bool inFlight = false;
+        bool stale = false;         ///< Enqueued before the last invalidate()
+        uint64_t fenceValue = 0;
+        uint64_t sequence = 0;      ///< Enqueue count when the copy was recorded
+    };
+
+    /** Reads a completed slot and frees it.
+        \return True if the slot held a newer value.
+    */
+    bool collect(uint32_t slot);
+
+    ReadbackDevice::SharedPtr mpDevice;
+    std::vector<Slot> mSlots;
+    std::vector<uint8_t> mData;
+    uint32_t mNextSlot = 0;
+    uint64_t mEnqueueCount = 0;
+    uint64_t mValueSequence = 0;
+    bool mHasValue = false;
+    uint64_t mMaxLatency = 0;
+    uint32_t mStallCount = 0;
+};
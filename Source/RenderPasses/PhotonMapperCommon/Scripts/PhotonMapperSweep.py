@@ -0,0 +1,220 @@
+# Parameter sweep for the photon mapper passes. Run it in Mogwai:
+#
+#   Mogwai.exe --script PhotonMapperSweep.py
+#
+# The sweep is described by a JSON file. Its path is taken from the PM_SWEEP_CONFIG environment variable,
+# without it DEFAULT_CONFIG below is used. Example:
+#
+#   {
+#       "pass": "PhotonMapperHash",
+#       "scenes": ["Arcade/Arcade.pyscene"],
+#       "resolution": [1920, 1080],
+#       "baseOptions": {"numPhotons": 2000000},
+#       "grid": {"numBucketBits": [18, 20, 22], "hashFunction": [0, 1, 2]},
+#       "vbufferOptions": {"useAlphaTest": true},
+#       "durationSec": 30,
+#       "maxIterations": 0,
+#       "output": "PhotonMapperSweep.csv",
+#       "references": {"Arcade/Arcade.pyscene": "ArcadeReference.exr"},
+#       "convergenceIntervalIterations": 16
+#   }
+#
+# Every scene is rendered with every combination of the grid values (on top of baseOptions) in timer mode.
+# The pass stops after durationSec seconds or maxIterations iterations (0 disables a limit) and writes its
+# per stage timings, which are summarized into one row of the output CSV. Rows are written as soon as a run is done.
+# Scenes with an entry in "references" additionally measure the error against the reference image during the run.
+# The error-vs-time curve of every run is written next to the output CSV, its last sample is added to the row.
+
+import csv
+import itertools
+import json
+import os
+import statistics
+import tempfile
+import time
+
+DEFAULT_CONFIG = {
+    "pass": "PhotonMapperHash",
+    "scenes": ["Arcade/Arcade.pyscene"],
+    "resolution": [1920, 1080],
+    "baseOptions": {},
+    "grid": {"numPhotons": [1000000, 2000000, 4000000]},
+    "vbufferOptions": {},
+    "durationSec": 30,
+    "maxIterations": 0,
+    "output": "PhotonMapperSweep.csv",
+    "references": {},
+    "convergenceIntervalIterations": 16,
+}
+
+PASS_LIBRARIES = {
+    "PhotonMapper": "PhotonMapper.dll",
+    "PhotonMapperHash": "PhotonMapperHash.dll",
+    "PhotonMapperStochasticHash": "PhotonMapperStochasticHash.dll",
+}
+
+STAGES = ["lightTable", "generate", "sort", "blasBuild", "tlasBuild", "culling", "collect"]
+
+# Per iteration counters of the times file, empty unless the pass records them (e.g. hashTableStats)
+COUNTERS = ["hashCausticLoadFactor", "hashGlobalLoadFactor", "hashDropRate", "hashAvgInsertProbe", "collectHitRate", "collectAvgProbe", "collectCellRejectRate", "collectRadiusRejectRate"]
+
+# Extra frames after the limit before a run counts as stuck
+STOP_GRACE_FRAMES = 100
+STOP_GRACE_SEC = 60.0
+
+
+def load_config():
+    path = os.environ.get("PM_SWEEP_CONFIG")
+    config = dict(DEFAULT_CONFIG)
+    if path:
+        with open(path, "r") as f:
+            config.update(json.load(f))
+    if config["pass"] not in PASS_LIBRARIES:
+        raise ValueError("Unknown photon mapper pass '{}'".format(config["pass"]))
+    if config["durationSec"] <= 0 and config["maxIterations"] <= 0:
+        raise ValueError("Either durationSec or maxIterations has to be set")
+    return config
+
+
+def grid_configurations(grid):
+    keys = sorted(grid.keys())
+    for values in itertools.product(*[grid[k] for k in keys]):
+        yield dict(zip(keys, values))
+
+
+def create_graph(config, options):
+    pass_type = config["pass"]
+    g = RenderGraph("PhotonMapperSweep")
+    loadRenderPassLibrary("PTVBuffer.dll")
+    loadRenderPassLibrary(PASS_LIBRARIES[pass_type])
+    g.addPass(createPass("PTVBuffer", config["vbufferOptions"]), "PTVBuffer")
+    g.addPass(createPass(pass_type, options), pass_type)
+    g.addEdge("PTVBuffer.vbuffer", pass_type + ".vbuffer")
+    g.addEdge("PTVBuffer.viewW", pass_type + ".viewW")
+    g.addEdge("PTVBuffer.throughput", pass_type + ".thpMatID")
+    g.addEdge("PTVBuffer.emissive", pass_type + ".emissive")
+    g.markOutput(pass_type + ".PhotonImage")
+    return g
+
+
+def read_times(path):
+    # Stage timing CSV: "# key: value" metadata lines, a header and one row per iteration.
+    # Stages that did not run in an iteration have empty cells
+    with open(path, "r", newline="") as f:
+        return list(csv.DictReader(line for line in f if not line.startswith("#")))
+
+
+def column(rows, key):
+    return [float(r[key]) for r in rows if r.get(key)]
+
+
+def median_or_empty(values):
+    return statistics.median(values) if values else ""
+
+
+def summarize(rows):
+    times = column(rows, "elapsedSec")
+    frame_times = [b - a for a, b in zip(times, times[1:])]
+    result = {
+        "iterations": len(times),
+        "elapsedSec": times[-1] if times else 0.0,
+        "avgFrameMs": 1000.0 * statistics.mean(frame_times) if frame_times else 0.0,
+        "medianFrameMs": 1000.0 * statistics.median(frame_times) if frame_times else 0.0,
+        "maxFrameMs": 1000.0 * max(frame_times) if frame_times else 0.0,
+    }
+    for stage in STAGES:
+        result[stage + "CpuMedianMs"] = median_or_empty(column(rows, stage + "CpuMs"))
+        result[stage + "GpuMedianMs"] = median_or_empty(column(rows, stage + "GpuMs"))
+    for counter in COUNTERS:
+        result[counter + "Median"] = median_or_empty(column(rows, counter))
+    return result
+
+
+def read_convergence(path):
+    if not os.path.exists(path):
+        return {}
+    with open(path, "r", newline="") as f:
+        rows = list(csv.DictReader(f))
+    if not rows:
+        return {}
+    return {"finalMse": rows[-1]["mse"], "finalRelMse": rows[-1]["relMse"], "finalSsim": rows[-1]["ssim"]}
+
+
+def run_configuration(config, options, times_path, reference=None, convergence_path=None):
+    for path in [times_path, convergence_path]:
+        if path and os.path.exists(path):
+            os.remove(path)
+
+    timer_options = {
+        "useTimer": True,
+        "timerDurationSec": float(config["durationSec"]),
+        "timerMaxIterations": int(config["maxIterations"]),
+        "timerRecordTimes": True,
+        "timesOutputFile": times_path,
+    }
+    if reference:
+        timer_options.update({
+            "convergenceEnabled": True,
+            "convergenceReference": reference,
+            "convergenceIntervalIterations": int(config["convergenceIntervalIterations"]),
+            "convergenceOutputFile": convergence_path,
+        })
+    g = create_graph(config, dict(options, **timer_options))
+    m.addGraph(g)
+
+    # The pass writes the times file once its timer stops
+    start = time.perf_counter()
+    frames = 0
+    max_frames = config["maxIterations"] + STOP_GRACE_FRAMES if config["maxIterations"] > 0 else None
+    max_sec = config["durationSec"] + STOP_GRACE_SEC if config["durationSec"] > 0 else None
+    while not os.path.exists(times_path):
+        m.renderFrame()
+        frames += 1
+        if (max_frames and frames > max_frames) or (max_sec and time.perf_counter() - start > max_sec):
+            break
+
+    m.removeGraph(g)
+    if not os.path.exists(times_path):
+        return None
+    result = summarize(read_times(times_path))
+    if reference:
+        result.update(read_convergence(convergence_path))
+    return result
+
+
+def run_sweep():
+    config = load_config()
+    grid_keys = sorted(config["grid"].keys())
+    result_keys = ["iterations", "elapsedSec", "avgFrameMs", "medianFrameMs", "maxFrameMs"]
+    result_keys += [stage + suffix for stage in STAGES for suffix in ["CpuMedianMs", "GpuMedianMs"]]
+    result_keys += [counter + "Median" for counter in COUNTERS]
+    result_keys += ["finalMse", "finalRelMse", "finalSsim"]
+    output_stem = os.path.splitext(config["output"])[0]
+    run_index = 0
+    times_path = os.path.join(tempfile.gettempdir(), "PhotonMapperSweepTimes.csv")
+
+    m.resizeSwapChain(*config["resolution"])
+    m.ui = False
+
+    with open(config["output"], "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["scene", "pass"] + grid_keys + result_keys + ["convergenceFile", "status"])
+        for scene in config["scenes"]:
+            m.loadScene(scene)
+            for grid_options in grid_configurations(config["grid"]):
+                options = dict(config["baseOptions"], **grid_options)
+                reference = config["references"].get(scene)
+                convergence_path = "{}_{}_convergence.csv".format(output_stem, run_index) if reference else ""
+                run_index += 1
+                result = run_configuration(config, options, times_path, reference, convergence_path)
+                row = [scene, config["pass"]] + [grid_options[k] for k in grid_keys]
+                if result:
+                    row += [result.get(k, "") for k in result_keys] + [convergence_path, "ok"]
+                else:
+                    row += [""] * len(result_keys) + [convergence_path, "timeout"]
+                writer.writerow(row)
+                f.flush()
+
+
+run_sweep()
+exit()
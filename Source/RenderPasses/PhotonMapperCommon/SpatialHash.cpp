@@ -0,0 +1,142 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "SpatialHash.h"
+#include "SimdUtils.h"
+#include <immintrin.h>
+
+namespace
+{
+    template<SpatialHashFunction kFunction>
+    void hashCellsScalar(const int32_t* x, const int32_t* y, const int32_t* z, uint32_t* out, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            out[i] = spatialHash<kFunction>(int3(x[i], y[i], z[i]));
+    }
+
+    //Wang mix of 4 packed 64 bit keys
+    PM_TARGET_AVX2 __m256i wangMix64(__m128i x, __m128i y, __m128i z)
+    {
+        const __m256i mask21 = _mm256_set1_epi64x(0x1FFFFF);
+        __m256i key = _mm256_slli_epi64(_mm256_and_si256(_mm256_cvtepi32_epi64(x), mask21), 42);
+        key = _mm256_or_si256(key, _mm256_slli_epi64(_mm256_and_si256(_mm256_cvtepi32_epi64(y), mask21), 21));
+        key = _mm256_or_si256(key, _mm256_and_si256(_mm256_cvtepi32_epi64(z), mask21));
+
+        key = _mm256_add_epi64(_mm256_xor_si256(key, _mm256_set1_epi64x(-1)), _mm256_slli_epi64(key, 18));
+        key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 31));
+        key = _mm256_add_epi64(key, _mm256_add_epi64(_mm256_slli_epi64(key, 2), _mm256_slli_epi64(key, 4)));   //key *= 21
+        key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 11));
+        key = _mm256_add_epi64(key, _mm256_slli_epi64(key, 6));
+        //uint(key) ^ uint(key >> 22) is the low half of key ^ (key >> 22)
+        key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 22));
+        return key;
+    }
+
+    PM_TARGET_AVX2 __m256i expandBits10AVX2(__m256i v)
+    {
+        v = _mm256_and_si256(v, _mm256_set1_epi32(0x3FF));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 16)), _mm256_set1_epi32(0x030000FF));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)), _mm256_set1_epi32(0x0300F00F));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 4)), _mm256_set1_epi32(0x030C30C3));
+        v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 2)), _mm256_set1_epi32(0x09249249));
+        return v;
+    }
+
+    PM_TARGET_AVX2 void hashCellsAVX2(SpatialHashFunction function, const int32_t* x, const int32_t* y, const int32_t* z, uint32_t* out, size_t count)
+    {
+        size_t i = 0;
+        switch (function)
+        {
+        case SpatialHashFunction::Wang:
+        {
+            const __m256i evenLanes = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i vx = _mm256_loadu_si256((const __m256i*)(x + i));
+                __m256i vy = _mm256_loadu_si256((const __m256i*)(y + i));
+                __m256i vz = _mm256_loadu_si256((const __m256i*)(z + i));
+                __m256i lo = wangMix64(_mm256_castsi256_si128(vx), _mm256_castsi256_si128(vy), _mm256_castsi256_si128(vz));
+                __m256i hi = wangMix64(_mm256_extracti128_si256(vx, 1), _mm256_extracti128_si256(vy, 1), _mm256_extracti128_si256(vz, 1));
+                __m128i lo32 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(lo, evenLanes));
+                __m128i hi32 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(hi, evenLanes));
+                _mm256_storeu_si256((__m256i*)(out + i), _mm256_inserti128_si256(_mm256_castsi128_si256(lo32), hi32, 1));
+            }
+            hashCellsScalar<SpatialHashFunction::Wang>(x, y, z, out, i, count);
+            break;
+        }
+        case SpatialHashFunction::Morton:
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i mx = expandBits10AVX2(_mm256_loadu_si256((const __m256i*)(x + i)));
+                __m256i my = expandBits10AVX2(_mm256_loadu_si256((const __m256i*)(y + i)));
+                __m256i mz = expandBits10AVX2(_mm256_loadu_si256((const __m256i*)(z + i)));
+                __m256i h = _mm256_or_si256(mx, _mm256_or_si256(_mm256_slli_epi32(my, 1), _mm256_slli_epi32(mz, 2)));
+                _mm256_storeu_si256((__m256i*)(out + i), h);
+            }
+            hashCellsScalar<SpatialHashFunction::Morton>(x, y, z, out, i, count);
+            break;
+        case SpatialHashFunction::Pcg:
+        {
+            const __m256i mul = _mm256_set1_epi32(1664525);
+            const __m256i add = _mm256_set1_epi32(1013904223);
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i vx = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(x + i)), mul), add);
+                __m256i vy = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(y + i)), mul), add);
+                __m256i vz = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)(z + i)), mul), add);
+                vx = _mm256_add_epi32(vx, _mm256_mullo_epi32(vy, vz));
+                vy = _mm256_add_epi32(vy, _mm256_mullo_epi32(vz, vx));
+                vz = _mm256_add_epi32(vz, _mm256_mullo_epi32(vx, vy));
+                vx = _mm256_xor_si256(vx, _mm256_srli_epi32(vx, 16));
+                vy = _mm256_xor_si256(vy, _mm256_srli_epi32(vy, 16));
+                vz = _mm256_xor_si256(vz, _mm256_srli_epi32(vz, 16));
+                vx = _mm256_add_epi32(vx, _mm256_mullo_epi32(vy, vz));
+                vy = _mm256_add_epi32(vy, _mm256_mullo_epi32(vz, vx));
+                vz = _mm256_add_epi32(vz, _mm256_mullo_epi32(vx, vy));
+                _mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(vx, _mm256_xor_si256(vy, vz)));
+            }
+            hashCellsScalar<SpatialHashFunction::Pcg>(x, y, z, out, i, count);
+            break;
+        }
+        }
+    }
+}
+
+void SpatialHash::hashCells(SpatialHashFunction function, const int32_t* x, const int32_t* y, const int32_t* z, uint32_t* out, size_t count, bool useAVX2)
+{
+    if (useAVX2 && PhotonMapperSimd::hasAVX2())
+    {
+        hashCellsAVX2(function, x, y, z, out, count);
+        return;
+    }
+    switch (function)
+    {
+    case SpatialHashFunction::Morton: hashCellsScalar<SpatialHashFunction::Morton>(x, y, z, out, 0, count); break;
+    case SpatialHashFunction::Pcg: hashCellsScalar<SpatialHashFunction::Pcg>(x, y, z, out, 0, count); break;
+    default: hashCellsScalar<SpatialHashFunction::Wang>(x, y, z, out, 0, count);
+    }
+}
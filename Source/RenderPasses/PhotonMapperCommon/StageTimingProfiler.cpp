@@ -0,0 +1,74 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "StageTimingProfiler.h"
+
+namespace
+{
+    //FALCOR_PROFILE scope names the passes use for each stage
+    const std::vector<std::string> kScopeNames[] = {
+        { "light sample table", "upload light sample table" },  // LightTable
+        { "generate photons" },                     // Generate
+        { "sort photons", "build photon grid" },    // Sort
+        { "buildPhotonBlas" },                      // BlasBuild
+        { "buildPhotonTlas" },                      // TlasBuild
+        { "PhotonCulling" },                        // Culling
+        { "collect photons" },                      // Collect
+    };
+    static_assert(sizeof(kScopeNames) / sizeof(kScopeNames[0]) == StageTimingStats::kStageCount, "Scope names missing");
+
+    std::string getScopeName(const std::string& eventName)
+    {
+        size_t pos = eventName.find_last_of('/');
+        return pos == std::string::npos ? eventName : eventName.substr(pos + 1);
+    }
+}
+
+namespace StageTimingProfiler
+{
+    void setGpuTimes(StageTimingStats& stats)
+    {
+        if (!stats.isEnabled() || !Profiler::instance().isEnabled()) return;
+
+        std::array<double, StageTimingStats::kStageCount> gpuMs = {};
+        std::array<bool, StageTimingStats::kStageCount> found = {};
+        for (const Profiler::Event* pEvent : Profiler::instance().getEvents())
+        {
+            const std::string scope = getScopeName(pEvent->getName());
+            for (size_t s = 0; s < StageTimingStats::kStageCount; s++)
+            {
+                const auto& names = kScopeNames[s];
+                if (std::find(names.begin(), names.end(), scope) == names.end()) continue;
+                gpuMs[s] += pEvent->getGpuTime();
+                found[s] = true;
+            }
+        }
+
+        for (size_t s = 0; s < StageTimingStats::kStageCount; s++)
+            if (found[s]) stats.setGpuTime(static_cast<StageTimingStats::Stage>(s), gpuMs[s]);
+    }
+}
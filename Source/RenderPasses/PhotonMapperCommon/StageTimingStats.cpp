@@ -0,0 +1,305 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "StageTimingStats.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+    const char* kStageNames[] = { "lightTable", "generate", "sort", "blasBuild", "tlasBuild", "culling", "collect" };
+    static_assert(sizeof(kStageNames) / sizeof(kStageNames[0]) == StageTimingStats::kStageCount, "Stage name missing");
+
+    /** Linear interpolation between the closest ranks of a sorted list.
+    */
+    double percentile(const std::vector<double>& sorted, double p)
+    {
+        double pos = p * static_cast<double>(sorted.size() - 1);
+        size_t lo = static_cast<size_t>(pos);
+        size_t hi = std::min(lo + 1, sorted.size() - 1);
+        double t = pos - static_cast<double>(lo);
+        return sorted[lo] * (1.0 - t) + sorted[hi] * t;
+    }
+
+    std::string escapeJson(const std::string& s)
+    {
+        std::string r;
+        r.reserve(s.size());
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\') { r += '\\'; r += c; }
+            else if (c == '\n') r += "\\n";
+            else if (static_cast<unsigned char>(c) < 0x20) r += ' ';
+            else r += c;
+        }
+        return r;
+    }
+
+    bool writeFile(const std::string& path, const std::string& content)
+    {
+        std::ofstream file(path, std::ios::trunc | std::ios::binary);
+        if (!file) return false;
+        file.write(content.data(), content.size());
+        return static_cast<bool>(file);
+    }
+
+    bool hasCounter(const StageTimingStats::Iteration& it, size_t index)
+    {
+        return index < it.counters.size() && !std::isnan(it.counters[index]);
+    }
+}
+
+StageTimingStats::ScopedCpuTimer::ScopedCpuTimer(StageTimingStats* pStats, Stage stage)
+    : mpStats(pStats)
+    , mStage(stage)
+{
+    if (mpStats) mStart = std::chrono::steady_clock::now();
+}
+
+StageTimingStats::ScopedCpuTimer::~ScopedCpuTimer()
+{
+    if (!mpStats) return;
+    std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - mStart;
+    mpStats->addCpuTime(mStage, duration.count());
+}
+
+StageTimingStats::StageTimingStats(size_t windowSize)
+    : mWindowSize(std::max<size_t>(windowSize, 1))
+{
+}
+
+const char* StageTimingStats::getStageName(Stage stage)
+{
+    return kStageNames[static_cast<size_t>(stage)];
+}
+
+void StageTimingStats::beginIteration(uint32_t iteration, double elapsedSec)
+{
+    if (!mEnabled) return;
+    endIteration();
+    mCurrent = Iteration();
+    mCurrent.iteration = iteration;
+    mCurrent.elapsedSec = elapsedSec;
+    mIterationOpen = true;
+}
+
+void StageTimingStats::endIteration()
+{
+    if (!mIterationOpen) return;
+    mIterationOpen = false;
+    mIterations.push_back(mCurrent);
+
+    for (size_t s = 0; s < kStageCount; s++)
+    {
+        const bool has[2] = { mCurrent.hasCpu[s], mCurrent.hasGpu[s] };
+        const double ms[2] = { mCurrent.cpuMs[s], mCurrent.gpuMs[s] };
+        for (size_t c = 0; c < 2; c++)
+        {
+            if (!has[c]) continue;
+            auto& window = mWindow[c][s];
+            window.push_back(ms[c]);
+            if (window.size() > mWindowSize) window.pop_front();
+        }
+    }
+}
+
+void StageTimingStats::addCpuTime(Stage stage, double ms)
+{
+    if (!mEnabled || !mIterationOpen) return;
+    size_t s = static_cast<size_t>(stage);
+    mCurrent.cpuMs[s] += ms;
+    mCurrent.hasCpu[s] = true;
+}
+
+void StageTimingStats::setGpuTime(Stage stage, double ms)
+{
+    if (!mEnabled || !mIterationOpen) return;
+    size_t s = static_cast<size_t>(stage);
+    mCurrent.gpuMs[s] = ms;
+    mCurrent.hasGpu[s] = true;
+}
+
+void StageTimingStats::setCounter(const std::string& name, double value)
+{
+    if (!mEnabled || !mIterationOpen) return;
+    size_t index = std::find(mCounterNames.begin(), mCounterNames.end(), name) - mCounterNames.begin();
+    if (index == mCounterNames.size()) mCounterNames.push_back(name);
+    if (mCurrent.counters.size() <= index) mCurrent.counters.resize(index + 1, std::numeric_limits<double>::quiet_NaN());
+    mCurrent.counters[index] = value;
+}
+
+void StageTimingStats::clear()
+{
+    mIterationOpen = false;
+    mIterations.clear();
+    for (auto& clock : mWindow)
+        for (auto& window : clock) window.clear();
+    mMetadata.clear();
+    mCounterNames.clear();
+}
+
+void StageTimingStats::setMetadata(const std::string& key, const std::string& value)
+{
+    for (auto& entry : mMetadata)
+    {
+        if (entry.first == key) { entry.second = value; return; }
+    }
+    mMetadata.emplace_back(key, value);
+}
+
+void StageTimingStats::setMetadata(const std::string& key, double value)
+{
+    std::ostringstream ss;
+    ss << std::setprecision(12) << value;
+    setMetadata(key, ss.str());
+}
+
+StageTimingStats::Summary StageTimingStats::getSummary(Stage stage, Clock clock) const
+{
+    const auto& window = mWindow[static_cast<size_t>(clock)][static_cast<size_t>(stage)];
+    return computeSummary(std::vector<double>(window.begin(), window.end()));
+}
+
+StageTimingStats::Summary StageTimingStats::computeSummary(std::vector<double> values)
+{
+    Summary summary;
+    if (values.empty()) return summary;
+
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (double v : values) sum += v;
+
+    summary.count = static_cast<uint32_t>(values.size());
+    summary.min = values.front();
+    summary.max = values.back();
+    summary.mean = sum / static_cast<double>(values.size());
+    summary.median = percentile(values, 0.5);
+    summary.p95 = percentile(values, 0.95);
+    summary.p99 = percentile(values, 0.99);
+    return summary;
+}
+
+std::string StageTimingStats::toCsv() const
+{
+    std::ostringstream ss;
+    for (const auto& [key, value] : mMetadata)
+    {
+        std::string line = key + ": " + value;
+        std::replace(line.begin(), line.end(), '\n', ' ');
+        ss << "# " << line << '\n';
+    }
+
+    ss << "iteration,elapsedSec";
+    for (size_t s = 0; s < kStageCount; s++)
+        ss << ',' << kStageNames[s] << "CpuMs," << kStageNames[s] << "GpuMs";
+    for (const auto& name : mCounterNames)
+        ss << ',' << name;
+    ss << '\n';
+
+    ss << std::setprecision(9);
+    for (const auto& it : mIterations)
+    {
+        ss << it.iteration << ',' << it.elapsedSec;
+        for (size_t s = 0; s < kStageCount; s++)
+        {
+            ss << ',';
+            if (it.hasCpu[s]) ss << it.cpuMs[s];
+            ss << ',';
+            if (it.hasGpu[s]) ss << it.gpuMs[s];
+        }
+        for (size_t c = 0; c < mCounterNames.size(); c++)
+        {
+            ss << ',';
+            if (hasCounter(it, c)) ss << it.counters[c];
+        }
+        ss << '\n';
+    }
+    return ss.str();
+}
+
+std::string StageTimingStats::toJson() const
+{
+    std::ostringstream ss;
+    ss << std::setprecision(9);
+    ss << "{\n  \"metadata\": {";
+    for (size_t i = 0; i < mMetadata.size(); i++)
+        ss << (i ? ",\n" : "\n") << "    \"" << escapeJson(mMetadata[i].first) << "\": \"" << escapeJson(mMetadata[i].second) << '"';
+    ss << (mMetadata.empty() ? "},\n" : "\n  },\n");
+
+    ss << "  \"windowSize\": " << mWindowSize << ",\n";
+    ss << "  \"summary\": {";
+    bool firstStage = true;
+    for (size_t s = 0; s < kStageCount; s++)
+    {
+        ss << (firstStage ? "\n" : ",\n") << "    \"" << kStageNames[s] << "\": {";
+        firstStage = false;
+        const char* clockNames[2] = { "cpu", "gpu" };
+        for (size_t c = 0; c < 2; c++)
+        {
+            Summary sum = getSummary(static_cast<Stage>(s), static_cast<Clock>(c));
+            ss << (c ? ", " : " ") << '"' << clockNames[c] << "\": { \"count\": " << sum.count << ", \"min\": " << sum.min
+               << ", \"mean\": " << sum.mean << ", \"median\": " << sum.median << ", \"p95\": " << sum.p95
+               << ", \"p99\": " << sum.p99 << ", \"max\": " << sum.max << " }";
+        }
+        ss << " }";
+    }
+    ss << "\n  },\n";
+
+    ss << "  \"iterations\": [";
+    for (size_t i = 0; i < mIterations.size(); i++)
+    {
+        const auto& it = mIterations[i];
+        ss << (i ? ",\n" : "\n") << "    { \"iteration\": " << it.iteration << ", \"elapsedSec\": " << it.elapsedSec;
+        for (size_t s = 0; s < kStageCount; s++)
+        {
+            if (it.hasCpu[s]) ss << ", \"" << kStageNames[s] << "CpuMs\": " << it.cpuMs[s];
+            if (it.hasGpu[s]) ss << ", \"" << kStageNames[s] << "GpuMs\": " << it.gpuMs[s];
+        }
+        for (size_t c = 0; c < mCounterNames.size(); c++)
+        {
+            if (hasCounter(it, c)) ss << ", \"" << escapeJson(mCounterNames[c]) << "\": " << it.counters[c];
+        }
+        ss << " }";
+    }
+    ss << (mIterations.empty() ? "]\n" : "\n  ]\n");
+    ss << "}\n";
+    return ss.str();
+}
+
+bool StageTimingStats::writeCsv(const std::string& path) const
+{
+    return writeFile(path, toCsv());
+}
+
+bool StageTimingStats::writeJson(const std::string& path) const
+{
+    return writeFile(path, toJson());
+}
@@ -0,0 +1,185 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Per iteration timings of the photon mapper stages with rolling statistics and CSV/JSON export.
+    Every iteration holds a CPU and a GPU time per stage. CPU times are measured around the stage on the host (command
+    recording and host work), GPU times are taken from the profiler scopes of the stage. Stages that did not run in an
+    iteration stay empty and are skipped by the statistics.
+    Named counters (e.g. hash table statistics) can be added per iteration. They are exported as extra columns.
+    The class has no device dependency, so it can be fed with synthetic timings.
+*/
+class StageTimingStats
+{
+public:
+    enum class Stage : uint32_t
+    {
+        LightTable = 0,     ///< Light sample table build and upload
+        Generate,           ///< Photon generation
+        Sort,               ///< Photon sort or cell range grid build
+        BlasBuild,          ///< Photon BLAS build
+        TlasBuild,          ///< Photon TLAS build
+        Culling,            ///< Photon culling
+        Collect,            ///< Photon collection
+
+        Count
+    };
+
+    enum class Clock : uint32_t
+    {
+        Cpu = 0,
+        Gpu = 1
+    };
+
+    static const size_t kStageCount = static_cast<size_t>(Stage::Count);
+
+    /** Rolling statistics of one stage in milliseconds.
+    */
+    struct Summary
+    {
+        uint32_t count = 0;         ///< Number of iterations in the window the stage ran in
+        double min = 0.0;
+        double mean = 0.0;
+        double median = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    struct Iteration
+    {
+        uint32_t iteration = 0;
+        double elapsedSec = 0.0;                        ///< Elapsed timer time at the start of the iteration
+        std::array<double, kStageCount> cpuMs = {};
+        std::array<double, kStageCount> gpuMs = {};
+        std::array<bool, kStageCount> hasCpu = {};
+        std::array<bool, kStageCount> hasGpu = {};
+        std::vector<double> counters;                   ///< Indexed like getCounterNames(), NaN if not set
+    };
+
+    /** Measures the CPU time of a scope and adds it to a stage of the current iteration.
+    */
+    class ScopedCpuTimer
+    {
+    public:
+        ScopedCpuTimer(StageTimingStats* pStats, Stage stage);
+        ~ScopedCpuTimer();
+
+        ScopedCpuTimer(const ScopedCpuTimer&) = delete;
+        ScopedCpuTimer& operator=(const ScopedCpuTimer&) = delete;
+
+    private:
+        StageTimingStats* mpStats;
+        Stage mStage;
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    /** \param[in] windowSize Number of most recent iterations the rolling statistics are computed over.
+    */
+    explicit StageTimingStats(size_t windowSize = 512);
+
+    static const char* getStageName(Stage stage);
+
+    /** Enables recording. While disabled all calls that add timings are ignored.
+    */
+    void setEnabled(bool enabled) { mEnabled = enabled; }
+    bool isEnabled() const { return mEnabled; }
+
+    /** Starts a new iteration. The previous iteration is committed to the log and the rolling window.
+    */
+    void beginIteration(uint32_t iteration, double elapsedSec);
+
+    /** Commits the current iteration. Has to be called before exporting the last iteration.
+    */
+    void endIteration();
+
+    /** Adds CPU time to a stage of the current iteration. Stages that run more than once per iteration accumulate.
+    */
+    void addCpuTime(Stage stage, double ms);
+
+    /** Sets the GPU time of a stage of the current iteration.
+    */
+    void setGpuTime(Stage stage, double ms);
+
+    /** Sets a named counter of the current iteration. Counters that are set for the first time add a column.
+    */
+    void setCounter(const std::string& name, double value);
+    const std::vector<std::string>& getCounterNames() const { return mCounterNames; }
+
+    /** Returns a scoped CPU timer for a stage. Measures nothing while recording is disabled.
+    */
+    ScopedCpuTimer scopedCpuTimer(Stage stage) { return ScopedCpuTimer(mEnabled ? this : nullptr, stage); }
+
+    /** Drops all iterations, counters and metadata.
+    */
+    void clear();
+
+    /** Metadata written with the exports, e.g. scene, settings and photon counts. Setting a key again replaces it.
+    */
+    void setMetadata(const std::string& key, const std::string& value);
+    void setMetadata(const std::string& key, double value);
+    const std::vector<std::pair<std::string, std::string>>& getMetadata() const { return mMetadata; }
+
+    const std::vector<Iteration>& getIterations() const { return mIterations; }
+
+    /** Rolling statistics of a stage over the last windowSize committed iterations.
+    */
+    Summary getSummary(Stage stage, Clock clock) const;
+
+    /** Computes min/mean/median/p95/p99/max of a list of values. Percentiles interpolate linearly between ranks.
+    */
+    static Summary computeSummary(std::vector<double> values);
+
+    /** Metadata as comment lines, then one row per iteration with the CPU and GPU time of every stage and the counters.
+    */
+    std::string toCsv() const;
+
+    /** Object with metadata, rolling statistics per stage and the per iteration timings.
+    */
+    std::string toJson() const;
+
+    bool writeCsv(const std::string& path) const;
+    bool writeJson(const std::string& path) const;
+
+private:
+    bool mEnabled = false;
+    size_t mWindowSize;
+    bool mIterationOpen = false;
+    Iteration mCurrent;
+    std::vector<Iteration> mIterations;
+    std::array<std::array<std::deque<double>, kStageCount>, 2> mWindow;    ///< [clock][stage]
+    std::vector<std::pair<std::string, std::string>> mMetadata;
+    std::vector<std::string> mCounterNames;
+};
@@ -0,0 +1,271 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "TriangleBVH.h"
+#include <limits>
+
+namespace
+{
+    const uint kNumBins = 16;
+    const uint kMaxLeafSize = 4;
+    const uint kMaxDepth = 64;
+    const uint kStackSize = 64;
+
+    float surfaceArea(const float3& bMin, const float3& bMax)
+    {
+        float3 e = bMax - bMin;
+        return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    bool intersectAABB(const float3& origin, const float3& invDir, const float3& bMin, const float3& bMax, float tMin, float tMax, float& tEntry)
+    {
+        float3 t0 = (bMin - origin) * invDir;
+        float3 t1 = (bMax - origin) * invDir;
+        float3 tSmall = glm::min(t0, t1);
+        float3 tBig = glm::max(t0, t1);
+        tEntry = std::max(tMin, std::max(tSmall.x, std::max(tSmall.y, tSmall.z)));
+        float tExit = std::min(tMax, std::min(tBig.x, std::min(tBig.y, tBig.z)));
+        return tEntry <= tExit;
+    }
+}
+
+void TriangleBVH::build(const std::vector<float3>& positions)
+{
+    const uint triCount = static_cast<uint>(positions.size() / 3);
+    mNodes.clear();
+    mTriIndices.resize(triCount);
+    for (uint i = 0; i < triCount; i++) mTriIndices[i] = i;
+
+    std::vector<BuildTri> buildTris(triCount);
+    for (uint i = 0; i < triCount; i++)
+    {
+        const float3& a = positions[3 * i + 0];
+        const float3& b = positions[3 * i + 1];
+        const float3& c = positions[3 * i + 2];
+        buildTris[i].boundsMin = glm::min(a, glm::min(b, c));
+        buildTris[i].boundsMax = glm::max(a, glm::max(b, c));
+        buildTris[i].centroid = (buildTris[i].boundsMin + buildTris[i].boundsMax) * 0.5f;
+    }
+
+    if (triCount > 0)
+    {
+        mNodes.reserve(2 * triCount);
+        buildRecursive(buildTris, 0, triCount, 0);
+    }
+
+    //Store triangles in leaf order so leaves touch contiguous memory
+    mTriV0.resize(triCount);
+    mTriE1.resize(triCount);
+    mTriE2.resize(triCount);
+    for (uint i = 0; i < triCount; i++)
+    {
+        uint tri = mTriIndices[i];
+        mTriV0[i] = positions[3 * tri];
+        mTriE1[i] = positions[3 * tri + 1] - positions[3 * tri];
+        mTriE2[i] = positions[3 * tri + 2] - positions[3 * tri];
+    }
+}
+
+uint TriangleBVH::buildRecursive(std::vector<BuildTri>& buildTris, uint first, uint count, uint depth)
+{
+    const uint nodeIndex = static_cast<uint>(mNodes.size());
+    mNodes.push_back({});
+
+    float3 bMin(std::numeric_limits<float>::max());
+    float3 bMax(-std::numeric_limits<float>::max());
+    float3 cMin(std::numeric_limits<float>::max());
+    float3 cMax(-std::numeric_limits<float>::max());
+    for (uint i = first; i < first + count; i++)
+    {
+        const BuildTri& bt = buildTris[mTriIndices[i]];
+        bMin = glm::min(bMin, bt.boundsMin);
+        bMax = glm::max(bMax, bt.boundsMax);
+        cMin = glm::min(cMin, bt.centroid);
+        cMax = glm::max(cMax, bt.centroid);
+    }
+    mNodes[nodeIndex].boundsMin = bMin;
+    mNodes[nodeIndex].boundsMax = bMax;
+
+    auto makeLeaf = [&]() {
+        mNodes[nodeIndex].leftOrFirst = first;
+        mNodes[nodeIndex].count = count;
+        return nodeIndex;
+    };
+
+    if (count <= kMaxLeafSize || depth >= kMaxDepth)
+        return makeLeaf();
+
+    //Find the best split over all axes with binned SAH
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    uint bestBin = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = cMax[axis] - cMin[axis];
+        if (extent <= 0.f) continue;
+        float binScale = kNumBins / extent;
+
+        float3 binMin[kNumBins], binMax[kNumBins];
+        uint binCount[kNumBins] = {};
+        for (uint b = 0; b < kNumBins; b++)
+        {
+            binMin[b] = float3(std::numeric_limits<float>::max());
+            binMax[b] = float3(-std::numeric_limits<float>::max());
+        }
+        for (uint i = first; i < first + count; i++)
+        {
+            const BuildTri& bt = buildTris[mTriIndices[i]];
+            uint b = std::min(kNumBins - 1, static_cast<uint>((bt.centroid[axis] - cMin[axis]) * binScale));
+            binCount[b]++;
+            binMin[b] = glm::min(binMin[b], bt.boundsMin);
+            binMax[b] = glm::max(binMax[b], bt.boundsMax);
+        }
+
+        //Sweep from the right to get the suffix areas, then evaluate from the left
+        float rightArea[kNumBins];
+        uint rightCount[kNumBins];
+        float3 accMin(std::numeric_limits<float>::max()), accMax(-std::numeric_limits<float>::max());
+        uint accCount = 0;
+        for (uint b = kNumBins - 1; b > 0; b--)
+        {
+            accMin = glm::min(accMin, binMin[b]);
+            accMax = glm::max(accMax, binMax[b]);
+            accCount += binCount[b];
+            rightArea[b] = accCount > 0 ? surfaceArea(accMin, accMax) : 0.f;
+            rightCount[b] = accCount;
+        }
+        accMin = float3(std::numeric_limits<float>::max());
+        accMax = float3(-std::numeric_limits<float>::max());
+        accCount = 0;
+        for (uint b = 0; b < kNumBins - 1; b++)
+        {
+            accMin = glm::min(accMin, binMin[b]);
+            accMax = glm::max(accMax, binMax[b]);
+            accCount += binCount[b];
+            if (accCount == 0 || rightCount[b + 1] == 0) continue;
+            float cost = accCount * surfaceArea(accMin, accMax) + rightCount[b + 1] * rightArea[b + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+
+    //Splitting has to beat the cost of intersecting all triangles in one leaf
+    if (bestAxis < 0 || bestCost >= count * surfaceArea(bMin, bMax))
+        return makeLeaf();
+
+    const float binScale = kNumBins / (cMax[bestAxis] - cMin[bestAxis]);
+    auto mid = std::partition(mTriIndices.begin() + first, mTriIndices.begin() + first + count, [&](uint tri) {
+        uint b = std::min(kNumBins - 1, static_cast<uint>((buildTris[tri].centroid[bestAxis] - cMin[bestAxis]) * binScale));
+        return b <= bestBin;
+    });
+    uint leftCount = static_cast<uint>(mid - (mTriIndices.begin() + first));
+    if (leftCount == 0 || leftCount == count)
+        return makeLeaf();
+
+    //Left child is always allocated right after its parent
+    buildRecursive(buildTris, first, leftCount, depth + 1);
+    uint right = buildRecursive(buildTris, first + leftCount, count - leftCount, depth + 1);
+    mNodes[nodeIndex].leftOrFirst = right;
+    mNodes[nodeIndex].count = 0;
+    return nodeIndex;
+}
+
+bool TriangleBVH::intersect(const float3& origin, const float3& dir, float tMin, float tMax, Hit& hit) const
+{
+    if (mNodes.empty()) return false;
+
+    const float3 invDir = float3(1.f) / dir;
+    hit.triIndex = kInvalidIndex;
+    hit.t = tMax;
+
+    uint stack[kStackSize];
+    uint stackSize = 0;
+    uint nodeIndex = 0;
+    float tEntry;
+    if (!intersectAABB(origin, invDir, mNodes[0].boundsMin, mNodes[0].boundsMax, tMin, hit.t, tEntry))
+        return false;
+
+    while (true)
+    {
+        const Node& node = mNodes[nodeIndex];
+        if (node.count > 0)
+        {
+            //Moeller-Trumbore against all leaf triangles
+            for (uint i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+            {
+                float3 p = glm::cross(dir, mTriE2[i]);
+                float det = glm::dot(mTriE1[i], p);
+                if (std::abs(det) < 1e-12f) continue;
+                float invDet = 1.f / det;
+                float3 s = origin - mTriV0[i];
+                float u = glm::dot(s, p) * invDet;
+                if (u < 0.f || u > 1.f) continue;
+                float3 q = glm::cross(s, mTriE1[i]);
+                float v = glm::dot(dir, q) * invDet;
+                if (v < 0.f || u + v > 1.f) continue;
+                float t = glm::dot(mTriE2[i], q) * invDet;
+                if (t >= tMin && t < hit.t)
+                {
+                    hit.t = t;
+                    hit.triIndex = mTriIndices[i];
+                    hit.barycentrics = float2(u, v);
+                }
+            }
+        }
+        else
+        {
+            //Visit the nearer child first
+            uint left = nodeIndex + 1;
+            uint right = node.leftOrFirst;
+            float tLeft, tRight;
+            bool hitLeft = intersectAABB(origin, invDir, mNodes[left].boundsMin, mNodes[left].boundsMax, tMin, hit.t, tLeft);
+            bool hitRight = intersectAABB(origin, invDir, mNodes[right].boundsMin, mNodes[right].boundsMax, tMin, hit.t, tRight);
+            if (hitLeft && hitRight)
+            {
+                if (tRight < tLeft) std::swap(left, right);
+                PM_ASSERT(stackSize < kStackSize);
+                stack[stackSize++] = right;
+                nodeIndex = left;
+                continue;
+            }
+            if (hitLeft || hitRight)
+            {
+                nodeIndex = hitLeft ? left : right;
+                continue;
+            }
+        }
+
+        if (stackSize == 0) break;
+        nodeIndex = stack[--stackSize];
+    }
+
+    return hit.triIndex != kInvalidIndex;
+}
@@ -0,0 +1,84 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include "CpuMath.h"
+#include <vector>
+
+using namespace Falcor;
+
+/** Binned SAH bounding volume hierarchy over a triangle soup.
+    Used by the CPU photon tracer to trace against the scene without a GPU.
+*/
+class TriangleBVH
+{
+public:
+    struct Hit
+    {
+        uint triIndex = kInvalidIndex;  ///< Index of the hit triangle
+        float t = 0.f;                  ///< Hit distance along the ray
+        float2 barycentrics;            ///< Barycentrics (u,v) of vertex 1 and 2
+    };
+
+    static const uint kInvalidIndex = 0xFFFFFFFFu;
+
+    /** Builds the hierarchy.
+        \param[in] positions Triangle vertex positions, 3 consecutive entries per triangle.
+    */
+    void build(const std::vector<float3>& positions);
+
+    /** Finds the closest intersection in [tMin, tMax]. Returns false on a miss.
+    */
+    bool intersect(const float3& origin, const float3& dir, float tMin, float tMax, Hit& hit) const;
+
+    uint getTriangleCount() const { return static_cast<uint>(mTriIndices.size()); }
+    uint getNodeCount() const { return static_cast<uint>(mNodes.size()); }
+
+private:
+    struct Node
+    {
+        float3 boundsMin;
+        uint leftOrFirst;   ///< Left child index for inner nodes, first triangle for leaves
+        float3 boundsMax;
+        uint count;         ///< Number of triangles for leaves, 0 for inner nodes
+    };
+
+    struct BuildTri
+    {
+        float3 boundsMin;
+        float3 boundsMax;
+        float3 centroid;
+    };
+
+    uint buildRecursive(std::vector<BuildTri>& buildTris, uint first, uint count, uint depth);
+
+    std::vector<Node>   mNodes;
+    std::vector<uint>   mTriIndices;    ///< Leaf triangle order
+    std::vector<float3> mTriV0;         ///< Vertex 0 per triangle, in leaf order
+    std::vector<float3> mTriE1;         ///< Edge v1 - v0
+    std::vector<float3> mTriE2;         ///< Edge v2 - v0
+};
@@ -0,0 +1,158 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "WorkStealingThreadPool.h"
+#include <algorithm>
+
+WorkStealingThreadPool::WorkStealingThreadPool(uint32_t threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    mQueues.resize(threadCount);
+    for (auto& queue : mQueues)
+        queue = std::make_unique<WorkQueue>();
+
+    //Thread 0 is the caller of parallelFor, only spawn the remaining ones
+    for (uint32_t i = 1; i < threadCount; i++)
+        mWorkers.emplace_back(&WorkStealingThreadPool::workerLoop, this, i);
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mStop = true;
+    }
+    mWakeCV.notify_all();
+    for (auto& worker : mWorkers)
+        worker.join();
+}
+
+void WorkStealingThreadPool::parallelFor(size_t count, size_t grainSize, const RangeFunc& func)
+{
+    if (count == 0) return;
+    grainSize = std::max<size_t>(grainSize, 1);
+
+    std::lock_guard<std::mutex> submitLock(mSubmitMutex);
+
+    //Run inline if there is nothing to distribute
+    const size_t numChunks = (count + grainSize - 1) / grainSize;
+    if (numChunks == 1 || mWorkers.empty())
+    {
+        func(0, count, 0);
+        return;
+    }
+
+    //Publish the job before the chunks, a worker still spinning from the last job may pick them up right away
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mpCurrentFunc = &func;
+        mPendingChunks = numChunks;
+    }
+
+    //Distribute the chunks round robin so every queue starts with a share of the range
+    const uint32_t numQueues = getThreadCount();
+    for (size_t c = 0; c < numChunks; c++)
+    {
+        Chunk chunk{ c * grainSize, std::min(count, (c + 1) * grainSize) };
+        auto& queue = *mQueues[c % numQueues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.chunks.push_back(chunk);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mGeneration++;
+    }
+    mWakeCV.notify_all();
+
+    runChunks(0);
+
+    std::unique_lock<std::mutex> lock(mWakeMutex);
+    mDoneCV.wait(lock, [&]() { return mPendingChunks.load() == 0; });
+    mpCurrentFunc = nullptr;
+}
+
+void WorkStealingThreadPool::workerLoop(uint32_t threadIndex)
+{
+    uint64_t lastGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mWakeMutex);
+            mWakeCV.wait(lock, [&]() { return mStop || mGeneration != lastGeneration; });
+            if (mStop) return;
+            lastGeneration = mGeneration;
+        }
+        runChunks(threadIndex);
+    }
+}
+
+bool WorkStealingThreadPool::popOrSteal(uint32_t threadIndex, Chunk& chunk)
+{
+    //Own queue first (LIFO keeps the most recently touched range hot)
+    {
+        auto& queue = *mQueues[threadIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.chunks.empty())
+        {
+            chunk = queue.chunks.back();
+            queue.chunks.pop_back();
+            return true;
+        }
+    }
+
+    //Steal from the front of the other queues
+    const uint32_t numQueues = getThreadCount();
+    for (uint32_t i = 1; i < numQueues; i++)
+    {
+        auto& queue = *mQueues[(threadIndex + i) % numQueues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.chunks.empty())
+        {
+            chunk = queue.chunks.front();
+            queue.chunks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingThreadPool::runChunks(uint32_t threadIndex)
+{
+    Chunk chunk;
+    while (popOrSteal(threadIndex, chunk))
+    {
+        (*mpCurrentFunc)(chunk.begin, chunk.end, threadIndex);
+        if (mPendingChunks.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(mWakeMutex);
+            mDoneCV.notify_all();
+        }
+    }
+}
@@ -0,0 +1,98 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Small work-stealing thread pool used by the CPU photon mapping tools.
+    Work is submitted as an index range that is split into chunks. Every worker owns a queue and
+    pops from its back; idle workers steal from the front of other queues. The calling thread
+    takes part in the work, so parallelFor() blocks until the whole range is processed.
+*/
+class WorkStealingThreadPool
+{
+public:
+    /** Range callback: (begin, end, threadIndex). threadIndex is in [0, getThreadCount()).
+    */
+    using RangeFunc = std::function<void(size_t, size_t, uint32_t)>;
+
+    /** Create the pool.
+        \param[in] threadCount Total number of threads including the caller. 0 uses all hardware threads.
+    */
+    explicit WorkStealingThreadPool(uint32_t threadCount = 0);
+    ~WorkStealingThreadPool();
+
+    WorkStealingThreadPool(const WorkStealingThreadPool&) = delete;
+    WorkStealingThreadPool& operator=(const WorkStealingThreadPool&) = delete;
+
+    /** Number of threads that take part in a parallelFor (workers + calling thread).
+    */
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(mQueues.size()); }
+
+    /** Run func over [0, count) split into chunks of grainSize. Blocks until all chunks are done.
+        Only one parallelFor can run at a time; concurrent calls are serialized.
+    */
+    void parallelFor(size_t count, size_t grainSize, const RangeFunc& func);
+
+private:
+    struct Chunk
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+    };
+
+    void workerLoop(uint32_t threadIndex);
+    bool popOrSteal(uint32_t threadIndex, Chunk& chunk);
+    void runChunks(uint32_t threadIndex);
+
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;    ///< One queue per thread. Index 0 belongs to the calling thread
+    std::vector<std::thread>    mWorkers;
+
+    std::mutex                  mSubmitMutex;           ///< Serializes parallelFor calls
+    std::mutex                  mWakeMutex;
+    std::condition_variable     mWakeCV;
+    std::condition_variable     mDoneCV;
+    uint64_t                    mGeneration = 0;        ///< Incremented for every submitted job
+    bool                        mStop = false;
+
+    const RangeFunc*            mpCurrentFunc = nullptr;
+    std::atomic<size_t>         mPendingChunks{ 0 };
+};
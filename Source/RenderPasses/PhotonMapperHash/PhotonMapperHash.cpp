@@ -26,11 +26,13 @@
  # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  **************************************************************************/
 #include "PhotonMapperHash.h"
+#include "../PhotonMapperCommon/PhotonPacking.h"
 #include <RenderGraph/RenderPassHelpers.h>
 
 //for random seed generation
 #include <random>
 #include <ctime>
+#include <cstring>
 #include <limits>
 
 constexpr float kUint32tMaxF = float((uint32_t)-1);
@@ -52,6 +54,9 @@ namespace
 {
     const char kShaderGeneratePhoton[] = "RenderPasses/PhotonMapperHash/PhotonMapperHashGenerate.rt.slang";
     const char kShaderCollectPhoton[] = "RenderPasses/PhotonMapperHash/PhotonMapperHashCollect.cs.slang";
+    const char kShaderSortPhoton[] = "RenderPasses/PhotonMapperHash/PhotonMapperHashSort.cs.slang";
+    const char kShaderGridPhoton[] = "RenderPasses/PhotonMapperHash/PhotonMapperHashGrid.cs.slang";
+    const char kShaderPhotonCulling[] = "RenderPasses/PhotonMapperCommon/PhotonCulling.cs.slang";
 
     // Ray tracing settings that affect the traversal stack size.
    // These should be set as small as possible.
@@ -61,6 +66,9 @@ namespace
     const uint32_t kMaxAttributeSizeBytes = 8u;
     const uint32_t kMaxRecursionDepth = 2u;
 
+    const uint kSortDispatchWidth = 1 << 16;        ///< Threads per dispatch row of the sort and grid passes
+    const uint kGridBlockSize = 2048;               ///< Slots per prefix sum block of the grid build (PhotonMapperHashGrid.cs.slang)
+
     const ChannelList kInputChannels =
     {
         {"vbuffer",             "gVBuffer",                 "V Buffer to get the intersected triangle",         false},
@@ -77,31 +85,254 @@ namespace
     const Gui::DropdownList kInfoTexDropdownList{
         //{(uint)PhotonMapperHash::TextureFormat::_8Bit , "8Bits"},
         {(uint)PhotonMapperHash::TextureFormat::_16Bit , "16Bits"},
-        {(uint)PhotonMapperHash::TextureFormat::_32Bit , "32Bits"}
+        {(uint)PhotonMapperHash::TextureFormat::_32Bit , "32Bits"},
+        {(uint)PhotonMapperHash::TextureFormat::Compact , "Compact (16B)"}
+    };
+
+    const Gui::DropdownList kPhotonStorageList{
+        {(uint)PhotonStorage::Texture2D , "2D Textures"},
+        {(uint)PhotonStorage::LinearBuffer , "Linear Buffers"}
+    };
+
+    const Gui::DropdownList kHashGridModeList{
+        {(uint)PhotonMapperHash::HashGridMode::Buckets , "Buckets"},
+        {(uint)PhotonMapperHash::HashGridMode::CellRanges , "Cell Ranges"}
     };
 
     const Gui::DropdownList kLightTexModeList{
         {PhotonMapperHash::LightTexMode::power , "Power"},
         {PhotonMapperHash::LightTexMode::area , "Area"}
     };
+
+    const Gui::DropdownList kHashFunctionList{
+        {(uint)SpatialHashFunction::Wang , "Wang"},
+        {(uint)SpatialHashFunction::Morton , "Morton"},
+        {(uint)SpatialHashFunction::Pcg , "PCG"}
+    };
+
+    const Gui::DropdownList kGatherTraversalList{
+        {(uint)GatherTraversal::Cube , "Cube"},
+        {(uint)GatherTraversal::SphereOverlap , "Sphere Overlap"}
+    };
+
+    const Gui::DropdownList kHashCellSizeList{
+        {1 , "Radius"},
+        {2 , "2x Radius"}
+    };
+
+    // Scripting options.
+    const char kNumPhotons[] = "numPhotons";
+    const char kGlobalBufferSize[] = "globalBufferSize";
+    const char kCausticBufferSize[] = "causticBufferSize";
+    const char kAutoBufferSize[] = "autoBufferSize";
+    const char kUseSPPM[] = "useSPPM";
+    const char kSPPMAlphaGlobal[] = "sppmAlphaGlobal";
+    const char kSPPMAlphaCaustic[] = "sppmAlphaCaustic";
+    const char kPerPixelSPPM[] = "perPixelSPPM";
+    const char kCausticRadiusStart[] = "causticRadiusStart";
+    const char kGlobalRadiusStart[] = "globalRadiusStart";
+    const char kRejectionProbability[] = "rejectionProbability";
+    const char kMaxBounces[] = "maxBounces";
+    const char kEmissiveScalar[] = "emissiveScalar";
+    const char kSpecRoughCutoff[] = "specRoughCutoff";
+    const char kUseAlphaTest[] = "useAlphaTest";
+    const char kAdjustShadingNormals[] = "adjustShadingNormals";
+    const char kUseFaceNormalRejection[] = "useFaceNormalRejection";
+    const char kEnablePhotonCulling[] = "enablePhotonCulling";
+    const char kCullingHashBufferBits[] = "cullingHashBufferBits";
+    const char kCullingNumHashes[] = "cullingNumHashes";
+    const char kUseProjectionMatrixCulling[] = "useProjectionMatrixCulling";
+    const char kCullingProjectionTestOver[] = "cullingProjectionTestOver";
+    const char kInfoTexFormat[] = "infoTexFormat";
+    const char kPhotonStorage[] = "photonStorage";
+    const char kNumBucketBits[] = "numBucketBits";
+    const char kNumPhotonsPerBucket[] = "numPhotonsPerBucket";
+    const char kQuadraticProbeIterations[] = "quadraticProbeIterations";
+    const char kHashFunction[] = "hashFunction";
+    const char kGatherTraversal[] = "gatherTraversal";
+    const char kHashCellSize[] = "hashCellSize";
+    const char kHashGridLevels[] = "hashGridLevels";
+    const char kSortPhotons[] = "sortPhotons";
+    const char kHashGridMode[] = "hashGridMode";
+    const char kHashTableStats[] = "hashTableStats";
+    const char kEnableStochasticCollect[] = "enableStochasticCollect";
+    const char kStochasticCollectProbability[] = "stochasticCollectProbability";
+    const char kLightSampleMode[] = "lightSampleMode";
+    const char kAsyncLightTableRebuild[] = "asyncLightTableRebuild";
+    const char kDisableGlobalCollection[] = "disableGlobalCollection";
+    const char kDisableCausticCollection[] = "disableCausticCollection";
+    const char kAlwaysResetIterations[] = "alwaysResetIterations";
+    const char kUseTimer[] = "useTimer";
+    const char kTimerDurationSec[] = "timerDurationSec";
+    const char kTimerMaxIterations[] = "timerMaxIterations";
+    const char kTimerRecordTimes[] = "timerRecordTimes";
+    const char kTimesOutputFile[] = "timesOutputFile";
+    const char kConvergenceEnabled[] = "convergenceEnabled";
+    const char kConvergenceReference[] = "convergenceReference";
+    const char kConvergenceIntervalIterations[] = "convergenceIntervalIterations";
+    const char kConvergenceIntervalMs[] = "convergenceIntervalMs";
+    const char kConvergenceSsim[] = "convergenceSsim";
+    const char kConvergenceOutputFile[] = "convergenceOutputFile";
+
+    bool isCompactFormat(uint format)
+    {
+        return format == static_cast<uint>(PhotonMapperHash::TextureFormat::Compact);
+    }
+
+    bool isLinearStorage(uint storage)
+    {
+        return storage == static_cast<uint>(PhotonStorage::LinearBuffer);
+    }
+
+    //Compact photons only use the flux stream. 8 bit infos are stored as halfs
+    PhotonStreamLayout createPhotonStreamLayout(uint capacity, uint format)
+    {
+        PhotonStreamFormat::Infos infos = PhotonStreamFormat::Infos::Half;
+        if (isCompactFormat(format)) infos = PhotonStreamFormat::Infos::Compact;
+        else if (format == static_cast<uint>(PhotonMapperHash::TextureFormat::_32Bit)) infos = PhotonStreamFormat::Infos::Full;
+        return PhotonStreamFormat::createMapLayout(capacity, infos, true);
+    }
 }
 
 PhotonMapperHash::SharedPtr PhotonMapperHash::create(RenderContext* pRenderContext, const Dictionary& dict)
 {
-    SharedPtr pPass = SharedPtr(new PhotonMapperHash);
+    SharedPtr pPass = SharedPtr(new PhotonMapperHash(dict));
     return pPass;
 }
 
-PhotonMapperHash::PhotonMapperHash():
+PhotonMapperHash::PhotonMapperHash(const Dictionary& dict):
     RenderPass(kInfo)
 {
+    parseDictionary(dict);
+
+    PhotonBufferSizePolicy::Options sizeOptions;
+    sizeOptions.minCapacity = kInfoTexHeight;
+    mCausticSizePolicy.setOptions(sizeOptions);
+    mGlobalSizePolicy.setOptions(sizeOptions);
+    updateSizePolicyGranularity();
+
     mpSampleGenerator = SampleGenerator::create(SAMPLE_GENERATOR_UNIFORM);
     FALCOR_ASSERT(mpSampleGenerator);
 }
 
+void PhotonMapperHash::parseDictionary(const Dictionary& dict)
+{
+    for (const auto& [key, value] : dict)
+    {
+        if (key == kNumPhotons) { mNumPhotons = value; mNumPhotonsUI = mNumPhotons; }
+        else if (key == kGlobalBufferSize) mGlobalBufferSizeUI = value;
+        else if (key == kCausticBufferSize) mCausticBufferSizeUI = value;
+        else if (key == kAutoBufferSize) mAutoBufferSize = value;
+        else if (key == kUseSPPM) mUseStatisticProgressivePM = value;
+        else if (key == kSPPMAlphaGlobal) mSPPMAlphaGlobal = value;
+        else if (key == kSPPMAlphaCaustic) mSPPMAlphaCaustic = value;
+        else if (key == kPerPixelSPPM) mPerPixelSPPM = value;
+        else if (key == kCausticRadiusStart) mCausticRadiusStart = value;
+        else if (key == kGlobalRadiusStart) mGlobalRadiusStart = value;
+        else if (key == kRejectionProbability) mRussianRoulette = value;
+        else if (key == kMaxBounces) mMaxBounces = value;
+        else if (key == kEmissiveScalar) mIntensityScalar = value;
+        else if (key == kSpecRoughCutoff) mSpecRoughCutoff = value;
+        else if (key == kUseAlphaTest) mUseAlphaTest = value;
+        else if (key == kAdjustShadingNormals) mAdjustShadingNormals = value;
+        else if (key == kUseFaceNormalRejection) mEnableFaceNormalRejection = value;
+        else if (key == kEnablePhotonCulling) mEnablePhotonCulling = value;
+        else if (key == kCullingHashBufferBits) mCullingHashBufferBits = value;
+        else if (key == kCullingNumHashes) mCullingNumHashes = value;
+        else if (key == kUseProjectionMatrixCulling) mUseProjectionMatrixCulling = value;
+        else if (key == kCullingProjectionTestOver) mCullingProjectionTestOver = value;
+        else if (key == kInfoTexFormat) mInfoTexFormat = value;
+        else if (key == kPhotonStorage) mPhotonStorage = value;
+        else if (key == kNumBucketBits) mNumBucketBits = value;
+        else if (key == kNumPhotonsPerBucket) mNumPhotonsPerBucket = value;
+        else if (key == kQuadraticProbeIterations) mQuadraticProbeIterations = value;
+        else if (key == kHashFunction) mHashFunction = value;
+        else if (key == kGatherTraversal) mGatherTraversal = value;
+        else if (key == kHashCellSize) mHashCellSize = value;
+        else if (key == kHashGridLevels) mHashGridLevels = value;
+        else if (key == kSortPhotons) mSortPhotons = value;
+        else if (key == kHashGridMode) mHashGridMode = value;
+        else if (key == kHashTableStats) mEnableHashTableStats = value;
+        else if (key == kEnableStochasticCollect) mEnableStochasticCollection = value;
+        else if (key == kStochasticCollectProbability) mStochasticCollectProbability = value;
+        else if (key == kLightSampleMode) mLightTexMode = static_cast<LightTexMode>(static_cast<uint32_t>(value));
+        else if (key == kAsyncLightTableRebuild) mAsyncLightTexRebuild = value;
+        else if (key == kDisableGlobalCollection) mDisableGlobalCollection = value;
+        else if (key == kDisableCausticCollection) mDisableCausticCollection = value;
+        else if (key == kAlwaysResetIterations) mAlwaysResetIterations = value;
+        else if (key == kUseTimer) { mUseTimer = value; mResetTimer = true; }
+        else if (key == kTimerDurationSec) mTimerDurationSec = value;
+        else if (key == kTimerMaxIterations) mTimerMaxIterations = value;
+        else if (key == kTimerRecordTimes) mTimerRecordTimes = value;
+        else if (key == kTimesOutputFile) mTimesOutputFilePath = static_cast<std::string>(value);
+        else if (key == kConvergenceEnabled) mConvergence.getOptions().enabled = value;
+        else if (key == kConvergenceReference) mConvergence.getOptions().referencePath = static_cast<std::string>(value);
+        else if (key == kConvergenceIntervalIterations) mConvergence.getOptions().intervalIterations = value;
+        else if (key == kConvergenceIntervalMs) mConvergence.getOptions().intervalMs = value;
+        else if (key == kConvergenceSsim) mConvergence.getOptions().computeSsim = value;
+        else if (key == kConvergenceOutputFile) mConvergence.getOptions().outputPath = static_cast<std::string>(value);
+        else logWarning("Unknown field '" + key + "' in a PhotonMapperHash dictionary");
+    }
+}
+
 Dictionary PhotonMapperHash::getScriptingDictionary()
 {
-    return Dictionary();
+    Dictionary dict;
+    dict[kNumPhotons] = mNumPhotons;
+    dict[kGlobalBufferSize] = mGlobalBufferSizeUI;
+    dict[kCausticBufferSize] = mCausticBufferSizeUI;
+    dict[kAutoBufferSize] = mAutoBufferSize;
+    dict[kUseSPPM] = mUseStatisticProgressivePM;
+    dict[kSPPMAlphaGlobal] = mSPPMAlphaGlobal;
+    dict[kSPPMAlphaCaustic] = mSPPMAlphaCaustic;
+    dict[kPerPixelSPPM] = mPerPixelSPPM;
+    dict[kCausticRadiusStart] = mCausticRadiusStart;
+    dict[kGlobalRadiusStart] = mGlobalRadiusStart;
+    dict[kRejectionProbability] = mRussianRoulette;
+    dict[kMaxBounces] = mMaxBounces;
+    dict[kEmissiveScalar] = mIntensityScalar;
+    dict[kSpecRoughCutoff] = mSpecRoughCutoff;
+    dict[kUseAlphaTest] = mUseAlphaTest;
+    dict[kAdjustShadingNormals] = mAdjustShadingNormals;
+    dict[kUseFaceNormalRejection] = mEnableFaceNormalRejection;
+    dict[kEnablePhotonCulling] = mEnablePhotonCulling;
+    dict[kCullingHashBufferBits] = mCullingHashBufferBits;
+    dict[kCullingNumHashes] = mCullingNumHashes;
+    dict[kUseProjectionMatrixCulling] = mUseProjectionMatrixCulling;
+    dict[kCullingProjectionTestOver] = mCullingProjectionTestOver;
+    dict[kInfoTexFormat] = mInfoTexFormat;
+    dict[kPhotonStorage] = mPhotonStorage;
+    dict[kNumBucketBits] = mNumBucketBits;
+    dict[kNumPhotonsPerBucket] = mNumPhotonsPerBucket;
+    dict[kQuadraticProbeIterations] = mQuadraticProbeIterations;
+    dict[kHashFunction] = mHashFunction;
+    dict[kGatherTraversal] = mGatherTraversal;
+    dict[kHashCellSize] = mHashCellSize;
+    dict[kHashGridLevels] = mHashGridLevels;
+    dict[kSortPhotons] = mSortPhotons;
+    dict[kHashGridMode] = mHashGridMode;
+    dict[kHashTableStats] = mEnableHashTableStats;
+    dict[kEnableStochasticCollect] = mEnableStochasticCollection;
+    dict[kStochasticCollectProbability] = mStochasticCollectProbability;
+    dict[kLightSampleMode] = static_cast<uint32_t>(mLightTexMode);
+    dict[kAsyncLightTableRebuild] = mAsyncLightTexRebuild;
+    dict[kDisableGlobalCollection] = mDisableGlobalCollection;
+    dict[kDisableCausticCollection] = mDisableCausticCollection;
+    dict[kAlwaysResetIterations] = mAlwaysResetIterations;
+    dict[kUseTimer] = mUseTimer;
+    dict[kTimerDurationSec] = mTimerDurationSec;
+    dict[kTimerMaxIterations] = mTimerMaxIterations;
+    dict[kTimerRecordTimes] = mTimerRecordTimes;
+    if (!mTimesOutputFilePath.empty()) dict[kTimesOutputFile] = mTimesOutputFilePath;
+    const auto& convergence = mConvergence.getOptions();
+    dict[kConvergenceEnabled] = convergence.enabled;
+    if (!convergence.referencePath.empty()) dict[kConvergenceReference] = convergence.referencePath;
+    dict[kConvergenceIntervalIterations] = convergence.intervalIterations;
+    dict[kConvergenceIntervalMs] = convergence.intervalMs;
+    dict[kConvergenceSsim] = convergence.computeSsim;
+    if (!convergence.outputPath.empty()) dict[kConvergenceOutputFile] = convergence.outputPath;
+
+    return dict;
 }
 
 RenderPassReflection PhotonMapperHash::reflect(const CompileData& compileData)
@@ -153,18 +384,25 @@ void PhotonMapperHash::execute(RenderContext* pRenderContext, const RenderData&
     checkTimer();
     if (mUseTimer && mTimerStopRenderer) return;
 
-    //Copy Photon Counter for UI
-    copyPhotonCounter(pRenderContext);
+    //Get the newest photon counter and hash table counters that are ready on the CPU
+    updatePhotonCounter();
+    updateHashTableStats();
 
     if (mNumPhotonsChanged) {
         changeNumPhotons();
         mNumPhotonsChanged = false;
     }
         
+    //Restarts the iterations if the screen size changed
+    if (mPerPixelSPPM) {
+        prepareProgressiveBuffers(renderData.getDefaultTextureDims());
+    }
+
     //reset radius
     if (mFrameCount == 0) {
         mCausticRadius = mCausticRadiusStart;
         mGlobalRadius = mGlobalRadiusStart;
+        mConvergence.restart();
     }
 
     if (is_set(mpScene->getUpdates(), Scene::UpdateFlags::GeometryChanged))
@@ -178,6 +416,14 @@ void PhotonMapperHash::execute(RenderContext* pRenderContext, const RenderData&
         mpScene->getLightCollection(pRenderContext);
     }
 
+    //The buffers are recreated with the sizes rounded to the new granularity
+    if (mPhotonStorageChanged) {
+        updateSizePolicyGranularity();
+        mResizePhotonBuffers = true;
+        mResetCS = true;
+        mPhotonStorageChanged = false;
+    }
+
     if (mResizePhotonBuffers) {
         if (mFitBuffersToPhotonShot) {
             //if size of conter is 0 wait till next iteration
@@ -187,14 +433,16 @@ void PhotonMapperHash::execute(RenderContext* pRenderContext, const RenderData&
             }
             mFitBuffersToPhotonShot = false;
         }
-        //put in new size with info tex2D height in mind
-        uint causticWidth = static_cast<uint>(std::ceil(mCausticBufferSizeUI / static_cast<float>(kInfoTexHeight)));
-        mCausticBuffers.maxSize = causticWidth * kInfoTexHeight;
-        uint globalWidth = static_cast<uint>(std::ceil(mGlobalBufferSizeUI / static_cast<float>(kInfoTexHeight)));
-        mGlobalBuffers.maxSize = globalWidth * kInfoTexHeight;
+        //put in new size with the storage granularity (info tex2D height) in mind
+        const uint granularity = getPhotonBufferGranularity();
+        uint causticWidth = static_cast<uint>(std::ceil(mCausticBufferSizeUI / static_cast<float>(granularity)));
+        mCausticBuffers.maxSize = std::max(causticWidth, 1u) * granularity;
+        uint globalWidth = static_cast<uint>(std::ceil(mGlobalBufferSizeUI / static_cast<float>(granularity)));
+        mGlobalBuffers.maxSize = std::max(globalWidth, 1u) * granularity;
 
         //refresh UI to new variable
         mCausticBufferSizeUI = mCausticBuffers.maxSize; mGlobalBufferSizeUI = mGlobalBuffers.maxSize;
+        mCausticSizePolicy.setCapacity(mCausticBuffers.maxSize); mGlobalSizePolicy.setCapacity(mGlobalBuffers.maxSize);
         mResizePhotonBuffers = false;
         mPhotonBuffersReady = false;
         mRebuildAS = true;
@@ -204,6 +452,7 @@ void PhotonMapperHash::execute(RenderContext* pRenderContext, const RenderData&
     if (mPhotonBuffersReady && mPhotonInfoFormatChanged) {
         preparePhotonInfoTexture();
         mPhotonInfoFormatChanged = false;
+        mResetCS = true;    //Collect pass depends on the compact format
     }
 
     if (!mPhotonBuffersReady) {
@@ -215,32 +464,71 @@ void PhotonMapperHash::execute(RenderContext* pRenderContext, const RenderData&
     }
 
     if (mRebuildLightTex) {
-        mLightSampleTex.reset();
+        //Keep the old table until the worker thread is done
+        if (mAsyncLightTexRebuild && mLightAliasTable)
+            mLightTableBuilder.buildAsync(LightSampleTableBuilder::createInput(pRenderContext, mpScene, mNumPhotons, mMaxDispatchY, (LightSampleTableBuilder::Mode)mLightTexMode));
+        else
+            mLightAliasTable.reset();
         mRebuildLightTex = false;
     }
 
-    //Create light sample tex if empty
-    if (!mLightSampleTex) {
-        createLightSampleTexture(pRenderContext);
+    //Create light table if empty
+    if (!mLightAliasTable) {
+        createLightSampleTable(pRenderContext);
+    }
+    else if (mLightTableBuilder.isReady()) {
+        uploadLightSampleTable(mLightTableBuilder.takeResult());
     }
 
     if (mResetCS) {
         mpCSCollect.reset();
+        mPhotonSort.pInitKeys.reset();  //Sort passes depend on the bucket defines
+        mPhotonGrid.pCount.reset();
+        mPhotonCullingPass.reset();     //Culling uses the bucket hash function
         prepareHashBuffer();
+        mHashTableStats.readback.invalidate();  //Counters of the old settings
+        mHashTableStats.hasLatest = false;
         mResetCS = false;
     }
 
+    if (mRebuildCullingBuffer) {
+        mCullingBuffer.reset();
+        mRebuildCullingBuffer = false;
+    }
+
+    if (mEnablePhotonCulling && !mCullingBuffer)
+        initPhotonCulling();
+
+    //Reset culling buffer if deactivated to save memory
+    if (!mEnablePhotonCulling && mCullingBuffer)
+        resetCullingVars();
+
+    if (mEnablePhotonCulling)
+        photonCullingPass(pRenderContext, renderData);
+
     //
     // Generate Ray Pass
     //
 
     generatePhotons(pRenderContext, renderData);
-    
+    copyPhotonCounter(pRenderContext);
+
+    //Bring the photons of a cell next to each other for the collect pass. The grid build sorts them by slot anyway
+    if (useCellRangeGrid())
+        buildPhotonGrid(pRenderContext);
+    else if (mSortPhotons && isLinearStorage(mPhotonStorage))
+        sortPhotons(pRenderContext);
+
     //Gather the photons with short rays
     collectPhotons(pRenderContext, renderData);
+    copyHashTableStats(pRenderContext);
     mFrameCount++;
 
-    if (mUseStatisticProgressivePM) {
+    //Compare with the reference if a measurement is due. The radii are the ones used for this iteration
+    mConvergence.update(pRenderContext, renderData[kOutputChannels[0].name]->asTexture(), mFrameCount, mGlobalRadius, mCausticRadius);
+
+    //With per pixel SPPM the cells keep the start radius, it bounds the radius of every pixel
+    if (mUseStatisticProgressivePM && !mPerPixelSPPM) {
         float itF = static_cast<float>(mFrameCount);
         mGlobalRadius *= sqrt((itF + mSPPMAlphaGlobal) / (itF + 1.0f));
         mCausticRadius *= sqrt((itF + mSPPMAlphaCaustic) / (itF + 1.0f));
@@ -255,22 +543,95 @@ void PhotonMapperHash::execute(RenderContext* pRenderContext, const RenderData&
         mSetConstantBuffers = false;
 }
 
+float PhotonMapperHash::getCullingRadius() const
+{
+    if (mPerPixelSPPM)
+        return std::max(mCausticRadiusStart, mGlobalRadiusStart);
+    return std::max(mCausticRadius, mGlobalRadius);
+}
+
+void PhotonMapperHash::initPhotonCulling()
+{
+    //One bit per slot
+    const uint numWords = static_cast<uint>(CullingBloomFilter::getWordCount(mCullingHashBufferBits));
+    mCullingBuffer = Buffer::createStructured(sizeof(uint), numWords);
+    mCullingBuffer->setName("PhotonMapperHash::CullingHashBuffer");
+    mSetConstantBuffers = true;     //Generate needs the new bit mask
+}
+
+void PhotonMapperHash::resetCullingVars()
+{
+    mPhotonCullingPass.reset();
+    mCullingBuffer.reset();
+}
+
+void PhotonMapperHash::photonCullingPass(RenderContext* pRenderContext, const RenderData& renderData)
+{
+    FALCOR_PROFILE("photon culling");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Culling);
+
+    pRenderContext->clearUAV(mCullingBuffer->getUAV().get(), uint4(0));
+
+    if (!mPhotonCullingPass) {
+        Program::Desc desc;
+        desc.addShaderLibrary(kShaderPhotonCulling).csEntry("main").setShaderModel("6_5");
+        desc.addTypeConformances(mpScene->getTypeConformances());
+
+        Program::DefineList defines;
+        defines.add(mpScene->getSceneDefines());
+        defines.add("CULLING_USE_PROJECTION", mUseProjectionMatrixCulling ? "1" : "0");
+        defines.add("SPATIAL_HASH_FUNCTION", std::to_string(mHashFunction));    //Same function as the buckets
+
+        mPhotonCullingPass = ComputePass::create(desc, defines, true);
+    }
+
+    auto var = mPhotonCullingPass->getRootVar();
+    //Set Scene data. Is needed for camera etc.
+    mpScene->setRaytracingShaderData(pRenderContext, var, 1);
+
+    var["PerFrame"]["gHashScaleFactor"] = 1.0f / (getCullingRadius() * 2);  //Cells are twice the radius, so the 2x2x2 closest cells hold every photon in reach
+    var["PerFrame"]["gBitMask"] = CullingBloomFilter::getBitMask(mCullingHashBufferBits);
+    var["PerFrame"]["gNumHashes"] = mCullingNumHashes;
+    var["PerFrame"]["gProjTest"] = mCullingProjectionTestOver;
+
+    var[kInputChannels[0].texname] = renderData[kInputChannels[0].name]->asTexture();    //VBuffer
+    var["gHashBuffer"] = mCullingBuffer;
+
+    const uint2 targetDim = renderData.getDefaultTextureDims();
+    FALCOR_ASSERT(targetDim.x > 0 && targetDim.y > 0);
+
+    mPhotonCullingPass->execute(pRenderContext, uint3(targetDim, 1));
+
+    pRenderContext->uavBarrier(mCullingBuffer.get());
+}
+
 void PhotonMapperHash::generatePhotons(RenderContext* pRenderContext, const RenderData& renderData)
 {
+    FALCOR_PROFILE("generate photons");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Generate);
 
     //Reset counter Buffers
-    pRenderContext->copyBufferRegion(mPhotonCounterBuffer.counter.get(), 0, mPhotonCounterBuffer.reset.get(), 0, sizeof(uint64_t));
+    pRenderContext->copyBufferRegion(mPhotonCounterBuffer.counter.get(), 0, mPhotonCounterBuffer.reset.get(), 0, sizeof(uint4));
     pRenderContext->resourceBarrier(mPhotonCounterBuffer.counter.get(), Resource::State::ShaderResource);
 
-    //Clear the photon Buffers
-    pRenderContext->clearTexture(mGlobalBuffers.position.get(), float4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mGlobalBuffers.infoFlux.get(), float4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mGlobalBuffers.infoDir.get(), float4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mCausticBuffers.position.get(), float4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mCausticBuffers.infoFlux.get(), float4(0, 0, 0, 0));
-    pRenderContext->clearTexture(mCausticBuffers.infoDir.get(), float4(0, 0, 0, 0));
+    //Clear the photon Buffers. Linear streams are not cleared, collect only reads photons that the cleared buckets reference
+    for (PhotonBuffers* buffers : { &mGlobalBuffers, &mCausticBuffers }) {
+        if (buffers->streams) {
+            continue;
+        }
+        else if (buffers->packed) {
+            pRenderContext->clearUAV(buffers->packed->getUAV().get(), uint4(0, 0, 0, 0));
+        }
+        else {
+            pRenderContext->clearTexture(buffers->position.get(), float4(0, 0, 0, 0));
+            pRenderContext->clearTexture(buffers->infoFlux.get(), float4(0, 0, 0, 0));
+            pRenderContext->clearTexture(buffers->infoDir.get(), float4(0, 0, 0, 0));
+        }
+    }
     pRenderContext->clearUAV(mpGlobalBuckets->getUAV().get(), uint4(0, 0, 0, 0));
     pRenderContext->clearUAV(mpCausticBuckets->getUAV().get(), uint4(0, 0, 0, 0));
+    if (useHashTableStats())
+        pRenderContext->clearUAV(mHashTableStats.counters->getUAV().get(), uint4(0, 0, 0, 0));
     
 
     auto lights = mpScene->getLights();
@@ -282,13 +643,18 @@ void PhotonMapperHash::generatePhotons(RenderContext* pRenderContext, const Rend
     mTracerGenerate.pProgram->addDefine("USE_EMISSIVE_LIGHTS", mpScene->useEmissiveLights() ? "1" : "0");
     mTracerGenerate.pProgram->addDefine("USE_ENV_LIGHT", mpScene->useEnvLight() ? "1" : "0");
     mTracerGenerate.pProgram->addDefine("USE_ENV_BACKGROUND", mpScene->useEnvBackground() ? "1" : "0");
-    mTracerGenerate.pProgram->addDefine("MAX_PHOTON_INDEX_GLOBAL", std::to_string(mGlobalBuffers.maxSize));
-    mTracerGenerate.pProgram->addDefine("MAX_PHOTON_INDEX_CAUSTIC", std::to_string(mCausticBuffers.maxSize));
-    mTracerGenerate.pProgram->addDefine("ANALYTIC_INV_PDF", std::to_string(mAnalyticInvPdf));
+    mTracerGenerate.pProgram->addDefine("MAX_PHOTON_INDEX_GLOBAL", std::to_string(mGlobalBuffers.maxSize - 1));
+    mTracerGenerate.pProgram->addDefine("MAX_PHOTON_INDEX_CAUSTIC", std::to_string(mCausticBuffers.maxSize - 1));
     mTracerGenerate.pProgram->addDefine("INFO_TEXTURE_HEIGHT", std::to_string(kInfoTexHeight));
     mTracerGenerate.pProgram->addDefine("NUM_PHOTONS_PER_BUCKET", std::to_string(mNumPhotonsPerBucket));
     mTracerGenerate.pProgram->addDefine("NUM_BUCKETS", std::to_string(mNumBuckets));
+    mTracerGenerate.pProgram->addDefine("SPATIAL_HASH_FUNCTION", std::to_string(mHashFunction));
     mTracerGenerate.pProgram->addDefine("PHOTON_FACE_NORMAL", mEnableFaceNormalRejection ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("PHOTON_COMPACT", isCompactFormat(mInfoTexFormat) ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("PHOTON_STORAGE_LINEAR", isLinearStorage(mPhotonStorage) ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("HASH_GRID_CELL_RANGES", useCellRangeGrid() ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("HASH_TABLE_STATS", useHashTableStats() ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("CULLING_USE_PROJECTION", mUseProjectionMatrixCulling ? "1" : "0");
     
     // Prepare program vars. This may trigger shader compilation.
     // The program should have all necessary defines set at this point.
@@ -307,10 +673,14 @@ void PhotonMapperHash::generatePhotons(RenderContext* pRenderContext, const Rend
     //PerFrame Constant Buffer
     std::string nameBuf = "PerFrame";
     var[nameBuf]["gFrameCount"] = mFrameCount;
+    var[nameBuf]["gLightAliasTableSize"] = mLightAliasTableSize;
     var[nameBuf]["gCausticRadius"] = mCausticRadius;
     var[nameBuf]["gGlobalRadius"] = mGlobalRadius;
-    var[nameBuf]["gCausticHashScaleFactor"] = 1.f / mCausticRadius;
-    var[nameBuf]["gGlobalHashScaleFactor"] = 1.f / mGlobalRadius;
+    var[nameBuf]["gCausticHashScaleFactor"] = getHashScaleFactor(true);
+    var[nameBuf]["gGlobalHashScaleFactor"] = getHashScaleFactor(false);
+    var[nameBuf]["gCullingHashScaleFactor"] = 1.0f / (getCullingRadius() * 2);
+    var[nameBuf]["gCausticLayout"].setBlob(mCausticBuffers.layout);
+    var[nameBuf]["gGlobalLayout"].setBlob(mGlobalBuffers.layout);
 
     //Constant Buffer is only set when options changed
     if (mSetConstantBuffers) {
@@ -324,6 +694,11 @@ void PhotonMapperHash::generatePhotons(RenderContext* pRenderContext, const Rend
         var[nameBuf]["gUseAlphaTest"] = mUseAlphaTest;
         var[nameBuf]["gAdjustShadingNormals"] = mAdjustShadingNormals;
         var[nameBuf]["gQuadProbeIt"] = mQuadraticProbeIterations;
+
+        var[nameBuf]["gEnablePhotonCulling"] = mEnablePhotonCulling;
+        var[nameBuf]["gCullingBitMask"] = CullingBloomFilter::getBitMask(mCullingHashBufferBits);
+        var[nameBuf]["gCullingNumHashes"] = mCullingNumHashes;
+        var[nameBuf]["gCullingProjTest"] = mCullingProjectionTestOver;
     }
     
     //set the buffers
@@ -333,16 +708,26 @@ void PhotonMapperHash::generatePhotons(RenderContext* pRenderContext, const Rend
     var["gGlobalPos"] = mGlobalBuffers.position;
     var["gGlobalFlux"] = mGlobalBuffers.infoFlux;
     var["gGlobalDir"] = mGlobalBuffers.infoDir;
+    var["gCausticPacked"] = mCausticBuffers.packed;
+    var["gGlobalPacked"] = mGlobalBuffers.packed;
+    var["gCausticPhotons"] = mCausticBuffers.streams;
+    var["gGlobalPhotons"] = mGlobalBuffers.streams;
+    var["gCausticCellSlots"] = mCausticBuffers.cellSlots;
+    var["gGlobalCellSlots"] = mGlobalBuffers.cellSlots;
     var["gRndSeedBuffer"] = mRandNumSeedBuffer;
 
     var["gGlobalHashBucket"] = mpGlobalBuckets;
     var["gCausticHashBucket"] = mpCausticBuckets;
 
     var["gPhotonCounter"] = mPhotonCounterBuffer.counter;
+    var["gHashTableStats"] = mHashTableStats.counters;
+
+    //Set optional culling variables
+    if (mEnablePhotonCulling)
+        var["gCullingHashBuffer"] = mCullingBuffer;
 
-    //Bind light sample tex
-    var["gLightSample"] = mLightSampleTex;
-    var["gNumPhotonsPerEmissive"] = mPhotonsPerTriangle;
+    //Bind light table
+    var["gLightAliasTable"] = mLightAliasTable;
 
     // Get dimensions of ray dispatch.
     const uint2 targetDim = uint2(mPGDispatchX, mMaxDispatchY);
@@ -352,10 +737,171 @@ void PhotonMapperHash::generatePhotons(RenderContext* pRenderContext, const Rend
     mpScene->raytrace(pRenderContext, mTracerGenerate.pProgram.get(), mTracerGenerate.pVars, uint3(targetDim, 1));
 }
 
+void PhotonMapperHash::sortPhotons(RenderContext* pRenderContext)
+{
+    FALCOR_PROFILE("sort photons");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Sort);
+
+    if (!mPhotonSort.pInitKeys) {
+        Program::DefineList defines;
+        defines.add("NUM_PHOTONS_PER_BUCKET", std::to_string(mNumPhotonsPerBucket));
+        defines.add("NUM_BUCKETS", std::to_string(mNumBuckets));
+        defines.add("PHOTON_COMPACT", isCompactFormat(mInfoTexFormat) ? "1" : "0");
+        defines.add("DISPATCH_WIDTH", std::to_string(kSortDispatchWidth));
+
+        auto createPass = [&](const char* entry) {
+            Program::Desc desc;
+            desc.addShaderLibrary(kShaderSortPhoton).csEntry(entry).setShaderModel("6_5");
+            return ComputePass::create(desc, defines, true);
+        };
+        mPhotonSort.pInitKeys = createPass("initKeys");
+        mPhotonSort.pComputeKeys = createPass("computeKeys");
+        mPhotonSort.pReorder = createPass("reorder");
+        mPhotonSort.pRemapBuckets = createPass("remapBuckets");
+    }
+
+    //Key buffers are shared by both maps
+    const uint capacity = std::max(mCausticBuffers.maxSize, mGlobalBuffers.maxSize);
+    if (!mPhotonSort.keys || mPhotonSort.keys->getElementCount() < capacity) {
+        const ResourceBindFlags flags = ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess;
+        mPhotonSort.keys = Buffer::createStructured(sizeof(uint), capacity, flags, Buffer::CpuAccess::None, nullptr, false);
+        mPhotonSort.keys->setName("PhotonMapperHash::SortKeys");
+        mPhotonSort.values = Buffer::createStructured(sizeof(uint), capacity, flags, Buffer::CpuAccess::None, nullptr, false);
+        mPhotonSort.values->setName("PhotonMapperHash::SortValues");
+        mPhotonSort.remap = Buffer::createStructured(sizeof(uint), capacity, flags, Buffer::CpuAccess::None, nullptr, false);
+        mPhotonSort.remap->setName("PhotonMapperHash::SortRemap");
+    }
+
+    sortPhotonMap(pRenderContext, true);
+    sortPhotonMap(pRenderContext, false);
+}
+
+void PhotonMapperHash::sortPhotonMap(RenderContext* pRenderContext, bool caustic)
+{
+    PhotonBuffers& buffers = caustic ? mCausticBuffers : mGlobalBuffers;
+    const Buffer::SharedPtr& pBuckets = caustic ? mpCausticBuckets : mpGlobalBuckets;
+    FALCOR_ASSERT(buffers.streams);
+
+    if (!buffers.sortedStreams) {
+        buffers.sortedStreams = PhotonStreams::createBuffer(buffers.layout, caustic ? "PhotonMapperHash::mCausticBuffers.sortedStreams" : "PhotonMapperHash::mGlobalBuffers.sortedStreams");
+    }
+
+    //Compact photons are keyed by their bucket, the other formats by the Morton code of the cell (30 bits). The invalid key sorts behind all valid keys
+    const uint capacity = buffers.maxSize;
+    const uint keyBits = isCompactFormat(mInfoTexFormat) ? mNumBucketBits + 1 : 31;
+    const uint invalidKey = isCompactFormat(mInfoTexFormat) ? mNumBuckets : 1u << 30;
+
+    auto dispatchDim = [](uint threads) { return uint3(std::min(threads, kSortDispatchWidth), (threads + kSortDispatchWidth - 1) / kSortDispatchWidth, 1); };
+
+    for (ComputePass* pPass : { mPhotonSort.pInitKeys.get(), mPhotonSort.pComputeKeys.get(), mPhotonSort.pReorder.get(), mPhotonSort.pRemapBuckets.get() }) {
+        auto var = pPass->getRootVar();
+        var["CB"]["gCapacity"] = capacity;
+        var["CB"]["gInvalidKey"] = invalidKey;
+        var["CB"]["gHashScaleFactor"] = getHashScaleFactor(caustic);
+        var["CB"]["gLayout"].setBlob(buffers.layout);
+        var["gHashBucket"] = pBuckets;
+        var["gPhotons"] = buffers.streams;
+        var["gSortedPhotons"] = buffers.sortedStreams;
+        var["gKeys"] = mPhotonSort.keys;
+        var["gValues"] = mPhotonSort.values;
+        var["gRemap"] = mPhotonSort.remap;
+    }
+
+    mPhotonSort.pInitKeys->execute(pRenderContext, dispatchDim(capacity));
+    pRenderContext->uavBarrier(mPhotonSort.keys.get());
+    mPhotonSort.pComputeKeys->execute(pRenderContext, dispatchDim(mNumBuckets));
+    pRenderContext->uavBarrier(mPhotonSort.keys.get());
+
+    mPhotonSort.radixSort.sort(pRenderContext, mPhotonSort.keys, mPhotonSort.values, capacity, keyBits);
+
+    mPhotonSort.pReorder->execute(pRenderContext, dispatchDim(capacity));
+    pRenderContext->uavBarrier(mPhotonSort.remap.get());
+    mPhotonSort.pRemapBuckets->execute(pRenderContext, dispatchDim(mNumBuckets));
+
+    //The sorted photons are read from now on, the old streams are the target of the next sort
+    std::swap(buffers.streams, buffers.sortedStreams);
+}
+
+bool PhotonMapperHash::useCellRangeGrid() const
+{
+    return mHashGridMode == (uint)HashGridMode::CellRanges && isLinearStorage(mPhotonStorage);
+}
+
+void PhotonMapperHash::buildPhotonGrid(RenderContext* pRenderContext)
+{
+    FALCOR_PROFILE("build photon grid");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Sort);
+
+    if (!mPhotonGrid.pCount) {
+        Program::DefineList defines;
+        defines.add("DISPATCH_WIDTH", std::to_string(kSortDispatchWidth));
+
+        auto createPass = [&](const char* entry) {
+            Program::Desc desc;
+            desc.addShaderLibrary(kShaderGridPhoton).csEntry(entry).setShaderModel("6_5");
+            return ComputePass::create(desc, defines, true);
+        };
+        mPhotonGrid.pCount = createPass("count");
+        mPhotonGrid.pScanBlocks = createPass("scanBlocks");
+        mPhotonGrid.pScanBlockSums = createPass("scanBlockSums");
+        mPhotonGrid.pAddBlockOffsets = createPass("addBlockOffsets");
+        mPhotonGrid.pScatter = createPass("scatter");
+    }
+
+    buildPhotonGridMap(pRenderContext, true);
+    buildPhotonGridMap(pRenderContext, false);
+}
+
+void PhotonMapperHash::buildPhotonGridMap(RenderContext* pRenderContext, bool caustic)
+{
+    PhotonBuffers& buffers = caustic ? mCausticBuffers : mGlobalBuffers;
+    FALCOR_ASSERT(buffers.streams && buffers.cellStart);
+
+    if (!buffers.sortedStreams) {
+        buffers.sortedStreams = PhotonStreams::createBuffer(buffers.layout, caustic ? "PhotonMapperHash::mCausticBuffers.sortedStreams" : "PhotonMapperHash::mGlobalBuffers.sortedStreams");
+    }
+
+    //The number of photons is only known on the GPU, the passes read it from the photon counter
+    const uint capacity = buffers.maxSize;
+    const uint numBlocks = (mNumBuckets + 1 + kGridBlockSize - 1) / kGridBlockSize;
+    auto dispatchDim = [](uint threads) { return uint3(std::min(threads, kSortDispatchWidth), (threads + kSortDispatchWidth - 1) / kSortDispatchWidth, 1); };
+
+    for (ComputePass* pPass : { mPhotonGrid.pCount.get(), mPhotonGrid.pScanBlocks.get(), mPhotonGrid.pScanBlockSums.get(), mPhotonGrid.pAddBlockOffsets.get(), mPhotonGrid.pScatter.get() }) {
+        auto var = pPass->getRootVar();
+        var["CB"]["gCapacity"] = capacity;
+        var["CB"]["gCounterIndex"] = caustic ? 0u : 1u;
+        var["CB"]["gNumSlots"] = mNumBuckets;
+        var["CB"]["gNumBlocks"] = numBlocks;
+        var["CB"]["gLayout"].setBlob(buffers.layout);
+        var["gPhotonCounter"] = mPhotonCounterBuffer.counter;
+        var["gCellSlots"] = buffers.cellSlots;
+        var["gLocalOffsets"] = buffers.localOffsets;
+        var["gCellStart"] = buffers.cellStart;
+        var["gBlockSums"] = mPhotonGrid.blockSums;
+        var["gPhotons"] = buffers.streams;
+        var["gSortedPhotons"] = buffers.sortedStreams;
+    }
+
+    pRenderContext->clearUAV(buffers.cellStart->getUAV().get(), uint4(0, 0, 0, 0));
+    mPhotonGrid.pCount->execute(pRenderContext, dispatchDim(capacity));
+    pRenderContext->uavBarrier(buffers.cellStart.get());
+    mPhotonGrid.pScanBlocks->execute(pRenderContext, dispatchDim(numBlocks * 256));
+    pRenderContext->uavBarrier(mPhotonGrid.blockSums.get());
+    mPhotonGrid.pScanBlockSums->execute(pRenderContext, uint3(256, 1, 1));
+    pRenderContext->uavBarrier(mPhotonGrid.blockSums.get());
+    mPhotonGrid.pAddBlockOffsets->execute(pRenderContext, dispatchDim(mNumBuckets + 1));
+    pRenderContext->uavBarrier(buffers.cellStart.get());
+    mPhotonGrid.pScatter->execute(pRenderContext, dispatchDim(capacity));
+
+    //The scattered photons are read from now on, the old streams are written by the next generate pass
+    std::swap(buffers.streams, buffers.sortedStreams);
+}
+
 void PhotonMapperHash::collectPhotons(RenderContext* pRenderContext, const RenderData& renderData)
 {
     // Trace the photons
     FALCOR_PROFILE("collect photons");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Collect);
 
 
     if (!mpCSCollect) {
@@ -370,7 +916,14 @@ void PhotonMapperHash::collectPhotons(RenderContext* pRenderContext, const Rende
         defines.add("INFO_TEXTURE_HEIGHT", std::to_string(kInfoTexHeight));
         defines.add("NUM_PHOTONS_PER_BUCKET", std::to_string(mNumPhotonsPerBucket));
         defines.add("NUM_BUCKETS", std::to_string(mNumBuckets));
+        defines.add("SPATIAL_HASH_FUNCTION", std::to_string(mHashFunction));
+        defines.add("GATHER_TRAVERSAL", std::to_string(mGatherTraversal));
         defines.add("PHOTON_FACE_NORMAL", mEnableFaceNormalRejection ? "1" : "0");
+        defines.add("PHOTON_COMPACT", isCompactFormat(mInfoTexFormat) ? "1" : "0");
+        defines.add("PHOTON_STORAGE_LINEAR", isLinearStorage(mPhotonStorage) ? "1" : "0");
+        defines.add("HASH_GRID_CELL_RANGES", useCellRangeGrid() ? "1" : "0");
+        defines.add("HASH_TABLE_STATS", useHashTableStats() ? "1" : "0");
+        defines.add("PER_PIXEL_SPPM", mPerPixelSPPM ? "1" : "0");
 
         mpCSCollect = ComputePass::create(desc, defines, true);
     }
@@ -387,8 +940,10 @@ void PhotonMapperHash::collectPhotons(RenderContext* pRenderContext, const Rende
     var[nameBuf]["gFrameCount"] = mFrameCount;
     var[nameBuf]["gCausticRadius"] = mCausticRadius;
     var[nameBuf]["gGlobalRadius"] = mGlobalRadius;
-    var[nameBuf]["gCausticHashScaleFactor"] = 1.f / mCausticRadius;
-    var[nameBuf]["gGlobalHashScaleFactor"] = 1.f / mGlobalRadius;
+    var[nameBuf]["gCausticHashScaleFactor"] = getHashScaleFactor(true);
+    var[nameBuf]["gGlobalHashScaleFactor"] = getHashScaleFactor(false);
+    var[nameBuf]["gCausticLayout"].setBlob(mCausticBuffers.layout);
+    var[nameBuf]["gGlobalLayout"].setBlob(mGlobalBuffers.layout);
 
     //Set constant buffer only if changes where made
     if (mSetConstantBuffers) {
@@ -399,6 +954,10 @@ void PhotonMapperHash::collectPhotons(RenderContext* pRenderContext, const Rende
         var[nameBuf]["gQuadProbeIt"] = mQuadraticProbeIterations;
         var[nameBuf]["gEnableStochasicGathering"] = mEnableStochasticCollection;
         var[nameBuf]["gCollectProbability"] = mStochasticCollectProbability;
+        //Alpha of 1 keeps the start radius of every pixel
+        var[nameBuf]["gSPPMAlphaGlobal"] = mUseStatisticProgressivePM ? mSPPMAlphaGlobal : 1.f;
+        var[nameBuf]["gSPPMAlphaCaustic"] = mUseStatisticProgressivePM ? mSPPMAlphaCaustic : 1.f;
+        var[nameBuf]["gMinPhotonRadius"] = kMinPhotonRadius;
     }
 
 
@@ -412,6 +971,15 @@ void PhotonMapperHash::collectPhotons(RenderContext* pRenderContext, const Rende
     var["gGlobalPos"] = mGlobalBuffers.position;
     var["gGlobalFlux"] = mGlobalBuffers.infoFlux;
     var["gGlobalDir"] = mGlobalBuffers.infoDir;
+    var["gCausticPacked"] = mCausticBuffers.packed;
+    var["gGlobalPacked"] = mGlobalBuffers.packed;
+    var["gCausticPhotons"] = mCausticBuffers.streams;
+    var["gGlobalPhotons"] = mGlobalBuffers.streams;
+    var["gCausticCellStart"] = mCausticBuffers.cellStart;
+    var["gGlobalCellStart"] = mGlobalBuffers.cellStart;
+    var["gHashTableStats"] = mHashTableStats.counters;
+    var["gProgressiveStats"] = mProgressiveStats;
+    var["gProgressiveEmission"] = mProgressiveEmission;
 
     // Lamda for binding textures. These needs to be done per-frame as the buffers may change anytime.
     auto bindAsTex = [&](const ChannelDesc& desc)
@@ -448,6 +1016,14 @@ void PhotonMapperHash::renderUI(Gui::Widgets& widget)
     widget.tooltip("Photons for current Iteration / Buffer Size");
     widget.text("Global Photons: " + std::to_string(mPhotonCount[1]) + " / " + std::to_string(mGlobalBuffers.maxSize));
     widget.tooltip("Photons for current Iteration / Buffer Size");
+    if (mEnablePhotonCulling) {
+        const uint attempted = mPhotonCount[0] + mPhotonCount[1] + mPhotonsCulled;
+        const double culledRate = attempted > 0 ? 100.0 * mPhotonsCulled / attempted : 0.0;
+        widget.text(fmt::format("Culled Inserts: {} of {} ({:.1f}%)", mPhotonsCulled, attempted, culledRate));
+        widget.tooltip("Photons that skipped the bucket insert because no camera hit can gather them / all photons that would have been inserted");
+    }
+    widget.text("Photon Counter Latency: " + std::to_string(mPhotonCounterReadback.getLatency()) + " frames");
+    widget.tooltip("The photon counts are read back without waiting for the GPU and lag behind by this many frames");
 
     widget.text("Current Global Radius: " + std::to_string(mGlobalRadius));
     widget.text("Current Caustic Radius: " + std::to_string(mCausticRadius));
@@ -461,6 +1037,14 @@ void PhotonMapperHash::renderUI(Gui::Widgets& widget)
     widget.dummy("", float2(15,0), true);
     mFitBuffersToPhotonShot |= widget.button("Fit Buffers", true);
     widget.tooltip("Fitts the Caustic and Global Buffer to current number of photons shot + 10 %");
+    widget.checkbox("Automatic Buffer Size", mAutoBufferSize);
+    widget.tooltip("Grows the photon buffers before they overflow and shrinks them after a longer time of low use. Manual sizes are used as the start size");
+    if (mAutoBufferSize) {
+        const auto& causticStats = mCausticSizePolicy.getStats();
+        const auto& globalStats = mGlobalSizePolicy.getStats();
+        widget.text("Resizes: " + std::to_string(causticStats.grows + causticStats.shrinks + globalStats.grows + globalStats.shrinks) + ", Overflows: " + std::to_string(causticStats.overflows + globalStats.overflows));
+        widget.tooltip("Number of automatic buffer resizes and of counts that exceeded the buffer size since the last scene change");
+    }
     widget.dummy("", dummySpacing);
 
     //If fit buffers is triggered, also trigger the photon change routine
@@ -475,6 +1059,9 @@ void PhotonMapperHash::renderUI(Gui::Widgets& widget)
         widget.tooltip("Sets the Alpha in SPPM for the Global Photons");
         dirty |= widget.var("Caustic Alpha", mSPPMAlphaCaustic, 0.1f, 1.0f, 0.001f);
         widget.tooltip("Sets the Alpha in SPPM for the Caustic Photons");
+        mResetCS |= widget.checkbox("Per Pixel Radius", mPerPixelSPPM);
+        widget.tooltip("Every pixel shrinks its own radius with the photons it found (Hachisuka and Jensen).\n"
+                       "The current radius of the maps then only sets the hash cell size");
     }
     
     widget.dummy("", dummySpacing);
@@ -520,6 +1107,11 @@ void PhotonMapperHash::renderUI(Gui::Widgets& widget)
         dirty |= resetTimer;
     }
 
+    //Convergence measurement
+    if (auto group = widget.group("Convergence")) {
+        dirty |= mConvergence.renderUI(widget);
+    }
+
     //Radius settings
     if (auto group = widget.group("Radius Options")) {
         dirty |= widget.var("Caustic Radius Start", mCausticRadiusStart, kMinPhotonRadius, FLT_MAX, 0.001f);
@@ -529,6 +1121,25 @@ void PhotonMapperHash::renderUI(Gui::Widgets& widget)
         dirty |= widget.var("Russian Roulette", mRussianRoulette, 0.001f, 1.f, 0.001f);
         widget.tooltip("Probabilty that a Global Photon is saved");
     }
+    if (auto group = widget.group("Photon Culling")) {
+        dirty |= widget.checkbox("Enable Photon Culling", mEnablePhotonCulling);
+        widget.tooltip("Marks the cells around the camera hits in a hash. Photons in other cells are not inserted into the buckets");
+        mRebuildCullingBuffer |= widget.slider("Culling Buffer Size", mCullingHashBufferBits, 10u, 32u);
+        widget.tooltip("Number of bits in the culling buffer. 2^x");
+        if (mCullingBuffer) widget.text(fmt::format("Culling buffer: {:.1f} KB", mCullingBuffer->getSize() / 1024.0));
+        dirty |= widget.slider("Culling Hashes", mCullingNumHashes, 1u, kCullingMaxHashes);
+        widget.tooltip("Bits that a cell sets. 1 is a plain bit set, more hashes make it a Bloom filter with fewer false positives as long as only a small part of the bits is set");
+        bool projMatrix = widget.checkbox("Use Projection Matrix", mUseProjectionMatrixCulling);
+        widget.tooltip("Uses Projection Matrix additionally for culling");
+        if (mUseProjectionMatrixCulling) {
+            dirty |= widget.var("Culling Projection Test Value", mCullingProjectionTestOver, 1.0f, 1.5f, 0.001f);
+            widget.tooltip("Value used for the test with the projected postions. Any absolute value above is culled for the xy coordinate.");
+        }
+        if (projMatrix)
+            mPhotonCullingPass.reset();
+
+        dirty |= mRebuildCullingBuffer | projMatrix;
+    }
     //Material Settings
     if (auto group = widget.group("Material Options")) {
         dirty |= widget.var("Emissive Scalar", mIntensityScalar, 0.0f, FLT_MAX, 0.001f);
@@ -548,21 +1159,76 @@ void PhotonMapperHash::renderUI(Gui::Widgets& widget)
         widget.tooltip("Max number of photons that can be saved in a hash grid");
         mResetCS |= widget.slider("Bucket size (bits)", mNumBucketBits, 2u, 32u);
         widget.tooltip("Bucket size in 2^x. One bucket takes 16Byte + Num photons per bucket * 4 Byte");
+        mResetCS |= widget.dropdown("Hash function", kHashFunctionList, mHashFunction);
+        widget.tooltip("Hash function that maps a cell to a bucket");
+        mResetCS |= widget.dropdown("Gather traversal", kGatherTraversalList, mGatherTraversal);
+        widget.tooltip("Cells the collect pass looks up. Cube visits every cell of the cube around the cell of the hit, Sphere Overlap only the cells that overlap the gather sphere (8 cells at most with a cell size of 2x radius)");
+        dirty |= widget.dropdown("Cell size", kHashCellSizeList, mHashCellSize);
+        widget.tooltip("Edge length of the hash cells. Larger cells need fewer lookups, but hold more photons outside of the radius");
+        dirty |= widget.var("Grid levels", mHashGridLevels, 0u, 16u);
+        widget.tooltip("Number of power of two cell sizes below the start radius. The cells use the finest level that is at least the cell size above, so they only shrink when the radius halves. 0 lets the cells follow the radius in every iteration");
+        if (mHashGridLevels > 0)
+            widget.text(fmt::format("Cell size: global {:.5f}, caustic {:.5f}", 1.f / getHashScaleFactor(false), 1.f / getHashScaleFactor(true)));
+        mResetCS |= widget.checkbox("Hash Table Statistics", mEnableHashTableStats);
+        widget.tooltip("Counts the probes, probe failures and full buckets of the generate pass and the bucket lookups of the collect pass on the GPU.\n"
+            "Costs a few atomics per photon and lookup. The counters are read back without waiting and exported with the recorded times");
+        if (mEnableHashTableStats && !useHashTableStats())
+            widget.text("Only the buckets have hash table statistics");
+        else if (mEnableHashTableStats && mHashTableStats.hasLatest) {
+            const auto report = HashTableStats::createReport("GPU", mHashTableStats.latest, getHashTableSettings());
+            std::array<uint64_t, kHashStatsCount> histograms = {};
+            HashTableStats::accumulate(histograms, mHashTableStats.latest);
+            widget.text(fmt::format("Load factor: caustic {:.1f}%, global {:.1f}%", report.causticLoadFactor * 100.0, report.globalLoadFactor * 100.0));
+            widget.tooltip("Buckets claimed by a cell / number of buckets");
+            widget.text(fmt::format("Dropped: {:.2f}% ({} probe failures, {} full bucket inserts)", report.dropRate * 100.0, report.probeFailures, report.overflows));
+            widget.tooltip("Photons that found no bucket within the probe limit are lost. A photon added to a full bucket replaces a stored photon or is lost");
+            widget.text(fmt::format("Insert probe: avg {:.2f}, max {}", report.avgInsertProbe, report.maxInsertProbe));
+            widget.text("Insert probe histogram: " + HashTableStats::histogramToString(histograms, kHashStatsGenerateHistogram));
+            widget.tooltip("Successful inserts per probe length, the last bin holds all longer probes");
+            widget.text(fmt::format("Lookups: {:.1f}% hits, {:.2f}% probe limit, avg probe {:.2f}", report.hitRate * 100.0, report.probeLimitRate * 100.0, report.avgLookupProbe));
+            widget.text("Lookup probe histogram: " + HashTableStats::histogramToString(histograms, kHashStatsCollectHistogram));
+            widget.text(fmt::format("Photons: {} loaded, {:.2f}% other cell, {:.1f}% outside radius", report.collectPhotons, report.cellRejectRate * 100.0, report.radiusRejectRate * 100.0));
+            widget.tooltip("Collect lookups per probe length until the cell's or an empty bucket, the last bin holds all longer probes");
+        }
+        mResetCS |= widget.dropdown("Grid build", kHashGridModeList, mHashGridMode);
+        widget.tooltip("Buckets keep at most \"Num Photons per bucket\" photons per cell and replace photons stochastically when a bucket is full.\n"
+            "Cell Ranges counts the photons per slot, prefix sums the counts and scatters the photons into per slot ranges. No photon is dropped "
+            "and the memory grows with the photons instead of the buckets. Needs the Linear Buffers photon storage");
+        if (mHashGridMode == (uint)HashGridMode::CellRanges && !isLinearStorage(mPhotonStorage))
+            widget.text("Cell Ranges need linear storage, using buckets");
+        uint64_t hashBytes = 0;
+        for (const Buffer::SharedPtr& pBuffer : { mpCausticBuckets, mpGlobalBuckets, mCausticBuffers.cellSlots, mGlobalBuffers.cellSlots, mCausticBuffers.localOffsets,
+            mGlobalBuffers.localOffsets, mCausticBuffers.cellStart, mGlobalBuffers.cellStart }) {
+            if (pBuffer) hashBytes += pBuffer->getSize();
+        }
+        widget.text("Hash grid memory: " + std::to_string(hashBytes / (1024 * 1024)) + " MB");
+        widget.tooltip("Memory of the buckets or cell ranges of both maps, without the photons");
+        dirty |= widget.checkbox("Sort Photons", mSortPhotons);
+        widget.tooltip("Radix sorts the photons by the Morton code of their hash cell after generation, so the photons of a bucket are next to each other in memory.\n"
+            "Only used with the Linear Buffers photon storage and buckets, cell ranges are sorted by slot");
 
         dirty |= mResetCS;
     }
 
-    if (auto group = widget.group("Light Sample Tex")) {
+    if (auto group = widget.group("Light Sampling")) {
         mRebuildLightTex |= widget.dropdown("Sample mode", kLightTexModeList, (uint32_t&)mLightTexMode);
-        widget.tooltip("Changes photon distribution for the light sampling texture. Also rebuilds the texture.");
-        mRebuildLightTex |= widget.button("Rebuild Light Tex");
+        widget.tooltip("Changes photon distribution over the lights. Also rebuilds the light table.");
+        mRebuildLightTex |= widget.button("Rebuild Light Table");
         dirty |= mRebuildLightTex;
+        widget.checkbox("Async Rebuild", mAsyncLightTexRebuild);
+        widget.tooltip("Rebuilds the light table on a worker thread. The old table is used until the new one is ready");
     }
 
     mPhotonInfoFormatChanged |= widget.dropdown("Photon Info size", kInfoTexDropdownList, mInfoTexFormat);
-    widget.tooltip("Determines the resolution of each element of the photon info struct.");
+    widget.tooltip("Determines the resolution of each element of the photon info struct.\n"
+        "Compact stores a photon in 16 bytes: LogLuv flux, octahedral directions and the position inside its hash cell");
+
+    mPhotonStorageChanged |= widget.dropdown("Photon storage", kPhotonStorageList, mPhotonStorage);
+    widget.tooltip("2D Textures stores the photons in columns of 512 photons.\n"
+        "Linear Buffers stores every attribute as a stream in a raw buffer. Buffer sizes are not rounded and the streams are not cleared every iteration");
 
     dirty |= mPhotonInfoFormatChanged;  //Reset iterations if format is changed
+    dirty |= mPhotonStorageChanged;
 
     //Disable Photon Collecion
     if (auto group = widget.group("Collect Options")) {
@@ -600,6 +1266,7 @@ void PhotonMapperHash::setScene(RenderContext* pRenderContext, const Scene::Shar
     // After changing scene, the raytracing program should to be recreated.
     mTracerGenerate = RayTraceProgramHelper::create();
     mpCSCollect.reset();
+    mPhotonCullingPass.reset();
     mSetConstantBuffers = true;
     
     // Set new scene.
@@ -636,204 +1303,45 @@ void PhotonMapperHash::setScene(RenderContext* pRenderContext, const Scene::Shar
     }
 
     //init the photon counters
-    preparePhotonCounters();
+    preparePhotonCounters(pRenderContext);
 }
 
-void PhotonMapperHash::getActiveEmissiveTriangles(RenderContext* pRenderContext)
+void PhotonMapperHash::createLightSampleTable(RenderContext* pRenderContext)
 {
-    auto lightCollection = mpScene->getLightCollection(pRenderContext);
-
-    auto meshLightTriangles = lightCollection->getMeshLightTriangles();
-
-    mActiveEmissiveTriangles.clear();
-    mActiveEmissiveTriangles.reserve(meshLightTriangles.size());
+    FALCOR_ASSERT(mpScene);    //Scene has to be set
 
-    for (uint32_t triIdx = 0; triIdx < (uint32_t)meshLightTriangles.size(); triIdx++)
+    LightSampleTableBuilder::Table table;
     {
-        if (meshLightTriangles[triIdx].flux > 0.f)
-        {
-            mActiveEmissiveTriangles.push_back(triIdx);
-        }
+        FALCOR_PROFILE("light sample table");
+        auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::LightTable);
+        auto input = LightSampleTableBuilder::createInput(pRenderContext, mpScene, mNumPhotons, mMaxDispatchY, (LightSampleTableBuilder::Mode)mLightTexMode);
+        table = mLightTableBuilder.build(input);
     }
+    uploadLightSampleTable(table);
 }
 
-void PhotonMapperHash::createLightSampleTexture(RenderContext* pRenderContext)
+void PhotonMapperHash::uploadLightSampleTable(const LightSampleTableBuilder::Table& table)
 {
-    if (mPhotonsPerTriangle) mPhotonsPerTriangle.reset();
-    if (mLightSampleTex) mLightSampleTex.reset();
-
-    FALCOR_ASSERT(mpScene);    //Scene has to be set
+    FALCOR_PROFILE("upload light sample table");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::LightTable);
 
-    auto analyticLights = mpScene->getActiveLights();
-    auto lightCollection = mpScene->getLightCollection(pRenderContext);
+    if (mLightAliasTable) mLightAliasTable.reset();
 
-    uint analyticPhotons = 0;
-    uint numEmissivePhotons = 0;
-    //If there are analytic Lights split number of Photons even between the analytic light and the number of emissive models (approximation of the number of emissive lights)
-    if (analyticLights.size() != 0){
-        uint lightsTotal = static_cast<uint>(analyticLights.size() + lightCollection->getMeshLights().size());
-        float percentAnalytic = static_cast<float>(analyticLights.size()) / static_cast<float>(lightsTotal);
-        analyticPhotons = static_cast<uint>(mNumPhotons * percentAnalytic);
-        analyticPhotons += (uint)analyticLights.size() - (analyticPhotons % (uint) analyticLights.size());  //add it up so every light gets the same number of photons
-        numEmissivePhotons = mNumPhotons - analyticPhotons;
-    }
-    else
-        numEmissivePhotons = mNumPhotons;
-
-    std::vector<uint> numPhotonsPerTriangle;    //only filled when there are emissive
-
-    if (numEmissivePhotons > 0) {
-        getActiveEmissiveTriangles(pRenderContext);
-        auto meshLightTriangles = lightCollection->getMeshLightTriangles();
-        //Get total area to distribute to get the number of photons per area.
-        float totalMode = 0;
-        for (uint i = 0; i < (uint)mActiveEmissiveTriangles.size(); i++) {
-            uint triIdx = mActiveEmissiveTriangles[i];
-
-            switch (mLightTexMode) {
-            case LightTexMode::power:
-                totalMode += meshLightTriangles[triIdx].flux;
-                break;
-            case LightTexMode::area:
-                totalMode += meshLightTriangles[triIdx].area;
-                break;
-            default:
-                totalMode += meshLightTriangles[triIdx].flux;
-            }
-
-        }
-        float photonsPerMode = numEmissivePhotons / totalMode;
-
-        //Calculate photons on a per triangle base
-        uint tmpNumEmissivePhotons = 0; //Real count will change due to rounding
-        numPhotonsPerTriangle.reserve(mActiveEmissiveTriangles.size());
-        for (uint i = 0; i < (uint)mActiveEmissiveTriangles.size(); i++) {
-            uint triIdx = mActiveEmissiveTriangles[i];
-            uint photons = 0;
-
-            switch (mLightTexMode) {
-            case LightTexMode::power:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].flux * photonsPerMode));
-                break;
-            case LightTexMode::area:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].area * photonsPerMode));
-                break;
-            default:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].flux * photonsPerMode));
-            }
-
-
-            if (photons == 0) photons = 1;  //shoot at least one photon
-            tmpNumEmissivePhotons += photons;
-            numPhotonsPerTriangle.push_back(photons);
-        }
-        numEmissivePhotons = tmpNumEmissivePhotons;     //get real photon count
+    //Create the alias table buffer. Memory scales with the number of lights
+    mLightAliasTableSize = static_cast<uint>(table.aliasTable.size());
+    if (mLightAliasTableSize > 0) {
+        mLightAliasTable = Buffer::createStructured(sizeof(LightAliasEntry), mLightAliasTableSize, ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, table.aliasTable.data());
     }
-
-    uint totalNumPhotons = numEmissivePhotons + analyticPhotons;
-
-    //calculate the pdf for analytic and emissive light
-    if (analyticPhotons > 0 && analyticLights.size() > 0) {
-        mAnalyticInvPdf = (static_cast<float>(totalNumPhotons) * static_cast<float>(analyticLights.size())) / static_cast<float>(analyticPhotons);
-    }   
-
-    const uint blockSize = 16;
-    const uint blockSizeSq = blockSize * blockSize;
-
-    //Create texture. The texture fills 16x16 fields with information
-    
-    uint xPhotons = (totalNumPhotons / mMaxDispatchY) + 1;
-    xPhotons += (xPhotons % blockSize == 0 && analyticPhotons > 0) ? blockSize : blockSize - (xPhotons % blockSize);  //Fill up so x to 16x16 block with at least 1 block extra when mixed
-
-    //Init the texture with the invalid index (zero)
-    //Negative indices are analytic and postivie indices are emissive
-    std::vector<int32_t> lightIdxTex(xPhotons * mMaxDispatchY, 0);
-
-    //Helper functions
-    auto getIndex = [&](uint2 idx) {
-        return idx.x + idx.y * xPhotons;
-    };
-
-    auto getBlockStartingIndex = [&](uint blockIdx) {
-        blockIdx = blockIdx * blockSize;          //Multiply by the expansion of the box in x
-        uint x = blockIdx % xPhotons;
-        uint y = (blockIdx / xPhotons) * blockSize;
-        return uint2(x, y);
-    };
-
-    //Fill analytic lights
-    if (analyticLights.size() > 0) {
-        uint numCurrentLight = 0;
-        uint step = analyticPhotons / static_cast<uint>(analyticLights.size());
-        bool stop = false;
-        for (uint i = 0; i <= analyticPhotons / blockSizeSq; i++) {
-            if (stop) break;
-            for (uint y = 0; y < blockSize; y++) {
-                if (stop) break;
-                for (uint x = 0; x < blockSize; x++) {
-                    if (numCurrentLight >= analyticPhotons) {
-                        stop = true;
-                        break;
-                    }
-                    uint2 idx = getBlockStartingIndex(i);
-                    idx += uint2(x, y);
-                    int32_t lightIdx = static_cast<int32_t>((numCurrentLight / step) + 1);  //current light index + 1
-                    lightIdx *= -1;                                                         //turn it negative as it is a analytic light
-                    lightIdxTex[getIndex(idx)] = lightIdx;
-                    numCurrentLight++;
-                }
-            }
-        }
+    else {
+        //Table with a single invalid light, so the generate pass stays valid in a scene without lights
+        LightAliasEntry invalid = { 1.f, 0, 0, 0.f };
+        mLightAliasTable = Buffer::createStructured(sizeof(LightAliasEntry), 1, ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, &invalid);
+        mLightAliasTableSize = 1;
     }
-    
-
-    //Fill emissive lights
-    if (numEmissivePhotons > 0) {
-        uint analyticEndBlock = analyticPhotons > 0 ? (analyticPhotons / blockSizeSq) + 1 : 0;    //we have guaranteed an extra block
-        uint currentActiveTri = 0;
-        uint lightInActiveTri = 0;
-        bool stop = false;
-        for (uint i = 0; i <= numEmissivePhotons / blockSizeSq; i++) {
-            if (stop) break;
-            for (uint y = 0; y < blockSize; y++) {
-                if (stop) break;
-                for (uint x = 0; x < blockSize; x++) {
-                    if (currentActiveTri >= static_cast<uint>(numPhotonsPerTriangle.size())) {
-                        stop = true;
-                        break;
-                    }
-                    uint2 idx = getBlockStartingIndex(i + analyticEndBlock);
-                    idx += uint2(x, y);
-                    int32_t lightIdx = static_cast<int32_t>(currentActiveTri + 1);      //emissive has the positive index
-                    lightIdxTex[getIndex(idx)] = lightIdx;
-
-                    //Check if the number of photons exeed that of the current active triangle
-                    lightInActiveTri++;
-                    if (lightInActiveTri >= numPhotonsPerTriangle[currentActiveTri]) {
-                        currentActiveTri++;
-                        lightInActiveTri = 0;
-                    }
-                }
-            }
-        }
-    }
-    
-
-
-    //Create texture and Pdf buffer
-    mLightSampleTex = Texture::create2D(xPhotons, mMaxDispatchY, ResourceFormat::R32Int, 1, 1, lightIdxTex.data());
-    mLightSampleTex->setName("PhotonMapperHash::LightSampleTex");
-
-    //Create a buffer for num photons per triangle
-    if (numPhotonsPerTriangle.size() == 0) {
-        numPhotonsPerTriangle.push_back(0);
-    }
-    mPhotonsPerTriangle = Buffer::createStructured(sizeof(uint), static_cast<uint32_t>(numPhotonsPerTriangle.size()), ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, numPhotonsPerTriangle.data());
-    mPhotonsPerTriangle->setName("PhotonMapperHash::mPhotonsPerTriangleEmissive");
-
+    mLightAliasTable->setName("PhotonMapperHash::LightAliasTable");
 
     //Set numPhoton variable
-    mPGDispatchX = xPhotons;
+    mPGDispatchX = table.width;
 
     mNumPhotons = mPGDispatchX * mMaxDispatchY;
     mNumPhotonsUI = mNumPhotons;
@@ -847,21 +1355,23 @@ void PhotonMapperHash::resetPhotonMapper()
     mResizePhotonBuffers = true; mPhotonBuffersReady = false;
     mCausticBuffers.maxSize = 0; mGlobalBuffers.maxSize = 0;
     mPhotonCount[0] = 0; mPhotonCount[1] = 0;
+    mPhotonsCulled = 0;
+    mCausticSizePolicy.reset(); mGlobalSizePolicy.reset();
 
     mResetCS = true;
     mSetConstantBuffers = true;
 
-    //reset light sample tex
-    mLightSampleTex = nullptr;
+    //reset light table
+    mLightAliasTable = nullptr;
 }
 
 void PhotonMapperHash::changeNumPhotons()
 {
-    //If photon number differ reset the light sample texture
+    //If photon number differ reset the light table
     if (mNumPhotonsUI != mNumPhotons) {
-        //Reset light sample tex and frame counter
+        //Reset light table and frame counter
         mNumPhotons = mNumPhotonsUI;
-        mLightSampleTex = nullptr;
+        mLightAliasTable = nullptr;
         mFrameCount = 0;
     }
 
@@ -876,12 +1386,91 @@ void PhotonMapperHash::changeNumPhotons()
 
 void PhotonMapperHash::copyPhotonCounter(RenderContext* pRenderContext)
 {
-    //Copy the photonConter to a CPU Buffer
-    pRenderContext->copyBufferRegion(mPhotonCounterBuffer.cpuCopy.get(), 0, mPhotonCounterBuffer.counter.get(), 0, sizeof(uint32_t) * 2);
+    //Counts from before a reset are not valid for the new iteration
+    if (mFrameCount == 0)
+        mPhotonCounterReadback.invalidate();
 
-    void* data = mPhotonCounterBuffer.cpuCopy->map(Buffer::MapType::Read);
-    std::memcpy(mPhotonCount.data(), data, sizeof(uint) * 2);
-    mPhotonCounterBuffer.cpuCopy->unmap();
+    mPhotonCounterReadback.enqueue();
+}
+
+void PhotonMapperHash::updatePhotonCounter()
+{
+    if (mPhotonCounterReadback.poll()) {
+        auto count = mPhotonCounterReadback.getValue<std::array<uint, 3>>();
+        mPhotonCount[0] = count[0]; mPhotonCount[1] = count[1];
+        mPhotonsCulled = count[2];
+
+        //Resize the buffers before photons get clamped onto the last slot. The counters are not clamped, so overflows show up in the count
+        if (mAutoBufferSize && mPhotonBuffersReady && !mResizePhotonBuffers) {
+            uint causticSize = static_cast<uint>(mCausticSizePolicy.addCount(count[0]));
+            uint globalSize = static_cast<uint>(mGlobalSizePolicy.addCount(count[1]));
+            if (causticSize != mCausticBuffers.maxSize || globalSize != mGlobalBuffers.maxSize) {
+                mCausticBufferSizeUI = causticSize; mGlobalBufferSizeUI = globalSize;
+                mResizePhotonBuffers = true;
+            }
+        }
+    }
+}
+
+float PhotonMapperHash::getHashScaleFactor(bool caustic) const
+{
+    const float radius = caustic ? mCausticRadius : mGlobalRadius;
+    if (mHashGridLevels == 0)
+        return 1.f / (float(mHashCellSize) * radius);
+    const auto levels = HashGridLevels::create(caustic ? mCausticRadiusStart : mGlobalRadiusStart, mHashGridLevels, float(mHashCellSize));
+    return HashGridLevels::getCellScale(levels, HashGridLevels::getLevel(levels, radius));
+}
+
+bool PhotonMapperHash::useHashTableStats() const
+{
+    return mEnableHashTableStats && !useCellRangeGrid();
+}
+
+HashTableStats::Settings PhotonMapperHash::getHashTableSettings() const
+{
+    HashTableStats::Settings settings;
+    settings.bucketBits = mNumBucketBits;
+    settings.photonsPerBucket = mNumPhotonsPerBucket;
+    settings.quadraticProbeIterations = mQuadraticProbeIterations;
+    settings.function = (SpatialHashFunction)mHashFunction;
+    return settings;
+}
+
+void PhotonMapperHash::copyHashTableStats(RenderContext* pRenderContext)
+{
+    if (!useHashTableStats()) return;
+
+    //Counts from before a reset belong to other settings
+    if (mFrameCount == 0)
+        mHashTableStats.readback.invalidate();
+
+    mHashTableStats.readback.enqueue();
+}
+
+void PhotonMapperHash::updateHashTableStats()
+{
+    if (!mHashTableStats.readback.poll()) return;
+    mHashTableStats.latest = mHashTableStats.readback.getValue<HashTableStats::Counters>();
+    mHashTableStats.hasLatest = true;
+    if (!mStageTimes.isEnabled()) return;
+
+    //The counters lag behind by the readback latency, they are added to the iteration they arrive in
+    HashTableStats::accumulate(mHashTableStats.recorded, mHashTableStats.latest);
+    const auto report = HashTableStats::createReport("GPU", mHashTableStats.latest, getHashTableSettings());
+    mStageTimes.setCounter("hashInserts", (double)report.inserts);
+    mStageTimes.setCounter("hashProbeFailures", (double)report.probeFailures);
+    mStageTimes.setCounter("hashOverflows", (double)report.overflows);
+    mStageTimes.setCounter("hashCausticLoadFactor", report.causticLoadFactor);
+    mStageTimes.setCounter("hashGlobalLoadFactor", report.globalLoadFactor);
+    mStageTimes.setCounter("hashDropRate", report.dropRate);
+    mStageTimes.setCounter("hashAvgInsertProbe", report.avgInsertProbe);
+    mStageTimes.setCounter("collectLookups", (double)report.lookups);
+    mStageTimes.setCounter("collectHitRate", report.hitRate);
+    mStageTimes.setCounter("collectProbeLimitRate", report.probeLimitRate);
+    mStageTimes.setCounter("collectAvgProbe", report.avgLookupProbe);
+    mStageTimes.setCounter("collectPhotons", (double)report.collectPhotons);
+    mStageTimes.setCounter("collectCellRejectRate", report.cellRejectRate);
+    mStageTimes.setCounter("collectRadiusRejectRate", report.radiusRejectRate);
 }
 
 void PhotonMapperHash::prepareVars()
@@ -922,8 +1511,29 @@ void PhotonMapperHash::preparePhotonInfoTexture()
 {
     FALCOR_ASSERT(mCausticBuffers.maxSize > 0 || mGlobalBuffers.maxSize > 0);
     //clean tex
-    mCausticBuffers.infoFlux.reset(); mCausticBuffers.infoDir.reset();  mCausticBuffers.position.reset();
-    mGlobalBuffers.infoFlux.reset(); mGlobalBuffers.infoDir.reset(); mGlobalBuffers.position.reset();
+    mCausticBuffers.infoFlux.reset(); mCausticBuffers.infoDir.reset();  mCausticBuffers.position.reset(); mCausticBuffers.packed.reset(); mCausticBuffers.streams.reset(); mCausticBuffers.sortedStreams.reset();
+    mGlobalBuffers.infoFlux.reset(); mGlobalBuffers.infoDir.reset(); mGlobalBuffers.position.reset(); mGlobalBuffers.packed.reset(); mGlobalBuffers.streams.reset(); mGlobalBuffers.sortedStreams.reset();
+    mCausticBuffers.layout = {}; mGlobalBuffers.layout = {};
+
+    //Linear storage keeps all attributes of a map in one buffer
+    if (isLinearStorage(mPhotonStorage)) {
+        mCausticBuffers.layout = createPhotonStreamLayout(mCausticBuffers.maxSize, mInfoTexFormat);
+        mCausticBuffers.streams = PhotonStreams::createBuffer(mCausticBuffers.layout, "PhotonMapperHash::mCausticBuffers.streams");
+        mGlobalBuffers.layout = createPhotonStreamLayout(mGlobalBuffers.maxSize, mInfoTexFormat);
+        mGlobalBuffers.streams = PhotonStreams::createBuffer(mGlobalBuffers.layout, "PhotonMapperHash::mGlobalBuffers.streams");
+        return;
+    }
+
+    //Compact photons need a single texture per map
+    if (isCompactFormat(mInfoTexFormat)) {
+        mCausticBuffers.packed = Texture::create2D(mCausticBuffers.maxSize / kInfoTexHeight, kInfoTexHeight, ResourceFormat::RGBA32Uint, 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+        mCausticBuffers.packed->setName("PhotonMapperHash::mCausticBuffers.packed");
+        mGlobalBuffers.packed = Texture::create2D(mGlobalBuffers.maxSize / kInfoTexHeight, kInfoTexHeight, ResourceFormat::RGBA32Uint, 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+        mGlobalBuffers.packed->setName("PhotonMapperHash::mGlobalBuffers.packed");
+
+        FALCOR_ASSERT(mCausticBuffers.packed); FALCOR_ASSERT(mGlobalBuffers.packed);
+        return;
+    }
    
     //Caustic
     mCausticBuffers.infoFlux = Texture::create2D(mCausticBuffers.maxSize / kInfoTexHeight, kInfoTexHeight, getFormatRGBA(mInfoTexFormat, true), 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
@@ -945,6 +1555,20 @@ void PhotonMapperHash::preparePhotonInfoTexture()
     FALCOR_ASSERT(mGlobalBuffers.infoFlux); FALCOR_ASSERT(mGlobalBuffers.infoDir); FALCOR_ASSERT(mGlobalBuffers.position);
 }
 
+uint PhotonMapperHash::getPhotonBufferGranularity() const
+{
+    return isLinearStorage(mPhotonStorage) ? 1 : kInfoTexHeight;
+}
+
+void PhotonMapperHash::updateSizePolicyGranularity()
+{
+    for (PhotonBufferSizePolicy* policy : { &mCausticSizePolicy, &mGlobalSizePolicy }) {
+        PhotonBufferSizePolicy::Options options = policy->getOptions();
+        options.granularity = getPhotonBufferGranularity();
+        policy->setOptions(options);
+    }
+}
+
 void PhotonMapperHash::prepareHashBuffer()
 {
     //reset buffers if already set
@@ -953,13 +1577,34 @@ void PhotonMapperHash::prepareHashBuffer()
         mpCausticBuckets.reset();
     }
 
-    //Build buffers
+    //Build buffers. The cell range grid only keeps a single bucket for the shader bindings
     mNumBuckets = 1 << mNumBucketBits;
-    mpGlobalBuckets = Buffer::createStructured(sizeof(uint32_t) * (mNumPhotonsPerBucket + 4), mNumBuckets);
+    const uint numBucketElements = useCellRangeGrid() ? 1 : mNumBuckets;
+    mpGlobalBuckets = Buffer::createStructured(sizeof(uint32_t) * (mNumPhotonsPerBucket + 4), numBucketElements);
     mpGlobalBuckets->setName("PhotonMapperHash::BucketGlobal");
-    mpCausticBuckets = Buffer::createStructured(sizeof(uint32_t) * (mNumPhotonsPerBucket + 4), mNumBuckets);
+    mpCausticBuckets = Buffer::createStructured(sizeof(uint32_t) * (mNumPhotonsPerBucket + 4), numBucketElements);
     mpCausticBuckets->setName("PhotonMapperHash::BucketCaustic");
 
+    //Cell range grid
+    for (PhotonBuffers* buffers : { &mCausticBuffers, &mGlobalBuffers }) {
+        buffers->cellSlots.reset(); buffers->localOffsets.reset(); buffers->cellStart.reset();
+        if (!useCellRangeGrid()) continue;
+        const std::string name = buffers == &mCausticBuffers ? "PhotonMapperHash::mCausticBuffers" : "PhotonMapperHash::mGlobalBuffers";
+        const ResourceBindFlags flags = ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess;
+        const uint capacity = std::max(buffers->maxSize, 1u);
+        buffers->cellSlots = Buffer::createStructured(sizeof(uint), capacity, flags, Buffer::CpuAccess::None, nullptr, false);
+        buffers->cellSlots->setName(name + ".cellSlots");
+        buffers->localOffsets = Buffer::createStructured(sizeof(uint), capacity, flags, Buffer::CpuAccess::None, nullptr, false);
+        buffers->localOffsets->setName(name + ".localOffsets");
+        buffers->cellStart = Buffer::createStructured(sizeof(uint), mNumBuckets + 1, flags, Buffer::CpuAccess::None, nullptr, false);
+        buffers->cellStart->setName(name + ".cellStart");
+    }
+    if (useCellRangeGrid()) {
+        const uint numBlocks = (mNumBuckets + 1 + kGridBlockSize - 1) / kGridBlockSize;
+        mPhotonGrid.blockSums = Buffer::createStructured(sizeof(uint), numBlocks, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+        mPhotonGrid.blockSums->setName("PhotonMapperHash::GridBlockSums");
+    }
+
 }
 
 bool PhotonMapperHash::preparePhotonBuffers()
@@ -975,17 +1620,22 @@ bool PhotonMapperHash::preparePhotonBuffers()
     return true;
 }
 
-void PhotonMapperHash::preparePhotonCounters()
+void PhotonMapperHash::preparePhotonCounters(RenderContext* pRenderContext)
 {
     //photon counter
-    mPhotonCounterBuffer.counter = Buffer::createStructured(sizeof(uint), 2);
+    //photon counter [caustic, global, culled, pad]
+    mPhotonCounterBuffer.counter = Buffer::createStructured(sizeof(uint), 4);
     mPhotonCounterBuffer.counter->setName("PhotonMapperHash::PhotonCounter");
-    uint64_t zeroInit = 0;
-    mPhotonCounterBuffer.reset = Buffer::create(sizeof(uint64_t), ResourceBindFlags::None, Buffer::CpuAccess::None, &zeroInit);
+    uint4 zeroInit = uint4(0);
+    mPhotonCounterBuffer.reset = Buffer::create(sizeof(uint4), ResourceBindFlags::None, Buffer::CpuAccess::None, &zeroInit);
     mPhotonCounterBuffer.reset->setName("PhotonMapperHash::PhotonCounterReset");
-    uint32_t oneInit[2] = { 1,1 };
-    mPhotonCounterBuffer.cpuCopy = Buffer::create(sizeof(uint64_t), ResourceBindFlags::None, Buffer::CpuAccess::Read, oneInit);
-    mPhotonCounterBuffer.cpuCopy->setName("PhotonMapperHash::PhotonCounterCPU");
+    mPhotonCounterReadback.init(FalcorReadbackDevice::create(pRenderContext, mPhotonCounterBuffer.counter, sizeof(uint) * 3));
+
+    //hash table counters
+    mHashTableStats.counters = Buffer::createStructured(sizeof(uint), kHashStatsCount);
+    mHashTableStats.counters->setName("PhotonMapperHash::HashTableStats");
+    mHashTableStats.readback.init(FalcorReadbackDevice::create(pRenderContext, mHashTableStats.counters, sizeof(uint) * kHashStatsCount));
+    mHashTableStats.hasLatest = false;
 }
 
 void PhotonMapperHash::prepareRandomSeedBuffer(const uint2 screenDimensions)
@@ -1004,9 +1654,26 @@ void PhotonMapperHash::prepareRandomSeedBuffer(const uint2 screenDimensions)
     FALCOR_ASSERT(mRandNumSeedBuffer);
 }
 
+void PhotonMapperHash::prepareProgressiveBuffers(const uint2 screenDimensions)
+{
+    FALCOR_ASSERT(screenDimensions.x > 0 && screenDimensions.y > 0);
+    if (mProgressiveEmission && mProgressiveEmission->getWidth() == screenDimensions.x && mProgressiveEmission->getHeight() == screenDimensions.y)
+        return;
+
+    mProgressiveStats = Buffer::createStructured(sizeof(ProgressivePhotonStats), 2 * screenDimensions.x * screenDimensions.y, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+    mProgressiveStats->setName("PhotonMapperHash::ProgressiveStats");
+    mProgressiveEmission = Texture::create2D(screenDimensions.x, screenDimensions.y, ResourceFormat::RGBA32Float, 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+    mProgressiveEmission->setName("PhotonMapperHash::ProgressiveEmission");
+    //The statistics are only initialized in the first iteration
+    mFrameCount = 0;
+}
+
 void PhotonMapperHash::checkTimer()
 {
-    if (!mUseTimer) return;
+    if (!mUseTimer) {
+        mStageTimes.setEnabled(false);
+        return;
+    }
 
     //reset timer
     if (mResetTimer) {
@@ -1014,10 +1681,9 @@ void PhotonMapperHash::checkTimer()
         mTimerStartTime = std::chrono::steady_clock::now();
         mTimerStopRenderer = false;
         mResetTimer = false;
-        if (mTimerRecordTimes) {
-            mTimesList.clear();
-            mTimesList.reserve(10000);
-        }
+        mStageTimes.clear();
+        mStageTimes.setEnabled(mTimerRecordTimes);
+        mHashTableStats.recorded = {};
         return;
     }
 
@@ -1041,30 +1707,60 @@ void PhotonMapperHash::checkTimer()
         }
     }
 
-    //Add to times list
+    //Start the next iteration. The profiler holds the GPU times of the last frame, so they belong to the previous one
     if (mTimerRecordTimes) {
-        mTimesList.push_back(mCurrentElapsedTime);
+        StageTimingProfiler::setGpuTimes(mStageTimes);
+        mStageTimes.beginIteration(mFrameCount, mCurrentElapsedTime);
+    }
+
+    //Store the times as soon as the timer stops. Scripted runs set the output file via the dictionary
+    if (mTimerStopRenderer && mTimerRecordTimes) {
+        mStageTimes.endIteration();
+        outputTimes();
     }
 }
 
 void PhotonMapperHash::outputTimes()
 {
-    if (mTimesOutputFilePath.empty() || mTimesList.empty()) return;
-
-    std::ofstream file = std::ofstream(mTimesOutputFilePath, std::ios::trunc);
-
-    if (!file) {
-        reportError(fmt::format("Failed to open file '{}'.", mTimesOutputFilePath));
-        mTimesOutputFilePath.clear();
-        return;
+    if (mTimesOutputFilePath.empty() || mStageTimes.getIterations().empty()) return;
+
+    //Run metadata
+    mStageTimes.setMetadata("pass", "PhotonMapperHash");
+    if (mpScene) mStageTimes.setMetadata("scene", mpScene->getPath().string());
+    mStageTimes.setMetadata("numPhotons", mNumPhotons);
+    mStageTimes.setMetadata("globalBufferSize", mGlobalBufferSizeUI);
+    mStageTimes.setMetadata("causticBufferSize", mCausticBufferSizeUI);
+    mStageTimes.setMetadata("globalRadiusStart", mGlobalRadiusStart);
+    mStageTimes.setMetadata("causticRadiusStart", mCausticRadiusStart);
+    mStageTimes.setMetadata("useSPPM", mUseStatisticProgressivePM);
+    mStageTimes.setMetadata("perPixelSPPM", mPerPixelSPPM);
+    mStageTimes.setMetadata("maxBounces", mMaxBounces);
+    mStageTimes.setMetadata("numBucketBits", mNumBucketBits);
+    mStageTimes.setMetadata("hashFunction", mHashFunction);
+    mStageTimes.setMetadata("gatherTraversal", mGatherTraversal);
+    mStageTimes.setMetadata("hashCellSize", mHashCellSize);
+    mStageTimes.setMetadata("hashGridLevels", mHashGridLevels);
+    mStageTimes.setMetadata("sortPhotons", mSortPhotons && isLinearStorage(mPhotonStorage));
+    mStageTimes.setMetadata("hashGridMode", useCellRangeGrid() ? mHashGridMode : (uint)HashGridMode::Buckets);
+    mStageTimes.setMetadata("numPhotonsPerBucket", mNumPhotonsPerBucket);
+    mStageTimes.setMetadata("quadraticProbeIterations", mQuadraticProbeIterations);
+    mStageTimes.setMetadata("hashTableStats", useHashTableStats());
+    mStageTimes.setMetadata("enablePhotonCulling", mEnablePhotonCulling);
+    if (mEnablePhotonCulling) {
+        mStageTimes.setMetadata("cullingHashBufferBits", mCullingHashBufferBits);
+        mStageTimes.setMetadata("cullingNumHashes", mCullingNumHashes);
+        mStageTimes.setMetadata("useProjectionMatrixCulling", mUseProjectionMatrixCulling);
+        mStageTimes.setMetadata("culledInserts", mPhotonsCulled);
+    }
+    if (useHashTableStats()) {
+        mStageTimes.setMetadata("insertProbeHistogram", HashTableStats::histogramToString(mHashTableStats.recorded, kHashStatsGenerateHistogram));
+        mStageTimes.setMetadata("lookupProbeHistogram", HashTableStats::histogramToString(mHashTableStats.recorded, kHashStatsCollectHistogram));
     }
+    mStageTimes.setMetadata("iterations", mFrameCount);
 
-    //Write into file
-    file << "Hash_Times" << std::endl;
-    file << std::fixed << std::setprecision(16);
-    for (size_t i = 0; i < mTimesList.size(); i++) {
-        file << mTimesList[i];
-        file << std::endl;
+    std::filesystem::path jsonPath = std::filesystem::path(mTimesOutputFilePath).replace_extension(".json");
+    if (!mStageTimes.writeCsv(mTimesOutputFilePath) || !mStageTimes.writeJson(jsonPath.string())) {
+        reportError(fmt::format("Failed to write the times to '{}'.", mTimesOutputFilePath));
+        mTimesOutputFilePath.clear();
     }
-    file.close();
 }
@@ -28,6 +28,19 @@
 #pragma once
 #include "Falcor.h"
 #include "Utils/Sampling/SampleGenerator.h"
+#include "../PhotonMapperCommon/SpatialHash.slang"
+#include "../PhotonMapperCommon/GatherCells.slang"
+#include "../PhotonMapperCommon/HashGridLevels.h"
+#include "../PhotonMapperCommon/CullingBloomFilter.h"
+#include "../PhotonMapperCommon/ProgressiveRadius.slang"
+#include "../PhotonMapperCommon/LightSampleTableBuilder.h"
+#include "../PhotonMapperCommon/StageTimingProfiler.h"
+#include "../PhotonMapperCommon/ConvergenceMonitor.h"
+#include "../PhotonMapperCommon/PhotonBufferSizePolicy.h"
+#include "../PhotonMapperCommon/ReadbackRing.h"
+#include "../PhotonMapperCommon/PhotonStreams.h"
+#include "../PhotonMapperCommon/PhotonRadixSort.h"
+#include "../PhotonMapperCommon/HashTableStats.h"
 #include <chrono>
 
 using namespace Falcor;
@@ -58,7 +71,13 @@ public:
     enum class TextureFormat {
         _8Bit = 0u,
         _16Bit = 1u,
-        _32Bit = 2u
+        _32Bit = 2u,
+        Compact = 3u        ///< One 16 byte record per photon, see PhotonPacking.slang
+    };
+
+    enum class HashGridMode : uint32_t {
+        Buckets = 0u,       ///< Fixed size buckets with quadratic probing, at most NUM_PHOTONS_PER_BUCKET photons per cell
+        CellRanges = 1u     ///< Photons sorted into [begin, end) ranges per slot with a counting sort. Needs linear storage
     };
 
     enum LightTexMode : uint32_t {
@@ -67,7 +86,11 @@ public:
     };
 
 private:
-    PhotonMapperHash();
+    PhotonMapperHash(const Dictionary& dict);
+
+    /** Parses the dictonary when creating the render pass
+    */
+    void parseDictionary(const Dictionary& dict);
 
     /** Prepares Program Variables and binds the sample generator
     */
@@ -85,9 +108,17 @@ private:
     */
     void preparePhotonInfoTexture();
 
-    /** Creates the photon counter for caustic and global photon buffers
+    /** Granularity of the photon buffer sizes. Texture storage needs whole columns of the info textures
     */
-    void preparePhotonCounters();
+    uint getPhotonBufferGranularity() const;
+
+    /** Applies the granularity of the current photon storage to the size policies
+    */
+    void updateSizePolicyGranularity();
+
+    /** Creates the photon counter for caustic and global photon buffers and its readback ring
+    */
+    void preparePhotonCounters(RenderContext* pRenderContext);
 
     /** Resets buffer and runtime vars. Used for scene change or number of photons change
     */
@@ -97,14 +128,74 @@ private:
     */
     void changeNumPhotons();
 
-    /** Copies the photon counter to a cpu buffer
+    /** Enqueues a copy of the photon counter into the readback ring. Has to be called after the generate pass
     */
     void copyPhotonCounter(RenderContext* pRenderContext);
 
+    /** Takes the newest photon counter from the readback ring without waiting for the GPU
+    */
+    void updatePhotonCounter();
+
+    /** Scale from world position to hash cell, 1 / (cell size * radius) or the scale of the grid level of the radius
+    */
+    float getHashScaleFactor(bool caustic) const;
+
+    /** True if the hash table counters are recorded. The cell range grid has no buckets to count
+    */
+    bool useHashTableStats() const;
+
+    /** Current bucket settings for the hash table statistics and the simulation
+    */
+    HashTableStats::Settings getHashTableSettings() const;
+
+    /** Enqueues a copy of the hash table counters into their readback ring. Has to be called after the collect pass
+    */
+    void copyHashTableStats(RenderContext* pRenderContext);
+
+    /** Takes the newest hash table counters from the readback ring and adds them to the recorded times
+    */
+    void updateHashTableStats();
+
+    /** Radius that the culling cells are built for. Per pixel radii never exceed the start radii
+    */
+    float getCullingRadius() const;
+
+    /** Creates the culling bit set with 2^mCullingHashBufferBits bits
+    */
+    void initPhotonCulling();
+
+    /** Resets the culling pass and buffer. This saves memory if the culling is deactivated
+    */
+    void resetCullingVars();
+
+    /** Marks the culling cells around every camera hit. Generate skips the bucket insert for photons in unmarked cells
+    */
+    void photonCullingPass(RenderContext* pRenderContext, const RenderData& renderData);
+
     /** Creates the Generate Photon pass, where the photons are shot through the scene and saved in an AABB and information buffer
     */
     void generatePhotons(RenderContext* pRenderContext, const RenderData& renderData);
 
+    /** Sorts the photons of both maps by the Morton code of their hash cell and remaps the buckets. Needs linear storage
+    */
+    void sortPhotons(RenderContext* pRenderContext);
+
+    /** Sorts the photons of the caustic or global map into its sorted streams and swaps them with the streams
+    */
+    void sortPhotonMap(RenderContext* pRenderContext, bool caustic);
+
+    /** True if the cell range grid is used. Falls back to the buckets with texture storage
+    */
+    bool useCellRangeGrid() const;
+
+    /** Builds the cell range grid of both maps with a count, prefix sum and scatter pass
+    */
+    void buildPhotonGrid(RenderContext* pRenderContext);
+
+    /** Builds the cell range grid of the caustic or global map. The scattered photons are swapped with the streams
+    */
+    void buildPhotonGridMap(RenderContext* pRenderContext, bool caustic);
+
     /** Pass that collect the photons. It will shoot a infinit small ray at the current camera position and collect all photons.
     * The needed position etc. has to be provided by a gBuffer
     */
@@ -115,21 +206,23 @@ private:
     */
     void prepareRandomSeedBuffer(const uint2 screenDimensions);
 
-    /** Prepares a light sample texture for the photon generate pass
+    /** Creates the per pixel SPPM statistics if they do not match the screen size. The collect pass initializes them in the first iteration
     */
-    void createLightSampleTexture(RenderContext* pRenderContext);
+    void prepareProgressiveBuffers(const uint2 screenDimensions);
 
-    /** Gets the active emissive triangles from the light collection.
-    *  This is analogous to the function from LightCollection. It is here to prevent changes to the core of Falcor.
-    *  As this is done once it has no impact on performance and only a minimal impact on CPU-Memory
+    /** Prepares the light alias table for the photon generate pass
     */
-    void getActiveEmissiveTriangles(RenderContext* pRenderContext);
+    void createLightSampleTable(RenderContext* pRenderContext);
+
+    /** Uploads a built light sample table and sets the dispatch size and number of photons from it
+    */
+    void uploadLightSampleTable(const LightSampleTableBuilder::Table& table);
 
     /** Checks the timer. This is to stop the renderer for performance tests
     */
     void checkTimer();
 
-    /** Writes the output times to file in mTimesOutputFilePath
+    /** Writes the recorded stage timings as CSV to mTimesOutputFilePath and as JSON next to it
     */
     void outputTimes();
 
@@ -150,6 +243,7 @@ private:
     bool                        mUseStatisticProgressivePM = true;     ///< Activate Statistically Progressive Photon Mapping(SPPM)
     float                       mSPPMAlphaGlobal = 0.7f;                 ///< Global Alpha for SPPM
     float                       mSPPMAlphaCaustic = 0.7f;                ///< Caustic Alpha for SPPM
+    bool                        mPerPixelSPPM = false;                  ///< Radius and photon statistics per pixel (ProgressiveRadius.slang). The map radius stays at the start radius for the cells
 
     float                       mCausticRadiusStart = 0.01f;            ///< Start value for the caustic Radius
     float                       mGlobalRadiusStart = 0.05f;             ///< Start value for the caustic Radius
@@ -163,6 +257,9 @@ private:
 
     bool                        mNumPhotonsChanged = false;             ///<If true buffers needs to be restarted and Number of photons needs to be changed
     bool                        mFitBuffersToPhotonShot = false;        ///<Changes the buffer size to be around the number of photons shot
+    bool                        mAutoBufferSize = true;                 ///< Resizes the photon buffers from the photon counter history
+    PhotonBufferSizePolicy      mCausticSizePolicy;                     ///< Size policy for the caustic photon buffer
+    PhotonBufferSizePolicy      mGlobalSizePolicy;                      ///< Size policy for the global photon buffer
 
     bool                        mUseAlphaTest = true;                   ///<Uses alpha test (Generate)
     bool                        mAdjustShadingNormals = true;           ///<Adjusts the shading normals (Generate)
@@ -170,9 +267,24 @@ private:
     uint                        mNumBucketBits = 20;                    ///< 2^NumBucketBits is the total amount of possible buckets
     uint                        mNumPhotonsPerBucket = 12;              ///< Max Photons per hash grid.
     uint                        mQuadraticProbeIterations = 10;         ///< Number of quadartic probe iteratons per hash.
+    uint                        mHashFunction = (uint)SpatialHashFunction::Wang;    ///< Hash function used for the buckets (SpatialHashFunction)
+    uint                        mGatherTraversal = (uint)GatherTraversal::SphereOverlap;    ///< Cells the collect pass looks up (GatherTraversal)
+    uint                        mHashCellSize = 1;                      ///< Edge length of the hash cells in radii (1 or 2)
+    uint                        mHashGridLevels = 0;                    ///< Power of two cell sizes (HashGridLevels). 0 lets the cells follow the radius
+    bool                        mEnableHashTableStats = false;          ///< Counts probes, drops and lookups of the buckets on the GPU
+    bool                        mSortPhotons = false;                   ///< Sorts the photons by hash cell after generation (linear storage only)
+    uint                        mHashGridMode = (uint)HashGridMode::Buckets;    ///< Structure that maps cells to photons (HashGridMode)
 
     bool                        mEnableFaceNormalRejection = false;
 
+    //Photon Culling
+    bool                        mEnablePhotonCulling = true;            ///< Skips the bucket insert for photons that no camera hit can gather
+    bool                        mRebuildCullingBuffer = false;
+    uint                        mCullingHashBufferBits = 22;            ///< 2^x bits in the culling buffer. Uses the bucket hash function
+    uint                        mCullingNumHashes = 1;                  ///< Bits per cell. 1 is a plain bit set, more make it a Bloom filter
+    bool                        mUseProjectionMatrixCulling = false;    ///< Never cull photons inside the camera frustum
+    float                       mCullingProjectionTestOver = 1.01f;     ///< Value used for determining what is inside the projection
+
     // Generate only
     uint                        mMaxBounces = 10;                        ///< Depth of recursion (0 = none).
     float                       mRussianRoulette = 0.3f;                ///< Probabilty that a Global photon is saved
@@ -198,6 +310,7 @@ private:
     
     uint                        mFrameCount = 0;            ///< Frame count since last Reset
     std::vector<uint>           mPhotonCount = { 0,0 };
+    uint                        mPhotonsCulled = 0;         ///< Photons of the last read back iteration that skipped the insert because of the culling
     bool                        mOptionsChanged = false;
     bool                        mResetCS = true;
     bool                        mSetConstantBuffers = true;
@@ -205,20 +318,22 @@ private:
     bool                        mPhotonInfoFormatChanged = false;         
     bool                        mRebuildAS = false;
     uint                        mInfoTexFormat = 1;
+    uint                        mPhotonStorage = (uint)PhotonStorage::Texture2D;  ///< Storage of the photon attributes (PhotonStorage)
+    bool                        mPhotonStorageChanged = false;
     uint                        mNumBuckets = 0;
 
 
     //Light
-    std::vector<uint> mActiveEmissiveTriangles;
+    LightSampleTableBuilder mLightTableBuilder;     ///< Builds the light sample table. Rebuilds can run on a worker thread
     bool            mRebuildLightTex = false;
+    bool            mAsyncLightTexRebuild = true;   ///< Keep rendering with the old light table while a rebuild is running
     LightTexMode mLightTexMode = LightTexMode::power;
-    Texture::SharedPtr mLightSampleTex;
-    Buffer::SharedPtr mPhotonsPerTriangle;
+    Buffer::SharedPtr mLightAliasTable;             ///< Light alias table (LightAliasEntry)
+    uint            mLightAliasTableSize = 0;
     const uint mMaxDispatchY = 512;
     uint mPGDispatchX = 0;
     uint mAnalyticEndIndex = 0;
     uint mNumLights = 0;
-    float mAnalyticInvPdf = 0.0f;
 
     //Clock/Timer
     bool                        mUseTimer = false;                          //<Activates the timer
@@ -229,9 +344,12 @@ private:
     double                      mCurrentElapsedTime = 0.0;                    //<Elapsed time for UI
     std::chrono::time_point<std::chrono::steady_clock> mTimerStartTime;     //<Start time for the timer
     bool                        mTimerRecordTimes = false;                   //< Enable Records times
-    std::vector<double>         mTimesList;                                 //< List with render times
+    StageTimingStats            mStageTimes;                                //< Per iteration stage timings while recording times
     std::string                 mTimesOutputFilePath;                       //< Output file path for the times
 
+    //Convergence
+    ConvergenceMonitor          mConvergence;                               ///< Error-versus-time measurement against a reference image
+
 
     // Ray tracing program.
     struct RayTraceProgramHelper
@@ -252,6 +370,10 @@ private:
 
     ComputePass::SharedPtr mpCSCollect;             ///<Collect pass collects the photons that where shot  
     RayTraceProgramHelper mTracerGenerate;          ///<Description for the Generate Photon pass 
+    ComputePass::SharedPtr mPhotonCullingPass;      ///< Marks the culling cells of the camera hits
+
+    //Photon Culling vars
+    Buffer::SharedPtr mCullingBuffer;               ///< Culling bits, 32 per word (CullingBloomFilter.slang)
 
     //
     //Photon Buffers
@@ -265,16 +387,52 @@ private:
     struct {
         Buffer::SharedPtr counter;
         Buffer::SharedPtr reset;
-        Buffer::SharedPtr cpuCopy;
     }mPhotonCounterBuffer;
 
+    ReadbackRing mPhotonCounterReadback;            ///< Photon counter readback. Lags a few frames behind the GPU
+
+    struct {
+        Buffer::SharedPtr counters;                 ///< kHashStatsCount counters, cleared before the generate pass
+        ReadbackRing readback;                      ///< Lags a few frames behind the GPU like the photon counter
+        HashTableStats::Counters latest = {};       ///< Newest counters that are ready on the CPU
+        bool hasLatest = false;
+        std::array<uint64_t, kHashStatsCount> recorded = {};    ///< Sum of the counters over the iterations recorded with the timer
+    }mHashTableStats;
+
     struct PhotonBuffers {
         uint maxSize = 0;
         Texture::SharedPtr position;
         Texture::SharedPtr infoFlux;
         Texture::SharedPtr infoDir;
+        Texture::SharedPtr packed;          ///< Compact photons. Replaces position and info textures in the compact format
+        Buffer::SharedPtr streams;          ///< Linear storage. Replaces all textures
+        Buffer::SharedPtr sortedStreams;    ///< Target of the photon sort and grid scatter, swapped with streams afterwards
+        Buffer::SharedPtr cellSlots;        ///< Cell range grid: slot of every photon in generation order
+        Buffer::SharedPtr localOffsets;     ///< Cell range grid: offset of every photon inside its slot
+        Buffer::SharedPtr cellStart;        ///< Cell range grid: start of every slot, numBuckets + 1 entries
+        PhotonStreamLayout layout = {};     ///< Layout of the streams
     };
 
+    struct {
+        PhotonRadixSort radixSort;
+        ComputePass::SharedPtr pInitKeys;
+        ComputePass::SharedPtr pComputeKeys;
+        ComputePass::SharedPtr pReorder;
+        ComputePass::SharedPtr pRemapBuckets;
+        Buffer::SharedPtr keys;             ///< Cell key per photon slot
+        Buffer::SharedPtr values;           ///< Photon index per slot, sorted with the keys
+        Buffer::SharedPtr remap;            ///< Sorted index of every photon
+    }mPhotonSort;
+
+    struct {
+        ComputePass::SharedPtr pCount;
+        ComputePass::SharedPtr pScanBlocks;
+        ComputePass::SharedPtr pScanBlockSums;
+        ComputePass::SharedPtr pAddBlockOffsets;
+        ComputePass::SharedPtr pScatter;
+        Buffer::SharedPtr blockSums;        ///< Sums of the prefix sum blocks, shared by both maps
+    }mPhotonGrid;
+
     Buffer::SharedPtr mpGlobalBuckets;
     Buffer::SharedPtr mpCausticBuckets;
 
@@ -282,5 +440,7 @@ private:
     PhotonBuffers mGlobalBuffers;               ///< Buffers for the global photons
 
     Texture::SharedPtr mRandNumSeedBuffer;       ///< Buffer for the random seeds
+    Buffer::SharedPtr mProgressiveStats;         ///< Per pixel SPPM statistics, caustic and global per pixel
+    Texture::SharedPtr mProgressiveEmission;     ///< Per pixel SPPM mean of the emission
 
 };
@@ -52,6 +52,7 @@ namespace
 {
     const char kShaderGeneratePhoton[] = "RenderPasses/PhotonMapperStochasticHash/PhotonMapperStochasticHashGenerate.rt.slang";
     const char kShaderCollectPhoton[] = "RenderPasses/PhotonMapperStochasticHash/PhotonMapperStochasticHashCollect.cs.slang";
+    const char kShaderPhotonCulling[] = "RenderPasses/PhotonMapperCommon/PhotonCulling.cs.slang";
 
     // Ray tracing settings that affect the traversal stack size.
    // These should be set as small as possible.
@@ -84,24 +85,188 @@ namespace
         {PhotonMapperStochasticHash::LightTexMode::power , "Power"},
         {PhotonMapperStochasticHash::LightTexMode::area , "Area"}
     };
+
+    const Gui::DropdownList kHashFunctionList{
+        {(uint)SpatialHashFunction::Wang , "Wang"},
+        {(uint)SpatialHashFunction::Morton , "Morton"},
+        {(uint)SpatialHashFunction::Pcg , "PCG"}
+    };
+
+    const Gui::DropdownList kGatherTraversalList{
+        {(uint)GatherTraversal::Cube , "Cube"},
+        {(uint)GatherTraversal::SphereOverlap , "Sphere Overlap"}
+    };
+
+    const Gui::DropdownList kHashCellSizeList{
+        {1 , "Radius"},
+        {2 , "2x Radius"}
+    };
+
+    // Scripting options.
+    const char kNumPhotons[] = "numPhotons";
+    const char kUseSPPM[] = "useSPPM";
+    const char kSPPMAlphaGlobal[] = "sppmAlphaGlobal";
+    const char kSPPMAlphaCaustic[] = "sppmAlphaCaustic";
+    const char kPerPixelSPPM[] = "perPixelSPPM";
+    const char kCausticRadiusStart[] = "causticRadiusStart";
+    const char kGlobalRadiusStart[] = "globalRadiusStart";
+    const char kRejectionProbability[] = "rejectionProbability";
+    const char kMaxBounces[] = "maxBounces";
+    const char kEmissiveScalar[] = "emissiveScalar";
+    const char kSpecRoughCutoff[] = "specRoughCutoff";
+    const char kUseAlphaTest[] = "useAlphaTest";
+    const char kAdjustShadingNormals[] = "adjustShadingNormals";
+    const char kUseFaceNormalRejection[] = "useFaceNormalRejection";
+    const char kEnablePhotonCulling[] = "enablePhotonCulling";
+    const char kCullingHashBufferBits[] = "cullingHashBufferBits";
+    const char kCullingNumHashes[] = "cullingNumHashes";
+    const char kUseProjectionMatrixCulling[] = "useProjectionMatrixCulling";
+    const char kCullingProjectionTestOver[] = "cullingProjectionTestOver";
+    const char kNumBucketBits[] = "numBucketBits";
+    const char kHashFunction[] = "hashFunction";
+    const char kGatherTraversal[] = "gatherTraversal";
+    const char kHashCellSize[] = "hashCellSize";
+    const char kHashGridLevels[] = "hashGridLevels";
+    const char kAutoBucketCount[] = "autoBucketCount";
+    const char kLightSampleMode[] = "lightSampleMode";
+    const char kAsyncLightTableRebuild[] = "asyncLightTableRebuild";
+    const char kDisableGlobalCollection[] = "disableGlobalCollection";
+    const char kDisableCausticCollection[] = "disableCausticCollection";
+    const char kAlwaysResetIterations[] = "alwaysResetIterations";
+    const char kUseTimer[] = "useTimer";
+    const char kTimerDurationSec[] = "timerDurationSec";
+    const char kTimerMaxIterations[] = "timerMaxIterations";
+    const char kTimerRecordTimes[] = "timerRecordTimes";
+    const char kTimesOutputFile[] = "timesOutputFile";
+    const char kConvergenceEnabled[] = "convergenceEnabled";
+    const char kConvergenceReference[] = "convergenceReference";
+    const char kConvergenceIntervalIterations[] = "convergenceIntervalIterations";
+    const char kConvergenceIntervalMs[] = "convergenceIntervalMs";
+    const char kConvergenceSsim[] = "convergenceSsim";
+    const char kConvergenceOutputFile[] = "convergenceOutputFile";
 }
 
 PhotonMapperStochasticHash::SharedPtr PhotonMapperStochasticHash::create(RenderContext* pRenderContext, const Dictionary& dict)
 {
-    SharedPtr pPass = SharedPtr(new PhotonMapperStochasticHash);
+    SharedPtr pPass = SharedPtr(new PhotonMapperStochasticHash(dict));
     return pPass;
 }
 
-PhotonMapperStochasticHash::PhotonMapperStochasticHash():
+PhotonMapperStochasticHash::PhotonMapperStochasticHash(const Dictionary& dict):
     RenderPass(kInfo)
 {
+    parseDictionary(dict);
+
+    //The bucket count stays a power of two. An occupied bucket holds one photon of many, so the
+    //thresholds are lower than for the photon buffers. The bucket textures are at most kMaxBucketTexWidth wide
+    PhotonBufferSizePolicy::Options sizeOptions;
+    sizeOptions.powerOfTwo = true;
+    sizeOptions.growThreshold = 0.5f;
+    sizeOptions.shrinkThreshold = 0.125f;
+    sizeOptions.headroom = 2.5f;
+    sizeOptions.minCapacity = 1 << 12;
+    sizeOptions.maxCapacity = uint64_t(kMaxBucketTexWidth) * mBucketFixedYExtend;
+    mBucketCountPolicy.setOptions(sizeOptions);
     mpSampleGenerator = SampleGenerator::create(SAMPLE_GENERATOR_UNIFORM);
     FALCOR_ASSERT(mpSampleGenerator);
 }
 
+void PhotonMapperStochasticHash::parseDictionary(const Dictionary& dict)
+{
+    for (const auto& [key, value] : dict)
+    {
+        if (key == kNumPhotons) { mNumPhotons = value; mNumPhotonsUI = mNumPhotons; }
+        else if (key == kUseSPPM) mUseStatisticProgressivePM = value;
+        else if (key == kSPPMAlphaGlobal) mSPPMAlphaGlobal = value;
+        else if (key == kSPPMAlphaCaustic) mSPPMAlphaCaustic = value;
+        else if (key == kPerPixelSPPM) mPerPixelSPPM = value;
+        else if (key == kCausticRadiusStart) mCausticRadiusStart = value;
+        else if (key == kGlobalRadiusStart) mGlobalRadiusStart = value;
+        else if (key == kRejectionProbability) mRussianRoulette = value;
+        else if (key == kMaxBounces) mMaxBounces = value;
+        else if (key == kEmissiveScalar) mIntensityScalar = value;
+        else if (key == kSpecRoughCutoff) mSpecRoughCutoff = value;
+        else if (key == kUseAlphaTest) mUseAlphaTest = value;
+        else if (key == kAdjustShadingNormals) mAdjustShadingNormals = value;
+        else if (key == kUseFaceNormalRejection) mEnableFaceNormalRejection = value;
+        else if (key == kEnablePhotonCulling) mEnablePhotonCulling = value;
+        else if (key == kCullingHashBufferBits) mCullingHashBufferBits = value;
+        else if (key == kCullingNumHashes) mCullingNumHashes = value;
+        else if (key == kUseProjectionMatrixCulling) mUseProjectionMatrixCulling = value;
+        else if (key == kCullingProjectionTestOver) mCullingProjectionTestOver = value;
+        else if (key == kNumBucketBits) mNumBucketBits = value;
+        else if (key == kHashFunction) mHashFunction = value;
+        else if (key == kGatherTraversal) mGatherTraversal = value;
+        else if (key == kHashCellSize) mHashCellSize = value;
+        else if (key == kHashGridLevels) mHashGridLevels = value;
+        else if (key == kAutoBucketCount) mAutoBucketCount = value;
+        else if (key == kLightSampleMode) mLightTexMode = static_cast<LightTexMode>(static_cast<uint32_t>(value));
+        else if (key == kAsyncLightTableRebuild) mAsyncLightTexRebuild = value;
+        else if (key == kDisableGlobalCollection) mDisableGlobalCollection = value;
+        else if (key == kDisableCausticCollection) mDisableCausticCollection = value;
+        else if (key == kAlwaysResetIterations) mAlwaysResetIterations = value;
+        else if (key == kUseTimer) { mUseTimer = value; mResetTimer = true; }
+        else if (key == kTimerDurationSec) mTimerDurationSec = value;
+        else if (key == kTimerMaxIterations) mTimerMaxIterations = value;
+        else if (key == kTimerRecordTimes) mTimerRecordTimes = value;
+        else if (key == kTimesOutputFile) mTimesOutputFilePath = static_cast<std::string>(value);
+        else if (key == kConvergenceEnabled) mConvergence.getOptions().enabled = value;
+        else if (key == kConvergenceReference) mConvergence.getOptions().referencePath = static_cast<std::string>(value);
+        else if (key == kConvergenceIntervalIterations) mConvergence.getOptions().intervalIterations = value;
+        else if (key == kConvergenceIntervalMs) mConvergence.getOptions().intervalMs = value;
+        else if (key == kConvergenceSsim) mConvergence.getOptions().computeSsim = value;
+        else if (key == kConvergenceOutputFile) mConvergence.getOptions().outputPath = static_cast<std::string>(value);
+        else logWarning("Unknown field '" + key + "' in a PhotonMapperStochasticHash dictionary");
+    }
+}
+
 Dictionary PhotonMapperStochasticHash::getScriptingDictionary()
 {
-    return Dictionary();
+    Dictionary dict;
+    dict[kNumPhotons] = mNumPhotons;
+    dict[kUseSPPM] = mUseStatisticProgressivePM;
+    dict[kSPPMAlphaGlobal] = mSPPMAlphaGlobal;
+    dict[kSPPMAlphaCaustic] = mSPPMAlphaCaustic;
+    dict[kPerPixelSPPM] = mPerPixelSPPM;
+    dict[kCausticRadiusStart] = mCausticRadiusStart;
+    dict[kGlobalRadiusStart] = mGlobalRadiusStart;
+    dict[kRejectionProbability] = mRussianRoulette;
+    dict[kMaxBounces] = mMaxBounces;
+    dict[kEmissiveScalar] = mIntensityScalar;
+    dict[kSpecRoughCutoff] = mSpecRoughCutoff;
+    dict[kUseAlphaTest] = mUseAlphaTest;
+    dict[kAdjustShadingNormals] = mAdjustShadingNormals;
+    dict[kUseFaceNormalRejection] = mEnableFaceNormalRejection;
+    dict[kEnablePhotonCulling] = mEnablePhotonCulling;
+    dict[kCullingHashBufferBits] = mCullingHashBufferBits;
+    dict[kCullingNumHashes] = mCullingNumHashes;
+    dict[kUseProjectionMatrixCulling] = mUseProjectionMatrixCulling;
+    dict[kCullingProjectionTestOver] = mCullingProjectionTestOver;
+    dict[kNumBucketBits] = mNumBucketBits;
+    dict[kHashFunction] = mHashFunction;
+    dict[kGatherTraversal] = mGatherTraversal;
+    dict[kHashCellSize] = mHashCellSize;
+    dict[kHashGridLevels] = mHashGridLevels;
+    dict[kAutoBucketCount] = mAutoBucketCount;
+    dict[kLightSampleMode] = static_cast<uint32_t>(mLightTexMode);
+    dict[kAsyncLightTableRebuild] = mAsyncLightTexRebuild;
+    dict[kDisableGlobalCollection] = mDisableGlobalCollection;
+    dict[kDisableCausticCollection] = mDisableCausticCollection;
+    dict[kAlwaysResetIterations] = mAlwaysResetIterations;
+    dict[kUseTimer] = mUseTimer;
+    dict[kTimerDurationSec] = mTimerDurationSec;
+    dict[kTimerMaxIterations] = mTimerMaxIterations;
+    dict[kTimerRecordTimes] = mTimerRecordTimes;
+    if (!mTimesOutputFilePath.empty()) dict[kTimesOutputFile] = mTimesOutputFilePath;
+    const auto& convergence = mConvergence.getOptions();
+    dict[kConvergenceEnabled] = convergence.enabled;
+    if (!convergence.referencePath.empty()) dict[kConvergenceReference] = convergence.referencePath;
+    dict[kConvergenceIntervalIterations] = convergence.intervalIterations;
+    dict[kConvergenceIntervalMs] = convergence.intervalMs;
+    dict[kConvergenceSsim] = convergence.computeSsim;
+    if (!convergence.outputPath.empty()) dict[kConvergenceOutputFile] = convergence.outputPath;
+
+    return dict;
 }
 
 RenderPassReflection PhotonMapperStochasticHash::reflect(const CompileData& compileData)
@@ -153,15 +318,23 @@ void PhotonMapperStochasticHash::execute(RenderContext* pRenderContext, const Re
     checkTimer();
     if (mUseTimer && mTimerStopRenderer) return;
 
+    updateOccupiedBuckets();
+
     if (mNumPhotonsChanged) {
         changeNumPhotons();
         mNumPhotonsChanged = false;
     }
 
+    //Restarts the iterations if the screen size changed
+    if (mPerPixelSPPM) {
+        prepareProgressiveBuffers(renderData.getDefaultTextureDims());
+    }
+
     //reset radius
     if (mFrameCount == 0) {
         mCausticRadius = mCausticRadiusStart;
         mGlobalRadius = mGlobalRadiusStart;
+        mConvergence.restart();
     }
 
     if (is_set(mpScene->getUpdates(), Scene::UpdateFlags::GeometryChanged))
@@ -184,32 +357,60 @@ void PhotonMapperStochasticHash::execute(RenderContext* pRenderContext, const Re
     }
 
     if (mRebuildLightTex) {
-        mLightSampleTex.reset();
+        //Keep the old table until the worker thread is done
+        if (mAsyncLightTexRebuild && mLightAliasTable)
+            mLightTableBuilder.buildAsync(LightSampleTableBuilder::createInput(pRenderContext, mpScene, mNumPhotons, mMaxDispatchY, (LightSampleTableBuilder::Mode)mLightTexMode));
+        else
+            mLightAliasTable.reset();
         mRebuildLightTex = false;
     }
 
-    //Create light sample tex if empty
-    if (!mLightSampleTex) {
-        createLightSampleTexture(pRenderContext);
+    //Create light table if empty
+    if (!mLightAliasTable) {
+        createLightSampleTable(pRenderContext);
+    }
+    else if (mLightTableBuilder.isReady()) {
+        uploadLightSampleTable(mLightTableBuilder.takeResult());
     }
 
     if (mResetCS) {
         mpCSCollect.reset();
+        mPhotonCullingPass.reset();     //Culling uses the bucket hash function
         preparePhotonBuffers();
         mResetCS = false;
     }
 
+    if (mRebuildCullingBuffer) {
+        mCullingBuffer.reset();
+        mRebuildCullingBuffer = false;
+    }
+
+    if (mEnablePhotonCulling && !mCullingBuffer)
+        initPhotonCulling();
+
+    //Reset culling buffer if deactivated to save memory
+    if (!mEnablePhotonCulling && mCullingBuffer)
+        resetCullingVars();
+
+    if (mEnablePhotonCulling)
+        photonCullingPass(pRenderContext, renderData);
+
     //
     // Generate Ray Pass
     //
 
     generatePhotons(pRenderContext, renderData);
-    
+    copyOccupiedBuckets(pRenderContext);
+
     //Gather the photons with short rays
     collectPhotons(pRenderContext, renderData);
     mFrameCount++;
 
-    if (mUseStatisticProgressivePM) {
+    //Compare with the reference if a measurement is due. The radii are the ones used for this iteration
+    mConvergence.update(pRenderContext, renderData[kOutputChannels[0].name]->asTexture(), mFrameCount, mGlobalRadius, mCausticRadius);
+
+    //With per pixel SPPM the cells keep the start radius, it bounds the radius of every pixel
+    if (mUseStatisticProgressivePM && !mPerPixelSPPM) {
         float itF = static_cast<float>(mFrameCount);
         mGlobalRadius *= sqrt((itF + mSPPMAlphaGlobal) / (itF + 1.0f));
         mCausticRadius *= sqrt((itF + mSPPMAlphaCaustic) / (itF + 1.0f));
@@ -224,8 +425,82 @@ void PhotonMapperStochasticHash::execute(RenderContext* pRenderContext, const Re
         mSetConstantBuffers = false;
 }
 
+float PhotonMapperStochasticHash::getHashScaleFactor(bool caustic) const
+{
+    const float radius = caustic ? mCausticRadius : mGlobalRadius;
+    if (mHashGridLevels == 0)
+        return 1.f / (float(mHashCellSize) * radius);
+    const auto levels = HashGridLevels::create(caustic ? mCausticRadiusStart : mGlobalRadiusStart, mHashGridLevels, float(mHashCellSize));
+    return HashGridLevels::getCellScale(levels, HashGridLevels::getLevel(levels, radius));
+}
+
+float PhotonMapperStochasticHash::getCullingRadius() const
+{
+    if (mPerPixelSPPM)
+        return std::max(mCausticRadiusStart, mGlobalRadiusStart);
+    return std::max(mCausticRadius, mGlobalRadius);
+}
+
+void PhotonMapperStochasticHash::initPhotonCulling()
+{
+    //One bit per slot
+    const uint numWords = static_cast<uint>(CullingBloomFilter::getWordCount(mCullingHashBufferBits));
+    mCullingBuffer = Buffer::createStructured(sizeof(uint), numWords);
+    mCullingBuffer->setName("PhotonMapperStochasticHash::CullingHashBuffer");
+    mSetConstantBuffers = true;     //Generate needs the new bit mask
+}
+
+void PhotonMapperStochasticHash::resetCullingVars()
+{
+    mPhotonCullingPass.reset();
+    mCullingBuffer.reset();
+}
+
+void PhotonMapperStochasticHash::photonCullingPass(RenderContext* pRenderContext, const RenderData& renderData)
+{
+    FALCOR_PROFILE("photon culling");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Culling);
+
+    pRenderContext->clearUAV(mCullingBuffer->getUAV().get(), uint4(0));
+
+    if (!mPhotonCullingPass) {
+        Program::Desc desc;
+        desc.addShaderLibrary(kShaderPhotonCulling).csEntry("main").setShaderModel("6_5");
+        desc.addTypeConformances(mpScene->getTypeConformances());
+
+        Program::DefineList defines;
+        defines.add(mpScene->getSceneDefines());
+        defines.add("CULLING_USE_PROJECTION", mUseProjectionMatrixCulling ? "1" : "0");
+        defines.add("SPATIAL_HASH_FUNCTION", std::to_string(mHashFunction));    //Same function as the buckets
+
+        mPhotonCullingPass = ComputePass::create(desc, defines, true);
+    }
+
+    auto var = mPhotonCullingPass->getRootVar();
+    //Set Scene data. Is needed for camera etc.
+    mpScene->setRaytracingShaderData(pRenderContext, var, 1);
+
+    var["PerFrame"]["gHashScaleFactor"] = 1.0f / (getCullingRadius() * 2);  //Cells are twice the radius, so the 2x2x2 closest cells hold every photon in reach
+    var["PerFrame"]["gBitMask"] = CullingBloomFilter::getBitMask(mCullingHashBufferBits);
+    var["PerFrame"]["gNumHashes"] = mCullingNumHashes;
+    var["PerFrame"]["gProjTest"] = mCullingProjectionTestOver;
+
+    var[kInputChannels[0].texname] = renderData[kInputChannels[0].name]->asTexture();    //VBuffer
+    var["gHashBuffer"] = mCullingBuffer;
+
+    const uint2 targetDim = renderData.getDefaultTextureDims();
+    FALCOR_ASSERT(targetDim.x > 0 && targetDim.y > 0);
+
+    mPhotonCullingPass->execute(pRenderContext, uint3(targetDim, 1));
+
+    pRenderContext->uavBarrier(mCullingBuffer.get());
+}
+
 void PhotonMapperStochasticHash::generatePhotons(RenderContext* pRenderContext, const RenderData& renderData)
 {
+    FALCOR_PROFILE("generate photons");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Generate);
+
     //Clear the photon Buffers
     pRenderContext->clearTexture(mpGlobalPosBucket.get());
     pRenderContext->clearTexture(mpGlobalDirBucket.get());
@@ -235,6 +510,7 @@ void PhotonMapperStochasticHash::generatePhotons(RenderContext* pRenderContext,
     pRenderContext->clearTexture(mpCausticFluxBucket.get());
     pRenderContext->clearUAV(mpGlobalHashPhotonCounter->getUAV().get(), uint4(0, 0, 0, 0));
     pRenderContext->clearUAV(mpCausticHashPhotonCounter->getUAV().get(), uint4(0, 0, 0, 0));
+    pRenderContext->clearUAV(mpOccupiedBucketCounter->getUAV().get(), uint4(0, 0, 0, 0));
     
 
     auto lights = mpScene->getLights();
@@ -246,10 +522,11 @@ void PhotonMapperStochasticHash::generatePhotons(RenderContext* pRenderContext,
     mTracerGenerate.pProgram->addDefine("USE_EMISSIVE_LIGHTS", mpScene->useEmissiveLights() ? "1" : "0");
     mTracerGenerate.pProgram->addDefine("USE_ENV_LIGHT", mpScene->useEnvLight() ? "1" : "0");
     mTracerGenerate.pProgram->addDefine("USE_ENV_BACKGROUND", mpScene->useEnvBackground() ? "1" : "0");
-    mTracerGenerate.pProgram->addDefine("ANALYTIC_INV_PDF", std::to_string(mAnalyticInvPdf));
     mTracerGenerate.pProgram->addDefine("INFO_TEXTURE_HEIGHT", std::to_string(kInfoTexHeight));
     mTracerGenerate.pProgram->addDefine("NUM_BUCKETS", std::to_string(mNumBuckets));
+    mTracerGenerate.pProgram->addDefine("SPATIAL_HASH_FUNCTION", std::to_string(mHashFunction));
     mTracerGenerate.pProgram->addDefine("PHOTON_FACE_NORMAL", mEnableFaceNormalRejection ? "1" : "0");
+    mTracerGenerate.pProgram->addDefine("CULLING_USE_PROJECTION", mUseProjectionMatrixCulling ? "1" : "0");
     
     // Prepare program vars. This may trigger shader compilation.
     // The program should have all necessary defines set at this point.
@@ -268,10 +545,12 @@ void PhotonMapperStochasticHash::generatePhotons(RenderContext* pRenderContext,
     //PerFrame Constant Buffer
     std::string nameBuf = "PerFrame";
     var[nameBuf]["gFrameCount"] = mFrameCount;
+    var[nameBuf]["gLightAliasTableSize"] = mLightAliasTableSize;
     var[nameBuf]["gCausticRadius"] = mCausticRadius;
     var[nameBuf]["gGlobalRadius"] = mGlobalRadius;
-    var[nameBuf]["gCausticHashScaleFactor"] = 1.f / mCausticRadius;
-    var[nameBuf]["gGlobalHashScaleFactor"] = 1.f / mGlobalRadius;
+    var[nameBuf]["gCausticHashScaleFactor"] = getHashScaleFactor(true);
+    var[nameBuf]["gGlobalHashScaleFactor"] = getHashScaleFactor(false);
+    var[nameBuf]["gCullingHashScaleFactor"] = 1.0f / (getCullingRadius() * 2);
 
     //Constant Buffer is only set when options changed
     if (mSetConstantBuffers) {
@@ -285,6 +564,11 @@ void PhotonMapperStochasticHash::generatePhotons(RenderContext* pRenderContext,
         var[nameBuf]["gUseAlphaTest"] = mUseAlphaTest;
         var[nameBuf]["gAdjustShadingNormals"] = mAdjustShadingNormals;
         var[nameBuf]["gBucketYExtent"] = mBucketFixedYExtend;
+
+        var[nameBuf]["gEnablePhotonCulling"] = mEnablePhotonCulling;
+        var[nameBuf]["gCullingBitMask"] = CullingBloomFilter::getBitMask(mCullingHashBufferBits);
+        var[nameBuf]["gCullingNumHashes"] = mCullingNumHashes;
+        var[nameBuf]["gCullingProjTest"] = mCullingProjectionTestOver;
     }
     
     //set the buffers
@@ -297,10 +581,14 @@ void PhotonMapperStochasticHash::generatePhotons(RenderContext* pRenderContext,
         var["gHashBucketFlux"][i] = i == 0 ? mpCausticFluxBucket : mpGlobalFluxBucket;
         var["gHashCounter"][i] = i == 0 ? mpCausticHashPhotonCounter : mpGlobalHashPhotonCounter;
     }
+    var["gOccupiedBuckets"] = mpOccupiedBucketCounter;
+
+    //Set optional culling variables
+    if (mEnablePhotonCulling)
+        var["gCullingHashBuffer"] = mCullingBuffer;
 
-    //Bind light sample tex
-    var["gLightSample"] = mLightSampleTex;
-    var["gNumPhotonsPerEmissive"] = mPhotonsPerTriangle;
+    //Bind light table
+    var["gLightAliasTable"] = mLightAliasTable;
 
     // Get dimensions of ray dispatch.
     const uint2 targetDim = uint2(mPGDispatchX, mMaxDispatchY);
@@ -314,6 +602,7 @@ void PhotonMapperStochasticHash::collectPhotons(RenderContext* pRenderContext, c
 {
     // Trace the photons
     FALCOR_PROFILE("collect photons");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::Collect);
 
 
     if (!mpCSCollect) {
@@ -327,7 +616,10 @@ void PhotonMapperStochasticHash::collectPhotons(RenderContext* pRenderContext, c
 
         defines.add("INFO_TEXTURE_HEIGHT", std::to_string(kInfoTexHeight));
         defines.add("NUM_BUCKETS", std::to_string(mNumBuckets));
+        defines.add("SPATIAL_HASH_FUNCTION", std::to_string(mHashFunction));
+        defines.add("GATHER_TRAVERSAL", std::to_string(mGatherTraversal));
         defines.add("PHOTON_FACE_NORMAL", mEnableFaceNormalRejection ? "1" : "0");
+        defines.add("PER_PIXEL_SPPM", mPerPixelSPPM ? "1" : "0");
 
         mpCSCollect = ComputePass::create(desc, defines, true);
     }
@@ -344,8 +636,8 @@ void PhotonMapperStochasticHash::collectPhotons(RenderContext* pRenderContext, c
     var[nameBuf]["gFrameCount"] = mFrameCount;
     var[nameBuf]["gCausticRadius"] = mCausticRadius;
     var[nameBuf]["gGlobalRadius"] = mGlobalRadius;
-    var[nameBuf]["gCausticHashScaleFactor"] = 1.f / mCausticRadius;
-    var[nameBuf]["gGlobalHashScaleFactor"] = 1.f / mGlobalRadius;
+    var[nameBuf]["gCausticHashScaleFactor"] = getHashScaleFactor(true);
+    var[nameBuf]["gGlobalHashScaleFactor"] = getHashScaleFactor(false);
 
     //Set constant buffer only if changes where made
     if (mSetConstantBuffers) {
@@ -354,6 +646,10 @@ void PhotonMapperStochasticHash::collectPhotons(RenderContext* pRenderContext, c
         var[nameBuf]["gCollectGlobalPhotons"] = !mDisableGlobalCollection;
         var[nameBuf]["gCollectCausticPhotons"] = !mDisableCausticCollection;
         var[nameBuf]["gBucketYExtent"] = mBucketFixedYExtend;
+        //Alpha of 1 keeps the start radius of every pixel
+        var[nameBuf]["gSPPMAlphaGlobal"] = mUseStatisticProgressivePM ? mSPPMAlphaGlobal : 1.f;
+        var[nameBuf]["gSPPMAlphaCaustic"] = mUseStatisticProgressivePM ? mSPPMAlphaCaustic : 1.f;
+        var[nameBuf]["gMinPhotonRadius"] = kMinPhotonRadius;
     }
 
     for (uint32_t i = 0; i <= 1; i++)
@@ -363,6 +659,8 @@ void PhotonMapperStochasticHash::collectPhotons(RenderContext* pRenderContext, c
         var["gHashBucketFlux"][i] = i == 0 ? mpCausticFluxBucket : mpGlobalFluxBucket;
         var["gHashCounter"][i] = i == 0 ? mpCausticHashPhotonCounter : mpGlobalHashPhotonCounter;
     }
+    var["gProgressiveStats"] = mProgressiveStats;
+    var["gProgressiveEmission"] = mProgressiveEmission;
 
     // Lamda for binding textures. These needs to be done per-frame as the buffers may change anytime.
     auto bindAsTex = [&](const ChannelDesc& desc)
@@ -396,6 +694,12 @@ void PhotonMapperStochasticHash::renderUI(Gui::Widgets& widget)
     widget.text("Iterations: " + std::to_string(mFrameCount));
     widget.text("Current Global Radius: " + std::to_string(mGlobalRadius));
     widget.text("Current Caustic Radius: " + std::to_string(mCausticRadius));
+    if (mEnablePhotonCulling) {
+        const uint attempted = mPhotonsInserted + mPhotonsCulled;
+        const double culledRate = attempted > 0 ? 100.0 * mPhotonsCulled / attempted : 0.0;
+        widget.text(fmt::format("Culled Inserts: {} of {} ({:.1f}%)", mPhotonsCulled, attempted, culledRate));
+        widget.tooltip("Photons that skipped the bucket insert because no camera hit can gather them / all photons that would have been inserted");
+    }
 
     widget.dummy("", dummySpacing);
     widget.var("Number Photons", mNumPhotonsUI, 1000u, UINT_MAX, 1000u);
@@ -415,6 +719,9 @@ void PhotonMapperStochasticHash::renderUI(Gui::Widgets& widget)
         widget.tooltip("Sets the Alpha in SPPM for the Global Photons");
         dirty |= widget.var("Caustic Alpha", mSPPMAlphaCaustic, 0.1f, 1.0f, 0.001f);
         widget.tooltip("Sets the Alpha in SPPM for the Caustic Photons");
+        mResetCS |= widget.checkbox("Per Pixel Radius", mPerPixelSPPM);
+        widget.tooltip("Every pixel shrinks its own radius with the photons it found (Hachisuka and Jensen).\n"
+                       "The current radius of the maps then only sets the hash cell size");
     }
     
     widget.dummy("", dummySpacing);
@@ -460,6 +767,11 @@ void PhotonMapperStochasticHash::renderUI(Gui::Widgets& widget)
         dirty |= resetTimer;
     }
 
+    //Convergence measurement
+    if (auto group = widget.group("Convergence")) {
+        dirty |= mConvergence.renderUI(widget);
+    }
+
     //Radius settings
     if (auto group = widget.group("Radius Options")) {
         dirty |= widget.var("Caustic Radius Start", mCausticRadiusStart, kMinPhotonRadius, FLT_MAX, 0.001f);
@@ -469,6 +781,25 @@ void PhotonMapperStochasticHash::renderUI(Gui::Widgets& widget)
         dirty |= widget.var("Russian Roulette", mRussianRoulette, 0.001f, 1.f, 0.001f);
         widget.tooltip("Probabilty that a Global Photon is saved");
     }
+    if (auto group = widget.group("Photon Culling")) {
+        dirty |= widget.checkbox("Enable Photon Culling", mEnablePhotonCulling);
+        widget.tooltip("Marks the cells around the camera hits in a hash. Photons in other cells are not inserted into the buckets");
+        mRebuildCullingBuffer |= widget.slider("Culling Buffer Size", mCullingHashBufferBits, 10u, 32u);
+        widget.tooltip("Number of bits in the culling buffer. 2^x");
+        if (mCullingBuffer) widget.text(fmt::format("Culling buffer: {:.1f} KB", mCullingBuffer->getSize() / 1024.0));
+        dirty |= widget.slider("Culling Hashes", mCullingNumHashes, 1u, kCullingMaxHashes);
+        widget.tooltip("Bits that a cell sets. 1 is a plain bit set, more hashes make it a Bloom filter with fewer false positives as long as only a small part of the bits is set");
+        bool projMatrix = widget.checkbox("Use Projection Matrix", mUseProjectionMatrixCulling);
+        widget.tooltip("Uses Projection Matrix additionally for culling");
+        if (mUseProjectionMatrixCulling) {
+            dirty |= widget.var("Culling Projection Test Value", mCullingProjectionTestOver, 1.0f, 1.5f, 0.001f);
+            widget.tooltip("Value used for the test with the projected postions. Any absolute value above is culled for the xy coordinate.");
+        }
+        if (projMatrix)
+            mPhotonCullingPass.reset();
+
+        dirty |= mRebuildCullingBuffer | projMatrix;
+    }
     //Material Settings
     if (auto group = widget.group("Material Options")) {
         dirty |= widget.var("Emissive Scalar", mIntensityScalar, 0.0f, FLT_MAX, 0.001f);
@@ -484,15 +815,35 @@ void PhotonMapperStochasticHash::renderUI(Gui::Widgets& widget)
     if (auto group = widget.group("Hash Options")) {
         mResetCS |= widget.slider("Bucket size (bits)", mNumBucketBits, 2u, 32u);
         widget.tooltip("Bucket size in 2^x. One bucket takes 48Byte. Total Size = 2^x * 48B. There are two buckets total");
+        mResetCS |= widget.dropdown("Hash function", kHashFunctionList, mHashFunction);
+        widget.tooltip("Hash function that maps a cell to a bucket");
+        mResetCS |= widget.dropdown("Gather traversal", kGatherTraversalList, mGatherTraversal);
+        widget.tooltip("Cells the collect pass looks up. Cube visits every cell of the cube around the cell of the hit, Sphere Overlap only the cells that overlap the gather sphere (8 cells at most with a cell size of 2x radius)");
+        dirty |= widget.dropdown("Cell size", kHashCellSizeList, mHashCellSize);
+        widget.tooltip("Edge length of the hash cells. Larger cells need fewer lookups, but hold more photons outside of the radius");
+        dirty |= widget.var("Grid levels", mHashGridLevels, 0u, 16u);
+        widget.tooltip("Number of power of two cell sizes below the start radius. The cells use the finest level that is at least the cell size above, so they only shrink when the radius halves. 0 lets the cells follow the radius in every iteration");
+        if (mHashGridLevels > 0)
+            widget.text(fmt::format("Cell size: global {:.5f}, caustic {:.5f}", 1.f / getHashScaleFactor(false), 1.f / getHashScaleFactor(true)));
+        widget.checkbox("Automatic Bucket Count", mAutoBucketCount);
+        widget.tooltip("Sets the bucket size from the number of occupied buckets. Both maps share the bucket count, the map with more occupied buckets decides. The bucket size above is used as start size");
+        widget.text("Occupied Buckets: " + std::to_string(mOccupiedBuckets[0]) + " caustic, " + std::to_string(mOccupiedBuckets[1]) + " global of " + std::to_string(mNumBuckets));
+        if (mAutoBucketCount) {
+            const auto& stats = mBucketCountPolicy.getStats();
+            widget.text("Resizes: " + std::to_string(stats.grows + stats.shrinks));
+            widget.tooltip("Number of automatic bucket count changes since the last scene change");
+        }
 
         dirty |= mResetCS;
     }
 
-    if (auto group = widget.group("Light Sample Tex")) {
+    if (auto group = widget.group("Light Sampling")) {
         mRebuildLightTex |= widget.dropdown("Sample mode", kLightTexModeList, (uint32_t&)mLightTexMode);
-        widget.tooltip("Changes photon distribution for the light sampling texture. Also rebuilds the texture.");
-        mRebuildLightTex |= widget.button("Rebuild Light Tex");
+        widget.tooltip("Changes photon distribution over the lights. Also rebuilds the light table.");
+        mRebuildLightTex |= widget.button("Rebuild Light Table");
         dirty |= mRebuildLightTex;
+        widget.checkbox("Async Rebuild", mAsyncLightTexRebuild);
+        widget.tooltip("Rebuilds the light table on a worker thread. The old table is used until the new one is ready");
     }
 
     //Disable Photon Collecion
@@ -523,6 +874,7 @@ void PhotonMapperStochasticHash::setScene(RenderContext* pRenderContext, const S
     // After changing scene, the raytracing program should to be recreated.
     mTracerGenerate = RayTraceProgramHelper::create();
     mpCSCollect.reset();
+    mPhotonCullingPass.reset();
     mSetConstantBuffers = true;
     
     // Set new scene.
@@ -557,203 +909,47 @@ void PhotonMapperStochasticHash::setScene(RenderContext* pRenderContext, const S
             mTracerGenerate.pProgram = RtProgram::create(desc, mpScene->getSceneDefines());
         }
     }
+
+    //init the occupied bucket counter
+    prepareOccupiedBucketCounter(pRenderContext);
 }
 
-void PhotonMapperStochasticHash::getActiveEmissiveTriangles(RenderContext* pRenderContext)
+void PhotonMapperStochasticHash::createLightSampleTable(RenderContext* pRenderContext)
 {
-    auto lightCollection = mpScene->getLightCollection(pRenderContext);
-
-    auto meshLightTriangles = lightCollection->getMeshLightTriangles();
-
-    mActiveEmissiveTriangles.clear();
-    mActiveEmissiveTriangles.reserve(meshLightTriangles.size());
+    FALCOR_ASSERT(mpScene);    //Scene has to be set
 
-    for (uint32_t triIdx = 0; triIdx < (uint32_t)meshLightTriangles.size(); triIdx++)
+    LightSampleTableBuilder::Table table;
     {
-        if (meshLightTriangles[triIdx].flux > 0.f)
-        {
-            mActiveEmissiveTriangles.push_back(triIdx);
-        }
+        FALCOR_PROFILE("light sample table");
+        auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::LightTable);
+        auto input = LightSampleTableBuilder::createInput(pRenderContext, mpScene, mNumPhotons, mMaxDispatchY, (LightSampleTableBuilder::Mode)mLightTexMode);
+        table = mLightTableBuilder.build(input);
     }
+    uploadLightSampleTable(table);
 }
 
-void PhotonMapperStochasticHash::createLightSampleTexture(RenderContext* pRenderContext)
+void PhotonMapperStochasticHash::uploadLightSampleTable(const LightSampleTableBuilder::Table& table)
 {
-    if (mPhotonsPerTriangle) mPhotonsPerTriangle.reset();
-    if (mLightSampleTex) mLightSampleTex.reset();
-
-    FALCOR_ASSERT(mpScene);    //Scene has to be set
-
-    auto analyticLights = mpScene->getActiveLights();
-    auto lightCollection = mpScene->getLightCollection(pRenderContext);
-
-    uint analyticPhotons = 0;
-    uint numEmissivePhotons = 0;
-    //If there are analytic Lights split number of Photons even between the analytic light and the number of emissive models (approximation of the number of emissive lights)
-    if (analyticLights.size() != 0){
-        uint lightsTotal = static_cast<uint>(analyticLights.size() + lightCollection->getMeshLights().size());
-        float percentAnalytic = static_cast<float>(analyticLights.size()) / static_cast<float>(lightsTotal);
-        analyticPhotons = static_cast<uint>(mNumPhotons * percentAnalytic);
-        analyticPhotons += (uint)analyticLights.size() - (analyticPhotons % (uint) analyticLights.size());  //add it up so every light gets the same number of photons
-        numEmissivePhotons = mNumPhotons - analyticPhotons;
-    }
-    else
-        numEmissivePhotons = mNumPhotons;
-
-    std::vector<uint> numPhotonsPerTriangle;    //only filled when there are emissive
-
-    if (numEmissivePhotons > 0) {
-        getActiveEmissiveTriangles(pRenderContext);
-        auto meshLightTriangles = lightCollection->getMeshLightTriangles();
-        //Get total area to distribute to get the number of photons per area.
-        float totalMode = 0;
-        for (uint i = 0; i < (uint)mActiveEmissiveTriangles.size(); i++) {
-            uint triIdx = mActiveEmissiveTriangles[i];
-
-            switch (mLightTexMode) {
-            case LightTexMode::power:
-                totalMode += meshLightTriangles[triIdx].flux;
-                break;
-            case LightTexMode::area:
-                totalMode += meshLightTriangles[triIdx].area;
-                break;
-            default:
-                totalMode += meshLightTriangles[triIdx].flux;
-            }
-
-        }
-        float photonsPerMode = numEmissivePhotons / totalMode;
-
-        //Calculate photons on a per triangle base
-        uint tmpNumEmissivePhotons = 0; //Real count will change due to rounding
-        numPhotonsPerTriangle.reserve(mActiveEmissiveTriangles.size());
-        for (uint i = 0; i < (uint)mActiveEmissiveTriangles.size(); i++) {
-            uint triIdx = mActiveEmissiveTriangles[i];
-            uint photons = 0;
-
-            switch (mLightTexMode) {
-            case LightTexMode::power:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].flux * photonsPerMode));
-                break;
-            case LightTexMode::area:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].area * photonsPerMode));
-                break;
-            default:
-                photons = static_cast<uint>(std::ceil(meshLightTriangles[triIdx].flux * photonsPerMode));
-            }
-
-
-            if (photons == 0) photons = 1;  //shoot at least one photon
-            tmpNumEmissivePhotons += photons;
-            numPhotonsPerTriangle.push_back(photons);
-        }
-        numEmissivePhotons = tmpNumEmissivePhotons;     //get real photon count
-    }
-
-    uint totalNumPhotons = numEmissivePhotons + analyticPhotons;
-
-    //calculate the pdf for analytic and emissive light
-    if (analyticPhotons > 0 && analyticLights.size() > 0) {
-        mAnalyticInvPdf = (static_cast<float>(totalNumPhotons) * static_cast<float>(analyticLights.size())) / static_cast<float>(analyticPhotons);
-    }   
+    FALCOR_PROFILE("upload light sample table");
+    auto stageTimer = mStageTimes.scopedCpuTimer(StageTimingStats::Stage::LightTable);
 
-    const uint blockSize = 16;
-    const uint blockSizeSq = blockSize * blockSize;
+    if (mLightAliasTable) mLightAliasTable.reset();
 
-    //Create texture. The texture fills 16x16 fields with information
-    
-    uint xPhotons = (totalNumPhotons / mMaxDispatchY) + 1;
-    xPhotons += (xPhotons % blockSize == 0 && analyticPhotons > 0) ? blockSize : blockSize - (xPhotons % blockSize);  //Fill up so x to 16x16 block with at least 1 block extra when mixed
-
-    //Init the texture with the invalid index (zero)
-    //Negative indices are analytic and postivie indices are emissive
-    std::vector<int32_t> lightIdxTex(xPhotons * mMaxDispatchY, 0);
-
-    //Helper functions
-    auto getIndex = [&](uint2 idx) {
-        return idx.x + idx.y * xPhotons;
-    };
-
-    auto getBlockStartingIndex = [&](uint blockIdx) {
-        blockIdx = blockIdx * blockSize;          //Multiply by the expansion of the box in x
-        uint x = blockIdx % xPhotons;
-        uint y = (blockIdx / xPhotons) * blockSize;
-        return uint2(x, y);
-    };
-
-    //Fill analytic lights
-    if (analyticLights.size() > 0) {
-        uint numCurrentLight = 0;
-        uint step = analyticPhotons / static_cast<uint>(analyticLights.size());
-        bool stop = false;
-        for (uint i = 0; i <= analyticPhotons / blockSizeSq; i++) {
-            if (stop) break;
-            for (uint y = 0; y < blockSize; y++) {
-                if (stop) break;
-                for (uint x = 0; x < blockSize; x++) {
-                    if (numCurrentLight >= analyticPhotons) {
-                        stop = true;
-                        break;
-                    }
-                    uint2 idx = getBlockStartingIndex(i);
-                    idx += uint2(x, y);
-                    int32_t lightIdx = static_cast<int32_t>((numCurrentLight / step) + 1);  //current light index + 1
-                    lightIdx *= -1;                                                         //turn it negative as it is a analytic light
-                    lightIdxTex[getIndex(idx)] = lightIdx;
-                    numCurrentLight++;
-                }
-            }
-        }
-    }
-    
-
-    //Fill emissive lights
-    if (numEmissivePhotons > 0) {
-        uint analyticEndBlock = analyticPhotons > 0 ? (analyticPhotons / blockSizeSq) + 1 : 0;    //we have guaranteed an extra block
-        uint currentActiveTri = 0;
-        uint lightInActiveTri = 0;
-        bool stop = false;
-        for (uint i = 0; i <= numEmissivePhotons / blockSizeSq; i++) {
-            if (stop) break;
-            for (uint y = 0; y < blockSize; y++) {
-                if (stop) break;
-                for (uint x = 0; x < blockSize; x++) {
-                    if (currentActiveTri >= static_cast<uint>(numPhotonsPerTriangle.size())) {
-                        stop = true;
-                        break;
-                    }
-                    uint2 idx = getBlockStartingIndex(i + analyticEndBlock);
-                    idx += uint2(x, y);
-                    int32_t lightIdx = static_cast<int32_t>(currentActiveTri + 1);      //emissive has the positive index
-                    lightIdxTex[getIndex(idx)] = lightIdx;
-
-                    //Check if the number of photons exeed that of the current active triangle
-                    lightInActiveTri++;
-                    if (lightInActiveTri >= numPhotonsPerTriangle[currentActiveTri]) {
-                        currentActiveTri++;
-                        lightInActiveTri = 0;
-                    }
-                }
-            }
-        }
+    //Create the alias table buffer. Memory scales with the number of lights
+    mLightAliasTableSize = static_cast<uint>(table.aliasTable.size());
+    if (mLightAliasTableSize > 0) {
+        mLightAliasTable = Buffer::createStructured(sizeof(LightAliasEntry), mLightAliasTableSize, ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, table.aliasTable.data());
     }
-    
-
-
-    //Create texture and Pdf buffer
-    mLightSampleTex = Texture::create2D(xPhotons, mMaxDispatchY, ResourceFormat::R32Int, 1, 1, lightIdxTex.data());
-    mLightSampleTex->setName("PhotonMapperStochasticHash::LightSampleTex");
-
-    //Create a buffer for num photons per triangle
-    if (numPhotonsPerTriangle.size() == 0) {
-        numPhotonsPerTriangle.push_back(0);
+    else {
+        //Table with a single invalid light, so the generate pass stays valid in a scene without lights
+        LightAliasEntry invalid = { 1.f, 0, 0, 0.f };
+        mLightAliasTable = Buffer::createStructured(sizeof(LightAliasEntry), 1, ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, &invalid);
+        mLightAliasTableSize = 1;
     }
-    mPhotonsPerTriangle = Buffer::createStructured(sizeof(uint), static_cast<uint32_t>(numPhotonsPerTriangle.size()), ResourceBindFlags::ShaderResource, Buffer::CpuAccess::None, numPhotonsPerTriangle.data());
-    mPhotonsPerTriangle->setName("PhotonMapperStochasticHash::mPhotonsPerTriangleEmissive");
-
+    mLightAliasTable->setName("PhotonMapperStochasticHash::LightAliasTable");
 
     //Set numPhoton variable
-    mPGDispatchX = xPhotons;
+    mPGDispatchX = table.width;
 
     mNumPhotons = mPGDispatchX * mMaxDispatchY;
     mNumPhotonsUI = mNumPhotons;
@@ -765,21 +961,24 @@ void PhotonMapperStochasticHash::resetPhotonMapper()
 
     //For Photon Buffers and resize
     mResizePhotonBuffers = true; mPhotonBuffersReady = false;
+    mOccupiedBuckets = { 0, 0 };
+    mPhotonsInserted = 0; mPhotonsCulled = 0;
+    mBucketCountPolicy.reset();
 
     mResetCS = true;
     mSetConstantBuffers = true;
 
-    //reset light sample tex
-    mLightSampleTex = nullptr;
+    //reset light table
+    mLightAliasTable = nullptr;
 }
 
 void PhotonMapperStochasticHash::changeNumPhotons()
 {
-    //If photon number differ reset the light sample texture
+    //If photon number differ reset the light table
     if (mNumPhotonsUI != mNumPhotons) {
-        //Reset light sample tex and frame counter
+        //Reset light table and frame counter
         mNumPhotons = mNumPhotonsUI;
-        mLightSampleTex = nullptr;
+        mLightAliasTable = nullptr;
         mFrameCount = 0;
     }
 
@@ -830,10 +1029,51 @@ bool PhotonMapperStochasticHash::preparePhotonBuffers()
     mpGlobalHashPhotonCounter->setName("PhotonMapperStochasticHash::CounterHashGlobal");
     mpCausticHashPhotonCounter = Buffer::createStructured(sizeof(uint32_t), mNumBuckets);
     mpCausticHashPhotonCounter->setName("PhotonMapperStochasticHash::CounterHashCaustic");
+
+    //Counts in flight belong to the old bucket count
+    mBucketCountPolicy.setCapacity(mNumBuckets);
+    mOccupiedBucketReadback.invalidate();
     
     return true;
 }
 
+void PhotonMapperStochasticHash::prepareOccupiedBucketCounter(RenderContext* pRenderContext)
+{
+    //[caustic occupied, global occupied, inserted, culled]
+    mpOccupiedBucketCounter = Buffer::createStructured(sizeof(uint), 4);
+    mpOccupiedBucketCounter->setName("PhotonMapperStochasticHash::OccupiedBucketCounter");
+    mOccupiedBucketReadback.init(FalcorReadbackDevice::create(pRenderContext, mpOccupiedBucketCounter, sizeof(uint) * 4));
+}
+
+void PhotonMapperStochasticHash::copyOccupiedBuckets(RenderContext* pRenderContext)
+{
+    //Counts from before a reset are not valid for the new iteration
+    if (mFrameCount == 0)
+        mOccupiedBucketReadback.invalidate();
+
+    mOccupiedBucketReadback.enqueue();
+}
+
+void PhotonMapperStochasticHash::updateOccupiedBuckets()
+{
+    if (!mOccupiedBucketReadback.poll()) return;
+
+    auto counters = mOccupiedBucketReadback.getValue<std::array<uint, 4>>();
+    mOccupiedBuckets = { counters[0], counters[1] };
+    mPhotonsInserted = counters[2]; mPhotonsCulled = counters[3];
+
+    //Both maps use the same bucket count, so the fuller one decides. The policy only returns powers of two
+    if (mAutoBucketCount && mPhotonBuffersReady && !mResetCS) {
+        uint64_t numBuckets = mBucketCountPolicy.addCount(std::max(mOccupiedBuckets[0], mOccupiedBuckets[1]));
+        if (numBuckets != mNumBuckets) {
+            uint bucketBits = 0;
+            while ((uint64_t(1) << bucketBits) < numBuckets) bucketBits++;
+            mNumBucketBits = bucketBits;
+            mResetCS = true;
+        }
+    }
+}
+
 void PhotonMapperStochasticHash::prepareRandomSeedBuffer(const uint2 screenDimensions)
 {
     FALCOR_ASSERT(screenDimensions.x > 0 && screenDimensions.y > 0);
@@ -850,9 +1090,26 @@ void PhotonMapperStochasticHash::prepareRandomSeedBuffer(const uint2 screenDimen
     FALCOR_ASSERT(mRandNumSeedBuffer);
 }
 
+void PhotonMapperStochasticHash::prepareProgressiveBuffers(const uint2 screenDimensions)
+{
+    FALCOR_ASSERT(screenDimensions.x > 0 && screenDimensions.y > 0);
+    if (mProgressiveEmission && mProgressiveEmission->getWidth() == screenDimensions.x && mProgressiveEmission->getHeight() == screenDimensions.y)
+        return;
+
+    mProgressiveStats = Buffer::createStructured(sizeof(ProgressivePhotonStats), 2 * screenDimensions.x * screenDimensions.y, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess, Buffer::CpuAccess::None, nullptr, false);
+    mProgressiveStats->setName("PhotonMapperStochasticHash::ProgressiveStats");
+    mProgressiveEmission = Texture::create2D(screenDimensions.x, screenDimensions.y, ResourceFormat::RGBA32Float, 1, 1, nullptr, ResourceBindFlags::ShaderResource | ResourceBindFlags::UnorderedAccess);
+    mProgressiveEmission->setName("PhotonMapperStochasticHash::ProgressiveEmission");
+    //The statistics are only initialized in the first iteration
+    mFrameCount = 0;
+}
+
 void PhotonMapperStochasticHash::checkTimer()
 {
-    if (!mUseTimer) return;
+    if (!mUseTimer) {
+        mStageTimes.setEnabled(false);
+        return;
+    }
 
     //reset timer
     if (mResetTimer) {
@@ -860,10 +1117,8 @@ void PhotonMapperStochasticHash::checkTimer()
         mTimerStartTime = std::chrono::steady_clock::now();
         mTimerStopRenderer = false;
         mResetTimer = false;
-        if (mTimerRecordTimes) {
-            mTimesList.clear();
-            mTimesList.reserve(10000);
-        }
+        mStageTimes.clear();
+        mStageTimes.setEnabled(mTimerRecordTimes);
         return;
     }
 
@@ -887,31 +1142,52 @@ void PhotonMapperStochasticHash::checkTimer()
         }
     }
 
-    //Add to times list
+    //Start the next iteration. The profiler holds the GPU times of the last frame, so they belong to the previous one
     if (mTimerRecordTimes) {
-        mTimesList.push_back(mCurrentElapsedTime);
+        StageTimingProfiler::setGpuTimes(mStageTimes);
+        mStageTimes.beginIteration(mFrameCount, mCurrentElapsedTime);
+    }
+
+    //Store the times as soon as the timer stops. Scripted runs set the output file via the dictionary
+    if (mTimerStopRenderer && mTimerRecordTimes) {
+        mStageTimes.endIteration();
+        outputTimes();
     }
 }
 
 void PhotonMapperStochasticHash::outputTimes()
 {
-    if (mTimesOutputFilePath.empty() || mTimesList.empty()) return;
-
-    std::ofstream file = std::ofstream(mTimesOutputFilePath, std::ios::trunc);
-
-    if (!file) {
-        reportError(fmt::format("Failed to open file '{}'.", mTimesOutputFilePath));
-        mTimesOutputFilePath.clear();
-        return;
+    if (mTimesOutputFilePath.empty() || mStageTimes.getIterations().empty()) return;
+
+    //Run metadata
+    mStageTimes.setMetadata("pass", "PhotonMapperStochasticHash");
+    if (mpScene) mStageTimes.setMetadata("scene", mpScene->getPath().string());
+    mStageTimes.setMetadata("numPhotons", mNumPhotons);
+    mStageTimes.setMetadata("globalBufferSize", mGlobalBufferSizeUI);
+    mStageTimes.setMetadata("causticBufferSize", mCausticBufferSizeUI);
+    mStageTimes.setMetadata("globalRadiusStart", mGlobalRadiusStart);
+    mStageTimes.setMetadata("causticRadiusStart", mCausticRadiusStart);
+    mStageTimes.setMetadata("useSPPM", mUseStatisticProgressivePM);
+    mStageTimes.setMetadata("perPixelSPPM", mPerPixelSPPM);
+    mStageTimes.setMetadata("maxBounces", mMaxBounces);
+    mStageTimes.setMetadata("numBucketBits", mNumBucketBits);
+    mStageTimes.setMetadata("hashFunction", mHashFunction);
+    mStageTimes.setMetadata("gatherTraversal", mGatherTraversal);
+    mStageTimes.setMetadata("hashCellSize", mHashCellSize);
+    mStageTimes.setMetadata("hashGridLevels", mHashGridLevels);
+    mStageTimes.setMetadata("enablePhotonCulling", mEnablePhotonCulling);
+    if (mEnablePhotonCulling) {
+        mStageTimes.setMetadata("cullingHashBufferBits", mCullingHashBufferBits);
+        mStageTimes.setMetadata("cullingNumHashes", mCullingNumHashes);
+        mStageTimes.setMetadata("useProjectionMatrixCulling", mUseProjectionMatrixCulling);
+        mStageTimes.setMetadata("culledInserts", mPhotonsCulled);
     }
+    mStageTimes.setMetadata("iterations", mFrameCount);
 
-    //Write into file
-    file << "StochHash_Times" << std::endl;
-    file << std::fixed << std::setprecision(16);
-    for (size_t i = 0; i < mTimesList.size(); i++) {
-        file << mTimesList[i];
-        file << std::endl;
+    std::filesystem::path jsonPath = std::filesystem::path(mTimesOutputFilePath).replace_extension(".json");
+    if (!mStageTimes.writeCsv(mTimesOutputFilePath) || !mStageTimes.writeJson(jsonPath.string())) {
+        reportError(fmt::format("Failed to write the times to '{}'.", mTimesOutputFilePath));
+        mTimesOutputFilePath.clear();
     }
-    file.close();
 }
 
@@ -28,7 +28,16 @@
 #pragma once
 #include "Falcor.h"
 #include "Utils/Sampling/SampleGenerator.h"
-#include "PhotonMapperStochasticHashFunctions.slang"
+#include "../PhotonMapperCommon/SpatialHash.slang"
+#include "../PhotonMapperCommon/GatherCells.slang"
+#include "../PhotonMapperCommon/HashGridLevels.h"
+#include "../PhotonMapperCommon/CullingBloomFilter.h"
+#include "../PhotonMapperCommon/ProgressiveRadius.slang"
+#include "../PhotonMapperCommon/LightSampleTableBuilder.h"
+#include "../PhotonMapperCommon/StageTimingProfiler.h"
+#include "../PhotonMapperCommon/ConvergenceMonitor.h"
+#include "../PhotonMapperCommon/PhotonBufferSizePolicy.h"
+#include "../PhotonMapperCommon/ReadbackRing.h"
 
 using namespace Falcor;
 
@@ -67,7 +76,11 @@ public:
     };
 
 private:
-    PhotonMapperStochasticHash();
+    PhotonMapperStochasticHash(const Dictionary& dict);
+
+    /** Parses the dictonary when creating the render pass
+    */
+    void parseDictionary(const Dictionary& dict);
 
     /** Prepares Program Variables and binds the sample generator
     */
@@ -77,6 +90,18 @@ private:
     */
     bool preparePhotonBuffers();
 
+    /** Creates the occupied bucket counter and its readback ring
+    */
+    void prepareOccupiedBucketCounter(RenderContext* pRenderContext);
+
+    /** Queues the copy of the occupied bucket counter for readback
+    */
+    void copyOccupiedBuckets(RenderContext* pRenderContext);
+
+    /** Takes the newest finished occupied bucket count and feeds the bucket count policy
+    */
+    void updateOccupiedBuckets();
+
     /** Resets buffer and runtime vars. Used for scene change or number of photons change
     */
     void resetPhotonMapper();
@@ -85,6 +110,26 @@ private:
     */
     void changeNumPhotons();
 
+    /** Scale from world position to hash cell, 1 / (cell size * radius) or the scale of the grid level of the radius
+    */
+    float getHashScaleFactor(bool caustic) const;
+
+    /** Radius that the culling cells are built for. Per pixel radii never exceed the start radii
+    */
+    float getCullingRadius() const;
+
+    /** Creates the culling bit set with 2^mCullingHashBufferBits bits
+    */
+    void initPhotonCulling();
+
+    /** Resets the culling pass and buffer. This saves memory if the culling is deactivated
+    */
+    void resetCullingVars();
+
+    /** Marks the culling cells around every camera hit. Generate skips the bucket insert for photons in unmarked cells
+    */
+    void photonCullingPass(RenderContext* pRenderContext, const RenderData& renderData);
+
     /** Creates the Generate Photon pass, where the photons are shot through the scene and saved in an AABB and information buffer
     */
     void generatePhotons(RenderContext* pRenderContext, const RenderData& renderData);
@@ -99,21 +144,23 @@ private:
     */
     void prepareRandomSeedBuffer(const uint2 screenDimensions);
 
-    /** Prepares a light sample texture for the photon generate pass
+    /** Creates the per pixel SPPM statistics if they do not match the screen size. The collect pass initializes them in the first iteration
     */
-    void createLightSampleTexture(RenderContext* pRenderContext);
+    void prepareProgressiveBuffers(const uint2 screenDimensions);
 
-    /** Gets the active emissive triangles from the light collection.
-    *  This is analogous to the function from LightCollection. It is here to prevent changes to the core of Falcor.
-    *  As this is done once it has no impact on performance and only a minimal impact on CPU-Memory
+    /** Prepares the light alias table for the photon generate pass
     */
-    void getActiveEmissiveTriangles(RenderContext* pRenderContext);
+    void createLightSampleTable(RenderContext* pRenderContext);
+
+    /** Uploads a built light sample table and sets the dispatch size and number of photons from it
+    */
+    void uploadLightSampleTable(const LightSampleTableBuilder::Table& table);
 
     /** Checks the timer. This is to stop the renderer for performance tests
     */
     void checkTimer();
 
-    /** Writes the output times to file in mTimesOutputFilePath
+    /** Writes the recorded stage timings as CSV to mTimesOutputFilePath and as JSON next to it
     */
     void outputTimes();
 
@@ -126,6 +173,7 @@ private:
     const float                 kCollectTMin = 0.000001f;                   ///<non configurable constant for collection for now
     const float                 kCollectTMax = 0.000002f;                   ///< non configurable constant for collection for now
     const uint                  kInfoTexHeight = 512;                       ///< Height of the info tex as it is too big for 1D tex
+    const uint                  kMaxBucketTexWidth = 16384;                 ///< Texture width limit for the bucket textures
 
     //***************************************************************************
     // Configuration
@@ -134,6 +182,7 @@ private:
     bool                        mUseStatisticProgressivePM = true;     ///< Activate Statistically Progressive Photon Mapping(SPPM)
     float                       mSPPMAlphaGlobal = 0.7f;                 ///< Global Alpha for SPPM
     float                       mSPPMAlphaCaustic = 0.7f;                ///< Caustic Alpha for SPPM
+    bool                        mPerPixelSPPM = false;                  ///< Radius and photon statistics per pixel (ProgressiveRadius.slang). The map radius stays at the start radius for the cells
 
     float                       mCausticRadiusStart = 0.01f;            ///< Start value for the caustic Radius
     float                       mGlobalRadiusStart = 0.05f;             ///< Start value for the caustic Radius
@@ -152,9 +201,22 @@ private:
     bool                        mAdjustShadingNormals = true;           ///<Adjusts the shading normals (Generate)
 
     uint                        mNumBucketBits = 18;                    ///< 2^NumBucketBits is the total amount of possible buckets
+    uint                        mHashFunction = (uint)SpatialHashFunction::Wang;    ///< Hash function used for the buckets (SpatialHashFunction)
+    uint                        mGatherTraversal = (uint)GatherTraversal::SphereOverlap;    ///< Cells the collect pass looks up (GatherTraversal)
+    uint                        mHashCellSize = 1;                      ///< Edge length of the hash cells in radii (1 or 2)
+    uint                        mHashGridLevels = 0;                    ///< Power of two cell sizes (HashGridLevels). 0 lets the cells follow the radius
+    bool                        mAutoBucketCount = true;                ///< Sets the bucket count from the number of occupied buckets
 
     bool                        mEnableFaceNormalRejection = false;
 
+    //Photon Culling
+    bool                        mEnablePhotonCulling = true;            ///< Skips the bucket insert for photons that no camera hit can gather
+    bool                        mRebuildCullingBuffer = false;
+    uint                        mCullingHashBufferBits = 22;            ///< 2^x bits in the culling buffer. Uses the bucket hash function
+    uint                        mCullingNumHashes = 1;                  ///< Bits per cell. 1 is a plain bit set, more make it a Bloom filter
+    bool                        mUseProjectionMatrixCulling = false;    ///< Never cull photons inside the camera frustum
+    float                       mCullingProjectionTestOver = 1.01f;     ///< Value used for determining what is inside the projection
+
     // Generate only
     uint                        mMaxBounces = 10;                        ///< Depth of recursion (0 = none).
     float                       mRussianRoulette = 0.3f;                ///< Probabilty that a Global photon is saved
@@ -184,19 +246,23 @@ private:
     uint                        mInfoTexFormat = 1;
     uint                        mNumBuckets = 0;
     bool                        mPhotonBuffersReady = false;
+    std::array<uint, 2>         mOccupiedBuckets = { 0, 0 };        ///< Last read back number of occupied buckets (caustic, global)
+    uint                        mPhotonsInserted = 0;               ///< Photons of the last read back iteration that were inserted into the buckets
+    uint                        mPhotonsCulled = 0;                 ///< Photons of the last read back iteration that skipped the insert because of the culling
+    PhotonBufferSizePolicy      mBucketCountPolicy;                 ///< Size policy for the bucket count
 
 
     //Light
-    std::vector<uint> mActiveEmissiveTriangles;
+    LightSampleTableBuilder mLightTableBuilder;     ///< Builds the light sample table. Rebuilds can run on a worker thread
     bool            mRebuildLightTex = false;
+    bool            mAsyncLightTexRebuild = true;   ///< Keep rendering with the old light table while a rebuild is running
     LightTexMode mLightTexMode = LightTexMode::power;
-    Texture::SharedPtr mLightSampleTex;
-    Buffer::SharedPtr mPhotonsPerTriangle;
+    Buffer::SharedPtr mLightAliasTable;             ///< Light alias table (LightAliasEntry)
+    uint            mLightAliasTableSize = 0;
     const uint mMaxDispatchY = 512;
     uint mPGDispatchX = 0;
     uint mAnalyticEndIndex = 0;
     uint mNumLights = 0;
-    float mAnalyticInvPdf = 0.0f;
 
     //Clock/Timer
     bool                        mUseTimer = false;                          //<Activates the timer
@@ -207,9 +273,12 @@ private:
     double                      mCurrentElapsedTime = 0.0;                    //<Elapsed time for UI
     std::chrono::time_point<std::chrono::steady_clock> mTimerStartTime;     //<Start time for the timer
     bool                        mTimerRecordTimes = false;                   //< Enable Records times
-    std::vector<double>         mTimesList;                                 //< List with render times
+    StageTimingStats            mStageTimes;                                //< Per iteration stage timings while recording times
     std::string                 mTimesOutputFilePath;                       //< Output file path for the times
 
+    //Convergence
+    ConvergenceMonitor          mConvergence;                               ///< Error-versus-time measurement against a reference image
+
     // Ray tracing program.
     struct RayTraceProgramHelper
     {
@@ -231,6 +300,10 @@ private:
 
     ComputePass::SharedPtr mpCSCollect;             ///<Collect pass collects the photons that where shot  
     RayTraceProgramHelper mTracerGenerate;          ///<Description for the Generate Photon pass 
+    ComputePass::SharedPtr mPhotonCullingPass;      ///< Marks the culling cells of the camera hits
+
+    //Photon Culling vars
+    Buffer::SharedPtr mCullingBuffer;               ///< Culling bits, 32 per word (CullingBloomFilter.slang)
 
     //
     //Photon Buffers
@@ -244,8 +317,12 @@ private:
 
     Buffer::SharedPtr mpGlobalHashPhotonCounter;
     Buffer::SharedPtr mpCausticHashPhotonCounter;
+    Buffer::SharedPtr mpOccupiedBucketCounter;      ///< Number of buckets that got at least one photon (caustic, global), then the inserted and culled photons
+    ReadbackRing mOccupiedBucketReadback;           ///< Occupied bucket readback. Lags a few frames behind the GPU
 
 
     Texture::SharedPtr mRandNumSeedBuffer;       ///< Buffer for the random seeds
+    Buffer::SharedPtr mProgressiveStats;         ///< Per pixel SPPM statistics, caustic and global per pixel
+    Texture::SharedPtr mProgressiveEmission;     ///< Per pixel SPPM mean of the emission
 
 };
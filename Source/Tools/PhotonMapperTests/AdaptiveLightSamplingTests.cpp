@@ -0,0 +1,256 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/AdaptiveLightSampling.h"
+#include "../../RenderPasses/PhotonMapperCommon/LightAliasTable.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <random>
+#include <string>
+
+namespace
+{
+    const uint32_t kFrames = 256;
+    const uint32_t kAdaptInterval = 4;          ///< Frames the counters are accumulated before a readback
+    const uint32_t kReadbackLatency = 3;        ///< Frames until a readback is available on the CPU
+    const double kMaxVarianceRatio = 2.0;       ///< The variances are estimated from 64 frames each, only a clear increase fails
+
+    /** Synthetic scene with a visibility per light. A visible photon lands in a marked culling cell.
+    */
+    struct SyntheticScene
+    {
+        std::string name;
+        std::vector<double> power;              ///< Normalized light power, used as the base distribution
+        std::vector<double> visibility;         ///< Probability that a photon of the light is stored visible
+        std::vector<double> visibilityAfter;    ///< Visibility from the middle of the frames on (camera moved). Empty for none
+        uint32_t photonsPerFrame = 0;
+        double minGain = 1.0;                   ///< Min ratio of the adaptive to the fixed visible fraction
+    };
+
+    struct SimulationResult
+    {
+        double meanError = 0.0;                 ///< Mean of estimate - reference over all frames
+        double stdError = 0.0;                  ///< Standard error of the mean
+        double mean = 0.0;
+        double visibleFraction = 0.0;           ///< Over the last quarter of the frames
+        double variance = 0.0;                  ///< Of the estimate over the last quarter of the frames
+        std::vector<double> probabilities;      ///< Final selection probabilities
+    };
+
+    double getVisibleFlux(const std::vector<double>& power, const std::vector<double>& visibility)
+    {
+        double flux = 0.0;
+        for (size_t i = 0; i < power.size(); i++) flux += power[i] * visibility[i];
+        return flux;
+    }
+
+    std::vector<double> createPower(size_t numLights, std::mt19937& rng)
+    {
+        //Heavy tailed like the triangle flux of real scenes
+        std::uniform_real_distribution<double> u01(0.0, 1.0);
+        std::vector<double> power(numLights);
+        double sum = 0.0;
+        for (auto& p : power)
+        {
+            p = 1.0 / std::max(u01(rng), 0.05);
+            sum += p;
+        }
+        for (auto& p : power) p /= sum;
+        return power;
+    }
+
+    std::vector<SyntheticScene> createScenes(std::mt19937& rng)
+    {
+        std::vector<SyntheticScene> scenes;
+
+        SyntheticScene uniform;
+        uniform.name = "Uniform visibility";
+        uniform.power = createPower(64, rng);
+        uniform.visibility.assign(64, 0.3);
+        uniform.photonsPerFrame = 8192;
+        uniform.minGain = 0.95;
+        scenes.push_back(uniform);
+
+        SyntheticScene hidden;
+        hidden.name = "Hidden lights";
+        hidden.power = createPower(64, rng);
+        for (uint32_t i = 0; i < 64; i++) hidden.visibility.push_back(i % 4 == 0 ? 0.5 : 0.02);
+        hidden.photonsPerFrame = 8192;
+        hidden.minGain = 1.5;
+        scenes.push_back(hidden);
+
+        //Two photons per light and frame, the prior keeps the distribution stable
+        SyntheticScene sparse;
+        sparse.name = "Sparse lights";
+        sparse.power = createPower(4096, rng);
+        for (uint32_t i = 0; i < 4096; i++) sparse.visibility.push_back(i % 10 == 0 ? 0.8 : 0.01);
+        sparse.photonsPerFrame = 8192;
+        sparse.minGain = 1.5;
+        scenes.push_back(sparse);
+
+        SyntheticScene change;
+        change.name = "View change";
+        change.power = createPower(64, rng);
+        for (uint32_t i = 0; i < 64; i++)
+        {
+            change.visibility.push_back(i % 4 == 0 ? 0.5 : 0.02);
+            change.visibilityAfter.push_back(i % 4 == 2 ? 0.5 : 0.02);
+        }
+        change.photonsPerFrame = 8192;
+        change.minGain = 1.5;
+        scenes.push_back(change);
+
+        return scenes;
+    }
+
+    std::vector<LightAliasEntry> buildTable(const std::vector<double>& probabilities)
+    {
+        std::vector<int32_t> lightIndices(probabilities.size());
+        for (size_t i = 0; i < lightIndices.size(); i++) lightIndices[i] = static_cast<int32_t>(i + 1);
+        return LightAliasTable::build(probabilities, lightIndices);
+    }
+
+    /** Emits the photons of all frames through the alias table like the generate pass. With adapt the counters are read
+        back every kAdaptInterval frames, arrive kReadbackLatency frames later and the table is rebuilt from them.
+    */
+    SimulationResult simulate(const SyntheticScene& scene, bool adapt, const AdaptiveLightSampling::Options& options, uint32_t seed)
+    {
+        const size_t numLights = scene.power.size();
+        const uint32_t numPhotons = scene.photonsPerFrame;
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+        AdaptiveLightSampling adaptive;
+        adaptive.setOptions(options);
+        adaptive.reset(numLights);
+
+        SimulationResult result;
+        result.probabilities = scene.power;
+        auto table = buildTable(result.probabilities);
+
+        std::vector<uint32_t> counts(2 * numLights, 0);
+        std::deque<std::pair<uint32_t, std::vector<uint32_t>>> inFlight;   //Frame the readback is available, counts
+
+        const uint32_t evalStart = kFrames - kFrames / 4;
+        double sumError = 0.0, sumErrorSq = 0.0;
+        double evalSum = 0.0, evalSumSq = 0.0;
+        uint64_t evalEmitted = 0, evalVisible = 0;
+        for (uint32_t frame = 0; frame < kFrames; frame++)
+        {
+            const bool after = !scene.visibilityAfter.empty() && frame >= kFrames / 2;
+            const auto& visibility = after ? scene.visibilityAfter : scene.visibility;
+
+            double estimate = 0.0;
+            uint64_t visible = 0;
+            for (uint32_t j = 0; j < numPhotons; j++)
+            {
+                float invPdf = 0.f;
+                const uint32_t light = static_cast<uint32_t>(LightAliasTable::sample(table, j, numPhotons, u01(rng), invPdf) - 1);
+                counts[2 * light]++;
+                if (u01(rng) < visibility[light])
+                {
+                    counts[2 * light + 1]++;
+                    estimate += scene.power[light] * invPdf;
+                    visible++;
+                }
+            }
+            estimate /= numPhotons;
+
+            const double error = estimate - getVisibleFlux(scene.power, visibility);
+            sumError += error;
+            sumErrorSq += error * error;
+            if (frame >= evalStart)
+            {
+                evalSum += estimate;
+                evalSumSq += estimate * estimate;
+                evalEmitted += numPhotons;
+                evalVisible += visible;
+            }
+            result.mean += estimate;
+
+            if (!adapt) continue;
+
+            if ((frame + 1) % kAdaptInterval == 0)
+            {
+                inFlight.emplace_back(frame + kReadbackLatency, counts);
+                std::fill(counts.begin(), counts.end(), 0);
+            }
+            while (!inFlight.empty() && inFlight.front().first <= frame)
+            {
+                adaptive.addCounts(inFlight.front().second.data(), inFlight.front().second.size());
+                inFlight.pop_front();
+                result.probabilities = adaptive.getProbabilities(scene.power);
+                table = buildTable(result.probabilities);
+            }
+        }
+
+        const double frames = static_cast<double>(kFrames);
+        result.mean /= frames;
+        result.meanError = sumError / frames;
+        const double errorVariance = std::max(sumErrorSq / frames - result.meanError * result.meanError, 0.0);
+        result.stdError = std::sqrt(errorVariance / (frames - 1.0));
+
+        const double evalFrames = static_cast<double>(kFrames - evalStart);
+        const double evalMean = evalSum / evalFrames;
+        result.variance = std::max(evalSumSq / evalFrames - evalMean * evalMean, 0.0);
+        result.visibleFraction = static_cast<double>(evalVisible) / static_cast<double>(evalEmitted);
+        return result;
+    }
+}
+
+CPU_TEST(AdaptiveLightSampling_Emission)
+{
+    //Emits photons from synthetic scenes with known per light visibility, once with the base distribution and once adapted
+    //every few frames with a delayed readback. Both estimates of the visible flux have to be unbiased, the base share has
+    //to be kept and more of the emitted photons have to end up visible
+    const AdaptiveLightSampling::Options options;
+    std::mt19937 rng(1);
+    const auto scenes = createScenes(rng);
+    for (size_t s = 0; s < scenes.size(); s++)
+    {
+        const SyntheticScene& scene = scenes[s];
+        const uint32_t simSeed = 7919u + static_cast<uint32_t>(s);
+        const SimulationResult fixed = simulate(scene, false, options, simSeed);
+        const SimulationResult adaptive = simulate(scene, true, options, simSeed);
+
+        EXPECT_LT(std::abs(fixed.meanError / fixed.stdError), 4.0) << scene.name << ", fixed";
+        EXPECT_LT(std::abs(adaptive.meanError / adaptive.stdError), 4.0) << scene.name << ", adaptive";
+
+        double adaptiveSum = 0.0;
+        for (double p : adaptive.probabilities) adaptiveSum += p;
+        double minScale = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < scene.power.size(); i++)
+            minScale = std::min(minScale, adaptive.probabilities[i] / adaptiveSum / scene.power[i]);
+        EXPECT_GE(minScale, options.minShare * (1.0 - 1e-6)) << scene.name;
+
+        EXPECT_GE(adaptive.visibleFraction, scene.minGain * fixed.visibleFraction) << scene.name;
+        EXPECT_LE(adaptive.variance, kMaxVarianceRatio * fixed.variance) << scene.name;
+    }
+}
@@ -0,0 +1,341 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/CpuPhotonGather.h"
+#include "../../RenderPasses/PhotonMapperCommon/SimdUtils.h"
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+namespace
+{
+    const float kPi = 3.14159265358979323846f;
+
+    /** Photons on a jittered grid in the z = 0 plane with the spacing, all facing +z and arriving at the angle to the normal.
+    */
+    CpuPhotonGather::PhotonSet createPlaneField(float extent, float spacing, float angle, const float3& flux, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        const uint n = static_cast<uint>(extent / spacing);
+        CpuPhotonGather::PhotonSet photons;
+        photons.resize(size_t(n) * n);
+        size_t i = 0;
+        for (uint y = 0; y < n; y++)
+            for (uint x = 0; x < n; x++, i++)
+            {
+                photons.posX[i] = (float(x) + u(rng)) * spacing - 0.5f * extent;
+                photons.posY[i] = (float(y) + u(rng)) * spacing - 0.5f * extent;
+                photons.posZ[i] = 0.f;
+                photons.fluxR[i] = flux.x; photons.fluxG[i] = flux.y; photons.fluxB[i] = flux.z;
+                photons.dirX[i] = std::sin(angle); photons.dirY[i] = 0.f; photons.dirZ[i] = -std::cos(angle);
+                photons.faceNX[i] = 0.f; photons.faceNY[i] = 0.f; photons.faceNZ[i] = 1.f;
+            }
+        return photons;
+    }
+
+    /** Queries on the z = 0 plane facing +z, inside the square of the extent shrunk by the margin.
+    */
+    CpuPhotonGather::GBuffer createPlaneQueries(uint count, float extent, float margin, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> u(-0.5f * extent + margin, 0.5f * extent - margin);
+        CpuPhotonGather::GBuffer gBuffer;
+        gBuffer.width = count;
+        gBuffer.height = 1;
+        for (uint i = 0; i < count; i++)
+        {
+            gBuffer.posW.push_back(float3(u(rng), u(rng), 0.f));
+            gBuffer.normalW.push_back(float3(0.f, 0.f, 1.f));
+        }
+        gBuffer.throughput.assign(count, float3(1.f));
+        return gBuffer;
+    }
+}
+
+CPU_TEST(CpuPhotonGather_Traversal)
+{
+    //Random queries on random photons with both traversals. The sphere overlap traversal has to return the same radiance
+    //(bitwise) as the cube around the query while visiting fewer cells
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> u(0.f, 1.f);
+    const uint numPhotons = 1 << 16;
+    const uint numQueries = 1 << 12;
+    const float radius = 0.05f;
+
+    //Photons and queries in a box around the origin, so negative cells are covered. Half of the queries are on a grid
+    //plane, every query gets photons just inside its radius that face it, where a skipped cell would show up first
+    auto randomPosition = [&]() { return (float3(u(rng), u(rng), u(rng)) * 2.f - 1.f) * 0.25f; };
+    auto randomDir = [&]() { return glm::normalize(float3(u(rng), u(rng), u(rng)) - 0.5f + 1e-3f); };
+
+    CpuPhotonGather::GBuffer gBuffer;
+    gBuffer.width = numQueries;
+    gBuffer.height = 1;
+    gBuffer.throughput.assign(numQueries, float3(1.f));
+    std::vector<float3> positions, dirs;
+    for (uint i = 0; i < numQueries; i++)
+    {
+        float3 pos = randomPosition();
+        if (i & 1) pos.x = std::round(pos.x / radius) * radius;
+        gBuffer.posW.push_back(pos);
+        gBuffer.normalW.push_back(randomDir());
+        for (uint j = 0; j < 4; j++)
+        {
+            positions.push_back(pos + randomDir() * radius * 0.9999f);
+            dirs.push_back(-gBuffer.normalW.back());
+        }
+    }
+    while (positions.size() < numPhotons)
+    {
+        positions.push_back(randomPosition());
+        dirs.push_back(randomDir());
+    }
+
+    CpuPhotonGather::PhotonSet photons;
+    photons.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        const float3 dir = dirs[i];
+        photons.posX[i] = positions[i].x; photons.posY[i] = positions[i].y; photons.posZ[i] = positions[i].z;
+        photons.fluxR[i] = u(rng); photons.fluxG[i] = u(rng); photons.fluxB[i] = u(rng);
+        photons.dirX[i] = dir.x; photons.dirY[i] = dir.y; photons.dirZ[i] = dir.z;
+        photons.faceNX[i] = -dir.x; photons.faceNY[i] = -dir.y; photons.faceNZ[i] = -dir.z;
+    }
+
+    CpuPhotonGather gather;
+    gather.setPhotons(CpuPhotonGather::PhotonSet(), std::move(photons));
+    CpuPhotonGather::Options options;
+    options.globalRadius = radius;
+    options.collectCaustic = false;
+    options.usePhotonFaceNormal = false;
+    const float cellSizes[] = { 1.f, 2.f, 0.5f, 1.37f };
+    for (float cellSize : cellSizes)
+    {
+        for (bool useAVX2 : { false, true })
+        {
+            options.cellSize = cellSize;
+            options.useAVX2 = useAVX2;
+            options.traversal = GatherTraversal::Cube;
+            const CpuPhotonGather::Result cube = gather.gather(gBuffer, options);
+            options.traversal = GatherTraversal::SphereOverlap;
+            const CpuPhotonGather::Result overlap = gather.gather(gBuffer, options);
+
+            const char* path = useAVX2 && PhotonMapperSimd::hasAVX2() ? "AVX2" : "Scalar";
+            uint mismatches = 0;
+            for (uint i = 0; i < numQueries; i++)
+                if (std::memcmp(&cube.radiance[i], &overlap.radiance[i], sizeof(float3)) != 0) mismatches++;
+            EXPECT_EQ(mismatches, 0u) << path << ", cell size " << cellSize;
+            EXPECT_LE(overlap.cellsVisited, cube.cellsVisited) << path << ", cell size " << cellSize;
+        }
+    }
+}
+
+CPU_TEST(CpuPhotonGather_AVX2MatchesScalar)
+{
+    //The AVX2 kernel takes 8 photons at a time and hands the rest of a cell to the scalar loop. Cell sizes from far below
+    //to above the radius give cells of 1 to a few hundred photons, so both the vector and the tail path are covered.
+    //The sums only differ by the order of the additions and the fused multiply-adds
+    if (!PhotonMapperSimd::hasAVX2()) return;
+
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> u(0.f, 1.f);
+    const float radius = 0.05f;
+    CpuPhotonGather::PhotonSet photons;
+    photons.resize(1 << 16);
+    for (size_t i = 0; i < photons.size(); i++)
+    {
+        const float3 dir = glm::normalize(float3(u(rng), u(rng), u(rng)) - 0.5f + 1e-3f);
+        photons.posX[i] = u(rng) * 0.5f; photons.posY[i] = u(rng) * 0.5f; photons.posZ[i] = u(rng) * 0.5f;
+        photons.fluxR[i] = u(rng); photons.fluxG[i] = u(rng); photons.fluxB[i] = u(rng);
+        photons.dirX[i] = dir.x; photons.dirY[i] = dir.y; photons.dirZ[i] = dir.z;
+        photons.faceNX[i] = -dir.x; photons.faceNY[i] = -dir.y; photons.faceNZ[i] = -dir.z;
+    }
+
+    CpuPhotonGather::GBuffer gBuffer;
+    gBuffer.width = 1 << 12;
+    gBuffer.height = 1;
+    for (uint i = 0; i < gBuffer.width; i++)
+    {
+        gBuffer.posW.push_back(float3(u(rng), u(rng), u(rng)) * 0.5f);
+        gBuffer.normalW.push_back(glm::normalize(float3(u(rng), u(rng), u(rng)) - 0.5f + 1e-3f));
+    }
+    gBuffer.throughput.assign(gBuffer.width, float3(1.f));
+
+    CpuPhotonGather gather;
+    gather.setPhotons(CpuPhotonGather::PhotonSet(), std::move(photons));
+    CpuPhotonGather::Options options;
+    options.globalRadius = radius;
+    options.collectCaustic = false;
+    for (float cellSize : { 0.25f, 1.f, 2.f })
+    {
+        for (bool faceTest : { false, true })
+        {
+            options.cellSize = cellSize;
+            options.usePhotonFaceNormal = faceTest;
+            options.useAVX2 = false;
+            const CpuPhotonGather::Result scalar = gather.gather(gBuffer, options);
+            options.useAVX2 = true;
+            const CpuPhotonGather::Result avx2 = gather.gather(gBuffer, options);
+
+            EXPECT_EQ(avx2.photonsTested, scalar.photonsTested) << "cell size " << cellSize;
+            uint mismatches = 0;
+            float maxValue = 0.f;
+            for (uint i = 0; i < gBuffer.width; i++)
+            {
+                const float3 a = avx2.radiance[i], b = scalar.radiance[i];
+                maxValue = std::max(maxValue, std::max(b.x, std::max(b.y, b.z)));
+                for (uint c = 0; c < 3; c++)
+                    if (std::abs(a[c] - b[c]) > 1e-5f * std::max(1.f, std::abs(b[c]))) mismatches++;
+            }
+            EXPECT_EQ(mismatches, 0u) << "cell size " << cellSize << ", face test " << faceTest;
+            EXPECT_GT(maxValue, 0.f) << "cell size " << cellSize << ", face test " << faceTest;
+        }
+    }
+}
+
+CPU_TEST(CpuPhotonGather_UniformField)
+{
+    //Photons of flux phi with density rho per area arriving at angle a on a Lambert surface of albedo A give the radiance
+    //A / pi * rho * phi * cos(a). The 1 / (pi r^2) normalization turns the photons in the disk into the density, so the
+    //estimate has to match for every radius and traversal
+    std::mt19937 rng(3);
+    const float extent = 1.f;
+    const float spacing = 1.f / 1024.f;
+    const float angle = 0.6f;
+    const float3 flux = float3(1.f, 2.f, 3.f) * 1e-6f;
+    const float3 albedo = float3(0.5f, 0.25f, 1.f);
+    const float3 expected = albedo / kPi * flux * std::cos(angle) / (spacing * spacing);
+
+    CpuPhotonGather gather;
+    gather.setPhotons(CpuPhotonGather::PhotonSet(), createPlaneField(extent, spacing, angle, flux, rng));
+    CpuPhotonGather::GBuffer gBuffer = createPlaneQueries(256, extent, 0.1f, rng);
+    gBuffer.diffuseAlbedo.assign(gBuffer.width, albedo);
+
+    CpuPhotonGather::Options options;
+    options.collectCaustic = false;
+    for (float radius : { 0.01f, 0.02f, 0.05f })
+    {
+        for (GatherTraversal traversal : { GatherTraversal::Cube, GatherTraversal::SphereOverlap })
+        {
+            options.globalRadius = radius;
+            options.traversal = traversal;
+            const CpuPhotonGather::Result result = gather.gather(gBuffer, options);
+
+            //About 330 to 8200 photons per disk, the jitter and the disk border keep single pixels within a few percent
+            float3 mean = float3(0.f);
+            float maxError = 0.f;
+            for (const float3& r : result.radiance)
+            {
+                mean += r / float(gBuffer.width);
+                maxError = std::max(maxError, std::abs(r.x / expected.x - 1.f));
+            }
+            for (uint c = 0; c < 3; c++)
+                EXPECT_NEAR(mean[c] / expected[c], 1.f, 0.01f) << "radius " << radius << ", channel " << c;
+            EXPECT_LT(maxError, 0.1f) << "radius " << radius;
+        }
+    }
+}
+
+CPU_TEST(CpuPhotonGather_MaxPhotonsPerCell)
+{
+    //With a capacity per cell only the first photons of a cell are tested and the cell sum is scaled by all photons over
+    //the collected ones, like a full bucket of the GPU hash
+    const float radius = 0.05f;
+    const uint numPhotons = 100;
+    const float3 flux = float3(0.25f, 0.5f, 1.f);
+    CpuPhotonGather::PhotonSet photons;
+    photons.resize(numPhotons);
+    for (uint i = 0; i < numPhotons; i++)
+    {
+        //All photons in one cell close to the query, straight down on the surface
+        photons.posX[i] = 0.025f + 1e-4f * float(i % 10); photons.posY[i] = 0.025f + 1e-4f * float(i / 10); photons.posZ[i] = 0.f;
+        photons.fluxR[i] = flux.x; photons.fluxG[i] = flux.y; photons.fluxB[i] = flux.z;
+        photons.dirX[i] = 0.f; photons.dirY[i] = 0.f; photons.dirZ[i] = -1.f;
+        photons.faceNX[i] = 0.f; photons.faceNY[i] = 0.f; photons.faceNZ[i] = 1.f;
+    }
+
+    CpuPhotonGather gather;
+    gather.setPhotons(CpuPhotonGather::PhotonSet(), std::move(photons));
+    CpuPhotonGather::GBuffer gBuffer;
+    gBuffer.width = 1;
+    gBuffer.height = 1;
+    gBuffer.posW.push_back(float3(0.025f, 0.025f, 0.f));
+    gBuffer.normalW.push_back(float3(0.f, 0.f, 1.f));
+    gBuffer.throughput.push_back(float3(1.f));
+
+    CpuPhotonGather::Options options;
+    options.globalRadius = radius;
+    options.collectCaustic = false;
+    const float3 expected = flux * float(numPhotons) / (kPi * radius * radius) / kPi;
+    for (bool useAVX2 : { false, true })
+    {
+        //Unlimited, capacities below, at and above the count. Capacities that are not a multiple of 8 run the scalar tail
+        for (uint maxPhotons : { 0u, 1u, 12u, 16u, 99u, 100u, 1000u })
+        {
+            options.useAVX2 = useAVX2;
+            options.maxPhotonsPerCell = maxPhotons;
+            const CpuPhotonGather::Result result = gather.gather(gBuffer, options);
+            const uint collected = maxPhotons == 0 ? numPhotons : std::min(maxPhotons, numPhotons);
+            EXPECT_EQ(result.photonsTested, uint64_t(collected)) << "max photons " << maxPhotons;
+            for (uint c = 0; c < 3; c++)
+                EXPECT_NEAR(result.radiance[0][c], expected[c], 1e-5f * expected[c]) << "max photons " << maxPhotons << ", channel " << c;
+        }
+    }
+
+    //On a uniform field the capped estimate keeps the expected value of the full one
+    std::mt19937 rng(4);
+    const float spacing = 1.f / 512.f;
+    CpuPhotonGather::PhotonSet field = createPlaneField(1.f, spacing, 0.f, flux, rng);
+    std::vector<uint> order(field.size());
+    for (uint i = 0; i < order.size(); i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    CpuPhotonGather::PhotonSet shuffled;
+    shuffled.resize(field.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        shuffled.posX[i] = field.posX[order[i]]; shuffled.posY[i] = field.posY[order[i]]; shuffled.posZ[i] = field.posZ[order[i]];
+        shuffled.fluxR[i] = field.fluxR[order[i]]; shuffled.fluxG[i] = field.fluxG[order[i]]; shuffled.fluxB[i] = field.fluxB[order[i]];
+        shuffled.dirX[i] = field.dirX[order[i]]; shuffled.dirY[i] = field.dirY[order[i]]; shuffled.dirZ[i] = field.dirZ[order[i]];
+        shuffled.faceNX[i] = field.faceNX[order[i]]; shuffled.faceNY[i] = field.faceNY[order[i]]; shuffled.faceNZ[i] = field.faceNZ[order[i]];
+    }
+    gather.setPhotons(CpuPhotonGather::PhotonSet(), std::move(shuffled));
+    gBuffer = createPlaneQueries(1024, 1.f, 0.1f, rng);
+    options.useAVX2 = true;
+    options.maxPhotonsPerCell = 0;
+    const CpuPhotonGather::Result full = gather.gather(gBuffer, options);
+    //About 650 photons per cell of the radius
+    options.maxPhotonsPerCell = 64;
+    const CpuPhotonGather::Result capped = gather.gather(gBuffer, options);
+    double fullSum = 0.0, cappedSum = 0.0;
+    for (uint i = 0; i < gBuffer.width; i++)
+    {
+        fullSum += full.radiance[i].x;
+        cappedSum += capped.radiance[i].x;
+    }
+    EXPECT_LT(capped.photonsTested, full.photonsTested / 4);
+    EXPECT_NEAR(cappedSum / fullSum, 1.0, 0.02);
+}
@@ -0,0 +1,234 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/CpuPhotonTracer.h"
+#include "../../RenderPasses/PhotonMapperCommon/LightAliasTable.h"
+#include <cstring>
+#include <memory>
+#include <set>
+
+namespace
+{
+    /** Closed unit box with a point light in the middle. Material 0 is diffuse, material 1 a mirror.
+        \param[in] mirrorFloor Makes the floor a mirror, so the box gets caustic photons.
+    */
+    CpuPhotonTracer::SceneData createBox(bool mirrorFloor)
+    {
+        CpuPhotonTracer::SceneData scene;
+        CpuPhotonTracer::Material diffuse;
+        diffuse.diffuse = float3(0.7f);
+        CpuPhotonTracer::Material mirror;
+        mirror.diffuse = float3(0.f);
+        mirror.specular = float3(0.9f);
+        mirror.roughness = 0.f;
+        scene.materials = { diffuse, mirror };
+
+        const float3 c[8] = { float3(0, 0, 0), float3(1, 0, 0), float3(0, 1, 0), float3(1, 1, 0), float3(0, 0, 1), float3(1, 0, 1), float3(0, 1, 1), float3(1, 1, 1) };
+        //Quads of the six faces, the floor (y = 0) first
+        const int quads[6][4] = { { 0, 1, 5, 4 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 5, 7, 6 }, { 0, 2, 6, 4 }, { 1, 3, 7, 5 } };
+        for (int f = 0; f < 6; f++)
+        {
+            const int* q = quads[f];
+            for (int i : { q[0], q[1], q[2], q[0], q[2], q[3] }) scene.positions.push_back(c[i]);
+            const uint material = f == 0 && mirrorFloor ? 1 : 0;
+            scene.materialIDs.push_back(material);
+            scene.materialIDs.push_back(material);
+        }
+        return scene;
+    }
+
+    CpuPhotonTracer::LightSampleTable createLightTable(uint width, uint height)
+    {
+        CpuPhotonTracer::LightSampleTable table;
+        table.width = width;
+        table.height = height;
+        table.aliasTable = LightAliasTable::build({ 1.0 }, { -1 });    //Analytic light 0
+        return table;
+    }
+
+    std::unique_ptr<CpuPhotonTracer> createTracer(bool mirrorFloor, uint threadCount)
+    {
+        auto pTracer = std::make_unique<CpuPhotonTracer>(createBox(mirrorFloor), threadCount);
+        CpuPhotonTracer::AnalyticLight light;
+        light.posW = float3(0.5f, 0.6f, 0.5f);
+        pTracer->setLights({ light }, {});
+        return pTracer;
+    }
+
+    std::vector<float3> getPositions(const CpuPhotonTracer::PhotonArrays& arrays)
+    {
+        std::vector<float3> positions;
+        for (uint i = 0; i < arrays.count; i++)
+        {
+            const float4& p = arrays.position[arrays.getOffset(i)];
+            positions.push_back(float3(p.x, p.y, p.z));
+        }
+        return positions;
+    }
+}
+
+CPU_TEST(CpuPhotonTracer_BucketInsert)
+{
+    //Few buckets for the cells of the box walls, so the insert runs out of probes and buckets overflow
+    CpuPhotonTracer::Options options;
+    options.globalHashScaleFactor = 20.f;
+    options.causticHashScaleFactor = 20.f;
+    options.causticMaxSize = 1 << 20;
+    options.globalMaxSize = 1 << 20;
+    options.buckets.bucketBits = 10;
+    options.buckets.photonsPerBucket = 4;
+    options.buckets.quadraticProbeIterations = 4;
+    const auto lightTable = createLightTable(128, 128);
+
+    //Without buckets every photon is stored in insert order
+    auto pTracer = createTracer(false, 4);
+    options.cellRangeGrid = true;
+    const auto all = pTracer->trace(lightTable, options);
+    EXPECT_EQ(all.caustic.count, 0u);
+    EXPECT_GT(all.global.count, 10000u);
+    EXPECT(all.globalBuckets.size.empty());
+
+    options.cellRangeGrid = false;
+    const auto result = pTracer->trace(lightTable, options);
+
+    //The generate counters have to match the simulated insert of the same photons
+    const auto expected = HashTableStats::simulate(getPositions(all.global), options.globalHashScaleFactor, options.buckets, 0);
+    const auto report = HashTableStats::createReport("CPU", result.hashStats, options.buckets);
+    EXPECT_EQ(report.inserts, uint64_t(all.global.count));
+    EXPECT_EQ(report.inserts, expected.inserts);
+    EXPECT_EQ(report.probeFailures, expected.probeFailures);
+    EXPECT_EQ(report.overflows, expected.overflows);
+    EXPECT_EQ(report.globalLoadFactor, expected.globalLoadFactor);
+    EXPECT_EQ(report.avgInsertProbe, expected.avgInsertProbe);
+    EXPECT_GT(report.probeFailures, 0u);
+    EXPECT_GT(report.overflows, 0u);
+    EXPECT_LT(result.global.count, all.global.count);
+
+    //Every stored slot points to a distinct photon of the cell of its bucket
+    const uint perBucket = options.buckets.photonsPerBucket;
+    std::set<uint> referenced;
+    uint storedSlots = 0, wrongCells = 0;
+    for (size_t b = 0; b < result.globalBuckets.size.size(); b++)
+    {
+        const uint slots = std::min(result.globalBuckets.size[b], perBucket);
+        for (uint s = 0; s < slots; s++)
+        {
+            const uint photonIndex = result.globalBuckets.photonIdx[b * perBucket + s];
+            storedSlots++;
+            referenced.insert(photonIndex);
+            if (photonIndex >= result.global.count)
+            {
+                wrongCells++;
+                continue;
+            }
+            const float4& p = result.global.position[result.global.getOffset(photonIndex)];
+            const int3 cell = int3(glm::floor(float3(p.x, p.y, p.z) * options.globalHashScaleFactor));
+            if (hashCellKey(cell) != result.globalBuckets.cell[b]) wrongCells++;
+        }
+    }
+    EXPECT_EQ(wrongCells, 0u);
+    EXPECT_EQ(referenced.size(), size_t(storedSlots));
+    //Every insert that neither failed nor overflowed takes a new slot. Photons that replaced another one are stored too,
+    //the replaced photons stay in the arrays
+    EXPECT_EQ(uint64_t(storedSlots), report.inserts - report.probeFailures - report.overflows);
+    EXPECT_GT(result.global.count, storedSlots);
+    EXPECT_LE(uint64_t(result.global.count - storedSlots), report.overflows);
+}
+
+CPU_TEST(CpuPhotonTracer_Deterministic)
+{
+    //The photons reach the buckets in launch order, independent of the thread count
+    CpuPhotonTracer::Options options;
+    options.globalHashScaleFactor = 20.f;
+    options.causticHashScaleFactor = 20.f;
+    options.causticMaxSize = 1 << 16;
+    options.globalMaxSize = 1 << 16;
+    options.buckets.bucketBits = 10;
+    options.buckets.photonsPerBucket = 4;
+    const auto lightTable = createLightTable(64, 64);
+
+    const auto a = createTracer(true, 1)->trace(lightTable, options);
+    const auto b = createTracer(true, 8)->trace(lightTable, options);
+    EXPECT_GT(a.caustic.count, 0u);
+    EXPECT_EQ(a.caustic.count, b.caustic.count);
+    EXPECT_EQ(a.global.count, b.global.count);
+    EXPECT(a.hashStats == b.hashStats);
+    EXPECT(a.globalBuckets.photonIdx == b.globalBuckets.photonIdx);
+    EXPECT(a.causticBuckets.photonIdx == b.causticBuckets.photonIdx);
+    EXPECT(std::memcmp(a.global.position.data(), b.global.position.data(), a.global.position.size() * sizeof(float4)) == 0);
+    EXPECT(std::memcmp(a.caustic.flux.data(), b.caustic.flux.data(), a.caustic.flux.size() * sizeof(float4)) == 0);
+}
+
+CPU_TEST(CpuPhotonTracer_Compare)
+{
+    //A trace with another seed stands in for the GPU readback: counts, flux and the distribution over coarse cells agree
+    CpuPhotonTracer::Options options;
+    options.globalHashScaleFactor = 4.f;
+    options.causticHashScaleFactor = 4.f;
+    options.causticMaxSize = 1 << 20;
+    options.globalMaxSize = 1 << 20;
+    const auto lightTable = createLightTable(256, 256);
+
+    auto pTracer = createTracer(true, 0);
+    const auto reference = pTracer->trace(lightTable, options);
+    options.seed = 1;
+    const auto other = pTracer->trace(lightTable, options);
+
+    CpuPhotonTracer::GpuReadback gpu;
+    gpu.causticCount = other.caustic.count;
+    gpu.globalCount = other.global.count;
+    gpu.hasHashStats = true;
+    gpu.hashStats = other.hashStats;
+    gpu.caustic = other.caustic;
+    gpu.global = other.global;
+
+    auto comparison = CpuPhotonTracer::compare(reference, gpu, options);
+    for (const auto* map : { &comparison.caustic, &comparison.global })
+    {
+        EXPECT_NEAR(map->countRatio, 1.0, 0.05);
+        EXPECT_NEAR(map->fluxRatio, 1.0, 0.05);
+        EXPECT_LT(map->cellDistance, 0.1);
+    }
+    EXPECT_EQ(comparison.gpuReport.source, std::string("GPU"));
+    EXPECT_NEAR(comparison.gpuReport.globalLoadFactor, comparison.cpuReport.globalLoadFactor, 0.05 * comparison.cpuReport.globalLoadFactor);
+
+    //Wrong flux and photons in the wrong cells have to show up
+    for (auto& f : gpu.global.flux) f *= 2.f;
+    for (auto& p : gpu.caustic.position) p.w = 0.f;  //Key of no cell
+    comparison = CpuPhotonTracer::compare(reference, gpu, options);
+    EXPECT_NEAR(comparison.global.fluxRatio, 2.0, 0.1);
+    EXPECT_LT(comparison.global.cellDistance, 0.1);
+    EXPECT_NEAR(comparison.caustic.cellDistance, 1.0, 1e-6);
+
+    //Only the counters read back
+    gpu.caustic = {};
+    gpu.global = {};
+    comparison = CpuPhotonTracer::compare(reference, gpu, options);
+    EXPECT_NEAR(comparison.global.countRatio, 1.0, 0.05);
+    EXPECT_EQ(comparison.global.fluxRatio, 0.0);
+}
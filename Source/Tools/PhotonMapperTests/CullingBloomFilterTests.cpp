@@ -0,0 +1,149 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/CullingBloomFilter.h"
+#include <cmath>
+#include <random>
+#include <unordered_set>
+
+namespace
+{
+    const uint kValidationBits = 20;                ///< 128 KB
+    const uint kBytePerSlotBits = 17;               ///< One byte per slot in the same 128 KB
+    const uint kValidationQueries = 1 << 18;
+    const int kValidationExtent = 128;              ///< Cells are in [-extent, extent)^3
+    const uint kValidationPlanes = 16;
+    const double kMaxRateFactor = 1.1;              ///< Allowed measured rate relative to the expected rate, on top of 4 sigma
+    const SpatialHashFunction kHashFunctions[] = { SpatialHashFunction::Wang, SpatialHashFunction::Morton, SpatialHashFunction::Pcg };
+
+    uint64_t packCell(int3 cell)
+    {
+        return (uint64_t(uint(cell.x) & 0x1FFFFF) << 42) | (uint64_t(uint(cell.y) & 0x1FFFFF) << 21) | uint64_t(uint(cell.z) & 0x1FFFFF);
+    }
+
+    bool isInside(int3 cell)
+    {
+        for (int i = 0; i < 3; i++)
+            if (cell[i] < -kValidationExtent || cell[i] >= kValidationExtent)
+                return false;
+        return true;
+    }
+
+    /** Distinct cells on random planes through the volume, like the cells the camera hits mark.
+    */
+    std::vector<int3> createSurfaceCells(std::mt19937& rng, uint numCells)
+    {
+        std::uniform_real_distribution<float> u(-1.f, 1.f);
+        struct Plane { float3 center, t1, t2; };
+        std::vector<Plane> planes(kValidationPlanes);
+        for (auto& plane : planes)
+        {
+            plane.center = float3(u(rng), u(rng), u(rng)) * (0.5f * kValidationExtent);
+            float3 n = glm::normalize(float3(u(rng), u(rng), u(rng)) + float3(1e-3f));
+            plane.t1 = glm::normalize(glm::cross(n, std::abs(n.x) < 0.9f ? float3(1, 0, 0) : float3(0, 1, 0)));
+            plane.t2 = glm::cross(n, plane.t1);
+        }
+
+        std::unordered_set<uint64_t> seen;
+        std::vector<int3> cells;
+        cells.reserve(numCells);
+        std::uniform_int_distribution<uint> planeDist(0, kValidationPlanes - 1);
+        const float span = 1.25f * kValidationExtent;
+        while (cells.size() < numCells)
+        {
+            const Plane& plane = planes[planeDist(rng)];
+            const int3 cell = int3(glm::floor(plane.center + u(rng) * span * plane.t1 + u(rng) * span * plane.t2));
+            if (isInside(cell) && seen.insert(packCell(cell)).second)
+                cells.push_back(cell);
+        }
+        return cells;
+    }
+}
+
+CPU_TEST(CullingBloomFilter_Layout)
+{
+    EXPECT_EQ(CullingBloomFilter::getBitMask(20), (1u << 20) - 1);
+    EXPECT_EQ(CullingBloomFilter::getBitMask(32), 0xFFFFFFFFu);
+    EXPECT_EQ(CullingBloomFilter::getWordCount(5), 1u);
+    EXPECT_EQ(CullingBloomFilter::getWordCount(20), uint64_t(1) << 15);
+    EXPECT_EQ(CullingBloomFilter::getOptimalNumHashes(uint64_t(1) << 20, 0), 1u);
+    EXPECT_EQ(CullingBloomFilter::getOptimalNumHashes(uint64_t(1) << 20, 1 << 16), std::min(11u, kCullingMaxHashes));
+
+    CullingBloomFilter filter(10, 1, SpatialHashFunction::Wang);
+    EXPECT_EQ(filter.getSizeBytes(), 128u);
+    filter.insert(int3(1, 2, 3));
+    EXPECT(filter.contains(int3(1, 2, 3)));
+    EXPECT_NEAR(filter.getFillRate(), 1.0 / 1024.0, 1e-12);
+    filter.clear();
+    EXPECT(!filter.contains(int3(1, 2, 3)));
+    EXPECT_EQ(filter.getFillRate(), 0.0);
+}
+
+CPU_TEST(CullingBloomFilter_FalsePositiveRate)
+{
+    //Fills filters of 2^20 bits with cells on random planes and queries cells of the same volume that were not inserted.
+    //No inserted cell may be missed and the false positive rate has to stay near the rate of an ideal filter, also for
+    //the one byte per slot buffer of the same memory (2^17 slots)
+    for (SpatialHashFunction function : kHashFunctions)
+    {
+        std::mt19937 rng(1);
+        //Load n / m of 1/64, 1/32 and 1/16 bits per cell. The byte per slot buffer has 8x the load
+        for (uint cellBits : { 14u, 15u, 16u })
+        {
+            const std::vector<int3> cells = createSurfaceCells(rng, 1u << cellBits);
+            std::unordered_set<uint64_t> inserted;
+            for (const int3& cell : cells) inserted.insert(packCell(cell));
+
+            std::vector<int3> queries;
+            queries.reserve(kValidationQueries);
+            std::uniform_int_distribution<int> coord(-kValidationExtent, kValidationExtent - 1);
+            while (queries.size() < kValidationQueries)
+            {
+                const int3 cell = int3(coord(rng), coord(rng), coord(rng));
+                if (inserted.count(packCell(cell)) == 0) queries.push_back(cell);
+            }
+
+            auto check = [&](uint bits, uint numHashes) {
+                CullingBloomFilter filter(bits, numHashes, function);
+                for (const int3& cell : cells) filter.insert(cell);
+                uint falseNegatives = 0, positives = 0;
+                for (const int3& cell : cells) falseNegatives += filter.contains(cell) ? 0 : 1;
+                for (const int3& cell : queries) positives += filter.contains(cell) ? 1 : 0;
+                const double rate = double(positives) / queries.size();
+                const double expected = CullingBloomFilter::getExpectedFalsePositiveRate(filter.getBitCount(), filter.getNumHashes(), cells.size());
+                const double sigma = std::sqrt(expected * (1.0 - expected) / queries.size());
+                EXPECT_EQ(falseNegatives, 0u) << "function " << uint(function) << ", bits " << bits << ", hashes " << numHashes;
+                EXPECT_LE(rate, kMaxRateFactor * expected + 4.0 * sigma + 1e-5) << "function " << uint(function) << ", bits " << bits << ", hashes " << numHashes;
+            };
+            check(kBytePerSlotBits, 1);
+            check(kValidationBits, 1);
+            for (uint numHashes : { 2u, 4u, CullingBloomFilter::getOptimalNumHashes(uint64_t(1) << kValidationBits, cells.size()) })
+                check(kValidationBits, numHashes);
+        }
+    }
+}
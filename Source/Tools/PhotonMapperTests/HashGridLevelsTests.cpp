@@ -0,0 +1,183 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/HashGridLevels.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace
+{
+    //Photons on the walls of a box around the origin, a tenth of them in a small caustic spot on the floor
+    std::vector<float3> createInteriorPhotons(uint numPhotons, float extent, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        std::vector<float3> positions(numPhotons);
+        for (uint i = 0; i < numPhotons; i++)
+        {
+            float3 p = (float3(u(rng), u(rng), u(rng)) - 0.5f) * extent;
+            if (i % 10 == 0) {
+                p = float3(0.05f * extent * u(rng), -0.5f * extent, 0.05f * extent * u(rng));
+            }
+            else {
+                const uint wall = rng() % 6;
+                p[wall % 3] = (wall < 3 ? -0.5f : 0.5f) * extent;
+            }
+            positions[i] = p;
+        }
+        return positions;
+    }
+
+    //Query points next to random photons
+    std::vector<float3> createQueries(const std::vector<float3>& photons, uint numQueries, float jitter, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> u(-1.f, 1.f);
+        std::vector<float3> queries(numQueries);
+        for (uint i = 0; i < numQueries; i++)
+            queries[i] = photons[rng() % photons.size()] + float3(u(rng), u(rng), u(rng)) * jitter;
+        return queries;
+    }
+
+    std::vector<uint> bruteForce(const std::vector<float3>& positions, const float3& pos, float radius)
+    {
+        std::vector<uint> result;
+        for (uint i = 0; i < positions.size(); i++)
+        {
+            const float3 d = positions[i] - pos;
+            if (glm::dot(d, d) < radius * radius) result.push_back(i);
+        }
+        return result;
+    }
+}
+
+CPU_TEST(HashGridLevels_GetLevel)
+{
+    const HashGridLevels::Levels levels = HashGridLevels::create(0.1f, 6);
+    EXPECT_EQ(levels.baseCellSize, 0.125f);
+    EXPECT_EQ(HashGridLevels::getLevel(levels, 1.f), 0u);
+    EXPECT_EQ(HashGridLevels::getLevel(levels, 0.125f), 0u);
+    EXPECT_EQ(HashGridLevels::getLevel(levels, 0.0625f), 1u);
+    EXPECT_EQ(HashGridLevels::getLevel(levels, 0.06f), 1u);
+    EXPECT_EQ(HashGridLevels::getLevel(levels, 1e-6f), 5u);
+    for (float radius = 1e-4f; radius < 0.2f; radius *= 1.01f)
+    {
+        const uint level = HashGridLevels::getLevel(levels, radius);
+        if (level > 0 && level < levels.numLevels - 1) {
+            EXPECT_GE(HashGridLevels::getCellSize(levels, level), radius) << "radius " << radius;
+            EXPECT_LT(HashGridLevels::getCellSize(levels, level + 1), radius) << "radius " << radius;
+        }
+    }
+}
+
+CPU_TEST(HashGridLevels_Query)
+{
+    //Queries with random radii against a brute force search, with all photons at one level and spread over the levels
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> u(0.f, 1.f);
+    const uint numPhotons = 1 << 15;
+    const uint numQueries = 1 << 10;
+    const std::vector<float3> positions = createInteriorPhotons(numPhotons, 2.f, rng);
+    const std::vector<float3> queries = createQueries(positions, numQueries, 0.02f, rng);
+    //Few levels, a query visits the cells of every used level and the finest cells make large radii expensive
+    const HashGridLevels::Levels levels = HashGridLevels::create(0.1f, 4);
+
+    for (bool mixedLevels : { false, true })
+    {
+        std::vector<uint> photonLevels;
+        if (mixedLevels) {
+            for (uint i = 0; i < numPhotons; i++) photonLevels.push_back(rng() % levels.numLevels);
+        }
+        HashGridLevels::Grid grid;
+        grid.build(levels, positions, photonLevels);
+
+        uint mismatches = 0;
+        std::vector<uint> found;
+        for (const float3& query : queries)
+        {
+            //Radii from far above level 0 down to below the finest level
+            const float radius = 0.4f * std::exp2(-8.f * u(rng));
+            found.clear();
+            grid.query(query, radius, found);
+            std::sort(found.begin(), found.end());
+            if (found != bruteForce(positions, query, radius)) mismatches++;
+        }
+        EXPECT_EQ(mismatches, 0u) << (mixedLevels ? "mixed levels" : "one level");
+    }
+}
+
+BENCHMARK(HashGridLevels_ScheduleBenchmark)
+{
+    //Shrinks the radius like SPPM and measures the gather cost at every power of two iteration, with a cell size that
+    //follows the radius and with the levels. Both find the same photons.
+    const uint numPhotons = 1 << 20;
+    const float startRadius = 0.05f;
+    const float alpha = 0.7f;
+    const uint iterations = 1 << 16;
+    const float cellSizeInRadii = 1.f;
+    std::mt19937 rng(1234);
+    const std::vector<float3> positions = createInteriorPhotons(numPhotons, 4.f, rng);
+    const std::vector<float3> queries = createQueries(positions, 4096, 0.01f, rng);
+    const HashGridLevels::Levels levels = HashGridLevels::create(startRadius, 8, cellSizeInRadii);
+
+    auto measure = [&](const HashGridLevels::Grid& grid, float radius, double& cells, double& tested) {
+        uint64_t visited = 0, testedSum = 0;
+        std::vector<uint> found;
+        for (const float3& query : queries)
+        {
+            found.clear();
+            visited += grid.query(query, radius, found, &testedSum);
+        }
+        cells = double(visited) / queries.size();
+        tested = double(testedSum) / queries.size();
+    };
+
+    ctx.log() << "iteration,radius,cellSize,cells,tested,occupiedCells,level,levelCellSize,levelCells,levelTested,levelOccupiedCells\n";
+    float radius = startRadius;
+    for (uint i = 0; i < iterations; i++)
+    {
+        if (i == 0 || (i & (i - 1)) == 0 || i == iterations - 1)
+        {
+            HashGridLevels::Levels follow;
+            follow.baseCellSize = cellSizeInRadii * radius;
+            follow.cellSizeInRadii = cellSizeInRadii;
+            HashGridLevels::Grid grid;
+            grid.build(follow, positions);
+            double cells, tested;
+            measure(grid, radius, cells, tested);
+            const size_t occupied = grid.getCellCount();
+
+            const uint level = HashGridLevels::getLevel(levels, radius);
+            grid.build(levels, positions, std::vector<uint>(positions.size(), level));
+            double levelCells, levelTested;
+            measure(grid, radius, levelCells, levelTested);
+            ctx.log() << i << "," << radius << "," << follow.baseCellSize << "," << cells << "," << tested << "," << occupied << ","
+                      << level << "," << HashGridLevels::getCellSize(levels, level) << "," << levelCells << "," << levelTested << "," << grid.getCellCount() << "\n";
+        }
+        radius *= std::sqrt((float(i) + alpha) / (float(i) + 1.f));
+    }
+}
@@ -0,0 +1,120 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/HashTableStats.h"
+
+CPU_TEST(HashTableStats_SimulateSparse)
+{
+    //One photon per cell in a table with far more buckets than cells: every insert claims its home bucket or a near one
+    std::vector<float3> positions;
+    for (int i = 0; i < 1000; i++)
+        positions.push_back(float3(float(i % 10), float(i / 10 % 10), float(i / 100)) + 0.5f);
+
+    HashTableStats::Settings settings;
+    settings.bucketBits = 16;
+    const auto report = HashTableStats::simulate(positions, 1.f, settings);
+    EXPECT_EQ(report.inserts, uint64_t(1000));
+    EXPECT_EQ(report.probeFailures, uint64_t(0));
+    EXPECT_EQ(report.overflows, uint64_t(0));
+    EXPECT_EQ(report.distinctCells, uint64_t(1000));
+    EXPECT_EQ(report.aliasedCells, uint64_t(0));
+    EXPECT_NEAR(report.globalLoadFactor, 1000.0 / 65536.0, 1e-12);
+    EXPECT_EQ(report.dropRate, 0.0);
+    EXPECT_LT(report.avgInsertProbe, 0.1);
+    //27 cells around every photon, all occupied cells are found
+    EXPECT_EQ(report.lookups, uint64_t(27000));
+    EXPECT_EQ(report.probeLimitRate, 0.0);
+    EXPECT_GT(report.hitRate, 0.0);
+}
+
+CPU_TEST(HashTableStats_SimulateOverflow)
+{
+    //All photons in one cell: one claimed bucket, everything above the bucket size overflows
+    std::vector<float3> positions(100, float3(0.5f));
+    HashTableStats::Settings settings;
+    settings.bucketBits = 8;
+    settings.photonsPerBucket = 12;
+    const auto report = HashTableStats::simulate(positions, 1.f, settings);
+    EXPECT_EQ(report.inserts, uint64_t(100));
+    EXPECT_EQ(report.overflows, uint64_t(88));
+    EXPECT_EQ(report.probeFailures, uint64_t(0));
+    EXPECT_NEAR(report.globalLoadFactor, 1.0 / 256.0, 1e-12);
+    EXPECT_NEAR(report.dropRate, 0.88, 1e-12);
+    EXPECT_EQ(report.distinctCells, uint64_t(1));
+}
+
+CPU_TEST(HashTableStats_SimulateProbeFailures)
+{
+    //More cells than buckets: the probe runs out for the cells that find no free bucket
+    std::vector<float3> positions;
+    for (int i = 0; i < 64; i++)
+        positions.push_back(float3(float(i), 0.f, 0.f) + 0.5f);
+
+    HashTableStats::Settings settings;
+    settings.bucketBits = 4;
+    settings.quadraticProbeIterations = 4;
+    const auto report = HashTableStats::simulate(positions, 1.f, settings);
+    EXPECT_EQ(report.inserts, uint64_t(64));
+    EXPECT_GE(report.probeFailures, uint64_t(64 - 16));
+    EXPECT_LE(report.globalLoadFactor, 1.0);
+    EXPECT_NEAR(report.dropRate, double(report.probeFailures + report.overflows) / 64.0, 1e-12);
+}
+
+CPU_TEST(HashTableStats_Report)
+{
+    HashTableStats::Counters counters = {};
+    counters[kHashStatsGenerateInserts] = 200;
+    counters[kHashStatsGenerateProbeFailures] = 10;
+    counters[kHashStatsGenerateOverflows] = 30;
+    counters[kHashStatsGlobalBuckets] = 64;
+    counters[kHashStatsGenerateHistogram + 0] = 100;
+    counters[kHashStatsGenerateHistogram + 2] = 60;
+    counters[kHashStatsCollectLookups] = 50;
+    counters[kHashStatsCollectHits] = 40;
+    counters[kHashStatsCollectProbeLimit] = 5;
+    counters[kHashStatsCollectPhotons] = 400;
+    counters[kHashStatsCollectRadiusRejects] = 100;
+
+    HashTableStats::Settings settings;
+    settings.bucketBits = 8;
+    const auto report = HashTableStats::createReport("GPU", counters, settings);
+    EXPECT_NEAR(report.globalLoadFactor, 0.25, 1e-12);
+    EXPECT_NEAR(report.dropRate, 0.2, 1e-12);
+    EXPECT_NEAR(report.avgInsertProbe, 120.0 / 160.0, 1e-12);
+    EXPECT_EQ(report.maxInsertProbe, 2u);
+    EXPECT_NEAR(report.hitRate, 0.8, 1e-12);
+    EXPECT_NEAR(report.probeLimitRate, 0.1, 1e-12);
+    EXPECT_NEAR(report.radiusRejectRate, 0.25, 1e-12);
+
+    std::array<uint64_t, kHashStatsCount> totals = {};
+    HashTableStats::accumulate(totals, counters);
+    HashTableStats::accumulate(totals, counters);
+    EXPECT_EQ(totals[kHashStatsGenerateInserts], uint64_t(400));
+    const std::string histogram = HashTableStats::histogramToString(totals, kHashStatsGenerateHistogram);
+    EXPECT(histogram.rfind("200;0;120;0", 0) == 0) << histogram;
+}
@@ -0,0 +1,164 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/ImageMetrics.h"
+#include "../../RenderPasses/PhotonMapperCommon/SimdUtils.h"
+#include <random>
+#include <vector>
+
+namespace
+{
+    /** Random interleaved image. Rows are rowPitch floats apart; the padding is filled with garbage that must not be read.
+    */
+    std::vector<float> createImage(uint32_t width, uint32_t height, uint32_t channelCount, size_t rowPitch, uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> value(0.f, 1.2f);
+        std::vector<float> data(rowPitch * height, 1e30f);
+        for (uint32_t y = 0; y < height; y++)
+            for (uint32_t i = 0; i < width * channelCount; i++) data[y * rowPitch + i] = value(rng);
+        return data;
+    }
+
+    /** Copies the RGB channels of an interleaved image into a tightly packed RGB image.
+    */
+    std::vector<float> toPackedRgb(const std::vector<float>& data, uint32_t width, uint32_t height, uint32_t channelCount, size_t rowPitch)
+    {
+        std::vector<float> rgb(size_t(width) * height * 3);
+        for (uint32_t y = 0; y < height; y++)
+            for (uint32_t x = 0; x < width; x++)
+                for (uint32_t c = 0; c < 3; c++) rgb[(size_t(y) * width + x) * 3 + c] = data[y * rowPitch + x * channelCount + c];
+        return rgb;
+    }
+
+    void expectSameResult(PhotonMapperTests::TestContext& ctx, const ImageMetrics::Result& a, const ImageMetrics::Result& b, double tolerance, const char* what)
+    {
+        EXPECT(a.valid && b.valid) << what;
+        EXPECT_NEAR(a.mse, b.mse, tolerance * b.mse) << what;
+        EXPECT_NEAR(a.relMse, b.relMse, tolerance * b.relMse) << what;
+        EXPECT_NEAR(a.ssim, b.ssim, tolerance) << what;
+        EXPECT_EQ(a.nonFiniteCount, b.nonFiniteCount) << what;
+    }
+}
+
+CPU_TEST(ImageMetrics_Mse)
+{
+    //A constant offset d on all RGB values gives MSE = d^2 and relMSE = d^2 / (y^2 + epsilon)
+    const uint32_t width = 37, height = 19;
+    const float value = 0.5f, offset = 0.25f;
+    std::vector<float> reference(width * height * 3, value);
+    std::vector<float> image(width * height * 3, value + offset);
+
+    ImageMetrics metrics(4);
+    ImageMetrics::Options options;
+    options.computeSsim = false;
+    for (bool useAVX2 : { false, true })
+    {
+        if (useAVX2 && !PhotonMapperSimd::hasAVX2()) continue;
+        options.useAVX2 = useAVX2;
+        const auto result = metrics.compute({ image.data(), width, height }, { reference.data(), width, height }, options);
+        EXPECT(result.valid);
+        EXPECT_NEAR(result.mse, offset * offset, 1e-6) << "AVX2 " << useAVX2;
+        EXPECT_NEAR(result.relMse, offset * offset / (value * value + options.relMseEpsilon), 1e-6) << "AVX2 " << useAVX2;
+        EXPECT_EQ(result.nonFiniteCount, 0u);
+    }
+
+    //Different sizes are rejected
+    const auto result = metrics.compute({ image.data(), width, height - 1 }, { reference.data(), width, height }, options);
+    EXPECT(!result.valid);
+}
+
+CPU_TEST(ImageMetrics_SsimIdentity)
+{
+    const uint32_t width = 64, height = 48;
+    const auto image = createImage(width, height, 3, width * 3, 1);
+    ImageMetrics metrics(4);
+    ImageMetrics::Options options;
+    for (bool useAVX2 : { false, true })
+    {
+        if (useAVX2 && !PhotonMapperSimd::hasAVX2()) continue;
+        options.useAVX2 = useAVX2;
+        const auto result = metrics.compute({ image.data(), width, height }, { image.data(), width, height }, options);
+        EXPECT(result.valid);
+        EXPECT_EQ(result.mse, 0.0) << "AVX2 " << useAVX2;
+        EXPECT_NEAR(result.ssim, 1.0, 1e-5) << "AVX2 " << useAVX2;
+    }
+}
+
+CPU_TEST(ImageMetrics_Avx2MatchesScalar)
+{
+    if (!PhotonMapperSimd::hasAVX2()) return;
+
+    //Odd sizes so the AVX2 kernels also run their remainder loops
+    ImageMetrics metrics(4);
+    for (uint32_t width : { 5u, 67u, 128u })
+    {
+        const uint32_t height = 23;
+        const auto image = createImage(width, height, 3, width * 3, 2);
+        const auto reference = createImage(width, height, 3, width * 3, 3);
+        ImageMetrics::Options options;
+        options.useAVX2 = false;
+        const auto scalar = metrics.compute({ image.data(), width, height }, { reference.data(), width, height }, options);
+        options.useAVX2 = true;
+        const auto avx2 = metrics.compute({ image.data(), width, height }, { reference.data(), width, height }, options);
+        expectSameResult(ctx, avx2, scalar, 1e-5, "AVX2 vs scalar");
+    }
+}
+
+CPU_TEST(ImageMetrics_RowPitchAndRgba)
+{
+    //Padded rows and RGBA input have to give the same result as tightly packed RGB; alpha is ignored
+    const uint32_t width = 45, height = 31;
+    ImageMetrics metrics(4);
+    ImageMetrics::Options options;
+    for (bool useAVX2 : { false, true })
+    {
+        if (useAVX2 && !PhotonMapperSimd::hasAVX2()) continue;
+        options.useAVX2 = useAVX2;
+        for (uint32_t channelCount : { 3u, 4u })
+        {
+            for (size_t padding : { size_t(0), size_t(13) })
+            {
+                const size_t rowPitch = width * channelCount + padding;
+                const auto image = createImage(width, height, channelCount, rowPitch, 4);
+                const auto reference = createImage(width, height, channelCount, rowPitch, 5);
+                const auto packedImage = toPackedRgb(image, width, height, channelCount, rowPitch);
+                const auto packedReference = toPackedRgb(reference, width, height, channelCount, rowPitch);
+
+                const size_t pitch = padding > 0 ? rowPitch : 0;
+                const auto result = metrics.compute({ image.data(), width, height, channelCount, pitch }, { reference.data(), width, height, channelCount, pitch }, options);
+                const auto expected = metrics.compute({ packedImage.data(), width, height }, { packedReference.data(), width, height }, options);
+                EXPECT(result.valid) << "channels " << channelCount << ", padding " << padding << ", AVX2 " << useAVX2;
+                EXPECT_EQ(result.mse, expected.mse) << "channels " << channelCount << ", padding " << padding << ", AVX2 " << useAVX2;
+                EXPECT_EQ(result.relMse, expected.relMse) << "channels " << channelCount << ", padding " << padding << ", AVX2 " << useAVX2;
+                EXPECT_EQ(result.ssim, expected.ssim) << "channels " << channelCount << ", padding " << padding << ", AVX2 " << useAVX2;
+                EXPECT_EQ(result.nonFiniteCount, 0u) << "channels " << channelCount << ", padding " << padding << ", AVX2 " << useAVX2;
+            }
+        }
+    }
+}
@@ -0,0 +1,224 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/LightSampleTableBuilder.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace
+{
+    struct DistributionCheck
+    {
+        double zScore = 0.0;                ///< Wilson-Hilferty normal approximation of the chi-square statistic
+        double maxInvPdfError = 0.0;        ///< Max relative error of the stored inverse pdf against the expected probability
+    };
+
+    uint sampleEntry(const std::vector<LightAliasEntry>& table, uint launchIdx, uint numLaunches, float xi)
+    {
+        AliasTableSample s = getAliasTableSample(launchIdx, numLaunches, static_cast<uint>(table.size()), xi);
+        const LightAliasEntry& entry = table[s.column];
+        return s.frac < entry.threshold ? s.column : entry.alias;
+    }
+
+    /** Samples numFrames frames of numLaunches launches with random jitter like the generate shaders and compares the
+        histogram of the selected entries with the probabilities the table was built with.
+    */
+    DistributionCheck checkDistribution(const std::vector<LightAliasEntry>& table, const std::vector<double>& probabilities, uint numLaunches, uint numFrames, uint seed = 1)
+    {
+        DistributionCheck result;
+        double sum = 0.0;
+        for (double p : probabilities) sum += p;
+
+        std::vector<uint64_t> counts(table.size(), 0);
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+        for (uint frame = 0; frame < numFrames; frame++)
+            for (uint i = 0; i < numLaunches; i++) counts[sampleEntry(table, i, numLaunches, u01(rng))]++;
+
+        //Chi-square test. Neighbouring entries with an expected count below 5 are pooled
+        const double numSamples = double(numLaunches) * numFrames;
+        double pooledExpected = 0.0, pooledObserved = 0.0, chiSquare = 0.0;
+        uint bins = 0;
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            const double p = probabilities[i] / sum;
+            const double observed = double(counts[i]);
+            if (p > 0.0) result.maxInvPdfError = std::max(result.maxInvPdfError, std::abs(table[i].invPdf * p - 1.0));
+            else if (counts[i] > 0) result.maxInvPdfError = INFINITY;    //Selected a light that should never be selected
+
+            pooledExpected += p * numSamples;
+            pooledObserved += observed;
+            if (pooledExpected >= 5.0)
+            {
+                chiSquare += (pooledObserved - pooledExpected) * (pooledObserved - pooledExpected) / pooledExpected;
+                pooledExpected = pooledObserved = 0.0;
+                bins++;
+            }
+        }
+        if (pooledExpected > 0.0)
+        {
+            chiSquare += (pooledObserved - pooledExpected) * (pooledObserved - pooledExpected) / pooledExpected;
+            bins++;
+        }
+        const double k = bins > 1 ? double(bins - 1) : 1.0;
+        result.zScore = (std::cbrt(chiSquare / k) - (1.0 - 2.0 / (9.0 * k))) / std::sqrt(2.0 / (9.0 * k));
+        return result;
+    }
+
+    /** Synthetic scene input: equal triangles, a heavy tailed flux distribution or the latter mixed with analytic lights.
+    */
+    LightSampleTableBuilder::Input createSyntheticInput(const std::string& scene, uint numTriangles, uint numPhotons)
+    {
+        LightSampleTableBuilder::Input input;
+        input.numPhotons = numPhotons;
+        input.numMeshLights = std::max(numTriangles / 1000, 1u);
+
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+        if (scene == "uniform")
+        {
+            input.triangleWeights.assign(numTriangles, 1.f);
+        }
+        else
+        {
+            input.triangleWeights.resize(numTriangles);
+            for (auto& w : input.triangleWeights)
+                w = 1.f / std::max(std::pow(u01(rng), 2.f), 1e-6f);
+        }
+        if (scene == "mixed-analytic")
+            input.numAnalyticLights = 8;
+        return input;
+    }
+
+    const std::vector<std::string> kSyntheticScenes = { "uniform", "power-law", "mixed-analytic" };
+}
+
+CPU_TEST(LightAliasTable_Distribution)
+{
+    //Chi-square test at p = 0.001 and inverse pdfs within 1e-4. Entries with zero probability are never selected
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> u01(0.0, 1.0);
+    const uint sizes[] = { 1, 2, 7, 1000, 100000 };
+    for (uint n : sizes)
+    {
+        std::vector<double> probabilities(n);
+        std::vector<int32_t> lightIndices(n);
+        for (uint i = 0; i < n; i++)
+        {
+            probabilities[i] = i % 5 == 3 ? 0.0 : 1.0 / std::max(u01(rng) * u01(rng), 1e-6);
+            lightIndices[i] = int32_t(i + 1);
+        }
+        const std::vector<LightAliasEntry> table = LightAliasTable::build(probabilities, lightIndices);
+        EXPECT_EQ(table.size(), size_t(n));
+        const DistributionCheck check = checkDistribution(table, probabilities, 1 << 20, 4);
+        EXPECT_LT(check.zScore, 3.09) << n << " lights";
+        EXPECT_LT(check.maxInvPdfError, 1e-4) << n << " lights";
+
+        float invPdf = 0.f;
+        const int32_t light = LightAliasTable::sample(table, 0, 1, 0.5f, invPdf);
+        EXPECT(light >= 1 && light <= int32_t(n)) << light;
+        EXPECT_GT(invPdf, 0.f);
+    }
+}
+
+CPU_TEST(LightSampleTableBuilder_Distribution)
+{
+    //The photons emitted through the alias table follow the power/area distribution of the synthetic scenes
+    WorkStealingThreadPool pool;
+    for (const auto& scene : kSyntheticScenes)
+    {
+        LightSampleTableBuilder::Input input = createSyntheticInput(scene, 100000, 2000000);
+        input.buildReference = true;
+        const LightSampleTableBuilder::Table table = LightSampleTableBuilder::build(input, pool);
+        EXPECT_EQ(table.aliasTable.size(), input.numAnalyticLights + input.triangleWeights.size()) << scene;
+        EXPECT_GE(table.getNumPhotons(), input.numPhotons) << scene;
+        const DistributionCheck check = checkDistribution(table.aliasTable, table.probabilities, table.getNumPhotons(), 4);
+        EXPECT_LT(check.zScore, 3.09) << scene;
+        EXPECT_LT(check.maxInvPdfError, 1e-4) << scene;
+
+        //Histogram of the per photon table in alias table order (analytic lights first)
+        std::vector<uint64_t> counts(table.aliasTable.size(), 0);
+        uint64_t numValid = 0;
+        for (int32_t lightIdx : table.lightIndex)
+        {
+            if (lightIdx == 0) continue;
+            const size_t entry = lightIdx < 0 ? size_t(-lightIdx - 1) : input.numAnalyticLights + size_t(lightIdx - 1);
+            if (entry < counts.size()) counts[entry]++;
+            numValid++;
+        }
+        double sum = 0.0, photonTableTotalVariation = 0.0;
+        for (double p : table.probabilities) sum += p;
+        for (size_t i = 0; i < counts.size(); i++)
+            photonTableTotalVariation += 0.5 * std::abs(double(counts[i]) / double(numValid) - table.probabilities[i] / sum);
+        //Every triangle of the per photon table gets at least one photon, that moves about 4% of the photons of the power law scenes
+        EXPECT_LT(photonTableTotalVariation, 0.1) << scene;
+    }
+}
+
+CPU_TEST(LightSampleTableBuilder_Threads)
+{
+    //Single and multithreaded builds give the same tables
+    WorkStealingThreadPool singlePool(1);
+    WorkStealingThreadPool multiPool(4);
+    for (const auto& scene : kSyntheticScenes)
+    {
+        LightSampleTableBuilder::Input input = createSyntheticInput(scene, 100000, 2000000);
+        input.buildReference = true;
+        const LightSampleTableBuilder::Table single = LightSampleTableBuilder::build(input, singlePool);
+        const LightSampleTableBuilder::Table multi = LightSampleTableBuilder::build(input, multiPool);
+        EXPECT_EQ(single.photonTableWidth, multi.photonTableWidth) << scene;
+        EXPECT(single.lightIndex == multi.lightIndex) << scene;
+        EXPECT(single.photonsPerTriangle == multi.photonsPerTriangle) << scene;
+        EXPECT(std::equal(single.aliasTable.begin(), single.aliasTable.end(), multi.aliasTable.begin(), multi.aliasTable.end(), [](const LightAliasEntry& a, const LightAliasEntry& b) {
+            return a.threshold == b.threshold && a.alias == b.alias && a.lightIndex == b.lightIndex && a.invPdf == b.invPdf;
+        })) << scene;
+    }
+}
+
+BENCHMARK(LightSampleTableBuilder_BuildBenchmark)
+{
+    //Alias and per photon table for 1M emissive triangles, single and multithreaded
+    const uint numTriangles = 1000000;
+    const uint numPhotons = 2000000;
+    WorkStealingThreadPool singlePool(1);
+    WorkStealingThreadPool multiPool;
+    ctx.log() << "scene,triangles,photons,threads,singleThreadMs,multiThreadMs,speedup,aliasOnlyMs,aliasTableBytes,photonTableBytes\n";
+    for (const auto& scene : kSyntheticScenes)
+    {
+        LightSampleTableBuilder::Input input = createSyntheticInput(scene, numTriangles, numPhotons);
+        const LightSampleTableBuilder::Table aliasOnly = LightSampleTableBuilder::build(input, multiPool);
+        input.buildReference = true;
+        const LightSampleTableBuilder::Table single = LightSampleTableBuilder::build(input, singlePool);
+        const LightSampleTableBuilder::Table multi = LightSampleTableBuilder::build(input, multiPool);
+        ctx.log() << scene << "," << numTriangles << "," << aliasOnly.getNumPhotons() << "," << multiPool.getThreadCount() << ","
+                  << single.buildTimeMs << "," << multi.buildTimeMs << "," << (multi.buildTimeMs > 0.0 ? single.buildTimeMs / multi.buildTimeMs : 0.0) << ","
+                  << aliasOnly.buildTimeMs << "," << aliasOnly.aliasTable.size() * sizeof(LightAliasEntry) << ","
+                  << (multi.lightIndex.size() + multi.photonsPerTriangle.size()) * sizeof(uint32_t) << "\n";
+    }
+}
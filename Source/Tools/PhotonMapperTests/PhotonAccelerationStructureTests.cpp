@@ -0,0 +1,162 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonAccelerationStructure.h"
+#include <algorithm>
+
+namespace
+{
+    uint64_t alignBytes(uint64_t bytes)
+    {
+        return (bytes + PhotonAccelerationStructure::kByteAlignment - 1) & ~(PhotonAccelerationStructure::kByteAlignment - 1);
+    }
+
+    PhotonASBuildInputs getInputs(bool topLevel, uint count, bool fastBuild)
+    {
+        PhotonASBuildInputs inputs;
+        inputs.topLevel = topLevel;
+        inputs.fastBuild = fastBuild;
+        inputs.count = count;
+        return inputs;
+    }
+
+    /** Creates and builds the acceleration structures on a null backend, which hands out the allocations as handles
+        from 0, so bottom level i is handle i and the top level the last one.
+    */
+    void checkBackend(PhotonMapperTests::TestContext& ctx, const NullPhotonASBackend::SharedPtr& pBackend, bool fastBuild)
+    {
+        PhotonAccelerationStructure as;
+        as.setBackend(pBackend);
+        //Two maps with a ring of two generations in one buffer each
+        std::vector<PhotonAccelerationStructure::Geometry> geometries = { { nullptr, 100003, 0, 1 }, { nullptr, 37, 0, 2 }, { nullptr, 100003, 100003, 1 }, { nullptr, 37, 37, 2 } };
+        as.create(geometries, fastBuild);
+        const uint tlas = uint(geometries.size());
+
+        //Bottom levels first, the top level last. All sizes aligned and large enough for the maximum counts
+        const auto& allocations = pBackend->getAllocations();
+        EXPECT_EQ(allocations.size(), geometries.size() + 1);
+        uint64_t scratchBytes = 0, sizeBytes = 0;
+        for (size_t i = 0; i < allocations.size(); i++)
+        {
+            const bool topLevel = i == tlas;
+            const PhotonASPrebuildInfo info = pBackend->getPrebuildInfo(getInputs(topLevel, topLevel ? tlas : geometries[i].maxCount, fastBuild));
+            EXPECT_EQ(allocations[i].topLevel, topLevel) << "allocation " << i;
+            EXPECT_EQ(allocations[i].byteSize, alignBytes(info.resultBytes)) << "allocation " << i;
+            scratchBytes = std::max(scratchBytes, alignBytes(std::max(info.scratchBytes, info.updateScratchBytes)));
+            sizeBytes += allocations[i].byteSize;
+        }
+        EXPECT_EQ(pBackend->getScratchBytes(), scratchBytes);
+        EXPECT_EQ(as.getSizeBytes(), sizeBytes + scratchBytes);
+
+        //Instance i references bottom level i with the mask of geometry i
+        const auto& instances = pBackend->getInstances();
+        EXPECT_EQ(instances.size(), geometries.size());
+        for (size_t i = 0; i < instances.size(); i++)
+        {
+            EXPECT_EQ(instances[i].instanceID, i);
+            EXPECT_EQ(instances[i].instanceMask, geometries[i].instanceMask) << "instance " << i;
+            EXPECT_EQ(instances[i].blas, i);
+        }
+
+        //Counts above the maximum are clamped, the top level uses the flags it was sized for
+        const uint counts[] = { 0, 1, 100003, 100004, 1u << 31 };
+        for (uint geometry = 0; geometry < geometries.size(); geometry++)
+        {
+            for (uint count : counts)
+            {
+                const uint expected = std::min(count, geometries[geometry].maxCount);
+                EXPECT_EQ(as.buildBottomLevel(nullptr, geometry, count), expected);
+                const auto& record = pBackend->getBuilds().back();
+                EXPECT(!record.inputs.topLevel);
+                EXPECT_EQ(record.inputs.count, expected);
+                EXPECT_EQ(record.inputs.aabbOffset, geometries[geometry].aabbOffset);
+                EXPECT_EQ(record.inputs.fastBuild, fastBuild);
+                EXPECT_EQ(record.dest, geometry);
+            }
+        }
+        as.buildTopLevel(nullptr);
+        {
+            const auto& record = pBackend->getBuilds().back();
+            EXPECT(record.inputs.topLevel);
+            EXPECT_EQ(record.inputs.count, geometries.size());
+            EXPECT_EQ(record.inputs.fastBuild, fastBuild);
+            EXPECT_EQ(record.dest, tlas);
+        }
+
+        //Recreating releases the old acceleration structures
+        const uint resetCount = pBackend->getResetCount();
+        geometries[1].maxCount = 5000;
+        as.create(geometries, fastBuild);
+        EXPECT_EQ(pBackend->getResetCount(), resetCount + 1);
+        EXPECT_EQ(pBackend->getAllocations().size(), geometries.size() + 1);
+        EXPECT(pBackend->getBuilds().empty());
+        EXPECT_EQ(as.buildBottomLevel(nullptr, 1, 4000), 4000u);
+        as.buildTopLevel(nullptr);
+
+        EXPECT_EQ(pBackend->getErrorCount(), 0u) << (fastBuild ? "fast build" : "fast trace");
+    }
+}
+
+CPU_TEST(PhotonAccelerationStructure_NullBackend)
+{
+    for (bool fastBuild : { true, false }) checkBackend(ctx, NullPhotonASBackend::create(), fastBuild);
+}
+
+CPU_TEST(PhotonAccelerationStructure_ValidatedBackend)
+{
+    //A validating null backend around another backend, like around the device backend of PhotonMapper. The inner
+    //backend gets every call and sees the same acceleration structures
+    for (bool fastBuild : { true, false })
+    {
+        auto pDevice = NullPhotonASBackend::create();
+        auto pBackend = NullPhotonASBackend::create(pDevice);
+        EXPECT(pBackend->getType() == PhotonASBackendType::Null);
+        checkBackend(ctx, pBackend, fastBuild);
+
+        EXPECT_EQ(pDevice->getAllocations().size(), pBackend->getAllocations().size());
+        for (size_t i = 0; i < std::min(pDevice->getAllocations().size(), pBackend->getAllocations().size()); i++)
+            EXPECT_EQ(pDevice->getAllocations()[i].byteSize, pBackend->getAllocations()[i].byteSize) << "allocation " << i;
+        EXPECT_EQ(pDevice->getInstances().size(), pBackend->getInstances().size());
+        EXPECT_EQ(pDevice->getScratchBytes(), pBackend->getScratchBytes());
+        EXPECT_EQ(pDevice->getResetCount(), pBackend->getResetCount());
+        EXPECT_EQ(pDevice->getBuilds().size(), pBackend->getBuilds().size());
+        EXPECT_EQ(pDevice->getErrorCount(), 0u);
+
+        //Invalid builds are counted but do not reach the device
+        const size_t deviceBuilds = pDevice->getBuilds().size();
+        PhotonASBuildInputs inputs = getInputs(false, 100, fastBuild);
+        pBackend->build(nullptr, inputs, uint(pBackend->getAllocations().size()));
+        EXPECT_EQ(pBackend->getErrorCount(), 1u);
+        //Too large for the result and the scratch
+        inputs.count = 1u << 30;
+        pBackend->build(nullptr, inputs, 0);
+        EXPECT_EQ(pBackend->getErrorCount(), 3u);
+        EXPECT_EQ(pDevice->getBuilds().size(), deviceBuilds);
+        EXPECT_EQ(pDevice->getErrorCount(), 0u);
+    }
+}
@@ -0,0 +1,181 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonBufferSizePolicy.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /** Result of running the policy on a count trace.
+    */
+    struct SimulationResult
+    {
+        std::string name;
+        uint32_t counts = 0;
+        PhotonBufferSizePolicy::Stats stats;
+        uint64_t droppedPhotons = 0;            ///< Photons over the capacity, summed over the trace
+        uint64_t droppedAfterFirstGrow = 0;     ///< Dropped photons once the first grow took effect. Earlier drops are in flight before the first readback
+        double meanUtilization = 0.0;           ///< Mean of count / capacity
+        uint64_t peakCapacity = 0;
+        uint64_t finalCapacity = 0;
+    };
+
+    /** Runs a policy over a count trace. The policy sees every count latency counts late, like the counter readback.
+    */
+    SimulationResult simulate(const std::string& name, const std::vector<uint64_t>& counts, uint64_t initialCapacity, const PhotonBufferSizePolicy::Options& options, uint32_t latency)
+    {
+        PhotonBufferSizePolicy policy;
+        policy.setOptions(options);
+        policy.setCapacity(initialCapacity);
+
+        SimulationResult result;
+        result.name = name;
+        result.counts = static_cast<uint32_t>(counts.size());
+        uint64_t capacity = initialCapacity;
+        double utilization = 0.0;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            //The capacity the GPU uses this frame is the one allocated before the newest decision
+            if (counts[i] > capacity)
+            {
+                result.droppedPhotons += counts[i] - capacity;
+                if (policy.getStats().grows > 0) result.droppedAfterFirstGrow += counts[i] - capacity;
+            }
+            utilization += capacity > 0 ? std::min(1.0, static_cast<double>(counts[i]) / capacity) : 0.0;
+            result.peakCapacity = std::max(result.peakCapacity, capacity);
+
+            if (i >= latency) capacity = policy.addCount(counts[i - latency]);
+        }
+        result.stats = policy.getStats();
+        result.meanUtilization = counts.empty() ? 0.0 : utilization / counts.size();
+        result.finalCapacity = capacity;
+        return result;
+    }
+
+    /** Runs the policy over a set of synthetic traces (steady, ramp up/down, spikes, noise, scene switches).
+    */
+    std::vector<SimulationResult> simulateTraces(const PhotonBufferSizePolicy::Options& options, uint32_t latency = 3)
+    {
+        const uint32_t kFrames = 2000;
+        const double kBase = 400000.0;
+        std::mt19937 rng(1234);
+        std::normal_distribution<double> noise(0.0, 1.0);
+
+        auto makeTrace = [&](auto func) {
+            std::vector<uint64_t> trace(kFrames);
+            for (uint32_t i = 0; i < kFrames; i++) trace[i] = static_cast<uint64_t>(std::max(0.0, func(i)));
+            return trace;
+        };
+
+        std::vector<std::pair<std::string, std::vector<uint64_t>>> traces;
+        traces.push_back({ "steady", makeTrace([&](uint32_t) { return kBase; }) });
+        traces.push_back({ "noisy", makeTrace([&](uint32_t) { return kBase * (1.0 + 0.05 * noise(rng)); }) });
+        traces.push_back({ "rampUp", makeTrace([&](uint32_t i) { return kBase * (0.25 + 1.75 * i / kFrames); }) });
+        traces.push_back({ "rampDown", makeTrace([&](uint32_t i) { return kBase * (2.0 - 1.75 * i / kFrames); }) });
+        traces.push_back({ "spikes", makeTrace([&](uint32_t i) { return (i % 250) < 3 ? kBase * 1.8 : kBase; }) });
+        traces.push_back({ "sceneSwitch", makeTrace([&](uint32_t i) { return (i / 500) % 2 == 0 ? kBase : kBase * 0.2; }) });
+        traces.push_back({ "cameraSweep", makeTrace([&](uint32_t i) { return kBase * (1.0 + 0.6 * std::sin(i * 0.01)) * (1.0 + 0.02 * noise(rng)); }) });
+
+        std::vector<SimulationResult> results;
+        for (const auto& [name, trace] : traces)
+            results.push_back(simulate(name, trace, static_cast<uint64_t>(kBase), options, latency));
+        return results;
+    }
+}
+
+CPU_TEST(PhotonBufferSizePolicy_RoundCapacity)
+{
+    PhotonBufferSizePolicy policy;
+    PhotonBufferSizePolicy::Options options;
+    options.minCapacity = 1024;
+    options.maxCapacity = 1 << 20;
+    options.granularity = 256;
+    policy.setOptions(options);
+    EXPECT_EQ(policy.roundCapacity(0.0), 1024u);
+    EXPECT_EQ(policy.roundCapacity(1025.0), 1280u);
+    EXPECT_EQ(policy.roundCapacity(1e9), uint64_t(1) << 20);
+    options.powerOfTwo = true;
+    policy.setOptions(options);
+    EXPECT_EQ(policy.roundCapacity(1025.0), 2048u);
+    EXPECT_EQ(policy.roundCapacity(4096.0), 4096u);
+}
+
+CPU_TEST(PhotonBufferSizePolicy_Overflow)
+{
+    //An overflow grows the buffer right away, also within the minimum resize interval
+    PhotonBufferSizePolicy policy;
+    policy.setOptions({});
+    policy.setCapacity(100000);
+    EXPECT_EQ(policy.addCount(50000), 100000u);
+    const uint64_t capacity = policy.addCount(150000);
+    EXPECT_GE(capacity, 150000u);
+    EXPECT_EQ(policy.getStats().overflows, 1u);
+    EXPECT_EQ(policy.getStats().grows, 1u);
+}
+
+CPU_TEST(PhotonBufferSizePolicy_Traces)
+{
+    std::map<std::string, SimulationResult> results;
+    for (auto& r : simulateTraces({})) results[r.name] = r;
+
+    const auto& steady = results["steady"];
+    EXPECT_LE(steady.stats.grows + steady.stats.shrinks, 1u);
+    EXPECT_EQ(steady.droppedAfterFirstGrow, 0u);
+
+    //A growing scene is followed without overflows once the first readback arrived
+    EXPECT_EQ(results["rampUp"].droppedAfterFirstGrow, 0u);
+    EXPECT_EQ(results["rampDown"].droppedAfterFirstGrow, 0u);
+    EXPECT_EQ(results["rampDown"].stats.overflows, 1u);
+
+    //Periodic spikes: after one shrink that a spike overflows, the shrink delay has to cover the spike period
+    const auto& spikes = results["spikes"];
+    EXPECT_LE(spikes.stats.shrinks, 1u);
+    EXPECT_LE(spikes.stats.overflows, 2u);
+    EXPECT_LE(spikes.droppedAfterFirstGrow, uint64_t(3 * 400000 * 0.8)) << "at most one spike of 3 frames may overflow";
+
+    for (const auto& [name, r] : results)
+    {
+        EXPECT_LE(r.stats.grows + r.stats.shrinks, 20u) << name;
+        EXPECT_GT(r.meanUtilization, 0.3) << name;
+    }
+}
+
+BENCHMARK(PhotonBufferSizePolicy_TraceReport)
+{
+    ctx.log() << "trace,counts,grows,shrinks,overflowCounts,droppedPhotons,droppedAfterFirstGrow,meanUtilization,peakCapacity,finalCapacity\n";
+    for (const auto& r : simulateTraces({}))
+    {
+        ctx.log() << r.name << "," << r.counts << "," << r.stats.grows << "," << r.stats.shrinks << "," << r.stats.overflows << ","
+                  << r.droppedPhotons << "," << r.droppedAfterFirstGrow << "," << r.meanUtilization << "," << r.peakCapacity << "," << r.finalCapacity << "\n";
+    }
+}
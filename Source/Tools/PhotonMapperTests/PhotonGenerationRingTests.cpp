@@ -0,0 +1,252 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonGenerationRing.h"
+#include "../../RenderPasses/PhotonMapperCommon/ProgressiveRadius.slang"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace
+{
+    const float kStartRadius = 0.05f;
+    const float kMinRadius = 0.0001f;
+    const double kPi = 3.14159265358979323846;
+
+    struct EstimateResult
+    {
+        double estimate = 0.0;              ///< Per pixel SPPM estimate with the weighted photons of the ring, the exact density is 1
+        float radius = 0.f;                 ///< Per pixel radius after the last iteration
+        float referenceRadius = 0.f;        ///< Radius after the last iteration with the expected photon count
+    };
+
+    struct PhotonDistribution
+    {
+        const char* name;
+        uint photonsPerIteration;
+        double tolerance;               ///< Max relative error of the estimate
+        float radiusTolerance;          ///< Max relative difference of the radius to the one of the expected photon count. Noisy for few photons
+    };
+
+    /** Number of wrong slots, weights or stale slots over 100 iterations with resets in between.
+    */
+    uint countSlotMismatches(uint generations)
+    {
+        uint mismatches = 0;
+        //Generation in the BLAS of every slot. -1 is a BLAS without photons, -2 one that was never built
+        PhotonGenerationRing ring;
+        ring.setGenerationCount(generations);
+        std::vector<int> content(generations, -2);
+        int generation = 0, resetGeneration = 0;
+        const uint kIterations = 100;
+        for (uint i = 0; i < kIterations; i++)
+        {
+            if (i == 5 || i % 37 == 0) {
+                ring.reset();
+                resetGeneration = generation;
+            }
+            const uint slot = ring.beginGeneration();
+            if (slot != uint(generation - resetGeneration) % generations) mismatches++;
+            content[slot] = generation;
+            for (uint stale : ring.takeStaleSlots()) {
+                if (stale == slot) mismatches++;
+                content[stale] = -1;
+            }
+            generation++;
+
+            const uint validCount = std::min(uint(generation - resetGeneration), generations);
+            if (ring.getValidCount() != validCount) mismatches++;
+            float weightSum = 0.f;
+            for (uint s = 0; s < generations; s++) {
+                const float weight = ring.getWeight(s);
+                weightSum += weight;
+                if (content[s] >= resetGeneration) {
+                    if (weight != 1.f / validCount) mismatches++;
+                }
+                //Photons from before the reset must not be hit
+                else if (weight != 0.f || content[s] != -1) mismatches++;
+            }
+            if (std::abs(weightSum - 1.f) > 1e-5f) mismatches++;
+        }
+        return mismatches;
+    }
+
+    /** Per pixel SPPM at the center of the unit square with uniform photons of total flux 1 per iteration. The ring is
+        gathered with the weights of the slots, a second pixel gathers only the newest generation for comparison.
+        Both radii follow the recurrence with the expected photon count, the ring with less noise.
+    */
+    EstimateResult estimate(const PhotonDistribution& dist, uint generations, std::mt19937& rng, float alpha, uint iterations)
+    {
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        const float2 query = float2(0.5f);
+        const float photonFlux = 1.f / dist.photonsPerIteration;
+        PhotonGenerationRing ring;
+        ring.setGenerationCount(generations);
+        std::vector<std::vector<float2>> slots(generations);
+        ProgressivePhotonStats stats = initProgressivePhotonStats(kStartRadius);
+        ProgressivePhotonStats singleStats = initProgressivePhotonStats(kStartRadius);
+        double referenceRadius = kStartRadius, referencePhotons = 0.0;
+        for (uint i = 0; i < iterations; i++)
+        {
+            const uint slot = ring.beginGeneration();
+            slots[slot].resize(dist.photonsPerIteration);
+            for (auto& pos : slots[slot]) pos = float2(u(rng), u(rng));
+
+            float weighted = 0.f, single = 0.f;
+            for (uint s = 0; s < generations; s++) {
+                const float weight = ring.getWeight(s);
+                if (weight == 0.f) continue;
+                uint count = 0, singleCount = 0;
+                for (const float2& pos : slots[s]) {
+                    const float2 d = pos - query;
+                    const float d2 = glm::dot(d, d);
+                    if (d2 < stats.radius * stats.radius) count++;
+                    if (s == slot && d2 < singleStats.radius * singleStats.radius) singleCount++;
+                }
+                weighted += weight * count;
+                single += singleCount;
+            }
+            //Diffuse surface with a BSDF of 1, the flux is the photon count times the photon flux
+            stats = updateProgressivePhotonStats(stats, weighted, float3(weighted * photonFlux), alpha, kMinRadius);
+            singleStats = updateProgressivePhotonStats(singleStats, single, float3(single * photonFlux), alpha, kMinRadius);
+
+            const double expected = dist.photonsPerIteration * kPi * referenceRadius * referenceRadius;
+            const double newPhotons = referencePhotons + alpha * expected;
+            referenceRadius = std::max(referenceRadius * std::sqrt(newPhotons / (referencePhotons + expected)), double(kMinRadius));
+            referencePhotons = newPhotons;
+        }
+
+        EstimateResult r;
+        r.estimate = getProgressivePhotonRadiance(stats, iterations).x;
+        r.radius = stats.radius;
+        r.referenceRadius = float(referenceRadius);
+        return r;
+    }
+
+    struct ConvergenceResult
+    {
+        double squaredError[2] = {};        ///< Squared error of the estimate at both checkpoints, summed over the runs
+        double radius = 0.0;                ///< Radius at the last checkpoint, summed over the runs
+    };
+
+    /** Per pixel SPPM like estimate(), but the radius update either gets the weighted photon count of the ring or the
+        combined count of all slots. The flux is weighted in both cases. Adds the errors at the checkpoints to the result.
+    */
+    void addConvergenceRun(ConvergenceResult& result, uint photonsPerIteration, uint generations, bool combinedCount, std::mt19937& rng, float alpha, const uint (&checkpoints)[2])
+    {
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        const float2 query = float2(0.5f);
+        const float photonFlux = 1.f / photonsPerIteration;
+        PhotonGenerationRing ring;
+        ring.setGenerationCount(generations);
+        std::vector<std::vector<float2>> slots(generations);
+        ProgressivePhotonStats stats = initProgressivePhotonStats(kStartRadius);
+        for (uint i = 0; i < checkpoints[1]; i++)
+        {
+            const uint slot = ring.beginGeneration();
+            slots[slot].resize(photonsPerIteration);
+            for (auto& pos : slots[slot]) pos = float2(u(rng), u(rng));
+
+            float weighted = 0.f, combined = 0.f;
+            for (uint s = 0; s < generations; s++) {
+                const float weight = ring.getWeight(s);
+                if (weight == 0.f) continue;
+                uint count = 0;
+                for (const float2& pos : slots[s]) {
+                    const float2 d = pos - query;
+                    if (glm::dot(d, d) < stats.radius * stats.radius) count++;
+                }
+                weighted += weight * count;
+                combined += float(count);
+            }
+            stats = updateProgressivePhotonStats(stats, combinedCount ? combined : weighted, float3(weighted * photonFlux), alpha, kMinRadius);
+
+            for (uint c = 0; c < 2; c++) {
+                if (i + 1 != checkpoints[c]) continue;
+                const double error = getProgressivePhotonRadiance(stats, i + 1).x - 1.0;
+                result.squaredError[c] += error * error;
+            }
+        }
+        result.radius += stats.radius;
+    }
+}
+
+CPU_TEST(PhotonGenerationRing_Slots)
+{
+    for (uint generations : { 1u, 2u, 3u, kMaxPhotonGenerations })
+        EXPECT_EQ(countSlotMismatches(generations), 0u) << "generations " << generations;
+}
+
+CPU_TEST(PhotonGenerationRing_Estimate)
+{
+    std::mt19937 rng(1);
+    const float alpha = 0.7f;
+    const uint iterations = 1000;
+    const PhotonDistribution distributions[] = {
+        { "Uniform dense", 4096, 0.08, 0.1f },
+        { "Uniform sparse", 256, 0.2, 0.3f },
+    };
+    for (const auto& dist : distributions)
+    {
+        for (uint generations : { 1u, 4u, kMaxPhotonGenerations })
+        {
+            const EstimateResult r = estimate(dist, generations, rng, alpha, iterations);
+            EXPECT_NEAR(r.estimate, 1.0, dist.tolerance) << dist.name << ", generations " << generations;
+            EXPECT_LT(std::abs(r.radius / r.referenceRadius - 1.f), dist.radiusTolerance) << dist.name << ", generations " << generations;
+        }
+    }
+}
+
+CPU_TEST(PhotonGenerationRing_RadiusConvergence)
+{
+    //The radius update gets the weighted count of the ring. It follows the radius of a single generation and the error of
+    //the estimate falls with the iterations. The combined count of all slots shrinks the radius as if every slot held new
+    //photons in every iteration, the density is uniform so the smaller radius only adds variance
+    const float alpha = 0.7f;
+    const uint photonsPerIteration = 256;
+    const uint checkpoints[2] = { 250, 4000 };
+    const uint runs = 16;
+    auto converge = [&](uint generations, bool combinedCount) {
+        std::mt19937 rng(7);
+        ConvergenceResult result;
+        for (uint run = 0; run < runs; run++) addConvergenceRun(result, photonsPerIteration, generations, combinedCount, rng, alpha, checkpoints);
+        return result;
+    };
+    auto rmse = [&](const ConvergenceResult& result, uint checkpoint) { return std::sqrt(result.squaredError[checkpoint] / runs); };
+
+    const ConvergenceResult single = converge(1, false);
+    for (uint generations : { 4u, kMaxPhotonGenerations })
+    {
+        const ConvergenceResult weighted = converge(generations, false);
+        const ConvergenceResult combined = converge(generations, true);
+        EXPECT_LT(rmse(weighted, 1), 0.5 * rmse(weighted, 0)) << "generations " << generations;
+        EXPECT_LT(std::abs(weighted.radius / single.radius - 1.0), 0.1) << "generations " << generations;
+        EXPECT_LT(combined.radius, 0.95 * weighted.radius) << "generations " << generations;
+        EXPECT_LT(rmse(weighted, 1), rmse(combined, 1)) << "generations " << generations;
+    }
+}
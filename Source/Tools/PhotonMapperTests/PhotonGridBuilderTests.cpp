@@ -0,0 +1,148 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonGridBuilder.h"
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+
+namespace
+{
+    template<typename Func>
+    double measureMs(uint repetitions, Func func)
+    {
+        if (repetitions == 0) return 0.0;
+        func();     //warm up
+        auto start = std::chrono::steady_clock::now();
+        for (uint r = 0; r < repetitions; r++) func();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+    }
+
+    //Photons on the walls of a box of extent^3 cells. A tenth of the photons is focused into a caustic spot of 2x2 cells on the floor
+    std::vector<float3> createInteriorPhotons(uint numPhotons, float extent, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        std::vector<float3> positions(numPhotons);
+        for (uint i = 0; i < numPhotons; i++)
+        {
+            float3 p = float3(u(rng), u(rng), u(rng)) * extent;
+            if (i % 10 == 0) {
+                p = float3(extent * 0.5f + 2.f * u(rng), 0.f, extent * 0.5f + 2.f * u(rng));
+            }
+            else {
+                const uint wall = rng() % 6;
+                p[wall % 3] = wall < 3 ? 0.f : extent - 1.f;
+            }
+            positions[i] = p;
+        }
+        return positions;
+    }
+}
+
+CPU_TEST(PhotonGridBuilder_Build)
+{
+    //The single and multithreaded build against a reference that stable sorts the photons by slot
+    std::mt19937 rng(1);
+    WorkStealingThreadPool pool;
+    const uint sizes[] = { 0, 1, 1000, 100003, 1 << 20 };
+    const uint slotBits[] = { 4, 12, 20 };
+    for (uint numPhotons : sizes)
+    {
+        const std::vector<float3> positions = createInteriorPhotons(numPhotons, 100.f, rng);
+        for (uint bits : slotBits)
+        {
+            const uint numSlots = 1u << bits;
+            const std::vector<uint> slots = PhotonGridBuilder::computeSlots(positions, 1.f, SpatialHashFunction::Wang, bits, &pool);
+
+            PhotonGridBuilder::Grid reference;
+            reference.photonIndices.resize(numPhotons);
+            std::iota(reference.photonIndices.begin(), reference.photonIndices.end(), 0u);
+            std::stable_sort(reference.photonIndices.begin(), reference.photonIndices.end(), [&](uint x, uint y) { return slots[x] < slots[y]; });
+            reference.cellStart.assign(size_t(numSlots) + 1, 0);
+            for (uint slot : slots) reference.cellStart[slot + 1]++;
+            std::partial_sum(reference.cellStart.begin(), reference.cellStart.end(), reference.cellStart.begin());
+
+            EXPECT_EQ(PhotonGridBuilder::compare(reference, PhotonGridBuilder::build(slots, numSlots)), uint64_t(0)) << numPhotons << " photons, " << numSlots << " slots";
+            EXPECT_EQ(PhotonGridBuilder::compare(reference, PhotonGridBuilder::build(slots, numSlots, &pool)), uint64_t(0)) << numPhotons << " photons, " << numSlots << " slots, MT";
+        }
+    }
+}
+
+CPU_TEST(PhotonGridBuilder_Compare)
+{
+    PhotonGridBuilder::Grid a;
+    a.cellStart = { 0, 2, 3 };
+    a.photonIndices = { 1, 0, 2 };
+    //The order inside a slot does not matter
+    PhotonGridBuilder::Grid b = a;
+    b.photonIndices = { 0, 1, 2 };
+    EXPECT_EQ(PhotonGridBuilder::compare(a, b), uint64_t(0));
+    //Photon 1 moved to slot 1: one slot start and one photon differ
+    b.cellStart = { 0, 1, 3 };
+    b.photonIndices = { 0, 2, 1 };
+    EXPECT_EQ(PhotonGridBuilder::compare(a, b), uint64_t(2));
+}
+
+BENCHMARK(PhotonGridBuilder_BuildBenchmark)
+{
+    //Build time and the memory and dropped photons of cell ranges against the buckets of the hash passes on a synthetic
+    //interior with a bright caustic spot. Probe failures of the buckets are ignored, so their dropped photons are a lower bound
+    const uint numPhotons = 1 << 22;
+    const uint slotBits = 20;
+    const uint photonsPerBucket = 12;
+    const uint repetitions = 4;
+
+    WorkStealingThreadPool pool;
+    std::mt19937 rng(1234);
+    const std::vector<float3> positions = createInteriorPhotons(numPhotons, 400.f, rng);
+    const uint numSlots = 1u << slotBits;
+    const std::vector<uint> slots = PhotonGridBuilder::computeSlots(positions, 1.f, SpatialHashFunction::Wang, slotBits, &pool);
+
+    //Cell ranges: slot starts, the slot and the offset inside the slot of every photon
+    const double rangesMB = (double(numSlots + 1) + 2.0 * numPhotons) * sizeof(uint) / (1024.0 * 1024.0);
+    ctx.log() << "test,photons,slotBits,ms,mPhotonsPerSec,memoryMB,droppedPhotons\n";
+    for (WorkStealingThreadPool* pPool : { (WorkStealingThreadPool*)nullptr, &pool })
+    {
+        const double ms = measureMs(repetitions, [&]() { PhotonGridBuilder::build(slots, numSlots, pPool); });
+        ctx.log() << (pPool ? "Build CPU MT," : "Build CPU,") << numPhotons << "," << slotBits << "," << ms << "," << (ms > 0.0 ? numPhotons / (ms * 1e3) : 0.0) << "," << rangesMB << ",0\n";
+    }
+
+    std::unordered_map<uint64_t, uint> cellCounts;
+    for (const float3& p : positions) {
+        const int3 c = int3(floor(p));
+        cellCounts[(uint64_t(uint(c.x) & 0x1FFFFF) << 42) | (uint64_t(uint(c.y) & 0x1FFFFF) << 21) | uint64_t(uint(c.z) & 0x1FFFFF)]++;
+    }
+    uint64_t droppedPhotons = 0;
+    for (const auto& [cell, cellCount] : cellCounts)
+        droppedPhotons += cellCount > photonsPerBucket ? cellCount - photonsPerBucket : 0;
+    const double bucketsMB = double(numSlots) * (4 + photonsPerBucket) * sizeof(uint) / (1024.0 * 1024.0);
+    ctx.log() << "Buckets," << numPhotons << "," << slotBits << ",0,0," << bucketsMB << "," << droppedPhotons << "\n";
+    ctx.log() << "Cell Ranges," << numPhotons << "," << slotBits << ",0,0," << rangesMB << ",0\n";
+}
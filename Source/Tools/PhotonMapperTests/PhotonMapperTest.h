@@ -0,0 +1,108 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <utility>
+
+/** Minimal test registry of the headless photon mapper tests.
+    CPU_TEST registers a check that fails the run if one of its EXPECTs fails. BENCHMARK registers a measurement that
+    only reports (e.g. as CSV) and is run with --benchmark. Both get a TestContext named ctx.
+*/
+namespace PhotonMapperTests
+{
+    class TestContext
+    {
+    public:
+        void addFailure(const std::string& message) { mFailures++; mLog << "    " << message << "\n"; }
+        uint32_t getFailureCount() const { return mFailures; }
+
+        /** Output of the test, printed after its result line.
+        */
+        std::ostringstream& log() { return mLog; }
+
+    private:
+        uint32_t mFailures = 0;
+        std::ostringstream mLog;
+    };
+
+    using TestFunc = void (*)(TestContext& ctx);
+
+    struct Registrar
+    {
+        Registrar(const char* name, TestFunc func, bool isBenchmark);
+    };
+
+    /** Collects the message of a failed EXPECT and reports it when the statement ends.
+    */
+    class FailureStream
+    {
+    public:
+        FailureStream(TestContext& ctx, const char* file, int line, const char* expression) : mCtx(ctx)
+        {
+            mMessage << file << "(" << line << "): EXPECT(" << expression << ") failed ";
+        }
+        ~FailureStream() { mCtx.addFailure(mMessage.str()); }
+
+        template<typename T>
+        FailureStream& operator<<(const T& value) { mMessage << value; return *this; }
+
+    private:
+        TestContext& mCtx;
+        std::ostringstream mMessage;
+    };
+}
+
+#define PM_TEST_FUNC(name, isBenchmark) \
+    static void name(::PhotonMapperTests::TestContext& ctx); \
+    static ::PhotonMapperTests::Registrar name##Registrar(#name, &name, isBenchmark); \
+    static void name(::PhotonMapperTests::TestContext& ctx)
+
+#define CPU_TEST(name) PM_TEST_FUNC(name, false)
+#define BENCHMARK(name) PM_TEST_FUNC(name, true)
+
+#define EXPECT(cond) \
+    if (cond) {} \
+    else ::PhotonMapperTests::FailureStream(ctx, __FILE__, __LINE__, #cond)
+
+#define PM_EXPECT_OP(a, b, op) \
+    if (const auto pmValues_ = std::make_pair((a), (b)); pmValues_.first op pmValues_.second) {} \
+    else ::PhotonMapperTests::FailureStream(ctx, __FILE__, __LINE__, #a " " #op " " #b) << "(" << pmValues_.first << " vs " << pmValues_.second << ") "
+
+#define EXPECT_EQ(a, b) PM_EXPECT_OP(a, b, ==)
+#define EXPECT_NE(a, b) PM_EXPECT_OP(a, b, !=)
+#define EXPECT_LT(a, b) PM_EXPECT_OP(a, b, <)
+#define EXPECT_LE(a, b) PM_EXPECT_OP(a, b, <=)
+#define EXPECT_GT(a, b) PM_EXPECT_OP(a, b, >)
+#define EXPECT_GE(a, b) PM_EXPECT_OP(a, b, >=)
+
+#define EXPECT_NEAR(a, b, tolerance) \
+    if (const auto pmValues_ = std::make_pair(double(a), double(b)); std::abs(pmValues_.first - pmValues_.second) <= double(tolerance)) {} \
+    else ::PhotonMapperTests::FailureStream(ctx, __FILE__, __LINE__, #a " ~ " #b) << "(" << pmValues_.first << " vs " << pmValues_.second << ", tolerance " << (tolerance) << ") "
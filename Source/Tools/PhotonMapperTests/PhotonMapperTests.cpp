@@ -0,0 +1,104 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/** Headless tests of the CPU parts of the photon mapper passes.
+    Usage: PhotonMapperTests [--benchmark] [--list] [filter]
+    Runs all tests whose name contains the filter, or the benchmarks with --benchmark. Returns 1 if a test failed.
+*/
+
+namespace PhotonMapperTests
+{
+    namespace
+    {
+        struct Entry
+        {
+            const char* name;
+            TestFunc func;
+            bool isBenchmark;
+        };
+
+        std::vector<Entry>& getRegistry()
+        {
+            static std::vector<Entry> registry;
+            return registry;
+        }
+    }
+
+    Registrar::Registrar(const char* name, TestFunc func, bool isBenchmark)
+    {
+        getRegistry().push_back({ name, func, isBenchmark });
+    }
+}
+
+int main(int argc, char** argv)
+{
+    using namespace PhotonMapperTests;
+
+    bool runBenchmarks = false;
+    bool listOnly = false;
+    const char* filter = "";
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--benchmark") == 0) runBenchmarks = true;
+        else if (std::strcmp(argv[i], "--list") == 0) listOnly = true;
+        else filter = argv[i];
+    }
+
+    uint32_t run = 0;
+    uint32_t failed = 0;
+    for (const Entry& entry : getRegistry())
+    {
+        if (entry.isBenchmark != runBenchmarks || std::strstr(entry.name, filter) == nullptr) continue;
+        if (listOnly)
+        {
+            std::printf("%s\n", entry.name);
+            continue;
+        }
+
+        TestContext ctx;
+        auto start = std::chrono::steady_clock::now();
+        entry.func(ctx);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        run++;
+        const bool passed = ctx.getFailureCount() == 0;
+        if (!passed) failed++;
+        std::printf("[%s] %s (%.1f ms)\n", passed ? "  OK  " : "FAILED", entry.name, ms);
+        const std::string log = ctx.log().str();
+        if (!log.empty()) std::printf("%s", log.c_str());
+        std::fflush(stdout);
+    }
+
+    if (!listOnly) std::printf("%u of %u %s passed\n", run - failed, run, runBenchmarks ? "benchmarks" : "tests");
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,333 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonPacking.h"
+#include "../../RenderPasses/PhotonMapperCommon/SimdUtils.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+namespace
+{
+    const float kFp16Max = 65504.f;
+    const float kPosScale = float(1u << kPackedPhotonPosBits);
+
+    uint32_t asUint(float f)
+    {
+        uint32_t u;
+        std::memcpy(&u, &f, sizeof(u));
+        return u;
+    }
+
+    float asFloat(uint32_t u)
+    {
+        float f;
+        std::memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+
+    //IEEE half conversion for the 16 bit layout of the benchmark. Overflow gives infinity like the GPU conversion
+    uint16_t floatToHalf(float f)
+    {
+        uint32_t x = asUint(f);
+        const uint16_t sign = uint16_t((x >> 16) & 0x8000);
+        x &= 0x7FFFFFFF;
+        if (x >= (143u << 23)) return sign | (x > 0x7F800000 ? 0x7E00 : 0x7C00);
+        if (x < (113u << 23))
+        {
+            //Subnormal, let the float adder round the mantissa
+            const uint32_t magic = 126u << 23;
+            return sign | uint16_t(asUint(asFloat(x) + asFloat(magic)) - magic);
+        }
+        const uint32_t mantOdd = (x >> 13) & 1;
+        x += (uint32_t(15 - 127) << 23) + 0xFFF + mantOdd;
+        return sign | uint16_t(x >> 13);
+    }
+
+    float halfToFloat(uint16_t h)
+    {
+        const uint32_t sign = uint32_t(h & 0x8000) << 16;
+        const uint32_t exponent = (h >> 10) & 0x1F;
+        const uint32_t mantissa = h & 0x3FF;
+        if (exponent == 0) return asFloat(sign | asUint(float(mantissa) * (1.f / 16777216.f)));
+        if (exponent == 31) return asFloat(sign | 0x7F800000 | (mantissa << 13));
+        return asFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+    }
+
+    float3 randomDirection(std::mt19937& rng)
+    {
+        std::normal_distribution<float> normal(0.f, 1.f);
+        while (true)
+        {
+            const float3 v(normal(rng), normal(rng), normal(rng));
+            const float len = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+            if (len > 1e-4f) return v / len;
+        }
+    }
+
+    /** Random photons. Flux is log-uniform in [2^-fluxLog2Range, 2^fluxLog2Range] with random colors and some primaries.
+    */
+    PhotonPacking::Streams createRandomPhotons(uint count, float extent, float fluxLog2Range, uint seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+        PhotonPacking::Streams photons;
+        photons.resize(count);
+        for (uint i = 0; i < count; i++)
+        {
+            const float magnitude = std::exp2((2.f * u01(rng) - 1.f) * fluxLog2Range);
+            float3 color(u01(rng), u01(rng), u01(rng));
+            if (i % 8 == 0) color = float3(0.f), color[(i / 8) % 3] = 1.f;
+            const float3 dir = randomDirection(rng);
+            const float3 faceN = randomDirection(rng);
+            for (uint c = 0; c < 3; c++)
+            {
+                photons.pos[c][i] = (2.f * u01(rng) - 1.f) * extent;
+                photons.flux[c][i] = color[c] * magnitude;
+                photons.dir[c][i] = dir[c];
+                photons.faceN[c][i] = faceN[c];
+            }
+        }
+        return photons;
+    }
+
+    double luminance(double r, double g, double b)
+    {
+        return 0.2126729 * r + 0.7151522 * g + 0.0721750 * b;
+    }
+
+    double angleDegrees(const PhotonPacking::Streams& a, const PhotonPacking::Streams& b, bool faceN, size_t i)
+    {
+        const auto& va = faceN ? a.faceN : a.dir;
+        const auto& vb = faceN ? b.faceN : b.dir;
+        const double ax = va[0][i], ay = va[1][i], az = va[2][i];
+        const double bx = vb[0][i], by = vb[1][i], bz = vb[2][i];
+        const double cx = ay * bz - az * by, cy = az * bx - ax * bz, cz = ax * by - ay * bx;
+        const double angle = std::atan2(std::sqrt(cx * cx + cy * cy + cz * cz), ax * bx + ay * by + az * bz);
+        return angle * 180.0 / 3.14159265358979323846;
+    }
+
+    /** Accumulates an error for max and mean.
+    */
+    struct ErrorStats
+    {
+        double max = 0.0;
+        double sum = 0.0;
+        uint64_t count = 0;
+
+        void add(double e) { max = std::max(max, e); sum += e; count++; }
+        double mean() const { return count > 0 ? sum / double(count) : 0.0; }
+    };
+
+    template<typename Func>
+    double measureMs(uint repetitions, Func func)
+    {
+        if (repetitions == 0) return 0.0;
+        func();     //warm up
+        auto start = std::chrono::steady_clock::now();
+        for (uint r = 0; r < repetitions; r++) func();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+    }
+}
+
+CPU_TEST(PhotonPacking_RoundTrip)
+{
+    //Packs and unpacks random photons on the scalar and the AVX2 path and checks the error of every attribute against the
+    //bound of the format. Flux covers 2^-40 to 2^40, far outside of the fp16 range
+    const uint numSamples = 1 << 20;
+    //Odd cell scale so cell borders do not line up with float steps
+    const float cellScale = 1.f / 0.0137f;
+    const float extent = 20.f;
+    const PhotonPacking::Streams photons = createRandomPhotons(numSamples, extent, 40.f, 1);
+    PhotonPacking::CellStreams cells;
+    PhotonPacking::computeCells(photons, cellScale, cells);
+
+    std::vector<uint4> packedScalar, packedAVX2;
+    PhotonPacking::pack(photons, cellScale, packedScalar, false);
+    PhotonPacking::pack(photons, cellScale, packedAVX2, true);
+    PhotonPacking::Streams decoded[2];
+    PhotonPacking::unpack(packedScalar, cells, cellScale, decoded[0], false);
+    PhotonPacking::unpack(packedAVX2, cells, cellScale, decoded[1], true);
+
+    ErrorStats fluxError, luminanceError, dirError, faceNError, posError;
+    uint64_t codeMismatches = 0, tagErrors = 0, fp16Overflows = 0;
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        const uint4& a = packedScalar[i];
+        const uint4& b = packedAVX2[i];
+        codeMismatches += a != b;
+
+        const double r = photons.flux[0][i], g = photons.flux[1][i], bl = photons.flux[2][i];
+        const double maxChannel = std::max(r, std::max(g, bl));
+        const double Y = luminance(r, g, bl);
+        fp16Overflows += maxChannel > kFp16Max;
+
+        for (const PhotonPacking::Streams& d : decoded)
+        {
+            double channelError = 0.0;
+            for (uint c = 0; c < 3; c++)
+                channelError = std::max(channelError, std::abs(double(d.flux[c][i]) - double(photons.flux[c][i])));
+            fluxError.add(channelError / maxChannel);
+            luminanceError.add(std::abs(luminance(d.flux[0][i], d.flux[1][i], d.flux[2][i]) - Y) / Y);
+            dirError.add(angleDegrees(photons, d, false, i));
+            faceNError.add(angleDegrees(photons, d, true, i));
+            double e = 0.0;
+            for (uint c = 0; c < 3; c++)
+                e = std::max(e, std::abs(double(d.pos[c][i]) - double(photons.pos[c][i])) * cellScale);
+            posError.add(e);
+        }
+
+        //The tag has to match the own cell and reject the direct neighbours
+        const int3 cell(cells[0][i], cells[1][i], cells[2][i]);
+        tagErrors += !PhotonPacking::isInCell(a, cell);
+        for (int dz = -1; dz <= 1; dz++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                    if (dx != 0 || dy != 0 || dz != 0) tagErrors += PhotonPacking::isInCell(a, cell + int3(dx, dy, dz));
+    }
+
+    //Bounds are half a quantization step plus float rounding. The position adds the float step of the cell coordinate.
+    //u'v' steps move saturated colors slightly out of gamut, clamping the negative channel then also changes the luminance
+    EXPECT_LE(fluxError.max, 0.05) << "relative to the max channel";
+    EXPECT_LE(luminanceError.max, 0.02) << "relative";
+    EXPECT_LE(dirError.max, 0.005) << "degrees";
+    EXPECT_LE(faceNError.max, 0.3) << "degrees";
+    EXPECT_LE(posError.max, 0.5 / kPosScale + 4.0 * extent * cellScale * FLT_EPSILON) << "cells";
+    EXPECT_EQ(tagErrors, 0u);
+    EXPECT_GT(fp16Overflows, 0u) << "the samples have to cover flux the 16 bit format cannot store";
+    //Contracted multiply-adds can move a code by one step, see PhotonPacking.h
+    ctx.log() << "AVX2 codes that differ from the scalar path: " << codeMismatches << " of " << numSamples << "\n";
+}
+
+BENCHMARK(PhotonPacking_Benchmark)
+{
+    //Pack and unpack bandwidth of the 32 bit, 16 bit and compact layout on random photons
+    struct Half4 { uint16_t v[4]; };
+    const uint numPhotons = 1 << 22;
+    const uint repetitions = 4;
+    const float cellScale = 1.f / 0.05f;
+    const PhotonPacking::Streams photons = createRandomPhotons(numPhotons, 50.f, 10.f, 1234);
+    PhotonPacking::CellStreams cells;
+    PhotonPacking::computeCells(photons, cellScale, cells);
+    PhotonPacking::Streams decoded;
+    decoded.resize(numPhotons);
+
+    ctx.log() << "format,path,photons,bytesPerPhoton,packMs,unpackMs,packGBPerSec,unpackGBPerSec\n";
+    auto addResult = [&](const char* format, const char* path, uint bytesPerPhoton, double packMs, double unpackMs) {
+        const double bytes = double(numPhotons) * bytesPerPhoton;
+        ctx.log() << format << "," << path << "," << numPhotons << "," << bytesPerPhoton << "," << packMs << "," << unpackMs << ","
+                  << (packMs > 0.0 ? bytes / (packMs * 1e6) : 0.0) << "," << (unpackMs > 0.0 ? bytes / (unpackMs * 1e6) : 0.0) << "\n";
+    };
+
+    //Face normal as spherical angles in the .w components, as the 32 and 16 bit info formats store it
+    auto toSpherical = [](float x, float y, float z, float& theta, float& phi) { theta = std::acos(std::clamp(y, -1.f, 1.f)); phi = std::atan2(z, x); };
+    auto fromSpherical = [](float theta, float phi, PhotonPacking::Streams& out, size_t i) {
+        const float sinTheta = std::sin(theta);
+        out.faceN[0][i] = std::cos(phi) * sinTheta;
+        out.faceN[1][i] = std::cos(theta);
+        out.faceN[2][i] = std::sin(phi) * sinTheta;
+    };
+
+    //32 bit: RGBA32F position, flux and direction
+    {
+        std::vector<float4> pos(numPhotons), flux(numPhotons), dir(numPhotons);
+        double packMs = measureMs(repetitions, [&]() {
+            for (size_t i = 0; i < numPhotons; i++)
+            {
+                float theta, phi;
+                toSpherical(photons.faceN[0][i], photons.faceN[1][i], photons.faceN[2][i], theta, phi);
+                pos[i] = float4(photons.pos[0][i], photons.pos[1][i], photons.pos[2][i], 0.f);
+                flux[i] = float4(photons.flux[0][i], photons.flux[1][i], photons.flux[2][i], theta);
+                dir[i] = float4(photons.dir[0][i], photons.dir[1][i], photons.dir[2][i], phi);
+            }
+        });
+        double unpackMs = measureMs(repetitions, [&]() {
+            for (size_t i = 0; i < numPhotons; i++)
+            {
+                for (uint c = 0; c < 3; c++)
+                {
+                    decoded.pos[c][i] = pos[i][c];
+                    decoded.flux[c][i] = flux[i][c];
+                    decoded.dir[c][i] = dir[i][c];
+                }
+                fromSpherical(flux[i].w, dir[i].w, decoded, i);
+            }
+        });
+        addResult("32Bit", "Scalar", 3 * sizeof(float4), packMs, unpackMs);
+    }
+
+    //16 bit: RGBA32F position, RGBA16F flux and direction
+    {
+        std::vector<float4> pos(numPhotons);
+        std::vector<Half4> flux(numPhotons), dir(numPhotons);
+        double packMs = measureMs(repetitions, [&]() {
+            for (size_t i = 0; i < numPhotons; i++)
+            {
+                float theta, phi;
+                toSpherical(photons.faceN[0][i], photons.faceN[1][i], photons.faceN[2][i], theta, phi);
+                pos[i] = float4(photons.pos[0][i], photons.pos[1][i], photons.pos[2][i], 0.f);
+                for (uint c = 0; c < 3; c++)
+                {
+                    flux[i].v[c] = floatToHalf(photons.flux[c][i]);
+                    dir[i].v[c] = floatToHalf(photons.dir[c][i]);
+                }
+                flux[i].v[3] = floatToHalf(theta);
+                dir[i].v[3] = floatToHalf(phi);
+            }
+        });
+        double unpackMs = measureMs(repetitions, [&]() {
+            for (size_t i = 0; i < numPhotons; i++)
+            {
+                for (uint c = 0; c < 3; c++)
+                {
+                    decoded.pos[c][i] = pos[i][c];
+                    decoded.flux[c][i] = halfToFloat(flux[i].v[c]);
+                    decoded.dir[c][i] = halfToFloat(dir[i].v[c]);
+                }
+                fromSpherical(halfToFloat(flux[i].v[3]), halfToFloat(dir[i].v[3]), decoded, i);
+            }
+        });
+        addResult("16Bit", "Scalar", sizeof(float4) + 2 * sizeof(Half4), packMs, unpackMs);
+    }
+
+    //Compact
+    {
+        std::vector<uint4> packed;
+        for (bool useAVX2 : { false, true })
+        {
+            if (useAVX2 && !PhotonMapperSimd::hasAVX2()) continue;
+            double packMs = measureMs(repetitions, [&]() { PhotonPacking::pack(photons, cellScale, packed, useAVX2); });
+            double unpackMs = measureMs(repetitions, [&]() { PhotonPacking::unpack(packed, cells, cellScale, decoded, useAVX2); });
+            addResult("Compact", useAVX2 ? "AVX2" : "Scalar", kPackedPhotonBytes, packMs, unpackMs);
+        }
+    }
+}
@@ -0,0 +1,178 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonRadixSort.h"
+#include "../../RenderPasses/PhotonMapperCommon/SpatialHash.slang"
+#include <chrono>
+#include <numeric>
+#include <random>
+
+namespace
+{
+    template<typename Func>
+    double measureMs(uint repetitions, Func func)
+    {
+        if (repetitions == 0) return 0.0;
+        func();     //warm up
+        auto start = std::chrono::steady_clock::now();
+        for (uint r = 0; r < repetitions; r++) func();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+    }
+
+    std::vector<uint> createRandomKeys(size_t count, uint keyBits, std::mt19937& rng)
+    {
+        const uint mask = keyBits >= 32 ? ~0u : (1u << keyBits) - 1;
+        std::vector<uint> keys(count);
+        for (uint& k : keys) k = rng() & mask;
+        return keys;
+    }
+
+    uint64_t countMismatches(const std::vector<uint>& a, const std::vector<uint>& b)
+    {
+        if (a.size() != b.size()) return std::max(a.size(), b.size());
+        uint64_t mismatches = 0;
+        for (size_t i = 0; i < a.size(); i++)
+            if (a[i] != b[i]) mismatches++;
+        return mismatches;
+    }
+
+    //Photon as the 32 bit info format stores it: position and flux
+    struct GatherPhoton
+    {
+        float4 pos;
+        float4 flux;
+    };
+}
+
+CPU_TEST(PhotonRadixSort_SortCpu)
+{
+    //The single and multithreaded sort against std::stable_sort of the indices
+    std::mt19937 rng(1);
+    WorkStealingThreadPool pool;
+    const uint sizes[] = { 0, 1, 1000, 100003, 1 << 20 };
+    const uint keyBits[] = { 32, 30, 12 };
+    for (uint numKeys : sizes)
+    {
+        for (uint bits : keyBits)
+        {
+            const std::vector<uint> keys = createRandomKeys(numKeys, bits, rng);
+
+            std::vector<uint> refValues(numKeys);
+            std::iota(refValues.begin(), refValues.end(), 0u);
+            std::stable_sort(refValues.begin(), refValues.end(), [&](uint a, uint b) { return keys[a] < keys[b]; });
+            std::vector<uint> refKeys(numKeys);
+            for (uint i = 0; i < numKeys; i++) refKeys[i] = keys[refValues[i]];
+
+            for (WorkStealingThreadPool* pPool : { (WorkStealingThreadPool*)nullptr, &pool })
+            {
+                std::vector<uint> sortedKeys = keys;
+                std::vector<uint> sortedValues(numKeys);
+                std::iota(sortedValues.begin(), sortedValues.end(), 0u);
+                PhotonRadixSort::sortCpu(sortedKeys, sortedValues, bits, pPool);
+                EXPECT_EQ(countMismatches(refKeys, sortedKeys) + countMismatches(refValues, sortedValues), uint64_t(0))
+                    << numKeys << " keys, " << bits << " bits" << (pPool ? ", MT" : "");
+            }
+        }
+    }
+}
+
+BENCHMARK(PhotonRadixSort_SortBenchmark)
+{
+    //The CPU sort and the photon gather bandwidth with photons in generation order and in Morton order. The gather reads
+    //every photon of every cell of a synthetic interior through the cell's photon index list, like the hash collect does.
+    //Both orders read the same lists, only the photon memory order differs
+    const uint numPhotons = 1 << 22;
+    const uint repetitions = 4;
+    WorkStealingThreadPool pool;
+
+    //Photons on the walls of a box of 400^3 cells, about 4 photons per occupied cell
+    const float extent = 400.f;
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> u(0.f, extent);
+    std::vector<GatherPhoton> photons(numPhotons);
+    std::vector<uint> keys(numPhotons);
+    for (uint i = 0; i < numPhotons; i++)
+    {
+        float3 p = float3(u(rng), u(rng), u(rng));
+        const uint wall = rng() % 6;
+        p[wall % 3] = wall < 3 ? 0.f : extent - 1.f;
+        photons[i].pos = float4(p, 0.f);
+        photons[i].flux = float4(1.f, 0.5f, 0.25f, 0.f);
+        keys[i] = hashMorton(int3(floor(p)));
+    }
+
+    ctx.log() << "test,elements,ms,rate,unit\n";
+    for (WorkStealingThreadPool* pPool : { (WorkStealingThreadPool*)nullptr, &pool })
+    {
+        std::vector<uint> k, v(numPhotons);
+        const double ms = measureMs(repetitions, [&]() {
+            k = keys;
+            std::iota(v.begin(), v.end(), 0u);
+            PhotonRadixSort::sortCpu(k, v, 30, pPool);
+        });
+        ctx.log() << (pPool ? "Sort CPU MT," : "Sort CPU,") << numPhotons << "," << ms << "," << (ms > 0.0 ? numPhotons / (ms * 1e3) : 0.0) << ",MKeys/s\n";
+    }
+
+    //Cells in Morton order. The cell lists reference the photons in generation order
+    std::vector<uint> sortedKeys = keys;
+    std::vector<uint> order(numPhotons);
+    std::iota(order.begin(), order.end(), 0u);
+    PhotonRadixSort::sortCpu(sortedKeys, order, 30, &pool);
+    std::vector<uint> cellEnd;
+    for (uint i = 1; i <= numPhotons; i++)
+        if (i == numPhotons || sortedKeys[i] != sortedKeys[i - 1]) cellEnd.push_back(i);
+
+    std::vector<GatherPhoton> sortedPhotons(numPhotons);
+    std::vector<uint> sortedOrder(numPhotons);
+    for (uint i = 0; i < numPhotons; i++) {
+        sortedPhotons[i] = photons[order[i]];
+        sortedOrder[i] = i;
+    }
+
+    auto measureGather = [&](const char* test, const std::vector<GatherPhoton>& data, const std::vector<uint>& indices) {
+        volatile float sink = 0.f;
+        const double ms = measureMs(repetitions, [&]() {
+            float sum = 0.f;
+            uint begin = 0;
+            for (uint end : cellEnd) {
+                float3 cellSum = float3(0.f);
+                for (uint i = begin; i < end; i++) {
+                    const GatherPhoton& p = data[indices[i]];
+                    cellSum += float3(p.flux.x, p.flux.y, p.flux.z) * p.pos.w;
+                }
+                sum += cellSum.x + cellSum.y + cellSum.z;
+                begin = end;
+            }
+            sink = sum;
+        });
+        ctx.log() << test << "," << numPhotons << "," << ms << "," << (ms > 0.0 ? double(numPhotons) * (sizeof(GatherPhoton) + sizeof(uint)) / (ms * 1e6) : 0.0) << ",GB/s\n";
+    };
+    measureGather("Gather Unsorted", photons, order);
+    measureGather("Gather Sorted", sortedPhotons, sortedOrder);
+}
@@ -0,0 +1,170 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonSphereBVH.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+
+namespace
+{
+    const float kPi = 3.14159265358979323846f;
+
+    //Photons on the walls of a box with edge length extent. With caustic a tenth of the photons is focused into a spot on the floor
+    std::vector<float3> createInteriorPhotons(uint numPhotons, float extent, bool caustic, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        std::vector<float3> positions(numPhotons);
+        for (uint i = 0; i < numPhotons; i++)
+        {
+            float3 p = float3(u(rng), u(rng), u(rng)) * extent;
+            if (caustic && i % 10 == 0) {
+                p = float3(extent * (0.5f + 0.02f * u(rng)), 0.f, extent * (0.5f + 0.02f * u(rng)));
+            }
+            else {
+                const uint wall = rng() % 6;
+                p[wall % 3] = wall < 3 ? 0.f : extent;
+            }
+            positions[i] = p;
+        }
+        return positions;
+    }
+
+    std::vector<uint> queryBruteForce(const std::vector<float3>& centers, float radius, const float3& posW)
+    {
+        std::vector<uint> result;
+        for (uint i = 0; i < centers.size(); i++)
+        {
+            const float3 d = centers[i] - posW;
+            if (dot(d, d) <= radius * radius) result.push_back(i);
+        }
+        return result;
+    }
+}
+
+CPU_TEST(PhotonSphereBVH_Query)
+{
+    //Both modes single and multithreaded against brute force. Every photon has to be in exactly one leaf and all bounds conservative
+    const uint numQueries = 1024;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> u(0.f, 1.f);
+    WorkStealingThreadPool pool;
+    const float extent = 20.f;
+    const float radius = 0.5f;
+    const uint sizes[] = { 0, 1, 2, 3, 5, 17, 1000, 100003, 1 << 18 };
+    for (uint numPhotons : sizes)
+    {
+        std::vector<float3> centers = createInteriorPhotons(numPhotons, extent, true, rng);
+        //Coincident photons give equal Morton codes and centroid bounds without extent
+        for (uint i = 7; i < numPhotons; i += 7) centers[i] = centers[i - 1];
+
+        //Half of the queries close to photons, the rest anywhere in the box
+        std::vector<float3> queries(numQueries);
+        for (uint q = 0; q < numQueries; q++)
+        {
+            const float3 jitter = (float3(u(rng), u(rng), u(rng)) * 2.f - 1.f) * radius;
+            queries[q] = numPhotons > 0 && q % 2 == 0 ? centers[rng() % numPhotons] + jitter : float3(u(rng), u(rng), u(rng)) * extent;
+        }
+        std::vector<std::vector<uint>> reference(numQueries);
+        for (uint q = 0; q < numQueries; q++) reference[q] = queryBruteForce(centers, radius, queries[q]);
+
+        for (PhotonSphereBVH::BuildMode mode : { PhotonSphereBVH::BuildMode::LBVH, PhotonSphereBVH::BuildMode::BinnedSAH })
+        {
+            for (bool multithreaded : { false, true })
+            {
+                const std::string test = std::string(PhotonSphereBVH::getBuildModeName(mode)) + (multithreaded ? " MT, " : ", ") + std::to_string(numPhotons) + " photons";
+                PhotonSphereBVH bvh;
+                bvh.build(centers, radius, mode, multithreaded ? &pool : nullptr);
+                EXPECT_EQ(bvh.countStructureErrors(centers), 0u) << test;
+
+                uint mismatches = 0;
+                std::vector<uint> found;
+                for (uint q = 0; q < numQueries; q++)
+                {
+                    found.clear();
+                    bvh.query(queries[q], found);
+                    std::sort(found.begin(), found.end());
+                    if (found != reference[q]) mismatches++;
+                }
+                EXPECT_EQ(mismatches, 0u) << test;
+            }
+        }
+    }
+}
+
+BENCHMARK(PhotonSphereBVH_BuildBenchmark)
+{
+    //Build and query for 2^16 to 2^22 photons on the walls of a box with a bright caustic spot. The queries are spread
+    //evenly over the walls and the radius is set so that a query outside the caustic spot finds about 16 photons
+    const uint maxPhotons = 1 << 22;
+    const uint photonsPerQuery = 16;
+    const uint numQueries = 1 << 16;
+    WorkStealingThreadPool pool;
+    std::mt19937 rng(1234);
+    const float extent = 100.f;
+    const std::vector<float3> queries = createInteriorPhotons(numQueries, extent, false, rng);
+    ctx.log() << "test,photons,radius,buildMs,mPhotonsPerSec,queryNs,nodesPerQuery,spheresPerQuery,photonsPerQuery,sahCost,memoryMB\n";
+    for (uint numPhotons = 1 << 16; numPhotons <= maxPhotons; numPhotons *= 4)
+    {
+        const std::vector<float3> centers = createInteriorPhotons(numPhotons, extent, true, rng);
+        //Nine tenths of the photons are on the six walls, a query on a wall covers a disk of the radius
+        const float wallDensity = 0.9f * numPhotons / (6.f * extent * extent);
+        const float radius = std::sqrt(photonsPerQuery / (wallDensity * kPi));
+
+        for (PhotonSphereBVH::BuildMode mode : { PhotonSphereBVH::BuildMode::LBVH, PhotonSphereBVH::BuildMode::BinnedSAH })
+        {
+            for (bool multithreaded : { false, true })
+            {
+                PhotonSphereBVH bvh;
+                bvh.build(centers, radius, mode, multithreaded ? &pool : nullptr);     //warm up
+                auto start = std::chrono::steady_clock::now();
+                bvh.build(centers, radius, mode, multithreaded ? &pool : nullptr);
+                const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                //Time without the counters, then count in a second run
+                std::vector<uint> found;
+                start = std::chrono::steady_clock::now();
+                for (const float3& q : queries)
+                {
+                    found.clear();
+                    bvh.query(q, found);
+                }
+                const double queryNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numQueries;
+                PhotonSphereBVH::QueryStats stats;
+                found.clear();
+                for (const float3& q : queries) bvh.query(q, found, &stats);
+
+                ctx.log() << PhotonSphereBVH::getBuildModeName(mode) << (multithreaded ? " CPU MT" : " CPU") << "," << numPhotons << "," << radius << "," << ms << ","
+                          << numPhotons / (ms * 1e3) << "," << queryNs << "," << double(stats.nodesVisited) / numQueries << "," << double(stats.spheresTested) / numQueries << ","
+                          << double(found.size()) / numQueries << "," << bvh.getSahCost() << "," << bvh.getSizeBytes() / (1024.0 * 1024.0) << "\n";
+            }
+        }
+    }
+}
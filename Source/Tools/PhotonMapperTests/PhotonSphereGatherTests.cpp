@@ -0,0 +1,189 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonSphereGather.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonAccelerationStructure.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+
+/** Photon lists of the CPU gather of the AS photon mapper against brute force over the AABBs of all ring slots.
+*/
+namespace
+{
+    struct SlotPhotons
+    {
+        std::vector<uint8_t> aabbs;         ///< kAABBStride bytes per photon, like the AABB buffer of the slot
+        std::vector<float3> centers;
+        std::vector<bool> cleared;          ///< AABB is zero like a photon the generate pass did not write
+    };
+
+    SlotPhotons createSlot(uint count, float extent, float radius, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        SlotPhotons slot;
+        slot.aabbs.resize(size_t(count) * PhotonAccelerationStructure::kAABBStride, 0);
+        slot.centers.resize(count);
+        slot.cleared.resize(count);
+        for (uint i = 0; i < count; i++)
+        {
+            slot.centers[i] = float3(u(rng), u(rng), u(rng)) * extent;
+            //The tail of a slot is not written if fewer photons than the estimate are stored
+            slot.cleared[i] = i % 11 == 5 || i + count / 8 >= count;
+            if (slot.cleared[i]) continue;
+            const float3 c = slot.centers[i];
+            const float bounds[6] = { c.x - radius, c.y - radius, c.z - radius, c.x + radius, c.y + radius, c.z + radius };
+            std::memcpy(slot.aabbs.data() + size_t(i) * PhotonAccelerationStructure::kAABBStride, bounds, sizeof(bounds));
+        }
+        return slot;
+    }
+
+    std::vector<uint> gatherBruteForce(const std::vector<SlotPhotons>& slots, uint slotCapacity, const float4& posW, float radius)
+    {
+        std::vector<uint> result;
+        if (posW.w == 0.f || radius <= 0.f) return result;
+        for (uint s = 0; s < slots.size(); s++)
+        {
+            for (uint i = 0; i < slots[s].centers.size(); i++)
+            {
+                const float3 d = slots[s].centers[i] - float3(posW.x, posW.y, posW.z);
+                if (!slots[s].cleared[i] && dot(d, d) < radius * radius) result.push_back(s * slotCapacity + i);
+            }
+        }
+        return result;
+    }
+}
+
+CPU_TEST(PhotonSphereGather_Lists)
+{
+    //Three ring slots per map, the global map with a larger radius. Queries use the build radius and a smaller one like after an SPPM step
+    const uint generations = 3;
+    const uint capacity[2] = { 3000, 5000 };
+    const float buildRadius[2] = { 0.3f, 0.6f };
+    const float extent = 10.f;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> u(0.f, 1.f);
+    WorkStealingThreadPool pool;
+
+    std::vector<SlotPhotons> slots[2];
+    for (uint map = 0; map < 2; map++)
+        for (uint s = 0; s < generations; s++) slots[map].push_back(createSlot(capacity[map], extent, buildRadius[map], rng));
+
+    //Every fourth pixel has no hit. The pixel count is not a multiple of the query chunks
+    const uint pixelCount = 3000;
+    std::vector<float4> positions(pixelCount);
+    for (uint p = 0; p < pixelCount; p++)
+        positions[p] = float4(u(rng) * extent, u(rng) * extent, u(rng) * extent, p % 4 == 3 ? 0.f : 1.f);
+
+    for (PhotonSphereBVH::BuildMode mode : { PhotonSphereBVH::BuildMode::LBVH, PhotonSphereBVH::BuildMode::BinnedSAH })
+    {
+        PhotonSphereGather gather;
+        gather.setGenerationCount(generations);
+        for (uint map = 0; map < 2; map++)
+            for (uint s = 0; s < generations; s++) gather.buildSlot(map, s, slots[map][s].aabbs, s * capacity[map], buildRadius[map], mode, &pool);
+
+        uint expectedPhotons[2] = {};
+        for (uint map = 0; map < 2; map++)
+            for (const SlotPhotons& slot : slots[map]) expectedPhotons[map] += uint(std::count(slot.cleared.begin(), slot.cleared.end(), false));
+        EXPECT_EQ(gather.getPhotonCount(0), expectedPhotons[0]);
+        EXPECT_EQ(gather.getPhotonCount(1), expectedPhotons[1]);
+
+        for (float radiusScale : { 1.f, 0.7f })
+        {
+            for (bool multithreaded : { false, true })
+            {
+                const std::string test = std::string(PhotonSphereBVH::getBuildModeName(mode)) + ", radius scale " + std::to_string(radiusScale) + (multithreaded ? ", MT" : "");
+                const std::array<float, 2> radius = { buildRadius[0] * radiusScale, buildRadius[1] * radiusScale };
+                PhotonSphereGather::Lists lists;
+                PhotonSphereGather::Stats stats;
+                gather.query(positions, radius, lists, multithreaded ? &pool : nullptr, &stats);
+
+                EXPECT_EQ(lists.offsets.size(), size_t(2 * pixelCount + 1)) << test;
+                if (lists.offsets.size() != size_t(2 * pixelCount + 1)) continue;
+                EXPECT_EQ(lists.offsets.back(), uint(lists.photons.size())) << test;
+                EXPECT_EQ(stats.photonsFound, uint64_t(lists.photons.size())) << test;
+                uint mismatches = 0;
+                for (uint p = 0; p < pixelCount; p++)
+                {
+                    for (uint map = 0; map < 2; map++)
+                    {
+                        const uint list = 2 * p + map;
+                        std::vector<uint> found(lists.photons.begin() + lists.offsets[list], lists.photons.begin() + lists.offsets[list + 1]);
+                        std::sort(found.begin(), found.end());
+                        if (found != gatherBruteForce(slots[map], capacity[map], positions[p], radius[map])) mismatches++;
+                    }
+                }
+                EXPECT_EQ(mismatches, 0u) << test;
+            }
+        }
+    }
+}
+
+CPU_TEST(PhotonSphereGather_DisabledMapsAndClearedSlots)
+{
+    const uint capacity = 2000;
+    const float radius = 1.f;
+    std::mt19937 rng(5);
+    const SlotPhotons slot = createSlot(capacity, 4.f, radius, rng);
+
+    PhotonSphereGather gather;
+    gather.setGenerationCount(2);
+    for (uint map = 0; map < 2; map++)
+        for (uint s = 0; s < 2; s++) gather.buildSlot(map, s, slot.aabbs, s * capacity, radius, PhotonSphereBVH::BuildMode::LBVH);
+
+    std::vector<float4> positions;
+    for (uint i = 0; i < 64; i++)
+        if (!slot.cleared[i]) positions.push_back(float4(slot.centers[i], 1.f));
+
+    //A radius of 0 skips the caustic map, every hit point is a photon center of both slots of the global map
+    PhotonSphereGather::Lists lists;
+    gather.query(positions, { 0.f, radius }, lists);
+    uint causticPhotons = 0, missingGlobal = 0;
+    for (uint p = 0; p < positions.size(); p++)
+    {
+        causticPhotons += lists.offsets[2 * p + 1] - lists.offsets[2 * p];
+        if (lists.offsets[2 * p + 2] - lists.offsets[2 * p + 1] < 2) missingGlobal++;
+    }
+    EXPECT_EQ(causticPhotons, 0u);
+    EXPECT_EQ(missingGlobal, 0u);
+
+    //A stale slot has no photons any more, its indices do not show up
+    gather.clearSlot(1, 1);
+    EXPECT_EQ(gather.getPhotonCount(1), gather.getPhotonCount(0) / 2);
+    gather.query(positions, { radius, radius }, lists);
+    uint staleIndices = 0;
+    for (uint p = 0; p < positions.size(); p++)
+        for (uint i = lists.offsets[2 * p + 1]; i < lists.offsets[2 * p + 2]; i++) staleIndices += lists.photons[i] >= capacity ? 1 : 0;
+    EXPECT_EQ(staleIndices, 0u);
+
+    //Dropping all slots leaves empty lists
+    gather.setGenerationCount(2);
+    gather.query(positions, { radius, radius }, lists);
+    EXPECT(lists.photons.empty());
+}
@@ -0,0 +1,218 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/PhotonStreamFormat.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/** Layouts of the linear photon storage and the CPU decoding of buffer copies.
+*/
+namespace
+{
+    using Infos = PhotonStreamFormat::Infos;
+
+    const uint kCapacities[] = { 0, 1, 7, 511, 513, 1000, 4097, 100003 };
+
+    uint64_t alignUp(uint64_t value)
+    {
+        return (value + PhotonStreamFormat::kAlignment - 1) / PhotonStreamFormat::kAlignment * PhotonStreamFormat::kAlignment;
+    }
+
+    /** Half bits of a float that is exactly representable as a normal half or zero.
+    */
+    uint16_t toHalf(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+        if ((bits & 0x7fffffffu) == 0) return sign;
+        const uint32_t exponent = ((bits >> 23) & 0xffu) - 112;
+        return static_cast<uint16_t>(sign | (exponent << 10) | ((bits >> 13) & 0x3ffu));
+    }
+
+    /** Writes an element like storePhotonStream.
+    */
+    void storeElement(std::vector<uint8_t>& data, uint offset, uint stride, uint index, float4 value)
+    {
+        uint8_t* pElement = data.data() + offset + uint64_t(index) * stride;
+        if (stride == 8)
+        {
+            const uint16_t h[4] = { toHalf(value.x), toHalf(value.y), toHalf(value.z), toHalf(value.w) };
+            std::memcpy(pElement, h, sizeof(h));
+        }
+        else
+            std::memcpy(pElement, &value, sizeof(value));
+    }
+
+    //Values are multiples of 1/4 below 2048, so they are exact in half
+    float4 testValue(uint stream, uint index)
+    {
+        const float base = float(index % 500);
+        return float4(base + 0.25f * stream, -base - 0.5f, 0.75f * stream, base * 0.5f + 1.f);
+    }
+
+    bool equal(float4 a, float4 b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+    }
+}
+
+CPU_TEST(PhotonStreamFormat_LayoutExamples)
+{
+    //Half infos with a position stream (hash pass, 8/16 bit formats)
+    PhotonStreamLayout layout = PhotonStreamFormat::createMapLayout(1000, Infos::Half, true);
+    EXPECT_EQ(layout.capacity, 1000u);
+    EXPECT_EQ(layout.posStride, 16u);
+    EXPECT_EQ(layout.fluxStride, 8u);
+    EXPECT_EQ(layout.dirStride, 8u);
+    EXPECT_EQ(layout.posOffset, 0u);
+    EXPECT_EQ(layout.fluxOffset, 16128u);       //16000 rounded up to 256
+    EXPECT_EQ(layout.dirOffset, 24320u);        //16128 + 8000 rounded up
+    EXPECT_EQ(layout.totalBytes, 32512u);       //24320 + 8000 rounded up
+
+    //Full infos without a position stream (AS pass, 32 bit format)
+    layout = PhotonStreamFormat::createMapLayout(513, Infos::Full, false);
+    EXPECT_EQ(layout.posStride, 0u);
+    EXPECT_EQ(layout.fluxStride, 16u);
+    EXPECT_EQ(layout.dirStride, 16u);
+    EXPECT_EQ(layout.posOffset, 0u);
+    EXPECT_EQ(layout.fluxOffset, 0u);
+    EXPECT_EQ(layout.dirOffset, 8448u);         //8208 rounded up
+    EXPECT_EQ(layout.totalBytes, 16896u);       //8448 + 8208 rounded up
+
+    //Compact records only use the flux stream, also in the hash pass
+    layout = PhotonStreamFormat::createMapLayout(777, Infos::Compact, true);
+    EXPECT_EQ(layout.posStride, 0u);
+    EXPECT_EQ(layout.fluxStride, 16u);
+    EXPECT_EQ(layout.dirStride, 0u);
+    EXPECT_EQ(layout.fluxOffset, 0u);
+    EXPECT_EQ(layout.totalBytes, 12544u);       //12432 rounded up
+
+    //An empty map still gets a bindable buffer
+    layout = PhotonStreamFormat::createMapLayout(0, Infos::Full, true);
+    EXPECT_EQ(layout.totalBytes, PhotonStreamFormat::kAlignment);
+}
+
+CPU_TEST(PhotonStreamFormat_LayoutInvariants)
+{
+    for (Infos infos : { Infos::Full, Infos::Half, Infos::Compact })
+    {
+        for (bool storePosition : { false, true })
+        {
+            for (uint capacity : kCapacities)
+            {
+                const PhotonStreamLayout layout = PhotonStreamFormat::createMapLayout(capacity, infos, storePosition);
+                const uint infoStride = infos == Infos::Full ? 16 : 8;
+                EXPECT_EQ(layout.capacity, capacity);
+                EXPECT_EQ(layout.posStride, storePosition && infos != Infos::Compact ? 16u : 0u);
+                EXPECT_EQ(layout.fluxStride, infos == Infos::Compact ? 16u : infoStride);
+                EXPECT_EQ(layout.dirStride, infos == Infos::Compact ? 0u : infoStride);
+
+                //Aligned, in order, without gaps beyond the alignment and without overlap
+                EXPECT_EQ(layout.posOffset, 0u);
+                EXPECT_EQ(layout.fluxOffset, alignUp(layout.posOffset + uint64_t(capacity) * layout.posStride)) << "capacity " << capacity;
+                EXPECT_EQ(layout.dirOffset, alignUp(layout.fluxOffset + uint64_t(capacity) * layout.fluxStride)) << "capacity " << capacity;
+                const uint64_t end = alignUp(layout.dirOffset + uint64_t(capacity) * layout.dirStride);
+                EXPECT_EQ(layout.totalBytes, std::max<uint64_t>(end, PhotonStreamFormat::kAlignment)) << "capacity " << capacity;
+                EXPECT_EQ(layout.fluxOffset % PhotonStreamFormat::kAlignment, 0u);
+                EXPECT_EQ(layout.dirOffset % PhotonStreamFormat::kAlignment, 0u);
+                EXPECT_EQ(layout.totalBytes % PhotonStreamFormat::kAlignment, 0u);
+            }
+        }
+    }
+}
+
+CPU_TEST(PhotonStreamFormat_ReadStreams)
+{
+    for (Infos infos : { Infos::Full, Infos::Half })
+    {
+        for (uint capacity : { 7u, 511u, 513u, 4097u })
+        {
+            const PhotonStreamLayout layout = PhotonStreamFormat::createMapLayout(capacity, infos, true);
+            std::vector<uint8_t> data(layout.totalBytes, 0);
+            for (uint i = 0; i < capacity; i++)
+            {
+                storeElement(data, layout.posOffset, layout.posStride, i, testValue(0, i));
+                storeElement(data, layout.fluxOffset, layout.fluxStride, i, testValue(1, i));
+                storeElement(data, layout.dirOffset, layout.dirStride, i, testValue(2, i));
+            }
+
+            //Asking for more photons than the capacity is clamped
+            const std::vector<float3> positions = PhotonStreamFormat::readPositions(data, 0, layout, capacity + 100);
+            const std::vector<float4> flux = PhotonStreamFormat::readFlux(data, 0, layout, capacity);
+            const std::vector<float4> dir = PhotonStreamFormat::readDir(data, 0, layout, capacity);
+            EXPECT_EQ(positions.size(), size_t(capacity));
+            EXPECT_EQ(flux.size(), size_t(capacity));
+            EXPECT_EQ(dir.size(), size_t(capacity));
+            uint mismatches = 0;
+            for (uint i = 0; i < std::min<uint>(capacity, uint(positions.size())); i++)
+            {
+                const float4 pos = testValue(0, i);
+                if (positions[i].x != pos.x || positions[i].y != pos.y || positions[i].z != pos.z) mismatches++;
+                if (!equal(flux[i], testValue(1, i))) mismatches++;
+                if (!equal(dir[i], testValue(2, i))) mismatches++;
+            }
+            EXPECT_EQ(mismatches, 0u) << (infos == Infos::Full ? "full" : "half") << " capacity " << capacity;
+
+            //A copy of only the direction stream, like PhotonStreams::readback of a sub range
+            const uint count = capacity / 2 + 1;
+            const std::vector<uint8_t> dirCopy(data.begin() + layout.dirOffset, data.begin() + layout.dirOffset + uint64_t(count) * layout.dirStride);
+            const std::vector<float4> dirPart = PhotonStreamFormat::readDir(dirCopy, layout.dirOffset, layout, count);
+            EXPECT_EQ(dirPart.size(), size_t(count));
+            mismatches = 0;
+            for (uint i = 0; i < std::min<uint>(count, uint(dirPart.size())); i++)
+                if (!equal(dirPart[i], testValue(2, i))) mismatches++;
+            EXPECT_EQ(mismatches, 0u) << "direction copy, capacity " << capacity;
+        }
+    }
+
+    //Streams that are not stored read as empty
+    const PhotonStreamLayout compact = PhotonStreamFormat::createMapLayout(513, Infos::Compact, true);
+    const std::vector<uint8_t> data(compact.totalBytes, 0);
+    EXPECT(PhotonStreamFormat::readPositions(data, 0, compact, 513).empty());
+    EXPECT(PhotonStreamFormat::readDir(data, 0, compact, 513).empty());
+}
+
+CPU_TEST(PhotonStreamFormat_HalfToFloat)
+{
+    EXPECT_EQ(PhotonStreamFormat::halfToFloat(0x3c00), 1.f);
+    EXPECT_EQ(PhotonStreamFormat::halfToFloat(0xc000), -2.f);
+    EXPECT_EQ(PhotonStreamFormat::halfToFloat(0x3800), 0.5f);
+    EXPECT_EQ(PhotonStreamFormat::halfToFloat(0x7bff), 65504.f);
+    EXPECT_EQ(PhotonStreamFormat::halfToFloat(0x0400), std::ldexp(1.f, -14));     //Smallest normal
+    EXPECT_EQ(PhotonStreamFormat::halfToFloat(0x0200), std::ldexp(1.f, -15));     //Denormals
+    EXPECT_EQ(PhotonStreamFormat::halfToFloat(0x0001), std::ldexp(1.f, -24));
+    EXPECT_EQ(PhotonStreamFormat::halfToFloat(0x0000), 0.f);
+    EXPECT(std::signbit(PhotonStreamFormat::halfToFloat(0x8000)));
+    EXPECT(std::isinf(PhotonStreamFormat::halfToFloat(0x7c00)));
+    EXPECT(std::isnan(PhotonStreamFormat::halfToFloat(0x7e00)));
+    for (float value : { 0.25f, -3.75f, 1000.5f, 2047.f })
+        EXPECT_EQ(PhotonStreamFormat::halfToFloat(toHalf(value)), value);
+}
@@ -0,0 +1,153 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "Falcor.h"
+#include "../../RenderPasses/PhotonMapperCommon/ProgressiveRadius.slang"
+#include <algorithm>
+#include <random>
+
+using namespace Falcor;
+
+/** CPU tests of the per pixel progressive radius update in ProgressiveRadius.slang.
+*/
+namespace
+{
+    const float kStartRadius = 0.05f;
+    const float kMinRadius = 0.0001f;
+    const float kAlpha = 0.7f;
+    const uint kIterations = 1000;
+    const double kPi = 3.14159265358979323846;
+
+    /** Photons on the unit square with a total flux of 1 per iteration. A part of them is in a gaussian peak at the center.
+    */
+    struct PhotonDistribution
+    {
+        const char* name;
+        uint photonsPerIteration;
+        float peakWeight;               ///< Fraction of the photons in the peak
+        float peakSigma;
+        double tolerance;               ///< Max relative error. 0 only requires a lower error than with the global radius
+
+        double getDensity(float2 p) const
+        {
+            const float2 d = p - float2(0.5f);
+            const double peak = std::exp(-double(glm::dot(d, d)) / (2.0 * peakSigma * peakSigma)) / (2.0 * kPi * peakSigma * peakSigma);
+            return (1.0 - peakWeight) + peakWeight * peak;
+        }
+    };
+}
+
+CPU_TEST(ProgressiveRadius_Update)
+{
+    //Compares the update with the same recurrence in double precision
+    std::mt19937 rng(1);
+    std::poisson_distribution<int> photonDist(4.0);
+    std::uniform_real_distribution<float> u(0.f, 1.f);
+    ProgressivePhotonStats stats = initProgressivePhotonStats(kStartRadius);
+    double refRadius = kStartRadius, refPhotons = 0.0, refFlux = 0.0;
+    double maxError = 0.0;
+    for (uint i = 0; i < 10000; i++)
+    {
+        //Skip some iterations without photons
+        const float photons = u(rng) < 0.2f ? 0.f : float(photonDist(rng));
+        const float flux = photons * u(rng);
+        const float oldRadius = stats.radius;
+        stats = updateProgressivePhotonStats(stats, photons, float3(flux), kAlpha, kMinRadius);
+
+        if (photons > 0.f)
+        {
+            const double newPhotons = refPhotons + kAlpha * photons;
+            const double radius = std::max(refRadius * std::sqrt(newPhotons / (refPhotons + photons)), double(kMinRadius));
+            refFlux = (refFlux + flux) * (radius * radius) / (refRadius * refRadius);
+            refRadius = radius;
+            refPhotons = newPhotons;
+        }
+
+        maxError = std::max({ maxError, std::abs(stats.radius - refRadius) / refRadius, std::abs(stats.photons - refPhotons) / std::max(refPhotons, 1.0),
+                              std::abs(stats.flux.x - refFlux) / std::max(refFlux, 1e-6) });
+        //The radius never grows and stays above the minimum
+        EXPECT_LE(stats.radius, oldRadius) << "iteration " << i;
+        EXPECT_GE(stats.radius, kMinRadius) << "iteration " << i;
+    }
+    EXPECT_LT(maxError, 1e-3);
+}
+
+CPU_TEST(ProgressiveRadius_Density)
+{
+    //Estimates the exact density of synthetic photon distributions at the center of the square. The estimate with one
+    //global radius that shrinks every iteration is the baseline of the caustic peak
+    const PhotonDistribution distributions[] = {
+        { "Uniform dense", 4096, 0.f, 1.f, 0.08 },
+        { "Uniform sparse", 256, 0.f, 1.f, 0.2 },
+        { "Caustic peak", 4096, 0.25f, 0.01f, 0.0 },
+    };
+
+    std::mt19937 rng(1);
+    for (const auto& dist : distributions)
+    {
+        const float2 query = float2(0.5f);
+        const double reference = dist.getDensity(query);
+
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        std::normal_distribution<float> n(0.f, dist.peakSigma);
+        const float photonFlux = 1.f / dist.photonsPerIteration;
+        ProgressivePhotonStats stats = initProgressivePhotonStats(kStartRadius);
+        float globalRadius = kStartRadius;
+        double globalSum = 0.0;
+        for (uint i = 0; i < kIterations; i++)
+        {
+            float photons = 0.f, globalPhotons = 0.f;
+            for (uint p = 0; p < dist.photonsPerIteration; p++)
+            {
+                const float2 pos = u(rng) < dist.peakWeight ? query + float2(n(rng), n(rng)) : float2(u(rng), u(rng));
+                const float2 d = pos - query;
+                const float d2 = glm::dot(d, d);
+                if (d2 < stats.radius * stats.radius) photons++;
+                if (d2 < globalRadius * globalRadius) globalPhotons++;
+            }
+            //Diffuse surface with a BSDF of 1, the flux is the photon count times the photon flux
+            stats = updateProgressivePhotonStats(stats, photons, float3(photons * photonFlux), kAlpha, kMinRadius);
+            globalSum += globalPhotons * photonFlux / (kPi * globalRadius * globalRadius);
+            const float itF = float(i + 1);
+            globalRadius = std::max(globalRadius * std::sqrt((itF + kAlpha) / (itF + 1.f)), kMinRadius);
+        }
+
+        const double error = std::abs(getProgressivePhotonRadiance(stats, kIterations).x - reference) / reference;
+        const double globalError = std::abs(globalSum / kIterations - reference) / reference;
+        ctx.log() << "    " << dist.name << ": error " << error << " (radius " << stats.radius << "), global radius error " << globalError << "\n";
+        //The peak is narrower than the radius, both estimates are biased until the radius is far below its width
+        if (dist.tolerance > 0.0)
+        {
+            EXPECT_LT(error, dist.tolerance) << dist.name;
+        }
+        else
+        {
+            EXPECT_LT(error, globalError) << dist.name;
+        }
+    }
+}
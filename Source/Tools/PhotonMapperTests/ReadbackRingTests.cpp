@@ -0,0 +1,142 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/ReadbackRing.h"
+
+namespace
+{
+    /** Runs one frame: sets the source, enqueues a copy, advances the emulated GPU and polls.
+        \return The result of poll().
+    */
+    bool runFrame(ReadbackRing& ring, FakeReadbackDevice& device, uint32_t value)
+    {
+        device.setSource(&value);
+        ring.enqueue();
+        device.advance();
+        return ring.poll();
+    }
+}
+
+CPU_TEST(ReadbackRing_Latency)
+{
+    for (uint32_t latency : { 0u, 1u, 2u, 3u })
+    {
+        auto pDevice = FakeReadbackDevice::create(sizeof(uint32_t), latency);
+        ReadbackRing ring;
+        ring.init(pDevice, latency + 1);
+        EXPECT(!ring.poll());
+        EXPECT(!ring.hasValue());
+
+        for (uint32_t frame = 0; frame < 20; frame++)
+        {
+            const bool updated = runFrame(ring, *pDevice, 100 + frame);
+            //The first copy lands latency frames after it was enqueued, one advance() already happened in runFrame()
+            const uint32_t firstFrame = latency > 0 ? latency - 1 : 0;
+            if (frame < firstFrame)
+            {
+                EXPECT(!updated) << "latency " << latency << ", frame " << frame;
+                EXPECT(!ring.hasValue()) << "latency " << latency << ", frame " << frame;
+                EXPECT_EQ(ring.getValue<uint32_t>(), 0u) << "latency " << latency << ", frame " << frame;
+            }
+            else
+            {
+                EXPECT(updated) << "latency " << latency << ", frame " << frame;
+                EXPECT_EQ(ring.getValue<uint32_t>(), 100 + frame - firstFrame) << "latency " << latency << ", frame " << frame;
+            }
+        }
+        EXPECT_EQ(pDevice->getInvalidReadCount(), 0u) << "latency " << latency;
+        EXPECT_EQ(ring.getStallCount(), 0u) << "latency " << latency;
+    }
+}
+
+CPU_TEST(ReadbackRing_Stall)
+{
+    //Fewer slots than the GPU latency: enqueue() has to wait, which bounds the latency to the slot count
+    const uint32_t slotCount = 2;
+    auto pDevice = FakeReadbackDevice::create(sizeof(uint32_t), 4);
+    ReadbackRing ring;
+    ring.init(pDevice, slotCount);
+    for (uint32_t frame = 0; frame < 20; frame++) runFrame(ring, *pDevice, frame);
+
+    EXPECT_GT(ring.getStallCount(), 0u);
+    EXPECT_GT(pDevice->getWaitCount(), 0u);
+    EXPECT_LE(ring.getMaxLatency(), uint64_t(slotCount));
+    EXPECT_EQ(pDevice->getInvalidReadCount(), 0u);
+}
+
+CPU_TEST(ReadbackRing_Invalidate)
+{
+    const uint32_t latency = 3;
+    auto pDevice = FakeReadbackDevice::create(sizeof(uint32_t), latency);
+    ReadbackRing ring;
+    ring.init(pDevice, latency + 1);
+    for (uint32_t frame = 0; frame < 10; frame++) runFrame(ring, *pDevice, 1);
+    EXPECT(ring.hasValue());
+
+    //Copies of the old source are still in flight. None of them may show up after invalidate()
+    ring.invalidate();
+    EXPECT(!ring.hasValue());
+    EXPECT_EQ(ring.getValue<uint32_t>(), 0u);
+    for (uint32_t frame = 0; frame < 10; frame++)
+    {
+        const bool updated = runFrame(ring, *pDevice, 2);
+        if (frame < latency - 1)
+        {
+            EXPECT(!updated) << "frame " << frame;
+            EXPECT(!ring.hasValue()) << "frame " << frame;
+        }
+        else
+        {
+            EXPECT(updated) << "frame " << frame;
+            EXPECT_EQ(ring.getValue<uint32_t>(), 2u) << "frame " << frame;
+        }
+    }
+    EXPECT_EQ(pDevice->getInvalidReadCount(), 0u);
+}
+
+CPU_TEST(ReadbackRing_NewestWins)
+{
+    //Several copies finish within one frame; poll() has to return the newest one
+    const uint32_t latency = 3;
+    auto pDevice = FakeReadbackDevice::create(sizeof(uint32_t), latency);
+    ReadbackRing ring;
+    ring.init(pDevice, latency + 1);
+    for (uint32_t value = 1; value <= latency; value++)
+    {
+        pDevice->setSource(&value);
+        ring.enqueue();
+    }
+    EXPECT(!ring.poll());
+
+    for (uint32_t i = 0; i < latency; i++) pDevice->advance();
+    EXPECT(ring.poll());
+    EXPECT_EQ(ring.getValue<uint32_t>(), latency);
+    EXPECT_EQ(ring.getLatency(), 0u);
+    EXPECT(!ring.poll());
+    EXPECT_EQ(pDevice->getInvalidReadCount(), 0u);
+}
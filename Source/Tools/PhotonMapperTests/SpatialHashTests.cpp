@@ -0,0 +1,269 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/SpatialHash.h"
+#include "../../RenderPasses/PhotonMapperCommon/SimdUtils.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+
+/** The AVX2 batch hash of SpatialHash against the scalar path and a benchmark of the hash functions on a photon distribution.
+*/
+namespace
+{
+    const SpatialHashFunction kHashFunctions[] = { SpatialHashFunction::Wang, SpatialHashFunction::Morton, SpatialHashFunction::Pcg };
+    const char* kHashFunctionNames[] = { "Wang", "Morton", "PCG" };
+
+    struct Result
+    {
+        SpatialHashFunction function = SpatialHashFunction::Wang;
+        uint bucketBits = 0;
+        uint numCells = 0;                  ///< Distinct occupied cells
+        double scalarMHashPerSec = 0.0;
+        double avx2MHashPerSec = 0.0;       ///< 0 if AVX2 is not available
+        double collisionRate = 0.0;         ///< Fraction of cells that share their home bucket with another cell
+        double avgProbeLength = 0.0;        ///< Mean quadratic probe steps until the cell's bucket is found
+        uint maxProbeLength = 0;
+        double failedInsertRate = 0.0;      ///< Fraction of cells that did not find a bucket within the probe limit
+        double neighbourLocality = 0.0;     ///< Fraction of +x/+y/+z neighbour pairs whose buckets are within localityWindow
+    };
+
+    template<typename Func>
+    double measureMHashPerSec(size_t count, uint repetitions, Func func)
+    {
+        if (count == 0 || repetitions == 0) return 0.0;
+        func();     //warm up
+        auto start = std::chrono::steady_clock::now();
+        for (uint r = 0; r < repetitions; r++) func();
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        return seconds > 0.0 ? (double(count) * repetitions) / seconds * 1e-6 : 0.0;
+    }
+
+    struct CellKeyHash
+    {
+        size_t operator()(const int3& c) const { return hashWang(c); }
+    };
+
+    struct CellKeyEqual
+    {
+        bool operator()(const int3& a, const int3& b) const { return a.x == b.x && a.y == b.y && a.z == b.z; }
+    };
+
+    //Photons on the walls of a box of extent^3 cells. A tenth of the photons is focused into a caustic spot of 2x2 cells on the floor
+    std::vector<float3> createInteriorPhotons(uint numPhotons, float extent, std::mt19937& rng)
+    {
+        std::uniform_real_distribution<float> u(0.f, 1.f);
+        std::vector<float3> positions(numPhotons);
+        for (uint i = 0; i < numPhotons; i++)
+        {
+            float3 p = float3(u(rng), u(rng), u(rng)) * extent;
+            if (i % 10 == 0) {
+                p = float3(extent * 0.5f + 2.f * u(rng), 0.f, extent * 0.5f + 2.f * u(rng));
+            }
+            else {
+                const uint wall = rng() % 6;
+                p[wall % 3] = wall < 3 ? 0.f : extent - 1.f;
+            }
+            positions[i] = p;
+        }
+        return positions;
+    }
+}
+
+CPU_TEST(SpatialHash_AVX2MatchesScalar)
+{
+    if (!PhotonMapperSimd::hasAVX2())
+    {
+        ctx.log() << "    AVX2 is not available, skipped\n";
+        return;
+    }
+
+    //Counts that are not a multiple of 8 also run the scalar tail of the AVX2 kernel
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int32_t> coord(-(1 << 22), 1 << 22);
+    const size_t count = 100003;
+    std::vector<int32_t> x(count), y(count), z(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        x[i] = coord(rng); y[i] = coord(rng); z[i] = coord(rng);
+    }
+
+    std::vector<uint32_t> scalar(count), avx2(count);
+    for (SpatialHashFunction function : kHashFunctions)
+    {
+        SpatialHash::hashCells(function, x.data(), y.data(), z.data(), scalar.data(), count, false);
+        SpatialHash::hashCells(function, x.data(), y.data(), z.data(), avx2.data(), count, true);
+        size_t mismatches = 0, referenceMismatches = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (scalar[i] != avx2[i]) mismatches++;
+            if (scalar[i] != spatialHash(function, int3(x[i], y[i], z[i]))) referenceMismatches++;
+        }
+        EXPECT_EQ(referenceMismatches, size_t(0)) << kHashFunctionNames[(uint)function];
+        EXPECT_EQ(mismatches, size_t(0)) << kHashFunctionNames[(uint)function];
+    }
+}
+
+BENCHMARK(SpatialHash_FunctionBenchmark)
+{
+    //For every hash function and bucket count: the hash throughput, the home bucket collision rate, the quadratic probe
+    //length as used by the hash passes and how close the buckets of neighbouring cells are
+    const std::vector<uint> bucketBitsList = { 16, 18, 20, 22, 24 };
+    const uint quadraticProbeIterations = 10;
+    const uint throughputRepetitions = 8;
+    const uint localityWindow = 16;         ///< Max bucket distance for a neighbour pair to count as local
+
+    std::mt19937 rng(1234);
+    const std::vector<float3> positions = createInteriorPhotons(1 << 22, 400.f, rng);
+    const float cellScale = 1.f;
+
+    //Cells of all photons (for throughput) and the distinct cells in order of first occurrence (for the table statistics)
+    std::vector<int32_t> cx(positions.size()), cy(positions.size()), cz(positions.size());
+    std::vector<int3> distinctCells;
+    std::unordered_map<int3, uint, CellKeyHash, CellKeyEqual> cellIndex;
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        int3 cell = int3(glm::floor(positions[i] * cellScale));
+        cx[i] = cell.x; cy[i] = cell.y; cz[i] = cell.z;
+        if (cellIndex.emplace(cell, static_cast<uint>(distinctCells.size())).second)
+            distinctCells.push_back(cell);
+    }
+
+    std::vector<int32_t> dx(distinctCells.size()), dy(distinctCells.size()), dz(distinctCells.size());
+    for (size_t i = 0; i < distinctCells.size(); i++)
+    {
+        dx[i] = distinctCells[i].x; dy[i] = distinctCells[i].y; dz[i] = distinctCells[i].z;
+    }
+
+    std::vector<Result> results;
+    std::vector<uint32_t> hashes(positions.size());
+    std::vector<uint32_t> cellHashes(distinctCells.size());
+    std::vector<uint32_t> neighbourHashes[3];
+    for (auto& n : neighbourHashes) n.resize(distinctCells.size());
+
+    for (SpatialHashFunction function : kHashFunctions)
+    {
+        const size_t count = positions.size();
+        double scalar = measureMHashPerSec(count, throughputRepetitions, [&]() {
+            SpatialHash::hashCells(function, cx.data(), cy.data(), cz.data(), hashes.data(), count, false);
+        });
+        double avx2 = PhotonMapperSimd::hasAVX2() ? measureMHashPerSec(count, throughputRepetitions, [&]() {
+            SpatialHash::hashCells(function, cx.data(), cy.data(), cz.data(), hashes.data(), count, true);
+        }) : 0.0;
+
+        SpatialHash::hashCells(function, dx.data(), dy.data(), dz.data(), cellHashes.data(), distinctCells.size());
+        for (int axis = 0; axis < 3; axis++)
+        {
+            std::vector<int32_t> nx = dx, ny = dy, nz = dz;
+            for (size_t i = 0; i < distinctCells.size(); i++)
+            {
+                if (axis == 0) nx[i]++;
+                else if (axis == 1) ny[i]++;
+                else nz[i]++;
+            }
+            SpatialHash::hashCells(function, nx.data(), ny.data(), nz.data(), neighbourHashes[axis].data(), distinctCells.size());
+        }
+
+        for (uint bits : bucketBitsList)
+        {
+            Result r;
+            r.function = function;
+            r.bucketBits = bits;
+            r.numCells = static_cast<uint>(distinctCells.size());
+            r.scalarMHashPerSec = scalar;
+            r.avx2MHashPerSec = avx2;
+            if (distinctCells.empty())
+            {
+                results.push_back(r);
+                continue;
+            }
+
+            const uint64_t numBuckets = 1ull << bits;
+            const uint64_t mask = numBuckets - 1;
+
+            //Home bucket collisions
+            std::vector<uint8_t> homeCount(numBuckets, 0);
+            for (uint32_t h : cellHashes)
+            {
+                uint8_t& c = homeCount[h & mask];
+                if (c < 2) c++;
+            }
+            size_t collidingCells = 0;
+            for (uint32_t h : cellHashes)
+                if (homeCount[h & mask] > 1) collidingCells++;
+            r.collisionRate = double(collidingCells) / distinctCells.size();
+
+            //Insert with the same quadratic probe as the generate shaders
+            std::vector<uint8_t> occupied(numBuckets, 0);
+            uint64_t probeSum = 0;
+            size_t inserted = 0;
+            for (uint32_t h : cellHashes)
+            {
+                uint64_t b = h & mask;
+                for (uint d = 0; d <= quadraticProbeIterations; d++)
+                {
+                    if (!occupied[b])
+                    {
+                        occupied[b] = 1;
+                        probeSum += d;
+                        r.maxProbeLength = std::max(r.maxProbeLength, d);
+                        inserted++;
+                        break;
+                    }
+                    uint step = d + 1;
+                    b = (b + ((step + step * step) >> 1)) & mask;
+                }
+            }
+            r.avgProbeLength = inserted > 0 ? double(probeSum) / inserted : 0.0;
+            r.failedInsertRate = double(distinctCells.size() - inserted) / distinctCells.size();
+
+            //Locality of neighbouring cells, distance on the bucket ring
+            size_t localPairs = 0;
+            for (int axis = 0; axis < 3; axis++)
+                for (size_t i = 0; i < distinctCells.size(); i++)
+                {
+                    uint64_t a = cellHashes[i] & mask;
+                    uint64_t b = neighbourHashes[axis][i] & mask;
+                    uint64_t dist = a > b ? a - b : b - a;
+                    dist = std::min(dist, numBuckets - dist);
+                    if (dist <= localityWindow) localPairs++;
+                }
+            r.neighbourLocality = double(localPairs) / (3.0 * distinctCells.size());
+            results.push_back(r);
+        }
+    }
+
+    ctx.log() << "function,bucketBits,numCells,scalarMHashPerSec,avx2MHashPerSec,collisionRate,avgProbeLength,maxProbeLength,failedInsertRate,neighbourLocality\n";
+    for (const auto& r : results)
+    {
+        ctx.log() << kHashFunctionNames[(uint)r.function] << "," << r.bucketBits << "," << r.numCells << "," << r.scalarMHashPerSec << "," << r.avx2MHashPerSec << ","
+                  << r.collisionRate << "," << r.avgProbeLength << "," << r.maxProbeLength << "," << r.failedInsertRate << "," << r.neighbourLocality << "\n";
+    }
+}
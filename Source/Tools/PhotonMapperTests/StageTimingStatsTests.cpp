@@ -0,0 +1,131 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/StageTimingStats.h"
+
+namespace
+{
+    using Stage = StageTimingStats::Stage;
+    using Clock = StageTimingStats::Clock;
+
+    size_t countLines(const std::string& s)
+    {
+        size_t lines = 0;
+        for (char c : s) lines += c == '\n' ? 1 : 0;
+        return lines;
+    }
+}
+
+CPU_TEST(StageTimingStats_Summary)
+{
+    std::vector<double> values;
+    for (int i = 100; i >= 1; i--) values.push_back(double(i));
+    auto summary = StageTimingStats::computeSummary(values);
+    EXPECT_EQ(summary.count, 100u);
+    EXPECT_EQ(summary.min, 1.0);
+    EXPECT_EQ(summary.max, 100.0);
+    EXPECT_NEAR(summary.mean, 50.5, 1e-9);
+    EXPECT_NEAR(summary.median, 50.5, 1e-9);
+    //Linear interpolation between the closest ranks
+    EXPECT_NEAR(summary.p95, 95.05, 1e-9);
+    EXPECT_NEAR(summary.p99, 99.01, 1e-9);
+
+    auto single = StageTimingStats::computeSummary({ 3.0 });
+    EXPECT_EQ(single.median, 3.0);
+    EXPECT_EQ(single.p99, 3.0);
+    EXPECT_EQ(StageTimingStats::computeSummary({}).count, 0u);
+}
+
+CPU_TEST(StageTimingStats_RollingWindow)
+{
+    StageTimingStats stats(4);
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        stats.addCpuTime(Stage::Generate, 1.0);     //Ignored while disabled
+    }
+    EXPECT(stats.getIterations().empty());
+
+    stats.setEnabled(true);
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        stats.beginIteration(i, 0.1 * i);
+        stats.addCpuTime(Stage::Generate, double(i));
+        stats.addCpuTime(Stage::Generate, 1.0);     //Accumulates
+        if (i % 2 == 0) stats.setGpuTime(Stage::Collect, double(i));
+    }
+    stats.endIteration();
+
+    EXPECT_EQ(stats.getIterations().size(), size_t(10));
+    //Only the last 4 iterations are in the window: 7..10
+    auto cpu = stats.getSummary(Stage::Generate, Clock::Cpu);
+    EXPECT_EQ(cpu.count, 4u);
+    EXPECT_EQ(cpu.min, 7.0);
+    EXPECT_EQ(cpu.max, 10.0);
+    //GPU times of stages that did not run are skipped: 0, 2, 4, 6, 8 -> window 2..8
+    auto gpu = stats.getSummary(Stage::Collect, Clock::Gpu);
+    EXPECT_EQ(gpu.count, 4u);
+    EXPECT_EQ(gpu.min, 2.0);
+    EXPECT_EQ(stats.getSummary(Stage::Sort, Clock::Cpu).count, 0u);
+}
+
+CPU_TEST(StageTimingStats_Export)
+{
+    StageTimingStats stats;
+    stats.setEnabled(true);
+    stats.setMetadata("scene", "test \"scene\"");
+    stats.setMetadata("photons", 1000.0);
+    stats.setMetadata("scene", "replaced");
+    EXPECT_EQ(stats.getMetadata().size(), size_t(2));
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        stats.beginIteration(i, double(i));
+        stats.addCpuTime(Stage::Generate, 2.0);
+        if (i == 1) stats.setCounter("overflows", 5.0);
+    }
+    stats.endIteration();
+
+    const std::string csv = stats.toCsv();
+    //2 metadata comments, the header and one row per iteration
+    EXPECT_EQ(countLines(csv), size_t(6));
+    EXPECT(csv.find("# scene: replaced\n") != std::string::npos);
+    EXPECT(csv.find(",overflows\n") != std::string::npos);
+    //Stages that did not run and counters that were not set stay empty
+    EXPECT(csv.find("\n0,0,,,2,,") != std::string::npos) << csv;
+    EXPECT(csv.find(",,5\n") != std::string::npos) << csv;
+    EXPECT(csv.size() > 3 && csv.compare(csv.size() - 3, 3, ",,\n") == 0) << csv;
+
+    const std::string json = stats.toJson();
+    EXPECT(json.find("\"scene\": \"replaced\"") != std::string::npos);
+    EXPECT(json.find("\"overflows\": 5") != std::string::npos);
+    EXPECT(json.find("\"generate\": { \"cpu\": { \"count\": 3") != std::string::npos) << json;
+
+    stats.clear();
+    EXPECT(stats.getIterations().empty());
+    EXPECT(stats.getCounterNames().empty());
+}
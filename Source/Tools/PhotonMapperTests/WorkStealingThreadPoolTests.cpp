@@ -0,0 +1,78 @@
+/***************************************************************************
+ # Copyright (c) 2015-21, NVIDIA CORPORATION. All rights reserved.
+ #
+ # Redistribution and use in source and binary forms, with or without
+ # modification, are permitted provided that the following conditions
+ # are met:
+ #  * Redistributions of source code must retain the above copyright
+ #    notice, this list of conditions and the following disclaimer.
+ #  * Redistributions in binary form must reproduce the above copyright
+ #    notice, this list of conditions and the following disclaimer in the
+ #    documentation and/or other materials provided with the distribution.
+ #  * Neither the name of NVIDIA CORPORATION nor the names of its
+ #    contributors may be used to endorse or promote products derived
+ #    from this software without specific prior written permission.
+ #
+ # THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS "AS IS" AND ANY
+ # EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ # IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ # PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ # CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ # EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ # PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ # PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ # OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **************************************************************************/
+#include "PhotonMapperTest.h"
+#include "../../RenderPasses/PhotonMapperCommon/WorkStealingThreadPool.h"
+#include <atomic>
+#include <vector>
+
+CPU_TEST(WorkStealingThreadPool_CoversRange)
+{
+    for (uint32_t threads : { 1u, 4u, 0u })
+    {
+        WorkStealingThreadPool pool(threads);
+        EXPECT_GE(pool.getThreadCount(), 1u);
+        if (threads > 0)
+        {
+            EXPECT_EQ(pool.getThreadCount(), threads);
+        }
+
+        for (size_t count : { size_t(0), size_t(1), size_t(1000), size_t(100003) })
+        {
+            for (size_t grain : { size_t(1), size_t(64), size_t(1 << 20) })
+            {
+                std::vector<std::atomic<uint32_t>> visits(count);
+                std::atomic<bool> badThread{ false };
+                pool.parallelFor(count, grain, [&](size_t begin, size_t end, uint32_t threadIndex) {
+                    if (threadIndex >= pool.getThreadCount() || end > count || begin >= end) badThread = true;
+                    for (size_t i = begin; i < end; i++) visits[i]++;
+                });
+
+                EXPECT(!badThread) << "threads " << threads << ", count " << count << ", grain " << grain;
+                size_t wrong = 0;
+                for (auto& v : visits) wrong += v != 1 ? 1 : 0;
+                EXPECT_EQ(wrong, size_t(0)) << "threads " << threads << ", count " << count << ", grain " << grain;
+            }
+        }
+    }
+}
+
+CPU_TEST(WorkStealingThreadPool_Repeated)
+{
+    //Back to back jobs must not pick up chunks of the previous one
+    WorkStealingThreadPool pool(8);
+    std::atomic<uint64_t> sum{ 0 };
+    for (uint32_t job = 0; job < 200; job++)
+    {
+        pool.parallelFor(1000, 7, [&](size_t begin, size_t end, uint32_t) {
+            uint64_t local = 0;
+            for (size_t i = begin; i < end; i++) local += i;
+            sum += local;
+        });
+    }
+    EXPECT_EQ(sum.load(), uint64_t(200) * 999 * 1000 / 2);
+}